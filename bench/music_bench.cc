@@ -0,0 +1,409 @@
+/*
+
+ music_bench.cc - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "general.hh"
+#include "config_file.hh"
+#include "fft_plans.hh"
+#include "mesh.hh"
+#include "random.hh"
+#include "convolution_kernel.hh"
+#include "mg_solver.hh"
+#include "mg_operators.hh"
+#include "mg_interp.hh"
+#include "fd_schemes.hh"
+#include "poisson.hh"
+#include "cosmology.hh"
+#include "output.hh"
+#include "region_generator.hh"
+
+/*!
+ * Synthetic benchmarks of the hot kernels of MUSIC (build target music_bench).
+ *
+ * All inputs are generated from a fixed parameter set and deterministic noise, so
+ * runs are reproducible and comparable between builds. Every benchmark is run once
+ * to warm up (FFT plans, memory pools) and then the given number of times, the
+ * fastest run is reported. Cells/s counts the cells (or particles) processed, GB/s
+ * the bytes of the arrays an operation reads plus those it writes, each once; for
+ * the output plug-ins it is the size of the files written.
+ *
+ * Usage: music_bench [levelmin (7)] [repetitions (3)] [scratch directory ($TMPDIR or /tmp)]
+ */
+
+void store_grid_structure( config_file& cf, const refinement_hierarchy& rh );
+
+namespace
+{
+	//! deterministic noise in [-1,1) for the integer coordinates, independent of the thread layout
+	inline double bench_noise( unsigned long long a, unsigned long long b, unsigned long long c, unsigned long long d )
+	{
+		unsigned long long x = (((a * 0x100000001b3ull + b) * 0x100000001b3ull + c) * 0x100000001b3ull + d) + 0x9e3779b97f4a7c15ull;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+		x = x ^ (x >> 31);
+		return (double)(x >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+	}
+
+	//! a hierarchy with the structure of rh, filled with amplitude times deterministic noise
+	void make_hierarchy( const refinement_hierarchy& rh, grid_hierarchy& gh, unsigned seed, double amplitude )
+	{
+		gh.create_base_hierarchy( rh.levelmin() );
+		for( unsigned ilevel=rh.levelmin()+1; ilevel<=rh.levelmax(); ++ilevel )
+			gh.add_patch( rh.offset(ilevel,0), rh.offset(ilevel,1), rh.offset(ilevel,2),
+						 rh.size(ilevel,0), rh.size(ilevel,1), rh.size(ilevel,2) );
+
+		for( unsigned ilevel=rh.levelmin(); ilevel<=rh.levelmax(); ++ilevel )
+		{
+			meshvar_bnd& g = *gh.get_grid(ilevel);
+			int nx = g.size(0), ny = g.size(1), nz = g.size(2);
+
+			#pragma omp parallel for
+			for( int i=0; i<nx; ++i )
+				for( int j=0; j<ny; ++j )
+					for( int k=0; k<nz; ++k )
+						g(i,j,k) = amplitude * bench_noise( seed+ilevel, i, j, k );
+		}
+	}
+
+	//! number of cells of the levels levelmin..levelmax of gh
+	double count_cells( const grid_hierarchy& gh )
+	{
+		double n = 0.0;
+		for( unsigned ilevel=gh.levelmin(); ilevel<=gh.levelmax(); ++ilevel )
+			n += (double)gh.size(ilevel,0) * (double)gh.size(ilevel,1) * (double)gh.size(ilevel,2);
+		return n;
+	}
+
+	//! fastest of nrep runs of run() after one warm-up run, setup() is called untimed before every run
+	double best_time( unsigned nrep, const std::function<void()>& setup, const std::function<void()>& run )
+	{
+		double tbest = 1e30;
+		for( unsigned irep=0; irep<=nrep; ++irep )
+		{
+			setup();
+			std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+			run();
+			double t = std::chrono::duration<double>( std::chrono::steady_clock::now() - t0 ).count();
+			if( irep > 0 && t < tbest )
+				tbest = t;
+		}
+		return tbest;
+	}
+
+	void report( const std::string& name, double seconds, double cells, double bytes )
+	{
+		printf( "%-36s %10.4f s %12.4e cells/s %9.3f GB/s\n", name.c_str(), seconds, cells/seconds, bytes/seconds*1e-9 );
+		fflush( stdout );
+	}
+
+	//! convolution kernel holding a Gaussian filter, as sampled kernels are applied by convolution::perform
+	class bench_kernel : public convolution::kernel
+	{
+	protected:
+		std::vector<fftw_real> data_;
+
+	public:
+		bench_kernel( config_file& cf, refinement_hierarchy& refh, int n, double boxlength )
+		: convolution::kernel( cf, NULL, refh, total ), data_( (size_t)n*n*2*(n/2+1), 0.0 )
+		{
+			cparam_.nx = cparam_.ny = cparam_.nz = n;
+			cparam_.lx = cparam_.ly = cparam_.lz = boxlength;
+			cparam_.pcf = &cf;
+			cparam_.ptf = NULL;
+			cparam_.coarse_fact = 1;
+			cparam_.deconvolve = false;
+			cparam_.is_finest = true;
+			cparam_.smooth = false;
+
+			int nzp = n/2+1;
+			double sigma2 = (double)n*(double)n/64.0;
+
+			#pragma omp parallel for
+			for( int i=0; i<n; ++i )
+				for( int j=0; j<n; ++j )
+					for( int k=0; k<nzp; ++k )
+					{
+						double kx = (i > n/2)? i-n : i, ky = (j > n/2)? j-n : j;
+						size_t idx = ((size_t)i*n+j)*nzp+k;
+						data_[2*idx] = exp( -0.5*(kx*kx+ky*ky+(double)k*k)/sigma2 );
+					}
+		}
+
+		convolution::kernel *fetch_kernel( int ilevel, bool isolated = false )
+		{	return this;	}
+
+		void *get_ptr()
+		{	return &data_[0];	}
+
+		bool is_ksampled()
+		{	return false;	}
+
+		void at_k( size_t len, const double *in_k, double *out_Tk )
+		{
+			for( size_t i=0; i<len; ++i )
+				out_Tk[i] = 1.0;
+		}
+
+		void deallocate()
+		{ }
+	};
+
+	//! the multigrid solver used for [poisson] laplace_order = 4, with one cycle exposed
+	typedef multigrid::solver< stencil_13P<real_t>, interp_O5_fluxcorr, mg_straight, real_t > bench_solver_base;
+
+	class bench_solver : public bench_solver_base
+	{
+	public:
+		explicit bench_solver( grid_hierarchy& f )
+		: bench_solver_base( f, multigrid::opt::sm_gauss_seidel, 3, 3 )
+		{ }
+
+		//! one V-cycle from the finest level, as performed by every iteration of solve()
+		void cycle( grid_hierarchy& u )
+		{
+			this->m_pu = &u;
+			this->m_levelerr.assign( u.levelmax()+1, 0.0 );
+			this->twoGrid( u.levelmax() );
+		}
+	};
+
+	//! size of the file fname, 0 if there is none
+	double file_size( const std::string& fname )
+	{
+		struct stat st;
+		return (stat( fname.c_str(), &st ) == 0)? (double)st.st_size : 0.0;
+	}
+}
+
+int main( int argc, char **argv )
+{
+	unsigned levelmin = (argc > 1)? atoi( argv[1] ) : 7;
+	unsigned nrep = (argc > 2)? atoi( argv[2] ) : 3;
+	std::string scratch = (argc > 3)? argv[3] : (getenv("TMPDIR") != NULL)? getenv("TMPDIR") : "/tmp";
+
+	if( levelmin < 5 || levelmin > 10 || nrep < 1 )
+	{
+		fprintf( stderr, "Usage: %s [levelmin (5..10, default 7)] [repetitions (default 3)] [scratch directory]\n", argv[0] );
+		return 1;
+	}
+
+	char prefix[256];
+	snprintf( prefix, sizeof(prefix), "%s/music_bench_%d", scratch.c_str(), (int)getpid() );
+	std::string paramfile = std::string(prefix) + ".conf", outfname = std::string(prefix) + ".dat";
+
+	MUSIC::log::setOutput( std::string(prefix) + "_log.txt" );
+	MUSIC::log::setLevel( MUSIC::log::Warning );
+
+	//... the synthetic setup: a 2x refined box over half the volume on top of a 2^levelmin grid
+	{
+		std::ofstream ofs( paramfile.c_str() );
+		ofs << "[setup]\nboxlength = 100\nzstart = 50\n"
+			<< "levelmin = " << levelmin << "\nlevelmin_TF = " << levelmin << "\nlevelmax = " << levelmin+1 << "\n"
+			<< "padding = 8\noverlap = 4\nref_center = 0.5, 0.5, 0.5\nref_extent = 0.5, 0.5, 0.5\n"
+			<< "align_top = no\nbaryons = no\nuse_2LPT = no\nperiodic_TF = yes\n"
+			<< "[cosmology]\nOmega_m = 0.276\nOmega_L = 0.724\nOmega_b = 0.045\nH0 = 70.3\nsigma_8 = 0.811\n"
+			<< "nspec = 0.961\ntransfer = eisenstein\nvfact = 1.0\ndplus = 1.0\npnorm = 1.0\n"
+			<< "[random]\nseed[" << levelmin << "] = 12345\nseed[" << levelmin+1 << "] = 23456\n"
+			<< "[output]\nformat = gadget2\nfilename = " << outfname << "\n"
+			<< "[poisson]\nlaplace_order = 4\ngrad_order = 4\n";
+		if( !ofs )
+		{
+			fprintf( stderr, "Could not write the parameter file \'%s\'\n", paramfile.c_str() );
+			return 1;
+		}
+	}
+
+	config_file cf( paramfile );
+	unlink( paramfile.c_str() );
+
+#if not defined(SINGLETHREAD_FFTW)
+#ifdef FFTW3
+	#ifdef SINGLE_PRECISION
+	fftwf_init_threads();
+	fftwf_plan_with_nthreads(omp_get_max_threads());
+	#else
+	fftw_init_threads();
+	fftw_plan_with_nthreads(omp_get_max_threads());
+	#endif
+#else
+	fftw_threads_init();
+#endif
+#endif
+	fft_plans::initialize( cf );
+
+	the_region_generator = select_region_generator_plugin( cf );
+	refinement_hierarchy rh( cf );
+	store_grid_structure( cf, rh );
+
+	//... the kernels and plug-ins print their progress, which is not wanted here
+	std::ofstream null_stream( "/dev/null" );
+	std::streambuf *cout_buf = std::cout.rdbuf( null_stream.rdbuf() );
+
+	printf( "MUSIC benchmarks, %s precision, %d threads, levelmin %u, best of %u runs\n\n",
+			(sizeof(real_t)==4)? "single" : "double", omp_get_max_threads(), levelmin, nrep );
+
+	const unsigned ntop = 1u << levelmin;
+	const double ncells_top = (double)ntop*ntop*ntop;
+
+	//------------------------------------------------------------------------------
+	//... white noise generation, all cubes are filled once per run
+	//------------------------------------------------------------------------------
+	{
+		const rng_algorithm algorithms[] = { rng_mt19937, rng_philox };
+		const char *names[] = { "random_numbers::fill_cube (mt19937)", "random_numbers::fill_cube (philox)" };
+
+		for( int ialg=0; ialg<2; ++ialg )
+		{
+			random_numbers<real_t>::algorithm_ = algorithms[ialg];
+			double t = best_time( nrep, []{}, [&]{ random_numbers<real_t> rn( ntop, 32, 12345, false ); } );
+			report( names[ialg], t, ncells_top, ncells_top*sizeof(real_t) );
+		}
+		random_numbers<real_t>::algorithm_ = rng_mt19937;
+	}
+
+	//------------------------------------------------------------------------------
+	//... kernel convolutions at several sizes
+	//------------------------------------------------------------------------------
+	for( unsigned n = ntop/4; n <= ntop; n *= 2 )
+	{
+		bench_kernel kern( cf, rh, n, 100.0 );
+		size_t nzp = 2*(n/2+1), ntot = (size_t)n*n*nzp;
+		std::vector<fftw_real> field( ntot );
+
+		double t = best_time( nrep,
+			[&]{
+				#pragma omp parallel for
+				for( int i=0; i<(int)n; ++i )
+					for( size_t j=0; j<n; ++j )
+						for( size_t k=0; k<nzp; ++k )
+							field[((size_t)i*n+j)*nzp+k] = bench_noise( 1, i, j, k );
+			},
+			[&]{ convolution::perform<real_t>( &kern, &field[0], false, false, false ); } );
+
+		char name[64];
+		snprintf( name, sizeof(name), "convolution::perform %u^3", n );
+		report( name, t, (double)n*n*n, 3.0*ntot*sizeof(fftw_real) );
+	}
+
+	//------------------------------------------------------------------------------
+	//... multigrid cycle and grid operators on the two level hierarchy
+	//------------------------------------------------------------------------------
+	grid_hierarchy f( 4 ), u( 4 );
+	make_hierarchy( rh, f, 100, 1.0 );
+	make_hierarchy( rh, u, 200, 0.0 );
+
+	const unsigned lmax = rh.levelmax();
+	const double ncells = count_cells( f );
+	const double ncells_fine = (double)f.size(lmax,0) * f.size(lmax,1) * f.size(lmax,2);
+
+	{
+		bench_solver solver( f );
+		double t = best_time( nrep, [&]{ u.zero(); }, [&]{ solver.cycle( u ); } );
+		report( "multigrid::solver::twoGrid", t, ncells, 3.0*ncells*sizeof(real_t) );
+
+		//... the solver left FAS corrections in f
+		make_hierarchy( rh, f, 100, 1.0 );
+	}
+
+	{
+		mg_straight op;
+		meshvar_bnd& fine = *f.get_grid(lmax);
+		meshvar_bnd& coarse = *u.get_grid(lmax-1);
+		double t;
+
+		t = best_time( nrep, []{}, [&]{ op.restrict( fine, coarse ); } );
+		report( "mg_straight::restrict", t, ncells_fine, 1.125*ncells_fine*sizeof(real_t) );
+
+		t = best_time( nrep, []{}, [&]{ op.prolong( coarse, *u.get_grid(lmax) ); } );
+		report( "mg_straight::prolong", t, ncells_fine, 1.125*ncells_fine*sizeof(real_t) );
+	}
+
+	//------------------------------------------------------------------------------
+	//... hybrid Poisson correction of the finest level and the 2LPT source term
+	//------------------------------------------------------------------------------
+	{
+		meshvar_bnd Df( *f.get_grid(lmax) );
+		double t = best_time( nrep, [&]{ Df = *f.get_grid(lmax); }, [&]{ poisson_hybrid( Df, 0, 4, false, false ); } );
+		report( "poisson_hybrid", t, ncells_fine, 2.0*ncells_fine*sizeof(real_t) );
+	}
+
+	{
+		grid_hierarchy fnew( 4 );
+		double t = best_time( nrep, []{}, [&]{ compute_2LPT_source_FFT( cf, f, fnew ); } );
+		report( "compute_2LPT_source_FFT", t, ncells, 2.0*ncells*sizeof(real_t) );
+	}
+
+	//------------------------------------------------------------------------------
+	//... particle output, including the assembly of the files in finalize()
+	//------------------------------------------------------------------------------
+	{
+		grid_hierarchy D( 4 );
+		make_hierarchy( rh, D, 300, 1e-3 );
+		make_hierarchy( rh, f, 100, 1.0 );
+		f.add_refinement_mask( rh.get_coord_shift() );
+		D.add_refinement_mask( rh.get_coord_shift() );
+
+		const char *formats[] = { "gadget2", "tipsy" };
+		for( int ifmt=0; ifmt<2; ++ifmt )
+		{
+			std::string name = std::string("output ") + formats[ifmt];
+			if( get_output_plugin_map().find( formats[ifmt] ) == get_output_plugin_map().end() )
+			{
+				printf( "%-36s not compiled in\n", name.c_str() );
+				continue;
+			}
+			cf.insertValue( "output", "format", formats[ifmt] );
+
+			double t = best_time( nrep, [&]{ unlink( outfname.c_str() ); },
+				[&]{
+					output_plugin *pout = select_output_plugin( cf );
+					pout->write_dm_mass( f );
+					pout->write_dm_density( f );
+					for( int icoord=0; icoord<3; ++icoord )
+						pout->write_dm_position( icoord, D );
+					for( int icoord=0; icoord<3; ++icoord )
+						pout->write_dm_velocity( icoord, D );
+					pout->finalize();
+					delete pout;
+				} );
+
+			report( name, t, (double)particle_batches( f, f.levelmin(), f.levelmax() ).size(), file_size( outfname ) );
+			unlink( outfname.c_str() );
+		}
+	}
+
+	std::cout.rdbuf( cout_buf );
+
+	delete the_region_generator;
+	fft_plans::finalize();
+	mesh_pool::finalize();
+
+#if defined(FFTW3) and not defined(SINGLETHREAD_FFTW)
+	#ifdef SINGLE_PRECISION
+	fftwf_cleanup_threads();
+	#else
+	fftw_cleanup_threads();
+	#endif
+#endif
+
+	unlink( (std::string(prefix) + "_log.txt").c_str() );
+	return 0;
+}
@@ -0,0 +1,76 @@
+/*
+
+ byte_order.hh - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#ifndef __BYTE_ORDER_HH
+#define __BYTE_ORDER_HH
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+/*!
+ * @brief byte order conversion of whole output buffers
+ *
+ * The conversions work in place on arrays of 4 or 8 byte values and are
+ * written as plain loops over fixed size integers, which the compiler turns
+ * into vector byte shuffles; large buffers are split across the OpenMP threads.
+ */
+namespace byte_order
+{
+	inline bool host_is_big_endian( void )
+	{
+		const uint32_t one = 1;
+		unsigned char c;
+		memcpy( &c, &one, 1 );
+		return c == 0;
+	}
+	
+	inline uint32_t swap32( uint32_t x )
+	{	return (x>>24) | ((x>>8)&0x0000ff00u) | ((x<<8)&0x00ff0000u) | (x<<24);	}
+	
+	inline uint64_t swap64( uint64_t x )
+	{	return ((uint64_t)swap32( (uint32_t)x ) << 32) | swap32( (uint32_t)(x>>32) );	}
+	
+	//! reverse the bytes of n values of size 4 or 8 at p
+	template< typename T >
+	inline void swap( T* p, size_t n )
+	{
+		static_assert( sizeof(T) == 4 || sizeof(T) == 8, "byte_order::swap needs 4 or 8 byte values" );
+		
+		#pragma omp parallel for if( n > 65536 )
+		for( long long i=0; i<(long long)n; ++i )
+		{
+			if( sizeof(T) == 4 )
+			{
+				uint32_t u;
+				memcpy( &u, p+i, 4 );
+				u = swap32( u );
+				memcpy( p+i, &u, 4 );
+			}
+			else
+			{
+				uint64_t u;
+				memcpy( &u, p+i, 8 );
+				u = swap64( u );
+				memcpy( p+i, &u, 8 );
+			}
+		}
+	}
+	
+	//! convert n native values at p to big endian (XDR) order
+	template< typename T >
+	inline void to_big_endian( T* p, size_t n )
+	{
+		if( !host_is_big_endian() )
+			swap( p, n );
+	}
+}
+
+#endif //__BYTE_ORDER_HH
@@ -0,0 +1,371 @@
+/*
+
+ checkpoint.cc - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+
+#include "checkpoint.hh"
+#include "log.hh"
+
+namespace
+{
+	const char checkpoint_magic[8] = { 'M','U','S','I','C','C','K','P' };
+	const unsigned checkpoint_version = 1;
+
+	//! 64bit FNV-1a hash, stable across builds
+	unsigned long long fnv1a( const std::string& s, unsigned long long h = 14695981039346656037ull )
+	{
+		for( size_t i=0; i<s.size(); ++i )
+		{
+			h ^= (unsigned char)s[i];
+			h *= 1099511628211ull;
+		}
+		return h;
+	}
+
+	//! hash of all configuration options but the restart flag
+	unsigned long long config_hash( config_file& cf )
+	{
+		std::ostringstream oss;
+		cf.dump( oss );
+
+		std::istringstream iss( oss.str() );
+		std::string line, all;
+		while( std::getline( iss, line ) )
+			if( line.compare( 0, 14, "setup/restart " ) != 0 )
+				all += line + "\n";
+
+		return fnv1a( all );
+	}
+
+	//! configuration options that do not change the density of a level of given extent
+	bool region_only( const std::string& line )
+	{
+		static const char* prefixes[] = { "output/", "poisson/", "setup/region", "setup/ref_", "setup/async_output" };
+		static const char* keys[] = { "setup/levelmax", "setup/padding", "setup/overlap", "setup/restart",
+			"setup/checkpoint_dir", "setup/spill_dir", "setup/stream_levels", "setup/reuse_density",
+			"setup/overlap_output", "setup/memory_plan_only", "setup/incremental_dir", "setup/use_2LPT", "setup/use_LLA" };
+		
+		for( size_t i=0; i<sizeof(prefixes)/sizeof(prefixes[0]); ++i )
+			if( line.compare( 0, strlen(prefixes[i]), prefixes[i] ) == 0 )
+				return true;
+		
+		std::string key = line.substr( 0, line.find( ' ' ) );
+		for( size_t i=0; i<sizeof(keys)/sizeof(keys[0]); ++i )
+			if( key == keys[i] )
+				return true;
+		return false;
+	}
+	
+	const char level_cache_magic[8] = { 'M','U','S','I','C','L','V','L' };
+	
+	struct level_header
+	{
+		int offset[3];
+		unsigned long long size[3];
+		unsigned long long nbytes;
+	};
+}
+
+stage_checkpoint::stage_checkpoint( config_file& cf )
+: restart_( false ), config_hash_( 0 ), nstage_( 0 )
+{
+	dir_ = cf.getValueSafe<std::string>( "setup", "checkpoint_dir", "" );
+	if( dir_.empty() )
+		return;
+
+	restart_ = cf.getValueSafe<bool>( "setup", "restart", false );
+	config_hash_ = config_hash( cf );
+
+	if( restart_ )
+		read_manifest();
+
+	if( done_.empty() )
+	{
+		//... start a new manifest
+		std::ofstream ofs( manifest_name().c_str(), std::ios::trunc );
+		if( !ofs.good() )
+		{
+			LOGWARN("Could not create checkpoint manifest \'%s\', checkpointing is disabled.", manifest_name().c_str());
+			dir_.clear();
+			return;
+		}
+		ofs << "# MUSIC checkpoint " << std::hex << config_hash_ << std::endl;
+	}
+
+	LOGUSER("Saving stage checkpoints to \'%s\' (%d finished stages found).", dir_.c_str(), (int)done_.size());
+}
+
+std::string stage_checkpoint::manifest_name( void ) const
+{
+	return dir_ + "/manifest";
+}
+
+void stage_checkpoint::read_manifest( void )
+{
+	std::ifstream ifs( manifest_name().c_str() );
+	if( !ifs.good() )
+	{
+		LOGINFO("No checkpoint to restart from in \'%s\'.", dir_.c_str());
+		return;
+	}
+
+	std::string line, tag1, tag2;
+	unsigned long long hash = 0;
+	std::getline( ifs, line );
+	std::istringstream hss( line );
+	hss >> tag1 >> tag2 >> tag2 >> std::hex >> hash;
+
+	if( tag1 != "#" || hash != config_hash_ )
+	{
+		LOGWARN("Checkpoint in \'%s\' was written with a different configuration, it is not used.", dir_.c_str());
+		return;
+	}
+
+	while( std::getline( ifs, line ) )
+	{
+		std::istringstream iss( line );
+		std::string key, file;
+		if( iss >> key >> file )
+			done_[key] = file;
+	}
+}
+
+bool stage_checkpoint::restore( const std::string& name, grid_hierarchy& gh )
+{
+	if( !enabled() )
+		return false;
+
+	//... stage keys are the stage number and its name without blanks
+	std::ostringstream key;
+	key << nstage_++ << "_" << name;
+	current_ = key.str();
+	for( size_t i=0; i<current_.size(); ++i )
+		if( current_[i] == ' ' )
+			current_[i] = '_';
+
+	std::map< std::string, std::string >::const_iterator it = done_.find( current_ );
+	if( it == done_.end() )
+		return false;
+
+	std::string fname = dir_ + "/" + it->second;
+	FILE *fp = fopen( fname.c_str(), "rb" );
+	if( fp == NULL )
+	{
+		LOGWARN("Checkpoint file \'%s\' is missing, stage \'%s\' is recomputed.", fname.c_str(), name.c_str());
+		return false;
+	}
+
+	char magic[8];
+	unsigned head[5]; // version, sizeof(real_t), nbnd, levelmin, levelmax
+	bool ok = fread( magic, sizeof(magic), 1, fp ) == 1 && memcmp( magic, checkpoint_magic, sizeof(magic) ) == 0
+		&& fread( head, sizeof(head), 1, fp ) == 1 && head[0] == checkpoint_version && head[1] == sizeof(real_t)
+		&& head[3] <= head[4];
+
+	std::vector< level_header > lh;
+	if( ok )
+	{
+		lh.resize( head[4]+1 );
+		ok = fread( &lh[0], sizeof(level_header), lh.size(), fp ) == lh.size();
+	}
+
+	if( ok )
+	{
+		//... keep the structure and masks of gh if it matches the stored one
+		bool same = gh.levelmax() == head[4] && gh.levelmin() == head[3] && gh.m_nbnd == head[2];
+		for( unsigned ilevel=0; same && ilevel<=head[4]; ++ilevel )
+			for( int d=0; d<3; ++d )
+				same &= gh.offset( ilevel, d ) == lh[ilevel].offset[d] && gh.size( ilevel, d ) == lh[ilevel].size[d];
+
+		if( !same )
+		{
+			grid_hierarchy tmp( head[2] );
+			tmp.create_base_hierarchy( head[3] );
+			for( unsigned ilevel=head[3]+1; ilevel<=head[4]; ++ilevel )
+				tmp.add_patch( lh[ilevel].offset[0], lh[ilevel].offset[1], lh[ilevel].offset[2],
+							   lh[ilevel].size[0], lh[ilevel].size[1], lh[ilevel].size[2] );
+			gh = std::move( tmp );
+		}
+
+		for( unsigned ilevel=0; ok && ilevel<=head[4]; ++ilevel )
+		{
+			MeshvarBnd<real_t> *g = gh.get_grid( ilevel );
+			ok = g->nbytes() == lh[ilevel].nbytes && fread( g->get_ptr(), 1, g->nbytes(), fp ) == g->nbytes();
+		}
+	}
+	fclose( fp );
+
+	if( !ok )
+	{
+		LOGWARN("Checkpoint file \'%s\' is damaged, stage \'%s\' is recomputed.", fname.c_str(), name.c_str());
+		return false;
+	}
+
+	std::cout << " - Restored stage \'" << name << "\' from checkpoint." << std::endl;
+	LOGUSER("Restored stage \'%s\' from checkpoint file \'%s\'.", name.c_str(), fname.c_str());
+	return true;
+}
+
+void stage_checkpoint::save( const grid_hierarchy& gh )
+{
+	if( !enabled() || current_.empty() )
+		return;
+
+	std::string file = current_ + ".bin", fname = dir_ + "/" + file, ftmp = fname + ".tmp";
+	FILE *fp = fopen( ftmp.c_str(), "wb" );
+	if( fp == NULL )
+	{
+		LOGWARN("Could not write checkpoint file \'%s\'.", ftmp.c_str());
+		return;
+	}
+
+	unsigned head[5] = { checkpoint_version, (unsigned)sizeof(real_t), (unsigned)gh.m_nbnd, gh.levelmin(), gh.levelmax() };
+	std::vector< level_header > lh( gh.levelmax()+1 );
+	for( unsigned ilevel=0; ilevel<=gh.levelmax(); ++ilevel )
+	{
+		for( int d=0; d<3; ++d )
+		{
+			lh[ilevel].offset[d] = gh.offset( ilevel, d );
+			lh[ilevel].size[d] = gh.size( ilevel, d );
+		}
+		lh[ilevel].nbytes = gh.get_grid( ilevel )->nbytes();
+	}
+
+	bool ok = fwrite( checkpoint_magic, sizeof(checkpoint_magic), 1, fp ) == 1
+		&& fwrite( head, sizeof(head), 1, fp ) == 1
+		&& fwrite( &lh[0], sizeof(level_header), lh.size(), fp ) == lh.size();
+
+	for( unsigned ilevel=0; ok && ilevel<=gh.levelmax(); ++ilevel )
+	{
+		const MeshvarBnd<real_t> *g = gh.get_grid( ilevel );
+		ok = fwrite( g->get_ptr(), 1, g->nbytes(), fp ) == g->nbytes();
+	}
+	ok &= fclose( fp ) == 0;
+
+	//... the stage only counts as finished once file and manifest entry are complete
+	if( ok )
+		ok = rename( ftmp.c_str(), fname.c_str() ) == 0;
+
+	if( ok )
+	{
+		std::ofstream ofs( manifest_name().c_str(), std::ios::app );
+		ofs << current_ << " " << file << std::endl;
+		ok = ofs.good();
+	}
+
+	if( !ok )
+	{
+		LOGWARN("Could not write checkpoint file \'%s\'.", fname.c_str());
+		remove( ftmp.c_str() );
+		return;
+	}
+
+	done_[current_] = file;
+	LOGUSER("Saved stage \'%s\' to checkpoint file \'%s\'.", current_.c_str(), fname.c_str());
+	current_.clear();
+}
+
+/*****************************************************************************************************/
+
+level_cache::level_cache( config_file& cf )
+: config_hash_( 0 )
+{
+	dir_ = cf.getValueSafe<std::string>( "setup", "incremental_dir", "" );
+	if( dir_.empty() )
+		return;
+	
+	std::ostringstream oss;
+	cf.dump( oss );
+	
+	std::istringstream iss( oss.str() );
+	std::string line, all;
+	while( std::getline( iss, line ) )
+		if( !region_only( line ) )
+			all += line + "\n";
+	
+	config_hash_ = fnv1a( all );
+	LOGUSER("Caching convolved density levels in '%s'.", dir_.c_str());
+}
+
+std::string level_cache::file_name( const std::string& field, unsigned ilevel ) const
+{
+	std::ostringstream oss;
+	oss << dir_ << "/";
+	for( size_t i=0; i<field.size(); ++i )
+		oss << (field[i]==' '? '_' : field[i]);
+	oss << "_level" << ilevel << ".bin";
+	return oss.str();
+}
+
+unsigned long long level_cache::key( const std::string& field, const refinement_hierarchy& refh, unsigned ilevel ) const
+{
+	std::ostringstream oss;
+	oss << field << " " << sizeof(real_t) << " " << refh.levelmin() << "\n";
+	for( unsigned l=refh.levelmin(); l<=ilevel; ++l )
+		oss << l << " " << refh.offset(l,0) << " " << refh.offset(l,1) << " " << refh.offset(l,2)
+			<< " " << refh.size(l,0) << " " << refh.size(l,1) << " " << refh.size(l,2) << "\n";
+	return fnv1a( oss.str(), config_hash_ );
+}
+
+bool level_cache::restore( const std::string& field, unsigned ilevel, unsigned long long key, real_t *data, size_t n )
+{
+	if( !enabled() )
+		return false;
+	
+	FILE *fp = fopen( file_name( field, ilevel ).c_str(), "rb" );
+	if( fp == NULL )
+		return false;
+	
+	char magic[8];
+	unsigned long long head[2]; // key, number of values
+	bool ok = fread( magic, sizeof(magic), 1, fp ) == 1 && memcmp( magic, level_cache_magic, sizeof(magic) ) == 0
+		&& fread( head, sizeof(head), 1, fp ) == 1 && head[0] == key && head[1] == n
+		&& fread( data, sizeof(real_t), n, fp ) == n;
+	fclose( fp );
+	
+	if( ok )
+	{
+		std::cout << " - Reusing cached level " << ilevel << " of " << field << "..." << std::endl;
+		LOGUSER("Reusing cached level %d of %s.", ilevel, field.c_str());
+	}
+	return ok;
+}
+
+void level_cache::save( const std::string& field, unsigned ilevel, unsigned long long key, const real_t *data, size_t n )
+{
+	if( !enabled() )
+		return;
+	
+	std::string fname = file_name( field, ilevel ), ftmp = fname + ".tmp";
+	FILE *fp = fopen( ftmp.c_str(), "wb" );
+	if( fp == NULL )
+	{
+		LOGWARN("Could not write level cache file '%s'.", ftmp.c_str());
+		return;
+	}
+	
+	unsigned long long head[2] = { key, (unsigned long long)n };
+	bool ok = fwrite( level_cache_magic, sizeof(level_cache_magic), 1, fp ) == 1
+		&& fwrite( head, sizeof(head), 1, fp ) == 1
+		&& fwrite( data, sizeof(real_t), n, fp ) == n;
+	ok &= fclose( fp ) == 0;
+	
+	if( ok )
+		ok = rename( ftmp.c_str(), fname.c_str() ) == 0;
+	
+	if( !ok )
+	{
+		LOGWARN("Could not write level cache file '%s'.", fname.c_str());
+		remove( ftmp.c_str() );
+	}
+}
@@ -0,0 +1,100 @@
+/*
+
+ checkpoint.hh - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#ifndef __CHECKPOINT_HH
+#define __CHECKPOINT_HH
+
+#include <string>
+#include <map>
+
+#include "general.hh"
+#include "config_file.hh"
+#include "mesh.hh"
+
+/*!
+ * @class stage_checkpoint
+ * @brief saves the hierarchies completed by driver stages and restores them on restart
+ *
+ * With [setup] checkpoint_dir set, every stage saved with save() is written to
+ * a binary file in that directory and recorded in the file 'manifest' there.
+ * When the run is started again with [setup] restart = yes and an unchanged
+ * configuration, restore() reads the hierarchy back instead of having the
+ * stage recomputed. Stages are matched by their order and name, so the driver
+ * has to call restore() for a stage before it computes and saves it.
+ */
+class stage_checkpoint
+{
+protected:
+	std::string dir_;
+	bool restart_;
+	unsigned long long config_hash_;
+	unsigned nstage_;
+	std::map< std::string, std::string > done_;		//!< stage key -> file name of finished stages
+	std::string current_;
+
+	std::string manifest_name( void ) const;
+	void read_manifest( void );
+
+public:
+	explicit stage_checkpoint( config_file& cf );
+
+	//! true if stages are saved
+	bool enabled( void ) const
+	{	return !dir_.empty();	}
+
+	//! begin the next stage, reads its hierarchy into gh and returns true if it was finished before
+	/*! with a hierarchy of the same structure in gh only the data is replaced, so its refinement
+	 *  mask is kept, otherwise the levels are recreated without mask
+	 */
+	bool restore( const std::string& name, grid_hierarchy& gh );
+
+	//! save the hierarchy of the stage begun by the last restore() call
+	void save( const grid_hierarchy& gh );
+};
+
+/*!
+ * @class level_cache
+ * @brief keeps convolved density levels on disk for zoom iterations
+ *
+ * With [setup] incremental_dir set, the noise convolution stores every level it
+ * computes in that directory. A level is keyed by the configuration without the
+ * options that only describe the refinement region or the output, and by the
+ * extents of all levels up to it, so a run that only moves or reshapes the zoom
+ * region reads back the levels whose extent (and those of the coarser levels)
+ * did not change, and recomputes only the others. Only the convolved levels are
+ * cached: the white noise is still generated (or read from its own cache) for
+ * every level, reading a level back replaces its kernel and convolution.
+ */
+class level_cache
+{
+protected:
+	std::string dir_;
+	unsigned long long config_hash_;
+	
+	std::string file_name( const std::string& field, unsigned ilevel ) const;
+	
+public:
+	explicit level_cache( config_file& cf );
+	
+	//! true if levels are cached
+	bool enabled( void ) const
+	{	return !dir_.empty();	}
+	
+	//! key of level ilevel of a field, depends on the extents of the levels up to ilevel
+	unsigned long long key( const std::string& field, const refinement_hierarchy& refh, unsigned ilevel ) const;
+	
+	//! read n values of the level into data, false if there is no valid entry for key
+	bool restore( const std::string& field, unsigned ilevel, unsigned long long key, real_t *data, size_t n );
+	
+	//! store n values of the level, replacing an entry with a different key
+	void save( const std::string& field, unsigned ilevel, unsigned long long key, const real_t *data, size_t n );
+};
+
+#endif //__CHECKPOINT_HH
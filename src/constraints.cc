@@ -10,48 +10,13 @@
 
 #include "constraints.hh"
 
-double dsigma2_tophat( double k, void *params );
-double dsigma2_gauss( double k, void *params );
 double find_coll_z( const std::vector<double>& z, const std::vector<double>& sigma, double nu );
 void compute_sigma_tophat( config_file& cf, transfer_function *ptf, double R, std::vector<double>& z, std::vector<double>& sigma );
 void compute_sigma_gauss( config_file& cf, transfer_function *ptf, double R, std::vector<double>& z, std::vector<double>& sigma );
+void compute_sigma_z( config_file& cf, transfer_function *ptf, double R, CosmoCalc::window_type w, std::vector<double>& z, std::vector<double>& sigma );
 
 
 
-double dsigma2_tophat( double k, void *pparams )
-{
-	if( k<=0.0 )
-		return 0.0;
-	
-	char **params = reinterpret_cast<char**> (pparams);
-	
-	transfer_function *ptf = reinterpret_cast<transfer_function*>(params[0]);
-	double x = k * *reinterpret_cast<double*>(params[1]);
-	double nspect = *reinterpret_cast<double*>(params[2]);
-	
-	double w = 3.0*(sin(x)-x*cos(x))/(x*x*x);
-	
-	double tfk = ptf->compute(k,total);
-	return k*k * w*w * pow(k,nspect) * tfk*tfk;
-}
-
-double dsigma2_gauss( double k, void *pparams )
-{
-	if( k<=0.0 )
-		return 0.0;
-	
-	char **params = reinterpret_cast<char**> (pparams);
-	
-	transfer_function *ptf = reinterpret_cast<transfer_function*> (params[0]);
-	double x = k * *reinterpret_cast<double*>(params[1]);
-	double nspect = *reinterpret_cast<double*>(params[2]);
-	
-	double w = exp(-x*x*0.5);
-	
-	double tfk = ptf->compute(k,total);
-	return k*k * w*w * pow(k,nspect) * tfk*tfk;
-}
-
 double find_coll_z( const std::vector<double>& z, const std::vector<double>& sigma, double nu )
 {
 	double dcoll = 1.686/nu;
@@ -71,7 +36,8 @@ double find_coll_z( const std::vector<double>& z, const std::vector<double>& sig
 }
 
 
-void compute_sigma_tophat( config_file& cf, transfer_function *ptf, double R, std::vector<double>& z, std::vector<double>& sigma )
+//! linear rms fluctuation in window w of radius R for a range of redshifts z, normalized to sigma_8
+void compute_sigma_z( config_file& cf, transfer_function *ptf, double R, CosmoCalc::window_type w, std::vector<double>& z, std::vector<double>& sigma )
 {
 	z.clear();
 	sigma.clear();
@@ -81,82 +47,32 @@ void compute_sigma_tophat( config_file& cf, transfer_function *ptf, double R, st
 	
 	double zmin = 0.0, zmax = 200.0;
 	int nz = 100;
+	std::vector<double> a, Dz( nz );
 	for( int i=0; i <nz; ++i )
+	{
 		z.push_back( zmax - i*(zmax-zmin)/(nz-1.0) );
+		a.push_back( 1./(1.+z.back()) );
+	}
 	
 	double D0 = ccalc.CalcGrowthFactor(1.0);
+	ccalc.CalcGrowthFactor( &a[0], &Dz[0], nz );
 
 	double sigma8 = cf.getValue<double>("cosmology","sigma_8"); 
-	double nspec = cf.getValue<double>("cosmology","nspec");
-	
-	double sigma0 = 0.0;
-	{
-		double eight=8.0;
-
-		char *params[3];
-		params[0] = reinterpret_cast<char*> (ptf);
-		params[1] = reinterpret_cast<char*> (&eight);
-		params[2] = reinterpret_cast<char*> (&nspec);
-		
-		sigma0 = sqrt(4.0*M_PI*integrate( &dsigma2_tophat, 1e-4, 1e4, reinterpret_cast<void*>(params) ));
-	}
+	double sigma0 = ccalc.ComputeSigma( 8.0, CosmoCalc::tophat_window );
+	double sig    = ccalc.ComputeSigma( R, w );
 	
 	for( int i=0; i <nz; ++i )
-	{
-		void *params[3];
-		params[0] = reinterpret_cast<char*> (ptf);
-		params[1] = reinterpret_cast<char*> (&R);
-		params[2] = reinterpret_cast<char*> (&nspec);
-		
-		double sig = sqrt(4.0*M_PI*integrate( &dsigma2_tophat, 1e-4, 1e4, reinterpret_cast<void*>(params) ));
-		double Dz  = ccalc.CalcGrowthFactor(1./(1.+z[i]));
-		sigma.push_back( sig*sigma8/sigma0*Dz/D0 );
-	}
+		sigma.push_back( sig*sigma8/sigma0*Dz[i]/D0 );
+}
+
+void compute_sigma_tophat( config_file& cf, transfer_function *ptf, double R, std::vector<double>& z, std::vector<double>& sigma )
+{
+	compute_sigma_z( cf, ptf, R, CosmoCalc::tophat_window, z, sigma );
 }
 
 void compute_sigma_gauss( config_file& cf, transfer_function *ptf, double R, std::vector<double>& z, std::vector<double>& sigma )
 {
-	z.clear();
-	sigma.clear();
-	
-	cosmology cosm( cf );
-	CosmoCalc ccalc( cosm, ptf );
-	
-	double zmin = 0.0, zmax = 200.0;
-	int nz = 100;
-	for( int i=0; i <nz; ++i )
-		z.push_back( zmax - i*(zmax-zmin)/(nz-1.0) );
-	
-	double D0 = ccalc.CalcGrowthFactor(1.0);
-	
-	double sigma8 = cf.getValue<double>("cosmology","sigma_8"); 
-	double nspec = cf.getValue<double>("cosmology","nspec");
-	
-	double sigma0 = 0.0;
-	{
-		double eight=8.0;
-		
-		char *params[3];
-		params[0] = reinterpret_cast<char*> (ptf);
-		params[1] = reinterpret_cast<char*> (&eight);
-		params[2] = reinterpret_cast<char*> (&nspec);
-		
-		sigma0 = sqrt(4.0*M_PI*integrate( &dsigma2_tophat, 1e-4, 1e4, reinterpret_cast<void*>(params) ));
-	}
-	
-	for( int i=0; i <nz; ++i )
-	{
-		void *params[3];
-		params[0] = reinterpret_cast<char*> (ptf);
-		params[1] = reinterpret_cast<char*> (&R);
-		params[2] = reinterpret_cast<char*> (&nspec);
-		
-		double sig = sqrt(4.0*M_PI*integrate( &dsigma2_gauss, 1e-4, 1e4, reinterpret_cast<void*>(params) ));
-		double Dz  = ccalc.CalcGrowthFactor(1./(1.+z[i]));
-		
-		//std::cerr << z[i] << "    " << sig << std::endl;
-		sigma.push_back( sig*sigma8/sigma0*Dz/D0 );
-	}
+	compute_sigma_z( cf, ptf, R, CosmoCalc::gauss_window, z, sigma );
 }
 
 
@@ -267,6 +183,42 @@ constraint_set::constraint_set( config_file& cf, transfer_function *ptf )
 }
 
 
+void constraint_set::constr_kernel_factors( size_t nx, size_t ny, size_t nzp, std::vector< std::complex<double> >& ex,
+											std::vector< std::complex<double> >& ey, std::vector< std::complex<double> >& ez )
+{
+	size_t nconstr = cset_.size();
+	
+	ex.resize( nx*nconstr );
+	ey.resize( ny*nconstr );
+	ez.resize( nzp*nconstr );
+	
+	//... exp(-k^2 R^2/2 + i k.x) = prod_d exp(-k_d^2 R^2/2 + i k_d x_d), wave numbers in units of 2pi/nx as in eval_constr
+	for( size_t i=0; i<nconstr; ++i )
+	{
+		const constraint& c = cset_[i];
+		
+		for( size_t ix=0; ix<nx; ++ix )
+		{
+			double kk(ix); if( kk > nx/2 ) kk-=nx;
+			kk *= 2.0*M_PI/nx;
+			ex[ix*nconstr+i] = std::polar( exp(-kk*kk*c.gRg2/2.0), kk*c.gx );
+		}
+		for( size_t iy=0; iy<ny; ++iy )
+		{
+			double kk(iy); if( kk > ny/2 ) kk-=ny;
+			kk *= 2.0*M_PI/nx;
+			ey[iy*nconstr+i] = std::polar( exp(-kk*kk*c.gRg2/2.0), kk*c.gy );
+		}
+		for( size_t iz=0; iz<nzp; ++iz )
+		{
+			double kk(iz);
+			kk *= 2.0*M_PI/nx;
+			ez[iz*nconstr+i] = std::polar( exp(-kk*kk*c.gRg2/2.0), kk*c.gz );
+		}
+	}
+}
+
+
 void constraint_set::wnoise_constr_corr( double dx, size_t nx, size_t ny, size_t nz, std::vector<double>& g0, matrix& cinv, fftw_complex* cw )
 {
 	double lsub = nx*dx;
@@ -279,19 +231,6 @@ void constraint_set::wnoise_constr_corr( double dx, size_t nx, size_t ny, size_t
 	size_t nconstr = cset_.size();
 	size_t nzp=nz/2+1;
 	
-	
-	
-	/*for( size_t i=0; i<nconstr; ++i )
-	 for( size_t j=0; j<nconstr; ++j )
-	 {
-	 std::cerr << "fact    = " << (cset_[j].sigma-g0[j])*cinv(i,j) << "\n";
-	 std::cerr << "g(j)    = " << cset_[j].sigma << "\n";
-	 std::cerr << "g0(j)   = " << g0[j] << "\n";
-	 std::cerr << "qinv    = " << cinv(i,j) << "\n";
-	 }
-	 */
-	
-	
 	double chisq = 0.0, chisq0 = 0.0;
 	for( size_t i=0; i<nconstr; ++i )
 		for( size_t j=0; j<nconstr; ++j )
@@ -301,11 +240,21 @@ void constraint_set::wnoise_constr_corr( double dx, size_t nx, size_t ny, size_t
 		}
 	LOGINFO("Chi squared for the constraints:\n       sampled = %f, desired = %f", chisq0, chisq );
 	
+	//... the correction is sum_ij (sigma_j-g0_j) cinv_ij C_i(k) sqrt(P(k)), contract over j once
+	std::vector<double> alpha(nconstr,0.0);
+	for( size_t i=0; i<nconstr; ++i )
+		for( size_t j=0; j<nconstr; ++j )
+			alpha[i] += cinv(i,j)*(cset_[j].sigma-g0[j]);
+	
+	std::vector< std::complex<double> > ex, ey, ez;
+	constr_kernel_factors( nx, ny, nzp, ex, ey, ez );
+	
 	std::vector<double> sigma(nconstr,0.0);
 	
 	#pragma omp parallel 
 	{
 		std::vector<double> sigma_loc(nconstr,0.0);
+		std::vector< std::complex<double> > cxy(nconstr), ck(nconstr);
 		
 		#pragma omp for 
 		for( int ix=0; ix<(int)nx; ++ix )
@@ -317,6 +266,10 @@ void constraint_set::wnoise_constr_corr( double dx, size_t nx, size_t ny, size_t
 			{	
 				double iiy(iy); if( iiy > ny/2 ) iiy-=ny;
 				iiy *= 2.0*M_PI/nx;
+				
+				for( size_t i=0; i<nconstr; ++i )
+					cxy[i] = ex[ix*nconstr+i]*ey[iy*nconstr+i];
+				
 				for( size_t iz=0; iz<nzp; ++iz )
 				{
 					double iiz(iz);
@@ -331,29 +284,22 @@ void constraint_set::wnoise_constr_corr( double dx, size_t nx, size_t ny, size_t
 					
 					double fac = sqrt(Pk);
 					
-					for( unsigned i=0; i<nconstr; ++i )
-						for( unsigned j=0; j<=i; ++j )
-						{
-							std::complex<double> 
-							ci = eval_constr(i,iix,iiy,iiz),
-							cj = eval_constr(j,iix,iiy,iiz);
-							
-							RE(cw[q]) += (cset_[j].sigma-g0[j])*cinv(i,j) * std::real(ci)*fac;
-							IM(cw[q]) += (cset_[j].sigma-g0[j])*cinv(i,j) * std::imag(ci)*fac;
-							
-							if( i!=j )
-							{
-								RE(cw[q]) += (cset_[i].sigma-g0[i])*cinv(j,i) * std::real(cj)*fac;
-								IM(cw[q]) += (cset_[i].sigma-g0[i])*cinv(j,i) * std::imag(cj)*fac;								
-							}
-							else
-							{
-								if( iz>0&&iz<nz/2 )
-									sigma_loc[i] += 2.0*std::real(std::conj(ci)*std::complex<double>(RE(cw[q]),IM(cw[q])))*fac;
-								else
-									sigma_loc[i] += std::real(std::conj(ci)*std::complex<double>(RE(cw[q]),IM(cw[q])))*fac;
-							}
-						}
+					std::complex<double> corr(0.0,0.0);
+					for( size_t i=0; i<nconstr; ++i )
+					{
+						ck[i] = cxy[i]*ez[iz*nconstr+i];
+						corr += alpha[i]*ck[i];
+					}
+					
+					RE(cw[q]) += std::real(corr)*fac;
+					IM(cw[q]) += std::imag(corr)*fac;
+					
+					//... measure the constraints in the corrected noise
+					std::complex<double> ccw(RE(cw[q]),IM(cw[q]));
+					double wfac = (iz>0&&iz<nz/2)? 2.0*fac : fac;
+					
+					for( size_t i=0; i<nconstr; ++i )
+						sigma_loc[i] += std::real(std::conj(ck[i])*ccw)*wfac;
 				}
 				
 			}
@@ -374,24 +320,31 @@ void constraint_set::wnoise_constr_corr( double dx, size_t nx, size_t ny, size_t
 
 
 
-void constraint_set::wnoise_constr_corr( double dx, fftw_complex* cw, size_t nx, size_t ny, size_t nz, std::vector<double>& g0 )
+void constraint_set::icov_constr( double dx, const fftw_complex* cw, size_t nx, size_t ny, size_t nz, std::vector<double>& g0, matrix& cij )
 {
 	size_t nconstr = cset_.size();
 	size_t nzp=nz/2+1;
 	
-	g0.assign(nconstr,0.0);
-	
 	double pnorm = pcf_->getValue<double>("cosmology","pnorm");
 	double nspec = pcf_->getValue<double>("cosmology","nspec");
 	pnorm *= dplus0_*dplus0_;
+	
 	double lsub = nx*dx;
 	double dk = 2.0*M_PI/lsub, d3k=dk*dk*dk;
 	
-	for( size_t i=0; i<nconstr; ++i )
+	std::vector< std::complex<double> > ex, ey, ez;
+	constr_kernel_factors( nx, ny, nzp, ex, ey, ez );
+	
+	//... lower triangle of the covariance matrix, and the constraint values in the noise
+	std::vector<double> c( nconstr*nconstr, 0.0 );
+	g0.assign(nconstr,0.0);
+	
+	#pragma omp parallel
 	{
-		double gg = 0.0;
+		std::vector<double> c_loc( nconstr*nconstr, 0.0 ), g0_loc( nconstr, 0.0 );
+		std::vector< std::complex<double> > cxy(nconstr), ck(nconstr);
 		
-		#pragma omp parallel for reduction(+:gg)
+		#pragma omp for
 		for( int ix=0; ix<(int)nx; ++ix )
 		{	
 			double iix(ix); if( iix > nx/2 ) iix-=nx;
@@ -401,6 +354,10 @@ void constraint_set::wnoise_constr_corr( double dx, fftw_complex* cw, size_t nx,
 			{	
 				double iiy(iy); if( iiy > ny/2 ) iiy-=ny;
 				iiy *= 2.0*M_PI/nx;
+				
+				for( size_t i=0; i<nconstr; ++i )
+					cxy[i] = ex[ix*nconstr+i]*ey[iy*nconstr+i];
+				
 				for( size_t iz=0; iz<nzp; ++iz )
 				{
 					double iiz(iz);
@@ -408,90 +365,44 @@ void constraint_set::wnoise_constr_corr( double dx, fftw_complex* cw, size_t nx,
 					
 					double k = sqrt(iix*iix+iiy*iiy+iiz*iiz)*(double)nx/lsub;
 					double T = ptf_->compute(k,total);
-					
-					std::complex<double> v(std::conj(eval_constr(i,iix,iiy,iiz)));
-					
-					v *= sqrt(pnorm*pow(k,nspec)*T*T*d3k);
-					
-					
-					if( iz>0&&iz<nz/2)
-						v*=2;
+					double Pk = pnorm * pow(k,nspec) * T * T * d3k;
 					
 					size_t q = ((size_t)ix*ny+(size_t)iy)*nzp+(size_t)iz;
-
 					std::complex<double> ccw(RE(cw[q]),IM(cw[q]));
-
-					gg += std::real(v*ccw);
 					
+					//... the measurement is weighted with sqrt(P(k)), the covariance with P(k),
+					//... modes with a conjugate not stored count twice
+					double w = (iz>0&&iz<nz/2)? 2.0 : 1.0;
+					double gfac = w*sqrt(Pk), cfac = w*Pk;
+					
+					for( size_t i=0; i<nconstr; ++i )
+					{
+						ck[i] = cxy[i]*ez[iz*nconstr+i];
+						g0_loc[i] += std::real(std::conj(ck[i])*ccw)*gfac;
+						
+						for( size_t j=0; j<=i; ++j )
+							c_loc[i*nconstr+j] += std::real(std::conj(ck[i])*ck[j])*cfac;
+					}
 				}
 			}
 		}
 		
-		g0[i] = gg;
+		#pragma omp critical
+		{
+			for( size_t i=0; i<nconstr*nconstr; ++i )
+				c[i] += c_loc[i];
+			for( size_t i=0; i<nconstr; ++i )
+				g0[i] += g0_loc[i];
+		}
 	}
-}
-
-
-
-
-void constraint_set::icov_constr( double dx, size_t nx, size_t ny, size_t nz, matrix& cij )
-{
-	size_t nconstr = cset_.size();
-	size_t nzp=nz/2+1;
-	
-	double pnorm = pcf_->getValue<double>("cosmology","pnorm");
-	double nspec = pcf_->getValue<double>("cosmology","nspec");
-	pnorm *= dplus0_*dplus0_;
 	
+	//... the matrix is symmetric, fill in the upper triangle
 	cij		= matrix(nconstr,nconstr);
-	
-	double lsub = nx*dx;
-	double dk = 2.0*M_PI/lsub, d3k=dk*dk*dk;
-	
-	//... compute lower triangle of covariance matrix
-	//... and fill in upper triangle
-	for( unsigned i=0; i<nconstr; ++i )
-		for( unsigned j=0; j<=i; ++j )
-		{
-			
-			float c1(0.0), c2(0.0);
-			
-#pragma omp parallel for reduction(+:c1,c2)
-			for( int ix=0; ix<(int)nx; ++ix )
-			{	
-				double iix(ix); if( iix > nx/2 ) iix-=nx;
-				iix *= 2.0*M_PI/nx;
-				
-				for( size_t iy=0; iy<ny; ++iy )
-				{	
-					double iiy(iy); if( iiy > ny/2 ) iiy-=ny;
-					iiy *= 2.0*M_PI/nx;
-					for( size_t iz=0; iz<nzp; ++iz )
-					{
-						double iiz(iz);
-						iiz *= 2.0*M_PI/nx;
-						
-						double k = sqrt(iix*iix+iiy*iiy+iiz*iiz)*(double)nx/lsub;
-						double T = ptf_->compute(k,total);
-						std::complex<double> v(std::conj(eval_constr(i,iix,iiy,iiz)));
-						v *= eval_constr(j,iix,iiy,iiz);
-						v *= pnorm * pow(k,nspec) * T * T * d3k;
-						
-						if( iz>0&&iz<nz/2)
-							v*=2;
-						
-						c1 += std::real(v);
-						c2 += std::real(std::conj(v));
-					}
-				}
-			}
-			
-			cij(i,j) = c1;
-			cij(j,i) = c2;
-		}
+	for( size_t i=0; i<nconstr; ++i )
+		for( size_t j=0; j<=i; ++j )
+			cij(i,j) = cij(j,i) = c[i*nconstr+j];
 	
 	//... invert convariance matrix
 	cij.invert();
 	
 }
-
@@ -18,6 +18,7 @@
 
 #include "general.hh"
 #include "config_file.hh"
+#include "fft_plans.hh"
 #include "transfer_function.hh"
 #include "cosmology.hh"
 
@@ -142,20 +143,21 @@ protected:
 	//! apply constraints to the white noise
 	void wnoise_constr_corr( double dx, size_t nx, size_t ny, size_t nz, std::vector<double>& g0, matrix& cinv, fftwf_complex* cw );
 	
-	//! measure sigma for each constraint in the unconstrained noise
-	void wnoise_constr_corr( double dx, fftwf_complex* cw, size_t nx, size_t ny, size_t nz, std::vector<double>& g0 );
+	//! measure sigma for each constraint in the unconstrained noise and the inverse covariance between the constraints
+	void icov_constr( double dx, const fftwf_complex* cw, size_t nx, size_t ny, size_t nz, std::vector<double>& g0, matrix& cij );
 	
 #else
 	//! apply constraints to the white noise
 	void wnoise_constr_corr( double dx, size_t nx, size_t ny, size_t nz, std::vector<double>& g0, matrix& cinv, fftw_complex* cw );
 	
-	//! measure sigma for each constraint in the unconstrained noise
-	void wnoise_constr_corr( double dx, fftw_complex* cw, size_t nx, size_t ny, size_t nz, std::vector<double>& g0 );
+	//! measure sigma for each constraint in the unconstrained noise and the inverse covariance between the constraints
+	void icov_constr( double dx, const fftw_complex* cw, size_t nx, size_t ny, size_t nz, std::vector<double>& g0, matrix& cij );
 	
 #endif
 	
-	//! compute the covariance between the constraints
-	void icov_constr( double dx, size_t nx, size_t ny, size_t nz, matrix& cij );
+	//! factors of the constraint kernels along each axis, eval_constr(i,k) = ex[ix*n+i]*ey[iy*n+i]*ez[iz*n+i] for n constraints
+	void constr_kernel_factors( size_t nx, size_t ny, size_t nzp, std::vector< std::complex<double> >& ex,
+							   std::vector< std::complex<double> >& ey, std::vector< std::complex<double> >& ez );
 	
 	
 public:
@@ -214,15 +216,9 @@ public:
 			
 			
 #ifdef FFTW3
-	#ifdef SINGLE_PRECISION
-			fftwf_complex * cw = reinterpret_cast<fftwf_complex*> (w);
-			fftwf_plan	p  = fftwf_plan_dft_r2c_3d( nx, ny, nz, w, cw, FFTW_ESTIMATE),
-						ip = fftwf_plan_dft_c2r_3d( nx, ny, nz, cw, w, FFTW_ESTIMATE);
-	#else
 			fftw_complex * cw = reinterpret_cast<fftw_complex*> (w);
-			fftw_plan	p  = fftw_plan_dft_r2c_3d( nx, ny, nz, w, cw, FFTW_ESTIMATE),
-						ip = fftw_plan_dft_c2r_3d( nx, ny, nz, cw, w, FFTW_ESTIMATE);
-	#endif
+			fft_plans::transform	p  = fft_plans::r2c( nx, ny, nz, w, cw),
+						ip = fft_plans::c2r( nx, ny, nz, cw, w);
 #else
 			fftw_complex * cw = reinterpret_cast<fftw_complex*> (w);
 			rfftwnd_plan p	= rfftw3d_create_plan( nx, ny, nz, FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE|FFTW_IN_PLACE),
@@ -241,11 +237,7 @@ public:
 					}
 			
 #ifdef FFTW3
-	#ifdef SINGLE_PRECISION
-			fftwf_execute( p );
-	#else
-			fftw_execute( p );
-	#endif
+			fft_plans::execute( p );
 #else
 #ifndef SINGLETHREAD_FFTW		
 			rfftwnd_threads_one_real_to_complex( omp_get_max_threads(), p, w, NULL );
@@ -253,20 +245,14 @@ public:
 			rfftwnd_one_real_to_complex( p, w, NULL );
 #endif
 #endif
-			wnoise_constr_corr( dx, cw, nx, ny, nz, g0 );
-			
 			matrix c(2,2);
-			icov_constr( dx, nx, ny, nz, c );
+			icov_constr( dx, cw, nx, ny, nz, g0, c );
 			
 			
 			wnoise_constr_corr( dx, nx, ny, nz, g0, c, cw );
 			
 #ifdef FFTW3
-	#ifdef SINGLE_PRECISION
-			fftwf_execute( ip );
-	#else
-			fftw_execute( ip );
-	#endif
+			fft_plans::execute( ip );
 #else
 #ifndef SINGLETHREAD_FFTW		
 			rfftwnd_threads_one_complex_to_real( omp_get_max_threads(), ip, cw, NULL );
@@ -290,13 +276,7 @@ public:
 			delete[] w;
 			
 			
-#ifdef FFTW3
-	#ifdef SINGLE_PRECISION
-			fftwf_destroy_plan(p);
-	#else
-			fftw_destroy_plan(p);
-	#endif
-#else
+#ifndef FFTW3
 			fftwnd_destroy_plan(p);
 #endif
 		}else{
@@ -308,15 +288,9 @@ public:
 			
 			
 #ifdef FFTW3
-	#ifdef SINGLE_PRECISION
-			fftwf_complex * cw = reinterpret_cast<fftwf_complex*> (w);
-			fftwf_plan	p  = fftwf_plan_dft_r2c_3d( nx, ny, nz, w, cw, FFTW_ESTIMATE),
-						ip = fftwf_plan_dft_c2r_3d( nx, ny, nz, cw, w, FFTW_ESTIMATE);
-	#else
 			fftw_complex * cw = reinterpret_cast<fftw_complex*> (w);
-			fftw_plan	p  = fftw_plan_dft_r2c_3d( nx, ny, nz, w, cw, FFTW_ESTIMATE),
-						ip = fftw_plan_dft_c2r_3d( nx, ny, nz, cw, w, FFTW_ESTIMATE);
-	#endif
+			fft_plans::transform	p  = fft_plans::r2c( nx, ny, nz, w, cw),
+						ip = fft_plans::c2r( nx, ny, nz, cw, w);
 #else
 			fftw_complex * cw = reinterpret_cast<fftw_complex*> (w);
 			rfftwnd_plan p	= rfftw3d_create_plan( nx, ny, nz, FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE|FFTW_IN_PLACE),
@@ -352,11 +326,7 @@ public:
 			}
 			
 #ifdef FFTW3
-	#ifdef SINGLE_PRECISION
-			fftwf_execute( p );
-	#else
-			fftw_execute( p );
-	#endif
+			fft_plans::execute( p );
 #else
 #ifndef SINGLETHREAD_FFTW		
 			rfftwnd_threads_one_real_to_complex( omp_get_max_threads(), p, w, NULL );
@@ -364,20 +334,14 @@ public:
 			rfftwnd_one_real_to_complex( p, w, NULL );
 #endif
 #endif
-			wnoise_constr_corr( dx, cw, nx, ny, nz, g0 );
-			
 			matrix c(2,2);
-			icov_constr( dx, nx, ny, nz, c );
+			icov_constr( dx, cw, nx, ny, nz, g0, c );
 			
 			
 			wnoise_constr_corr( dx, nx, ny, nz, g0, c, cw );
 			
 #ifdef FFTW3
-	#ifdef SINGLE_PRECISION
-			fftwf_execute( ip );
-	#else
-			fftw_execute( ip );
-	#endif
+			fft_plans::execute( ip );
 #else
 #ifndef SINGLETHREAD_FFTW		
 			rfftwnd_threads_one_complex_to_real( omp_get_max_threads(), ip, cw, NULL );
@@ -402,13 +366,7 @@ public:
 			delete[] w;
 			
 			
-#ifdef FFTW3
-	#ifdef SINGLE_PRECISION
-			fftwf_destroy_plan(p);
-	#else
-			fftw_destroy_plan(p);
-	#endif
-#else
+#ifndef FFTW3
 			fftwnd_destroy_plan(p);
 #endif
 			
@@ -9,8 +9,11 @@
 */
 
 #include "general.hh"
+#include "fft_plans.hh"
 #include "densities.hh"
 #include "convolution_kernel.hh"
+#include "kernel_store.hh"
+#include "fft_mpi.hh"
 
 #if defined(FFTW3) && defined(SINGLE_PRECISION)
 //#define fftw_complex fftwf_complex
@@ -29,10 +32,81 @@ get_kernel_map()
 	return kernel_map;
 }
 
+namespace
+{
+	struct kernel_key
+	{
+		std::string name;
+		int type;
+		const refinement_hierarchy *refh;
+
+		bool operator<(const kernel_key &o) const
+		{
+			if (name != o.name)
+				return name < o.name;
+			if (type != o.type)
+				return type < o.type;
+			return refh < o.refh;
+		}
+	};
+
+	bool keep_kernels_ = false;
+	std::map<kernel_key, kernel *> kept_kernels_;
+}
+
+void keep_kernels(bool keep)
+{
+	keep_kernels_ = keep;
+	if (!keep)
+		clear_kernels();
+}
+
+kernel *get_kernel(const std::string &kernel_name, config_file &cf, transfer_function *ptf, refinement_hierarchy &refh, tf_type type)
+{
+	kernel_key key = {kernel_name, (int)type, &refh};
+	std::map<kernel_key, kernel *>::iterator it = kept_kernels_.find(key);
+	if (it != kept_kernels_.end())
+	{
+		LOGUSER("Reusing convolution kernel '%s' for type %d.", kernel_name.c_str(), (int)type);
+		return it->second;
+	}
+
+	std::map<std::string, kernel_creator *>::iterator ic = get_kernel_map().find(kernel_name);
+	if (ic == get_kernel_map().end())
+	{
+		LOGERR("Convolution kernel '%s' is not available.", kernel_name.c_str());
+		throw std::runtime_error("Unknown convolution kernel");
+	}
+
+	kernel *pk = ic->second->create(cf, ptf, refh, type);
+	if (keep_kernels_)
+		kept_kernels_[key] = pk;
+	return pk;
+}
+
+void release_kernel(kernel *pk)
+{
+	for (std::map<kernel_key, kernel *>::iterator it = kept_kernels_.begin(); it != kept_kernels_.end(); ++it)
+		if (it->second == pk)
+		{
+			pk->deallocate();
+			return;
+		}
+	delete pk;
+}
+
+void clear_kernels(void)
+{
+	for (std::map<kernel_key, kernel *>::iterator it = kept_kernels_.begin(); it != kept_kernels_.end(); ++it)
+		delete it->second;
+	kept_kernels_.clear();
+}
+
 template <typename real_t>
 void perform(kernel *pk, void *pd, bool shift, bool fix, bool flip)
 {
 	//return;
+	profile::timer ptimer("convolution");
 
 	parameters cparam_ = pk->cparam_;
 	double fftnormp = 1.0/sqrt((double)cparam_.nx * (double)cparam_.ny * (double)cparam_.nz);
@@ -45,25 +119,34 @@ void perform(kernel *pk, void *pd, bool shift, bool fix, bool flip)
 	cdata = reinterpret_cast<fftw_complex *>(data);
 	ckernel = reinterpret_cast<fftw_complex *>(pk->get_ptr());
 
+	//... in distributed runs only the planes x0...x0+nxl-1 are held here
+	fft_mpi::slab sl = fft_mpi::decompose(cparam_.nx, cparam_.ny, cparam_.nz);
+	const int nxl = sl.local_n0, x0 = sl.local_0_start;
+
+	if (fft_mpi::active() && !pk->is_ksampled())
+	{
+		LOGERR("Distributed convolutions need a k-space transfer function kernel.");
+		throw std::runtime_error("Distributed convolutions need a k-space transfer function kernel");
+	}
+
 	std::cout << "   - Performing density convolution... ("
 			  << cparam_.nx << ", " << cparam_.ny << ", " << cparam_.nz << ")\n";
 
 	LOGUSER("Performing kernel convolution on (%5d,%5d,%5d) grid", cparam_.nx, cparam_.ny, cparam_.nz);
 	LOGUSER("Performing forward FFT...");
 #ifdef FFTW3
-#ifdef SINGLE_PRECISION
-	fftwf_plan plan, iplan;
-	plan = fftwf_plan_dft_r2c_3d(cparam_.nx, cparam_.ny, cparam_.nz, data, cdata, FFTW_ESTIMATE);
-	iplan = fftwf_plan_dft_c2r_3d(cparam_.nx, cparam_.ny, cparam_.nz, cdata, data, FFTW_ESTIMATE);
-
-	fftwf_execute(plan);
-#else
-	fftw_plan plan, iplan;
-	plan = fftw_plan_dft_r2c_3d(cparam_.nx, cparam_.ny, cparam_.nz, data, cdata, FFTW_ESTIMATE);
-	iplan = fftw_plan_dft_c2r_3d(cparam_.nx, cparam_.ny, cparam_.nz, cdata, data, FFTW_ESTIMATE);
-
-	fftw_execute(plan);
+	fft_plans::transform plan, iplan;
+#ifdef USE_FFTW_MPI
+	if (fft_mpi::active())
+		fft_mpi::forward(sl, data);
+	else
 #endif
+	{
+		plan = fft_plans::r2c(cparam_.nx, cparam_.ny, cparam_.nz, data, cdata);
+		iplan = fft_plans::c2r(cparam_.nx, cparam_.ny, cparam_.nz, cdata, data);
+
+		fft_plans::execute(plan);
+	}
 #else
 	rfftwnd_plan iplan, plan;
 
@@ -97,111 +180,115 @@ void perform(kernel *pk, void *pd, bool shift, bool fix, bool flip)
 
 	//.............................................
 
-	std::complex<double> dcmode(RE(cdata[0]), IM(cdata[0]));
-
-	if (!pk->is_ksampled())
-	{
-
-#pragma omp parallel for
-		for (int i = 0; i < cparam_.nx; ++i)
-			for (int j = 0; j < cparam_.ny; ++j)
-				for (int k = 0; k < cparam_.nz / 2 + 1; ++k)
-				{
-					size_t ii = (size_t)(i * cparam_.ny + j) * (size_t)(cparam_.nz / 2 + 1) + (size_t)k;
-
-					double kx, ky, kz;
-
-					kx = (double)i;
-					ky = (double)j;
-					kz = (double)k;
-
-					if (kx > cparam_.nx / 2)
-						kx -= cparam_.nx;
-					if (ky > cparam_.ny / 2)
-						ky -= cparam_.ny;
+	//... the DC mode is held by the slab starting at x=0
+	double dcmode = fft_mpi::sum((x0 == 0) ? (double)RE(cdata[0]) : 0.0);
 
-					double arg = (kx + ky + kz) * dstag;
-					std::complex<double> carg(cos(arg), sin(arg));
+	//... the staggering phase exp(i(kx+ky+kz)dstag) factorizes into per-axis phases,
+	//... the normalisation and the sign flip are folded into the z-phases
+	const size_t veclen = cparam_.nz / 2 + 1;
+	std::vector<double> phxr(cparam_.nx), phxi(cparam_.nx), phyr(cparam_.ny), phyi(cparam_.ny), phzr(veclen), phzi(veclen);
 
-					std::complex<double>
-						ccdata(RE(cdata[ii]), IM(cdata[ii])),
-						cckernel(RE(ckernel[ii]), IM(ckernel[ii]));
-
-					if( fix ){
-						ccdata = ccdata / std::abs(ccdata);
-					}
-					if( flip ){
-						ccdata = -ccdata;
-					}
-
-					ccdata = ccdata * cckernel * fftnorm * carg;
-
-					RE(cdata[ii]) = ccdata.real();
-					IM(cdata[ii]) = ccdata.imag();
-				}
+	for (int i = 0; i < cparam_.nx; ++i)
+	{
+		double kx = (i > cparam_.nx / 2) ? (double)(i - cparam_.nx) : (double)i;
+		phxr[i] = cos(kx * dstag);
+		phxi[i] = sin(kx * dstag);
 	}
-	else
+	for (int j = 0; j < cparam_.ny; ++j)
+	{
+		double ky = (j > cparam_.ny / 2) ? (double)(j - cparam_.ny) : (double)j;
+		phyr[j] = cos(ky * dstag);
+		phyi[j] = sin(ky * dstag);
+	}
+	for (size_t k = 0; k < veclen; ++k)
 	{
+		double znorm = flip ? -fftnorm : fftnorm;
+		phzr[k] = znorm * cos((double)k * dstag);
+		phzi[k] = znorm * sin((double)k * dstag);
+	}
 
 #pragma omp parallel
-		{
-
-			const size_t veclen = cparam_.nz / 2 + 1;
-
-			double *kvec = new double[veclen];
-			double *Tkvec = new double[veclen];
-			double *argvec = new double[veclen];
+	{
+		double *kvec = new double[veclen];
+		double *Tkvec = new double[veclen];
+		double *phr = new double[veclen];
+		double *phi = new double[veclen];
 
 #pragma omp for
-			for (int i = 0; i < cparam_.nx; ++i)
-				for (int j = 0; j < cparam_.ny; ++j)
-				{
+		for (int i = 0; i < nxl; ++i)
+			for (int j = 0; j < cparam_.ny; ++j)
+			{
+				const size_t ii0 = (size_t)(i * cparam_.ny + j) * veclen;
+				const int gi = i + x0;
 
-					for (int k = 0; k < cparam_.nz / 2 + 1; ++k)
-					{
-						double kx, ky, kz;
+				//... phase of this row of modes
+				double pxyr = phxr[gi] * phyr[j] - phxi[gi] * phyi[j];
+				double pxyi = phxr[gi] * phyi[j] + phxi[gi] * phyr[j];
 
-						kx = (double)i;
-						ky = (double)j;
-						kz = (double)k;
+				for (size_t k = 0; k < veclen; ++k)
+				{
+					phr[k] = pxyr * phzr[k] - pxyi * phzi[k];
+					phi[k] = pxyr * phzi[k] + pxyi * phzr[k];
+				}
 
-						if (kx > cparam_.nx / 2)
-							kx -= cparam_.nx;
-						if (ky > cparam_.ny / 2)
-							ky -= cparam_.ny;
+				if (pk->is_ksampled())
+				{
+					double kx = (gi > cparam_.nx / 2) ? (double)(gi - cparam_.nx) : (double)gi;
+					double ky = (j > cparam_.ny / 2) ? (double)(j - cparam_.ny) : (double)j;
+					double kxy2 = kx * kx + ky * ky;
 
-						kvec[k] = sqrt(kx * kx + ky * ky + kz * kz);
-						argvec[k] = (kx + ky + kz) * dstag;
-					}
+					for (size_t k = 0; k < veclen; ++k)
+						kvec[k] = sqrt(kxy2 + (double)k * (double)k);
 
 					pk->at_k(veclen, kvec, Tkvec);
 
-					for (int k = 0; k < cparam_.nz / 2 + 1; ++k)
+					for (size_t k = 0; k < veclen; ++k)
 					{
-						size_t ii = (size_t)(i * cparam_.ny + j) * (size_t)(cparam_.nz / 2 + 1) + (size_t)k;
-						std::complex<double> carg(cos(argvec[k]), sin(argvec[k]));
-
-						std::complex<double> ccdata(RE(cdata[ii]), IM(cdata[ii]));
-
-						if( fix ){
-							ccdata = ccdata / std::abs(ccdata) / fftnormp;
-						}
-						if( flip ){
-							ccdata = -ccdata;
-						}
-
-						ccdata = ccdata * Tkvec[k] * fftnorm * carg;
+						phr[k] *= Tkvec[k];
+						phi[k] *= Tkvec[k];
+					}
+				}
+				else
+				{
+					for (size_t k = 0; k < veclen; ++k)
+					{
+						double kr = RE(ckernel[ii0 + k]), ki = IM(ckernel[ii0 + k]);
+						double pr = phr[k];
+						phr[k] = pr * kr - phi[k] * ki;
+						phi[k] = pr * ki + phi[k] * kr;
+					}
+				}
 
-						RE(cdata[ii]) = ccdata.real();
-						IM(cdata[ii]) = ccdata.imag();
+				//... white noise with fixed amplitudes has modes of modulus one
+				if (fix)
+				{
+					double fnorm = pk->is_ksampled() ? 1.0 / fftnormp : 1.0;
+					for (size_t k = 0; k < veclen; ++k)
+					{
+						double dr = RE(cdata[ii0 + k]), di = IM(cdata[ii0 + k]);
+						double a = fnorm / sqrt(dr * dr + di * di);
+						phr[k] *= a;
+						phi[k] *= a;
 					}
 				}
 
-			delete[] kvec;
-			delete[] Tkvec;
-			delete[] argvec;
-		}
+				//... fused complex multiply with kernel, shift and normalisation
+				for (size_t k = 0; k < veclen; ++k)
+				{
+					double dr = RE(cdata[ii0 + k]), di = IM(cdata[ii0 + k]);
+					RE(cdata[ii0 + k]) = dr * phr[k] - di * phi[k];
+					IM(cdata[ii0 + k]) = dr * phi[k] + di * phr[k];
+				}
+			}
 
+		delete[] kvec;
+		delete[] Tkvec;
+		delete[] phr;
+		delete[] phi;
+	}
+
+	if (pk->is_ksampled() && x0 == 0)
+	{
 		// we now set the correct DC mode below...
 		RE(cdata[0]) = 0.0;
 		IM(cdata[0]) = 0.0;
@@ -210,16 +297,13 @@ void perform(kernel *pk, void *pd, bool shift, bool fix, bool flip)
 	LOGUSER("Performing backward FFT...");
 
 #ifdef FFTW3
-#ifdef SINGLE_PRECISION
-	fftwf_execute(iplan);
-	fftwf_destroy_plan(plan);
-	fftwf_destroy_plan(iplan);
-#else
-	fftw_execute(iplan);
-	fftw_destroy_plan(plan);
-	fftw_destroy_plan(iplan);
-
+#ifdef USE_FFTW_MPI
+	if (fft_mpi::active())
+		fft_mpi::backward(sl, data);
+	else
 #endif
+		fft_plans::execute(iplan);
+
 #else
 #ifndef SINGLETHREAD_FFTW
 	rfftwnd_threads_one_complex_to_real(omp_get_max_threads(), iplan, cdata, NULL);
@@ -234,8 +318,8 @@ void perform(kernel *pk, void *pd, bool shift, bool fix, bool flip)
 	// set the DC mode here to avoid a possible truncation error in single precision
 	if (pk->is_ksampled())
 	{
-		size_t nelem = (size_t)cparam_.nx * (size_t)cparam_.ny * (size_t)cparam_.nz;
-		real_t mean = dcmode.real() * fftnorm / (real_t)nelem;
+		size_t nelem = (size_t)nxl * (size_t)cparam_.ny * (size_t)cparam_.nz;
+		real_t mean = dcmode * fftnorm / ((real_t)cparam_.nx * (real_t)cparam_.ny * (real_t)cparam_.nz);
 
 #pragma omp parallel for
 		for (size_t i = 0; i < nelem; ++i)
@@ -270,6 +354,10 @@ public:
 		kmax_ = kfac_ / 2;
 		tfk_ = new TransferFunction_k(type_, ptf_, nspec_, pnorm_);
 
+		//... tabulate over all wave numbers the (isolated) kernels on any level can contain
+		if (pcf_->getValueSafe<bool>("setup", "kspace_TF_table", true))
+			tfk_->tabulate(0.5 * kfac_, 2.0 * sqrt(3.0) * M_PI * (double)(1 << refh.levelmax()) / boxlength_);
+
 		cparam_.nx = 1;
 		cparam_.ny = 1;
 		cparam_.nz = 1;
@@ -323,7 +411,7 @@ public:
 		for (size_t i = 0; i < len; ++i)
 		{
 			double kk = kfac_ * in_k[i];
-			out_Tk[i] = volfac_ * tfk_->compute(kk);
+			out_Tk[i] = volfac_ * tfk_->compute_tab(kk);
 		}
 	}
 
@@ -334,16 +422,133 @@ public:
 
 ////////////////////////////////////////////////////////////////////////////
 
+//! index of cell (i,j,k) of a periodic kernel, -n<=i<2n, either in the padded full array
+//! or in the stored octant 0<=i<=nx/2, 0<=j<=ny/2, 0<=k<=nz/2 of a reflection symmetric kernel
+inline size_t kernel_index(int i, int j, int k, int nx, int ny, int nz, bool octant)
+{
+	i = (i + nx) % nx;
+	j = (j + ny) % ny;
+	k = (k + nz) % nz;
+
+	if (!octant)
+		return ((size_t)i * ny + (size_t)j) * 2 * (nz / 2 + 1) + (size_t)k;
+
+	if (i > nx / 2)
+		i = nx - i;
+	if (j > ny / 2)
+		j = ny - j;
+	if (k > nz / 2)
+		k = nz - k;
+
+	return ((size_t)i * (ny / 2 + 1) + (size_t)j) * (nz / 2 + 1) + (size_t)k;
+}
+
+//! set the kernel value of cell (i,j,k) of the first octant and of all its reflections
+template <typename T>
+inline void set_kernel_value(T *kernel, int i, int j, int k, int nx, int ny, int nz, bool octant, T val)
+{
+	if (octant)
+		kernel[kernel_index(i, j, k, nx, ny, nz, true)] = val;
+	else
+		for (int q = 0; q < 8; ++q)
+			kernel[kernel_index((q & 1) ? -i : i, (q & 2) ? -j : j, (q & 4) ? -k : k, nx, ny, nz, false)] = val;
+}
+
+//! true if the kernel value of cell (i,j,k) of the first octant is copied from a permutation of it
+/*! the sampled kernels only depend on |r| and treat all axes alike, so the value of a cell is
+ *  that of the cell with its indices sorted, which is computed instead if it is in the octant
+ */
+inline bool kernel_value_shared(int i, int j, int k, int nx, int ny, int nz)
+{
+	int a = std::max(i, std::max(j, k)), c = std::min(i, std::min(j, k)), b = i + j + k - a - c;
+	return (i != a || j != b) && a <= nx / 2 && b <= ny / 2 && c <= nz / 2;
+}
+
+//! fill the cells of the first octant for which kernel_value_shared is true from the computed ones
+template <typename T>
+inline void fill_shared_kernel_values(T *kernel, int nx, int ny, int nz, bool octant)
+{
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i <= nx / 2; ++i)
+		for (int j = 0; j <= ny / 2; ++j)
+			for (int k = 0; k <= nz / 2; ++k)
+				if (kernel_value_shared(i, j, k, nx, ny, nz))
+				{
+					int a = std::max(i, std::max(j, k)), c = std::min(i, std::min(j, k)), b = i + j + k - a - c;
+					set_kernel_value(kernel, i, j, k, nx, ny, nz, octant, kernel[kernel_index(a, b, c, nx, ny, nz, octant)]);
+				}
+}
+
+//! remove the pixel response from a k-space kernel mode
+template <typename T>
+inline void deconvolve_mode(double kx, double ky, double kz, double kmax, bool bsmooth, bool kspacepoisson, T &re, T &im)
+{
+	if (!bsmooth)
+	{
+		if (kspacepoisson)
+		{
+			//... Use child average response function to emulate sub-sampling
+			double ipix = cos(kx * kmax) * cos(ky * kmax) * cos(kz * kmax);
+
+			re /= ipix;
+			im /= ipix;
+		}
+		else
+		{
+			//... Use piecewise constant response function (NGP-kernel)
+			//... for finite difference methods
+			double ipix = 1.0;
+			if (kx != 0.0)
+				ipix /= sin(kx * 2.0 * kmax) / (kx * 2.0 * kmax);
+			if (ky != 0.0)
+				ipix /= sin(ky * 2.0 * kmax) / (ky * 2.0 * kmax);
+			if (kz != 0.0)
+				ipix /= sin(kz * 2.0 * kmax) / (kz * 2.0 * kmax);
+
+			re *= ipix;
+			im *= ipix;
+		}
+	}
+	else
+	{
+		//... if smooth==true, convolve with
+		//... NGP kernel to get CIC smoothness
+		double ipix = 1.0;
+		if (kx != 0.0)
+			ipix /= sin(kx * 2.0 * kmax) / (kx * 2.0 * kmax);
+		if (ky != 0.0)
+			ipix /= sin(ky * 2.0 * kmax) / (ky * 2.0 * kmax);
+		if (kz != 0.0)
+			ipix /= sin(kz * 2.0 * kmax) / (kz * 2.0 * kmax);
+
+		re /= ipix;
+		im /= ipix;
+	}
+}
+
+//! number of values stored for a kernel on an nx*ny*nz grid
+inline size_t kernel_size(size_t nx, size_t ny, size_t nz, bool octant)
+{
+	if (octant)
+		return (nx / 2 + 1) * (ny / 2 + 1) * (nz / 2 + 1);
+	return nx * ny * 2 * (nz / 2 + 1);
+}
+
+#define ACC_RFK(i, j, k) kernel_index((i), (j), (k), nx, ny, nz, octant)
+#define ACC_RCK(i, j, k) kernel_index((i), (j), (k), nxc, nyc, nzc, octant)
+
 template <typename real_t>
 class kernel_real_cached : public kernel
 {
 protected:
-	std::vector<real_t> kdata_;
+	std::vector<fftw_real> kdata_;
+	kernel_store<fftw_real> *store_;
+	bool octant_; //!< only the first octant of the symmetric kernels is stored
 	void precompute_kernel(transfer_function *ptf, tf_type type, const refinement_hierarchy &refh);
 
 public:
 	kernel_real_cached(config_file &cf, transfer_function *ptf, refinement_hierarchy &refh, tf_type type)
-		: kernel(cf, ptf, refh, type)
+		: kernel(cf, ptf, refh, type), store_(NULL), octant_(false)
 	{
 		precompute_kernel(ptf, type, refh);
 	}
@@ -365,49 +570,44 @@ public:
 	~kernel_real_cached()
 	{
 		deallocate();
+		delete store_;
 	}
 
 	void deallocate()
 	{
-		std::vector<real_t>().swap(kdata_);
+		std::vector<fftw_real>().swap(kdata_);
 	}
 };
 
 template <typename real_t>
 kernel *kernel_real_cached<real_t>::fetch_kernel(int ilevel, bool isolated)
 {
-	char cachefname[128];
-	sprintf(cachefname, "temp_kernel_level%03d.tmp", ilevel);
-	FILE *fp = fopen(cachefname, "r");
+	unsigned dims[3];
 
 	std::cout << " - Fetching kernel for level " << ilevel << std::endl;
 
-	LOGUSER("Loading kernel for level %3d from file \'%s\'...", ilevel, cachefname);
-
-	if (fp == NULL)
-	{
-		LOGERR("Could not open kernel file \'%s\'.", cachefname);
-		throw std::runtime_error("Internal error: cached convolution kernel does not exist on disk!");
-	}
+	store_->get(ilevel, dims, kdata_);
 
-	unsigned nx, ny, nz;
-	size_t nread = 0;
+	unsigned nx = dims[0], ny = dims[1], nz = dims[2];
 
-	nread = fread(reinterpret_cast<void *>(&nx), sizeof(unsigned), 1, fp);
-	nread = fread(reinterpret_cast<void *>(&ny), sizeof(unsigned), 1, fp);
-	nread = fread(reinterpret_cast<void *>(&nz), sizeof(unsigned), 1, fp);
+	if (octant_)
+	{
+		//... expand the stored octant to the full padded array for the FFT
+		std::vector<fftw_real> koct;
+		koct.swap(kdata_);
 
-	kdata_.assign((size_t)nx * (size_t)ny * (size_t)nz, 0.0);
+		nx = 2 * (dims[0] - 1);
+		ny = 2 * (dims[1] - 1);
+		nz = 2 * (dims[2] - 1) + 2;
+		kdata_.assign((size_t)nx * (size_t)ny * (size_t)nz, 0.0);
 
-	for (size_t ix = 0; ix < nx; ++ix)
-	{
-		const size_t sz = ny * nz;
-		nread = fread(reinterpret_cast<void *>(&kdata_[(size_t)ix * sz]), sizeof(fftw_real), sz, fp);
-		assert(nread == sz);
+#pragma omp parallel for
+		for (int i = 0; i < (int)nx; ++i)
+			for (int j = 0; j < (int)ny; ++j)
+				for (int k = 0; k < (int)nz - 2; ++k)
+					kdata_[((size_t)i * ny + (size_t)j) * nz + (size_t)k] = koct[kernel_index(i, j, k, nx, ny, nz - 2, true)];
 	}
 
-	fclose(fp);
-
 	//... set parameters
 
 	double boxlength = pcf_->getValue<double>("setup", "boxlength");
@@ -424,17 +624,9 @@ kernel *kernel_real_cached<real_t>::fetch_kernel(int ilevel, bool isolated)
 	fftw_real *rkernel = reinterpret_cast<fftw_real *>(&kdata_[0]);
 
 #ifdef FFTW3
-#ifdef SINGLE_PRECISION
-	fftwf_complex *kkernel = reinterpret_cast<fftwf_complex *>(&rkernel[0]);
-	fftwf_plan plan = fftwf_plan_dft_r2c_3d(cparam_.nx, cparam_.ny, cparam_.nz, rkernel, kkernel, FFTW_ESTIMATE);
-	fftwf_execute(plan);
-	fftwf_destroy_plan(plan);
-#else
 	fftw_complex *kkernel = reinterpret_cast<fftw_complex *>(&rkernel[0]);
-	fftw_plan plan = fftw_plan_dft_r2c_3d(cparam_.nx, cparam_.ny, cparam_.nz, rkernel, kkernel, FFTW_ESTIMATE);
-	fftw_execute(plan);
-	fftw_destroy_plan(plan);
-#endif
+	fft_plans::transform plan = fft_plans::r2c(cparam_.nx, cparam_.ny, cparam_.nz, rkernel, kkernel);
+	fft_plans::execute(plan);
 #else
 	rfftwnd_plan plan = rfftw3d_create_plan(cparam_.nx, cparam_.ny, cparam_.nz,
 											FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE | FFTW_IN_PLACE);
@@ -543,6 +735,29 @@ void kernel_real_cached<real_t>::precompute_kernel(transfer_function *ptf, tf_ty
 
 	LOGUSER("Precomputing transfer function kernels...");
 
+	//... the kernel only depends on |r|, so it can be kept as one octant
+	bool octant = pcf_->getValueSafe<bool>("setup", "kernel_symmetric", false);
+#ifndef FFTW3
+	if (octant)
+	{
+		LOGWARN("Symmetric kernel storage requires FFTW3, full kernels will be stored.");
+		octant = false;
+	}
+#endif
+	octant_ = octant;
+
+	//... total size of all kernels decides where they can be kept
+	size_t nbytes = 0;
+	for (int ilevel = levelmin; ilevel <= levelmax; ++ilevel)
+	{
+		size_t fac = (ilevel != levelmin) ? 2 : 1;
+		nbytes += kernel_size(fac * refh.size(ilevel, 0), fac * refh.size(ilevel, 1), fac * refh.size(ilevel, 2), octant) * sizeof(fftw_real);
+	}
+
+	delete store_;
+	store_ = create_kernel_store<fftw_real>(pcf_->getValueSafe<std::string>("setup", "kernel_store", "auto"), nbytes);
+	LOGUSER("Keeping transfer function kernels in \'%s\' store (%.1f MB).", store_->name(), (double)nbytes / (1 << 20));
+
 	nx = refh.size(refh.levelmax(), 0);
 	ny = refh.size(refh.levelmax(), 1);
 	nz = refh.size(refh.levelmax(), 2);
@@ -579,16 +794,12 @@ void kernel_real_cached<real_t>::precompute_kernel(transfer_function *ptf, tf_ty
 	TransferFunction_real *tfr = new TransferFunction_real(boxlength, 1 << levelmax, type, ptf, nspec, pnorm,
 														   0.25 * dx, 2.0 * boxlength, kny, (int)pow(2, levelmax + 2));
 
-	fftw_real *rkernel = new fftw_real[(size_t)nx * (size_t)ny * ((size_t)nz + 2)], *rkernel_coarse;
+	size_t nkernel = kernel_size(nx, ny, nz, octant);
+	fftw_real *rkernel = new fftw_real[nkernel], *rkernel_coarse;
 
 #pragma omp parallel for
-	for (int i = 0; i < nx; ++i)
-		for (int j = 0; j < ny; ++j)
-			for (int k = 0; k < nz; ++k)
-			{
-				size_t q = ((size_t)(i)*ny + (size_t)(j)) * (size_t)(nz + 2) + (size_t)(k);
-				rkernel[q] = 0.0;
-			}
+	for (size_t q = 0; q < nkernel; ++q)
+		rkernel[q] = 0.0;
 
 	LOGUSER("Computing fine kernel (level %d)...", levelmax);
 
@@ -601,198 +812,140 @@ void kernel_real_cached<real_t>::precompute_kernel(transfer_function *ptf, tf_ty
 
 	if (bperiodic)
 	{
-#pragma omp parallel for
-		for (int i = 0; i <= nx / 2; ++i)
-			for (int j = 0; j <= ny / 2; ++j)
-				for (int k = 0; k <= nz / 2; ++k)
-				{
-					int iix(i), iiy(j), iiz(k);
-					real_t rr[3];
+#pragma omp parallel for schedule(dynamic)
+		for (int ij = 0; ij < (nx / 2 + 1) * (ny / 2 + 1); ++ij)
+			for (int k = 0; k <= nz / 2; ++k)
+			{
+				int i = ij / (ny / 2 + 1), j = ij % (ny / 2 + 1);
+				if (kernel_value_shared(i, j, k, nx, ny, nz))
+					continue;
 
-					if (iix > (int)nx / 2)
-						iix -= nx;
-					if (iiy > (int)ny / 2)
-						iiy -= ny;
-					if (iiz > (int)nz / 2)
-						iiz -= nz;
-
-					//... speed up 8x by copying data to other octants
-					size_t idx[8];
-
-					idx[0] = ((size_t)(i)*ny + (size_t)(j)) * 2 * (nz / 2 + 1) + (size_t)(k);
-					idx[1] = ((size_t)(nx - i) * ny + (size_t)(j)) * 2 * (nz / 2 + 1) + (size_t)(k);
-					idx[2] = ((size_t)(i)*ny + (size_t)(ny - j)) * 2 * (nz / 2 + 1) + (size_t)(k);
-					idx[3] = ((size_t)(nx - i) * ny + (size_t)(ny - j)) * 2 * (nz / 2 + 1) + (size_t)(k);
-					idx[4] = ((size_t)(i)*ny + (size_t)(j)) * 2 * (nz / 2 + 1) + (size_t)(nz - k);
-					idx[5] = ((size_t)(nx - i) * ny + (size_t)(j)) * 2 * (nz / 2 + 1) + (size_t)(nz - k);
-					idx[6] = ((size_t)(i)*ny + (size_t)(ny - j)) * 2 * (nz / 2 + 1) + (size_t)(nz - k);
-					idx[7] = ((size_t)(nx - i) * ny + (size_t)(ny - j)) * 2 * (nz / 2 + 1) + (size_t)(nz - k);
-
-					if (i == 0 || i == nx / 2)
-					{
-						idx[1] = idx[3] = idx[5] = idx[7] = (size_t)-1;
-					}
-					if (j == 0 || j == ny / 2)
-					{
-						idx[2] = idx[3] = idx[6] = idx[7] = (size_t)-1;
-					}
-					if (k == 0 || k == nz / 2)
-					{
-						idx[4] = idx[5] = idx[6] = idx[7] = (size_t)-1;
-					}
+				int iix(i), iiy(j), iiz(k);
+				real_t rr[3];
 
-					double val = 0.0;
+				double val = 0.0;
 
-					for (int ii = -1; ii <= 1; ++ii)
-						for (int jj = -1; jj <= 1; ++jj)
-							for (int kk = -1; kk <= 1; ++kk)
-							{
-								rr[0] = ((double)iix) * dx + ii * boxlength;
-								rr[1] = ((double)iiy) * dx + jj * boxlength;
-								rr[2] = ((double)iiz) * dx + kk * boxlength;
+				for (int ii = -1; ii <= 1; ++ii)
+					for (int jj = -1; jj <= 1; ++jj)
+						for (int kk = -1; kk <= 1; ++kk)
+						{
+							rr[0] = ((double)iix) * dx + ii * boxlength;
+							rr[1] = ((double)iiy) * dx + jj * boxlength;
+							rr[2] = ((double)iiz) * dx + kk * boxlength;
 
-								if (rr[0] > -boxlength && rr[0] <= boxlength && rr[1] > -boxlength && rr[1] <= boxlength && rr[2] > -boxlength && rr[2] <= boxlength)
-								{
+							if (rr[0] > -boxlength && rr[0] <= boxlength && rr[1] > -boxlength && rr[1] <= boxlength && rr[2] > -boxlength && rr[2] <= boxlength)
+							{
 #ifdef OLD_KERNEL_SAMPLING
-									if (ref_fac > 0)
+								if (ref_fac > 0)
+								{
+									double rrr[3];
+									register double rrr2[3];
+									for (int iii = ql; iii < qr; ++iii)
 									{
-										double rrr[3];
-										register double rrr2[3];
-										for (int iii = ql; iii < qr; ++iii)
+										rrr[0] = rr[0] + (double)iii * dx05 - dx025;
+										rrr2[0] = rrr[0] * rrr[0];
+										for (int jjj = ql; jjj < qr; ++jjj)
 										{
-											rrr[0] = rr[0] + (double)iii * dx05 - dx025;
-											rrr2[0] = rrr[0] * rrr[0];
-											for (int jjj = ql; jjj < qr; ++jjj)
+											rrr[1] = rr[1] + (double)jjj * dx05 - dx025;
+											rrr2[1] = rrr[1] * rrr[1];
+											for (int kkk = ql; kkk < qr; ++kkk)
 											{
-												rrr[1] = rr[1] + (double)jjj * dx05 - dx025;
-												rrr2[1] = rrr[1] * rrr[1];
-												for (int kkk = ql; kkk < qr; ++kkk)
-												{
-													rrr[2] = rr[2] + (double)kkk * dx05 - dx025;
-													rrr2[2] = rrr[2] * rrr[2];
-													val += tfr->compute_real(rrr2[0] + rrr2[1] + rrr2[2]) / rf8;
-												}
+												rrr[2] = rr[2] + (double)kkk * dx05 - dx025;
+												rrr2[2] = rrr[2] * rrr[2];
+												val += tfr->compute_real(rrr2[0] + rrr2[1] + rrr2[2]) / rf8;
 											}
 										}
 									}
-									else
-									{
-										val += tfr->compute_real(rr[0] * rr[0] + rr[1] * rr[1] + rr[2] * rr[2]);
-									}
+								}
+								else
+								{
+									val += tfr->compute_real(rr[0] * rr[0] + rr[1] * rr[1] + rr[2] * rr[2]);
+								}
 
 #else // !OLD_KERNEL_SAMPLING
-									val += eval_split_recurse(tfr, rr, dx) / (dx * dx * dx);
+								val += eval_split_recurse(tfr, rr, dx) / (dx * dx * dx);
 #endif
-								}
 							}
+						}
 
-					val *= fac;
+				val *= fac;
 
-					for (int q = 0; q < 8; ++q)
-						if (idx[q] != (size_t)-1)
-							rkernel[idx[q]] = val;
-				}
+				//... other octants follow by symmetry
+				set_kernel_value(rkernel, i, j, k, nx, ny, nz, octant, (fftw_real)val);
+			}
 	}
 	else
 	{
-#pragma omp parallel for
-		for (int i = 0; i < nx; ++i)
-			for (int j = 0; j < ny; ++j)
-				for (int k = 0; k < nz; ++k)
-				{
-					int iix(i), iiy(j), iiz(k);
-					real_t rr[3];
-
-					if (iix > (int)nx / 2)
-						iix -= nx;
-					if (iiy > (int)ny / 2)
-						iiy -= ny;
-					if (iiz > (int)nz / 2)
-						iiz -= nz;
-
-					//size_t idx = ((size_t)i*ny + (size_t)j) * 2*(nz/2+1) + (size_t)k;
-
-					rr[0] = ((double)iix) * dx;
-					rr[1] = ((double)iiy) * dx;
-					rr[2] = ((double)iiz) * dx;
+#pragma omp parallel for schedule(dynamic)
+		for (int ij = 0; ij < (nx / 2 + 1) * (ny / 2 + 1); ++ij)
+			for (int k = 0; k <= nz / 2; ++k)
+			{
+				int i = ij / (ny / 2 + 1), j = ij % (ny / 2 + 1);
+				if (kernel_value_shared(i, j, k, nx, ny, nz))
+					continue;
 
-					//rkernel[idx] = 0.0;
+				int iix(i), iiy(j), iiz(k);
+				real_t rr[3];
 
-					//rr2 = rr[0]*rr[0]+rr[1]*rr[1]+rr[2]*rr[2];
+				//size_t idx = ((size_t)i*ny + (size_t)j) * 2*(nz/2+1) + (size_t)k;
 
-					//... speed up 8x by copying data to other octants
-					size_t idx[8];
+				rr[0] = ((double)iix) * dx;
+				rr[1] = ((double)iiy) * dx;
+				rr[2] = ((double)iiz) * dx;
 
-					idx[0] = ((size_t)(i)*ny + (size_t)(j)) * 2 * (nz / 2 + 1) + (size_t)(k);
-					idx[1] = ((size_t)(nx - i) * ny + (size_t)(j)) * 2 * (nz / 2 + 1) + (size_t)(k);
-					idx[2] = ((size_t)(i)*ny + (size_t)(ny - j)) * 2 * (nz / 2 + 1) + (size_t)(k);
-					idx[3] = ((size_t)(nx - i) * ny + (size_t)(ny - j)) * 2 * (nz / 2 + 1) + (size_t)(k);
-					idx[4] = ((size_t)(i)*ny + (size_t)(j)) * 2 * (nz / 2 + 1) + (size_t)(nz - k);
-					idx[5] = ((size_t)(nx - i) * ny + (size_t)(j)) * 2 * (nz / 2 + 1) + (size_t)(nz - k);
-					idx[6] = ((size_t)(i)*ny + (size_t)(ny - j)) * 2 * (nz / 2 + 1) + (size_t)(nz - k);
-					idx[7] = ((size_t)(nx - i) * ny + (size_t)(ny - j)) * 2 * (nz / 2 + 1) + (size_t)(nz - k);
+				//rkernel[idx] = 0.0;
 
-					if (i == 0 || i == nx / 2)
-					{
-						idx[1] = idx[3] = idx[5] = idx[7] = (size_t)-1;
-					}
-					if (j == 0 || j == ny / 2)
-					{
-						idx[2] = idx[3] = idx[6] = idx[7] = (size_t)-1;
-					}
-					if (k == 0 || k == nz / 2)
-					{
-						idx[4] = idx[5] = idx[6] = idx[7] = (size_t)-1;
-					}
+				//rr2 = rr[0]*rr[0]+rr[1]*rr[1]+rr[2]*rr[2];
 
-					double val = 0.0; //(fftw_real)tfr->compute_real(rr2)*fac;
+				double val = 0.0; //(fftw_real)tfr->compute_real(rr2)*fac;
 
 #ifdef OLD_KERNEL_SAMPLING
 
-					if (ref_fac > 0)
+				if (ref_fac > 0)
+				{
+					double rrr[3];
+					register double rrr2[3];
+					for (int iii = ql; iii < qr; ++iii)
 					{
-						double rrr[3];
-						register double rrr2[3];
-						for (int iii = ql; iii < qr; ++iii)
+						rrr[0] = rr[0] + (double)iii * dx05 - dx025;
+						rrr2[0] = rrr[0] * rrr[0];
+						for (int jjj = ql; jjj < qr; ++jjj)
 						{
-							rrr[0] = rr[0] + (double)iii * dx05 - dx025;
-							rrr2[0] = rrr[0] * rrr[0];
-							for (int jjj = ql; jjj < qr; ++jjj)
+							rrr[1] = rr[1] + (double)jjj * dx05 - dx025;
+							rrr2[1] = rrr[1] * rrr[1];
+							for (int kkk = ql; kkk < qr; ++kkk)
 							{
-								rrr[1] = rr[1] + (double)jjj * dx05 - dx025;
-								rrr2[1] = rrr[1] * rrr[1];
-								for (int kkk = ql; kkk < qr; ++kkk)
-								{
-									rrr[2] = rr[2] + (double)kkk * dx05 - dx025;
-									rrr2[2] = rrr[2] * rrr[2];
-									val += tfr->compute_real(rrr2[0] + rrr2[1] + rrr2[2]) / rf8;
-								}
+								rrr[2] = rr[2] + (double)kkk * dx05 - dx025;
+								rrr2[2] = rrr[2] * rrr[2];
+								val += tfr->compute_real(rrr2[0] + rrr2[1] + rrr2[2]) / rf8;
 							}
 						}
 					}
-					else
-					{
-						val = tfr->compute_real(rr[0] * rr[0] + rr[1] * rr[1] + rr[2] * rr[2]);
-					}
+				}
+				else
+				{
+					val = tfr->compute_real(rr[0] * rr[0] + rr[1] * rr[1] + rr[2] * rr[2]);
+				}
 
 #else
-					if (i == 0 && j == 0 && k == 0)
-						continue;
+				if (i == 0 && j == 0 && k == 0)
+					continue;
 
-					// use new exact volume integration scheme
-					val = eval_split_recurse(tfr, rr, dx) / (dx * dx * dx);
+				// use new exact volume integration scheme
+				val = eval_split_recurse(tfr, rr, dx) / (dx * dx * dx);
 
 #endif
 
-					//if( rr2 <= boxlength2*boxlength2 )
-					//rkernel[idx] += (fftw_real)tfr->compute_real(rr2)*fac;
-					val *= fac;
+				//if( rr2 <= boxlength2*boxlength2 )
+				//rkernel[idx] += (fftw_real)tfr->compute_real(rr2)*fac;
+				val *= fac;
 
-					for (int q = 0; q < 8; ++q)
-						if (idx[q] != (size_t)-1)
-							rkernel[idx[q]] = val;
-				}
+				//... other octants follow by symmetry
+				set_kernel_value(rkernel, i, j, k, nx, ny, nz, octant, (fftw_real)val);
+			}
 	}
+	fill_shared_kernel_values(rkernel, nx, ny, nz, octant);
+
 	{
 #ifdef OLD_KERNEL_SAMPLING
 		rkernel[0] = tfr->compute_real(0.0) * fac;
@@ -806,6 +959,57 @@ void kernel_real_cached<real_t>::precompute_kernel(transfer_function *ptf, tf_ty
 	/******* perform deconvolution *******************************************************/
 
 	//bool baryons = type==baryon||type==vbaryon;
+#ifdef FFTW3
+	if (deconv && octant)
+	{
+		LOGUSER("Deconvolving fine kernel...");
+		std::cout << " - Deconvolving density kernel...\n";
+
+		double fftnorm = 1.0 / ((size_t)nx * (size_t)ny * (size_t)nz);
+		double k0 = rkernel[0];
+
+		//... subtract white noise component before deconvolution
+		if (!bsmooth_baryons)
+			rkernel[0] = 0.0;
+
+		//... the DFT of a reflection symmetric kernel is real and symmetric, a DCT-I of the
+		//... octant yields exactly the modes 0<=k<=n/2 of the full transform
+		int nxo = nx / 2 + 1, nyo = ny / 2 + 1, nzo = nz / 2 + 1;
+		fft_plans::transform dct = fft_plans::redft00(nxo, nyo, nzo, rkernel);
+		fft_plans::execute(dct);
+
+		double ksum = 0.0;
+		size_t kcount = 0;
+		double kmax = 0.5 * M_PI / std::max(nx, std::max(ny, nz));
+
+#pragma omp parallel for reduction(+ \
+								   : ksum, kcount)
+		for (int i = 0; i < nxo; ++i)
+			for (int j = 0; j < nyo; ++j)
+				for (int k = 0; k < nzo; ++k)
+				{
+					size_t q = ((size_t)i * nyo + (size_t)j) * (size_t)nzo + (size_t)k;
+					fftw_real im = 0.0;
+
+					deconvolve_mode((double)i, (double)j, (double)k, kmax, bsmooth_baryons, kspacepoisson, rkernel[q], im);
+
+					//... every stored mode stands for all its reflections
+					size_t w = ((i == 0 || i == nx / 2) ? 1 : 2) * ((j == 0 || j == ny / 2) ? 1 : 2) * ((k == 0 || k == nz / 2) ? 1 : 2);
+					ksum += (double)w * rkernel[q];
+					kcount += w;
+				}
+
+		//... re-add white noise component for finest grid, unless smoothing is enabled
+		double dk = bsmooth_baryons ? 0.0 : k0 - ksum / kcount;
+
+#pragma omp parallel for
+		for (size_t q = 0; q < nkernel; ++q)
+			rkernel[q] = (rkernel[q] + dk) * fftnorm;
+
+		fft_plans::execute(dct);
+	}
+	else
+#endif
 	if (deconv)
 	{
 
@@ -822,19 +1026,11 @@ void kernel_real_cached<real_t>::precompute_kernel(transfer_function *ptf, tf_ty
 			rkernel[0] = 0.0;
 
 #ifdef FFTW3
-#ifdef SINGLE_PRECISION
-		fftwf_plan
-			plan = fftwf_plan_dft_r2c_3d(nx, ny, nz, rkernel, kkernel, FFTW_ESTIMATE),
-			iplan = fftwf_plan_dft_c2r_3d(nx, ny, nz, kkernel, rkernel, FFTW_ESTIMATE);
+		fft_plans::transform
+			plan = fft_plans::r2c(nx, ny, nz, rkernel, kkernel),
+			iplan = fft_plans::c2r(nx, ny, nz, kkernel, rkernel);
 
-		fftwf_execute(plan);
-#else
-		fftw_plan
-			plan = fftw_plan_dft_r2c_3d(nx, ny, nz, rkernel, kkernel, FFTW_ESTIMATE),
-			iplan = fftw_plan_dft_c2r_3d(nx, ny, nz, kkernel, rkernel, FFTW_ESTIMATE);
-
-		fftw_execute(plan);
-#endif
+		fft_plans::execute(plan);
 #else
 		rfftwnd_plan plan = rfftw3d_create_plan(nx, ny, nz, FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE | FFTW_IN_PLACE),
 					 iplan = rfftw3d_create_plan(nx, ny, nz, FFTW_COMPLEX_TO_REAL, FFTW_ESTIMATE | FFTW_IN_PLACE);
@@ -870,57 +1066,9 @@ void kernel_real_cached<real_t>::precompute_kernel(transfer_function *ptf, tf_ty
 						if (ky > ny / 2)
 							ky -= ny;
 
-						double kkmax = kmax;
 						size_t q = ((size_t)i * ny + (size_t)j) * (size_t)(nz / 2 + 1) + (size_t)k;
 
-						if (!bsmooth_baryons)
-						{
-							if (kspacepoisson)
-							{
-								//... Use child average response function to emulate sub-sampling
-								double ipix = cos(kx * kkmax) * cos(ky * kkmax) * cos(kz * kkmax);
-
-								RE(kkernel[q]) /= ipix;
-								IM(kkernel[q]) /= ipix;
-							}
-							else
-							{
-
-								//... Use piecewise constant response function (NGP-kernel)
-								//... for finite difference methods
-								kkmax = kmax;
-								double ipix = 1.0;
-								if (i > 0)
-									ipix /= sin(kx * 2.0 * kkmax) / (kx * 2.0 * kkmax);
-								if (j > 0)
-									ipix /= sin(ky * 2.0 * kkmax) / (ky * 2.0 * kkmax);
-								if (k > 0)
-									ipix /= sin(kz * 2.0 * kkmax) / (kz * 2.0 * kkmax);
-
-								RE(kkernel[q]) *= ipix;
-								IM(kkernel[q]) *= ipix;
-							}
-						}
-#if 1
-						else
-						{
-							//... if smooth==true, convolve with
-							//... NGP kernel to get CIC smoothness
-
-							//kkmax *= 2.0;
-
-							double ipix = 1.0;
-							if (i > 0)
-								ipix /= sin(kx * 2.0 * kkmax) / (kx * 2.0 * kkmax);
-							if (j > 0)
-								ipix /= sin(ky * 2.0 * kkmax) / (ky * 2.0 * kkmax);
-							if (k > 0)
-								ipix /= sin(kz * 2.0 * kkmax) / (kz * 2.0 * kkmax);
-
-							RE(kkernel[q]) /= ipix;
-							IM(kkernel[q]) /= ipix;
-						}
-#endif
+						deconvolve_mode(kx, ky, kz, kmax, bsmooth_baryons, kspacepoisson, RE(kkernel[q]), IM(kkernel[q]));
 
 						//... store k-space average
 						if (k == 0 || k == nz / 2)
@@ -962,15 +1110,7 @@ void kernel_real_cached<real_t>::precompute_kernel(transfer_function *ptf, tf_ty
 		}
 
 #ifdef FFTW3
-#ifdef SINGLE_PRECISION
-		fftwf_execute(iplan);
-		fftwf_destroy_plan(plan);
-		fftwf_destroy_plan(iplan);
-#else
-		fftw_execute(iplan);
-		fftw_destroy_plan(plan);
-		fftw_destroy_plan(iplan);
-#endif
+		fft_plans::execute(iplan);
 #else
 #ifndef SINGLETHREAD_FFTW
 		rfftwnd_threads_one_complex_to_real(omp_get_max_threads(), iplan, kkernel, NULL);
@@ -986,26 +1126,11 @@ void kernel_real_cached<real_t>::precompute_kernel(transfer_function *ptf, tf_ty
 	/*************************************************************************************/
 	/*************************************************************************************/
 
-	char cachefname[128];
-	sprintf(cachefname, "temp_kernel_level%03d.tmp", levelmax);
-	LOGUSER("Storing kernel in temp file \'%s\'.", cachefname);
-
-	FILE *fp = fopen(cachefname, "w+");
-	unsigned q = nx;
-	fwrite(reinterpret_cast<void *>(&q), sizeof(unsigned), 1, fp);
-	q = ny;
-	fwrite(reinterpret_cast<void *>(&q), sizeof(unsigned), 1, fp);
-	q = 2 * (nz / 2 + 1);
-	fwrite(reinterpret_cast<void *>(&q), sizeof(unsigned), 1, fp);
-
-	for (int ix = 0; ix < nx; ++ix)
-	{
-		size_t sz = ny * 2 * (nz / 2 + 1);
-		//fwrite( reinterpret_cast<void*>(&rkernel[0]), sizeof(fftw_real), nx*ny*2*(nz/2+1), fp );
-		fwrite(reinterpret_cast<void *>(&rkernel[(size_t)ix * sz]), sizeof(fftw_real), sz, fp);
-	}
-
-	fclose(fp);
+	unsigned dims[3];
+	dims[0] = octant ? nx / 2 + 1 : nx;
+	dims[1] = octant ? ny / 2 + 1 : ny;
+	dims[2] = octant ? nz / 2 + 1 : 2 * (nz / 2 + 1);
+	store_->put(levelmax, dims, rkernel);
 
 	//... average and fill for other levels
 	for (int ilevel = levelmax - 1; ilevel >= levelmin; ilevel--)
@@ -1031,130 +1156,93 @@ void kernel_real_cached<real_t>::precompute_kernel(transfer_function *ptf, tf_ty
 		lyc = dxc * nyc;
 		lzc = dxc * nzc;
 
-		rkernel_coarse = new fftw_real[(size_t)nxc * (size_t)nyc * 2 * ((size_t)nzc / 2 + 1)];
+		rkernel_coarse = new fftw_real[kernel_size(nxc, nyc, nzc, octant)];
 		fac = lxc * lyc * lzc / pow(2.0 * M_PI, 3) / ((double)nxc * (double)nyc * (double)nzc);
 
 		if (bperiodic)
 		{
-#pragma omp parallel for
-			for (int i = 0; i <= nxc / 2; ++i)
-				for (int j = 0; j <= nyc / 2; ++j)
-					for (int k = 0; k <= nzc / 2; ++k)
-					{
-						int iix(i), iiy(j), iiz(k);
-						real_t rr[3], rr2;
-
-						if (iix > (int)nxc / 2)
-							iix -= nxc;
-						if (iiy > (int)nyc / 2)
-							iiy -= nyc;
-						if (iiz > (int)nzc / 2)
-							iiz -= nzc;
-
-						//... speed up 8x by copying data to other octants
-						size_t idx[8];
-
-						idx[0] = ((size_t)(i)*nyc + (size_t)(j)) * 2 * (nzc / 2 + 1) + (size_t)(k);
-						idx[1] = ((size_t)(nxc - i) * nyc + (size_t)(j)) * 2 * (nzc / 2 + 1) + (size_t)(k);
-						idx[2] = ((size_t)(i)*nyc + (size_t)(nyc - j)) * 2 * (nzc / 2 + 1) + (size_t)(k);
-						idx[3] = ((size_t)(nxc - i) * nyc + (size_t)(nyc - j)) * 2 * (nzc / 2 + 1) + (size_t)(k);
-						idx[4] = ((size_t)(i)*nyc + (size_t)(j)) * 2 * (nzc / 2 + 1) + (size_t)(nzc - k);
-						idx[5] = ((size_t)(nxc - i) * nyc + (size_t)(j)) * 2 * (nzc / 2 + 1) + (size_t)(nzc - k);
-						idx[6] = ((size_t)(i)*nyc + (size_t)(nyc - j)) * 2 * (nzc / 2 + 1) + (size_t)(nzc - k);
-						idx[7] = ((size_t)(nxc - i) * nyc + (size_t)(nyc - j)) * 2 * (nzc / 2 + 1) + (size_t)(nzc - k);
-
-						if (i == 0 || i == nxc / 2)
-						{
-							idx[1] = idx[3] = idx[5] = idx[7] = (size_t)-1;
-						}
-						if (j == 0 || j == nyc / 2)
-						{
-							idx[2] = idx[3] = idx[6] = idx[7] = (size_t)-1;
-						}
-						if (k == 0 || k == nzc / 2)
-						{
-							idx[4] = idx[5] = idx[6] = idx[7] = (size_t)-1;
-						}
+#pragma omp parallel for schedule(dynamic)
+			for (int ij = 0; ij < (nxc / 2 + 1) * (nyc / 2 + 1); ++ij)
+				for (int k = 0; k <= nzc / 2; ++k)
+				{
+					int i = ij / (nyc / 2 + 1), j = ij % (nyc / 2 + 1);
+					if (kernel_value_shared(i, j, k, nxc, nyc, nzc))
+						continue;
 
-						double val = 0.0;
+					int iix(i), iiy(j), iiz(k);
+					real_t rr[3], rr2;
 
-						for (int ii = -1; ii <= 1; ++ii)
-							for (int jj = -1; jj <= 1; ++jj)
-								for (int kk = -1; kk <= 1; ++kk)
-								{
-									rr[0] = ((double)iix) * dxc + ii * boxlength;
-									rr[1] = ((double)iiy) * dxc + jj * boxlength;
-									rr[2] = ((double)iiz) * dxc + kk * boxlength;
+					double val = 0.0;
 
-									if (rr[0] > -boxlength && rr[0] < boxlength && rr[1] > -boxlength && rr[1] < boxlength && rr[2] > -boxlength && rr[2] < boxlength)
-									{
+					for (int ii = -1; ii <= 1; ++ii)
+						for (int jj = -1; jj <= 1; ++jj)
+							for (int kk = -1; kk <= 1; ++kk)
+							{
+								rr[0] = ((double)iix) * dxc + ii * boxlength;
+								rr[1] = ((double)iiy) * dxc + jj * boxlength;
+								rr[2] = ((double)iiz) * dxc + kk * boxlength;
+
+								if (rr[0] > -boxlength && rr[0] < boxlength && rr[1] > -boxlength && rr[1] < boxlength && rr[2] > -boxlength && rr[2] < boxlength)
+								{
 #ifdef OLD_KERNEL_SAMPLING
-										rr2 = rr[0] * rr[0] + rr[1] * rr[1] + rr[2] * rr[2];
-										val += tfr->compute_real(rr2);
+									rr2 = rr[0] * rr[0] + rr[1] * rr[1] + rr[2] * rr[2];
+									val += tfr->compute_real(rr2);
 #else // ! OLD_KERNEL_SAMPLING
-										val += eval_split_recurse(tfr, rr, dxc) / (dxc * dxc * dxc);
+									val += eval_split_recurse(tfr, rr, dxc) / (dxc * dxc * dxc);
 #endif
-									}
 								}
+							}
 
-						val *= fac;
+					val *= fac;
 
-						for (int qq = 0; qq < 8; ++qq)
-							if (idx[qq] != (size_t)-1)
-								rkernel_coarse[idx[qq]] = val;
-					}
+					set_kernel_value(rkernel_coarse, i, j, k, nxc, nyc, nzc, octant, (fftw_real)val);
+				}
 		}
 		else
 		{
-#pragma omp parallel for
-			for (int i = 0; i < nxc; ++i)
-				for (int j = 0; j < nyc; ++j)
-					for (int k = 0; k < nzc; ++k)
-					{
-						int iix(i), iiy(j), iiz(k);
-						real_t rr[3];
-
-						if (iix > (int)nxc / 2)
-							iix -= nxc;
-						if (iiy > (int)nyc / 2)
-							iiy -= nyc;
-						if (iiz > (int)nzc / 2)
-							iiz -= nzc;
+#pragma omp parallel for schedule(dynamic)
+			for (int ij = 0; ij < (nxc / 2 + 1) * (nyc / 2 + 1); ++ij)
+				for (int k = 0; k <= nzc / 2; ++k)
+				{
+					int i = ij / (nyc / 2 + 1), j = ij % (nyc / 2 + 1);
+					if (kernel_value_shared(i, j, k, nxc, nyc, nzc))
+						continue;
 
-						size_t idx = ((size_t)i * nyc + (size_t)j) * 2 * (nzc / 2 + 1) + (size_t)k;
+					real_t rr[3];
+					fftw_real val = 0.0;
 
-						rr[0] = ((double)iix) * dxc;
-						rr[1] = ((double)iiy) * dxc;
-						rr[2] = ((double)iiz) * dxc;
+					rr[0] = ((double)i) * dxc;
+					rr[1] = ((double)j) * dxc;
+					rr[2] = ((double)k) * dxc;
 
 #ifdef OLD_KERNEL_SAMPLING
-						rkernel_coarse[idx] = 0.0;
-
-						real_t rr2 = rr[0] * rr[0] + rr[1] * rr[1] + rr[2] * rr[2];
-						if (fabs(rr[0]) <= boxlength2 || fabs(rr[1]) <= boxlength2 || fabs(rr[2]) <= boxlength2)
-							rkernel_coarse[idx] += (fftw_real)tfr->compute_real(rr2) * fac;
+					real_t rr2 = rr[0] * rr[0] + rr[1] * rr[1] + rr[2] * rr[2];
+					if (fabs(rr[0]) <= boxlength2 || fabs(rr[1]) <= boxlength2 || fabs(rr[2]) <= boxlength2)
+						val = (fftw_real)tfr->compute_real(rr2) * fac;
 #else
+					//if( i==0 && j==0 && k==0 ) continue;
+					real_t rval = eval_split_recurse(tfr, rr, dxc) / (dxc * dxc * dxc);
 
-						rkernel_coarse[idx] = 0.0;
-
-						//if( i==0 && j==0 && k==0 ) continue;
-						real_t val = eval_split_recurse(tfr, rr, dxc) / (dxc * dxc * dxc);
-
-						if (fabs(rr[0]) <= boxlength2 || fabs(rr[1]) <= boxlength2 || fabs(rr[2]) <= boxlength2)
-							rkernel_coarse[idx] += val * fac;
-
+					if (fabs(rr[0]) <= boxlength2 || fabs(rr[1]) <= boxlength2 || fabs(rr[2]) <= boxlength2)
+						val = rval * fac;
 #endif
-					}
+
+					//... other octants follow by symmetry
+					set_kernel_value(rkernel_coarse, i, j, k, nxc, nyc, nzc, octant, val);
+				}
 		}
 
+		fill_shared_kernel_values(rkernel_coarse, nxc, nyc, nzc, octant);
+
 #ifdef OLD_KERNEL_SAMPLING
 		LOGUSER("Averaging fine kernel to coarse kernel...");
 
 //... copy averaged and convolved fine kernel to coarse kernel
+//... for a symmetric kernel only the cells of the stored octant are needed
 #pragma omp parallel for
-		for (int ix = 0; ix < nx; ix += 2)
-			for (int iy = 0; iy < ny; iy += 2)
-				for (int iz = 0; iz < nz; iz += 2)
+		for (int ix = 0; ix < (octant ? nx / 2 + 1 : nx); ix += 2)
+			for (int iy = 0; iy < (octant ? ny / 2 + 1 : ny); iy += 2)
+				for (int iz = 0; iz < (octant ? nz / 2 + 1 : nz); iz += 2)
 				{
 					int iix(ix / 2), iiy(iy / 2), iiz(iz / 2);
 					if (ix > nx / 2)
@@ -1171,36 +1259,22 @@ void kernel_real_cached<real_t>::precompute_kernel(transfer_function *ptf, tf_ty
 						for (int j = 0; j <= 1; ++j)
 							for (int k = 0; k <= 1; ++k)
 								if (i == 0 && k == 0 && j == 0)
-									rkernel_coarse[ACC_RC(iix, iiy, iiz)] =
-										0.125 * (rkernel[ACC_RF(ix - i, iy - j, iz - k)] + rkernel[ACC_RF(ix - i + 1, iy - j, iz - k)] + rkernel[ACC_RF(ix - i, iy - j + 1, iz - k)] + rkernel[ACC_RF(ix - i, iy - j, iz - k + 1)] + rkernel[ACC_RF(ix - i + 1, iy - j + 1, iz - k)] + rkernel[ACC_RF(ix - i + 1, iy - j, iz - k + 1)] + rkernel[ACC_RF(ix - i, iy - j + 1, iz - k + 1)] + rkernel[ACC_RF(ix - i + 1, iy - j + 1, iz - k + 1)]);
+									rkernel_coarse[ACC_RCK(iix, iiy, iiz)] =
+										0.125 * (rkernel[ACC_RFK(ix - i, iy - j, iz - k)] + rkernel[ACC_RFK(ix - i + 1, iy - j, iz - k)] + rkernel[ACC_RFK(ix - i, iy - j + 1, iz - k)] + rkernel[ACC_RFK(ix - i, iy - j, iz - k + 1)] + rkernel[ACC_RFK(ix - i + 1, iy - j + 1, iz - k)] + rkernel[ACC_RFK(ix - i + 1, iy - j, iz - k + 1)] + rkernel[ACC_RFK(ix - i, iy - j + 1, iz - k + 1)] + rkernel[ACC_RFK(ix - i + 1, iy - j + 1, iz - k + 1)]);
 
 								else
 								{
 
-									rkernel_coarse[ACC_RC(iix, iiy, iiz)] +=
-										0.125 * (rkernel[ACC_RF(ix - i, iy - j, iz - k)] + rkernel[ACC_RF(ix - i + 1, iy - j, iz - k)] + rkernel[ACC_RF(ix - i, iy - j + 1, iz - k)] + rkernel[ACC_RF(ix - i, iy - j, iz - k + 1)] + rkernel[ACC_RF(ix - i + 1, iy - j + 1, iz - k)] + rkernel[ACC_RF(ix - i + 1, iy - j, iz - k + 1)] + rkernel[ACC_RF(ix - i, iy - j + 1, iz - k + 1)] + rkernel[ACC_RF(ix - i + 1, iy - j + 1, iz - k + 1)]);
+									rkernel_coarse[ACC_RCK(iix, iiy, iiz)] +=
+										0.125 * (rkernel[ACC_RFK(ix - i, iy - j, iz - k)] + rkernel[ACC_RFK(ix - i + 1, iy - j, iz - k)] + rkernel[ACC_RFK(ix - i, iy - j + 1, iz - k)] + rkernel[ACC_RFK(ix - i, iy - j, iz - k + 1)] + rkernel[ACC_RFK(ix - i + 1, iy - j + 1, iz - k)] + rkernel[ACC_RFK(ix - i + 1, iy - j, iz - k + 1)] + rkernel[ACC_RFK(ix - i, iy - j + 1, iz - k + 1)] + rkernel[ACC_RFK(ix - i + 1, iy - j + 1, iz - k + 1)]);
 								}
 				}
 
 #endif // #OLD_KERNEL_SAMPLING
-		sprintf(cachefname, "temp_kernel_level%03d.tmp", ilevel);
-		LOGUSER("Storing kernel in temp file \'%s\'.", cachefname);
-		fp = fopen(cachefname, "w+");
-		q = nxc;
-		fwrite(reinterpret_cast<void *>(&q), sizeof(unsigned), 1, fp);
-		q = nyc;
-		fwrite(reinterpret_cast<void *>(&q), sizeof(unsigned), 1, fp);
-		q = 2 * (nzc / 2 + 1);
-		fwrite(reinterpret_cast<void *>(&q), sizeof(unsigned), 1, fp);
-
-		for (int ix = 0; ix < nxc; ++ix)
-		{
-			size_t sz = nyc * 2 * (nzc / 2 + 1);
-			//fwrite( reinterpret_cast<void*>(&rkernel_coarse[0]), sizeof(fftw_real), nxc*nyc*2*(nzc/2+1), fp );
-			fwrite(reinterpret_cast<void *>(&rkernel_coarse[ix * sz]), sizeof(fftw_real), sz, fp);
-		}
-
-		fclose(fp);
+		dims[0] = octant ? nxc / 2 + 1 : nxc;
+		dims[1] = octant ? nyc / 2 + 1 : nyc;
+		dims[2] = octant ? nzc / 2 + 1 : 2 * (nzc / 2 + 1);
+		store_->put(ilevel, dims, rkernel_coarse);
 
 		delete[] rkernel;
 
@@ -110,6 +110,18 @@ struct kernel_creator_concrete : public kernel_creator
 	}
 };
 
+//! keep the kernels created by get_kernel for later requests of the same kernel, type and hierarchy
+void keep_kernels(bool keep);
+
+//! create the kernel kernel_name through the factory, or return the one kept from an earlier request
+kernel *get_kernel(const std::string &kernel_name, config_file &cf, transfer_function *ptf, refinement_hierarchy &refh, tf_type type);
+
+//! release a kernel obtained from get_kernel, it is deleted unless kernels are kept
+void release_kernel(kernel *pk);
+
+//! delete all kept kernels
+void clear_kernels(void);
+
 //! actual implementation of the FFT convolution (independent of the actual kernel)
 template <typename real_t>
 void perform(kernel *pk, void *pd, bool shift, bool fix, bool flip);
@@ -12,6 +12,8 @@
 #include "mesh.hh"
 #include "mg_operators.hh"
 #include "general.hh"
+#include "fft_plans.hh"
+#include "fft_mpi.hh"
 
 #define ACC(i,j,k) ((*u.get_grid((ilevel)))((i),(j),(k)))
 #define SQR(x)	((x)*(x))
@@ -20,6 +22,119 @@
 #define fftw_complex fftwf_complex
 #endif
 
+//... range and resolution of the tabulated growth integral, in ln a
+#define GROWTH_TAB_AMIN		1e-4
+#define GROWTH_TAB_AMAX		2.0
+#define GROWTH_TAB_PER_EFOLD	64
+
+//... resolution of the tabulated power spectrum integrands, in ln k
+#define POWER_TAB_PER_EFOLD	256
+
+double CosmoCalc::GrowthIntegral( double a )
+{
+	const double lnamin = log(GROWTH_TAB_AMIN), dlna = 1.0/GROWTH_TAB_PER_EFOLD;
+	const int ntab = (int)ceil( (log(GROWTH_TAB_AMAX)-lnamin)/dlna ) + 1;
+	
+	if( a < GROWTH_TAB_AMIN || a > GROWTH_TAB_AMAX )
+		return integrate( &GrowthIntegrand, 0.0, a, (void*)&m_Cosmology );
+	
+	if( m_tab_lngrowth.empty() )
+	{
+		//... 8-point Gauss-Legendre rule on [-1,1] for each interval in ln a
+		static const double x[4] = { 0.1834346424956498, 0.5255324099163290, 0.7966664774136267, 0.9602898564975363 };
+		static const double w[4] = { 0.3626837833783620, 0.3137066458778873, 0.2223810344533745, 0.1012285362903763 };
+		
+		std::vector<double> dI( ntab, 0.0 );
+		
+		#pragma omp parallel for
+		for( int i=1; i<ntab; ++i )
+		{
+			double lnam = lnamin + (i-0.5)*dlna, sum = 0.0;
+			for( int j=0; j<4; ++j )
+				for( int s=-1; s<=1; s+=2 )
+				{
+					double aa = exp( lnam + s*x[j]*0.5*dlna );
+					sum += w[j] * aa * GrowthIntegrand( aa, (void*)&m_Cosmology );
+				}
+			dI[i] = 0.5 * dlna * sum;
+		}
+		
+		m_tab_lngrowth.assign( ntab, 0.0 );
+		double I = integrate( &GrowthIntegrand, 0.0, GROWTH_TAB_AMIN, (void*)&m_Cosmology );
+		for( int i=0; i<ntab; ++i )
+		{
+			I += dI[i];
+			m_tab_lngrowth[i] = log(I);
+		}
+	}
+	
+	//... cubic Lagrange interpolation in ln a, the stencil is kept inside the table
+	double u = (log(a)-lnamin)/dlna;
+	int i0 = std::min( std::max( (int)u-1, 0 ), ntab-4 );
+	double t = u - i0, f = 0.0;
+	
+	for( int j=0; j<4; ++j )
+	{
+		double l = 1.0;
+		for( int m=0; m<4; ++m )
+			if( m != j )
+				l *= (t-m)/(j-m);
+		f += l * m_tab_lngrowth[i0+j];
+	}
+	
+	return exp(f);
+}
+
+void CosmoCalc::TabulatePower( double kmin, double kmax, tf_type type, power_table& tab )
+{
+	if( tab.kmin == kmin && tab.kmax == kmax && tab.type == type )
+		return;
+	
+	//... composite Simpson rule in ln k, needs an odd number of points
+	double lnkmin = log(kmin), lnkmax = log(kmax);
+	int n = 2*(int)ceil( 0.5*(lnkmax-lnkmin)*POWER_TAB_PER_EFOLD ) + 1;
+	double dlnk = (lnkmax-lnkmin)/(n-1);
+	double nspect = (double)m_pTransferFunction->cosmo_.nspect;
+	
+	tab.k.assign( n, 0.0 );
+	tab.w.assign( n, 0.0 );
+	
+	for( int i=0; i<n; ++i )
+		tab.k[i] = exp( lnkmin + i*dlnk );
+	
+	m_pTransferFunction->compute_batch( &tab.k[0], &tab.w[0], n, type );
+	
+	for( int i=0; i<n; ++i )
+	{
+		double k = tab.k[i], tf = tab.w[i];
+		double ws = (i==0 || i==n-1)? 1.0 : ((i%2)? 4.0 : 2.0);
+		tab.w[i] = ws * dlnk/3.0 * k*k*k * pow(k,nspect) * tf*tf;
+	}
+	
+	tab.kmin = kmin;
+	tab.kmax = kmax;
+	tab.type = type;
+}
+
+double CosmoCalc::SigmaSq( const power_table& tab, double R, window_type wtype )
+{
+	double sum = 0.0;
+	
+	for( size_t i=0; i<tab.k.size(); ++i )
+	{
+		double x = tab.k[i]*R, w;
+		
+		if( wtype == tophat_window )
+			w = (x < 1e-3)? 1.0-0.1*x*x : 3.0*(sin(x)-x*cos(x))/(x*x*x);
+		else
+			w = exp(-x*x*0.5);
+		
+		sum += tab.w[i] * w*w;
+	}
+	
+	return 4.0 * M_PI * sum;
+}
+
 
 void compute_LLA_density( const grid_hierarchy& u, grid_hierarchy& fnew, unsigned order )
 {
@@ -29,116 +144,120 @@ void compute_LLA_density( const grid_hierarchy& u, grid_hierarchy& fnew, unsigne
 	{
 		double h = pow(2.0,ilevel), h2 = h*h, h2_4 = 0.25*h2;
 		meshvar_bnd *pvar = fnew.get_grid(ilevel);
+		const mesh_bricks bricks( pvar->size(0), pvar->size(1), pvar->size(2) );
 		
 		
 		if( order == 2 )
 		{
-			#pragma omp parallel for //reduction(+:sum_corr,sum,sum2)
-			for( int ix = 0; ix < (int)(*u.get_grid(ilevel)).size(0); ++ix )
-				for( int iy = 0; iy < (int)(*u.get_grid(ilevel)).size(1); ++iy )
-					for( int iz = 0; iz < (int)(*u.get_grid(ilevel)).size(2); ++iz )
-					{
-						double D[3][3];
+			#pragma omp parallel for schedule(static)
+			for( int ib = 0; ib < (int)bricks.size(); ++ib )
+				for( int ix = bricks[ib].ix0; ix < bricks[ib].ix1; ++ix )
+					for( int iy = bricks[ib].iy0; iy < bricks[ib].iy1; ++iy )
+						for( int iz = bricks[ib].iz0; iz < bricks[ib].iz1; ++iz )
+						{
+							double D[3][3];
 						
-						D[0][0] = (ACC(ix-1,iy,iz)-2.0*ACC(ix,iy,iz)+ACC(ix+1,iy,iz)) * h2;
-						D[1][1] = (ACC(ix,iy-1,iz)-2.0*ACC(ix,iy,iz)+ACC(ix,iy+1,iz)) * h2;
-						D[2][2] = (ACC(ix,iy,iz-1)-2.0*ACC(ix,iy,iz)+ACC(ix,iy,iz+1)) * h2;
+							D[0][0] = (ACC(ix-1,iy,iz)-2.0*ACC(ix,iy,iz)+ACC(ix+1,iy,iz)) * h2;
+							D[1][1] = (ACC(ix,iy-1,iz)-2.0*ACC(ix,iy,iz)+ACC(ix,iy+1,iz)) * h2;
+							D[2][2] = (ACC(ix,iy,iz-1)-2.0*ACC(ix,iy,iz)+ACC(ix,iy,iz+1)) * h2;
 											
-						D[0][1] = D[1][0] = (ACC(ix-1,iy-1,iz)-ACC(ix-1,iy+1,iz)-ACC(ix+1,iy-1,iz)+ACC(ix+1,iy+1,iz))*h2_4;
-						D[0][2] = D[2][0] = (ACC(ix-1,iy,iz-1)-ACC(ix-1,iy,iz+1)-ACC(ix+1,iy,iz-1)+ACC(ix+1,iy,iz+1))*h2_4;
-						D[1][2] = D[2][1] = (ACC(ix,iy-1,iz-1)-ACC(ix,iy-1,iz+1)-ACC(ix,iy+1,iz-1)+ACC(ix,iy+1,iz+1))*h2_4;
+							D[0][1] = D[1][0] = (ACC(ix-1,iy-1,iz)-ACC(ix-1,iy+1,iz)-ACC(ix+1,iy-1,iz)+ACC(ix+1,iy+1,iz))*h2_4;
+							D[0][2] = D[2][0] = (ACC(ix-1,iy,iz-1)-ACC(ix-1,iy,iz+1)-ACC(ix+1,iy,iz-1)+ACC(ix+1,iy,iz+1))*h2_4;
+							D[1][2] = D[2][1] = (ACC(ix,iy-1,iz-1)-ACC(ix,iy-1,iz+1)-ACC(ix,iy+1,iz-1)+ACC(ix,iy+1,iz+1))*h2_4;
 						
-						D[0][0] += 1.0;
-						D[1][1] += 1.0;
-						D[2][2] += 1.0;
+							D[0][0] += 1.0;
+							D[1][1] += 1.0;
+							D[2][2] += 1.0;
 						
-						double det = D[0][0]*D[1][1]*D[2][2]
-						-	D[0][0]*D[1][2]*D[2][1]
-						-   D[1][0]*D[0][1]*D[2][2]
-						+	D[1][0]*D[0][2]*D[1][2]
-						+	D[2][0]*D[0][1]*D[1][2]
-						-	D[2][0]*D[0][2]*D[1][1];
+							double det = D[0][0]*D[1][1]*D[2][2]
+							-	D[0][0]*D[1][2]*D[2][1]
+							-   D[1][0]*D[0][1]*D[2][2]
+							+	D[1][0]*D[0][2]*D[1][2]
+							+	D[2][0]*D[0][1]*D[1][2]
+							-	D[2][0]*D[0][2]*D[1][1];
 						
-						(*pvar)(ix,iy,iz) = 1.0/det-1.0;
+							(*pvar)(ix,iy,iz) = 1.0/det-1.0;
 						
-					}
+						}
 		}
 		else if ( order == 4 )
 		{
-			#pragma omp parallel for 
-			for( int ix = 0; ix < (int)(*u.get_grid(ilevel)).size(0); ++ix )
-				for( int iy = 0; iy < (int)(*u.get_grid(ilevel)).size(1); ++iy )
-					for( int iz = 0; iz < (int)(*u.get_grid(ilevel)).size(2); ++iz )
-					{
-						double D[3][3];
+			#pragma omp parallel for schedule(static)
+			for( int ib = 0; ib < (int)bricks.size(); ++ib )
+				for( int ix = bricks[ib].ix0; ix < bricks[ib].ix1; ++ix )
+					for( int iy = bricks[ib].iy0; iy < bricks[ib].iy1; ++iy )
+						for( int iz = bricks[ib].iz0; iz < bricks[ib].iz1; ++iz )
+						{
+							double D[3][3];
 						
-						D[0][0] = (-ACC(ix-2,iy,iz)+16.*ACC(ix-1,iy,iz)-30.0*ACC(ix,iy,iz)+16.*ACC(ix+1,iy,iz)-ACC(ix+2,iy,iz)) * h2/12.0;
-						D[1][1] = (-ACC(ix,iy-2,iz)+16.*ACC(ix,iy-1,iz)-30.0*ACC(ix,iy,iz)+16.*ACC(ix,iy+1,iz)-ACC(ix,iy+2,iz)) * h2/12.0;
-						D[2][2] = (-ACC(ix,iy,iz-2)+16.*ACC(ix,iy,iz-1)-30.0*ACC(ix,iy,iz)+16.*ACC(ix,iy,iz+1)-ACC(ix,iy,iz+2)) * h2/12.0;
+							D[0][0] = (-ACC(ix-2,iy,iz)+16.*ACC(ix-1,iy,iz)-30.0*ACC(ix,iy,iz)+16.*ACC(ix+1,iy,iz)-ACC(ix+2,iy,iz)) * h2/12.0;
+							D[1][1] = (-ACC(ix,iy-2,iz)+16.*ACC(ix,iy-1,iz)-30.0*ACC(ix,iy,iz)+16.*ACC(ix,iy+1,iz)-ACC(ix,iy+2,iz)) * h2/12.0;
+							D[2][2] = (-ACC(ix,iy,iz-2)+16.*ACC(ix,iy,iz-1)-30.0*ACC(ix,iy,iz)+16.*ACC(ix,iy,iz+1)-ACC(ix,iy,iz+2)) * h2/12.0;
 						
-						D[0][1] = D[1][0] = (ACC(ix-1,iy-1,iz)-ACC(ix-1,iy+1,iz)-ACC(ix+1,iy-1,iz)+ACC(ix+1,iy+1,iz))*h2_4;
-						D[0][2] = D[2][0] = (ACC(ix-1,iy,iz-1)-ACC(ix-1,iy,iz+1)-ACC(ix+1,iy,iz-1)+ACC(ix+1,iy,iz+1))*h2_4;
-						D[1][2] = D[2][1] = (ACC(ix,iy-1,iz-1)-ACC(ix,iy-1,iz+1)-ACC(ix,iy+1,iz-1)+ACC(ix,iy+1,iz+1))*h2_4;
+							D[0][1] = D[1][0] = (ACC(ix-1,iy-1,iz)-ACC(ix-1,iy+1,iz)-ACC(ix+1,iy-1,iz)+ACC(ix+1,iy+1,iz))*h2_4;
+							D[0][2] = D[2][0] = (ACC(ix-1,iy,iz-1)-ACC(ix-1,iy,iz+1)-ACC(ix+1,iy,iz-1)+ACC(ix+1,iy,iz+1))*h2_4;
+							D[1][2] = D[2][1] = (ACC(ix,iy-1,iz-1)-ACC(ix,iy-1,iz+1)-ACC(ix,iy+1,iz-1)+ACC(ix,iy+1,iz+1))*h2_4;
 						
 						
-						D[0][0] += 1.0;
-						D[1][1] += 1.0;
-						D[2][2] += 1.0;
+							D[0][0] += 1.0;
+							D[1][1] += 1.0;
+							D[2][2] += 1.0;
 						
-						double det = D[0][0]*D[1][1]*D[2][2]
-						-	D[0][0]*D[1][2]*D[2][1]
-						-   D[1][0]*D[0][1]*D[2][2]
-						+	D[1][0]*D[0][2]*D[1][2]
-						+	D[2][0]*D[0][1]*D[1][2]
-						-	D[2][0]*D[0][2]*D[1][1];
+							double det = D[0][0]*D[1][1]*D[2][2]
+							-	D[0][0]*D[1][2]*D[2][1]
+							-   D[1][0]*D[0][1]*D[2][2]
+							+	D[1][0]*D[0][2]*D[1][2]
+							+	D[2][0]*D[0][1]*D[1][2]
+							-	D[2][0]*D[0][2]*D[1][1];
 						
-						(*pvar)(ix,iy,iz) = 1.0/det-1.0;
+							(*pvar)(ix,iy,iz) = 1.0/det-1.0;
 						
-					}
+						}
 		}
 		else if ( order == 6 )
 		{
 			h2_4/=36.;
 			h2/=180.;
-			#pragma omp parallel for 
-			for( int ix = 0; ix < (int)(*u.get_grid(ilevel)).size(0); ++ix )
-				for( int iy = 0; iy < (int)(*u.get_grid(ilevel)).size(1); ++iy )
-					for( int iz = 0; iz < (int)(*u.get_grid(ilevel)).size(2); ++iz )
-					{
-						double D[3][3];
+			#pragma omp parallel for schedule(static)
+			for( int ib = 0; ib < (int)bricks.size(); ++ib )
+				for( int ix = bricks[ib].ix0; ix < bricks[ib].ix1; ++ix )
+					for( int iy = bricks[ib].iy0; iy < bricks[ib].iy1; ++iy )
+						for( int iz = bricks[ib].iz0; iz < bricks[ib].iz1; ++iz )
+						{
+							double D[3][3];
 						
-						D[0][0] = (2.*ACC(ix-3,iy,iz)-27.*ACC(ix-2,iy,iz)+270.*ACC(ix-1,iy,iz)-490.0*ACC(ix,iy,iz)+270.*ACC(ix+1,iy,iz)-27.*ACC(ix+2,iy,iz)+2.*ACC(ix+3,iy,iz)) * h2;
-						D[1][1] = (2.*ACC(ix,iy-3,iz)-27.*ACC(ix,iy-2,iz)+270.*ACC(ix,iy-1,iz)-490.0*ACC(ix,iy,iz)+270.*ACC(ix,iy+1,iz)-27.*ACC(ix,iy+2,iz)+2.*ACC(ix,iy+3,iz)) * h2;
-						D[2][2] = (2.*ACC(ix,iy,iz-3)-27.*ACC(ix,iy,iz-2)+270.*ACC(ix,iy,iz-1)-490.0*ACC(ix,iy,iz)+270.*ACC(ix,iy,iz+1)-27.*ACC(ix,iy,iz+2)+2.*ACC(ix,iy,iz+3)) * h2;
+							D[0][0] = (2.*ACC(ix-3,iy,iz)-27.*ACC(ix-2,iy,iz)+270.*ACC(ix-1,iy,iz)-490.0*ACC(ix,iy,iz)+270.*ACC(ix+1,iy,iz)-27.*ACC(ix+2,iy,iz)+2.*ACC(ix+3,iy,iz)) * h2;
+							D[1][1] = (2.*ACC(ix,iy-3,iz)-27.*ACC(ix,iy-2,iz)+270.*ACC(ix,iy-1,iz)-490.0*ACC(ix,iy,iz)+270.*ACC(ix,iy+1,iz)-27.*ACC(ix,iy+2,iz)+2.*ACC(ix,iy+3,iz)) * h2;
+							D[2][2] = (2.*ACC(ix,iy,iz-3)-27.*ACC(ix,iy,iz-2)+270.*ACC(ix,iy,iz-1)-490.0*ACC(ix,iy,iz)+270.*ACC(ix,iy,iz+1)-27.*ACC(ix,iy,iz+2)+2.*ACC(ix,iy,iz+3)) * h2;
 						
-						//.. this is actually 8th order accurate
-						D[0][1] = D[1][0] = (64.*(ACC(ix-1,iy-1,iz)-ACC(ix-1,iy+1,iz)-ACC(ix+1,iy-1,iz)+ACC(ix+1,iy+1,iz))
-											 -8.*(ACC(ix-2,iy-1,iz)-ACC(ix+2,iy-1,iz)-ACC(ix-2,iy+1,iz)+ACC(ix+2,iy+1,iz)
-												+ ACC(ix-1,iy-2,iz)-ACC(ix-1,iy+2,iz)-ACC(ix+1,iy-2,iz)+ACC(ix+1,iy+2,iz))
-											 +1.*(ACC(ix-2,iy-2,iz)-ACC(ix-2,iy+2,iz)-ACC(ix+2,iy-2,iz)+ACC(ix+2,iy+2,iz)))*h2_4;
-						D[0][2] = D[2][0] = (64.*(ACC(ix-1,iy,iz-1)-ACC(ix-1,iy,iz+1)-ACC(ix+1,iy,iz-1)+ACC(ix+1,iy,iz+1))
-											 -8.*(ACC(ix-2,iy,iz-1)-ACC(ix+2,iy,iz-1)-ACC(ix-2,iy,iz+1)+ACC(ix+2,iy,iz+1)
-												+ ACC(ix-1,iy,iz-2)-ACC(ix-1,iy,iz+2)-ACC(ix+1,iy,iz-2)+ACC(ix+1,iy,iz+2))
-											 +1.*(ACC(ix-2,iy,iz-2)-ACC(ix-2,iy,iz+2)-ACC(ix+2,iy,iz-2)+ACC(ix+2,iy,iz+2)))*h2_4;
-						D[1][2] = D[2][1] = (64.*(ACC(ix,iy-1,iz-1)-ACC(ix,iy-1,iz+1)-ACC(ix,iy+1,iz-1)+ACC(ix,iy+1,iz+1))
-											 -8.*(ACC(ix,iy-2,iz-1)-ACC(ix,iy+2,iz-1)-ACC(ix,iy-2,iz+1)+ACC(ix,iy+2,iz+1)
-												+ ACC(ix,iy-1,iz-2)-ACC(ix,iy-1,iz+2)-ACC(ix,iy+1,iz-2)+ACC(ix,iy+1,iz+2))
-											 +1.*(ACC(ix,iy-2,iz-2)-ACC(ix,iy-2,iz+2)-ACC(ix,iy+2,iz-2)+ACC(ix,iy+2,iz+2)))*h2_4;
+							//.. this is actually 8th order accurate
+							D[0][1] = D[1][0] = (64.*(ACC(ix-1,iy-1,iz)-ACC(ix-1,iy+1,iz)-ACC(ix+1,iy-1,iz)+ACC(ix+1,iy+1,iz))
+												 -8.*(ACC(ix-2,iy-1,iz)-ACC(ix+2,iy-1,iz)-ACC(ix-2,iy+1,iz)+ACC(ix+2,iy+1,iz)
+													+ ACC(ix-1,iy-2,iz)-ACC(ix-1,iy+2,iz)-ACC(ix+1,iy-2,iz)+ACC(ix+1,iy+2,iz))
+												 +1.*(ACC(ix-2,iy-2,iz)-ACC(ix-2,iy+2,iz)-ACC(ix+2,iy-2,iz)+ACC(ix+2,iy+2,iz)))*h2_4;
+							D[0][2] = D[2][0] = (64.*(ACC(ix-1,iy,iz-1)-ACC(ix-1,iy,iz+1)-ACC(ix+1,iy,iz-1)+ACC(ix+1,iy,iz+1))
+												 -8.*(ACC(ix-2,iy,iz-1)-ACC(ix+2,iy,iz-1)-ACC(ix-2,iy,iz+1)+ACC(ix+2,iy,iz+1)
+													+ ACC(ix-1,iy,iz-2)-ACC(ix-1,iy,iz+2)-ACC(ix+1,iy,iz-2)+ACC(ix+1,iy,iz+2))
+												 +1.*(ACC(ix-2,iy,iz-2)-ACC(ix-2,iy,iz+2)-ACC(ix+2,iy,iz-2)+ACC(ix+2,iy,iz+2)))*h2_4;
+							D[1][2] = D[2][1] = (64.*(ACC(ix,iy-1,iz-1)-ACC(ix,iy-1,iz+1)-ACC(ix,iy+1,iz-1)+ACC(ix,iy+1,iz+1))
+												 -8.*(ACC(ix,iy-2,iz-1)-ACC(ix,iy+2,iz-1)-ACC(ix,iy-2,iz+1)+ACC(ix,iy+2,iz+1)
+													+ ACC(ix,iy-1,iz-2)-ACC(ix,iy-1,iz+2)-ACC(ix,iy+1,iz-2)+ACC(ix,iy+1,iz+2))
+												 +1.*(ACC(ix,iy-2,iz-2)-ACC(ix,iy-2,iz+2)-ACC(ix,iy+2,iz-2)+ACC(ix,iy+2,iz+2)))*h2_4;
 						
-						D[0][0] += 1.0;
-						D[1][1] += 1.0;
-						D[2][2] += 1.0;
+							D[0][0] += 1.0;
+							D[1][1] += 1.0;
+							D[2][2] += 1.0;
 						
-						double det = D[0][0]*D[1][1]*D[2][2]
-						-	D[0][0]*D[1][2]*D[2][1]
-						-   D[1][0]*D[0][1]*D[2][2]
-						+	D[1][0]*D[0][2]*D[1][2]
-						+	D[2][0]*D[0][1]*D[1][2]
-						-	D[2][0]*D[0][2]*D[1][1];
+							double det = D[0][0]*D[1][1]*D[2][2]
+							-	D[0][0]*D[1][2]*D[2][1]
+							-   D[1][0]*D[0][1]*D[2][2]
+							+	D[1][0]*D[0][2]*D[1][2]
+							+	D[2][0]*D[0][1]*D[1][2]
+							-	D[2][0]*D[0][2]*D[1][1];
 						
-						(*pvar)(ix,iy,iz) = 1.0/det-1.0;
+							(*pvar)(ix,iy,iz) = 1.0/det-1.0;
 						
-					}
+						}
 			
 		}else
 			throw std::runtime_error("compute_LLA_density : invalid operator order specified");
@@ -176,324 +295,292 @@ void compute_Lu_density( const grid_hierarchy& u, grid_hierarchy& fnew, unsigned
 }
 
 
-void compute_2LPT_source_FFT( config_file& cf_, const grid_hierarchy& u, grid_hierarchy& fnew )
+namespace{
+
+//! in-place complex to real transform of a padded nx*ny*nzp array, or of this rank's slab of it
+void inverse_fft_inplace( const fft_mpi::slab& sl, fftw_real *data )
 {
-	if( u.levelmin() != u.levelmax() )
-		throw std::runtime_error("FFT 2LPT can only be run in Unigrid mode!");
-	
-	fnew = u;
-	size_t nx,ny,nz,nzp;
-	nx = u.get_grid(u.levelmax())->size(0);
-	ny = u.get_grid(u.levelmax())->size(1);
-	nz = u.get_grid(u.levelmax())->size(2);
-	nzp = 2*(nz/2+1);
-	
-	//... copy data ..................................................
-	fftw_real *data = new fftw_real[nx*ny*nzp];
-	fftw_complex *cdata = reinterpret_cast<fftw_complex*> (data);
-	
-	fftw_complex	*cdata_11, *cdata_12, *cdata_13, *cdata_22, *cdata_23, *cdata_33;
-	fftw_real		*data_11, *data_12, *data_13, *data_22, *data_23, *data_33;
-	
-	data_11 = new fftw_real[nx*ny*nzp]; cdata_11 = reinterpret_cast<fftw_complex*> (data_11);
-	data_12 = new fftw_real[nx*ny*nzp]; cdata_12 = reinterpret_cast<fftw_complex*> (data_12);
-	data_13 = new fftw_real[nx*ny*nzp]; cdata_13 = reinterpret_cast<fftw_complex*> (data_13);
-	data_22 = new fftw_real[nx*ny*nzp]; cdata_22 = reinterpret_cast<fftw_complex*> (data_22);
-	data_23 = new fftw_real[nx*ny*nzp]; cdata_23 = reinterpret_cast<fftw_complex*> (data_23);
-	data_33 = new fftw_real[nx*ny*nzp]; cdata_33 = reinterpret_cast<fftw_complex*> (data_33);
-	
-	#pragma omp parallel for
-	for( int i=0; i<(int)nx; ++i )
-		for( size_t j=0; j<ny; ++j )	
-			for( size_t k=0; k<nz; ++k )
-			{
-				size_t idx = ((size_t)i*ny+j)*nzp+k;
-				data[idx] = (*u.get_grid(u.levelmax()))(i,j,k);
-			}
-	
-	//... perform FFT and Poisson solve................................
+	size_t nx = sl.n0, ny = sl.n1, nz = sl.n2;
 #ifdef FFTW3
-	
-	#ifdef SINGLE_PRECISION
-	fftwf_plan
-		plan  = fftwf_plan_dft_r2c_3d(nx,ny,nz, data, cdata, FFTW_ESTIMATE),
-		iplan = fftwf_plan_dft_c2r_3d(nx,ny,nz, cdata, data, FFTW_ESTIMATE),
-		ip11  = fftwf_plan_dft_c2r_3d(nx,ny,nz, cdata_11, data_11, FFTW_ESTIMATE),
-		ip12  = fftwf_plan_dft_c2r_3d(nx,ny,nz, cdata_12, data_12, FFTW_ESTIMATE),
-		ip13  = fftwf_plan_dft_c2r_3d(nx,ny,nz, cdata_13, data_13, FFTW_ESTIMATE),
-		ip22  = fftwf_plan_dft_c2r_3d(nx,ny,nz, cdata_22, data_22, FFTW_ESTIMATE),
-		ip23  = fftwf_plan_dft_c2r_3d(nx,ny,nz, cdata_23, data_23, FFTW_ESTIMATE),
-		ip33  = fftwf_plan_dft_c2r_3d(nx,ny,nz, cdata_33, data_33, FFTW_ESTIMATE);
-	
-	fftwf_execute(plan);
-	
+#ifdef USE_FFTW_MPI
+	if( fft_mpi::active() )
+	{
+		fft_mpi::backward( sl, data );
+		return;
+	}
+#endif
+	fft_plans::transform iplan = fft_plans::c2r(nx,ny,nz, reinterpret_cast<fftw_complex*>(data), data);
+	fft_plans::execute(iplan);
+#else
+	rfftwnd_plan iplan = rfftw3d_create_plan( nx,ny,nz, FFTW_COMPLEX_TO_REAL, FFTW_ESTIMATE|FFTW_IN_PLACE);
+	#ifndef SINGLETHREAD_FFTW
+	rfftwnd_threads_one_complex_to_real( omp_get_max_threads(), iplan, reinterpret_cast<fftw_complex*>(data), NULL );
 	#else
-	
-	fftw_plan
-		plan  = fftw_plan_dft_r2c_3d(nx,ny,nz, data, cdata, FFTW_ESTIMATE),
-		iplan = fftw_plan_dft_c2r_3d(nx,ny,nz, cdata, data, FFTW_ESTIMATE),
-		ip11  = fftw_plan_dft_c2r_3d(nx,ny,nz, cdata_11, data_11, FFTW_ESTIMATE),
-		ip12  = fftw_plan_dft_c2r_3d(nx,ny,nz, cdata_12, data_12, FFTW_ESTIMATE),
-		ip13  = fftw_plan_dft_c2r_3d(nx,ny,nz, cdata_13, data_13, FFTW_ESTIMATE),
-		ip22  = fftw_plan_dft_c2r_3d(nx,ny,nz, cdata_22, data_22, FFTW_ESTIMATE),
-		ip23  = fftw_plan_dft_c2r_3d(nx,ny,nz, cdata_23, data_23, FFTW_ESTIMATE),
-		ip33  = fftw_plan_dft_c2r_3d(nx,ny,nz, cdata_33, data_33, FFTW_ESTIMATE);
-	
-	fftw_execute(plan);
-	
+	rfftwnd_one_complex_to_real( iplan, reinterpret_cast<fftw_complex*>(data), NULL );
 	#endif
-	
-	double kfac = 2.0*M_PI;
-	double norm = 1.0/((double)(nx*ny*nz));
+	rfftwnd_destroy_plan(iplan);
+#endif
+}
+
+//! real space (a,b) component of the Hessian of the potential with spectrum cdata, into the padded array data_ab
+void hessian_component_FFT( int a, int b, const fft_mpi::slab& sl, const double *kfac,
+						   const fftw_complex *cdata, fftw_real *data_ab )
+{
+	size_t nx = sl.n0, ny = sl.n1, nz = sl.n2;
+	size_t nzp = 2*(nz/2+1);
+	double norm = 1.0/((double)nx*(double)ny*(double)nz);
+	fftw_complex *cdata_ab = reinterpret_cast<fftw_complex*>(data_ab);
 	
 	#pragma omp parallel for
-	for( int i=0; i<(int)nx; ++i )
-		for( size_t j=0; j<ny; ++j )	
+	for( int i=0; i<sl.local_n0; ++i )
+		for( size_t j=0; j<ny; ++j )
 			for( size_t l=0; l<nz/2+1; ++l )
 			{
-				int ii = i; if(ii>(int)nx/2) ii-=nx;
+				int gi = i+sl.local_0_start;
+				int ii = gi; if(ii>(int)nx/2) ii-=nx;
 				int jj = (int)j; if(jj>(int)ny/2) jj-=ny;
-				double ki = (double)ii;
-				double kj = (double)jj;
-				double kk = (double)l;
 				
 				double k[3];
-				k[0] = (double)ki * kfac;
-				k[1] = (double)kj * kfac;
-				k[2] = (double)kk * kfac;
+				k[0] = (double)ii * kfac[0];
+				k[1] = (double)jj * kfac[1];
+				k[2] = (double)l * kfac[2];
 				
 				size_t idx = ((size_t)i*ny+j)*nzp/2+l;
-				//double re = cdata[idx][0];
-				//double im = cdata[idx][1];
-				
-				cdata_11[idx][0] = -k[0]*k[0] * cdata[idx][0] * norm;
-				cdata_11[idx][1] = -k[0]*k[0] * cdata[idx][1] * norm;
-				
-				cdata_12[idx][0] = -k[0]*k[1] * cdata[idx][0] * norm;
-				cdata_12[idx][1] = -k[0]*k[1] * cdata[idx][1] * norm;
-				
-				cdata_13[idx][0] = -k[0]*k[2] * cdata[idx][0] * norm;
-				cdata_13[idx][1] = -k[0]*k[2] * cdata[idx][1] * norm;
+				double fac = -k[a]*k[b] * norm;
 				
-				cdata_22[idx][0] = -k[1]*k[1] * cdata[idx][0] * norm;
-				cdata_22[idx][1] = -k[1]*k[1] * cdata[idx][1] * norm;
-				
-				cdata_23[idx][0] = -k[1]*k[2] * cdata[idx][0] * norm;
-				cdata_23[idx][1] = -k[1]*k[2] * cdata[idx][1] * norm;
-				
-				cdata_33[idx][0] = -k[2]*k[2] * cdata[idx][0] * norm;
-				cdata_33[idx][1] = -k[2]*k[2] * cdata[idx][1] * norm;
-				
-				
-				if( i==(int)nx/2||j==ny/2||l==nz/2)
-				{
-					cdata_11[idx][0] = 0.0;
-					cdata_11[idx][1] = 0.0;
-					
-					cdata_12[idx][0] = 0.0;
-					cdata_12[idx][1] = 0.0;
-					
-					cdata_13[idx][0] = 0.0;
-					cdata_13[idx][1] = 0.0;
-					
-					cdata_22[idx][0] = 0.0;
-					cdata_22[idx][1] = 0.0;
-					
-					cdata_23[idx][0] = 0.0;
-					cdata_23[idx][1] = 0.0;
-					
-					cdata_33[idx][0] = 0.0;
-					cdata_33[idx][1] = 0.0;
-				}
+				if( gi==(int)nx/2||j==ny/2||l==nz/2)
+					fac = 0.0;
 				
+				RE(cdata_ab[idx]) = fac * RE(cdata[idx]);
+				IM(cdata_ab[idx]) = fac * IM(cdata[idx]);
 			}
 	
-	delete[] data;
-	/*cdata_11[0][0]	= 0.0; cdata_11[0][1]	= 0.0;
-	 cdata_12[0][0]	= 0.0; cdata_12[0][1]	= 0.0;
-	 cdata_13[0][0]	= 0.0; cdata_13[0][1]	= 0.0;
-	 cdata_22[0][0]	= 0.0; cdata_22[0][1]	= 0.0;
-	 cdata_23[0][0]	= 0.0; cdata_23[0][1]	= 0.0;
-	 cdata_33[0][0]	= 0.0; cdata_33[0][1]	= 0.0;*/
-	
-	
-#ifdef SINGLE_PRECISION
-	fftwf_execute(ip11);
-	fftwf_execute(ip12);
-	fftwf_execute(ip13);
-	fftwf_execute(ip22);
-	fftwf_execute(ip23);
-	fftwf_execute(ip33);
-	
-	fftwf_destroy_plan(plan);
-	fftwf_destroy_plan(iplan);
-	fftwf_destroy_plan(ip11);
-	fftwf_destroy_plan(ip12);
-	fftwf_destroy_plan(ip13);
-	fftwf_destroy_plan(ip22);
-	fftwf_destroy_plan(ip23);
-	fftwf_destroy_plan(ip33);
-#else
-	fftw_execute(ip11);
-	fftw_execute(ip12);
-	fftw_execute(ip13);
-	fftw_execute(ip22);
-	fftw_execute(ip23);
-	fftw_execute(ip33);
-	
-	fftw_destroy_plan(plan);
-	fftw_destroy_plan(iplan);
-	fftw_destroy_plan(ip11);
-	fftw_destroy_plan(ip12);
-	fftw_destroy_plan(ip13);
-	fftw_destroy_plan(ip22);
-	fftw_destroy_plan(ip23);
-	fftw_destroy_plan(ip33);
+	inverse_fft_inplace( sl, data_ab );
+}
 
-#endif
-//#endif
-	
+/*!
+ * @brief accumulate the second order source phi_ii phi_jj - phi_ij^2 one Hessian component at a time
+ *
+ * data holds the potential on a padded nx*ny*nzp grid, or this rank's slab of it, and is
+ * overwritten by its spectrum. The
+ * source is written to out(i-ox,j-oy,k-oz) for the n[0]*n[1]*n[2] cells starting at (ox,oy,oz).
+ * Besides data only two more grids are needed: one that accumulates the diagonal components
+ * and one for the component currently transformed.
+ */
+void compute_2LPT_source_FFT_lowmem( const fft_mpi::slab& sl, const double *kfac, fftw_real *data,
+									meshvar_bnd& out, const int *ox, const size_t *n )
+{
+	size_t nx = sl.n0, ny = sl.n1, nz = sl.n2;
+	size_t nzp = 2*(nz/2+1), ntot = (size_t)sl.local_n0*ny*nzp;
+	fftw_complex *cdata = reinterpret_cast<fftw_complex*> (data);
 	
+	//... perform FFT ..................................................
+#ifdef FFTW3
+#ifdef USE_FFTW_MPI
+	if( fft_mpi::active() )
+		fft_mpi::forward( sl, data );
+	else
+#endif
+	{
+		fft_plans::transform plan = fft_plans::r2c(nx,ny,nz, data, cdata);
+		fft_plans::execute(plan);
+	}
 #else
-	rfftwnd_plan 
-		plan = rfftw3d_create_plan( nx,ny,nz,
-								   FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE|FFTW_IN_PLACE),
-		iplan = rfftw3d_create_plan( nx,ny,nz,
-									FFTW_COMPLEX_TO_REAL, FFTW_ESTIMATE|FFTW_IN_PLACE);
-	
-	
-	#ifndef SINGLETHREAD_FFTW		
+	rfftwnd_plan plan = rfftw3d_create_plan( nx,ny,nz, FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE|FFTW_IN_PLACE);
+	#ifndef SINGLETHREAD_FFTW
 	rfftwnd_threads_one_real_to_complex( omp_get_max_threads(), plan, data, NULL );
 	#else
 	rfftwnd_one_real_to_complex( plan, data, NULL );
 	#endif
-//#endif
-	//double fac = -1.0/(nx*ny*nz);
-	double kfac = 2.0*M_PI;
-	double norm = 1.0/((double)(nx*ny*nz));
+	rfftwnd_destroy_plan(plan);
+#endif
 	
-	#pragma omp parallel for
-	for( int i=0; i<(int)nx; ++i )
-		for( size_t j=0; j<ny; ++j )	
-			for( size_t l=0; l<nz/2+1; ++l )
-			{
-				int ii = (int)i; if(ii>(int)(nx/2)) ii-=(int)nx;
-				int jj = (int)j; if(jj>(int)(ny/2)) jj-=(int)ny;
-				double ki = (double)ii;
-				double kj = (double)jj;
-				double kk = (double)l;
-				
-				double k[3];
-				k[0] = (double)ki * kfac;
-				k[1] = (double)kj * kfac;
-				k[2] = (double)kk * kfac;
-				
-				size_t idx = ((size_t)i*ny+j)*nzp/2+l;
-				//double re = cdata[idx].re;
-				//double im = cdata[idx].im;
-				
-				cdata_11[idx].re = -k[0]*k[0] * cdata[idx].re * norm;
-				cdata_11[idx].im = -k[0]*k[0] * cdata[idx].im * norm;
-				
-				cdata_12[idx].re = -k[0]*k[1] * cdata[idx].re * norm;
-				cdata_12[idx].im = -k[0]*k[1] * cdata[idx].im * norm;
-				
-				cdata_13[idx].re = -k[0]*k[2] * cdata[idx].re * norm;
-				cdata_13[idx].im = -k[0]*k[2] * cdata[idx].im * norm;
-				
-				cdata_22[idx].re = -k[1]*k[1] * cdata[idx].re * norm;
-				cdata_22[idx].im = -k[1]*k[1] * cdata[idx].im * norm;
-				
-				cdata_23[idx].re = -k[1]*k[2] * cdata[idx].re * norm;
-				cdata_23[idx].im = -k[1]*k[2] * cdata[idx].im * norm;
-				
-				cdata_33[idx].re = -k[2]*k[2] * cdata[idx].re * norm;
-				cdata_33[idx].im = -k[2]*k[2] * cdata[idx].im * norm;
-				
-				
-				if( i==(int)(nx/2)||j==ny/2||l==nz/2)
+	fftw_real *data_sum = new fftw_real[ntot], *data_ab = new fftw_real[ntot];
+	
+	const int ox_ = ox[0], oy_ = ox[1], oz_ = ox[2];
+	#define OUT(i,j,k) out((int)(i)-ox_,(int)(j)-oy_,(int)(k)-oz_)
+	
+	//... phi_11 phi_22 + (phi_11+phi_22) phi_33 ........................
+	hessian_component_FFT( 0, 0, sl, kfac, cdata, data_sum );
+	
+	for( int c=1; c<3; ++c )
+	{
+		hessian_component_FFT( c, c, sl, kfac, cdata, data_ab );
+		
+		#pragma omp parallel for
+		for( int i=ox_; i<ox_+(int)n[0]; ++i )
+			for( size_t j=oy_; j<oy_+n[1]; ++j )
+				for( size_t k=oz_; k<oz_+n[2]; ++k )
 				{
-					cdata_11[idx].re = 0.0;
-					cdata_11[idx].im = 0.0;
-					
-					cdata_12[idx].re = 0.0;
-					cdata_12[idx].im = 0.0;
-					
-					cdata_13[idx].re = 0.0;
-					cdata_13[idx].im = 0.0;
-					
-					cdata_22[idx].re = 0.0;
-					cdata_22[idx].im = 0.0;
-					
-					cdata_23[idx].re = 0.0;
-					cdata_23[idx].im = 0.0;
-					
-					cdata_33[idx].re = 0.0;
-					cdata_33[idx].im = 0.0;
+					size_t ii = ((size_t)i*ny+j)*nzp+k;
+					//... form the products in double, each term is rounded once
+					double prod = (double)data_sum[ii]*(double)data_ab[ii];
+					if( c==1 )
+						OUT(i,j,k) = prod;
+					else
+						OUT(i,j,k) = (double)OUT(i,j,k) + prod;
 				}
-				
-			}
-	
-	delete[] data;
-	/*cdata_11[0].re	= 0.0; cdata_11[0].im	= 0.0;
-	cdata_12[0].re	= 0.0; cdata_12[0].im	= 0.0;
-	cdata_13[0].re	= 0.0; cdata_13[0].im	= 0.0;
-	cdata_22[0].re	= 0.0; cdata_22[0].im	= 0.0;
-	cdata_23[0].re	= 0.0; cdata_23[0].im	= 0.0;
-	cdata_33[0].re	= 0.0; cdata_33[0].im	= 0.0;*/
-	
-	
-#ifndef SINGLETHREAD_FFTW		
-	//rfftwnd_threads_one_complex_to_real( omp_get_max_threads(), iplan, cdata, NULL );
-	rfftwnd_threads_one_complex_to_real( omp_get_max_threads(), iplan, cdata_11, NULL );
-	rfftwnd_threads_one_complex_to_real( omp_get_max_threads(), iplan, cdata_12, NULL );
-	rfftwnd_threads_one_complex_to_real( omp_get_max_threads(), iplan, cdata_13, NULL );
-	rfftwnd_threads_one_complex_to_real( omp_get_max_threads(), iplan, cdata_22, NULL );
-	rfftwnd_threads_one_complex_to_real( omp_get_max_threads(), iplan, cdata_23, NULL );
-	rfftwnd_threads_one_complex_to_real( omp_get_max_threads(), iplan, cdata_33, NULL );
-#else
-	//rfftwnd_one_complex_to_real( iplan, cdata, NULL );
-	rfftwnd_one_complex_to_real(iplan, cdata_11, NULL );
-	rfftwnd_one_complex_to_real(iplan, cdata_12, NULL );
-	rfftwnd_one_complex_to_real(iplan, cdata_13, NULL );
-	rfftwnd_one_complex_to_real(iplan, cdata_22, NULL );
-	rfftwnd_one_complex_to_real(iplan, cdata_23, NULL );
-	rfftwnd_one_complex_to_real(iplan, cdata_33, NULL );
-#endif
+		
+		if( c==1 )
+		{
+			#pragma omp parallel for
+			for( long ii=0; ii<(long)ntot; ++ii )
+				data_sum[ii] += data_ab[ii];
+		}
+	}
 	
+	//... release the accumulator early ................................
+	delete[] data_sum;
 	
+	//... - phi_12^2 - phi_13^2 - phi_23^2 .............................
+	for( int a=0; a<2; ++a )
+		for( int b=a+1; b<3; ++b )
+		{
+			hessian_component_FFT( a, b, sl, kfac, cdata, data_ab );
+			
+			#pragma omp parallel for
+			for( int i=ox_; i<ox_+(int)n[0]; ++i )
+				for( size_t j=oy_; j<oy_+n[1]; ++j )
+					for( size_t k=oz_; k<oz_+n[2]; ++k )
+					{
+						size_t ii = ((size_t)i*ny+j)*nzp+k;
+						OUT(i,j,k) = (double)OUT(i,j,k) - (double)data_ab[ii]*(double)data_ab[ii];
+					}
+		}
 	
-	rfftwnd_destroy_plan(plan);
-	rfftwnd_destroy_plan(iplan);
-#endif
+	#undef OUT
+	delete[] data_ab;
+}
 
+}
 
-	//... copy data ..........................................
-	#pragma omp parallel for
-	for( int i=0; i<(int)nx; ++i )
-		for( size_t j=0; j<ny; ++j )	
-			for( size_t k=0; k<nz; ++k )
+namespace{
+
+//! trilinear interpolation of the potential from the finest coarser level containing the point
+/*! (gi,gj,gk) is the absolute index of a cell at level ilevel, the coarsest level is periodic */
+double sample_coarse_potential( const grid_hierarchy& u, int ilevel, int gi, int gj, int gk )
+{
+	int g[3] = { gi, gj, gk };
+	
+	for( int lev=ilevel-1; lev>=(int)u.levelmin(); --lev )
+	{
+		double s = (double)(1<<(ilevel-lev));
+		int i0[3];
+		double w[3];
+		bool inside = true;
+		
+		for( int d=0; d<3; ++d )
+		{
+			double x = ((double)g[d]+0.5)/s - 0.5 - (double)u.offset_abs(lev,d);
+			i0[d] = (int)floor(x);
+			w[d] = x - (double)i0[d];
+			
+			if( lev == (int)u.levelmin() )
 			{
-				size_t ii = ((size_t)i*ny+j)*nzp+k;
-				(*fnew.get_grid(u.levelmax()))(i,j,k) = (( data_11[ii]*data_22[ii]-data_12[ii]*data_12[ii] ) +
-														 ( data_11[ii]*data_33[ii]-data_13[ii]*data_13[ii] ) +
-														 ( data_22[ii]*data_33[ii]-data_23[ii]*data_23[ii] ) );
-				
-				//(*fnew.get_grid(u.levelmax()))(i,j,k) = 
-				
+				int n = (int)u.size(lev,d);
+				i0[d] = ((i0[d] % n) + n) % n;
 			}
+			else if( i0[d] < 0 || i0[d]+1 >= (int)u.size(lev,d) )
+				inside = false;
+		}
+		
+		if( !inside )
+			continue;
+		
+		const meshvar_bnd& v = *u.get_grid(lev);
+		int i1[3];
+		for( int d=0; d<3; ++d )
+		{
+			i1[d] = i0[d]+1;
+			if( lev == (int)u.levelmin() && i1[d] == (int)u.size(lev,d) )
+				i1[d] = 0;
+		}
+		
+		return (1.0-w[0])*((1.0-w[1])*((1.0-w[2])*v(i0[0],i0[1],i0[2]) + w[2]*v(i0[0],i0[1],i1[2]))
+						   +     w[1] *((1.0-w[2])*v(i0[0],i1[1],i0[2]) + w[2]*v(i0[0],i1[1],i1[2])))
+			+      w[0] *((1.0-w[1])*((1.0-w[2])*v(i1[0],i0[1],i0[2]) + w[2]*v(i1[0],i0[1],i1[2]))
+						   +     w[1] *((1.0-w[2])*v(i1[0],i1[1],i0[2]) + w[2]*v(i1[0],i1[1],i1[2])));
+	}
 	
-	//delete[] data;
-	delete[] data_11;
-	delete[] data_12;
-	delete[] data_13;
-	delete[] data_23;
-	delete[] data_22;
-	delete[] data_33;
+	return 0.0;
+}
+
+}
+
+/*!
+ * @brief 2LPT source term computed spectrally
+ *
+ * The coarsest level is periodic and transformed as is. Every refinement level is transformed
+ * on a grid that is padded to twice its size, the padding is filled with the potential
+ * interpolated from the coarser levels (as for the isolated kernels), and only the part
+ * covered by the level is kept. In distributed runs the single level is a slab of the grid.
+ */
+void compute_2LPT_source_FFT( config_file& cf_, const grid_hierarchy& u, grid_hierarchy& fnew )
+{
+	memory_stats::stage mstage("2LPT source");
+	
+	fnew = u;
+	
+	for( unsigned ilevel=u.levelmin(); ilevel<=u.levelmax(); ++ilevel )
+	{
+		size_t nx,ny,nz,nzp;
+		int ox[3] = { 0, 0, 0 };
+		size_t n[3] = { u.size(ilevel,0), u.size(ilevel,1), u.size(ilevel,2) };
+		fft_mpi::slab sl;
+		
+		if( ilevel == u.levelmin() )
+		{
+			nx = fft_mpi::active()? (1<<ilevel) : n[0]; ny = n[1]; nz = n[2];
+			sl = fft_mpi::decompose( nx, ny, nz );
+			if( sl.local_n0 != (int)n[0] )
+			{
+				LOGERR("Slab of %d planes does not match the FFT decomposition.",(int)n[0]);
+				throw std::runtime_error("compute_2LPT_source_FFT : slab does not match the FFT decomposition");
+			}
+		}
+		else
+		{
+			nx = 2*n[0]; ny = 2*n[1]; nz = 2*n[2];
+			ox[0] = n[0]/2; ox[1] = n[1]/2; ox[2] = n[2]/2;
+			sl.n0 = nx; sl.n1 = ny; sl.n2 = nz;
+			sl.local_n0 = nx; sl.local_0_start = 0;
+			LOGUSER("Computing 2LPT source on padded %dx%dx%d grid for level %d",(int)nx,(int)ny,(int)nz,ilevel);
+		}
+		nzp = 2*(nz/2+1);
+		
+		//... copy data, padding from coarser levels .........................
+		fftw_real *data = new fftw_real[(size_t)sl.local_n0*ny*nzp];
+		const meshvar_bnd& v = *u.get_grid(ilevel);
+		
+		#pragma omp parallel for
+		for( int i=0; i<sl.local_n0; ++i )
+			for( size_t j=0; j<ny; ++j )	
+				for( size_t k=0; k<nz; ++k )
+				{
+					size_t idx = ((size_t)i*ny+j)*nzp+k;
+					int il = i-ox[0], jl = (int)j-ox[1], kl = (int)k-ox[2];
+					
+					if( il>=0 && il<(int)n[0] && jl>=0 && jl<(int)n[1] && kl>=0 && kl<(int)n[2] )
+						data[idx] = v(il,jl,kl);
+					else
+						data[idx] = sample_coarse_potential( u, ilevel, u.offset_abs(ilevel,0)+il,
+															u.offset_abs(ilevel,1)+jl, u.offset_abs(ilevel,2)+kl );
+				}
+		
+		//... the padded grid has size nx/2^ilevel in units of the box
+		double kfac[3] = { 2.0*M_PI*(double)(1<<ilevel)/(double)nx,
+			2.0*M_PI*(double)(1<<ilevel)/(double)ny, 2.0*M_PI*(double)(1<<ilevel)/(double)nz };
+		
+		compute_2LPT_source_FFT_lowmem( sl, kfac, data, *fnew.get_grid(ilevel), ox, n );
+		
+		delete[] data;
+	}
 }
 
 void compute_2LPT_source( const grid_hierarchy& u, grid_hierarchy& fnew, unsigned order )
 {
+	memory_stats::stage mstage("2LPT source");
+	
 	fnew = u;
     fnew.zero();
 	
@@ -12,6 +12,8 @@
 #define _COSMOLOGY_HH
 
 
+#include <vector>
+
 #include "transfer_function.hh"
 #include "mesh.hh"
 #include "general.hh"
@@ -21,10 +23,38 @@
  * @brief provides functions to compute cosmological quantities
  *
  * This class provides member functions to compute cosmological quantities
- * related to the Friedmann equations and linear perturbation theory
+ * related to the Friedmann equations and linear perturbation theory.
+ * The growth integral and the integrands of the power spectrum variance are
+ * tabulated on first use, so that repeated queries for D+, vfact and sigma(R)
+ * only interpolate or sum over the tables instead of integrating again.
  */
 class CosmoCalc
 {
+public:
+	//! window functions for ComputeSigma
+	enum window_type { tophat_window, gauss_window };
+
+protected:
+	//! power spectrum integrand k^3 T^2(k) k^n times quadrature weights on a grid in ln k
+	struct power_table
+	{
+		double kmin, kmax;
+		tf_type type;
+		std::vector<double> k, w;
+	};
+
+	std::vector<double> m_tab_lngrowth;			//!< ln of the growth integral on a grid in ln a
+	power_table m_ptab_norm, m_ptab_sigma;		//!< integrands for ComputePNorm and ComputeSigma
+
+	//! the integral over GrowthIntegrand from 0 to a
+	double GrowthIntegral( double a );
+
+	//! fill tab for the given k-range and type of the transfer function, unless it already is
+	void TabulatePower( double kmin, double kmax, tf_type type, power_table& tab );
+
+	//! the integral of tab over window w with radius R
+	static double SigmaSq( const power_table& tab, double R, window_type w );
+
 public:
 	//! data structure to store cosmological parameters
 	Cosmology m_Cosmology;
@@ -43,6 +73,7 @@ public:
 	{
 		m_Cosmology = acosmo;
 		m_pTransferFunction = pTransferFunction;
+		m_ptab_norm.kmin = m_ptab_sigma.kmin = -1.0;
 	}
 	
 	//! returns the amplitude of amplitude of the power spectrum
@@ -52,12 +83,8 @@ public:
 	 * @returns power spectrum amplitude for wave number k at time a
 	 */
 	inline real_t Power( real_t k, real_t a ){
-		real_t m_Dplus    = CalcGrowthFactor( a );
-		real_t m_DplusOne = CalcGrowthFactor( 1.0 );
+		real_t scale  = CalcGrowthFactor( a )/CalcGrowthFactor( 1.0 );
 		real_t m_pNorm = ComputePNorm( 1e4 );
-		m_Dplus    /= m_DplusOne;
-		m_DplusOne = 1.0;
-		real_t scale = m_Dplus/m_DplusOne;
 		return m_pNorm*scale*scale*TransferSq(k)*pow((double)k,(double)m_Cosmology.nspect);
 	}
 
@@ -97,8 +124,14 @@ public:
     */
     real_t CalcGrowthFactor( real_t a )
     {
-        real_t integral = integrate( &GrowthIntegrand, 0.0, a, (void*)&m_Cosmology );
-        return H_of_a( a, (void*)&m_Cosmology ) * integral;
+        return H_of_a( a, (void*)&m_Cosmology ) * GrowthIntegral( a );
+    }
+
+    //! Computes the linear theory growth factor D+ for the n expansion factors a
+    void CalcGrowthFactor( const double *a, double *Dplus, size_t n )
+    {
+        for( size_t i=0; i<n; ++i )
+            Dplus[i] = CalcGrowthFactor( a[i] );
     }
 
     //! Compute the factor relating particle displacement and velocity
@@ -184,14 +217,35 @@ public:
 		kmax = m_pTransferFunction->get_kmax();//m_Cosmology.H0/8.0;
 		kmin = m_pTransferFunction->get_kmin();//0.0;
         
-        if( !m_pTransferFunction->tf_has_total0() )
-            sigma0 = 4.0 * M_PI * integrate( &dSigma8, (double)kmin, (double)kmax, (void*)m_pTransferFunction );
-		else
-            sigma0 = 4.0 * M_PI * integrate( &dSigma8_0, (double)kmin, (double)kmax, (void*)m_pTransferFunction );
+        TabulatePower( kmin, kmax, m_pTransferFunction->tf_has_total0()? total0 : total, m_ptab_norm );
+        sigma0 = SigmaSq( m_ptab_norm, 8.0, tophat_window );
 		
         return m_Cosmology.sigma8*m_Cosmology.sigma8/sigma0;
 	}
 	
+	//! Computes the unnormalized rms linear density fluctuation at z=0 in a window of radius R
+	/*! integrates the power spectrum of the total matter transfer function between k=1e-4 and 1e4 h/Mpc
+	 * @param R radius of the window in Mpc/h
+	 * @param w shape of the window
+	 */
+	real_t ComputeSigma( real_t R, window_type w )
+	{
+		double sigma;
+		ComputeSigma( &R, &sigma, 1, w );
+		return sigma;
+	}
+	
+	//! Computes the unnormalized rms linear density fluctuation at z=0 for n window radii R
+	template< typename T >
+	void ComputeSigma( const T *R, double *sigma, size_t n, window_type w )
+	{
+		TabulatePower( 1e-4, 1e4, total, m_ptab_sigma );
+		
+		#pragma omp parallel for if( n > 16 )
+		for( long i=0; i<(long)n; ++i )
+			sigma[i] = sqrt( SigmaSq( m_ptab_sigma, R[i], w ) );
+	}
+	
 };
 
 
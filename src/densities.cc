@@ -12,6 +12,8 @@
 
 #include "densities.hh"
 #include "convolution_kernel.hh"
+#include "fft_plans.hh"
+#include "fft_mpi.hh"
 
 //TODO: this should be a larger number by default, just to maintain consistency with old default
 #define DEF_RAN_CUBE_SIZE 32
@@ -37,6 +39,38 @@ double Blend_Function(double k, double kmax)
 #endif
 }
 
+//! in-place forward transform of a padded array
+inline void fft_forward(size_t nx, size_t ny, size_t nz, fftw_real *data)
+{
+#ifdef FFTW3
+	fft_plans::execute(fft_plans::r2c(nx, ny, nz, data, reinterpret_cast<fftw_complex *>(data)));
+#else
+	rfftwnd_plan p = rfftw3d_create_plan(nx, ny, nz, FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE | FFTW_IN_PLACE);
+#ifndef SINGLETHREAD_FFTW
+	rfftwnd_threads_one_real_to_complex(omp_get_max_threads(), p, data, NULL);
+#else
+	rfftwnd_one_real_to_complex(p, data, NULL);
+#endif
+	rfftwnd_destroy_plan(p);
+#endif
+}
+
+//! in-place backward transform of a padded array
+inline void fft_backward(size_t nx, size_t ny, size_t nz, fftw_real *data)
+{
+#ifdef FFTW3
+	fft_plans::execute(fft_plans::c2r(nx, ny, nz, reinterpret_cast<fftw_complex *>(data), data));
+#else
+	rfftwnd_plan p = rfftw3d_create_plan(nx, ny, nz, FFTW_COMPLEX_TO_REAL, FFTW_ESTIMATE | FFTW_IN_PLACE);
+#ifndef SINGLETHREAD_FFTW
+	rfftwnd_threads_one_complex_to_real(omp_get_max_threads(), p, reinterpret_cast<fftw_complex *>(data), NULL);
+#else
+	rfftwnd_one_complex_to_real(p, reinterpret_cast<fftw_complex *>(data), NULL);
+#endif
+	rfftwnd_destroy_plan(p);
+#endif
+}
+
 template <typename m1, typename m2>
 void fft_coarsen(m1 &v, m2 &V)
 {
@@ -49,23 +83,6 @@ void fft_coarsen(m1 &v, m2 &V)
 	fftw_real *rfine = new fftw_real[nxf * nyf * nzfp];
 	fftw_complex *cfine = reinterpret_cast<fftw_complex *>(rfine);
 
-#ifdef FFTW3
-#ifdef SINGLE_PRECISION
-	fftwf_plan
-		pf = fftwf_plan_dft_r2c_3d(nxf, nyf, nzf, rfine, cfine, FFTW_ESTIMATE),
-		ipc = fftwf_plan_dft_c2r_3d(nxF, nyF, nzF, ccoarse, rcoarse, FFTW_ESTIMATE);
-#else
-	fftw_plan
-		pf = fftw_plan_dft_r2c_3d(nxf, nyf, nzf, rfine, cfine, FFTW_ESTIMATE),
-		ipc = fftw_plan_dft_c2r_3d(nxF, nyF, nzF, ccoarse, rcoarse, FFTW_ESTIMATE);
-#endif
-
-#else
-	rfftwnd_plan
-		pf = rfftw3d_create_plan(nxf, nyf, nzf, FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE | FFTW_IN_PLACE),
-		ipc = rfftw3d_create_plan(nxF, nyF, nzF, FFTW_COMPLEX_TO_REAL, FFTW_ESTIMATE | FFTW_IN_PLACE);
-#endif
-
 #pragma omp parallel for
 	for (int i = 0; i < (int)nxf; i++)
 		for (int j = 0; j < (int)nyf; j++)
@@ -75,19 +92,7 @@ void fft_coarsen(m1 &v, m2 &V)
 				rfine[q] = v(i, j, k);
 			}
 
-#ifdef FFTW3
-#ifdef SINGLE_PRECISION
-	fftwf_execute(pf);
-#else
-	fftw_execute(pf);
-#endif
-#else
-#ifndef SINGLETHREAD_FFTW
-	rfftwnd_threads_one_real_to_complex(omp_get_max_threads(), pf, rfine, NULL);
-#else
-	rfftwnd_one_real_to_complex(pf, rfine, NULL);
-#endif
-#endif
+	fft_forward(nxf, nyf, nzf, rfine);
 
 	double fftnorm = 1.0 / ((double)nxF * (double)nyF * (double)nzF);
 
@@ -125,19 +130,7 @@ void fft_coarsen(m1 &v, m2 &V)
 
 	delete[] rfine;
 
-#ifdef FFTW3
-#ifdef SINGLE_PRECISION
-	fftwf_execute(ipc);
-#else
-	fftw_execute(ipc);
-#endif
-#else
-#ifndef SINGLETHREAD_FFTW
-	rfftwnd_threads_one_complex_to_real(omp_get_max_threads(), ipc, ccoarse, NULL);
-#else
-	rfftwnd_one_complex_to_real(ipc, ccoarse, NULL);
-#endif
-#endif
+	fft_backward(nxF, nyF, nzF, rcoarse);
 
 #pragma omp parallel for
 	for (int i = 0; i < (int)nxF; i++)
@@ -149,19 +142,6 @@ void fft_coarsen(m1 &v, m2 &V)
 			}
 
 	delete[] rcoarse;
-
-#ifdef FFTW3
-#ifdef SINGLE_PRECISION
-	fftwf_destroy_plan(pf);
-	fftwf_destroy_plan(ipc);
-#else
-	fftw_destroy_plan(pf);
-	fftw_destroy_plan(ipc);
-#endif
-#else
-	rfftwnd_destroy_plan(pf);
-	rfftwnd_destroy_plan(ipc);
-#endif
 }
 
 //#define NO_COARSE_OVERLAP
@@ -206,7 +186,7 @@ void fft_interpolate(m1 &V, m2 &v, bool from_basegrid = false)
 	fftw_complex *cfine = reinterpret_cast<fftw_complex *>(rfine);
 
 	// copy coarse data to rcoarse[.]
-	memset(rcoarse, 0, sizeof(fftw_real) * nxc * nyc * nzcp);
+	first_touch::zero(rcoarse, nxc, nyc * nzcp);
 
 #ifdef NO_COARSE_OVERLAP
 #pragma omp parallel for
@@ -226,10 +206,7 @@ void fft_interpolate(m1 &V, m2 &v, bool from_basegrid = false)
 		for (int j = 0; j < (int)nyc; ++j)
 			for (int k = 0; k < (int)nzc; ++k)
 			{
-				int ii(i);
-				int jj(j);
-				int kk(k);
-				size_t q = ((size_t)ii * nyc + (size_t)jj) * nzcp + (size_t)kk;
+				size_t q = ((size_t)i * nyc + (size_t)j) * nzcp + (size_t)k;
 				rcoarse[q] = V(oxf + i, oyf + j, ozf + k);
 			}
 #endif
@@ -243,36 +220,8 @@ void fft_interpolate(m1 &V, m2 &v, bool from_basegrid = false)
 				rfine[q] = v(i, j, k);
 			}
 
-#ifdef FFTW3
-#ifdef SINGLE_PRECISION
-	fftwf_plan
-		pc = fftwf_plan_dft_r2c_3d(nxc, nyc, nzc, rcoarse, ccoarse, FFTW_ESTIMATE),
-		pf = fftwf_plan_dft_r2c_3d(nxf, nyf, nzf, rfine, cfine, FFTW_ESTIMATE),
-		ipf = fftwf_plan_dft_c2r_3d(nxf, nyf, nzf, cfine, rfine, FFTW_ESTIMATE);
-	fftwf_execute(pc);
-	fftwf_execute(pf);
-#else
-	fftw_plan
-		pc = fftw_plan_dft_r2c_3d(nxc, nyc, nzc, rcoarse, ccoarse, FFTW_ESTIMATE),
-		pf = fftw_plan_dft_r2c_3d(nxf, nyf, nzf, rfine, cfine, FFTW_ESTIMATE),
-		ipf = fftw_plan_dft_c2r_3d(nxf, nyf, nzf, cfine, rfine, FFTW_ESTIMATE);
-	fftw_execute(pc);
-	fftw_execute(pf);
-#endif
-#else
-	rfftwnd_plan
-		pc = rfftw3d_create_plan(nxc, nyc, nzc, FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE | FFTW_IN_PLACE),
-		pf = rfftw3d_create_plan(nxf, nyf, nzf, FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE | FFTW_IN_PLACE),
-		ipf = rfftw3d_create_plan(nxf, nyf, nzf, FFTW_COMPLEX_TO_REAL, FFTW_ESTIMATE | FFTW_IN_PLACE);
-
-#ifndef SINGLETHREAD_FFTW
-	rfftwnd_threads_one_real_to_complex(omp_get_max_threads(), pc, rcoarse, NULL);
-	rfftwnd_threads_one_real_to_complex(omp_get_max_threads(), pf, rfine, NULL);
-#else
-	rfftwnd_one_real_to_complex(pc, rcoarse, NULL);
-	rfftwnd_one_real_to_complex(pf, rfine, NULL);
-#endif
-#endif
+	fft_forward(nxc, nyc, nzc, rcoarse);
+	fft_forward(nxf, nyf, nzf, rfine);
 
 	/*************************************************/
 	//.. perform actual interpolation
@@ -281,7 +230,7 @@ void fft_interpolate(m1 &V, m2 &v, bool from_basegrid = false)
 	double phasefac = -0.5;
 
 	// this enables filtered splicing of coarse and fine modes
-#if 1
+#pragma omp parallel for
 	for (int i = 0; i < (int)nxc; i++)
 		for (int j = 0; j < (int)nyc; j++)
 			for (int k = 0; k < (int)nzc / 2 + 1; k++)
@@ -317,137 +266,13 @@ void fft_interpolate(m1 &V, m2 &v, bool from_basegrid = false)
 				IM(cfine[qf]) = blend_fine * IM(cfine[qf]) + blend_coarse * val.imag();
 			}
 
-#else
-
-	// 0 0
-#pragma omp parallel for
-	for (int i = 0; i < (int)nxc / 2 + 1; i++)
-		for (int j = 0; j < (int)nyc / 2 + 1; j++)
-			for (int k = 0; k < (int)nzc / 2 + 1; k++)
-			{
-				int ii(i), jj(j), kk(k);
-				size_t qc, qf;
-				qc = ((size_t)i * (size_t)nyc + (size_t)j) * (nzc / 2 + 1) + (size_t)k;
-				qf = ((size_t)ii * (size_t)nyf + (size_t)jj) * (nzf / 2 + 1) + (size_t)kk;
-
-				double kx = (i <= (int)nxc / 2) ? (double)i : (double)(i - (int)nxc);
-				double ky = (j <= (int)nyc / 2) ? (double)j : (double)(j - (int)nyc);
-				double kz = (k <= (int)nzc / 2) ? (double)k : (double)(k - (int)nzc);
-
-				double phase = phasefac * (kx / nxc + ky / nyc + kz / nzc) * M_PI;
-				std::complex<double> val_phas(cos(phase), sin(phase));
-
-				std::complex<double> val(RE(ccoarse[qc]), IM(ccoarse[qc]));
-				val *= sqrt8 * val_phas;
-
-				RE(cfine[qf]) = val.real();
-				IM(cfine[qf]) = val.imag();
-			}
-
-// 1 0
-#pragma omp parallel for
-	for (int i = nxc / 2; i < (int)nxc; i++)
-		for (int j = 0; j < (int)nyc / 2 + 1; j++)
-			for (int k = 0; k < (int)nzc / 2 + 1; k++)
-			{
-				int ii(i + nxf / 2), jj(j), kk(k);
-				size_t qc, qf;
-				qc = ((size_t)i * (size_t)nyc + (size_t)j) * (nzc / 2 + 1) + (size_t)k;
-				qf = ((size_t)ii * (size_t)nyf + (size_t)jj) * (nzf / 2 + 1) + (size_t)kk;
-
-				double kx = (i <= (int)nxc / 2) ? (double)i : (double)(i - (int)nxc);
-				double ky = (j <= (int)nyc / 2) ? (double)j : (double)(j - (int)nyc);
-				double kz = (k <= (int)nzc / 2) ? (double)k : (double)(k - (int)nzc);
-
-				double phase = phasefac * (kx / nxc + ky / nyc + kz / nzc) * M_PI;
-				std::complex<double> val_phas(cos(phase), sin(phase));
-
-				std::complex<double> val(RE(ccoarse[qc]), IM(ccoarse[qc]));
-				val *= sqrt8 * val_phas;
-
-				RE(cfine[qf]) = val.real();
-				IM(cfine[qf]) = val.imag();
-			}
-
-// 0 1
-#pragma omp parallel for
-	for (int i = 0; i < (int)nxc / 2 + 1; i++)
-		for (int j = nyc / 2; j < (int)nyc; j++)
-			for (int k = 0; k < (int)nzc / 2 + 1; k++)
-			{
-				int ii(i), jj(j + nyf / 2), kk(k);
-				size_t qc, qf;
-				qc = ((size_t)i * (size_t)nyc + (size_t)j) * (nzc / 2 + 1) + (size_t)k;
-				qf = ((size_t)ii * (size_t)nyf + (size_t)jj) * (nzf / 2 + 1) + (size_t)kk;
-
-				double kx = (i <= (int)nxc / 2) ? (double)i : (double)(i - (int)nxc);
-				double ky = (j <= (int)nyc / 2) ? (double)j : (double)(j - (int)nyc);
-				double kz = (k <= (int)nzc / 2) ? (double)k : (double)(k - (int)nzc);
-
-				double phase = phasefac * (kx / nxc + ky / nyc + kz / nzc) * M_PI;
-				std::complex<double> val_phas(cos(phase), sin(phase));
-
-				std::complex<double> val(RE(ccoarse[qc]), IM(ccoarse[qc]));
-				val *= sqrt8 * val_phas;
-
-				RE(cfine[qf]) = val.real();
-				IM(cfine[qf]) = val.imag();
-			}
-
-// 1 1
-#pragma omp parallel for
-	for (int i = nxc / 2; i < (int)nxc; i++)
-		for (int j = nyc / 2; j < (int)nyc; j++)
-			for (int k = 0; k < (int)nzc / 2 + 1; k++)
-			{
-				int ii(i + nxf / 2), jj(j + nyf / 2), kk(k);
-				size_t qc, qf;
-				qc = ((size_t)i * (size_t)nyc + (size_t)j) * (nzc / 2 + 1) + (size_t)k;
-				qf = ((size_t)ii * (size_t)nyf + (size_t)jj) * (nzf / 2 + 1) + (size_t)kk;
-
-				double kx = (i <= (int)nxc / 2) ? (double)i : (double)(i - (int)nxc);
-				double ky = (j <= (int)nyc / 2) ? (double)j : (double)(j - (int)nyc);
-				double kz = (k <= (int)nzc / 2) ? (double)k : (double)(k - (int)nzc);
-
-				double phase = phasefac * (kx / nxc + ky / nyc + kz / nzc) * M_PI;
-				std::complex<double> val_phas(cos(phase), sin(phase));
-
-				std::complex<double> val(RE(ccoarse[qc]), IM(ccoarse[qc]));
-				val *= sqrt8 * val_phas;
-
-				RE(cfine[qf]) = val.real();
-				IM(cfine[qf]) = val.imag();
-			}
-#endif
-
 	delete[] rcoarse;
 
 	/*************************************************/
 
-#ifdef FFTW3
-#ifdef SINGLE_PRECISION
-	fftwf_execute(ipf);
-	fftwf_destroy_plan(pf);
-	fftwf_destroy_plan(pc);
-	fftwf_destroy_plan(ipf);
-#else
-	fftw_execute(ipf);
-	fftw_destroy_plan(pf);
-	fftw_destroy_plan(pc);
-	fftw_destroy_plan(ipf);
-#endif
-#else
-#ifndef SINGLETHREAD_FFTW
-	rfftwnd_threads_one_complex_to_real(omp_get_max_threads(), ipf, cfine, NULL);
-#else
-	rfftwnd_one_complex_to_real(ipf, cfine, NULL);
-#endif
-	fftwnd_destroy_plan(pf);
-	fftwnd_destroy_plan(pc);
-	fftwnd_destroy_plan(ipf);
-#endif
+	fft_backward(nxf, nyf, nzf, rfine);
 
-// copy back and normalize
+	// copy back and normalize
 #pragma omp parallel for
 	for (int i = 0; i < (int)nxf; ++i)
 		for (int j = 0; j < (int)nyf; ++j)
@@ -484,7 +309,7 @@ void GenerateDensityUnigrid(config_file &cf, transfer_function *ptf, tf_type typ
 	LOGUSER("Running unigrid density convolution...");
 
 	//... select the transfer function to be used
-	convolution::kernel_creator *the_kernel_creator;
+	std::string kernel_name;
 
 	if (kspace)
 	{
@@ -492,9 +317,9 @@ void GenerateDensityUnigrid(config_file &cf, transfer_function *ptf, tf_type typ
 		LOGUSER("Using k-space transfer function kernel.");
 
 #ifdef SINGLE_PRECISION
-		the_kernel_creator = convolution::get_kernel_map()["tf_kernel_k_float"];
+		kernel_name = "tf_kernel_k_float";
 #else
-		the_kernel_creator = convolution::get_kernel_map()["tf_kernel_k_double"];
+		kernel_name = "tf_kernel_k_double";
 #endif
 	}
 	else
@@ -503,24 +328,28 @@ void GenerateDensityUnigrid(config_file &cf, transfer_function *ptf, tf_type typ
 		LOGUSER("Using real-space transfer function kernel.");
 
 #ifdef SINGLE_PRECISION
-		the_kernel_creator = convolution::get_kernel_map()["tf_kernel_real_float"];
+		kernel_name = "tf_kernel_real_float";
 #else
-		the_kernel_creator = convolution::get_kernel_map()["tf_kernel_real_double"];
+		kernel_name = "tf_kernel_real_double";
 #endif
 	}
 
 	//... initialize convolution kernel
-	convolution::kernel *the_tf_kernel = the_kernel_creator->create(cf, ptf, refh, type);
+	convolution::kernel *the_tf_kernel = convolution::get_kernel(kernel_name, cf, ptf, refh, type);
 
 	//...
 	std::cout << " - Performing noise convolution on level " << std::setw(2) << levelmax << " ..." << std::endl;
 	LOGUSER("Performing noise convolution on level %3d", levelmax);
 
-	//... create convolution mesh
-	DensityGrid<real_t> *top = new DensityGrid<real_t>(nbase, nbase, nbase);
+	//... create convolution mesh, in distributed runs only this rank's slab
+	fft_mpi::slab sl = fft_mpi::decompose(nbase, nbase, nbase);
+	DensityGrid<real_t> *top = new DensityGrid<real_t>(sl.local_n0, nbase, nbase, sl.local_0_start, 0, 0);
 
 	//... fill with random numbers
-	rand.load(*top, levelmin);
+	if (fft_mpi::active())
+		rand.load_slab(*top, levelmin, sl.local_0_start);
+	else
+		rand.load(*top, levelmin);
 
 	//... load convolution kernel
 	the_tf_kernel->fetch_kernel(levelmin, false);
@@ -529,10 +358,13 @@ void GenerateDensityUnigrid(config_file &cf, transfer_function *ptf, tf_type typ
 	convolution::perform<real_t>(the_tf_kernel, reinterpret_cast<void *>(top->get_data_ptr()), shift, fix, flip);
 
 	//... clean up kernel
-	delete the_tf_kernel;
+	convolution::release_kernel(the_tf_kernel);
 
 	//... create multi-grid hierarchy
-	delta.create_base_hierarchy(levelmin);
+	if (fft_mpi::active())
+		delta.create_base_slab(levelmin, sl.local_n0, sl.local_0_start);
+	else
+		delta.create_base_hierarchy(levelmin);
 
 	//... copy convolved field to multi-grid hierarchy
 	top->copy(*delta.get_grid(levelmin));
@@ -547,8 +379,12 @@ void GenerateDensityUnigrid(config_file &cf, transfer_function *ptf, tf_type typ
 
 void GenerateDensityHierarchy(config_file &cf, transfer_function *ptf, tf_type type,
 							  refinement_hierarchy &refh, rand_gen &rand,
-							  grid_hierarchy &delta, bool smooth, bool shift)
+							  grid_hierarchy &delta, bool smooth, bool shift,
+							  level_cache *levels)
 {
+	memory_stats::stage mstage("density");
+	profile::timer ptimer("density");
+
 	unsigned levelmin, levelmax, levelminPoisson;
 	std::vector<long> rngseeds;
 	std::vector<std::string> rngfnames;
@@ -578,7 +414,7 @@ void GenerateDensityHierarchy(config_file &cf, transfer_function *ptf, tf_type t
 
 	unsigned nbase = 1 << levelmin;
 
-	convolution::kernel_creator *the_kernel_creator;
+	std::string kernel_name;
 
 	if (kspaceTF)
 	{
@@ -586,9 +422,9 @@ void GenerateDensityHierarchy(config_file &cf, transfer_function *ptf, tf_type t
 		LOGUSER("Using k-space transfer function kernel.");
 
 #ifdef SINGLE_PRECISION
-		the_kernel_creator = convolution::get_kernel_map()["tf_kernel_k_float"];
+		kernel_name = "tf_kernel_k_float";
 #else
-		the_kernel_creator = convolution::get_kernel_map()["tf_kernel_k_double"];
+		kernel_name = "tf_kernel_k_double";
 #endif
 	}
 	else
@@ -596,17 +432,30 @@ void GenerateDensityHierarchy(config_file &cf, transfer_function *ptf, tf_type t
 		std::cout << " - Using real-space transfer function kernel.\n";
 		LOGUSER("Using real-space transfer function kernel.");
 #ifdef SINGLE_PRECISION
-		the_kernel_creator = convolution::get_kernel_map()["tf_kernel_real_float"];
+		kernel_name = "tf_kernel_real_float";
 #else
-		the_kernel_creator = convolution::get_kernel_map()["tf_kernel_real_double"];
+		kernel_name = "tf_kernel_real_double";
 #endif
 	}
 
-	convolution::kernel *the_tf_kernel = the_kernel_creator->create(cf, ptf, refh, type);
+	convolution::kernel *the_tf_kernel = convolution::get_kernel(kernel_name, cf, ptf, refh, type);
+
+	//... the real-space kernel couples each level to the next finer one, so levels are only cached with the k-space kernel
+	if (levels != NULL && levels->enabled() && !kspaceTF)
+	{
+		LOGWARN("[setup] incremental_dir needs kspace_TF = yes, all levels are recomputed.");
+		levels = NULL;
+	}
+
+	char field[64];
+	sprintf(field, "density %d%s%s", (int)type, smooth ? " smooth" : "", shift ? " shift" : "");
 
 	/***** PERFORM CONVOLUTIONS *****/
 	if (kspaceTF)
 	{
+		//... a cached level is only valid if all coarser ones were, since it is interpolated from them
+		bool cached = levels != NULL && levels->enabled();
+		unsigned long long key = 0;
 
 		//... create and initialize density grids with white noise
 		DensityGrid<real_t> *top(NULL);
@@ -615,9 +464,19 @@ void GenerateDensityHierarchy(config_file &cf, transfer_function *ptf, tf_type t
 
 		// do coarse level
 		top = new DensityGrid<real_t>(nbase, nbase, nbase);
-		LOGINFO("Performing noise convolution on level %3d", levelmin);
-		rand.load(*top, levelmin);
-		convolution::perform<real_t>(the_tf_kernel->fetch_kernel(levelmin, false), reinterpret_cast<void *>(top->get_data_ptr()), shift, fix, flip);
+		if (cached)
+		{
+			key = levels->key(field, refh, levelmin);
+			cached = levels->restore(field, levelmin, key, top->get_data_ptr(), top->size_with_padding());
+		}
+		if (!cached)
+		{
+			LOGINFO("Performing noise convolution on level %3d", levelmin);
+			rand.load(*top, levelmin);
+			convolution::perform<real_t>(the_tf_kernel->fetch_kernel(levelmin, false), reinterpret_cast<void *>(top->get_data_ptr()), shift, fix, flip);
+			if (levels != NULL)
+				levels->save(field, levelmin, key, top->get_data_ptr(), top->size_with_padding());
+		}
 
 		delta.create_base_hierarchy(levelmin);
 		top->copy(*delta.get_grid(levelmin));
@@ -641,16 +500,27 @@ void GenerateDensityHierarchy(config_file &cf, transfer_function *ptf, tf_type t
 													refh.size(levelmin + i, 2));
 			/////////////////////////////////////////////////////////////////////////
 
-			// load white noise for patch
-			rand.load(*fine, levelmin + i);
+			if (cached)
+			{
+				key = levels->key(field, refh, levelmin + i);
+				cached = levels->restore(field, levelmin + i, key, fine->get_data_ptr(), fine->size_with_padding());
+			}
+			if (!cached)
+			{
+				// load white noise for patch
+				rand.load(*fine, levelmin + i);
 
-			convolution::perform<real_t>(the_tf_kernel->fetch_kernel(levelmin + i, true),
-										 reinterpret_cast<void *>(fine->get_data_ptr()), shift, fix, flip);
+				convolution::perform<real_t>(the_tf_kernel->fetch_kernel(levelmin + i, true),
+											 reinterpret_cast<void *>(fine->get_data_ptr()), shift, fix, flip);
 
-			if (i == 1)
-				fft_interpolate(*top, *fine, true);
-			else
-				fft_interpolate(*coarse, *fine, false);
+				if (i == 1)
+					fft_interpolate(*top, *fine, true);
+				else
+					fft_interpolate(*coarse, *fine, false);
+
+				if (levels != NULL)
+					levels->save(field, levelmin + i, levels->key(field, refh, levelmin + i), fine->get_data_ptr(), fine->size_with_padding());
+			}
 
 			delta.add_patch(refh.offset(levelmin + i, 0),
 							refh.offset(levelmin + i, 1),
@@ -666,6 +536,10 @@ void GenerateDensityHierarchy(config_file &cf, transfer_function *ptf, tf_type t
 			else
 				delete coarse;
 
+			//... the coarser level is complete, keep it in a scratch file until the hierarchy is used
+			if (mesh_spill::streaming())
+				delta.spill(levelmin + i - 1);
+
 			coarse = fine;
 		}
 
@@ -831,6 +705,10 @@ void GenerateDensityHierarchy(config_file &cf, transfer_function *ptf, tf_type t
 				//... clean up
 				the_tf_kernel->deallocate();
 				delete coarse;
+
+				//... the next coarser level received its last correction
+				if (mesh_spill::streaming())
+					delta.spill(levelmin + i - 1);
 			}
 
 			coarse = fine;
@@ -882,7 +760,7 @@ void GenerateDensityHierarchy(config_file &cf, transfer_function *ptf, tf_type t
 		}
 	}
 
-	delete the_tf_kernel;
+	convolution::release_kernel(the_tf_kernel);
 
 #ifndef SINGLETHREAD_FFTW
 	tend = omp_get_wtime();
@@ -922,7 +800,8 @@ void normalize_density(grid_hierarchy &delta)
 				for (size_t iz = 0; iz < nz; ++iz)
 					sum += (*delta.get_grid(levelmin))(ix, iy, iz);
 
-		sum /= (double)(nx * ny * nz);
+		//... in distributed runs the top grid is split into slabs along x
+		sum = fft_mpi::sum((double)sum) / (double)fft_mpi::sum(nx * ny * nz);
 	}
 
 	std::cout << " - Top grid mean density is off by " << sum << ", correcting..." << std::endl;
@@ -943,8 +822,109 @@ void normalize_density(grid_hierarchy &delta)
 	}
 }
 
+density_cache::density_cache(config_file &cf, transfer_function *ptf, refinement_hierarchy &rh_TF, refinement_hierarchy &rh_Poisson,
+							 rand_gen &rand, stage_checkpoint &ckpt, bool kspace, bool enabled)
+	: cf_(cf), ptf_(ptf), rh_TF_(rh_TF), rh_Poisson_(rh_Poisson), rand_(rand), ckpt_(ckpt), levels_(cf), kspace_(kspace), enabled_(enabled)
+{
+	std::string precision = cf.getValueSafe<std::string>("setup", "density_precision", sizeof(real_t) == sizeof(float) ? "float" : "double");
+
+	if (precision != "float" && precision != "double")
+	{
+		LOGERR("Unknown density precision \'%s\' in [setup]/density_precision (float/double).", precision.c_str());
+		throw std::runtime_error("Unknown density precision in [setup]/density_precision");
+	}
+
+	//... in single precision builds the kept hierarchies are float anyway
+	float_storage_ = (precision == "float") && sizeof(real_t) != sizeof(float);
+}
+
+density_cache::~density_cache()
+{
+	clear();
+}
+
+void density_cache::clear(void)
+{
+	for (size_t i = 0; i < entries_.size(); ++i)
+	{
+		delete entries_[i].delta;
+		delete entries_[i].fdelta;
+	}
+	entries_.clear();
+}
+
+tf_type density_cache::effective_type(tf_type type) const
+{
+	//... plugins without distinct or velocity transfer functions evaluate the same
+	//... function for all types but the z=0 one
+	if (!ptf_->tf_is_distinct() && !ptf_->tf_has_velocities() && type != total0)
+		return total;
+	return type;
+}
+
+void density_cache::get(tf_type type, grid_hierarchy &delta, bool smooth, bool shift)
+{
+	tf_type etype = effective_type(type);
+
+	for (size_t i = 0; i < entries_.size(); ++i)
+		if (entries_[i].type == etype && entries_[i].smooth == smooth && entries_[i].shift == shift)
+		{
+			LOGUSER("Reusing previously computed density field.");
+			std::cout << " - Reusing previously computed density field..." << std::endl;
+			if (entries_[i].fdelta != NULL)
+			{
+				delta.convert_from(*entries_[i].fdelta);
+				entries_[i].fdelta->spill();
+			}
+			else
+			{
+				delta = *entries_[i].delta;
+				entries_[i].delta->spill();
+			}
+			return;
+		}
+
+	char name[64];
+	sprintf(name, "density %d%s%s", (int)type, smooth ? " smooth" : "", shift ? " shift" : "");
+
+	if (ckpt_.restore(name, delta))
+		delta.add_refinement_mask(rh_Poisson_.get_coord_shift());
+	else
+	{
+		//... distributed runs hold a slab of the base grid and no coarser levels
+		if (fft_mpi::active())
+			GenerateDensityUnigrid(cf_, ptf_, type, rh_TF_, rand_, delta, smooth, shift);
+		else
+			GenerateDensityHierarchy(cf_, ptf_, type, rh_TF_, rand_, delta, smooth, shift, &levels_);
+		coarsen_density(rh_Poisson_, delta, kspace_);
+		delta.add_refinement_mask(rh_Poisson_.get_coord_shift());
+		normalize_density(delta);
+		ckpt_.save(delta);
+	}
+
+	if (enabled_)
+	{
+		entry e = {etype, smooth, shift, NULL, NULL};
+		if (float_storage_)
+		{
+			e.fdelta = new GridHierarchy<float>(delta.m_nbnd);
+			e.fdelta->convert_from(delta);
+			e.fdelta->spill();
+		}
+		else
+		{
+			e.delta = new grid_hierarchy(delta);
+			e.delta->spill();
+		}
+		entries_.push_back(e);
+	}
+}
+
 void coarsen_density(const refinement_hierarchy &rh, GridHierarchy<real_t> &u, bool kspace)
 {
+	if (fft_mpi::active())
+		return;
+
 	unsigned levelmin_TF = u.levelmin();
 
 	/*for( int i=rh.levelmax(); i>0; --i )
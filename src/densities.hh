@@ -19,9 +19,14 @@
 #include "cosmology.hh"
 #include "transfer_function.hh"
 #include "general.hh"
+#include "memory_stats.hh"
+#include "first_touch.hh"
+#include "checkpoint.hh"
 
+//! convolve the noise with the transfer function on all levels of refh, convolved levels found in levels are read back instead (k-space kernel only)
 void GenerateDensityHierarchy(	config_file& cf, transfer_function *ptf, tf_type type, 
-							  refinement_hierarchy& refh, rand_gen& rand, grid_hierarchy& delta, bool smooth, bool shift );
+							  refinement_hierarchy& refh, rand_gen& rand, grid_hierarchy& delta, bool smooth, bool shift,
+							  level_cache *levels = NULL );
 
 void GenerateDensityUnigrid( config_file& cf, transfer_function *ptf, tf_type type, 
 							refinement_hierarchy& refh, rand_gen& rand, grid_hierarchy& delta, bool smooth, bool shift );
@@ -55,8 +60,11 @@ public:
 
         size_t ov_[3];
 
+	//! the storage type, elements are first touched by the x-slab loops rather than on allocation
+	typedef std::vector< real_t, first_touch::allocator<real_t> > data_vector;
+
 	//! the actual data container in the form of a 1D array
-	std::vector< real_t > data_;
+	data_vector data_;
 	
 	//! constructor
 	/*! constructs an instance given the dimensions of the density field
@@ -67,7 +75,9 @@ public:
 	DensityGrid( unsigned nx, unsigned ny, unsigned nz )
 	  : nx_(nx), ny_(ny), nz_(nz), nzp_( 2*(nz_/2+1) ), ox_(0), oy_(0), oz_(0)
 	{
-		data_.assign((size_t)nx_*(size_t)ny_*(size_t)nzp_,0.0);
+		data_.resize((size_t)nx_*(size_t)ny_*(size_t)nzp_);
+		first_touch::zero( get_data_ptr(), nx_, ny_*nzp_ );
+		memory_stats::add( nbytes() );
 		nv_[0] = nx_; nv_[1] = ny_; nv_[2] = nz_;
 		ov_[0] = ox_; ov_[1] = oy_; ov_[2] = oz_;
 	}
@@ -75,7 +85,9 @@ public:
         DensityGrid( unsigned nx, unsigned ny, unsigned nz, int ox, int oy, int oz )
 	  : nx_(nx), ny_(ny), nz_(nz), nzp_( 2*(nz_/2+1) ), ox_(ox), oy_(oy), oz_(oz)
 	{
-		data_.assign((size_t)nx_*(size_t)ny_*(size_t)nzp_,0.0);
+		data_.resize((size_t)nx_*(size_t)ny_*(size_t)nzp_);
+		first_touch::zero( get_data_ptr(), nx_, ny_*nzp_ );
+		memory_stats::add( nbytes() );
 		nv_[0] = nx_; nv_[1] = ny_; nv_[2] = nz_;
 		ov_[0] = ox_; ov_[1] = oy_; ov_[2] = oz_;
 	}
@@ -85,14 +97,18 @@ public:
 	  : nx_(g.nx_), ny_(g.ny_), nz_(g.nz_), nzp_(g.nzp_), 
 	    ox_(g.ox_), oy_(g.oy_), oz_(g.oz_)
 	{
-		data_ = g.data_;
+		data_.resize( g.data_.size() );
+		first_touch::copy( get_data_ptr(), g.get_data_ptr(), nx_, ny_*nzp_ );
+		memory_stats::add( nbytes() );
 		nv_[0] = nx_; nv_[1] = ny_; nv_[2] = nz_;
 		ov_[0] = ox_; ov_[1] = oy_; ov_[2] = oz_;
 	}
 	
 	//!destructor
 	~DensityGrid()
-	{	}
+	{
+		memory_stats::add( -nbytes() );
+	}
 	
 	//! clears the density object
 	/*! sets all dimensions to zero and frees the memory
@@ -104,8 +120,9 @@ public:
 		nv_[0] = nv_[1] = nv_[2] = 0;
 		ov_[0] = ov_[1] = ov_[2] = 0;
 
+		memory_stats::add( -nbytes() );
 		data_.clear();
-		std::vector<real_t>().swap(data_);
+		data_vector().swap(data_);
 	}
 	
 	//! query the 3D array sizes of the density object
@@ -127,7 +144,7 @@ public:
 	 */
 	void zero( void )
 	{
-		data_.assign(data_.size(),0.0);
+		first_touch::zero( get_data_ptr(), nx_, ny_*nzp_ );
 	}
 	
 	//! assigns the contents of another DensityGrid to this
@@ -140,11 +157,26 @@ public:
 		ox_ = g.ox_;
 		oy_ = g.oy_;
 		oz_ = g.oz_;
-		data_ = g.data_;
+		memory_stats::add( -nbytes() );
+		if( data_.size() != g.data_.size() )
+		{
+			data_vector().swap( data_ );
+			data_.resize( g.data_.size() );
+		}
+		first_touch::copy( get_data_ptr(), g.get_data_ptr(), nx_, ny_*nzp_ );
+		memory_stats::add( nbytes() );
 		
 		return *this;
 	}
 	
+	//! bytes held by the data array
+	long long nbytes( void ) const
+	{	return (long long)(data_.size() * sizeof(real_t));	}
+	
+	//! number of values in the data array, including the padding
+	size_t size_with_padding( void ) const
+	{	return data_.size();	}
+	
 	//! 3D index based data access operator
 	inline real_t& operator()( size_t i, size_t j, size_t k )
 	{	return data_[((size_t)i*ny_+(size_t)j)*nzp_+(size_t)k]; 	}
@@ -155,7 +187,11 @@ public:
 	
 	//! recover the pointer to the 1D data array
 	inline real_t * get_data_ptr( void )
-	{	return &data_[0];	}
+	{	return data_.data();	}
+
+	//! recover the pointer to the 1D data array
+	inline const real_t * get_data_ptr( void ) const
+	{	return data_.data();	}
 	
 	
 	//! fills the density field with random number values
@@ -1079,6 +1115,58 @@ inline void enforce_mean( M& v, M& V )
 
 void coarsen_density( const refinement_hierarchy& rh, GridHierarchy<real_t>& u, bool kspace );
 
+/*!
+ * @class density_cache
+ * @brief generates normalised density hierarchies and keeps them for later requests
+ *
+ * Every request runs GenerateDensityHierarchy, coarsens the result onto the
+ * Poisson hierarchy, adds the refinement mask and normalises it. When enabled,
+ * the result is kept and handed out again (as a copy) for later requests with the
+ * same key, so the convolution is not repeated with the same noise and kernel.
+ * The key is the transfer function type, the smoothing and the shift flags;
+ * types the transfer function plugin does not distinguish map to the same key.
+ * Kept hierarchies are spilled to the scratch directory when one is set. With
+ * [setup] density_precision = float they are kept in single precision, which
+ * halves their memory in double precision builds.
+ * Generated densities are also saved as checkpoint stages, and their levels
+ * are kept in the level cache of [setup] incremental_dir.
+ */
+class density_cache
+{
+protected:
+	struct entry
+	{
+		tf_type type;
+		bool smooth, shift;
+		grid_hierarchy *delta;
+		GridHierarchy<float> *fdelta;
+	};
+	
+	config_file& cf_;
+	transfer_function *ptf_;
+	refinement_hierarchy &rh_TF_, &rh_Poisson_;
+	rand_gen& rand_;
+	stage_checkpoint& ckpt_;
+	level_cache levels_;
+	bool kspace_, enabled_, float_storage_;
+	std::vector< entry > entries_;
+	
+	//! the type the transfer function plugin actually evaluates for type
+	tf_type effective_type( tf_type type ) const;
+	
+public:
+	density_cache( config_file& cf, transfer_function *ptf, refinement_hierarchy& rh_TF, refinement_hierarchy& rh_Poisson,
+				   rand_gen& rand, stage_checkpoint& ckpt, bool kspace, bool enabled );
+	
+	~density_cache();
+	
+	//! store the normalised density of the given type in delta
+	void get( tf_type type, grid_hierarchy& delta, bool smooth, bool shift );
+	
+	//! drop all kept hierarchies
+	void clear( void );
+};
+
 
 #endif
 
@@ -0,0 +1,346 @@
+/*
+
+ fft_mpi.cc - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include "fft_mpi.hh"
+#include "mesh.hh"
+#include "log.hh"
+
+namespace
+{
+	bool started_mpi_ = false;
+	bool fftw_mpi_ready_ = false;
+
+#ifdef USE_FFTW_MPI
+	bool mpi_running( void )
+	{
+		int init = 0, fin = 0;
+		MPI_Initialized( &init );
+		MPI_Finalized( &fin );
+		return init && !fin;
+	}
+
+	MPI_Datatype mpi_real( void )
+	{
+		return (sizeof(real_t)==sizeof(float))? MPI_FLOAT : MPI_DOUBLE;
+	}
+#endif
+}
+
+void fft_mpi::initialize( void )
+{
+#ifdef USE_FFTW_MPI
+	if( !mpi_running() )
+	{
+		//... OpenMP threads never call MPI, only the thread that started it
+		int provided;
+		MPI_Init_thread( NULL, NULL, MPI_THREAD_FUNNELED, &provided );
+		started_mpi_ = true;
+	}
+
+	//... the first rank reports progress, all ranks keep their own log file
+	if( rank() > 0 )
+		std::cout.setstate( std::ios::failbit );
+#endif
+}
+
+void fft_mpi::finalize( void )
+{
+#ifdef USE_FFTW_MPI
+	if( started_mpi_ && mpi_running() )
+		MPI_Finalize();
+#endif
+	started_mpi_ = false;
+}
+
+void fft_mpi::setup( config_file& cf, unsigned nbnd )
+{
+#ifdef USE_FFTW_MPI
+	if( !active() )
+		return;
+
+	#ifdef SINGLE_PRECISION
+	fftwf_mpi_init();
+	#else
+	fftw_mpi_init();
+	#endif
+	fftw_mpi_ready_ = true;
+
+	unsigned levelmin = cf.getValue<unsigned>("setup","levelmin");
+	unsigned levelmax = cf.getValue<unsigned>("setup","levelmax");
+	unsigned levelmin_TF = cf.getValueSafe<unsigned>("setup","levelmin_TF",levelmin);
+
+	//... only the base grid is decomposed, refinements would need distributed patches
+	if( levelmin != levelmax || levelmin_TF != levelmin )
+	{
+		LOGERR("Runs on %d MPI ranks need levelmin = levelmin_TF = levelmax.",size());
+		throw std::runtime_error("MPI runs are unigrid only");
+	}
+
+	if( !cf.getValueSafe<bool>("setup","kspace_TF",false) )
+	{
+		LOGERR("Runs on %d MPI ranks need [setup] kspace_TF = yes.",size());
+		throw std::runtime_error("MPI runs need k-space transfer function kernels");
+	}
+
+	if( cf.getValueSafe<bool>("setup","use_LLA",false) )
+	{
+		LOGERR("[setup] use_LLA is not supported in runs on %d MPI ranks.",size());
+		throw std::runtime_error("MPI runs do not support use_LLA");
+	}
+
+	//... every rank reads its planes of the noise from the file the first rank wrote
+	if( !cf.getValueSafe<bool>("random","disk_cached",true) )
+	{
+		LOGERR("Runs on %d MPI ranks need [random] disk_cached = yes.",size());
+		throw std::runtime_error("MPI runs need disk cached white noise");
+	}
+
+	if( cf.getValueSafe<std::string>("setup","checkpoint_dir","").size() > 0 )
+	{
+		LOGERR("Checkpoints are not supported in runs on %d MPI ranks.",size());
+		throw std::runtime_error("MPI runs do not support checkpoints");
+	}
+
+	int n = 1<<levelmin;
+	if( n % size() != 0 || n/size() < (int)nbnd )
+	{
+		LOGERR("A %d^3 grid cannot be split into slabs of at least %u planes on %d MPI ranks.",n,nbnd,size());
+		throw std::runtime_error("MPI rank count does not divide the grid");
+	}
+
+	LOGINFO("Distributing the %d^3 base grid over %d MPI ranks, %d planes each.",n,size(),n/size());
+#else
+	(void)cf; (void)nbnd;
+#endif
+}
+
+void fft_mpi::cleanup( void )
+{
+#ifdef USE_FFTW_MPI
+	if( fftw_mpi_ready_ )
+	{
+	#ifdef SINGLE_PRECISION
+		fftwf_mpi_cleanup();
+	#else
+		fftw_mpi_cleanup();
+	#endif
+	}
+#endif
+	fftw_mpi_ready_ = false;
+}
+
+int fft_mpi::rank( void )
+{
+	int r = 0;
+#ifdef USE_FFTW_MPI
+	if( mpi_running() )
+		MPI_Comm_rank( MPI_COMM_WORLD, &r );
+#endif
+	return r;
+}
+
+int fft_mpi::size( void )
+{
+	int s = 1;
+#ifdef USE_FFTW_MPI
+	if( mpi_running() )
+		MPI_Comm_size( MPI_COMM_WORLD, &s );
+#endif
+	return s;
+}
+
+bool fft_mpi::active( void )
+{
+	return size() > 1;
+}
+
+void fft_mpi::barrier( void )
+{
+#ifdef USE_FFTW_MPI
+	if( active() )
+		MPI_Barrier( MPI_COMM_WORLD );
+#endif
+}
+
+double fft_mpi::sum( double x )
+{
+#ifdef USE_FFTW_MPI
+	if( active() )
+		MPI_Allreduce( MPI_IN_PLACE, &x, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD );
+#endif
+	return x;
+}
+
+size_t fft_mpi::sum( size_t n )
+{
+#ifdef USE_FFTW_MPI
+	if( active() )
+	{
+		unsigned long long v = n;
+		MPI_Allreduce( MPI_IN_PLACE, &v, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD );
+		n = (size_t)v;
+	}
+#endif
+	return n;
+}
+
+size_t fft_mpi::exclusive_sum( size_t n )
+{
+#ifdef USE_FFTW_MPI
+	if( active() )
+	{
+		unsigned long long v = n, s = 0;
+		MPI_Exscan( &v, &s, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD );
+
+		//... the result is undefined on the first rank
+		return (rank()==0)? 0 : (size_t)s;
+	}
+#endif
+	(void)n;
+	return 0;
+}
+
+double fft_mpi::max( double x )
+{
+#ifdef USE_FFTW_MPI
+	if( active() )
+		MPI_Allreduce( MPI_IN_PLACE, &x, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD );
+#endif
+	return x;
+}
+
+double fft_mpi::max_abs( double x )
+{
+#ifdef USE_FFTW_MPI
+	if( active() )
+	{
+		std::vector<double> all( size() );
+		MPI_Allgather( &x, 1, MPI_DOUBLE, &all[0], 1, MPI_DOUBLE, MPI_COMM_WORLD );
+		for( size_t i=0; i<all.size(); ++i )
+			if( fabs(all[i]) > fabs(x) )
+				x = all[i];
+	}
+#endif
+	return x;
+}
+
+fft_mpi::slab fft_mpi::decompose( int n0, int n1, int n2 )
+{
+	slab s;
+	s.n0 = n0; s.n1 = n1; s.n2 = n2;
+	s.local_n0 = n0; s.local_0_start = 0;
+
+#ifdef USE_FFTW_MPI
+	if( active() )
+	{
+		ptrdiff_t local_n0, local_0_start, alloc_local;
+	#ifdef SINGLE_PRECISION
+		alloc_local = fftwf_mpi_local_size_3d( n0, n1, n2/2+1, MPI_COMM_WORLD, &local_n0, &local_0_start );
+	#else
+		alloc_local = fftw_mpi_local_size_3d( n0, n1, n2/2+1, MPI_COMM_WORLD, &local_n0, &local_0_start );
+	#endif
+
+		//... the slabs are padded arrays without room for FFTW's intermediate transposes
+		if( alloc_local > local_n0*(ptrdiff_t)n1*(n2/2+1) )
+		{
+			LOGERR("FFTW-MPI needs extra work space for a %dx%dx%d grid on %d ranks.",n0,n1,n2,size());
+			throw std::runtime_error("MPI rank count does not divide the grid");
+		}
+
+		s.local_n0 = (int)local_n0;
+		s.local_0_start = (int)local_0_start;
+	}
+#endif
+	return s;
+}
+
+void fft_mpi::exchange_ghosts( MeshvarBnd<real_t>& v )
+{
+	int nb = v.m_nbnd, nx = (int)v.size(0);
+	size_t count = (size_t)nb*(v.size(1)+2*nb)*(v.size(2)+2*nb);
+
+	real_t *lo_ghost = &v(-nb,-nb,-nb), *lo_cells = &v(0,-nb,-nb);
+	real_t *hi_cells = &v(nx-nb,-nb,-nb), *hi_ghost = &v(nx,-nb,-nb);
+
+#ifdef USE_FFTW_MPI
+	if( active() )
+	{
+		int left = (rank()+size()-1)%size(), right = (rank()+1)%size();
+
+		MPI_Sendrecv( hi_cells, (int)count, mpi_real(), right, 0,
+					  lo_ghost, (int)count, mpi_real(), left, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+		MPI_Sendrecv( lo_cells, (int)count, mpi_real(), left, 1,
+					  hi_ghost, (int)count, mpi_real(), right, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+		return;
+	}
+#endif
+
+	//... a single slab is its own periodic neighbour
+	memcpy( lo_ghost, hi_cells, count*sizeof(real_t) );
+	memcpy( hi_ghost, lo_cells, count*sizeof(real_t) );
+}
+
+#ifdef USE_FFTW_MPI
+
+namespace
+{
+	#ifdef SINGLE_PRECISION
+	typedef fftwf_plan mpi_plan_t;
+	#else
+	typedef fftw_plan mpi_plan_t;
+	#endif
+
+	//... the slabs hold the data to be transformed, so the planner must not measure
+	void run_plan( mpi_plan_t p, const fft_mpi::slab& s, const char *kind )
+	{
+		if( p == NULL )
+		{
+			LOGERR("FFTW-MPI could not plan a %dx%dx%d %s transform.",s.n0,s.n1,s.n2,kind);
+			throw std::runtime_error("FFTW-MPI planning failed");
+		}
+	#ifdef SINGLE_PRECISION
+		fftwf_execute( p );
+		fftwf_destroy_plan( p );
+	#else
+		fftw_execute( p );
+		fftw_destroy_plan( p );
+	#endif
+	}
+}
+
+void fft_mpi::forward( const slab& s, fftw_real *data )
+{
+#ifdef SINGLE_PRECISION
+	run_plan( fftwf_mpi_plan_dft_r2c_3d( s.n0, s.n1, s.n2, data, reinterpret_cast<fftwf_complex*>(data),
+										 MPI_COMM_WORLD, FFTW_ESTIMATE ), s, "r2c" );
+#else
+	run_plan( fftw_mpi_plan_dft_r2c_3d( s.n0, s.n1, s.n2, data, reinterpret_cast<fftw_complex*>(data),
+										MPI_COMM_WORLD, FFTW_ESTIMATE ), s, "r2c" );
+#endif
+}
+
+void fft_mpi::backward( const slab& s, fftw_real *data )
+{
+#ifdef SINGLE_PRECISION
+	run_plan( fftwf_mpi_plan_dft_c2r_3d( s.n0, s.n1, s.n2, reinterpret_cast<fftwf_complex*>(data), data,
+										 MPI_COMM_WORLD, FFTW_ESTIMATE ), s, "c2r" );
+#else
+	run_plan( fftw_mpi_plan_dft_c2r_3d( s.n0, s.n1, s.n2, reinterpret_cast<fftw_complex*>(data), data,
+										MPI_COMM_WORLD, FFTW_ESTIMATE ), s, "c2r" );
+#endif
+}
+
+#endif
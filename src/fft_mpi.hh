@@ -0,0 +1,107 @@
+/*
+
+ fft_mpi.hh - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#ifndef __FFT_MPI_HH
+#define __FFT_MPI_HH
+
+#include <cstddef>
+
+#include "general.hh"
+#include "config_file.hh"
+
+#ifdef USE_FFTW_MPI
+#ifndef FFTW3
+#error "the FFTW-MPI backend needs FFTW3"
+#endif
+#include <mpi.h>
+#include <fftw3-mpi.h>
+#endif
+
+template< typename T > class MeshvarBnd;
+
+/*!
+ * @brief optional distributed-memory backend for unigrid runs
+ *
+ * Compiled with USE_FFTW_MPI (CMake option MUSIC_ENABLE_MPI, HAVEFFTWMPI in the
+ * Makefile) and started on more than one MPI rank, every rank of a unigrid run
+ * holds only an x-slab of the base grid, in the decomposition FFTW-MPI uses for
+ * real transforms. The white noise is read plane by plane from the disk cache,
+ * the transfer function convolution, the k-space Poisson solver and gradients
+ * and the spectral 2LPT source use distributed in-place transforms of the slabs,
+ * and every rank writes one file of a multi-file output.
+ *
+ * In all other builds and runs there is a single rank whose slab is the whole
+ * grid, and the reductions below return their argument.
+ */
+namespace fft_mpi
+{
+	//! start MPI unless the caller already did, to be called first in main()
+	void initialize( void );
+
+	//! shut down MPI if it was started by initialize()
+	void finalize( void );
+
+	//! set up FFTW-MPI and check that the run can be distributed, call after the FFTW threads are set up
+	void setup( config_file& cf, unsigned nbnd );
+
+	//! release FFTW-MPI at the end of a run, call before the FFTW threads are cleaned up
+	void cleanup( void );
+
+	//! number of this rank
+	int rank( void );
+
+	//! number of ranks
+	int size( void );
+
+	//! true if the base grid is distributed over more than one rank
+	bool active( void );
+
+	//! wait for all ranks
+	void barrier( void );
+
+	//! sum of x over all ranks
+	double sum( double x );
+
+	//! sum of n over all ranks
+	size_t sum( size_t n );
+
+	//! sum of n over the ranks below this one
+	size_t exclusive_sum( size_t n );
+
+	//! largest x over all ranks
+	double max( double x );
+
+	//! the value of largest modulus over all ranks
+	double max_abs( double x );
+
+	//! the part of an n0*n1*n2 grid held by this rank, the planes local_0_start...local_0_start+local_n0-1 along x
+	struct slab
+	{
+		int n0, n1, n2;
+		int local_n0, local_0_start;
+	};
+
+	//! decomposition of an n0*n1*n2 grid over all ranks
+	slab decompose( int n0, int n1, int n2 );
+
+	//! fill the ghost planes along x of the slab of a periodic grid from the neighbouring ranks
+	/*! the ghost zones along y and z have to be filled before, they are sent along */
+	void exchange_ghosts( MeshvarBnd<real_t>& v );
+
+#ifdef USE_FFTW_MPI
+	//! in-place real to complex transform of the slab of a grid padded to 2*(n2/2+1) along z, collective over all ranks
+	void forward( const slab& s, fftw_real *data );
+
+	//! in-place complex to real transform of the slab of a grid padded to 2*(n2/2+1) along z, collective over all ranks
+	void backward( const slab& s, fftw_real *data );
+#endif
+}
+
+#endif //__FFT_MPI_HH
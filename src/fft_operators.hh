@@ -1,5 +1,8 @@
 #ifndef __FFT_OPERATORS_HH
 #define __FFT_OPERATORS_HH
+
+#include "fft_plans.hh"
+
 struct fft_interp{
 
   template< typename m1, typename m2 >
@@ -49,23 +52,13 @@ struct fft_interp{
       }
 
 #ifdef FFTW3
-#ifdef SINGLE_PRECISION
-    fftwf_plan
-      pc  = fftwf_plan_dft_r2c_3d( nxc, nyc, nzc, rcoarse, ccoarse, FFTW_ESTIMATE),
-      pf  = fftwf_plan_dft_r2c_3d( nxf, nyf, nzf, rfine, cfine, FFTW_ESTIMATE),
-      ipf = fftwf_plan_dft_c2r_3d( nxf, nyf, nzf, cfine, rfine, FFTW_ESTIMATE);
-    fftwf_execute( pc );
+    fft_plans::transform
+      pc  = fft_plans::r2c( nxc, nyc, nzc, rcoarse, ccoarse),
+      pf  = fft_plans::r2c( nxf, nyf, nzf, rfine, cfine),
+      ipf = fft_plans::c2r( nxf, nyf, nzf, cfine, rfine);
+    fft_plans::execute( pc );
     if( fourier_splice )
-      fftwf_execute( pf );
-#else
-    fftw_plan
-      pc  = fftw_plan_dft_r2c_3d( nxc, nyc, nzc, rcoarse, ccoarse, FFTW_ESTIMATE),
-      pf  = fftw_plan_dft_r2c_3d( nxf, nyf, nzf, rfine, cfine, FFTW_ESTIMATE),
-      ipf = fftw_plan_dft_c2r_3d( nxf, nyf, nzf, cfine, rfine, FFTW_ESTIMATE);
-    fftw_execute( pc );
-    if( fourier_splice )
-      fftwf_execute( pf );
-#endif
+      fft_plans::execute( pf );
 #else
     rfftwnd_plan 
       pc  = rfftw3d_create_plan( nxc, nyc, nzc, FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE|FFTW_IN_PLACE),
@@ -159,17 +152,7 @@ struct fft_interp{
     /*************************************************/    
 
 #ifdef FFTW3
-  #ifdef SINGLE_PRECISION
-    fftwf_execute( ipf );
-    fftwf_destroy_plan(pf);
-    fftwf_destroy_plan(pc);
-    fftwf_destroy_plan(ipf);
-  #else
-    fftw_execute( ipf );
-    fftw_destroy_plan(pf);
-    fftw_destroy_plan(pc);
-    fftw_destroy_plan(ipf);
-  #endif
+    fft_plans::execute( ipf );
 #else
   #ifndef SINGLETHREAD_FFTW		
     rfftwnd_threads_one_complex_to_real( omp_get_max_threads(), ipf, cfine, NULL );
@@ -0,0 +1,548 @@
+/*
+
+ fft_plans.cc - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#include <map>
+#include <string>
+#include <stdexcept>
+
+#include "fft_plans.hh"
+#include "log.hh"
+#include "profile.hh"
+#include "memory_stats.hh"
+
+#ifdef FFTW3
+
+#ifdef USE_CUFFT
+#include <cuda_runtime.h>
+#include <cufft.h>
+#endif
+
+namespace
+{
+	struct plan_key
+	{
+		int nx, ny, nz, kind, inplace, ain, aout;
+
+		bool operator<( const plan_key& o ) const
+		{
+			if( nx != o.nx ) return nx < o.nx;
+			if( ny != o.ny ) return ny < o.ny;
+			if( nz != o.nz ) return nz < o.nz;
+			if( kind != o.kind ) return kind < o.kind;
+			if( inplace != o.inplace ) return inplace < o.inplace;
+			if( ain != o.ain ) return ain < o.ain;
+			return aout < o.aout;
+		}
+	};
+
+	std::map< plan_key, fft_plans::plan_t > plans_;
+	unsigned planner_flags_ = FFTW_ESTIMATE;
+	std::string wisdom_file_;
+	size_t nplanned_ = 0, nreused_ = 0;
+
+	const char *kind_names[] = { "r2c", "c2r", "redft00" };
+
+	//... FFTW aligns to at most 64 bytes, pad scratch arrays by that much
+	const size_t align_pad = 64;
+
+	int alignment_of( void *p )
+	{
+	#ifdef SINGLE_PRECISION
+		return fftwf_alignment_of( reinterpret_cast<float*>(p) );
+	#else
+		return fftw_alignment_of( reinterpret_cast<double*>(p) );
+	#endif
+	}
+
+	void *scratch_alloc( size_t nbytes )
+	{
+	#ifdef SINGLE_PRECISION
+		void *p = fftwf_malloc( nbytes + align_pad );
+	#else
+		void *p = fftw_malloc( nbytes + align_pad );
+	#endif
+		if( p == NULL )
+		{
+			LOGERR("Could not allocate %llu bytes for FFT planning.", (unsigned long long)nbytes);
+			throw std::runtime_error("Could not allocate memory for FFT planning");
+		}
+		return p;
+	}
+
+	void scratch_free( void *p )
+	{
+	#ifdef SINGLE_PRECISION
+		fftwf_free( p );
+	#else
+		fftw_free( p );
+	#endif
+	}
+
+	fft_plans::plan_t make_plan( const plan_key& key, fftw_real *rdata, fftw_complex *cdata, unsigned flags )
+	{
+	#ifdef SINGLE_PRECISION
+		if( key.kind == fft_plans::kind_r2c )
+			return fftwf_plan_dft_r2c_3d( key.nx, key.ny, key.nz, rdata, cdata, flags );
+		if( key.kind == fft_plans::kind_c2r )
+			return fftwf_plan_dft_c2r_3d( key.nx, key.ny, key.nz, cdata, rdata, flags );
+		return fftwf_plan_r2r_3d( key.nx, key.ny, key.nz, rdata, rdata, FFTW_REDFT00, FFTW_REDFT00, FFTW_REDFT00, flags );
+	#else
+		if( key.kind == fft_plans::kind_r2c )
+			return fftw_plan_dft_r2c_3d( key.nx, key.ny, key.nz, rdata, cdata, flags );
+		if( key.kind == fft_plans::kind_c2r )
+			return fftw_plan_dft_c2r_3d( key.nx, key.ny, key.nz, cdata, rdata, flags );
+		return fftw_plan_r2r_3d( key.nx, key.ny, key.nz, rdata, rdata, FFTW_REDFT00, FFTW_REDFT00, FFTW_REDFT00, flags );
+	#endif
+	}
+
+	fft_plans::plan_t get_plan( int nx, int ny, int nz, fft_plans::transform_kind kind, fftw_real *rdata, fftw_complex *cdata )
+	{
+		plan_key key;
+		key.nx = nx; key.ny = ny; key.nz = nz;
+		key.kind = kind;
+		key.inplace = ((void*)rdata == (void*)cdata);
+		key.ain = alignment_of( rdata );
+		key.aout = alignment_of( cdata );
+
+		fft_plans::plan_t p = NULL;
+
+		#pragma omp critical(fft_plans)
+		{
+			std::map< plan_key, fft_plans::plan_t >::iterator it = plans_.find( key );
+
+			if( it != plans_.end() )
+			{
+				p = it->second;
+				++nreused_;
+			}
+			else
+			{
+				if( planner_flags_ == FFTW_ESTIMATE )
+					//... estimating does not touch the arrays, plan on the user data directly
+					p = make_plan( key, rdata, cdata, planner_flags_ );
+				else
+				{
+					//... measuring overwrites the arrays, plan on scratch arrays with the same
+					//... alignment and in-place property instead
+					size_t nr = (size_t)nx * (size_t)ny * (size_t)nz;
+					size_t nc = (size_t)nx * (size_t)ny * (size_t)(nz/2+1);
+
+					if( kind == fft_plans::kind_redft00 )
+						nc = (nr + 1) / 2;
+
+					char *sr = NULL, *sc = NULL;
+					if( key.inplace )
+					{
+						sr = (char*)scratch_alloc( 2 * nc * sizeof(fftw_real) ) + key.ain;
+						sc = sr;
+					}
+					else
+					{
+						sr = (char*)scratch_alloc( nr * sizeof(fftw_real) );
+						sc = (char*)scratch_alloc( nc * sizeof(fftw_complex) );
+						sr += key.ain;
+						sc += key.aout;
+					}
+
+					p = make_plan( key, reinterpret_cast<fftw_real*>(sr), reinterpret_cast<fftw_complex*>(sc), planner_flags_ );
+
+					scratch_free( sr - key.ain );
+					if( !key.inplace )
+						scratch_free( sc - key.aout );
+				}
+
+				if( p != NULL )
+				{
+					plans_[key] = p;
+					++nplanned_;
+				}
+			}
+		}
+
+		if( p == NULL )
+		{
+			LOGERR("FFTW could not create a %s plan for a %d x %d x %d grid.", kind_names[kind], nx, ny, nz);
+			throw std::runtime_error("FFTW planner failed");
+		}
+
+		return p;
+	}
+#ifdef USE_CUFFT
+	//... optional cuFFT backend for the real transforms, the data stays on the host
+	//... and is shipped to the device for each transform
+	struct device_key
+	{
+		int nx, ny, nz, kind, rpad;
+
+		bool operator<( const device_key& o ) const
+		{
+			if( nx != o.nx ) return nx < o.nx;
+			if( ny != o.ny ) return ny < o.ny;
+			if( nz != o.nz ) return nz < o.nz;
+			if( kind != o.kind ) return kind < o.kind;
+			return rpad < o.rpad;
+		}
+	};
+
+	//! a device plan, or a transform that cuFFT could not plan and that runs on the host
+	struct device_plan
+	{
+		cufftHandle h;
+		size_t worksize;
+		bool ok;
+	};
+
+	std::map< device_key, device_plan > device_plans_;
+	bool use_device_ = false;
+	void *dreal_ = NULL, *dcplx_ = NULL;
+	size_t nbreal_ = 0, nbcplx_ = 0, ndevice_ = 0, nhostfallback_ = 0;
+
+	void check_cufft( cufftResult res, const char *what )
+	{
+		if( res != CUFFT_SUCCESS )
+		{
+			LOGERR("cuFFT error %d in %s.", (int)res, what);
+			throw std::runtime_error("cuFFT call failed");
+		}
+	}
+
+	void check_cuda( cudaError_t err, const char *what )
+	{
+		if( err != cudaSuccess )
+		{
+			LOGERR("CUDA error in %s: %s.", what, cudaGetErrorString(err));
+			throw std::runtime_error("CUDA call failed");
+		}
+	}
+
+	//! grow a device buffer to nbytes, false if the device does not have the memory
+	bool device_reserve( void **p, size_t& nbcur, size_t nbytes )
+	{
+		if( nbytes <= nbcur )
+			return true;
+
+		if( *p != NULL )
+		{
+			cudaFree( *p );
+			memory_stats::add_device( -(long long)nbcur );
+		}
+		*p = NULL;
+		nbcur = 0;
+
+		if( cudaMalloc( p, nbytes ) != cudaSuccess )
+		{
+			*p = NULL;
+			cudaGetLastError();
+			return false;
+		}
+
+		nbcur = nbytes;
+		memory_stats::add_device( (long long)nbcur );
+		return true;
+	}
+
+	void device_release( void )
+	{
+		for( std::map< device_key, device_plan >::iterator it = device_plans_.begin(); it != device_plans_.end(); ++it )
+			if( it->second.ok )
+			{
+				cufftDestroy( it->second.h );
+				memory_stats::add_device( -(long long)it->second.worksize );
+			}
+		device_plans_.clear();
+
+		if( dreal_ != NULL ) cudaFree( dreal_ );
+		if( dcplx_ != NULL ) cudaFree( dcplx_ );
+		memory_stats::add_device( -(long long)(nbreal_ + nbcplx_) );
+		dreal_ = dcplx_ = NULL;
+		nbreal_ = nbcplx_ = 0;
+	}
+
+	//! run a real transform on the device, false if it has to be done on the host
+	bool execute_device( const fft_plans::transform& t )
+	{
+		if( !use_device_ || t.kind == fft_plans::kind_redft00 )
+			return false;
+
+		//... the host arrays are padded for in-place transforms
+		int nzc = t.nz/2+1;
+		device_key key;
+		key.nx = t.nx; key.ny = t.ny; key.nz = t.nz;
+		key.kind = t.kind;
+		key.rpad = ( (void*)t.rdata == (void*)t.cdata )? 2*nzc : t.nz;
+
+		size_t ncells = (size_t)t.nx * (size_t)t.ny;
+		size_t nbr = ncells * (size_t)key.rpad * sizeof(fftw_real);
+		size_t nbc = ncells * (size_t)nzc * sizeof(fftw_complex);
+
+		std::map< device_key, device_plan >::iterator it = device_plans_.find( key );
+		if( it != device_plans_.end() && !it->second.ok )
+		{
+			++nhostfallback_;
+			return false;
+		}
+
+		if( !device_reserve( &dreal_, nbreal_, nbr ) || !device_reserve( &dcplx_, nbcplx_, nbc ) )
+		{
+			if( nhostfallback_++ == 0 )
+				LOGWARN("%d x %d x %d transform does not fit on the GPU, using FFTW.", t.nx, t.ny, t.nz);
+			device_release();
+			return false;
+		}
+
+		it = device_plans_.find( key );
+		if( it == device_plans_.end() )
+		{
+			//... 64 bit layout, single padded arrays exceed 2^31 elements at 2048^3
+			long long n[3] = { t.nx, t.ny, t.nz };
+			long long rembed[3] = { t.nx, t.ny, key.rpad }, cembed[3] = { t.nx, t.ny, nzc };
+			long long rdist = (long long)t.nx * t.ny * key.rpad, cdist = (long long)t.nx * t.ny * nzc;
+			device_plan dp = { 0, 0, false };
+			cufftResult res;
+
+		#ifdef SINGLE_PRECISION
+			cufftType type = (t.kind == fft_plans::kind_r2c)? CUFFT_R2C : CUFFT_C2R;
+		#else
+			cufftType type = (t.kind == fft_plans::kind_r2c)? CUFFT_D2Z : CUFFT_Z2D;
+		#endif
+
+			//... planning fails e.g. if the work area does not fit on the device, the
+			//... transform is then remembered as one for the host
+			res = cufftCreate( &dp.h );
+			if( res == CUFFT_SUCCESS )
+			{
+				if( t.kind == fft_plans::kind_r2c )
+					res = cufftMakePlanMany64( dp.h, 3, n, rembed, 1, rdist, cembed, 1, cdist, type, 1, &dp.worksize );
+				else
+					res = cufftMakePlanMany64( dp.h, 3, n, cembed, 1, cdist, rembed, 1, rdist, type, 1, &dp.worksize );
+
+				if( res != CUFFT_SUCCESS )
+					cufftDestroy( dp.h );
+			}
+
+			dp.ok = (res == CUFFT_SUCCESS);
+			if( dp.ok )
+				memory_stats::add_device( (long long)dp.worksize );
+			else
+				LOGWARN("cuFFT could not plan the %d x %d x %d %s transform (error %d), using FFTW.", t.nx, t.ny, t.nz, kind_names[t.kind], (int)res);
+
+			it = device_plans_.insert( std::make_pair( key, dp ) ).first;
+		}
+
+		if( !it->second.ok )
+		{
+			++nhostfallback_;
+			return false;
+		}
+
+		if( t.kind == fft_plans::kind_r2c )
+		{
+			check_cuda( cudaMemcpy( dreal_, t.rdata, nbr, cudaMemcpyHostToDevice ), "cudaMemcpy" );
+		#ifdef SINGLE_PRECISION
+			check_cufft( cufftExecR2C( it->second.h, (cufftReal*)dreal_, (cufftComplex*)dcplx_ ), "cufftExecR2C" );
+		#else
+			check_cufft( cufftExecD2Z( it->second.h, (cufftDoubleReal*)dreal_, (cufftDoubleComplex*)dcplx_ ), "cufftExecD2Z" );
+		#endif
+			check_cuda( cudaMemcpy( t.cdata, dcplx_, nbc, cudaMemcpyDeviceToHost ), "cudaMemcpy" );
+		}
+		else
+		{
+			check_cuda( cudaMemcpy( dcplx_, t.cdata, nbc, cudaMemcpyHostToDevice ), "cudaMemcpy" );
+		#ifdef SINGLE_PRECISION
+			check_cufft( cufftExecC2R( it->second.h, (cufftComplex*)dcplx_, (cufftReal*)dreal_ ), "cufftExecC2R" );
+		#else
+			check_cufft( cufftExecZ2D( it->second.h, (cufftDoubleComplex*)dcplx_, (cufftDoubleReal*)dreal_ ), "cufftExecZ2D" );
+		#endif
+			check_cuda( cudaMemcpy( t.rdata, dreal_, nbr, cudaMemcpyDeviceToHost ), "cudaMemcpy" );
+		}
+
+		++ndevice_;
+		return true;
+	}
+#endif
+}
+
+fft_plans::transform fft_plans::r2c( int nx, int ny, int nz, fftw_real *in, fftw_complex *out )
+{
+	transform t;
+	t.plan = get_plan( nx, ny, nz, kind_r2c, in, out );
+	t.kind = kind_r2c;
+	t.rdata = in;
+	t.cdata = out;
+	t.nx = nx; t.ny = ny; t.nz = nz;
+	return t;
+}
+
+fft_plans::transform fft_plans::c2r( int nx, int ny, int nz, fftw_complex *in, fftw_real *out )
+{
+	transform t;
+	t.plan = get_plan( nx, ny, nz, kind_c2r, out, in );
+	t.kind = kind_c2r;
+	t.rdata = out;
+	t.cdata = in;
+	t.nx = nx; t.ny = ny; t.nz = nz;
+	return t;
+}
+
+fft_plans::transform fft_plans::redft00( int nx, int ny, int nz, fftw_real *data )
+{
+	transform t;
+	t.plan = get_plan( nx, ny, nz, kind_redft00, data, reinterpret_cast<fftw_complex*>(data) );
+	t.kind = kind_redft00;
+	t.rdata = data;
+	t.cdata = reinterpret_cast<fftw_complex*>(data);
+	t.nx = nx; t.ny = ny; t.nz = nz;
+	return t;
+}
+
+void fft_plans::execute( const transform& t )
+{
+	{
+		static const char *kind_names[] = { "r2c", "c2r", "redft00" };
+		char name[128];
+		snprintf( name, sizeof(name), "fft/%s/%dx%dx%d", kind_names[t.kind], t.nx, t.ny, t.nz );
+		profile::count( name, (double)t.nx * (double)t.ny * (double)t.nz );
+	}
+	
+#ifdef USE_CUFFT
+	bool done = false;
+
+	#pragma omp critical(fft_device)
+	done = execute_device( t );
+
+	if( done )
+		return;
+#endif
+
+#ifdef SINGLE_PRECISION
+	if( t.kind == kind_r2c )
+		fftwf_execute_dft_r2c( t.plan, t.rdata, t.cdata );
+	else if( t.kind == kind_c2r )
+		fftwf_execute_dft_c2r( t.plan, t.cdata, t.rdata );
+	else
+		fftwf_execute_r2r( t.plan, t.rdata, t.rdata );
+#else
+	if( t.kind == kind_r2c )
+		fftw_execute_dft_r2c( t.plan, t.rdata, t.cdata );
+	else if( t.kind == kind_c2r )
+		fftw_execute_dft_c2r( t.plan, t.cdata, t.rdata );
+	else
+		fftw_execute_r2r( t.plan, t.rdata, t.rdata );
+#endif
+}
+
+void fft_plans::initialize( config_file& cf )
+{
+	wisdom_file_ = cf.getValueSafe<std::string>("setup","fftw_wisdom","");
+
+	//... planning with wisdom is only worthwhile beyond FFTW_ESTIMATE
+	std::string planner = cf.getValueSafe<std::string>("setup","fftw_planner", wisdom_file_.empty() ? "estimate" : "measure");
+
+	if( planner == "estimate" )
+		planner_flags_ = FFTW_ESTIMATE;
+	else if( planner == "measure" )
+		planner_flags_ = FFTW_MEASURE;
+	else if( planner == "patient" )
+		planner_flags_ = FFTW_PATIENT;
+	else if( planner == "exhaustive" )
+		planner_flags_ = FFTW_EXHAUSTIVE;
+	else
+	{
+		LOGERR("Unknown FFTW planner level \'%s\' (estimate/measure/patient/exhaustive).", planner.c_str());
+		throw std::runtime_error("Unknown FFTW planner level");
+	}
+
+	LOGINFO("FFTW plans are created with planner level \'%s\'.", planner.c_str());
+
+	std::string device = cf.getValueSafe<std::string>("setup","fft_device","cpu");
+
+	if( device == "cuda" )
+	{
+	#ifdef USE_CUFFT
+		int ndev = 0;
+		if( cudaGetDeviceCount( &ndev ) == cudaSuccess && ndev > 0 )
+		{
+			use_device_ = true;
+			LOGINFO("Real FFTs are performed on the GPU using cuFFT.");
+		}
+		else
+			LOGWARN("No CUDA device found, FFTs are performed with FFTW.");
+	#else
+		LOGWARN("[setup] fft_device=cuda requires compilation with USE_CUFFT, FFTs are performed with FFTW.");
+	#endif
+	}
+	else if( device != "cpu" )
+	{
+		LOGERR("Unknown FFT device \'%s\' (cpu/cuda).", device.c_str());
+		throw std::runtime_error("Unknown FFT device");
+	}
+
+	if( !wisdom_file_.empty() )
+	{
+	#ifdef SINGLE_PRECISION
+		int ok = fftwf_import_wisdom_from_filename( wisdom_file_.c_str() );
+	#else
+		int ok = fftw_import_wisdom_from_filename( wisdom_file_.c_str() );
+	#endif
+		if( ok )
+			LOGINFO("Imported FFTW wisdom from file \'%s\'.", wisdom_file_.c_str());
+		else
+			LOGINFO("No FFTW wisdom found in \'%s\', it will be created.", wisdom_file_.c_str());
+	}
+}
+
+void fft_plans::finalize( void )
+{
+	if( !wisdom_file_.empty() && nplanned_ > 0 )
+	{
+	#ifdef SINGLE_PRECISION
+		int ok = fftwf_export_wisdom_to_filename( wisdom_file_.c_str() );
+	#else
+		int ok = fftw_export_wisdom_to_filename( wisdom_file_.c_str() );
+	#endif
+		if( ok )
+			LOGUSER("Exported FFTW wisdom to file \'%s\'.", wisdom_file_.c_str());
+		else
+			LOGWARN("Could not export FFTW wisdom to file \'%s\'.", wisdom_file_.c_str());
+	}
+
+	LOGUSER("FFTW plan cache: %llu plans created, %llu reused.", (unsigned long long)nplanned_, (unsigned long long)nreused_);
+
+	for( std::map< plan_key, plan_t >::iterator it = plans_.begin(); it != plans_.end(); ++it )
+	{
+	#ifdef SINGLE_PRECISION
+		fftwf_destroy_plan( it->second );
+	#else
+		fftw_destroy_plan( it->second );
+	#endif
+	}
+
+	plans_.clear();
+	nplanned_ = nreused_ = 0;
+
+#ifdef USE_CUFFT
+	if( use_device_ )
+		LOGUSER("cuFFT: %llu transforms on the GPU, %llu fell back to FFTW.", (unsigned long long)ndevice_, (unsigned long long)nhostfallback_);
+
+	device_release();
+	use_device_ = false;
+	ndevice_ = nhostfallback_ = 0;
+#endif
+}
+
+#else
+
+void fft_plans::initialize( config_file& cf )
+{ }
+
+void fft_plans::finalize( void )
+{ }
+
+#endif
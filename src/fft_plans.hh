@@ -0,0 +1,72 @@
+/*
+
+ fft_plans.hh - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#ifndef __FFT_PLANS_HH
+#define __FFT_PLANS_HH
+
+#include "general.hh"
+#include "config_file.hh"
+
+/*!
+ * @brief central store for FFTW plans that are reused during a run
+ *
+ * Plans are kept by (dims, direction, in-place, data alignment) and are applied
+ * to the actual arrays through the new-array execute interface, so a call site
+ * only pays for planning the first time a given transform appears. Optionally
+ * FFTW wisdom is read from and written to the file [setup] fftw_wisdom, which
+ * makes the expensive planner levels ([setup] fftw_planner) affordable for
+ * campaigns that repeat the same grid sizes.
+ *
+ * When compiled with USE_CUFFT and [setup] fft_device=cuda, the real transforms
+ * are performed with cuFFT on the GPU, transforms that do not fit into device
+ * memory and the DCT fall back to FFTW.
+ */
+namespace fft_plans
+{
+	//! read planner settings and import wisdom, call after the FFTW threads are set up
+	void initialize( config_file& cf );
+
+	//! export wisdom and destroy all cached plans
+	void finalize( void );
+
+#ifdef FFTW3
+	#ifdef SINGLE_PRECISION
+	typedef fftwf_plan plan_t;
+	#else
+	typedef fftw_plan plan_t;
+	#endif
+
+	enum transform_kind { kind_r2c, kind_c2r, kind_redft00 };
+
+	//! a cached plan bound to the arrays it is to be executed on, owned by the cache
+	struct transform
+	{
+		plan_t plan;
+		transform_kind kind;
+		fftw_real *rdata;
+		fftw_complex *cdata;
+		int nx, ny, nz;
+	};
+
+	//! real to complex transform of an nx*ny*nz array
+	transform r2c( int nx, int ny, int nz, fftw_real *in, fftw_complex *out );
+
+	//! complex to real transform of an nx*ny*nz array
+	transform c2r( int nx, int ny, int nz, fftw_complex *in, fftw_real *out );
+
+	//! in-place real even (DCT-I) transform of an nx*ny*nz array, equal to the DFT of its even extension
+	transform redft00( int nx, int ny, int nz, fftw_real *data );
+
+	//! execute a transform on the arrays it was requested for
+	void execute( const transform& t );
+#endif
+}
+
+#endif //__FFT_PLANS_HH
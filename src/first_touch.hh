@@ -0,0 +1,96 @@
+/*
+
+ first_touch.hh - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#ifndef __FIRST_TOUCH_HH
+#define __FIRST_TOUCH_HH
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+/*!
+ * @brief NUMA-friendly initialisation of large arrays
+ *
+ * Pages are placed on the memory node of the thread that first writes to them.
+ * The arrays of the density calculation are processed by '#pragma omp parallel for'
+ * loops over the slowest (x) index, so they are zeroed the same way on creation,
+ * one slab of ny*nzp elements per x-index, instead of by the allocating thread.
+ */
+namespace first_touch
+{
+	//! std::vector allocator that leaves default-constructed elements uninitialised
+	template< typename T >
+	struct allocator
+	{
+		typedef T value_type;
+
+		allocator( void ) {}
+		template< typename U > allocator( const allocator<U>& ) {}
+
+		T* allocate( size_t n )
+		{	return static_cast<T*>( ::operator new( n * sizeof(T) ) );	}
+
+		void deallocate( T* p, size_t )
+		{	::operator delete( p );		}
+
+		template< typename U >
+		void construct( U* p )
+		{	::new( (void*)p ) U;	}
+
+		template< typename U, typename... Args >
+		void construct( U* p, Args&&... args )
+		{	::new( (void*)p ) U( std::forward<Args>(args)... );	}
+	};
+
+	template< typename T, typename U >
+	inline bool operator==( const allocator<T>&, const allocator<U>& )
+	{	return true;	}
+
+	template< typename T, typename U >
+	inline bool operator!=( const allocator<T>&, const allocator<U>& )
+	{	return false;	}
+
+	//! zero nslab consecutive slabs of nperslab elements, slab i by the thread owning x-index i
+	template< typename T >
+	inline void zero( T* p, size_t nslab, size_t nperslab )
+	{
+		#pragma omp parallel for
+		for( long long i=0; i<(long long)nslab; ++i )
+		{
+			T* q = p + (size_t)i * nperslab;
+			for( size_t j=0; j<nperslab; ++j )
+				q[j] = T(0);
+		}
+	}
+
+	//! copy nslab slabs of nperslab elements with the same decomposition
+	template< typename T >
+	inline void copy( T* dst, const T* src, size_t nslab, size_t nperslab )
+	{
+		#pragma omp parallel for
+		for( long long i=0; i<(long long)nslab; ++i )
+		{
+			size_t q = (size_t)i * nperslab;
+			for( size_t j=0; j<nperslab; ++j )
+				dst[q+j] = src[q+j];
+		}
+	}
+
+	//! allocate a zeroed array with new[] (release with delete[]), first touched by slabs
+	template< typename T >
+	inline T* new_array( size_t nslab, size_t nperslab )
+	{
+		T* p = new T[nslab * nperslab];
+		zero( p, nslab, nperslab );
+		return p;
+	}
+}
+
+#endif //__FIRST_TOUCH_HH
@@ -0,0 +1,290 @@
+/*
+
+ kernel_store.hh - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#ifndef __KERNEL_STORE_HH
+#define __KERNEL_STORE_HH
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "log.hh"
+
+namespace convolution
+{
+
+/*!
+ * @brief storage for the precomputed real space convolution kernels of all levels
+ *
+ * A kernel is an array of dims[0]*dims[1]*dims[2] values, it is put once after
+ * it has been computed and can be retrieved any number of times later.
+ */
+template <typename real_t>
+class kernel_store
+{
+protected:
+	//! unique prefix for temporary files, so that several runs can share a directory
+	static std::string unique_prefix(void)
+	{
+		static int instance = 0;
+		char prefix[128];
+		sprintf(prefix, "temp_kernel_%d_%d", (int)getpid(), instance++);
+		return std::string(prefix);
+	}
+
+public:
+	//! store the kernel of a level
+	virtual void put(int ilevel, const unsigned *dims, const real_t *data) = 0;
+
+	//! retrieve the kernel of a level, data is resized to hold it
+	virtual void get(int ilevel, unsigned *dims, std::vector<real_t> &data) = 0;
+
+	//! human readable name of the backend
+	virtual const char *name(void) const = 0;
+
+	virtual ~kernel_store() {}
+};
+
+//! keeps all kernels in memory
+template <typename real_t>
+class kernel_store_memory : public kernel_store<real_t>
+{
+protected:
+	struct level
+	{
+		unsigned dims[3];
+		std::vector<real_t> data;
+	};
+	std::map<int, level> levels_;
+
+public:
+	void put(int ilevel, const unsigned *dims, const real_t *data)
+	{
+		level &l = levels_[ilevel];
+		size_t n = (size_t)dims[0] * (size_t)dims[1] * (size_t)dims[2];
+		memcpy(l.dims, dims, 3 * sizeof(unsigned));
+		l.data.assign(data, data + n);
+	}
+
+	void get(int ilevel, unsigned *dims, std::vector<real_t> &data)
+	{
+		typename std::map<int, level>::iterator it = levels_.find(ilevel);
+		if (it == levels_.end())
+		{
+			LOGERR("No kernel stored for level %d.", ilevel);
+			throw std::runtime_error("Internal error: convolution kernel was not precomputed!");
+		}
+		memcpy(dims, it->second.dims, 3 * sizeof(unsigned));
+		data = it->second.data;
+	}
+
+	const char *name(void) const { return "memory"; }
+};
+
+//! keeps all kernels in one temporary file that is memory mapped for reading
+template <typename real_t>
+class kernel_store_mmap : public kernel_store<real_t>
+{
+protected:
+	struct level
+	{
+		unsigned dims[3];
+		off_t offset;
+	};
+	std::map<int, level> levels_;
+	std::string fname_;
+	int fd_;
+	off_t size_;
+
+public:
+	kernel_store_mmap(void)
+		: fname_(kernel_store<real_t>::unique_prefix() + ".tmp"), size_(0)
+	{
+		fd_ = open(fname_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (fd_ < 0)
+		{
+			LOGERR("Could not create kernel file \'%s\'.", fname_.c_str());
+			throw std::runtime_error("Could not create convolution kernel file");
+		}
+	}
+
+	~kernel_store_mmap()
+	{
+		close(fd_);
+		unlink(fname_.c_str());
+	}
+
+	void put(int ilevel, const unsigned *dims, const real_t *data)
+	{
+		level &l = levels_[ilevel];
+		memcpy(l.dims, dims, 3 * sizeof(unsigned));
+		l.offset = size_;
+
+		size_t nbytes = (size_t)dims[0] * (size_t)dims[1] * (size_t)dims[2] * sizeof(real_t), nwritten = 0;
+		const char *p = reinterpret_cast<const char *>(data);
+
+		while (nwritten < nbytes)
+		{
+			ssize_t nw = pwrite(fd_, p + nwritten, nbytes - nwritten, size_ + (off_t)nwritten);
+			if (nw <= 0)
+			{
+				LOGERR("Could not write kernel of level %d to file \'%s\'.", ilevel, fname_.c_str());
+				throw std::runtime_error("Could not write convolution kernel file");
+			}
+			nwritten += (size_t)nw;
+		}
+
+		size_ += (off_t)nbytes;
+	}
+
+	void get(int ilevel, unsigned *dims, std::vector<real_t> &data)
+	{
+		typename std::map<int, level>::iterator it = levels_.find(ilevel);
+		if (it == levels_.end())
+		{
+			LOGERR("No kernel stored for level %d in file \'%s\'.", ilevel, fname_.c_str());
+			throw std::runtime_error("Internal error: convolution kernel was not precomputed!");
+		}
+
+		memcpy(dims, it->second.dims, 3 * sizeof(unsigned));
+		size_t n = (size_t)dims[0] * (size_t)dims[1] * (size_t)dims[2];
+
+		//... mappings have to start at a page boundary
+		off_t pagesz = (off_t)sysconf(_SC_PAGESIZE);
+		off_t off0 = (it->second.offset / pagesz) * pagesz, skip = it->second.offset - off0;
+		size_t maplen = (size_t)skip + n * sizeof(real_t);
+
+		void *pmap = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fd_, off0);
+		if (pmap == MAP_FAILED)
+		{
+			LOGERR("Could not map kernel of level %d from file \'%s\'.", ilevel, fname_.c_str());
+			throw std::runtime_error("Could not map convolution kernel file");
+		}
+		madvise(pmap, maplen, MADV_SEQUENTIAL);
+
+		const real_t *src = reinterpret_cast<const real_t *>(reinterpret_cast<char *>(pmap) + skip);
+		data.assign(src, src + n);
+
+		munmap(pmap, maplen);
+	}
+
+	const char *name(void) const { return "mmap"; }
+};
+
+//! keeps every kernel in a temporary file of its own (the traditional behaviour)
+template <typename real_t>
+class kernel_store_file : public kernel_store<real_t>
+{
+protected:
+	std::string prefix_;
+	std::map<int, std::string> fnames_;
+
+public:
+	kernel_store_file(void)
+		: prefix_(kernel_store<real_t>::unique_prefix())
+	{
+	}
+
+	~kernel_store_file()
+	{
+		for (std::map<int, std::string>::iterator it = fnames_.begin(); it != fnames_.end(); ++it)
+			remove(it->second.c_str());
+	}
+
+	void put(int ilevel, const unsigned *dims, const real_t *data)
+	{
+		char cachefname[256];
+		sprintf(cachefname, "%s_level%03d.tmp", prefix_.c_str(), ilevel);
+		LOGUSER("Storing kernel in temp file \'%s\'.", cachefname);
+
+		FILE *fp = fopen(cachefname, "w+");
+		if (fp == NULL)
+		{
+			LOGERR("Could not create kernel file \'%s\'.", cachefname);
+			throw std::runtime_error("Could not create convolution kernel file");
+		}
+		fnames_[ilevel] = cachefname;
+
+		fwrite(reinterpret_cast<const void *>(dims), sizeof(unsigned), 3, fp);
+
+		size_t sz = (size_t)dims[1] * (size_t)dims[2];
+		for (size_t ix = 0; ix < dims[0]; ++ix)
+			fwrite(reinterpret_cast<const void *>(&data[ix * sz]), sizeof(real_t), sz, fp);
+
+		fclose(fp);
+	}
+
+	void get(int ilevel, unsigned *dims, std::vector<real_t> &data)
+	{
+		std::map<int, std::string>::iterator it = fnames_.find(ilevel);
+		FILE *fp = (it == fnames_.end()) ? NULL : fopen(it->second.c_str(), "r");
+
+		if (fp == NULL)
+		{
+			LOGERR("Could not open kernel file for level %d.", ilevel);
+			throw std::runtime_error("Internal error: cached convolution kernel does not exist on disk!");
+		}
+
+		LOGUSER("Loading kernel for level %3d from file \'%s\'...", ilevel, it->second.c_str());
+
+		bool ok = fread(reinterpret_cast<void *>(dims), sizeof(unsigned), 3, fp) == 3;
+
+		size_t sz = (size_t)dims[1] * (size_t)dims[2];
+		if (ok)
+			data.assign((size_t)dims[0] * sz, 0.0);
+
+		for (size_t ix = 0; ok && ix < dims[0]; ++ix)
+			ok = fread(reinterpret_cast<void *>(&data[ix * sz]), sizeof(real_t), sz, fp) == sz;
+
+		fclose(fp);
+
+		if (!ok)
+		{
+			LOGERR("Could not read kernel file \'%s\'.", it->second.c_str());
+			throw std::runtime_error("Could not read convolution kernel file");
+		}
+	}
+
+	const char *name(void) const { return "file"; }
+};
+
+//! create a kernel store of the given type (auto/memory/mmap/file), nbytes is the total size of all kernels
+template <typename real_t>
+kernel_store<real_t> *create_kernel_store(std::string type, size_t nbytes)
+{
+	if (type == "auto")
+	{
+		//... keep the kernels in memory if they take at most a quarter of the free memory
+		long npages = sysconf(_SC_AVPHYS_PAGES), pagesz = sysconf(_SC_PAGESIZE);
+		size_t nfree = (npages > 0 && pagesz > 0) ? (size_t)npages * (size_t)pagesz : 0;
+		type = (nbytes <= nfree / 4) ? "memory" : "mmap";
+	}
+
+	if (type == "memory")
+		return new kernel_store_memory<real_t>();
+	if (type == "mmap")
+		return new kernel_store_mmap<real_t>();
+	if (type == "file")
+		return new kernel_store_file<real_t>();
+
+	LOGERR("Unknown kernel store \'%s\' (auto/memory/mmap/file).", type.c_str());
+	throw std::runtime_error("Unknown convolution kernel store");
+}
+
+} // namespace convolution
+
+#endif //__KERNEL_STORE_HH
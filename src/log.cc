@@ -1,78 +1,299 @@
 /*
- 
+
  log.cc - This file is part of MUSIC -
- a code to generate multi-scale initial conditions 
- for cosmological simulations 
- 
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
  Copyright (C) 2010  Oliver Hahn
- 
+
  */
 
 #include "log.hh"
 #include <iostream>
-#include <algorithm>
-
-std::string RemoveMultipleWhiteSpaces( std::string s );
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 
 std::string MUSIC::log::outputFile_;
 std::ofstream MUSIC::log::outputStream_;
-std::list<MUSIC::log::message> MUSIC::log::messages_;
 void (*MUSIC::log::receiver)(const message&) = NULL;
 MUSIC::log::messageType MUSIC::log::logLevel_;
 
+//! guards the log file and the receiver against setOutput and writes after the writer thread ended
+static std::mutex log_mutex_;
+
+//! true once the writer thread has been shut down at exit, messages are written directly then
+static std::atomic<bool> log_writer_stopped_( false );
+
+
+namespace MUSIC
+{
+
+//! one queued message, its text is formatted directly into the slot
+struct log_slot
+{
+	std::atomic<size_t> seq;	//!< pos while the slot is free for message pos, pos+1 once that is published
+	log::messageType type;
+	time_t when;
+	char text[1024];
+};
+
+/*!
+ *	\brief	Bounded message queue drained by a background writer thread.
+ *
+ *	Senders claim a slot with one atomic increment, format into it and publish it; they only
+ *	take a lock to wake the writer when it sleeps. When all slots are taken, senders wait for
+ *	the writer instead of allocating. The log file is flushed when no message arrived for a
+ *	while, on flush() and at exit, not after every line.
+ */
+class log_writer
+{
+protected:
+	enum { nslots = 1024 };
+
+	log_slot slots_[nslots];
+	std::atomic<size_t> head_;		//!< next position claimed by a sender
+	size_t tail_;					//!< next position to write, owned by the writer thread
+	size_t flush_target_, flushed_;	//!< all positions below these are to be / have been flushed
+	std::atomic<bool> sleeping_;
+	bool stop_;
+	std::mutex mutex_;
+	std::condition_variable wake_, flushed_cv_;
+	std::thread thread_;
+
+	bool ready( void ) const
+	{	return slots_[tail_ % nslots].seq.load() == tail_+1;	}
+
+	bool flush_due( void ) const
+	{	return flush_target_ > flushed_ && tail_ >= flush_target_;	}
+
+	void flush_streams( void )
+	{
+		std::lock_guard<std::mutex> lock( log_mutex_ );
+		if( log::outputStream_.is_open() )
+			log::outputStream_.flush();
+	}
+
+	void run( void )
+	{
+		bool dirty = false;
+		std::unique_lock<std::mutex> lock( mutex_ );
+
+		while( true )
+		{
+			lock.unlock();
+			while( ready() )
+			{
+				log_slot& s = slots_[tail_ % nslots];
+				log::write( s.type, s.when, s.text );
+				s.seq.store( tail_+nslots );
+				++tail_;
+				dirty = true;
+			}
+			lock.lock();
+
+			bool done = stop_ && head_.load() == tail_;
+			if( flush_due() || done )
+			{
+				if( dirty )
+					flush_streams();
+				dirty = false;
+				flushed_ = tail_;
+				flushed_cv_.notify_all();
+			}
+			if( done )
+				return;
 
-std::string RemoveMultipleWhiteSpaces( std::string s )
-{ 
-	std::string search = "  "; // this is 2 spaces
-	size_t index;
-	
-	while( (index = s.find(search)) != std::string::npos )
-	{ // remove 1 character from the string at index
-		s.erase(index,1);
+			sleeping_.store( true );
+			bool woken = wake_.wait_for( lock, std::chrono::milliseconds(100),
+						[this]{ return ready() || stop_ || flush_due(); } );
+			sleeping_.store( false );
+
+			//... idle, make what has been written so far visible
+			if( !woken && dirty )
+			{
+				flush_streams();
+				dirty = false;
+			}
+		}
+	}
+
+public:
+	log_writer( void )
+	: head_( 0 ), tail_( 0 ), flush_target_( 0 ), flushed_( 0 ), sleeping_( false ), stop_( false )
+	{
+		for( size_t i=0; i<nslots; ++i )
+			slots_[i].seq.store( i );
+		thread_ = std::thread( &log_writer::run, this );
+	}
+
+	~log_writer()
+	{
+		{
+			std::lock_guard<std::mutex> lock( mutex_ );
+			stop_ = true;
+		}
+		wake_.notify_one();
+		thread_.join();
+		log_writer_stopped_.store( true );
+	}
+
+	//! claim the slot of the next message, waits while the writer has not freed it yet
+	log_slot& claim( size_t& pos )
+	{
+		pos = head_.fetch_add( 1 );
+		log_slot& s = slots_[pos % nslots];
+		while( s.seq.load() != pos )
+			std::this_thread::yield();
+		return s;
+	}
+
+	//! hand the claimed slot over to the writer
+	void publish( log_slot& s, size_t pos )
+	{
+		s.seq.store( pos+1 );
+		if( sleeping_.load() )
+		{
+			std::lock_guard<std::mutex> lock( mutex_ );
+			wake_.notify_one();
+		}
 	}
-	
-	return s;
+
+	//! block until all messages claimed so far are written and flushed
+	void flush( void )
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		size_t target = head_.load();
+		if( target > flush_target_ )
+			flush_target_ = target;
+		wake_.notify_one();
+		flushed_cv_.wait( lock, [this,target]{ return flushed_ >= target; } );
+	}
+};
+
 }
 
-void MUSIC::log::send(messageType type, const std::string& text_)
-//void MUSIC::log::send(messageType type, std::stringstream& textstr)
+//! the writer is started by the first message and shut down after main returns
+static MUSIC::log_writer& get_log_writer( void )
+{
+	static MUSIC::log_writer writer;
+	return writer;
+}
+
+//! messages of these types are also shown on the console
+static void print_message( MUSIC::log::messageType type, const char *text )
+{
+	const char *prefix;
+	switch(type)
+	{
+		case MUSIC::log::Info:			prefix = " - "; break;
+		case MUSIC::log::Warning:		prefix = " - WARNING: "; break;
+		case MUSIC::log::Error:			prefix = " - ERROR: "; break;
+		case MUSIC::log::FatalError:	prefix = " - FATAL: "; break;
+		default:						return;
+	}
+
+	//... a single write, so that lines of different threads do not mix
+	std::string line( prefix );
+	line += text;
+	line += '\n';
+	std::cout << line;
+
+	if( type==MUSIC::log::Error||type==MUSIC::log::FatalError )
+		std::cout.flush();
+}
+
+//! vsend with a variable argument list
+static void send_formatted( MUSIC::log::messageType type, const char *fmt, ... )
+{
+	va_list args;
+	va_start(args,fmt);
+	MUSIC::log::vsend(type, fmt, args);
+	va_end(args);
+}
+
+void MUSIC::log::send(messageType type, const std::string& text)
+{
+	// the text is not a format
+	send_formatted( type, "%s", text.c_str() );
+}
+
+void MUSIC::log::vsend(messageType type, const char* fmt, va_list args)
 {
-	std::string text(text_);// = textstr.str();
 	// Skip logging if minimum level is higher
-    if (logLevel_)
+	if (logLevel_)
 		if (type < logLevel_) return;
-	// log message
-	MUSIC::log::message m;
-	m.type = type;
-	m.text = text;
-	time_t t = time(NULL);
-	m.when = localtime(&t);
-	messages_.push_back(m);
-	
-	if( type==Info||type==Warning||type==Error||type==FatalError )
-	{	
-		std::cout << " - "; 
-		if(type==Warning)
-			std::cout << "WARNING: ";
-		if(type==Error)
-			std::cout << "ERROR: ";
-		if(type==FatalError)
-			std::cout << "FATAL: ";
-		std::cout << text << std::endl;
+
+	//... after the writer thread ended at exit, write directly
+	if( log_writer_stopped_.load() )
+	{
+		char text[1024];
+		vsnprintf( text, sizeof(text), fmt, args );
+		print_message( type, text );
+		write( type, time(NULL), text );
+
+		std::lock_guard<std::mutex> lock( log_mutex_ );
+		if( outputStream_.is_open() )
+			outputStream_.flush();
+		return;
 	}
-	
-	std::replace(text.begin(),text.end(),'\n',' ');
-	RemoveMultipleWhiteSpaces(text);
-	
+
+	log_writer& writer = get_log_writer();
+	size_t pos;
+	log_slot& s = writer.claim( pos );
+	vsnprintf( s.text, sizeof(s.text), fmt, args );
+	s.type = type;
+	s.when = time(NULL);
+	print_message( type, s.text );
+	writer.publish( s, pos );
+
+	//... errors usually precede an exception or abort, make sure they are in the file
+	if( type==Error||type==FatalError )
+		writer.flush();
+}
+
+void MUSIC::log::flush()
+{
+	if( !log_writer_stopped_.load() )
+		get_log_writer().flush();
+}
+
+void MUSIC::log::write(messageType type, time_t when, char* text)
+{
+	//... newlines become spaces and runs of spaces are compacted, in place
+	char *out = text;
+	for( const char *in = text; *in; ++in )
+	{
+		char c = (*in=='\n')? ' ' : *in;
+		if( c==' ' && out > text && out[-1]==' ' )
+			continue;
+		*out++ = c;
+	}
+	*out = '\0';
+
+	std::lock_guard<std::mutex> lock( log_mutex_ );
+
+	//... messages arrive in order, so the time only has to be converted when it changes
+	static time_t last_when = (time_t)-1;
+	static tm tm_when;
+	static char stamp[9];
+	if( when != last_when )
+	{
+		localtime_r( &when, &tm_when );
+		strftime( stamp, sizeof(stamp), "%X", &tm_when );
+		last_when = when;
+	}
+
 	// if enabled logging to file
 	if(outputStream_.is_open())
 	{
 		// print time
-		char buffer[9];
-		strftime(buffer, 9, "%X", m.when);
-		outputStream_ << buffer;
-		
+		outputStream_ << stamp;
+
 		// print type
 		switch(type)
 		{
@@ -84,33 +305,47 @@ void MUSIC::log::send(messageType type, const std::string& text_)
 			case User:		outputStream_ << " | info    | "; break;
 			default:		outputStream_ << " | ";
 		}
-		
+
 		// print description
-		outputStream_ << text << std::endl;
+		outputStream_ << text << '\n';
 	}
-	
+
 	// if user wants to catch messages, send it to him
 	if(receiver)
+	{
+		message m;
+		m.type = type;
+		m.text = text;
+		m.when = &tm_when;
 		receiver(m);
+	}
 }
 
 
 void MUSIC::log::setOutput(const std::string& filename)
 {
-	//logDebug("Setting output log file: " + filename);
-	outputFile_ = filename;
-	
-	// close old one
-	if(outputStream_.is_open())
-		outputStream_.close();
-	
-	// create file
-	outputStream_.open(filename.c_str());
-	if(!outputStream_.is_open())
+	//... messages sent before go to the old file
+	flush();
+
+	bool ok;
+	{
+		std::lock_guard<std::mutex> lock( log_mutex_ );
+		outputFile_ = filename;
+
+		// close old one
+		if(outputStream_.is_open())
+			outputStream_.close();
+
+		// create file
+		outputStream_.open(filename.c_str());
+		ok = outputStream_.is_open();
+	}
+
+	if(!ok)
 		LOGERR("Cannot create/open logfile \'%s\'.",filename.c_str());
 }
 
-void MUSIC::log::setLevel(const MUSIC::log::messageType level) 
+void MUSIC::log::setLevel(const MUSIC::log::messageType level)
 {
     logLevel_ = level;
 }
@@ -118,7 +353,9 @@ void MUSIC::log::setLevel(const MUSIC::log::messageType level)
 
 MUSIC::log::~log()
 {
+	flush();
+
+	std::lock_guard<std::mutex> lock( log_mutex_ );
 	if(outputStream_.is_open())
 		outputStream_.close();
 }
-
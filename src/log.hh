@@ -12,7 +12,6 @@
 #define __LOG_HH
 
 #include <string>
-#include <list>
 #include <fstream>
 #include <ctime>
 #include <cstdarg>
@@ -24,9 +23,14 @@
  *	This is the class that catches every (debug) info, warning, error, or user message and
  *	processes it. Messages can be written to files and/or forwarded to user function for
  *	processing messages.
+ *
+ *	Messages are formatted into a fixed ring of slots and written by a background thread,
+ *	so sending is safe and cheap from parallel regions. Errors are written before send returns.
  */
 namespace MUSIC
 {
+
+class log_writer;
 	
 class log
 {
@@ -71,20 +75,19 @@ public:
 	 *	\brief	Add a new message to log.
 	 *	\param	type	Type of the new message.
 	 *	\param	text	Message.
-	 *	\remarks Message is directly passes to user reciever if one is set.
+	 *	\remarks Message is passed to the user receiver if one is set, from the writer thread.
 	 */
 	static void send(messageType type, const std::string& text);
-	//static void send(messageType type, std::string& text);
 	
 	/*!
-	 *	\brief	Get the list of all of the logged messages.
+	 *	\brief	Add a new message to log, formatted printf-like from fmt and args (at most 1023 characters).
 	 */
-	static const std::list<message>& messages() { return messages_; }
+	static void vsend(messageType type, const char* fmt, va_list args);
 	
 	/*!
-	 *	\brief	Get the last logged message.
+	 *	\brief	Wait until all messages sent so far are written and the log file is flushed.
 	 */
-	static const message& lastMessage() { return messages_.back(); }
+	static void flush();
 	
 	/*!
 	 *	\brief	Set user function to receive newly sent messages to logger.
@@ -98,9 +101,13 @@ public:
 	
 private:
 	
+	friend class log_writer;
+	
+	//! write one message to the log file and pass it to the receiver
+	static void write(messageType type, time_t when, char* text);
+	
 	static std::string outputFile_;
 	static std::ofstream outputStream_;
-	static std::list<message> messages_;
 	static messageType logLevel_;
 	static void (*receiver)(const message&);
 };
@@ -110,62 +117,50 @@ private:
 
 inline void LOGERR( const char* str, ... )
 {
-	char out[1024];
 	va_list argptr;
 	va_start(argptr,str);
+	MUSIC::log::vsend(MUSIC::log::Error, str, argptr);
 	va_end(argptr);
-	vsprintf(out,str,argptr);
-	MUSIC::log::send(MUSIC::log::Error, std::string(out));
 }
 
 inline void LOGWARN( const char* str, ... )
 {
-	char out[1024];
 	va_list argptr;
 	va_start(argptr,str);
+	MUSIC::log::vsend(MUSIC::log::Warning, str, argptr);
 	va_end(argptr);
-	vsprintf(out,str,argptr);
-	MUSIC::log::send(MUSIC::log::Warning, std::string(out));
 }
 
 inline void LOGFATAL( const char* str, ... )
 {
-	char out[1024];
 	va_list argptr;
 	va_start(argptr,str);
+	MUSIC::log::vsend(MUSIC::log::FatalError, str, argptr);
 	va_end(argptr);
-	vsprintf(out,str,argptr);
-	MUSIC::log::send(MUSIC::log::FatalError, std::string(out));
 }
 
 inline void LOGDEBUG( const char* str, ... )
 {
-	char out[1024];
 	va_list argptr;
 	va_start(argptr,str);
+	MUSIC::log::vsend(MUSIC::log::DebugInfo, str, argptr);
 	va_end(argptr);
-	vsprintf(out,str,argptr);
-	MUSIC::log::send(MUSIC::log::DebugInfo, std::string(out));
 }
 
 inline void LOGUSER( const char* str, ... )
 {
-	char out[1024];
 	va_list argptr;
 	va_start(argptr,str);
+	MUSIC::log::vsend(MUSIC::log::User, str, argptr);
 	va_end(argptr);
-	vsprintf(out,str,argptr);
-	MUSIC::log::send(MUSIC::log::User, std::string(out));
 }
 
 inline void LOGINFO( const char* str, ... )
 {
-	char out[1024];
 	va_list argptr;
 	va_start(argptr,str);
+	MUSIC::log::vsend(MUSIC::log::Info, str, argptr);
 	va_end(argptr);
-	vsprintf(out,str,argptr);
-	MUSIC::log::send(MUSIC::log::Info, std::string(out));
 }
 
 #endif //__LOG_HH
@@ -32,6 +32,8 @@
 #include "output.hh"
 
 #include "config_file.hh"
+#include "fft_plans.hh"
+#include "fft_mpi.hh"
 
 #include "poisson.hh"
 #include "mg_solver.hh"
@@ -42,6 +44,9 @@
 #include "convolution_kernel.hh"
 #include "cosmology.hh"
 #include "transfer_function.hh"
+#include "task_graph.hh"
+#include "output_writer.hh"
+#include "music.hh"
 
 #define THE_CODE_NAME "music!"
 #define THE_CODE_VERSION "1.53"
@@ -73,6 +78,7 @@ real_t TransferFunction_k::nspec_ = -1.0;
 void splash(void);
 void modify_grid_for_TF( const refinement_hierarchy& rh_full, refinement_hierarchy& rh_TF, config_file& cf );
 void print_hierarchy_stats( config_file& cf, const refinement_hierarchy& rh );
+double print_memory_plan( config_file& cf, const refinement_hierarchy& rh_Poisson, const refinement_hierarchy& rh_TF, unsigned nbnd );
 void store_grid_structure( config_file& cf, const refinement_hierarchy& rh );
 double compute_finest_mean( grid_hierarchy& u );
 double compute_finest_sigma( grid_hierarchy& u );
@@ -228,6 +234,126 @@ void print_hierarchy_stats( config_file& cf, const refinement_hierarchy& rh )
 	std::cout << "-------------------------------------------------------------\n";
 }
 
+//! bytes of one level of a grid hierarchy, including the ghost zones
+static double level_bytes( const refinement_hierarchy& rh, unsigned ilevel, unsigned nbnd )
+{
+	double n = 1.0;
+	for( int i=0; i<3; ++i )
+		n *= (double)((ilevel < rh.levelmin()? (1ul<<ilevel) : rh.size(ilevel,i)) + 2*nbnd);
+	return n * sizeof(real_t);
+}
+
+//! bytes of a padded FFT array of nx*ny*nz cells
+static double padded_bytes( double nx, double ny, double nz )
+{	return nx * ny * 2.0 * (floor(nz/2)+1) * sizeof(real_t);	}
+
+/*! estimate the peak memory of the stages of the driver from the grid structure and the
+ *  chosen solvers, before anything is allocated. The estimate covers the grid data only,
+ *  temporary data of the output plug-ins is not included. Returns the estimated peak in bytes.
+ */
+double print_memory_plan( config_file& cf, const refinement_hierarchy& rh_Poisson, const refinement_hierarchy& rh_TF, unsigned nbnd )
+{
+	bool do_baryons = cf.getValue<bool>("setup","baryons");
+	bool do_2LPT = cf.getValueSafe<bool>("setup","use_2LPT",false);
+	bool bdefd = cf.getValueSafe<bool>("poisson","fft_fine",true);
+	bool kspace = cf.getValueSafe<bool>("poisson","kspace",false);
+	bool grad_single_pass = cf.getValueSafe<bool>("poisson","grad_single_pass",false);
+	bool hybrid_single_fft = cf.getValueSafe<bool>("poisson","hybrid_single_fft",false);
+	bool disk_cached = cf.getValueSafe<bool>("random","disk_cached",true);
+	std::string noise_precision = cf.getValueSafe<std::string>("random","noise_precision",sizeof(real_t)==sizeof(float)? "float" : "double");
+	
+	unsigned lmin = rh_Poisson.levelmin(), lmax = rh_Poisson.levelmax();
+	bool kspace2LPT = cf.getValueSafe<bool>("poisson","kspace2LPT",kspace && lmin == lmax);
+	if( bdefd && lmin == lmax )
+	{
+		kspace = true;
+		bdefd = false;
+		kspace2LPT = false;
+	}
+	
+	//... hierarchies of the Poisson and the density grid structure
+	double H = 0.0, HTF = 0.0;
+	for( unsigned ilevel=0; ilevel<=lmax; ++ilevel )
+	{
+		H += level_bytes( rh_Poisson, ilevel, nbnd );
+		HTF += level_bytes( rh_TF, ilevel, nbnd );
+	}
+	
+	//... white noise, kept in memory for all levels unless cached on disk
+	double noise = 0.0, noise_level = 0.0;
+	size_t sz_noise = (noise_precision == "float")? sizeof(float) : sizeof(double);
+	for( unsigned ilevel=rh_TF.levelmin(); ilevel<=lmax; ++ilevel )
+	{
+		double n = (ilevel == rh_TF.levelmin())? pow(2.0,3.0*ilevel) 
+			: 8.0 * (double)rh_TF.size(ilevel,0) * (double)rh_TF.size(ilevel,1) * (double)rh_TF.size(ilevel,2);
+		noise += n * sz_noise;
+		noise_level = std::max( noise_level, n * sz_noise );
+	}
+	double noise_resident = disk_cached? noise_level : noise;
+	
+	//... convolutions work on the padded top grid and on zoom grids padded to twice their size,
+	//... each needs the grid, a saved copy, the kernel and the next finer grid
+	std::vector<double> G;
+	for( unsigned ilevel=rh_TF.levelmin(); ilevel<=lmax; ++ilevel )
+	{
+		if( ilevel == rh_TF.levelmin() )
+		{
+			double n = (double)(1ul<<ilevel);
+			G.push_back( padded_bytes( n, n, n ) );
+		}
+		else
+			G.push_back( padded_bytes( 2.0*rh_TF.size(ilevel,0), 2.0*rh_TF.size(ilevel,1), 2.0*rh_TF.size(ilevel,2) ) );
+	}
+	double conv = 0.0;
+	for( size_t i=0; i<G.size(); ++i )
+		conv = std::max( conv, 3.0*G[i] + ((i+1<G.size())? G[i+1] : 0.0) );
+	
+	//... the finest level as a padded array, for k-space solves and the hybrid corrections
+	double Pfine = padded_bytes( rh_Poisson.size(lmax,0), rh_Poisson.size(lmax,1), rh_Poisson.size(lmax,2) );
+	double solver = kspace? Pfine : H;
+	double hybrid = bdefd? (hybrid_single_fft? 3.0 : 1.0) * Pfine : 0.0;
+	double fkeep = bdefd? H : 0.0;
+	
+	std::vector< std::pair<std::string,double> > stages;
+	stages.push_back( std::make_pair( "white noise", noise_resident ) );
+	stages.push_back( std::make_pair( "density", noise_resident + HTF + conv ) );
+	
+	if( !do_2LPT )
+	{
+		stages.push_back( std::make_pair( "Poisson solve", noise_resident + 2.0*H + solver ) );
+		stages.push_back( std::make_pair( "displacements", noise_resident + fkeep + 2.0*H + hybrid + (grad_single_pass? 2.0*H : 0.0) ) );
+	}
+	else
+	{
+		double source = kspace2LPT? 3.0*Pfine : 0.0;
+		stages.push_back( std::make_pair( "Poisson solve", noise_resident + 2.0*H + solver ) );
+		stages.push_back( std::make_pair( "2LPT source", noise_resident + fkeep + 2.0*H + source ) );
+		stages.push_back( std::make_pair( "2LPT Poisson solve", noise_resident + fkeep + 3.0*H + solver ) );
+		stages.push_back( std::make_pair( "displacements", noise_resident + fkeep + 2.0*H + hybrid + (grad_single_pass? 2.0*H : 0.0) ) );
+	}
+	
+	double peak = 0.0;
+	std::cout << " - Estimated memory of the grid data" << (do_baryons? " (each stage runs once per component)" : "") << ":\n";
+	for( size_t i=0; i<stages.size(); ++i )
+	{
+		std::cout << "     " << std::setw(20) << std::left << stages[i].first << std::right << " : " 
+				  << std::setw(10) << std::fixed << std::setprecision(1) << stages[i].second/1048576.0 << " MB\n";
+		LOGUSER("Estimated memory of stage \'%s\': %.1f MB", stages[i].first.c_str(), stages[i].second/1048576.0);
+		peak = std::max( peak, stages[i].second );
+	}
+	std::cout.unsetf( std::ios::fixed );
+	std::cout << std::setprecision(6);
+	
+	std::cout << "     " << std::setw(20) << std::left << "estimated peak" << std::right << " : " 
+			  << std::setw(10) << std::fixed << std::setprecision(1) << peak/1048576.0 << " MB (output plug-in buffers not included)\n";
+	std::cout.unsetf( std::ios::fixed );
+	std::cout << std::setprecision(6);
+	std::cout << "-------------------------------------------------------------\n";
+	LOGUSER("Estimated peak memory of the grid data: %.1f MB", peak/1048576.0);
+	
+	return peak;
+}
+
 
 void store_grid_structure( config_file& cf, const refinement_hierarchy& rh )
 {
@@ -261,7 +387,7 @@ double compute_finest_mean( grid_hierarchy& u )
                     sum += (*u.get_grid(u.levelmax()))(ix,iy,iz);
                     ++count;
                 }
-	sum /= count;
+	sum = fft_mpi::sum( sum ) / (double)fft_mpi::sum( count );
 	return sum;
 	
 }
@@ -280,8 +406,9 @@ double compute_finest_sigma( grid_hierarchy& u )
 	size_t N = (size_t)(*u.get_grid(u.levelmax())).size(0)
 		 * (size_t)(*u.get_grid(u.levelmax())).size(1)
 		 * (size_t)(*u.get_grid(u.levelmax())).size(2);
-	sum /= N;
-	sum2 /= N;
+	N = fft_mpi::sum( N );
+	sum = fft_mpi::sum( sum ) / N;
+	sum2 = fft_mpi::sum( sum2 ) / N;
 
 	return sqrt(sum2-sum*sum);
 }
@@ -297,11 +424,324 @@ double compute_finest_max( grid_hierarchy& u )
 			    valmax = (*u.get_grid(u.levelmax()))(ix,iy,iz);
 			}
 
-	return valmax;
+	return fft_mpi::max_abs( valmax );
 }
 
 
 
+//! hands out the gradient components of a potential, optionally all computed in one pass over it
+class gradient_components
+{
+protected:
+	poisson_plugin *ps_;
+	bool single_pass_;
+	grid_hierarchy *next_[2];
+	
+	void release( void )
+	{
+		delete next_[0];
+		delete next_[1];
+		next_[0] = next_[1] = NULL;
+	}
+	
+public:
+	gradient_components( poisson_plugin *ps, bool single_pass )
+	: ps_( ps ), single_pass_( single_pass )
+	{ next_[0] = next_[1] = NULL; }
+	
+	~gradient_components()
+	{ release(); }
+	
+	//! store component icoord of the gradient of u in Du, to be called for icoord=0,1,2 in turn,
+	//! Du has to have the structure of u
+	void get( int icoord, grid_hierarchy& u, grid_hierarchy& Du )
+	{
+		memory_stats::stage mstage("gradient");
+		profile::timer ptimer("gradient");
+		
+		if( !single_pass_ )
+		{
+			ps_->gradient( icoord, u, Du );
+			return;
+		}
+		
+		if( icoord == 0 )
+		{
+			release();
+			next_[0] = new grid_hierarchy( u );
+			next_[1] = new grid_hierarchy( u );
+			
+			grid_hierarchy *D[3] = { &Du, next_[0], next_[1] };
+			ps_->gradient_all( u, D );
+			return;
+		}
+		
+		//... the previous component in Du has been used, it is freed with the cache
+		Du.swap_data( *next_[icoord-1] );
+		if( icoord == 2 )
+			release();
+	}
+};
+
+//! hands out the hybrid Poisson corrections of the finest level, optionally all from one forward FFT
+class hybrid_components
+{
+protected:
+	bool single_fft_;
+	meshvar_bnd *next_[2];
+	
+	void release( void )
+	{
+		delete next_[0];
+		delete next_[1];
+		next_[0] = next_[1] = NULL;
+	}
+	
+public:
+	explicit hybrid_components( bool single_fft )
+	: single_fft_( single_fft )
+	{ next_[0] = next_[1] = NULL; }
+	
+	~hybrid_components()
+	{ release(); }
+	
+	//! store the correction of the density f for direction icoord in Df, to be called for icoord=0,1,2 in turn
+	void get( int icoord, meshvar_bnd& f, meshvar_bnd& Df, int order, bool periodic, bool deconvolve_cic )
+	{
+		if( !single_fft_ )
+		{
+			Df = f;
+			poisson_hybrid( Df, icoord, order, periodic, deconvolve_cic );
+			return;
+		}
+		
+		if( icoord == 0 )
+		{
+			release();
+			Df = f;
+			next_[0] = new meshvar_bnd( f );
+			next_[1] = new meshvar_bnd( f );
+			
+			meshvar_bnd *D[3] = { &Df, next_[0], next_[1] };
+			poisson_hybrid_all( f, D, order, periodic, deconvolve_cic );
+			return;
+		}
+		
+		Df = *next_[icoord-1];
+		if( icoord == 2 )
+			release();
+	}
+};
+
+//! computes the three components of a displacement or velocity field and hands them to the output,
+//! each component as a compute stage followed by a write stage of a task_graph
+class component_stages
+{
+protected:
+	poisson_plugin *ps_;
+	gradient_components& grads_;
+	hybrid_components& hybrid_;
+	output_writer& writer_;
+	bool bdefd_, overlap_;
+	unsigned grad_order_;
+	
+public:
+	typedef std::function<void(int,grid_hierarchy&)> stage_fn;
+	
+	component_stages( poisson_plugin *ps, gradient_components& grads, hybrid_components& hybrid,
+					 output_writer& writer, bool bdefd, unsigned grad_order, bool overlap )
+	: ps_( ps ), grads_( grads ), hybrid_( hybrid ), writer_( writer ), bdefd_( bdefd ), overlap_( overlap ), grad_order_( grad_order )
+	{ }
+	
+	//! store component icoord of the gradient of u in D, with the hybrid correction from the finest level of f
+	void gradient( int icoord, grid_hierarchy& u, grid_hierarchy& f, grid_hierarchy& D, bool decic )
+	{
+		if( bdefd_ )
+		{
+			D.zero();
+			hybrid_.get( icoord, *f.get_grid(f.levelmax()), *D.get_grid(D.levelmax()), grad_order_,
+						D.levelmin()==D.levelmax(), decic );
+			*D.get_grid(D.levelmax()) /= 1<<f.levelmax();
+			ps_->gradient_add( icoord, u, D );
+		}
+		else
+			grads_.get( icoord, u, D );
+	}
+	
+	//! run compute(icoord,D) and write(icoord,D) for icoord=0,1,2, D has to have the structure of the potential
+	/*! the writes are issued in order of the components; with [setup] overlap_output a second buffer
+	 *  lets the next component be computed while the previous one is written; with [setup] stream_levels
+	 *  the component is moved to scratch files while it is written and read back by the plugin level by level,
+	 *  D is left that way, callers only deallocate or overwrite it afterwards
+	 */
+	void run( const std::string& what, grid_hierarchy& D, const stage_fn& compute, const stage_fn& write )
+	{
+		task_graph graph;
+		grid_hierarchy D2( D.m_nbnd );
+		grid_hierarchy *buf[2] = { &D, &D };
+		
+		if( overlap_ )
+		{
+			D2.assign_shape( D );
+			buf[1] = &D2;
+		}
+		
+		int last_write[2] = { -1, -1 }, prev_write = -1;
+		for( int icoord=0; icoord<3; ++icoord )
+		{
+			int ib = overlap_? icoord%2 : 0;
+			grid_hierarchy *pD = buf[ib];
+			std::string comp = what + " " + (char)('x'+icoord);
+			
+			std::vector<int> deps;
+			if( last_write[ib] >= 0 )
+				deps.push_back( last_write[ib] );
+			int c = graph.add( comp, task_graph::compute, [&compute,icoord,pD]{ pD->discard_stream(); compute( icoord, *pD ); }, deps );
+			
+			std::vector<int> wdeps( 1, c );
+			if( prev_write >= 0 )
+				wdeps.push_back( prev_write );
+			prev_write = last_write[ib] = graph.add( "writing " + comp, task_graph::io, [&write,icoord,pD]{ pD->stream(); write( icoord, *pD ); }, wdeps );
+		}
+		
+		//... the plugin is called from the stages, so earlier background writes have to be done
+		writer_.wait();
+		graph.run( overlap_ );
+	}
+};
+
+/*****************************************************************************************************/
+/*****************************************************************************************************/
+/*****************************************************************************************************/
+
+/*!
+ * @class realization_batch
+ * @brief the realizations of a batch run, given by [random] batch_seeds
+ *
+ * batch_seeds is a comma separated list of seeds and seed ranges (e.g. '100-119').
+ * Realization i replaces the seed of the coarsest level that has one by seed(i)
+ * and shifts the seeds of all finer levels by the same amount. Output file name
+ * and checkpoint directory are templated: '{seed}' and '{index}' are replaced
+ * by the seed and the number of the realization, without either '_<seed>' is
+ * added before the file extension.
+ */
+class realization_batch
+{
+protected:
+	config_file& cf_;
+	std::vector<long> seeds_;
+	std::map<int,long> level_seeds_;
+	std::string outfname_, ckptdir_;
+	
+	static std::string expand( const std::string& name, long seed, size_t index )
+	{
+		char sstr[32], istr[32];
+		sprintf( sstr, "%ld", seed );
+		sprintf( istr, "%03d", (int)index );
+		
+		std::string s( name );
+		bool templated = false;
+		size_t pos;
+		while( (pos = s.find("{seed}")) != std::string::npos )
+		{	s.replace( pos, 6, sstr ); templated = true;	}
+		while( (pos = s.find("{index}")) != std::string::npos )
+		{	s.replace( pos, 7, istr ); templated = true;	}
+		
+		if( !templated )
+		{
+			size_t pdot = s.find_last_of( '.' ), pslash = s.find_last_of( '/' );
+			if( pdot == std::string::npos || (pslash != std::string::npos && pdot < pslash) || pdot == 0 )
+				pdot = s.size();
+			s.insert( pdot, std::string("_") + sstr );
+		}
+		return s;
+	}
+	
+public:
+	explicit realization_batch( config_file& cf )
+	: cf_( cf )
+	{
+		std::string list = cf.getValueSafe<std::string>( "random", "batch_seeds", "" );
+		std::stringstream ss( list );
+		std::string tok;
+		while( std::getline( ss, tok, ',' ) )
+		{
+			long a = 0, b = 0;
+			char c;
+			std::stringstream ts( tok );
+			if( !(ts >> a) )
+				continue;
+			b = a;
+			if( ts >> c && (c != '-' || !(ts >> b)) )
+				b = -1;
+			if( a <= 0 || b < a )
+			{
+				LOGERR("Invalid entry \'%s\' in [random] batch_seeds.", tok.c_str());
+				throw std::runtime_error("Invalid batch seed list");
+			}
+			for( long s = a; s <= b; ++s )
+				seeds_.push_back( s );
+		}
+		
+		if( seeds_.empty() )
+			return;
+		
+		for( int i = 0; i <= 100; ++i )
+		{
+			char seedstr[128];
+			sprintf( seedstr, "seed[%d]", i );
+			if( !cf.containsKey( "random", seedstr ) )
+				continue;
+			
+			//... levels with white noise files are left alone
+			std::stringstream vs( cf.getValue<std::string>( "random", seedstr ) );
+			long ltemp;
+			if( vs >> ltemp && (vs >> std::ws).eof() && ltemp > 0 )
+				level_seeds_[i] = ltemp;
+		}
+		
+		if( level_seeds_.empty() )
+		{
+			LOGERR("A batch run needs a numerical [random] seed for at least one level.");
+			throw std::runtime_error("No seed to vary in batch run");
+		}
+		
+		outfname_ = cf.getValue<std::string>( "output", "filename" );
+		ckptdir_ = cf.getValueSafe<std::string>( "setup", "checkpoint_dir", "" );
+		
+		LOGUSER("Running a batch of %d realizations.", (int)seeds_.size());
+	}
+	
+	bool enabled( void ) const
+	{	return !seeds_.empty();	}
+	
+	//! number of realizations, one if not in batch mode
+	size_t size( void ) const
+	{	return seeds_.empty()? 1 : seeds_.size();	}
+	
+	long seed( size_t i ) const
+	{	return seeds_[i];	}
+	
+	//! set seeds, output file name and checkpoint directory of realization i
+	void apply( size_t i )
+	{
+		long shift = seeds_[i] - level_seeds_.begin()->second;
+		for( std::map<int,long>::const_iterator it = level_seeds_.begin(); it != level_seeds_.end(); ++it )
+		{
+			char seedstr[128], valstr[128];
+			sprintf( seedstr, "seed[%d]", it->first );
+			sprintf( valstr, "%ld", std::max( it->second + shift, 1l ) );
+			cf_.insertValue( "random", seedstr, valstr );
+		}
+		
+		cf_.insertValue( "output", "filename", expand( outfname_, seeds_[i], i ) );
+		if( !ckptdir_.empty() )
+			cf_.insertValue( "setup", "checkpoint_dir", expand( ckptdir_, seeds_[i], i ) );
+		
+		LOGUSER("Starting realization %d of %d with seed %ld.", (int)i+1, (int)seeds_.size(), seeds_[i]);
+	}
+};
+
 /*****************************************************************************************************/
 /*****************************************************************************************************/
 /*****************************************************************************************************/
@@ -309,42 +749,104 @@ double compute_finest_max( grid_hierarchy& u )
 region_generator_plugin *the_region_generator;
 RNG_plugin *the_random_number_generator;
 
-int main (int argc, const char * argv[]) 
+//! release the plug-ins and caches of a run, report its memory and profile and close the log
+static void finish_run( config_file& cf, const std::string& paramfile, bool bprofile,
+					   transfer_function_plugin *the_transfer_function_plugin, poisson_plugin *the_poisson_solver )
 {
-	const unsigned nbnd = 4;
-	
-	unsigned lbase, lmax, lbaseTF;
-	double   err = 1.0;
+	delete the_transfer_function_plugin;
+	delete the_poisson_solver;
+	delete the_region_generator;
+	delete the_random_number_generator;
+	the_region_generator = NULL;
+	the_random_number_generator = NULL;
+
+	fft_plans::finalize();
+	mesh_pool::finalize();
 	
-	//------------------------------------------------------------------------------
-	//... parse command line options
-	//------------------------------------------------------------------------------
+	if( memory_stats::process_peak_max() > 0 )
+		LOGUSER("Peak memory: %.1f MB of grid data, %.1f MB resident.", 
+				memory_stats::to_mb(memory_stats::peak()), memory_stats::to_mb(memory_stats::process_peak_max()));
+	else
+		LOGUSER("Peak memory: %.1f MB of grid data.", memory_stats::to_mb(memory_stats::peak()));
+
+	if( memory_stats::device_peak() > 0 )
+		LOGUSER("Peak device memory: %.1f MB.", memory_stats::to_mb(memory_stats::device_peak()));
 	
-	splash();
-	if( argc != 2 ){
-		std::cout << " This version is compiled with the following plug-ins:\n";
+	if( bprofile )
+	{
+		char proffname[128];
+		if( fft_mpi::rank() > 0 )
+			snprintf(proffname,sizeof(proffname),"%s_profile.%d.json",paramfile.c_str(),fft_mpi::rank());
+		else
+			snprintf(proffname,sizeof(proffname),"%s_profile.json",paramfile.c_str());
 		
-		print_region_generator_plugins();
-		print_transfer_function_plugins();
-		print_RNG_plugins();
-		print_output_plugins();
+		profile::count( "memory/peak_grid_bytes", (double)memory_stats::peak() );
+		if( memory_stats::process_peak_max() > 0 )
+			profile::count( "memory/peak_resident_bytes", (double)memory_stats::process_peak_max() );
 		
-		std::cerr << "\n In order to run, you need to specify a parameter file!\n\n";
-		exit(0);
+		if( profile::write( proffname ) )
+			LOGINFO("Wrote run-time profile to '%s'.",proffname);
+		else
+			LOGWARN("Could not write run-time profile '%s'.",proffname);
 	}
+
+	fft_mpi::cleanup();
+
+#if defined(FFTW3) and not defined(SINGLETHREAD_FFTW)
+	#ifdef SINGLE_PRECISION
+	fftwf_cleanup_threads();
+	#else
+	fftw_cleanup_threads();
+	#endif
+#endif
+	
+	
+	//------------------------------------------------------------------------------
+	//... we are done !
+	//------------------------------------------------------------------------------
+	std::cout << " - Done!" << std::endl << std::endl;
+	
+	time_t ltime=time(NULL);
+	
+	LOGUSER("Run finished succesfully on %s",asctime( localtime(&ltime) ));
+	
+	cf.log_dump();
+}
+
+int music::generate( const std::string& paramfile, const output_factory& make_output )
+{
+	const unsigned nbnd = 4;
+	
+	unsigned lbase, lmax, lbaseTF;
+	double   err = 1.0;
 	
 	//------------------------------------------------------------------------------
 	//... open log file
 	//------------------------------------------------------------------------------
 
 	char logfname[128];
-	sprintf(logfname,"%s_log.txt",argv[1]);
+	if( fft_mpi::rank() > 0 )
+		snprintf(logfname,sizeof(logfname),"%s_log.%d.txt",paramfile.c_str(),fft_mpi::rank());
+	else
+		snprintf(logfname,sizeof(logfname),"%s_log.txt",paramfile.c_str());
 	MUSIC::log::setOutput(logfname);
 	time_t ltime=time(NULL);
 	LOGINFO("Opening log file \'%s\'.",logfname);
 	LOGUSER("Running %s, version %s",THE_CODE_NAME,THE_CODE_VERSION);
 	LOGUSER("Log is for run started %s",asctime( localtime(&ltime) ));
 	
+	//... stage timers and counters, written next to the log at the end of the run
+	profile::reset();
+	profile::timer setup_timer("setup");
+	profile::info( "code", THE_CODE_NAME );
+	profile::info( "version", THE_CODE_VERSION );
+	profile::info( "parameter_file", paramfile );
+	{
+		char tmpstr[32];
+		snprintf( tmpstr, sizeof(tmpstr), "%d", omp_get_max_threads() );
+		profile::info( "threads", tmpstr );
+	}
+	
 #ifdef FFTW3
 	LOGUSER("Code was compiled using FFTW version 3.x");
 #else
@@ -368,8 +870,9 @@ int main (int argc, const char * argv[])
 	//------------------------------------------------------------------------------
 	//... read and interpret config file
 	//------------------------------------------------------------------------------
-	config_file cf(argv[1]);
+	config_file cf(paramfile);
 	std::string tfname,randfname,temp;
+	bool bprofile = cf.getValueSafe<bool>("setup","profile",true);
 	bool force_shift(false);
 	double boxlength;
 	
@@ -424,6 +927,26 @@ int main (int argc, const char * argv[])
 	fftw_threads_init();
 #endif
 #endif
+
+	fft_plans::initialize( cf );
+	
+	//... distributed unigrid runs, does nothing on a single rank
+	fft_mpi::setup( cf, nbnd );
+	
+	//... edge length of the cache bricks high order stencils are evaluated in, 0 for plain slab loops
+	mesh_bricks::edge() = cf.getValueSafe<int>( "setup", "stencil_brick", 16 );
+	
+	//... idle mesh blocks kept for reuse, dropped at the end of every driver stage
+	mesh_pool::set_limit( (size_t)(cf.getValueSafe<double>( "setup", "pool_limit_mb", 1024.0 ) * 1048576.0) );
+	memory_stats::set_cleanup( &mesh_pool::purge );
+	
+	//... scratch directory idle hierarchies of the 2LPT branch are spilled to, none by default
+	mesh_spill::directory() = cf.getValueSafe<std::string>( "setup", "spill_dir", "" );
+	
+	//... keep only a few levels of finished fields in memory, the others wait in the scratch directory
+	mesh_spill::stream_levels() = cf.getValueSafe<bool>( "setup", "stream_levels", false );
+	if( mesh_spill::stream_levels() && !mesh_spill::enabled() )
+		LOGWARN("[setup] stream_levels needs a scratch directory in [setup] spill_dir, it is ignored.");
 	
 	//------------------------------------------------------------------------------
 	//... initialize cosmology
@@ -506,22 +1029,16 @@ int main (int argc, const char * argv[])
 	LOGUSER("Grid structure for density convolution:");
 	rh_TF.output_log();
 	
-	//------------------------------------------------------------------------------
-	//... initialize the output plug-in
-	//------------------------------------------------------------------------------
-	std::string outformat, outfname;
-	outformat			= cf.getValue<std::string>( "output", "format" );
-	outfname			= cf.getValue<std::string>( "output", "filename" );
-	output_plugin *the_output_plugin = select_output_plugin( cf );
+	//... predict the memory needs, optionally stop before anything large is allocated
+	print_memory_plan( cf, rh_Poisson, rh_TF, nbnd );
 	
-	//------------------------------------------------------------------------------
-	//... initialize the random numbers
-	//------------------------------------------------------------------------------
-	std::cout << "=============================================================\n";
-	std::cout << "   GENERATING WHITE NOISE\n";
-	std::cout << "-------------------------------------------------------------\n";
-	LOGUSER("Computing white noise...");
-	rand_gen rand( cf, rh_TF, the_transfer_function_plugin );
+	if( cf.getValueSafe<bool>("setup","memory_plan_only",false) )
+	{
+		LOGUSER("Stopping after the memory plan as requested by [setup] memory_plan_only.");
+		std::cout << " - Stopping after the memory plan ([setup] memory_plan_only = yes).\n";
+		finish_run( cf, paramfile, bprofile, the_transfer_function_plugin, NULL );
+		return 0;
+	}
 	
 	//------------------------------------------------------------------------------
 	//... initialize the Poisson solver
@@ -532,7 +1049,8 @@ int main (int argc, const char * argv[])
 	bool bbshift= bsph && !bglass;
 	
 	bool kspace	= cf.getValueSafe<bool>( "poisson", "kspace", false );
-    bool kspace2LPT = kspace;
+	//... the spectral 2LPT source on refined levels is approximate, zooms have to ask for it
+	bool kspace2LPT = cf.getValueSafe<bool>( "poisson", "kspace2LPT", kspace && lbase == lmax );
 
 	bool decic_DM = cf.getValueSafe<bool>( "output", "glass_cicdeconvolve", false );
 	bool decic_baryons = cf.getValueSafe<bool>( "output", "glass_cicdeconvolve", false ) & bsph;
@@ -545,6 +1063,10 @@ int main (int argc, const char * argv[])
 		kspace2LPT=false;
 	}
 	
+	//... the finite difference 2LPT source is not distributed
+	if( fft_mpi::active() )
+		kspace2LPT=true;
+	
 	std::string poisson_solver_name;
 	if( kspace )
 		poisson_solver_name = std::string("fft_poisson");
@@ -562,769 +1084,768 @@ int main (int argc, const char * argv[])
 	poisson_plugin_creator *the_poisson_plugin_creator = get_poisson_plugin_map()[ poisson_solver_name ];
 	poisson_plugin *the_poisson_solver = the_poisson_plugin_creator->create( cf );
 	
-	//---------------------------------------------------------------------------------
-	//... THIS IS THE MAIN DRIVER BRANCHING TREE RUNNING THE VARIOUS PARTS OF THE CODE
-	//---------------------------------------------------------------------------------
+	//... computing all gradient components at once needs two more hierarchies of the potential size
+	bool grad_single_pass = cf.getValueSafe<bool>("poisson","grad_single_pass",false);
+	gradient_components grads( the_poisson_solver, grad_single_pass );
+	
+	//... one forward FFT for the hybrid corrections of all directions, needs a second padded buffer
+	bool hybrid_single_fft = cf.getValueSafe<bool>("poisson","hybrid_single_fft",false);
+	hybrid_components hybrid( hybrid_single_fft );
+	
+	//... write densities and potentials in the background, needs one more hierarchy per pending write
+	//... the output of distributed runs communicates, which only the main thread may do
+	bool async_output = cf.getValueSafe<bool>("setup","async_output",false) && !fft_mpi::active();
+	unsigned async_output_buffers = cf.getValueSafe<unsigned>("setup","async_output_buffers",1);
+	output_writer writer( async_output, async_output_buffers );
+	
+	//... write each component on a separate thread while the next one is computed, needs one more hierarchy
+	bool overlap_output = cf.getValueSafe<bool>("setup","overlap_output",false) && !fft_mpi::active();
+	component_stages components( the_poisson_solver, grads, hybrid, writer, bdefd, grad_order, overlap_output );
+	
+	//------------------------------------------------------------------------------
+	//... loop over the realizations of a batch, everything above is shared by them
+	//------------------------------------------------------------------------------
+	realization_batch batch( cf );
+	if( batch.enabled() )
+		convolution::keep_kernels( true );
+	
+	std::string outformat, outfname;
 	bool bfatal = false;
-	try{
-		if( ! do_2LPT )
+	
+	setup_timer.stop();
+	
+	for( size_t ibatch = 0; ibatch < batch.size() && !bfatal; ++ibatch )
+	{
+		if( batch.enabled() )
 		{
-			LOGUSER("Entering 1LPT branch");
-			
-			//------------------------------------------------------------------------------
-			//... cdm density and displacements
-			//------------------------------------------------------------------------------
 			std::cout << "=============================================================\n";
-			std::cout << "   COMPUTING DARK MATTER DISPLACEMENTS\n";
+			std::cout << "   REALIZATION " << ibatch+1 << " OF " << batch.size() << " (SEED " << batch.seed(ibatch) << ")\n";
 			std::cout << "-------------------------------------------------------------\n";
-			LOGUSER("Computing dark matter displacements...");
+			batch.apply( ibatch );
+		}
+		
+		//------------------------------------------------------------------------------
+		//... initialize the output plug-in
+		//------------------------------------------------------------------------------
+		//... an output plug-in supplied by the caller need not be configured in [output]
+		if( make_output )
+		{
+			outformat		= cf.getValueSafe<std::string>( "output", "format", "custom" );
+			outfname		= cf.getValueSafe<std::string>( "output", "filename", "" );
+		}
+		else
+		{
+			outformat		= cf.getValue<std::string>( "output", "format" );
+			outfname		= cf.getValue<std::string>( "output", "filename" );
+			
+			//... only the Gadget-2 plug-in writes one file per rank
+			if( fft_mpi::active() && outformat != "gadget2" && outformat != "gadget2_double" )
+			{
+				LOGERR("Output format \'%s\' does not support runs on %d MPI ranks.",outformat.c_str(),fft_mpi::size());
+				throw std::runtime_error("MPI runs need the gadget2 output format");
+			}
+		}
+		output_plugin *the_output_plugin = new output_profiler( cf, make_output? make_output( cf ) : select_output_plugin( cf ), outformat );
+	
+		//------------------------------------------------------------------------------
+		//... initialize the random numbers
+		//------------------------------------------------------------------------------
+		std::cout << "=============================================================\n";
+		std::cout << "   GENERATING WHITE NOISE\n";
+		std::cout << "-------------------------------------------------------------\n";
+		LOGUSER("Computing white noise...");
+		memory_stats::stage noise_stage("white noise");
+		profile::timer noise_timer("white noise");
+		rand_gen rand( cf, rh_TF, the_transfer_function_plugin );
+		noise_timer.stop();
+		noise_stage.finish();
+	
+		//... keep generated density fields for later requests of the same type, needs one more hierarchy per field
+		bool reuse_density = cf.getValueSafe<bool>("setup","reuse_density",false);
+		stage_checkpoint ckpt( cf );
+		density_cache densities( cf, the_transfer_function_plugin, rh_TF, rh_Poisson, rand, ckpt, bspectral_sampling, reuse_density );
+	
+		//... Poisson solves are checkpoint stages as well
+		auto solve = [&]( const std::string& name, grid_hierarchy& f, grid_hierarchy& u ){
+			if( ckpt.restore( name, u ) )
+				return 0.0;
+			double e = the_poisson_solver->solve( f, u );
+			ckpt.save( u );
+			return e;
+		};
+	
+		//---------------------------------------------------------------------------------
+		//... THIS IS THE MAIN DRIVER BRANCHING TREE RUNNING THE VARIOUS PARTS OF THE CODE
+		//---------------------------------------------------------------------------------
+		try{
+			if( ! do_2LPT )
+			{
+				LOGUSER("Entering 1LPT branch");
+			
+				//------------------------------------------------------------------------------
+				//... cdm density and displacements
+				//------------------------------------------------------------------------------
+				std::cout << "=============================================================\n";
+				std::cout << "   COMPUTING DARK MATTER DISPLACEMENTS\n";
+				std::cout << "-------------------------------------------------------------\n";
+				LOGUSER("Computing dark matter displacements...");
 			
-			grid_hierarchy f( nbnd );//, u(nbnd);
-			tf_type my_tf_type = cdm;
-			if( !do_baryons || !the_transfer_function_plugin->tf_is_distinct() )
-				my_tf_type = total;
+				grid_hierarchy f( nbnd );//, u(nbnd);
+				tf_type my_tf_type = cdm;
+				if( !do_baryons || !the_transfer_function_plugin->tf_is_distinct() )
+					my_tf_type = total;
 			
 			
-			GenerateDensityHierarchy(	cf, the_transfer_function_plugin, my_tf_type , rh_TF, rand, f, false, false );
-			coarsen_density(rh_Poisson, f, bspectral_sampling);
-            f.add_refinement_mask( rh_Poisson.get_coord_shift() );
-            
-			normalize_density(f);
+				densities.get( my_tf_type, f, false, false );
 			
-			LOGUSER("Writing CDM data");
-			the_output_plugin->write_dm_mass(f);
-			the_output_plugin->write_dm_density(f);
+				writer.write( "CDM data", f, [&]( const grid_hierarchy& g ){ the_output_plugin->write_dm_mass( g ); the_output_plugin->write_dm_density( g ); } );
 			
-			grid_hierarchy u( f );	u.zero();
-			err = the_poisson_solver->solve(f, u);
+				grid_hierarchy u( nbnd );	u.assign_shape( f ); u.zero();
+				err = solve( "potential", f, u );
 			
-			if(!bdefd)
-				f.deallocate();	
+				if(!bdefd)
+					f.deallocate();	
 			
-			LOGUSER("Writing CDM potential");
-			the_output_plugin->write_dm_potential(u);
+				writer.write( "CDM potential", u, [&]( const grid_hierarchy& g ){ the_output_plugin->write_dm_potential( g ); } );
 			
 			
-			//------------------------------------------------------------------------------
-			//... DM displacements
-			//------------------------------------------------------------------------------
-			{
-				grid_hierarchy data_forIO(u);
-				for( int icoord = 0; icoord < 3; ++icoord )
+				//------------------------------------------------------------------------------
+				//... DM displacements
+				//------------------------------------------------------------------------------
 				{
-					if( bdefd )
-					{
-						data_forIO.zero();
-						*data_forIO.get_grid(data_forIO.levelmax()) = *f.get_grid(f.levelmax());
-						poisson_hybrid(*data_forIO.get_grid(data_forIO.levelmax()), icoord, grad_order,
-							       data_forIO.levelmin()==data_forIO.levelmax(), decic_DM );					
-						*data_forIO.get_grid(data_forIO.levelmax()) /= 1<<f.levelmax();
-						the_poisson_solver->gradient_add(icoord, u, data_forIO );
-						
-					}
-					else
-						//... displacement
-					        the_poisson_solver->gradient(icoord, u, data_forIO );
-					double dispmax = compute_finest_max( data_forIO );
-					LOGINFO("max. %c-displacement of HR particles is %f [mean dx]",'x'+icoord, dispmax*(double)(1ll<<data_forIO.levelmax()));
-					coarsen_density( rh_Poisson, data_forIO, false );
-					LOGUSER("Writing CDM displacements");
-					the_output_plugin->write_dm_position(icoord, data_forIO );
+					grid_hierarchy data_forIO(u);
+					components.run( "CDM displacement", data_forIO,
+						[&]( int icoord, grid_hierarchy& D ){
+							//... displacement
+							components.gradient( icoord, u, f, D, decic_DM );
+							double dispmax = compute_finest_max( D );
+							LOGINFO("max. %c-displacement of HR particles is %f [mean dx]",'x'+icoord, dispmax*(double)(1ll<<D.levelmax()));
+							coarsen_density( rh_Poisson, D, false );
+						},
+						[&]( int icoord, grid_hierarchy& D ){
+							LOGUSER("Writing CDM displacements");
+							the_output_plugin->write_dm_position(icoord, D );
+						} );
+					if( do_baryons )
+						u.deallocate();
+					data_forIO.deallocate();
 				}
-				if( do_baryons )
-					u.deallocate();
-				data_forIO.deallocate();
-			}
 			
 			
-			//------------------------------------------------------------------------------
-			//... gas density
-			//------------------------------------------------------------------------------
-			if( do_baryons )
-			{
-				std::cout << "=============================================================\n";
-				std::cout << "   COMPUTING BARYON DENSITY\n";
-				std::cout << "-------------------------------------------------------------\n";
-				LOGUSER("Computing baryon density...");
-				GenerateDensityHierarchy(	cf, the_transfer_function_plugin, baryon , rh_TF, rand, f, false, bbshift );
-				coarsen_density(rh_Poisson, f, bspectral_sampling);
-                f.add_refinement_mask( rh_Poisson.get_coord_shift() );
-				normalize_density(f);
-				
-				if( !do_LLA )
-				{	
-					LOGUSER("Writing baryon density");
-					the_output_plugin->write_gas_density(f);
-				}
-				
-				if( bsph )
+				//------------------------------------------------------------------------------
+				//... gas density
+				//------------------------------------------------------------------------------
+				if( do_baryons )
 				{
-					u = f;	u.zero();
-					err = the_poisson_solver->solve(f, u);					
+					std::cout << "=============================================================\n";
+					std::cout << "   COMPUTING BARYON DENSITY\n";
+					std::cout << "-------------------------------------------------------------\n";
+					LOGUSER("Computing baryon density...");
+					densities.get( baryon, f, false, bbshift );
+				
+					if( !do_LLA )
+					{	
+						writer.write( "baryon density", f, [&]( const grid_hierarchy& g ){ the_output_plugin->write_gas_density( g ); } );
+					}
+				
+					if( bsph )
+					{
+						u.assign_shape( f );	u.zero();
+						err = solve( "potential", f, u );					
 					
-					if(!bdefd)
-						f.deallocate();
+						if(!bdefd)
+							f.deallocate();
 					
-					grid_hierarchy data_forIO(u);
-					for( int icoord = 0; icoord < 3; ++icoord )
-					{
+						grid_hierarchy data_forIO(u);
+						components.run( "baryon displacement", data_forIO,
+							[&]( int icoord, grid_hierarchy& D ){
+								//... displacement
+								components.gradient( icoord, u, f, D, decic_baryons );
+								coarsen_density( rh_Poisson, D, false );
+							},
+							[&]( int icoord, grid_hierarchy& D ){
+								LOGUSER("Writing baryon displacements");
+								the_output_plugin->write_gas_position(icoord, D );
+							} );
+						u.deallocate();
+						data_forIO.deallocate();
 						if( bdefd )
-						{
-							data_forIO.zero();
-							*data_forIO.get_grid(data_forIO.levelmax()) = *f.get_grid(f.levelmax());
-							poisson_hybrid(*data_forIO.get_grid(data_forIO.levelmax()), icoord, grad_order, 
-								       data_forIO.levelmin()==data_forIO.levelmax(), decic_baryons);					
-							*data_forIO.get_grid(data_forIO.levelmax()) /= 1<<f.levelmax();
-							the_poisson_solver->gradient_add(icoord, u, data_forIO );
-							
-						}
-						else
-							//... displacement
-							the_poisson_solver->gradient(icoord, u, data_forIO );
-						
-						coarsen_density( rh_Poisson, data_forIO, false );
-                        LOGUSER("Writing baryon displacements");
-						the_output_plugin->write_gas_position(icoord, data_forIO );
-						
-					}	
-					u.deallocate();
-					data_forIO.deallocate();
-					if( bdefd )
-						f.deallocate();
-				}
-				else if( do_LLA )
-				{
-					u = f;	u.zero();
-					err = the_poisson_solver->solve(f, u);
-					compute_LLA_density( u, f,grad_order );
-					u.deallocate();
-					normalize_density(f);
-					LOGUSER("Writing baryon density");
-					the_output_plugin->write_gas_density(f);
-				}
+							f.deallocate();
+					}
+					else if( do_LLA )
+					{
+						u.assign_shape( f );	u.zero();
+						err = solve( "potential", f, u );
+						compute_LLA_density( u, f,grad_order );
+						u.deallocate();
+						normalize_density(f);
+						writer.write( "baryon density", std::move(f), [&]( const grid_hierarchy& g ){ the_output_plugin->write_gas_density( g ); } );
+					}
 				
-				f.deallocate();
-			}
+					f.deallocate();
+				}
 			
 			
 			
-			//------------------------------------------------------------------------------
-			//... velocities
-			//------------------------------------------------------------------------------
-			if( (!the_transfer_function_plugin->tf_has_velocities() || !do_baryons) && !bsph )
-			{	
-				std::cout << "=============================================================\n";
-				std::cout << "   COMPUTING VELOCITIES\n";
-				std::cout << "-------------------------------------------------------------\n";
-				LOGUSER("Computing velocitites...");
+				//------------------------------------------------------------------------------
+				//... velocities
+				//------------------------------------------------------------------------------
+				if( (!the_transfer_function_plugin->tf_has_velocities() || !do_baryons) && !bsph )
+				{	
+					std::cout << "=============================================================\n";
+					std::cout << "   COMPUTING VELOCITIES\n";
+					std::cout << "-------------------------------------------------------------\n";
+					LOGUSER("Computing velocitites...");
 				
-				if( do_baryons || the_transfer_function_plugin->tf_has_velocities() )
-				{
-				  LOGUSER("Generating velocity perturbations...");
-				  GenerateDensityHierarchy( cf, the_transfer_function_plugin, vtotal , rh_TF, rand, f, false, false );
-				  coarsen_density(rh_Poisson, f, bspectral_sampling);
-				  f.add_refinement_mask( rh_Poisson.get_coord_shift() );
-				  normalize_density(f);					
-				  u = f;
-				  u.zero();
-				  err = the_poisson_solver->solve(f, u);
-				  
-				  if(!bdefd)
-				    f.deallocate();
-				}
-				grid_hierarchy data_forIO(u);
-				for( int icoord = 0; icoord < 3; ++icoord )
-				{
-					//... displacement
-					if(bdefd)
+					if( do_baryons || the_transfer_function_plugin->tf_has_velocities() )
 					{
-						data_forIO.zero();
-						*data_forIO.get_grid(data_forIO.levelmax()) = *f.get_grid(f.levelmax());
-						poisson_hybrid(*data_forIO.get_grid(data_forIO.levelmax()), icoord, grad_order, 
-							       data_forIO.levelmin()==data_forIO.levelmax(), decic_baryons );					
-						*data_forIO.get_grid(data_forIO.levelmax()) /= 1<<f.levelmax();
-						the_poisson_solver->gradient_add(icoord, u, data_forIO );
-					}
-					else 
-						the_poisson_solver->gradient(icoord, u, data_forIO );
-					
-					
-					
-					//... multiply to get velocity
-					data_forIO *= cosmo.vfact;
-					
-					//... velocity kick to keep refined region centered?
-					
-					double sigv = compute_finest_sigma( data_forIO );
-					LOGINFO("sigma of %c-velocity of high-res particles is %f",'x'+icoord, sigv);
-
-					coarsen_density( rh_Poisson, data_forIO, false );
-					LOGUSER("Writing CDM velocities");
-					the_output_plugin->write_dm_velocity(icoord, data_forIO);
-
-					if( do_baryons )
-					{	
-						LOGUSER("Writing baryon velocities");
-						the_output_plugin->write_gas_velocity(icoord, data_forIO);
+					  LOGUSER("Generating velocity perturbations...");
+					  densities.get( vtotal, f, false, false );
+					  u.assign_shape( f );
+					  u.zero();
+					  err = solve( "potential", f, u );
+				  
+					  if(!bdefd)
+					    f.deallocate();
 					}
+					grid_hierarchy data_forIO(u);
+					components.run( "velocity", data_forIO,
+						[&]( int icoord, grid_hierarchy& D ){
+							//... displacement
+							components.gradient( icoord, u, f, D, decic_baryons );
+						
+							//... multiply to get velocity
+							D *= cosmo.vfact;
+						
+							//... velocity kick to keep refined region centered?
+						
+							double sigv = compute_finest_sigma( D );
+							LOGINFO("sigma of %c-velocity of high-res particles is %f",'x'+icoord, sigv);
+						
+							coarsen_density( rh_Poisson, D, false );
+						},
+						[&]( int icoord, grid_hierarchy& D ){
+							LOGUSER("Writing CDM velocities");
+							the_output_plugin->write_dm_velocity(icoord, D);
+						
+							if( do_baryons )
+							{	
+								LOGUSER("Writing baryon velocities");
+								the_output_plugin->write_gas_velocity(icoord, D);
+							}
+						} );
 				
-				}
-				
-				u.deallocate();
-				data_forIO.deallocate();
+					u.deallocate();
+					data_forIO.deallocate();
 				
-			}
-			else
-			{
-				LOGINFO("Computing separate velocities for CDM and baryons:");
-				std::cout << "=============================================================\n";
-				std::cout << "   COMPUTING DARK MATTER VELOCITIES\n";
-				std::cout << "-------------------------------------------------------------\n";
-				LOGUSER("Computing dark matter velocitites...");
+				}
+				else
+				{
+					LOGINFO("Computing separate velocities for CDM and baryons:");
+					std::cout << "=============================================================\n";
+					std::cout << "   COMPUTING DARK MATTER VELOCITIES\n";
+					std::cout << "-------------------------------------------------------------\n";
+					LOGUSER("Computing dark matter velocitites...");
 				
-				//... we do baryons and have velocity transfer functions, or we do SPH and not to shift
-				//... do DM first
-				GenerateDensityHierarchy(	cf, the_transfer_function_plugin, vcdm , rh_TF, rand, f, false, false );
-				coarsen_density(rh_Poisson, f, bspectral_sampling);
-				f.add_refinement_mask( rh_Poisson.get_coord_shift() );
-				normalize_density(f);
+					//... we do baryons and have velocity transfer functions, or we do SPH and not to shift
+					//... do DM first
+					densities.get( vcdm, f, false, false );
 				
-				u = f;	u.zero();
+					u.assign_shape( f );	u.zero();
 				
-				err = the_poisson_solver->solve(f, u);
+					err = solve( "potential", f, u );
 				
-				if(!bdefd)
-				  f.deallocate();
+					if(!bdefd)
+					  f.deallocate();
 								
-				grid_hierarchy data_forIO(u);
-				for( int icoord = 0; icoord < 3; ++icoord )
-				{
-					//... displacement
-					if(bdefd)
-					{
-						data_forIO.zero();
-						*data_forIO.get_grid(data_forIO.levelmax()) = *f.get_grid(f.levelmax());
-						poisson_hybrid(*data_forIO.get_grid(data_forIO.levelmax()), icoord, grad_order, 
-							       data_forIO.levelmin()==data_forIO.levelmax(), decic_DM );					
-						*data_forIO.get_grid(data_forIO.levelmax()) /= 1<<f.levelmax();
-						the_poisson_solver->gradient_add(icoord, u, data_forIO );
-					}
-					else 
-						the_poisson_solver->gradient(icoord, u, data_forIO );
-					
-					//... multiply to get velocity
-					data_forIO *= cosmo.vfact;
+					grid_hierarchy data_forIO(u);
+					components.run( "CDM velocity", data_forIO,
+						[&]( int icoord, grid_hierarchy& D ){
+							//... displacement
+							components.gradient( icoord, u, f, D, decic_DM );
+						
+							//... multiply to get velocity
+							D *= cosmo.vfact;
+						
+							double sigv = compute_finest_sigma( D );
+							LOGINFO("sigma of %c-velocity of high-res DM is %f",'x'+icoord, sigv);
+						
+							coarsen_density( rh_Poisson, D, false );
+						},
+						[&]( int icoord, grid_hierarchy& D ){
+							LOGUSER("Writing CDM velocities");
+							the_output_plugin->write_dm_velocity(icoord, D);
+						} );
+					u.deallocate();
+					data_forIO.deallocate();
+					f.deallocate();
 				
-					double sigv = compute_finest_sigma( data_forIO );
-					LOGINFO("sigma of %c-velocity of high-res DM is %f",'x'+icoord, sigv);
-
-					coarsen_density( rh_Poisson, data_forIO, false );
-					LOGUSER("Writing CDM velocities");
-					the_output_plugin->write_dm_velocity(icoord, data_forIO);
-				}
-				u.deallocate();
-				data_forIO.deallocate();
-				f.deallocate();
 				
+					std::cout << "=============================================================\n";
+					std::cout << "   COMPUTING BARYON VELOCITIES\n";
+					std::cout << "-------------------------------------------------------------\n";
+					LOGUSER("Computing baryon velocitites...");
+					//... do baryons
+					densities.get( vbaryon, f, false, bbshift );
 				
-				std::cout << "=============================================================\n";
-				std::cout << "   COMPUTING BARYON VELOCITIES\n";
-				std::cout << "-------------------------------------------------------------\n";
-				LOGUSER("Computing baryon velocitites...");
-				//... do baryons
-				GenerateDensityHierarchy(	cf, the_transfer_function_plugin, vbaryon , rh_TF, rand, f, false, bbshift );
-				coarsen_density(rh_Poisson, f, bspectral_sampling);
-				f.add_refinement_mask( rh_Poisson.get_coord_shift() );
-                normalize_density(f);
+					u.assign_shape( f );	u.zero();
 				
-				u = f;	u.zero();
+					err = solve( "potential", f, u );
 				
-				err = the_poisson_solver->solve(f, u);
+					if(!bdefd)
+						f.deallocate();
 				
-				if(!bdefd)
+					data_forIO = u;
+					components.run( "baryon velocity", data_forIO,
+						[&]( int icoord, grid_hierarchy& D ){
+							//... displacement
+							components.gradient( icoord, u, f, D, decic_baryons );
+						
+							//... multiply to get velocity
+							D *= cosmo.vfact;
+						
+							double sigv = compute_finest_sigma( D );
+							LOGINFO("sigma of %c-velocity of high-res baryons is %f",'x'+icoord, sigv);
+						
+							coarsen_density( rh_Poisson, D, false );
+						},
+						[&]( int icoord, grid_hierarchy& D ){
+							LOGUSER("Writing baryon velocities");
+							the_output_plugin->write_gas_velocity(icoord, D);
+						} );
+					u.deallocate();
 					f.deallocate();
-				
-				data_forIO = u;
-				for( int icoord = 0; icoord < 3; ++icoord )
-				{
-					//... displacement
-					if(bdefd)
-					{
-						data_forIO.zero();
-						*data_forIO.get_grid(data_forIO.levelmax()) = *f.get_grid(f.levelmax());
-						poisson_hybrid(*data_forIO.get_grid(data_forIO.levelmax()), icoord, grad_order, 
-							       data_forIO.levelmin()==data_forIO.levelmax(), decic_baryons );					
-						*data_forIO.get_grid(data_forIO.levelmax()) /= 1<<f.levelmax();
-						the_poisson_solver->gradient_add(icoord, u, data_forIO );
-					}
-					else 
-						the_poisson_solver->gradient(icoord, u, data_forIO );
-					
-					//... multiply to get velocity
-					data_forIO *= cosmo.vfact;
-										
-					double sigv = compute_finest_sigma( data_forIO );
-					LOGINFO("sigma of %c-velocity of high-res baryons is %f",'x'+icoord, sigv);
-					
-					coarsen_density( rh_Poisson, data_forIO, false );
-					LOGUSER("Writing baryon velocities");
-					the_output_plugin->write_gas_velocity(icoord, data_forIO);
+					data_forIO.deallocate();
 				}
-				u.deallocate();
-				f.deallocate();
-				data_forIO.deallocate();
-			}
-		/*********************************************************************************************/
-		/*********************************************************************************************/
-		/*** 2LPT ************************************************************************************/
-		/*********************************************************************************************/
-		}else {
-			//.. use 2LPT ...
-			LOGUSER("Entering 2LPT branch");
+			/*********************************************************************************************/
+			/*********************************************************************************************/
+			/*** 2LPT ************************************************************************************/
+			/*********************************************************************************************/
+			}else {
+				//.. use 2LPT ...
+				LOGUSER("Entering 2LPT branch");
 			
-			grid_hierarchy f( nbnd ), u1(nbnd), u2LPT(nbnd), f2LPT( nbnd );
+				grid_hierarchy f( nbnd ), u1(nbnd), u2LPT(nbnd), f2LPT( nbnd );
 			
 			
 			
-			tf_type my_tf_type = vcdm;
-			bool dm_only = !do_baryons;
-			if( !do_baryons || !the_transfer_function_plugin->tf_has_velocities() )
-				my_tf_type = total;
+				tf_type my_tf_type = vcdm;
+				bool dm_only = !do_baryons;
+				if( !do_baryons || !the_transfer_function_plugin->tf_has_velocities() )
+					my_tf_type = total;
 			
-			std::cout << "=============================================================\n";
-			if( my_tf_type == total )
-			{
-				std::cout << "   COMPUTING VELOCITIES\n";
-				LOGUSER("Computing velocities...");				
-			}else{
-				std::cout << "   COMPUTING DARK MATTER VELOCITIES\n";
-				LOGUSER("Computing dark matter velocities...");	
-			}
-			std::cout << "-------------------------------------------------------------\n";	
+				std::cout << "=============================================================\n";
+				if( my_tf_type == total )
+				{
+					std::cout << "   COMPUTING VELOCITIES\n";
+					LOGUSER("Computing velocities...");				
+				}else{
+					std::cout << "   COMPUTING DARK MATTER VELOCITIES\n";
+					LOGUSER("Computing dark matter velocities...");	
+				}
+				std::cout << "-------------------------------------------------------------\n";	
 
 			
-			GenerateDensityHierarchy(	cf, the_transfer_function_plugin, my_tf_type , rh_TF, rand, f, false, false );
-			coarsen_density(rh_Poisson, f, bspectral_sampling);
-			f.add_refinement_mask( rh_Poisson.get_coord_shift() );
-            normalize_density(f);
+				densities.get( my_tf_type, f, false, false );
 			
-			if( dm_only )
-			{
-				the_output_plugin->write_dm_density(f);
-				the_output_plugin->write_dm_mass(f);	
-			}
+				if( dm_only )
+				{
+					writer.write( "CDM data", f, [&]( const grid_hierarchy& g ){ the_output_plugin->write_dm_density( g ); the_output_plugin->write_dm_mass( g ); } );
+				}
 			
-			u1 = f;	u1.zero();
+				u1.assign_shape( f );	u1.zero();
 			
-			//... compute 1LPT term
-			err = the_poisson_solver->solve(f, u1);
+				//... compute 1LPT term
+				err = solve( "potential", f, u1 );
 			
 			
-			//... compute 2LPT term
-			if(bdefd)
-				f2LPT=f;
-			else
-				f.deallocate();
+				//... compute 2LPT term
+				if(bdefd)
+				{
+					f2LPT=f;
+					f.spill();	//... idle until the combined source term is formed
+				}
+				else
+					f.deallocate();
 		
-			LOGINFO("Computing 2LPT term....");
-			if( !kspace2LPT )
-				compute_2LPT_source(u1, f2LPT, grad_order );
-			else{
-				LOGUSER("computing term using FFT");
-				compute_2LPT_source_FFT(cf, u1, f2LPT);
-			}
+				LOGINFO("Computing 2LPT term....");
+				if( !kspace2LPT )
+					compute_2LPT_source(u1, f2LPT, grad_order );
+				else{
+					LOGUSER("computing term using FFT");
+					compute_2LPT_source_FFT(cf, u1, f2LPT);
+				}
             
-            LOGINFO("Solving 2LPT Poisson equation");
-			u2LPT = u1; u2LPT.zero();
-			err = the_poisson_solver->solve(f2LPT, u2LPT);
+	            LOGINFO("Solving 2LPT Poisson equation");
+				u2LPT.assign_shape( u1 ); u2LPT.zero();
+				u1.spill();	//... idle during the 2LPT solve
+				err = solve( "2LPT potential", f2LPT, u2LPT );
+				u1.prefetch();
+				f.prefetch();
             
 			
-			//... if doing the hybrid step, we need a combined source term
-			if( bdefd )
-			{
-				f2LPT*=6.0/7.0/vfac2lpt;
-				f+=f2LPT;
-				
-				if( !dm_only )
-					f2LPT.deallocate();
-			}
-			
-			//... add the 2LPT contribution
-			u2LPT *= 6.0/7.0/vfac2lpt;
-			u1 += u2LPT;
-			
-			
-			grid_hierarchy data_forIO(u1);
-			for( int icoord = 0; icoord < 3; ++icoord )
-			{
-				if(bdefd)
+				//... if doing the hybrid step, we need a combined source term
+				if( bdefd )
 				{
-					data_forIO.zero();
-					*data_forIO.get_grid(data_forIO.levelmax()) = *f.get_grid(f.levelmax());
-					poisson_hybrid(*data_forIO.get_grid(data_forIO.levelmax()), icoord, grad_order, 
-						       data_forIO.levelmin()==data_forIO.levelmax(), decic_DM );
-					*data_forIO.get_grid(data_forIO.levelmax()) /= (1<<f.levelmax());
-					the_poisson_solver->gradient_add(icoord, u1, data_forIO );
-				}
-				else 
-					the_poisson_solver->gradient(icoord, u1, data_forIO );
-				
-				data_forIO *= cosmo.vfact;
-				
-				double sigv = compute_finest_sigma( data_forIO );
-				std::cerr << " - velocity component " << icoord << " : sigma = " << sigv << std::endl;
+					f2LPT*=6.0/7.0/vfac2lpt;
+					f+=f2LPT;
 				
-				coarsen_density( rh_Poisson, data_forIO, false );
-				LOGUSER("Writing CDM velocities");
-				the_output_plugin->write_dm_velocity(icoord, data_forIO);					
+					if( !dm_only )
+						f2LPT.deallocate();
 				
-				if( do_baryons && !the_transfer_function_plugin->tf_has_velocities() && !bsph)
-				{	
-					LOGUSER("Writing baryon velocities");
-					the_output_plugin->write_gas_velocity(icoord, data_forIO);				
+					//... only the finest level of f enters the hybrid gradients below
+					for( unsigned ilevel=f.levelmin(); ilevel<f.levelmax(); ++ilevel )
+						f.spill( ilevel );
 				}
-			}
-			data_forIO.deallocate();
-			if( !dm_only )
-				u1.deallocate();
+			
+				//... add the 2LPT contribution
+				u2LPT *= 6.0/7.0/vfac2lpt;
+				u1 += u2LPT;
 			
 			
-			if( do_baryons && (the_transfer_function_plugin->tf_has_velocities() || bsph) )
-			{
-				std::cout << "=============================================================\n";
-				std::cout << "   COMPUTING BARYON VELOCITIES\n";
-				std::cout << "-------------------------------------------------------------\n";
-				LOGUSER("Computing baryon displacements...");
+				grid_hierarchy data_forIO(u1);
+				components.run( "CDM velocity", data_forIO,
+					[&]( int icoord, grid_hierarchy& D ){
+						components.gradient( icoord, u1, f, D, decic_DM );
+					
+						D *= cosmo.vfact;
+					
+						double sigv = compute_finest_sigma( D );
+						std::cerr << " - velocity component " << icoord << " : sigma = " << sigv << std::endl;
+					
+						coarsen_density( rh_Poisson, D, false );
+					},
+					[&]( int icoord, grid_hierarchy& D ){
+						LOGUSER("Writing CDM velocities");
+						the_output_plugin->write_dm_velocity(icoord, D);
+					
+						if( do_baryons && !the_transfer_function_plugin->tf_has_velocities() && !bsph)
+						{	
+							LOGUSER("Writing baryon velocities");
+							the_output_plugin->write_gas_velocity(icoord, D);
+						}
+					} );
+				data_forIO.deallocate();
+				if( !dm_only )
+					u1.deallocate();
+			
+			
+				if( do_baryons && (the_transfer_function_plugin->tf_has_velocities() || bsph) )
+				{
+					std::cout << "=============================================================\n";
+					std::cout << "   COMPUTING BARYON VELOCITIES\n";
+					std::cout << "-------------------------------------------------------------\n";
+					LOGUSER("Computing baryon displacements...");
 				
-				GenerateDensityHierarchy(	cf, the_transfer_function_plugin, vbaryon , rh_TF, rand, f, false, bbshift );
-				coarsen_density(rh_Poisson, f, bspectral_sampling);
-				f.add_refinement_mask( rh_Poisson.get_coord_shift() );
-                normalize_density(f);
+					densities.get( vbaryon, f, false, bbshift );
 				
-				u1 = f;	u1.zero();
+					u1.assign_shape( f );	u1.zero();
 				
-				if(bdefd)
-					f2LPT=f;
+					if(bdefd)
+						f2LPT=f;
 				
-				//... compute 1LPT term
-				err = the_poisson_solver->solve(f, u1);
+					//... compute 1LPT term
+					err = solve( "potential", f, u1 );
 
-				LOGINFO("Writing baryon potential");
-				the_output_plugin->write_gas_potential(u1);
-				
-				//... compute 2LPT term
-				u2LPT = f; u2LPT.zero();
-				
-				if( !kspace2LPT )
-					compute_2LPT_source(u1, f2LPT, grad_order );
-				else
-					compute_2LPT_source_FFT(cf, u1, f2LPT);
+					writer.write( "baryon potential", u1, [&]( const grid_hierarchy& g ){ the_output_plugin->write_gas_potential( g ); } );
 				
+					//... compute 2LPT term
+					u2LPT.assign_shape( f ); u2LPT.zero();
+					if( bdefd )
+						f.spill();
 				
-				err = the_poisson_solver->solve(f2LPT, u2LPT);
+					if( !kspace2LPT )
+						compute_2LPT_source(u1, f2LPT, grad_order );
+					else
+						compute_2LPT_source_FFT(cf, u1, f2LPT);
 				
-				//... if doing the hybrid step, we need a combined source term
-				if( bdefd )
-				{
-					f2LPT*=6.0/7.0/vfac2lpt;
-					f+=f2LPT;
-					
-					f2LPT.deallocate();
-				}
 				
-				//... add the 2LPT contribution
-				u2LPT *= 6.0/7.0/vfac2lpt;
-				u1 += u2LPT;
-				u2LPT.deallocate();
+					u1.spill();
+					err = solve( "2LPT potential", f2LPT, u2LPT );
+					u1.prefetch();
+					f.prefetch();
 				
-				//grid_hierarchy data_forIO(u1);
-				data_forIO = u1;
-				for( int icoord = 0; icoord < 3; ++icoord )
-				{
-					if(bdefd)
+					//... if doing the hybrid step, we need a combined source term
+					if( bdefd )
 					{
-						data_forIO.zero();
-						*data_forIO.get_grid(data_forIO.levelmax()) = *f.get_grid(f.levelmax());
-						poisson_hybrid(*data_forIO.get_grid(data_forIO.levelmax()), icoord, grad_order, 
-							       data_forIO.levelmin()==data_forIO.levelmax(), decic_baryons );					
-						*data_forIO.get_grid(data_forIO.levelmax()) /= (1<<f.levelmax());
-						the_poisson_solver->gradient_add(icoord, u1, data_forIO );
-					}
-					else 
-						the_poisson_solver->gradient(icoord, u1, data_forIO );
+						f2LPT*=6.0/7.0/vfac2lpt;
+						f+=f2LPT;
 					
-					data_forIO *= cosmo.vfact;
-										
-					double sigv = compute_finest_sigma( data_forIO );
-					std::cerr << " - velocity component " << icoord << " : sigma = " << sigv << std::endl;
+						f2LPT.deallocate();
 					
-					coarsen_density( rh_Poisson, data_forIO, false );
-					LOGUSER("Writing baryon velocities");
-					the_output_plugin->write_gas_velocity(icoord, data_forIO);				
+						for( unsigned ilevel=f.levelmin(); ilevel<f.levelmax(); ++ilevel )
+							f.spill( ilevel );
+					}
+				
+					//... add the 2LPT contribution
+					u2LPT *= 6.0/7.0/vfac2lpt;
+					u1 += u2LPT;
+					u2LPT.deallocate();
+				
+					//grid_hierarchy data_forIO(u1);
+					data_forIO = u1;
+					components.run( "baryon velocity", data_forIO,
+						[&]( int icoord, grid_hierarchy& D ){
+							components.gradient( icoord, u1, f, D, decic_baryons );
+						
+							D *= cosmo.vfact;
+						
+							double sigv = compute_finest_sigma( D );
+							std::cerr << " - velocity component " << icoord << " : sigma = " << sigv << std::endl;
+						
+							coarsen_density( rh_Poisson, D, false );
+						},
+						[&]( int icoord, grid_hierarchy& D ){
+							LOGUSER("Writing baryon velocities");
+							the_output_plugin->write_gas_velocity(icoord, D);
+						} );
+					data_forIO.deallocate();
+					u1.deallocate();
 				}
-				data_forIO.deallocate();
-				u1.deallocate();
-			}
 			
 			
-			std::cout << "=============================================================\n";
-			std::cout << "   COMPUTING DARK MATTER DISPLACEMENTS\n";
-			std::cout << "-------------------------------------------------------------\n";
-			LOGUSER("Computing dark matter displacements...");
+				std::cout << "=============================================================\n";
+				std::cout << "   COMPUTING DARK MATTER DISPLACEMENTS\n";
+				std::cout << "-------------------------------------------------------------\n";
+				LOGUSER("Computing dark matter displacements...");
 			
-			//... if baryons are enabled, the displacements have to be recomputed
-			//... otherwise we can compute them directly from the velocities
-			if( !dm_only )
-			{
-				// my_tf_type is cdm if do_baryons==true, total otherwise
-				my_tf_type = cdm;
-				if( !do_baryons || !the_transfer_function_plugin->tf_is_distinct() )
-					my_tf_type = total;
+				//... if baryons are enabled, the displacements have to be recomputed
+				//... otherwise we can compute them directly from the velocities
+				if( !dm_only )
+				{
+					// my_tf_type is cdm if do_baryons==true, total otherwise
+					my_tf_type = cdm;
+					if( !do_baryons || !the_transfer_function_plugin->tf_is_distinct() )
+						my_tf_type = total;
 				
-				GenerateDensityHierarchy(	cf, the_transfer_function_plugin, my_tf_type , rh_TF, rand, f, false, false );
-				coarsen_density(rh_Poisson, f, bspectral_sampling);
-				f.add_refinement_mask( rh_Poisson.get_coord_shift() );
-                normalize_density(f);
+					densities.get( my_tf_type, f, false, false );
 				
-				LOGUSER("Writing CDM data");
-				the_output_plugin->write_dm_density(f);
-				the_output_plugin->write_dm_mass(f);
-				u1 = f;	u1.zero();
+					writer.write( "CDM data", f, [&]( const grid_hierarchy& g ){ the_output_plugin->write_dm_density( g ); the_output_plugin->write_dm_mass( g ); } );
+					u1.assign_shape( f );	u1.zero();
 				
-				if(bdefd)
-					f2LPT=f;
+					if(bdefd)
+						f2LPT=f;
 				
-				//... compute 1LPT term
-				err = the_poisson_solver->solve(f, u1);
+					//... compute 1LPT term
+					err = solve( "potential", f, u1 );
 				
-				//... compute 2LPT term
-				u2LPT = f; u2LPT.zero();
+					//... compute 2LPT term
+					u2LPT.assign_shape( f ); u2LPT.zero();
 				
-				if( !kspace2LPT )
-					compute_2LPT_source(u1, f2LPT, grad_order );
-				else
-					compute_2LPT_source_FFT(cf, u1, f2LPT);
+					if( !kspace2LPT )
+						compute_2LPT_source(u1, f2LPT, grad_order );
+					else
+						compute_2LPT_source_FFT(cf, u1, f2LPT);
 				
-				err = the_poisson_solver->solve(f2LPT, u2LPT);
+					err = solve( "2LPT potential", f2LPT, u2LPT );
 				
-				if( bdefd )
-				{
-					f2LPT*=3.0/7.0;
-					f+=f2LPT;
-					f2LPT.deallocate();
-				}
+					if( bdefd )
+					{
+						f2LPT*=3.0/7.0;
+						f+=f2LPT;
+						f2LPT.deallocate();
+					}
 				
-				u2LPT *= 3.0/7.0;
-				u1 += u2LPT;
-				u2LPT.deallocate();
-			}else{
-				//... reuse prior data
-				/*f-=f2LPT;
-				the_output_plugin->write_dm_density(f);
-				the_output_plugin->write_dm_mass(f);
-				f+=f2LPT;*/
+					u2LPT *= 3.0/7.0;
+					u1 += u2LPT;
+					u2LPT.deallocate();
+				}else{
+					//... reuse prior data
+					/*f-=f2LPT;
+					the_output_plugin->write_dm_density(f);
+					the_output_plugin->write_dm_mass(f);
+					f+=f2LPT;*/
 				
-				u2LPT *= 0.5;
-				u1 -= u2LPT;
-				u2LPT.deallocate();
+					u2LPT *= 0.5;
+					u1 -= u2LPT;
+					u2LPT.deallocate();
 				
-				if(bdefd)
-				{
-					f2LPT *= 0.5;
-					f-=f2LPT;
-					f2LPT.deallocate();
+					if(bdefd)
+					{
+						f2LPT *= 0.5;
+						f-=f2LPT;
+						f2LPT.deallocate();
+					}
 				}
-			}
 						
-			data_forIO = u1;
+				data_forIO = u1;
 			
-			for( int icoord = 0; icoord < 3; ++icoord )
-			{
-				//... displacement
-				if(bdefd)
-				{
-					data_forIO.zero();
-					*data_forIO.get_grid(data_forIO.levelmax()) = *f.get_grid(f.levelmax());
-					poisson_hybrid(*data_forIO.get_grid(data_forIO.levelmax()), icoord, grad_order, 
-						       data_forIO.levelmin()==data_forIO.levelmax(), decic_DM );
-					*data_forIO.get_grid(data_forIO.levelmax()) /= 1<<f.levelmax();
-					the_poisson_solver->gradient_add(icoord, u1, data_forIO );
-				}
-				else 
-					the_poisson_solver->gradient(icoord, u1, data_forIO );
-				
-				double dispmax = compute_finest_max( data_forIO );
-				LOGINFO("max. %c-displacement of HR particles is %f [mean dx]",'x'+icoord, dispmax*(double)(1ll<<data_forIO.levelmax()));
-
-				coarsen_density( rh_Poisson, data_forIO, false );
-				LOGUSER("Writing CDM displacements");
-				the_output_plugin->write_dm_position(icoord, data_forIO );	
-			}
+				components.run( "CDM displacement", data_forIO,
+					[&]( int icoord, grid_hierarchy& D ){
+						//... displacement
+						components.gradient( icoord, u1, f, D, decic_DM );
+					
+						double dispmax = compute_finest_max( D );
+						LOGINFO("max. %c-displacement of HR particles is %f [mean dx]",'x'+icoord, dispmax*(double)(1ll<<D.levelmax()));
+					
+						coarsen_density( rh_Poisson, D, false );
+					},
+					[&]( int icoord, grid_hierarchy& D ){
+						LOGUSER("Writing CDM displacements");
+						the_output_plugin->write_dm_position(icoord, D );	
+					} );
 			
-			data_forIO.deallocate();
-			u1.deallocate();
+				data_forIO.deallocate();
+				u1.deallocate();
 			
 
-			if( do_baryons && !bsph )
-			{	
-				std::cout << "=============================================================\n";
-				std::cout << "   COMPUTING BARYON DENSITY\n";
-				std::cout << "-------------------------------------------------------------\n";
-				LOGUSER("Computing baryon density...");
+				if( do_baryons && !bsph )
+				{	
+					std::cout << "=============================================================\n";
+					std::cout << "   COMPUTING BARYON DENSITY\n";
+					std::cout << "-------------------------------------------------------------\n";
+					LOGUSER("Computing baryon density...");
 				
-				GenerateDensityHierarchy(	cf, the_transfer_function_plugin, baryon , rh_TF, rand, f, true, false );
-				coarsen_density(rh_Poisson, f, bspectral_sampling);
-				f.add_refinement_mask( rh_Poisson.get_coord_shift() );
-                normalize_density(f);
+					densities.get( baryon, f, true, false );
 				
-				if( !do_LLA )
-					the_output_plugin->write_gas_density(f);
-				else 
-				{	
-					u1 = f;	u1.zero();
+					if( !do_LLA )
+						writer.write( "baryon density", f, [&]( const grid_hierarchy& g ){ the_output_plugin->write_gas_density( g ); } );
+					else 
+					{	
+						u1.assign_shape( f );	u1.zero();
 					
-					//... compute 1LPT term
-					err = the_poisson_solver->solve(f, u1);
+						//... compute 1LPT term
+						err = solve( "potential", f, u1 );
 					
-					//... compute 2LPT term
-					u2LPT = f; u2LPT.zero();
+						//... compute 2LPT term
+						u2LPT.assign_shape( f ); u2LPT.zero();
 					
-					if( !kspace2LPT )
-						compute_2LPT_source(u1, f2LPT, grad_order );
-					else
-						compute_2LPT_source_FFT(cf, u1, f2LPT);
+						if( !kspace2LPT )
+							compute_2LPT_source(u1, f2LPT, grad_order );
+						else
+							compute_2LPT_source_FFT(cf, u1, f2LPT);
 					
-					err = the_poisson_solver->solve(f2LPT, u2LPT);
-					u2LPT *= 3.0/7.0;
-					u1 += u2LPT;
-					u2LPT.deallocate();
+						err = solve( "2LPT potential", f2LPT, u2LPT );
+						u2LPT *= 3.0/7.0;
+						u1 += u2LPT;
+						u2LPT.deallocate();
 					
-					compute_LLA_density( u1, f, grad_order );
-                    normalize_density(f);
+						compute_LLA_density( u1, f, grad_order );
+	                    normalize_density(f);
 					
-					LOGUSER("Writing baryon density");
-					the_output_plugin->write_gas_density(f);
+						writer.write( "baryon density", f, [&]( const grid_hierarchy& g ){ the_output_plugin->write_gas_density( g ); } );
+					}
 				}
-			}
-			else if( do_baryons && bsph )
-			{
-				std::cout << "=============================================================\n";
-				std::cout << "   COMPUTING BARYON DISPLACEMENTS\n";
-				std::cout << "-------------------------------------------------------------\n";
-				LOGUSER("Computing baryon displacements...");
+				else if( do_baryons && bsph )
+				{
+					std::cout << "=============================================================\n";
+					std::cout << "   COMPUTING BARYON DISPLACEMENTS\n";
+					std::cout << "-------------------------------------------------------------\n";
+					LOGUSER("Computing baryon displacements...");
 				
-				GenerateDensityHierarchy(	cf, the_transfer_function_plugin, baryon , rh_TF, rand, f, false, bbshift );
-				coarsen_density(rh_Poisson, f, bspectral_sampling);
-				f.add_refinement_mask( rh_Poisson.get_coord_shift() );
-                normalize_density(f);
+					densities.get( baryon, f, false, bbshift );
 				
-				LOGUSER("Writing baryon density");
-				the_output_plugin->write_gas_density(f);
-				u1 = f;	u1.zero();
+					writer.write( "baryon density", f, [&]( const grid_hierarchy& g ){ the_output_plugin->write_gas_density( g ); } );
+					u1.assign_shape( f );	u1.zero();
 				
-				if(bdefd)
-					f2LPT=f;
+					if(bdefd)
+						f2LPT=f;
 				
-				//... compute 1LPT term
-				err = the_poisson_solver->solve(f, u1);
+					//... compute 1LPT term
+					err = solve( "potential", f, u1 );
 				
-				//... compute 2LPT term
-				u2LPT = f; u2LPT.zero();
+					//... compute 2LPT term
+					u2LPT.assign_shape( f ); u2LPT.zero();
 				
-				if( !kspace2LPT )
-					compute_2LPT_source(u1, f2LPT, grad_order );
-				else
-					compute_2LPT_source_FFT(cf, u1, f2LPT);
+					if( !kspace2LPT )
+						compute_2LPT_source(u1, f2LPT, grad_order );
+					else
+						compute_2LPT_source_FFT(cf, u1, f2LPT);
 				
-				err = the_poisson_solver->solve(f2LPT, u2LPT);
+					err = solve( "2LPT potential", f2LPT, u2LPT );
 				
-				if( bdefd )
-				{
-					f2LPT*=3.0/7.0;
-					f+=f2LPT;
-					f2LPT.deallocate();
-				}
+					if( bdefd )
+					{
+						f2LPT*=3.0/7.0;
+						f+=f2LPT;
+						f2LPT.deallocate();
+					}
 				
-				u2LPT *= 3.0/7.0;
-				u1 += u2LPT;
-				u2LPT.deallocate();
+					u2LPT *= 3.0/7.0;
+					u1 += u2LPT;
+					u2LPT.deallocate();
 				
-				data_forIO = u1;
+					data_forIO = u1;
 				
-				for( int icoord = 0; icoord < 3; ++icoord )
-				{
-					//... displacement
-					if(bdefd)
-					{
-						data_forIO.zero();
-						*data_forIO.get_grid(data_forIO.levelmax()) = *f.get_grid(f.levelmax());
-						poisson_hybrid(*data_forIO.get_grid(data_forIO.levelmax()), icoord, grad_order, 
-							       data_forIO.levelmin()==data_forIO.levelmax(), decic_baryons );
-						*data_forIO.get_grid(data_forIO.levelmax()) /= 1<<f.levelmax();
-						the_poisson_solver->gradient_add(icoord, u1, data_forIO );
-					}
-					else 
-						the_poisson_solver->gradient(icoord, u1, data_forIO );
-					
-					coarsen_density( rh_Poisson, data_forIO, false );
-					LOGUSER("Writing baryon displacements");
-					the_output_plugin->write_gas_position(icoord, data_forIO );	
+					components.run( "baryon displacement", data_forIO,
+						[&]( int icoord, grid_hierarchy& D ){
+							//... displacement
+							components.gradient( icoord, u1, f, D, decic_baryons );
+							coarsen_density( rh_Poisson, D, false );
+						},
+						[&]( int icoord, grid_hierarchy& D ){
+							LOGUSER("Writing baryon displacements");
+							the_output_plugin->write_gas_position(icoord, D );	
+						} );
 				}
-			}
 
-		}
+			}
 		
-		//------------------------------------------------------------------------------
-		//... finish output
-		//------------------------------------------------------------------------------
+			//------------------------------------------------------------------------------
+			//... finish output
+			//------------------------------------------------------------------------------
 		
-		the_output_plugin->finalize();
-		delete the_output_plugin;
+			writer.wait();
+			the_output_plugin->finalize();
+			delete the_output_plugin;
 		
-	}catch(std::runtime_error& excp){
-		LOGERR("Fatal error occured. Code will exit:");
-		LOGERR("Exception: %s",excp.what());
-		std::cerr << " - " << excp.what() << std::endl;
-		std::cerr << " - A fatal error occured. We need to exit...\n";
-		bfatal = true;
-	}
+		}catch(std::runtime_error& excp){
+			LOGERR("Fatal error occured. Code will exit:");
+			LOGERR("Exception: %s",excp.what());
+			std::cerr << " - " << excp.what() << std::endl;
+			std::cerr << " - A fatal error occured. We need to exit...\n";
+			bfatal = true;
+			
+			//... queued writes refer to this realization's plugin
+			try{ writer.wait(); }catch(std::runtime_error&){ }
+		}
 
-	std::cout << "=============================================================\n";
+		std::cout << "=============================================================\n";
 	
 	
 
-	if( !bfatal )
-	{	
-		std::cout << " - Wrote output file \'" << outfname << "\'\n     using plugin \'" << outformat << "\'...\n";
-		LOGUSER("Wrote output file \'%s\'.",outfname.c_str());
+		if( !bfatal )
+		{	
+			std::cout << " - Wrote output file \'" << outfname << "\'\n     using plugin \'" << outformat << "\'...\n";
+			LOGUSER("Wrote output file \'%s\'.",outfname.c_str());
+		}
 	}
 	
+	if( batch.enabled() )
+		convolution::keep_kernels( false );
+	
 	//------------------------------------------------------------------------------
 	//... clean up
 	//------------------------------------------------------------------------------
-	delete the_transfer_function_plugin;
-	delete the_poisson_solver;
-
-#if defined(FFTW3) and not defined(SINGLETHREAD_FFTW)
-	#ifdef SINGLE_PRECISION
-	fftwf_cleanup_threads();
-	#else
-	fftw_cleanup_threads();
-	#endif
-#endif
-	
+	finish_run( cf, paramfile, bprofile, the_transfer_function_plugin, the_poisson_solver );
 	
+	return bfatal? 1 : 0;
+}
+
+#ifndef MUSIC_LIBRARY
+int main (int argc, const char * argv[]) 
+{
 	//------------------------------------------------------------------------------
-	//... we are done !
+	//... parse command line options
 	//------------------------------------------------------------------------------
-	std::cout << " - Done!" << std::endl << std::endl;
 	
-	ltime=time(NULL);
-	
-	LOGUSER("Run finished succesfully on %s",asctime( localtime(&ltime) ));
-	
-	cf.log_dump();
+	splash();
+	if( argc != 2 ){
+		std::cout << " This version is compiled with the following plug-ins:\n";
+		
+		print_region_generator_plugins();
+		print_transfer_function_plugins();
+		print_RNG_plugins();
+		print_output_plugins();
+		
+		std::cerr << "\n In order to run, you need to specify a parameter file!\n\n";
+		exit(0);
+	}
 	
+	fft_mpi::initialize();
+	int ret = music::generate( argv[1] );
+	fft_mpi::finalize();
 	
-	return 0;
+	return ret;
 }
+#endif
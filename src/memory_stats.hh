@@ -0,0 +1,208 @@
+/*
+
+ memory_stats.hh - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#ifndef __MEMORY_STATS_HH
+#define __MEMORY_STATS_HH
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "log.hh"
+#include "profile.hh"
+
+/*!
+ * @brief accounting of the memory held by mesh and density grid data
+ *
+ * Meshvar (through mesh_pool) and DensityGrid report their allocations here,
+ * the cuFFT backend reports its device buffers and work areas separately.
+ * The driver stages are marked with memory_stats::stage objects, each of which
+ * logs the high-water mark of the tracked data and the peak resident size of
+ * the process (VmHWM, reset at the start of every outermost stage where the
+ * kernel allows it) when it ends. At the end of every outermost stage the cleanup
+ * hook is called, which the driver points at mesh_pool::purge.
+ */
+namespace memory_stats
+{
+	struct stats_state
+	{
+		long long live, peak;
+		long long device_live, device_peak;
+		std::vector< long long > saved_peaks;
+		bool process_reset;
+		long long process_peak_max;
+		void (*cleanup)( void );
+	};
+
+	inline stats_state& state( void )
+	{
+		static stats_state s = { 0, 0, 0, 0, std::vector< long long >(), false, 0, NULL };
+		return s;
+	}
+
+	//! account for nbytes more (or, if negative, less) grid data
+	inline void add( long long nbytes )
+	{
+		#pragma omp critical(memory_stats)
+		{
+			stats_state& s = state();
+			s.live += nbytes;
+			if( s.live > s.peak )
+				s.peak = s.live;
+		}
+		
+		if( nbytes > 0 )
+			profile::count( "memory/grid_bytes_allocated", (double)nbytes );
+	}
+
+	//! function called at the end of every stage to drop cached memory
+	inline void set_cleanup( void (*fn)( void ) )
+	{	state().cleanup = fn;	}
+
+	//! account for nbytes more (or, if negative, less) device memory
+	inline void add_device( long long nbytes )
+	{
+		#pragma omp critical(memory_stats)
+		{
+			stats_state& s = state();
+			s.device_live += nbytes;
+			if( s.device_live > s.device_peak )
+				s.device_peak = s.device_live;
+		}
+	}
+
+	//! high-water mark of the device memory over the whole run
+	inline long long device_peak( void )
+	{	return state().device_peak;	}
+
+	//! tracked bytes currently allocated
+	inline long long live( void )
+	{	return state().live;	}
+
+	//! high-water mark of the tracked bytes over the whole run
+	inline long long peak( void )
+	{
+		stats_state& s = state();
+		long long p = s.peak;
+		for( size_t i=0; i<s.saved_peaks.size(); ++i )
+			if( s.saved_peaks[i] > p )
+				p = s.saved_peaks[i];
+		return p;
+	}
+
+	//! peak resident set size of the process in bytes, -1 if not available
+	inline long long process_peak( void )
+	{
+		FILE *fp = fopen( "/proc/self/status", "r" );
+		if( fp == NULL )
+			return -1;
+
+		char line[256];
+		long long kb = -1;
+		while( fgets( line, sizeof(line), fp ) != NULL )
+			if( strncmp( line, "VmHWM:", 6 ) == 0 )
+			{
+				sscanf( line+6, "%lld", &kb );
+				break;
+			}
+		fclose( fp );
+
+		return (kb < 0)? -1 : kb * 1024ll;
+	}
+
+	//! largest peak resident set size seen over the run
+	inline long long process_peak_max( void )
+	{
+		long long pp = process_peak();
+		return (pp > state().process_peak_max)? pp : state().process_peak_max;
+	}
+
+	//! restart the peak resident set size measurement, false if not supported
+	inline bool reset_process_peak( void )
+	{
+		FILE *fp = fopen( "/proc/self/clear_refs", "w" );
+		if( fp == NULL )
+			return false;
+		bool ok = fputs( "5", fp ) >= 0;
+		ok &= fclose( fp ) == 0;
+		return ok;
+	}
+
+	inline double to_mb( long long nbytes )
+	{	return (double)nbytes / 1048576.0;	}
+
+	//! marks a driver stage for the time of its lifetime and logs its memory high-water mark
+	class stage
+	{
+	protected:
+		std::string name_;
+		bool outermost_, process_reset_;
+
+	public:
+		explicit stage( const std::string& name )
+		: name_( name ), process_reset_( false )
+		{
+			#pragma omp critical(memory_stats)
+			{
+				stats_state& s = state();
+				outermost_ = s.saved_peaks.empty();
+				s.saved_peaks.push_back( s.peak );
+				s.peak = s.live;
+			}
+
+			if( outermost_ )
+			{
+				state().process_peak_max = process_peak_max();
+				state().process_reset = reset_process_peak();
+			}
+			process_reset_ = state().process_reset;
+		}
+
+		~stage()
+		{	finish();	}
+
+		//! end the stage before the object goes out of scope
+		void finish( void )
+		{
+			if( name_.empty() )
+				return;
+
+			if( outermost_ && state().cleanup != NULL )
+				state().cleanup();
+
+			long long stage_peak = 0, pp = process_peak();
+
+			#pragma omp critical(memory_stats)
+			{
+				stats_state& s = state();
+				stage_peak = s.peak;
+				if( s.saved_peaks.back() > s.peak )
+					s.peak = s.saved_peaks.back();
+				s.saved_peaks.pop_back();
+				if( pp > s.process_peak_max )
+					s.process_peak_max = pp;
+			}
+
+			if( pp < 0 )
+				LOGINFO("Memory high-water mark of stage \'%s\': %.1f MB of grid data.", name_.c_str(), to_mb(stage_peak));
+			else
+				LOGINFO("Memory high-water mark of stage \'%s\': %.1f MB of grid data, %.1f MB resident%s.",
+						name_.c_str(), to_mb(stage_peak), to_mb(pp), process_reset_? "" : " (since start)");
+
+			if( state().device_live > 0 )
+				LOGINFO("Device memory held at the end of stage \'%s\': %.1f MB.", name_.c_str(), to_mb(state().device_live));
+
+			name_.clear();
+		}
+	};
+}
+
+#endif //__MEMORY_STATS_HH
@@ -14,89 +14,434 @@
 #include <iostream>
 #include <iomanip>
 #include <vector>
+#include <map>
+#include <algorithm>
+#include <utility>
+#include <atomic>
+#include <thread>
 #include <stdexcept>
+#include <string>
 
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "config_file.hh"
 #include "log.hh"
+#include "memory_stats.hh"
 
 
 #include "region_generator.hh"
 
+/*!
+ * @brief bit-packed per-cell refinement flags of one level
+ *
+ * Keeps the values -1 (outside of the mask), 0 (in the mask), 1 (in the mask
+ * and flagged) and 2 (in the mask and refined) as three bit planes, each row
+ * along z padded to whole 64-bit words. Queries that run along a row, such as
+ * finding the next cell that is not refined, work on whole words at a time.
+ */
 class refinement_mask
 {
 protected:
-    std::vector<short> mask_;
-    size_t nx_, ny_, nz_;
+    typedef unsigned long long word_t;
+    
+    std::vector<word_t> in_, flag_, ref_;
+    size_t nx_, ny_, nz_, nwz_;
+    
+    inline size_t word( size_t i, size_t j, size_t k ) const
+    {   return (i*ny_+j)*nwz_ + (k>>6);   }
+    
+    inline static word_t bit( size_t k )
+    {   return 1ull << (k&63);   }
+    
+    inline static int count_bits( word_t w )
+    {   return __builtin_popcountll( w );   }
+    
+    //! mask of the bits of the last word of a row that belong to cells
+    inline word_t row_tail( void ) const
+    {   return (nz_&63)? (bit(nz_)-1) : ~0ull;   }
     
 public:
     
     refinement_mask( void )
-    : nx_( 0 ), ny_ ( 0 ), nz_( 0 )
+    : nx_( 0 ), ny_ ( 0 ), nz_( 0 ), nwz_( 0 )
     { }
     
     refinement_mask( size_t nx, size_t ny, size_t nz, short value = 0. )
-    : nx_( nx ), ny_( ny ), nz_( nz )
     {
-        mask_.assign( nx_*ny_*nz_, value );
+        init( nx, ny, nz, value );
     }
     
-    refinement_mask( const refinement_mask& r )
+    void init( size_t nx, size_t ny, size_t nz, short value = 0. )
     {
-        nx_ = r.nx_;
-        ny_ = r.ny_;
-        nz_ = r.nz_;
-        mask_ = r.mask_;
+        nx_ = nx;
+        ny_ = ny;
+        nz_ = nz;
+        nwz_ = (nz_+63)/64;
+        
+        size_t nw = nx_*ny_*nwz_;
+        in_.assign( nw, (value>=0)? ~0ull : 0ull );
+        flag_.assign( nw, (value>0)? ~0ull : 0ull );
+        ref_.assign( nw, (value>1)? ~0ull : 0ull );
     }
     
-    refinement_mask& operator=( const refinement_mask& r )
+    //! the value of a cell in the short-valued convention
+    short operator()( size_t i, size_t j, size_t k ) const
     {
-        nx_ = r.nx_;
-        ny_ = r.ny_;
-        nz_ = r.nz_;
-        mask_ = r.mask_;
+        size_t q = word(i,j,k);
+        word_t b = bit(k);
         
-        return *this;
+        if( !(in_[q]&b) )
+            return -1;
+        if( ref_[q]&b )
+            return 2;
+        return (flag_[q]&b)? 1 : 0;
     }
     
-    void init( size_t nx, size_t ny, size_t nz, short value = 0. )
+    //! set the value of a cell in the short-valued convention
+    void set( size_t i, size_t j, size_t k, short value )
     {
-        nx_ = nx;
-        ny_ = ny;
-        nz_ = nz;
-        mask_.assign( nx_*ny_*nz_, value );
+        size_t q = word(i,j,k);
+        word_t b = bit(k);
+        
+        in_[q]   = (value>=0)? (in_[q]|b) : (in_[q]&~b);
+        flag_[q] = (value>0)? (flag_[q]|b) : (flag_[q]&~b);
+        ref_[q]  = (value>1)? (ref_[q]|b) : (ref_[q]&~b);
     }
     
-    const short& operator()( size_t i, size_t j, size_t k ) const
+    inline bool is_in_mask( size_t i, size_t j, size_t k ) const
+    {   return (in_[word(i,j,k)] & bit(k)) != 0;   }
+    
+    inline bool is_refined( size_t i, size_t j, size_t k ) const
+    {   return (ref_[word(i,j,k)] & bit(k)) != 0;   }
+    
+    //! the first cell at or after k in row (i,j) that is in the mask and not refined, nz if none
+    size_t next_leaf( size_t i, size_t j, size_t k ) const
     {
-        return mask_[ (i*ny_+j)*nz_+k ];
+        if( k >= nz_ )
+            return nz_;
+        
+        size_t q0 = word(i,j,0), iw = k>>6;
+        word_t w = (in_[q0+iw] & ~ref_[q0+iw]) & ~(bit(k)-1);
+        
+        while( true )
+        {
+            if( iw == nwz_-1 )
+                w &= row_tail();
+            if( w )
+                return (iw<<6) + __builtin_ctzll( w );
+            if( ++iw == nwz_ )
+                return nz_;
+            w = in_[q0+iw] & ~ref_[q0+iw];
+        }
     }
     
-    short& operator()( size_t i, size_t j, size_t k )
+    //! number of cells that are in the mask and not refined
+    size_t count_leaves( void ) const
     {
-        return mask_[ (i*ny_+j)*nz_+k ];
+        size_t count = 0;
+        word_t tail = row_tail();
+        for( size_t q=0; q<in_.size(); ++q )
+            count += count_bits( (in_[q] & ~ref_[q]) & ((q%nwz_==nwz_-1)? tail : ~0ull) );
+        return count;
     }
     
+    //! number of cells with a value other than 0
     size_t count_flagged( void )
     {
-        size_t count = 0;
-        for( size_t i=0; i<mask_.size(); ++i )
-            if( mask_[i] )
-                ++count;
-        return count;
+        return nx_*ny_*nz_ - count_notflagged();
     }
     
+    //! number of cells with the value 0
     size_t count_notflagged( void )
     {
         size_t count = 0;
-        for( size_t i=0; i<mask_.size(); ++i )
-            if( !mask_[i] )
-                ++count;
+        word_t tail = row_tail();
+        for( size_t q=0; q<in_.size(); ++q )
+            count += count_bits( (in_[q] & ~flag_[q]) & ((q%nwz_==nwz_-1)? tail : ~0ull) );
         return count;
     }
 };
 
+/*!
+ * @brief 64-byte aligned storage for mesh data that reuses freed blocks
+ *
+ * Whole hierarchies are allocated and freed for every stage of the driver with
+ * the same level shapes. Freed blocks are kept and handed out again for requests
+ * of the same size. On the first request that cannot be served from the pool all
+ * kept blocks are returned to the system. Kept blocks still count against the
+ * resident size, so memory allocated elsewhere (FFT work arrays, particle buffers)
+ * can push the process peak above that of plain allocation while they are held.
+ * This is bounded by [setup] pool_limit_mb, beyond which freed blocks go straight
+ * back to the system, and by the purge at the end of every outermost driver stage (see
+ * memory_stats::stage). Fresh blocks are touched in parallel with the
+ * static schedule used by the loops over the data, placing pages close to the
+ * threads that use them.
+ */
+namespace mesh_pool
+{
+	//... the size of a block is kept in front of it, padded to keep the alignment
+	const size_t alignment = 64;
+
+	struct pool_state
+	{
+		std::multimap< size_t, void* > free_blocks;
+		size_t nallocated, nreused;
+		size_t kept_bytes, limit_bytes;
+	};
+
+	inline pool_state& state( void )
+	{
+		static pool_state s = { std::multimap< size_t, void* >(), 0, 0, 0, 1ul<<30 };
+		return s;
+	}
+
+	//! return all kept blocks to the system, call with the pool locked
+	inline void purge_locked( void )
+	{
+		pool_state& s = state();
+		for( std::multimap< size_t, void* >::iterator it = s.free_blocks.begin(); it != s.free_blocks.end(); ++it )
+			free( it->second );
+		s.free_blocks.clear();
+		s.kept_bytes = 0;
+	}
+
+	//! return all kept blocks to the system
+	inline void purge( void )
+	{
+		#pragma omp critical(mesh_pool)
+		purge_locked();
+	}
+
+	//! upper bound on the bytes kept in the pool
+	inline void set_limit( size_t nbytes )
+	{
+		#pragma omp critical(mesh_pool)
+		{
+			state().limit_bytes = nbytes;
+			if( state().kept_bytes > nbytes )
+				purge_locked();
+		}
+	}
+
+	//! first touch of a fresh block, only worth it for blocks larger than a few pages
+	template< typename T >
+	inline void first_touch( T* p, size_t n )
+	{
+		if( n * sizeof(T) < (1ul<<20) )
+			return;
+
+		#pragma omp parallel for schedule(static)
+		for( long long i=0; i<(long long)n; ++i )
+			p[i] = T(0);
+	}
+
+	//! copy n elements, large arrays in parallel chunks
+	template< typename T >
+	inline void copy( T* dst, const T* src, size_t n )
+	{
+		const size_t nchunk = (1ul<<20) / sizeof(T);
+		long long nchunks = (long long)((n + nchunk - 1) / nchunk);
+
+		#pragma omp parallel for schedule(static) if( nchunks > 1 )
+		for( long long ic=0; ic<nchunks; ++ic )
+		{
+			size_t i0 = (size_t)ic * nchunk, nc = std::min( nchunk, n - i0 );
+			memcpy( dst + i0, src + i0, nc * sizeof(T) );
+		}
+	}
+
+	//! get an aligned array of n elements
+	template< typename T >
+	inline T* allocate( size_t n )
+	{
+		size_t nbytes = n * sizeof(T);
+		void *pblock = NULL;
+		bool fresh = false;
+
+		#pragma omp critical(mesh_pool)
+		{
+			pool_state& s = state();
+			std::multimap< size_t, void* >::iterator it = s.free_blocks.find( nbytes );
+
+			if( it != s.free_blocks.end() )
+			{
+				pblock = it->second;
+				s.free_blocks.erase( it );
+				s.kept_bytes -= nbytes;
+				++s.nreused;
+			}
+			else
+			{
+				purge_locked();
+				if( posix_memalign( &pblock, alignment, nbytes + alignment ) != 0 )
+					pblock = NULL;
+				else
+				{
+					*reinterpret_cast<size_t*>(pblock) = nbytes;
+					++s.nallocated;
+					fresh = true;
+				}
+			}
+		}
+
+		if( pblock == NULL )
+		{
+			LOGERR("Could not allocate %llu bytes of mesh data.", (unsigned long long)nbytes);
+			throw std::runtime_error("Could not allocate memory for mesh data");
+		}
+
+		memory_stats::add( (long long)nbytes );
+
+		T *p = reinterpret_cast<T*>( reinterpret_cast<char*>(pblock) + alignment );
+
+		if( fresh )
+			first_touch( p, n );
+
+		return p;
+	}
+
+	//! give an array obtained from allocate back to the pool
+	template< typename T >
+	inline void release( T* p )
+	{
+		if( p == NULL )
+			return;
+
+		void *pblock = reinterpret_cast<char*>(p) - alignment;
+		size_t nbytes = *reinterpret_cast<size_t*>(pblock);
+
+		#pragma omp critical(mesh_pool)
+		{
+			pool_state& s = state();
+			if( s.kept_bytes + nbytes > s.limit_bytes )
+				free( pblock );
+			else
+			{
+				s.free_blocks.insert( std::make_pair( nbytes, pblock ) );
+				s.kept_bytes += nbytes;
+			}
+		}
+
+		memory_stats::add( -(long long)nbytes );
+	}
+
+	//! return all kept blocks to the system and report the pool statistics
+	inline void finalize( void )
+	{
+		#pragma omp critical(mesh_pool)
+		{
+			pool_state& s = state();
+			purge_locked();
+			LOGUSER("Mesh pool: %llu blocks allocated, %llu reused.",
+					(unsigned long long)s.nallocated, (unsigned long long)s.nreused);
+		}
+	}
+}
+
+/*!
+ * @brief scratch files that idle mesh data is moved to while it is not needed
+ *
+ * Each spilled block gets its own unlinked file in [setup] spill_dir, which is
+ * written and read back through a shared mapping. Only the open descriptor is
+ * kept, so the file disappears when the block is read back or dropped.
+ */
+namespace mesh_spill
+{
+	//! directory for the scratch files, empty if spilling is disabled
+	inline std::string& directory( void )
+	{
+		static std::string dir;
+		return dir;
+	}
+	
+	inline bool enabled( void )
+	{	return !directory().empty();	}
+	
+	//! whether hierarchies that are only read any more are kept in scratch files level by level
+	inline bool& stream_levels( void )
+	{
+		static bool stream = false;
+		return stream;
+	}
+	
+	inline bool streaming( void )
+	{	return enabled() && stream_levels();	}
+	
+	//! copy nbytes at p to a new scratch file and return its descriptor
+	inline int write( const void* p, size_t nbytes )
+	{
+		std::string fname = directory() + "/music_spill_XXXXXX";
+		std::vector<char> tmpl( fname.begin(), fname.end() );
+		tmpl.push_back( '\0' );
+		
+		int fd = mkstemp( &tmpl[0] );
+		if( fd < 0 )
+		{
+			LOGERR("Could not create spill file in \'%s\': %s", directory().c_str(), strerror(errno));
+			throw std::runtime_error("mesh_spill::write : could not create spill file");
+		}
+		unlink( &tmpl[0] );
+		
+		if( nbytes == 0 )
+			return fd;
+		
+		void *map = MAP_FAILED;
+		if( ftruncate( fd, (off_t)nbytes ) == 0 )
+			map = mmap( NULL, nbytes, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0 );
+		
+		if( map == MAP_FAILED )
+		{
+			LOGERR("Could not map spill file of %llu bytes: %s", (unsigned long long)nbytes, strerror(errno));
+			close( fd );
+			throw std::runtime_error("mesh_spill::write : could not map spill file");
+		}
+		
+		memcpy( map, p, nbytes );
+		msync( map, nbytes, MS_ASYNC );
+		munmap( map, nbytes );
+		
+		return fd;
+	}
+	
+	//! ask the kernel to start reading a scratch file back in the background
+	inline void prefetch( int fd )
+	{
+		posix_fadvise( fd, 0, 0, POSIX_FADV_WILLNEED );
+	}
+	
+	//! copy a scratch file back to p and close it, unless it is to be kept
+	inline void read( int fd, void* p, size_t nbytes, bool keep = false )
+	{
+		if( nbytes > 0 )
+		{
+			void *map = mmap( NULL, nbytes, PROT_READ, MAP_SHARED, fd, 0 );
+			if( map == MAP_FAILED )
+			{
+				LOGERR("Could not map spill file of %llu bytes: %s", (unsigned long long)nbytes, strerror(errno));
+				close( fd );
+				throw std::runtime_error("mesh_spill::read : could not map spill file");
+			}
+			madvise( map, nbytes, MADV_SEQUENTIAL );
+			memcpy( p, map, nbytes );
+			munmap( map, nbytes );
+		}
+		if( !keep )
+			close( fd );
+	}
+	
+	//! drop a scratch file without reading it
+	inline void discard( int fd )
+	{
+		close( fd );
+	}
+}
+
 //! base class for all things that have rectangular mesh structure
 template<typename T>
 class Meshvar{
@@ -119,14 +464,14 @@ public:
 	explicit Meshvar( size_t n, int offx, int offy, int offz )
 	: m_nx( n ), m_ny( n ), m_nz( n ), m_offx( offx ), m_offy( offy ), m_offz( offz )
 	{
-		m_pdata = new real_t[m_nx*m_ny*m_nz];
+		m_pdata = mesh_pool::allocate<real_t>( m_nx*m_ny*m_nz );
 	}
 	
 	//! constructor for rectangular mesh
 	Meshvar( size_t nx, size_t ny, size_t nz, int offx, int offy, int offz )
 	: m_nx( nx ), m_ny( ny ), m_nz( nz ), m_offx( offx ), m_offy( offy ), m_offz( offz )
 	{
-		m_pdata = new real_t[m_nx*m_ny*m_nz];
+		m_pdata = mesh_pool::allocate<real_t>( m_nx*m_ny*m_nz );
 	}
 	
 	//! variant copy constructor with optional copying of the actual data
@@ -140,11 +485,10 @@ public:
 		m_offy = m.m_offy;
 		m_offz = m.m_offz;
 		
-		m_pdata = new real_t[m_nx*m_ny*m_nz];
+		m_pdata = mesh_pool::allocate<real_t>( m_nx*m_ny*m_nz );
 		
 		if( copy_over )
-			for( size_t i=0; i<m_nx*m_ny*m_nz; ++i )
-				m_pdata[i] = m.m_pdata[i];
+			mesh_pool::copy( m_pdata, m.m_pdata, m_nx*m_ny*m_nz );
 	}
 	
 	//! standard copy constructor
@@ -158,27 +502,66 @@ public:
 		m_offy = m.m_offy;
 		m_offz = m.m_offz;
 		
-		m_pdata = new real_t[m_nx*m_ny*m_nz];
+		m_pdata = mesh_pool::allocate<real_t>( m_nx*m_ny*m_nz );
 		
-		for( size_t i=0; i<m_nx*m_ny*m_nz; ++i )
-			m_pdata[i] = m.m_pdata[i];
+		mesh_pool::copy( m_pdata, m.m_pdata, m_nx*m_ny*m_nz );
+	}
+	
+	//! move constructor, takes over the data of m which keeps its structure but no data
+	Meshvar( Meshvar<real_t>&& m )
+	: m_nx( m.m_nx ), m_ny( m.m_ny ), m_nz( m.m_nz ), m_offx( m.m_offx ), m_offy( m.m_offy ), m_offz( m.m_offz ),
+	  m_pdata( m.m_pdata )
+	{
+		m.m_pdata = NULL;
 	}
 	
 	//! destructor
 	~Meshvar()
 	{
-		if( m_pdata != NULL )
-			delete[] m_pdata;
+		mesh_pool::release( m_pdata );
 	}
 	
 	//! deallocate the data, but keep the structure
 	inline void deallocate( void )
 	{
-		if( m_pdata != NULL )
-			delete[] m_pdata;
+		mesh_pool::release( m_pdata );
 		m_pdata = NULL;
 	}
 	
+	//! move the data to a scratch file and deallocate it, returns the descriptor of the file
+	int spill( void )
+	{
+		int fd = mesh_spill::write( m_pdata, m_nx*m_ny*m_nz*sizeof(real_t) );
+		deallocate();
+		return fd;
+	}
+	
+	//! allocate the data again and read it back from a scratch file written by spill()
+	void unspill( int fd, bool keep_file = false )
+	{
+		m_pdata = mesh_pool::allocate<real_t>( m_nx*m_ny*m_nz );
+		mesh_spill::read( fd, m_pdata, m_nx*m_ny*m_nz*sizeof(real_t), keep_file );
+	}
+	
+	//! copy the data to a scratch file that is kept open, returns its descriptor
+	int write_scratch( void ) const
+	{	return mesh_spill::write( m_pdata, m_nx*m_ny*m_nz*sizeof(real_t) );	}
+	
+	//! allocate the data again, without initialising it, after deallocate()
+	void reallocate( void )
+	{
+		if( m_pdata == NULL )
+			m_pdata = mesh_pool::allocate<real_t>( m_nx*m_ny*m_nz );
+	}
+	
+	//! whether the data is allocated
+	bool is_allocated( void ) const
+	{	return m_pdata != NULL;		}
+	
+	//! bytes held by the data block
+	inline size_t nbytes( void ) const
+	{	return m_nx*m_ny*m_nz*sizeof(real_t);	}
+	
 	//! get extent of the mesh along a specified dimension (const)
 	inline size_t size( unsigned dim ) const
 	{
@@ -206,6 +589,7 @@ public:
 	//! set all the data to zero values
 	void zero( void )
 	{
+		#pragma omp parallel for
 		for( size_t i=0; i<m_nx*m_ny*m_nz; ++i )
 			m_pdata[i] = 0.0;
 	}
@@ -341,19 +725,41 @@ public:
 		m_offy = m.m_offy;
 		m_offz = m.m_offz;
 		
-		if( m_pdata != NULL )
-			delete m_pdata;
+		mesh_pool::release( m_pdata );
 		
-		m_pdata = new real_t[m_nx*m_ny*m_nz];
+		m_pdata = mesh_pool::allocate<real_t>( m_nx*m_ny*m_nz );
 		
-		for( size_t i=0; i<m_nx*m_ny*m_nz; ++i )
-			m_pdata[i] = m.m_pdata[i];
+		mesh_pool::copy( m_pdata, m.m_pdata, m_nx*m_ny*m_nz );
+		
+		return *this;
+	}
+	
+	//! move assignment, takes over the data of m
+	Meshvar<real_t>& operator=( Meshvar<real_t>&& m )
+	{
+		if( this != &m )
+		{
+			m_nx = m.m_nx;
+			m_ny = m.m_ny;
+			m_nz = m.m_nz;
+			
+			m_offx = m.m_offx;
+			m_offy = m.m_offy;
+			m_offz = m.m_offz;
+			
+			mesh_pool::release( m_pdata );
+			m_pdata = m.m_pdata;
+			m.m_pdata = NULL;
+		}
 		
 		return *this;
 	}
 	
 	real_t* get_ptr( void )
 	{	return m_pdata;		}
+	
+	const real_t* get_ptr( void ) const
+	{	return m_pdata;		}
 };
 
 //! MeshvarBnd derived class adding boundary ghost cell functionality
@@ -402,6 +808,11 @@ public:
 	: Meshvar<real_t>( v, true ), m_nbnd( v.m_nbnd )
 	{   }
 	
+	//! move constructor
+	MeshvarBnd( MeshvarBnd<real_t>&& v )
+	: Meshvar<real_t>( std::move(v) ), m_nbnd( v.m_nbnd )
+	{   }
+	
 	//! get extent of the mesh along a specified dimension
 	inline size_t size( unsigned dim=0 ) const
 	{
@@ -433,17 +844,23 @@ public:
 			this->m_ny = m.m_ny;
 			this->m_nz = m.m_nz;
 			
-			if( m_pdata != NULL )
-				delete[] m_pdata;
+			mesh_pool::release( m_pdata );
 			
-			m_pdata = new real_t[m_nx*m_ny*m_nz];			
+			m_pdata = mesh_pool::allocate<real_t>( m_nx*m_ny*m_nz );
 		}
 		
-		for( size_t i=0; i<m_nx*m_ny*m_nz; ++i )
-			this->m_pdata[i] = m.m_pdata[i];
+		mesh_pool::copy( m_pdata, m.m_pdata, m_nx*m_ny*m_nz );
 		
 		return *this;
 	}
+	
+	//! move assignment for rectangular meshes with ghost zones
+	MeshvarBnd<real_t>& operator=( MeshvarBnd<real_t>&& m )
+	{
+		Meshvar<real_t>::operator=( std::move(m) );
+		m_nbnd = m.m_nbnd;
+		return *this;
+	}
 
 	//! sets the value of all ghost zones to zero
 	void zero_bnd( void )
@@ -517,6 +934,62 @@ public:
 
 
 
+/*!
+ * @brief cache-blocked traversal of the cells of a mesh for high order stencils
+ *
+ * The nx*ny*nz cells are cut into bricks of e*e*4e cells (longer along the
+ * contiguous z-direction), which are distributed over the threads in x-major
+ * order. A stencil of radius r then works on a brick and its halo of width r,
+ * which stay in L1/L2, instead of streaming through 2r+1 full planes per cell.
+ * The storage layout of the meshes is not changed. An edge length of 0 gives
+ * one brick per x-slab, i.e. the plain loop order.
+ */
+class mesh_bricks
+{
+public:
+	struct brick
+	{
+		int ix0, ix1, iy0, iy1, iz0, iz1;
+	};
+
+protected:
+	std::vector< brick > bricks_;
+
+public:
+	//! brick edge length in x and y, set from [setup] stencil_brick
+	static int& edge( void )
+	{
+		static int e = 16;
+		return e;
+	}
+
+	mesh_bricks( int nx, int ny, int nz )
+	{
+		int bx = edge(), by = edge(), bz = 4*edge();
+		if( bx <= 0 )
+		{
+			bx = 1;
+			by = std::max( ny, 1 );
+			bz = std::max( nz, 1 );
+		}
+
+		for( int ix=0; ix<nx; ix+=bx )
+			for( int iy=0; iy<ny; iy+=by )
+				for( int iz=0; iz<nz; iz+=bz )
+				{
+					brick b = { ix, std::min(ix+bx,nx), iy, std::min(iy+by,ny), iz, std::min(iz+bz,nz) };
+					bricks_.push_back( b );
+				}
+	}
+
+	inline size_t size( void ) const
+	{	return bricks_.size();	}
+
+	inline const brick& operator[]( size_t i ) const
+	{	return bricks_[i];	}
+};
+
+
 //! class that subsumes a nested grid collection
 template< typename T >
 class GridHierarchy
@@ -542,6 +1015,182 @@ public:
 	
 protected:
 	
+	//! scratch file descriptors of the levels whose data is spilled
+	mutable std::map< unsigned, int > m_spilled;
+	
+	//! read a level back from its scratch file if it is spilled
+	void fetch_level( unsigned ilevel ) const
+	{
+		#pragma omp critical(mesh_spill)
+		{
+			std::map< unsigned, int >::iterator it = m_spilled.find( ilevel );
+			if( it != m_spilled.end() )
+			{
+				m_pgrids[ilevel]->unspill( it->second );
+				m_spilled.erase( it );
+			}
+		}
+	}
+	
+	//! scratch file descriptors of the levels of a streamed hierarchy, see stream()
+	mutable std::map< unsigned, int > m_streamed;
+	
+	//! the levels of a streamed hierarchy that are held in memory, least recently used first
+	mutable std::vector< int > m_resident;
+	
+	//! the (at most two) levels each reading thread asked for last, these are pinned in memory
+	mutable std::map< std::thread::id, std::vector< int > > m_readers;
+	
+	//! changes whenever streaming starts or ends, so that threads can tell their cached pins are stale
+	mutable std::atomic< unsigned long long > m_stream_epoch;
+	
+	static unsigned long long new_stream_epoch( void )
+	{
+		static std::atomic< unsigned long long > n( 0 );
+		return ++n;
+	}
+	
+	//! pins of the calling thread from its last stream_level(), valid only for the same hierarchy and epoch
+	struct reader_pins
+	{
+		const void *owner;
+		unsigned long long epoch;
+		int level[2];
+	};
+	
+	static reader_pins& thread_pins( void )
+	{
+		static thread_local reader_pins pins = { NULL, 0, { -1, -1 } };
+		return pins;
+	}
+	
+	//! make sure a level of a streamed hierarchy is in memory
+	/*! the level stays pinned until the calling thread has asked for two other levels, unpinned levels
+	 *  are evicted least recently used first so that two levels are resident where possible
+	 */
+	void stream_level( unsigned ilevel ) const
+	{
+		//... a level this thread has pinned cannot be evicted, no need to lock
+		reader_pins& tp = thread_pins();
+		if( tp.owner == this && tp.epoch == m_stream_epoch.load() && (tp.level[0] == (int)ilevel || tp.level[1] == (int)ilevel) )
+			return;
+		
+		#pragma omp critical(mesh_spill)
+		{
+			std::map< unsigned, int >::iterator it = m_streamed.find( ilevel );
+			if( it != m_streamed.end() )
+			{
+				std::vector< int >& pins = m_readers[ std::this_thread::get_id() ];
+				pins.erase( std::remove( pins.begin(), pins.end(), (int)ilevel ), pins.end() );
+				pins.push_back( ilevel );
+				if( pins.size() > 2 )
+					pins.erase( pins.begin() );
+				
+				std::vector< int >::iterator ir = std::find( m_resident.begin(), m_resident.end(), (int)ilevel );
+				if( ir != m_resident.end() )
+					m_resident.erase( ir );
+				else
+				{
+					for( size_t i=0; i<m_resident.size() && m_resident.size() >= 2; )
+					{
+						if( is_pinned( m_resident[i] ) )
+							++i;
+						else
+						{
+							m_pgrids[ m_resident[i] ]->deallocate();
+							m_resident.erase( m_resident.begin() + i );
+						}
+					}
+					m_pgrids[ilevel]->unspill( it->second, true );
+				}
+				m_resident.push_back( ilevel );
+				
+				tp.owner = this;
+				tp.epoch = m_stream_epoch.load();
+				tp.level[0] = pins.front();
+				tp.level[1] = pins.back();
+			}
+		}
+	}
+	
+	//! whether a level of a streamed hierarchy is pinned by any reader, call inside critical(mesh_spill)
+	bool is_pinned( int ilevel ) const
+	{
+		for( typename std::map< std::thread::id, std::vector< int > >::const_iterator it = m_readers.begin(); it != m_readers.end(); ++it )
+			if( std::find( it->second.begin(), it->second.end(), ilevel ) != it->second.end() )
+				return true;
+		return false;
+	}
+	
+	//! end streaming, optionally without reading the evicted levels back (they are zeroed instead)
+	void end_stream( bool read_back ) const
+	{
+		if( m_streamed.empty() )
+			return;
+		
+		#pragma omp critical(mesh_spill)
+		{
+			for( std::map< unsigned, int >::iterator it = m_streamed.begin(); it != m_streamed.end(); ++it )
+			{
+				if( m_pgrids[it->first]->is_allocated() )
+					mesh_spill::discard( it->second );
+				else if( read_back )
+					m_pgrids[it->first]->unspill( it->second );
+				else
+				{
+					m_pgrids[it->first]->reallocate();
+					m_pgrids[it->first]->zero();
+					mesh_spill::discard( it->second );
+				}
+			}
+			m_streamed.clear();
+			m_resident.clear();
+			m_readers.clear();
+			m_stream_epoch = new_stream_epoch();
+		}
+	}
+	
+	//! drop all scratch files without reading them back
+	void discard_spilled( void )
+	{
+		for( std::map< unsigned, int >::iterator it = m_spilled.begin(); it != m_spilled.end(); ++it )
+			mesh_spill::discard( it->second );
+		m_spilled.clear();
+		
+		for( std::map< unsigned, int >::iterator it = m_streamed.begin(); it != m_streamed.end(); ++it )
+			mesh_spill::discard( it->second );
+		m_streamed.clear();
+		m_resident.clear();
+		m_readers.clear();
+		m_stream_epoch = new_stream_epoch();
+	}
+	
+	//! give all spilled or streamed levels their memory back without reading the scratch files, the data is lost
+	void reallocate_spilled( void )
+	{
+		for( std::map< unsigned, int >::iterator it = m_spilled.begin(); it != m_spilled.end(); ++it )
+		{
+			mesh_spill::discard( it->second );
+			m_pgrids[it->first]->reallocate();
+		}
+		m_spilled.clear();
+		end_stream( false );
+	}
+	
+	//! replace the refinement masks by copies of those of gh
+	void copy_masks( const GridHierarchy<T>& gh )
+	{
+		for( size_t i=0; i<m_ref_masks.size(); ++i )
+			delete m_ref_masks[i];
+		m_ref_masks.clear();
+		
+		bhave_refmask = gh.bhave_refmask;
+		
+		if( bhave_refmask )
+			for( size_t i=0; i<gh.m_ref_masks.size(); ++i )
+				m_ref_masks.push_back( new refinement_mask( *(gh.m_ref_masks[i]) ) );
+	}
+	
 	//! check whether a given grid has identical hierarchy, dimensions to this 
 	bool is_consistent( const GridHierarchy<T>& gh )
 	{
@@ -575,6 +1224,10 @@ public:
 			LOGERR("Attempt to access level %d but maxlevel = %d", ilevel, m_pgrids.size()-1);
 			throw std::runtime_error("Fatal: attempt to access non-existent grid");
 		}
+		if( !m_spilled.empty() )
+			fetch_level( ilevel );
+		if( !m_streamed.empty() )
+			end_stream( true );
 		return m_pgrids[ilevel];  
 	}
 
@@ -586,23 +1239,100 @@ public:
             LOGERR("Attempt to access level %d but maxlevel = %d", ilevel, m_pgrids.size()-1 );
 			throw std::runtime_error("Fatal: attempt to access non-existent grid");
 		}
-
+		if( !m_spilled.empty() )
+			fetch_level( ilevel );
+		if( !m_streamed.empty() )
+			stream_level( ilevel );
 		return m_pgrids[ilevel];  
 	}
 	
+	//! move the data of a level to a scratch file if [setup] spill_dir is set
+	/*! the level is read back on the next get_grid() or operation on the whole hierarchy,
+	 *  spilled levels should be fetched (or at least prefetched) before parallel regions use them
+	 */
+	void spill( unsigned ilevel )
+	{
+		if( !mesh_spill::enabled() || ilevel >= m_pgrids.size() || m_spilled.count( ilevel ) )
+			return;
+		
+		size_t nbytes = m_pgrids[ilevel]->nbytes();
+		m_spilled[ilevel] = m_pgrids[ilevel]->spill();
+		
+		LOGUSER("Spilled level %d (%.1f MB) to scratch file.", ilevel, memory_stats::to_mb( nbytes ));
+	}
+	
+	//! move the data of all levels to scratch files
+	void spill( void )
+	{
+		for( unsigned i=0; i<m_pgrids.size(); ++i )
+			spill( i );
+	}
+	
+	//! hint that a spilled level will be needed soon, it is read ahead in the background
+	void prefetch( unsigned ilevel ) const
+	{
+		std::map< unsigned, int >::const_iterator it = m_spilled.find( ilevel );
+		if( it != m_spilled.end() )
+			mesh_spill::prefetch( it->second );
+	}
+	
+	//! hint that all spilled levels will be needed soon
+	void prefetch( void ) const
+	{
+		for( std::map< unsigned, int >::const_iterator it = m_spilled.begin(); it != m_spilled.end(); ++it )
+			mesh_spill::prefetch( it->second );
+	}
+	
+	//! read all spilled levels back
+	void fetch( void ) const
+	{
+		while( !m_spilled.empty() )
+			fetch_level( m_spilled.begin()->first );
+		end_stream( true );
+	}
+	
+	//! keep a hierarchy that is only read from now on in scratch files, with at most two levels in memory
+	/*! requires [setup] stream_levels and spill_dir, levels are read back on demand by the const get_grid(),
+	 *  so the hierarchy should be read level by level; any modification reads all levels back first
+	 */
+	void stream( void ) const
+	{
+		if( !mesh_spill::streaming() || !m_streamed.empty() )
+			return;
+		fetch();
+		
+		size_t nbytes = 0;
+		for( unsigned i=0; i<m_pgrids.size(); ++i )
+		{
+			m_streamed[i] = m_pgrids[i]->write_scratch();
+			m_pgrids[i]->deallocate();
+			nbytes += m_pgrids[i]->nbytes();
+		}
+		LOGUSER("Streaming %d levels (%.1f MB) from scratch files.", (int)m_pgrids.size(), memory_stats::to_mb( nbytes ));
+	}
+	
+	//! stop streaming a hierarchy whose data will be overwritten anyway, evicted levels are zeroed, not read back
+	void discard_stream( void ) const
+	{	end_stream( false );	}
+	
+	//! whether the data of a level is currently in a scratch file
+	bool is_spilled( unsigned ilevel ) const
+	{	return m_spilled.count( ilevel ) > 0;	}
+	
 	
 	//! constructor for a collection of rectangular grids representing a multi-level hierarchy
 	/*! creates an empty hierarchy, levelmin is initially zero, no grids are stored
 	 * @param nbnd number of ghost zones added at the boundary
 	 */
 	explicit GridHierarchy( size_t nbnd )
-	: m_nbnd( nbnd ), m_levelmin( 0 ), bhave_refmask( false )
+	: m_nbnd( nbnd ), m_levelmin( 0 ), bhave_refmask( false ), m_stream_epoch( new_stream_epoch() )
 	{
 		m_pgrids.clear();
 	}
 	
 	//! copy constructor
 	explicit GridHierarchy( const GridHierarchy<T> & gh )
+	: m_stream_epoch( new_stream_epoch() )
 	{
 		for( unsigned i=0; i<=gh.levelmax(); ++i )
 			m_pgrids.push_back( new MeshvarBnd<T>( *gh.get_grid(i) ) );
@@ -624,6 +1354,13 @@ public:
         }
 	}
 	
+	//! move constructor, takes over all levels of gh which is left empty
+	GridHierarchy( GridHierarchy<T>&& gh )
+	: m_nbnd( gh.m_nbnd ), m_levelmin( 0 ), bhave_refmask( false ), m_stream_epoch( new_stream_epoch() )
+	{
+		swap_all( gh );
+	}
+	
 	//! destructor
 	~GridHierarchy()
 	{
@@ -633,6 +1370,7 @@ public:
 	//! free all memory occupied by the grid hierarchy
 	void deallocate()
 	{
+		discard_spilled();
 		for( unsigned i=0; i<m_pgrids.size(); ++i )
 			delete m_pgrids[i];
 		m_pgrids.clear();
@@ -647,6 +1385,43 @@ public:
             delete m_ref_masks[i];
         m_ref_masks.clear();
 	}
+	
+	//! replace this hierarchy by a copy of gh, whose values are of another precision
+	template< typename U >
+	void convert_from( const GridHierarchy<U>& gh )
+	{
+		this->deallocate();
+		
+		m_nbnd = gh.m_nbnd;
+		m_levelmin = gh.m_levelmin;
+		
+		m_xoffabs = gh.m_xoffabs;
+		m_yoffabs = gh.m_yoffabs;
+		m_zoffabs = gh.m_zoffabs;
+		
+		for( unsigned i=0; i<gh.m_pgrids.size(); ++i )
+		{
+			const MeshvarBnd<U>& g = *gh.get_grid(i);
+			MeshvarBnd<T> *p = new MeshvarBnd<T>( g.m_nbnd, g.size(0), g.size(1), g.size(2), g.offset(0), g.offset(1), g.offset(2) );
+			
+			//... the ghost zones are part of the data arrays and converted along
+			const U *src = g.get_ptr();
+			T *dst = p->get_ptr();
+			long n = (long)(g.nbytes()/sizeof(U));
+			
+			#pragma omp parallel for
+			for( long j=0; j<n; ++j )
+				dst[j] = (T)src[j];
+			
+			m_pgrids.push_back( p );
+		}
+		
+		bhave_refmask = gh.bhave_refmask;
+		
+		if( bhave_refmask )
+			for( size_t i=0; i<gh.m_ref_masks.size(); ++i )
+				m_ref_masks.push_back( new refinement_mask( *(gh.m_ref_masks[i]) ) );
+	}
     
     
     // meaning of the mask:
@@ -663,34 +1438,48 @@ public:
         {
             for( int ilevel = (int)levelmax(); ilevel >= (int)levelmin(); --ilevel )
             {
-                double xq[3], dx = 1.0/(1ul<<ilevel);
+                double dx = 1.0/(1ul<<ilevel);
+                size_t nq = (size(ilevel,2)+1)/2;
                 
                 m_ref_masks[ilevel]->init( size(ilevel,0), size(ilevel,1), size(ilevel,2), 0 );
                 
-                for( size_t i=0; i<size(ilevel,0); i+=2 )
+                //... the coordinates along z are the same for all rows
+                std::vector<double> zq( nq );
+                for( size_t k=0; k<size(ilevel,2); k+=2 )
+                    zq[k/2] = (offset_abs(ilevel,2) + k)*dx + 0.5*dx + shift[2];
+                
+                //... every query covers a 2x2x2 block of cells, each thread fills whole (i,j)
+                //... rows of the mask, which do not share words
+                #pragma omp parallel
                 {
-                    xq[0] = (offset_abs(ilevel,0) + i)*dx + 0.5*dx + shift[0];
-                    for( size_t j=0; j<size(ilevel,1); j+=2 )
+                    std::vector<unsigned char> inside( nq, 1 );
+                    
+                    #pragma omp for
+                    for( int ii=0; ii<(int)size(ilevel,0); ii+=2 )
                     {
-                        xq[1] = (offset_abs(ilevel,1) + j)*dx + 0.5*dx + shift[1];
-                        for( size_t k=0; k<size(ilevel,2); k+=2 )
+                        size_t i = ii;
+                        double xq = (offset_abs(ilevel,0) + i)*dx + 0.5*dx + shift[0];
+                        for( size_t j=0; j<size(ilevel,1); j+=2 )
                         {
-                            xq[2] = (offset_abs(ilevel,2) + k)*dx + 0.5*dx + shift[2];
-                            
+                            double yq = (offset_abs(ilevel,1) + j)*dx + 0.5*dx + shift[1];
                             
-                            short mask_val = -1; // outside mask
-                            if( the_region_generator->query_point( xq, ilevel ) || ilevel == (int)levelmin() )
-                                mask_val = 1; // inside mask
-                            
-                            (*m_ref_masks[ilevel])(i+0,j+0,k+0) = mask_val;
-                            (*m_ref_masks[ilevel])(i+0,j+0,k+1) = mask_val;
-                            (*m_ref_masks[ilevel])(i+0,j+1,k+0) = mask_val;
-                            (*m_ref_masks[ilevel])(i+0,j+1,k+1) = mask_val;
-                            (*m_ref_masks[ilevel])(i+1,j+0,k+0) = mask_val;
-                            (*m_ref_masks[ilevel])(i+1,j+0,k+1) = mask_val;
-                            (*m_ref_masks[ilevel])(i+1,j+1,k+0) = mask_val;
-                            (*m_ref_masks[ilevel])(i+1,j+1,k+1) = mask_val;
+                            //... the coarsest level is inside everywhere
+                            if( nq > 0 && ilevel != (int)levelmin() )
+                                the_region_generator->query_row( xq, yq, &zq[0], nq, ilevel, &inside[0] );
                             
+                            for( size_t k=0; k<size(ilevel,2); k+=2 )
+                            {
+                                short mask_val = inside[k/2]? 1 : -1; // inside or outside mask
+                                
+                                m_ref_masks[ilevel]->set( i+0,j+0,k+0, mask_val );
+                                m_ref_masks[ilevel]->set( i+0,j+0,k+1, mask_val );
+                                m_ref_masks[ilevel]->set( i+0,j+1,k+0, mask_val );
+                                m_ref_masks[ilevel]->set( i+0,j+1,k+1, mask_val );
+                                m_ref_masks[ilevel]->set( i+1,j+0,k+0, mask_val );
+                                m_ref_masks[ilevel]->set( i+1,j+0,k+1, mask_val );
+                                m_ref_masks[ilevel]->set( i+1,j+1,k+0, mask_val );
+                                m_ref_masks[ilevel]->set( i+1,j+1,k+1, mask_val );
+                            }
                         }
                     }
                 }
@@ -727,16 +1516,16 @@ public:
                                 
                                 if( fine_is_flagged )
                                 {
-                                    (*m_ref_masks[ilevel])(i,j,k) = 2; // cell is refined
+                                    m_ref_masks[ilevel]->set( i,j,k, 2 ); // cell is refined
                                     
-                                    (*m_ref_masks[ilevel+1])(ifine[0]+0,ifine[1]+0,ifine[2]+0) = 1;
-                                    (*m_ref_masks[ilevel+1])(ifine[0]+0,ifine[1]+0,ifine[2]+1) = 1;
-                                    (*m_ref_masks[ilevel+1])(ifine[0]+0,ifine[1]+1,ifine[2]+0) = 1;
-                                    (*m_ref_masks[ilevel+1])(ifine[0]+0,ifine[1]+1,ifine[2]+1) = 1;
-                                    (*m_ref_masks[ilevel+1])(ifine[0]+1,ifine[1]+0,ifine[2]+0) = 1;
-                                    (*m_ref_masks[ilevel+1])(ifine[0]+1,ifine[1]+0,ifine[2]+1) = 1;
-                                    (*m_ref_masks[ilevel+1])(ifine[0]+1,ifine[1]+1,ifine[2]+0) = 1;
-                                    (*m_ref_masks[ilevel+1])(ifine[0]+1,ifine[1]+1,ifine[2]+1) = 1;
+                                    m_ref_masks[ilevel+1]->set( ifine[0]+0,ifine[1]+0,ifine[2]+0, 1 );
+                                    m_ref_masks[ilevel+1]->set( ifine[0]+0,ifine[1]+0,ifine[2]+1, 1 );
+                                    m_ref_masks[ilevel+1]->set( ifine[0]+0,ifine[1]+1,ifine[2]+0, 1 );
+                                    m_ref_masks[ilevel+1]->set( ifine[0]+0,ifine[1]+1,ifine[2]+1, 1 );
+                                    m_ref_masks[ilevel+1]->set( ifine[0]+1,ifine[1]+0,ifine[2]+0, 1 );
+                                    m_ref_masks[ilevel+1]->set( ifine[0]+1,ifine[1]+0,ifine[2]+1, 1 );
+                                    m_ref_masks[ilevel+1]->set( ifine[0]+1,ifine[1]+1,ifine[2]+0, 1 );
+                                    m_ref_masks[ilevel+1]->set( ifine[0]+1,ifine[1]+1,ifine[2]+1, 1 );
                                     
                                 }
                             }
@@ -844,7 +1633,7 @@ public:
         
 
         if( bhave_refmask ){
-            return (*m_ref_masks[ilevel])(i,j,k)==2;
+            return m_ref_masks[ilevel]->is_refined(i,j,k);
         }
         
         if( !bhave_refmask && ilevel == levelmax() )
@@ -867,15 +1656,33 @@ public:
         
 
         if( bhave_refmask ){
-            return ((*m_ref_masks[ilevel])(i,j,k)>=0);
+            return m_ref_masks[ilevel]->is_in_mask(i,j,k);
         }
         
         return true;
     }
 	
+	//! the first cell at or after k in row (i,j) of a level that is in the mask and not refined
+	/*! returns size(ilevel,2) if there is none, loops over the leaf cells of a row can be written
+	 *  as for( k=next_leaf(ilevel,i,j,0); k<nz; k=next_leaf(ilevel,i,j,k+1) ), skipping refined
+	 *  spans a word of the mask at a time
+	 */
+	int next_leaf( unsigned ilevel, int i, int j, int k ) const
+	{
+		int nz = (int)size(ilevel,2);
+		
+		if( bhave_refmask )
+			return (int)m_ref_masks[ilevel]->next_leaf( i, j, std::min(k,nz) );
+		
+		while( k < nz && !(is_in_mask(ilevel,i,j,k) && !is_refined(ilevel,i,j,k)) )
+			++k;
+		return std::min(k,nz);
+	}
+	
 	//! sets the values of all grids on all levels to zero
 	void zero( void )
 	{
+		reallocate_spilled();
 		for( unsigned i=0; i<m_pgrids.size(); ++i )
 			m_pgrids[i]->zero();
 	}
@@ -892,11 +1699,19 @@ public:
 		size_t npcount = 0;
 		
 		for( int ilevel=lmax; ilevel>=(int)lmin; --ilevel )
+		{
+			if( bhave_refmask )
+			{
+				npcount += m_ref_masks[ilevel]->count_leaves();
+				continue;
+			}
+			
 			for( unsigned i=0; i<get_grid(ilevel)->size(0); ++i )
 				for( unsigned j=0; j<get_grid(ilevel)->size(1); ++j )
 					for( unsigned k=0; k<get_grid(ilevel)->size(2); ++k )
 						if( is_in_mask(ilevel,i,j,k) && !is_refined(ilevel,i,j,k) )
                             ++npcount;
+		}
 		
 		return npcount;
 	}
@@ -945,10 +1760,49 @@ public:
         for( unsigned i=0; i<= lmax; ++i )
             m_ref_masks.push_back( new refinement_mask(size(i,0),size(i,1),size(i,2),(short)(i!=lmax)) );
 	}
-	
+
+	//! create a unigrid hierarchy that holds only the planes xoff...xoff+nslab-1 of the base grid
+	/*! the coarser levels are left empty, for runs distributed with fft_mpi
+	 * @param lmax the level of the base grid
+	 * @param nslab the number of planes along x held here
+	 * @param xoff the first plane held here
+	 */
+	void create_base_slab( unsigned lmax, size_t nslab, int xoff )
+	{
+		size_t n = 1<<lmax;
+
+		this->deallocate();
+
+		m_pgrids.clear();
+
+		m_xoffabs.clear();
+		m_yoffabs.clear();
+		m_zoffabs.clear();
+
+		for( unsigned i=0; i< lmax; ++i )
+		{
+			m_pgrids.push_back( new MeshvarBnd<T>( m_nbnd, 0, 0, 0, 0, 0, 0 ) );
+			m_xoffabs.push_back( 0 );
+			m_yoffabs.push_back( 0 );
+			m_zoffabs.push_back( 0 );
+		}
+
+		m_pgrids.push_back( new MeshvarBnd<T>( m_nbnd, nslab, n, n, 0, 0, 0 ) );
+		m_pgrids[lmax]->zero();
+		m_xoffabs.push_back( xoff );
+		m_yoffabs.push_back( 0 );
+		m_zoffabs.push_back( 0 );
+
+		m_levelmin = lmax;
+
+		for( unsigned i=0; i<= lmax; ++i )
+			m_ref_masks.push_back( new refinement_mask(size(i,0),size(i,1),size(i,2),(short)(i!=lmax)) );
+	}
+
 	//! multiply entire grid hierarchy by a constant
 	GridHierarchy<T>& operator*=( T x )
 	{
+		fetch();
 		for( unsigned i=0; i<m_pgrids.size(); ++i )
 			(*m_pgrids[i]) *= x;
 		return *this;
@@ -957,6 +1811,7 @@ public:
 	//! divide entire grid hierarchy by a constant
 	GridHierarchy<T>& operator/=( T x )
 	{
+		fetch();
 		for( unsigned i=0; i<m_pgrids.size(); ++i )
 			(*m_pgrids[i]) /= x;
 		return *this;
@@ -965,6 +1820,7 @@ public:
 	//! add a constant to the entire grid hierarchy
 	GridHierarchy<T>& operator+=( T x )
 	{
+		fetch();
 		for( unsigned i=0; i<m_pgrids.size(); ++i )
 			(*m_pgrids[i]) += x;
 		return *this;
@@ -973,6 +1829,7 @@ public:
 	//! subtract a constant from the entire grid hierarchy
 	GridHierarchy<T>& operator-=( T x )
 	{
+		fetch();
 		for( unsigned i=0; i<m_pgrids.size(); ++i )
 			(*m_pgrids[i]) -= x;
 		return *this;
@@ -986,6 +1843,7 @@ public:
             LOGERR("GridHierarchy::operator*= : attempt to operate on incompatible data");
             throw std::runtime_error("GridHierarchy::operator*= : attempt to operate on incompatible data");
 		}
+		fetch();
 		for( unsigned i=0; i<m_pgrids.size(); ++i )
 			(*m_pgrids[i]) *= *gh.get_grid(i);
 		return *this;
@@ -999,6 +1857,7 @@ public:
             LOGERR("GridHierarchy::operator/= : attempt to operate on incompatible data");
             throw std::runtime_error("GridHierarchy::operator/= : attempt to operate on incompatible data");
 		}
+		fetch();
 		for( unsigned i=0; i<m_pgrids.size(); ++i )
 			(*m_pgrids[i]) /= *gh.get_grid(i);
 		return *this;
@@ -1010,6 +1869,7 @@ public:
 		if( !is_consistent(gh) )
 			throw std::runtime_error("GridHierarchy::operator+= : attempt to operate on incompatible data");
 		
+		fetch();
 		for( unsigned i=0; i<m_pgrids.size(); ++i )
 			(*m_pgrids[i]) += *gh.get_grid(i);
 		return *this;
@@ -1023,24 +1883,92 @@ public:
             LOGERR("GridHierarchy::operator-= : attempt to operate on incompatible data");
             throw std::runtime_error("GridHierarchy::operator-= : attempt to operate on incompatible data");
 		}
+		fetch();
 		for( unsigned i=0; i<m_pgrids.size(); ++i )
 			(*m_pgrids[i]) -= *gh.get_grid(i);
 		return *this;
 	}
 	
+	//! exchange the level data with a hierarchy of identical structure
+	void swap_data( GridHierarchy<T>& gh )
+	{
+		if( !is_consistent(gh) )
+		{
+			LOGERR("Attempt to swap data of incompatible grid hierarchies.");
+			throw std::runtime_error("GridHierarchy::swap_data : attempt to operate on incompatible data");
+		}
+		m_pgrids.swap( gh.m_pgrids );
+		m_spilled.swap( gh.m_spilled );
+		m_streamed.swap( gh.m_streamed );
+		m_resident.swap( gh.m_resident );
+		m_readers.swap( gh.m_readers );
+		m_stream_epoch = new_stream_epoch();
+		gh.m_stream_epoch = new_stream_epoch();
+	}
+	
+	//! exchange everything, including the structure, with another hierarchy
+	void swap_all( GridHierarchy<T>& gh )
+	{
+		std::swap( m_nbnd, gh.m_nbnd );
+		std::swap( m_levelmin, gh.m_levelmin );
+		m_pgrids.swap( gh.m_pgrids );
+		m_spilled.swap( gh.m_spilled );
+		m_streamed.swap( gh.m_streamed );
+		m_resident.swap( gh.m_resident );
+		m_readers.swap( gh.m_readers );
+		m_stream_epoch = new_stream_epoch();
+		gh.m_stream_epoch = new_stream_epoch();
+		m_xoffabs.swap( gh.m_xoffabs );
+		m_yoffabs.swap( gh.m_yoffabs );
+		m_zoffabs.swap( gh.m_zoffabs );
+		m_ref_masks.swap( gh.m_ref_masks );
+		std::swap( bhave_refmask, gh.bhave_refmask );
+	}
+	
+	//! move assignment, takes over all levels of gh which is left empty
+	GridHierarchy<T>& operator=( GridHierarchy<T>&& gh )
+	{
+		if( this != &gh )
+		{
+			this->deallocate();
+			bhave_refmask = false;
+			swap_all( gh );
+		}
+		return *this;
+	}
+	
+	//! give this hierarchy the levels, offsets and masks of gh, without copying the data
+	void assign_shape( const GridHierarchy<T>& gh )
+	{
+		if( !is_consistent(gh) )
+		{
+			discard_spilled();
+			for( unsigned i=0; i<m_pgrids.size(); ++i )
+				delete m_pgrids[i];
+			m_pgrids.clear();
+			
+			//... only the shape of the levels of gh is used, they need not be in memory
+			for( unsigned i=0; i<=gh.levelmax(); ++i )
+				m_pgrids.push_back( new MeshvarBnd<T>( *gh.m_pgrids[i], false ) );
+			m_levelmin = gh.levelmin();
+			m_nbnd = gh.m_nbnd;
+			
+			m_xoffabs = gh.m_xoffabs;
+			m_yoffabs = gh.m_yoffabs;
+			m_zoffabs = gh.m_zoffabs;
+		}
+		
+		copy_masks( gh );
+	}
+	
 	//! assign (element-wise) two grid hierarchies
 	GridHierarchy<T>& operator=( const GridHierarchy<T>& gh )
 	{
-        bhave_refmask = gh.bhave_refmask;
-
-        if( bhave_refmask )
-        {
-            for( unsigned i=0; i<=gh.levelmax(); ++i )
-                m_ref_masks.push_back( new refinement_mask( *(gh.m_ref_masks[i]) ) );
-        }
+		copy_masks( gh );
       
 		if( !is_consistent(gh) )
 		{
+			discard_spilled();
 			for( unsigned i=0; i<m_pgrids.size(); ++i )
 				delete m_pgrids[i];
 			m_pgrids.clear();
@@ -1058,6 +1986,8 @@ public:
 			return *this;
 		}//throw std::runtime_error("GridHierarchy::operator= : attempt to operate on incompatible data");
 		
+		//... every level is overwritten, spilled data need not be read back
+		reallocate_spilled();
 		for( unsigned i=0; i<m_pgrids.size(); ++i )
 			(*m_pgrids[i]) = *gh.get_grid(i);
 		return *this;
@@ -1095,6 +2025,7 @@ public:
 	 */
 	void add_patch( unsigned xoff, unsigned yoff, unsigned zoff, unsigned nx, unsigned ny, unsigned nz )
 	{
+		//... the existing levels are not touched and may stay in their scratch files
 		m_pgrids.push_back( new MeshvarBnd<T>( m_nbnd, nx, ny, nz, xoff, yoff, zoff ) );
 		m_pgrids.back()->zero();
 		
@@ -1117,6 +2048,8 @@ public:
 	 */
 	void cut_patch( unsigned ilevel, unsigned xoff, unsigned yoff, unsigned zoff, unsigned nx, unsigned ny, unsigned nz)
 	{
+		end_stream( true );
+		fetch_level( ilevel );
 		unsigned dx,dy,dz,dxtop,dytop,dztop;
 		
 		dx = xoff-m_xoffabs[ilevel];
@@ -1158,6 +2091,10 @@ public:
 
   void cut_patch_enforce_top_density( unsigned ilevel, unsigned xoff, unsigned yoff, unsigned zoff, unsigned nx, unsigned ny, unsigned nz)
   {
+    end_stream( true );
+    fetch_level( ilevel );
+    if( ilevel > 0 )
+      fetch_level( ilevel-1 );
     unsigned dx,dy,dz,dxtop,dytop,dztop;
 		
     dx = xoff-m_xoffabs[ilevel];
@@ -10,6 +10,9 @@
 #ifndef __MG_INTERP_HH
 #define __MG_INTERP_HH
 
+#include <map>
+#include <vector>
+
 #include "mg_operators.hh"
 
 
@@ -20,6 +23,77 @@ struct coarse_fine_interpolation
 	{ }
 };
 
+/*!
+ * @brief ghost cells of a refinement patch at which the flux-corrected interpolators work
+ *
+ * The interpolators treat the ghost zone face by face in blocks of 2x2 fine cells,
+ * i.e. at the cells of a face whose two tangential indices are even. These are
+ * listed once per patch size, grouped by the face normal, so that each axis can be
+ * processed in equal static chunks instead of searching the whole patch volume.
+ * The blocks of one axis never overlap. With edges=false the blocks adjacent to
+ * the ghost edges (tangential index == n) are left out.
+ */
+struct bnd_face_tasks
+{
+	enum face_t { left, right, bottom, top, front, back };
+
+	struct task
+	{
+		int ix, iy, iz, face;
+	};
+
+	std::vector<task> tasks[3];
+
+	static const bnd_face_tasks& get( int nx, int ny, int nz, bool edges )
+	{
+		static std::map< std::vector<int>, bnd_face_tasks > cache;
+
+		std::vector<int> key(4);
+		key[0] = nx; key[1] = ny; key[2] = nz; key[3] = edges;
+
+		const bnd_face_tasks *pft;
+
+		#pragma omp critical(bnd_face_tasks)
+		{
+			std::map< std::vector<int>, bnd_face_tasks >::iterator it = cache.find( key );
+
+			if( it == cache.end() )
+			{
+				it = cache.insert( std::make_pair( key, bnd_face_tasks() ) ).first;
+				it->second.build( nx, ny, nz, edges );
+			}
+
+			pft = &it->second;
+		}
+
+		return *pft;
+	}
+
+protected:
+	void build( int nx, int ny, int nz, bool edges )
+	{
+		int n[3] = { nx, ny, nz }, e = edges? 1 : 0;
+
+		for( int idir=0; idir<3; ++idir )
+		{
+			int d1 = (idir+1)%3, d2 = (idir+2)%3;
+
+			for( int iside=0; iside<2; ++iside )
+				for( int i1=0; i1<n[d1]+e; i1+=2 )
+					for( int i2=0; i2<n[d2]+e; i2+=2 )
+					{
+						int ii[3];
+						ii[idir] = iside? n[idir] : -1;
+						ii[d1] = i1;
+						ii[d2] = i2;
+
+						task t = { ii[0], ii[1], ii[2], 2*idir+iside };
+						tasks[idir].push_back( t );
+					}
+		}
+	}
+};
+
 
 //! general 2nd order polynomial interpolation
 inline real_t interp2( real_t x1, real_t x2, real_t x3, real_t f1, real_t f2, real_t f3, real_t x )
@@ -460,177 +534,176 @@ struct interp_O3_fluxcorr
 			ny = u->size(1), 
 			nz = u->size(2);
 		
-		//... set boundary condition for fine grid
-		#pragma omp parallel for schedule(dynamic)
-		for( int ix=-1; ix<=nx; ++ix )
-			for( int iy=-1; iy<=ny; ++iy )
-				for( int iz=-1; iz<=nz; ++iz )
+		//... set boundary condition for fine grid, one axis after the other so that
+		//... the faces of an axis can read the completed ghost zones of earlier ones
+		const bnd_face_tasks& ftasks = bnd_face_tasks::get( nx, ny, nz, false );
+		
+		for( int idir=0; idir<3; ++idir )
+		{
+			const std::vector<bnd_face_tasks::task>& tl = ftasks.tasks[idir];
+			int ntasks = (int)tl.size();
+			
+			#pragma omp parallel for schedule(static)
+			for( int itask=0; itask<ntasks; ++itask )
+			{
+				int ix = tl[itask].ix, iy = tl[itask].iy, iz = tl[itask].iz, face = tl[itask].face;
+				
+				int ixtop = (int)(0.5*(real_t)(ix))+xoff;
+				int iytop = (int)(0.5*(real_t)(iy))+yoff;
+				int iztop = (int)(0.5*(real_t)(iz))+zoff;
+				
+				if( ix==-1 ) ixtop=xoff-1;
+				if( iy==-1 ) iytop=yoff-1;
+				if( iz==-1 ) iztop=zoff-1;
+				
+				real_t ustar1, ustar2, ustar3, uhat;			
+				real_t fac = 0.5;//0.25;
+				real_t flux;;
+				// left boundary
+				if( face == bnd_face_tasks::left )
 				{
-					bool xbnd=(ix==-1||ix==nx),ybnd=(iy==-1||iy==ny),zbnd=(iz==-1||iz==nz);
-					
-					if( xbnd || ybnd || zbnd )
-					{
-						
-						//... only deal with proper ghostzones
-						if( (xbnd&&ybnd) || (xbnd&&zbnd) || (ybnd&&zbnd) || (xbnd&&ybnd&&zbnd))
-							continue;
-						
-						int ixtop = (int)(0.5*(real_t)(ix))+xoff;
-						int iytop = (int)(0.5*(real_t)(iy))+yoff;
-						int iztop = (int)(0.5*(real_t)(iz))+zoff;
-						
-						if( ix==-1 ) ixtop=xoff-1;
-						if( iy==-1 ) iytop=yoff-1;
-						if( iz==-1 ) iztop=zoff-1;
-						
-						real_t ustar1, ustar2, ustar3, uhat;			
-						real_t fac = 0.5;//0.25;
-						real_t flux;;
-						// left boundary
-						if( ix == -1 && iy%2==0 && iz%2==0 )
-						{
-							flux = 0.0;
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{		
-									ustar1 = interp2( (*utop)(ixtop,iytop-1,iztop-1),(*utop)(ixtop,iytop,iztop-1),(*utop)(ixtop,iytop+1,iztop-1), fac*((real_t)j-0.5) );
-									ustar2 = interp2( (*utop)(ixtop,iytop-1,iztop),(*utop)(ixtop,iytop,iztop),(*utop)(ixtop,iytop+1,iztop), fac*((real_t)j-0.5) );
-									ustar3 = interp2( (*utop)(ixtop,iytop-1,iztop+1),(*utop)(ixtop,iytop,iztop+1),(*utop)(ixtop,iytop+1,iztop+1), fac*((real_t)j-0.5) );
-									
-									uhat   = interp2( ustar1, ustar2, ustar3, fac*((real_t)k-0.5) );
-									
-									(*u)(ix,iy+j,iz+k) = interp2left( uhat, (*u)(ix+1,iy+j,iz+k), (*u)(ix+2,iy+j,iz+k) );
-									
-									flux += ((*u)(ix+1,iy+j,iz+k)-(*u)(ix,iy+j,iz+k));
-								}
+					flux = 0.0;
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+						{		
+							ustar1 = interp2( (*utop)(ixtop,iytop-1,iztop-1),(*utop)(ixtop,iytop,iztop-1),(*utop)(ixtop,iytop+1,iztop-1), fac*((real_t)j-0.5) );
+							ustar2 = interp2( (*utop)(ixtop,iytop-1,iztop),(*utop)(ixtop,iytop,iztop),(*utop)(ixtop,iytop+1,iztop), fac*((real_t)j-0.5) );
+							ustar3 = interp2( (*utop)(ixtop,iytop-1,iztop+1),(*utop)(ixtop,iytop,iztop+1),(*utop)(ixtop,iytop+1,iztop+1), fac*((real_t)j-0.5) );
+							
+							uhat   = interp2( ustar1, ustar2, ustar3, fac*((real_t)k-0.5) );
 							
-							flux /= 4.0;
+							(*u)(ix,iy+j,iz+k) = interp2left( uhat, (*u)(ix+1,iy+j,iz+k), (*u)(ix+2,iy+j,iz+k) );
 							
-							real_t dflux = ((*utop)(ixtop+1,iytop,iztop)-(*utop)(ixtop,iytop,iztop))/2.0 - flux;
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-									(*u)(ix,iy+j,iz+k) -= dflux;
+							flux += ((*u)(ix+1,iy+j,iz+k)-(*u)(ix,iy+j,iz+k));
 						}
-						// right boundary
-						if( ix == nx && iy%2==0 && iz%2==0 )
-						{
-							flux = 0.0;
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{		
-									ustar1 = interp2( (*utop)(ixtop,iytop-1,iztop-1),(*utop)(ixtop,iytop,iztop-1),(*utop)(ixtop,iytop+1,iztop-1), fac*((real_t)j-0.5) );
-									ustar2 = interp2( (*utop)(ixtop,iytop-1,iztop),(*utop)(ixtop,iytop,iztop),(*utop)(ixtop,iytop+1,iztop), fac*((real_t)j-0.5) );
-									ustar3 = interp2( (*utop)(ixtop,iytop-1,iztop+1),(*utop)(ixtop,iytop,iztop+1),(*utop)(ixtop,iytop+1,iztop+1), fac*((real_t)j-0.5) );
-									
-									uhat   = interp2( -1.0, 0.0, 1.0, ustar1, ustar2, ustar3, fac*((real_t)k-0.5) );
-									
-									(*u)(ix,iy+j,iz+k) = interp2right( (*u)(ix-2,iy+j,iz+k), (*u)(ix-1,iy+j,iz+k), uhat );
-									flux += ((*u)(ix,iy+j,iz+k)-(*u)(ix-1,iy+j,iz+k));
-								}
-							flux /= 4.0;
-							real_t dflux = ((*utop)(ixtop,iytop,iztop)-(*utop)(ixtop-1,iytop,iztop))/2.0 - flux;
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-									(*u)(ix,iy+j,iz+k) += dflux;
+					
+					flux /= 4.0;
+					
+					real_t dflux = ((*utop)(ixtop+1,iytop,iztop)-(*utop)(ixtop,iytop,iztop))/2.0 - flux;
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+							(*u)(ix,iy+j,iz+k) -= dflux;
+				}
+				// right boundary
+				if( face == bnd_face_tasks::right )
+				{
+					flux = 0.0;
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+						{		
+							ustar1 = interp2( (*utop)(ixtop,iytop-1,iztop-1),(*utop)(ixtop,iytop,iztop-1),(*utop)(ixtop,iytop+1,iztop-1), fac*((real_t)j-0.5) );
+							ustar2 = interp2( (*utop)(ixtop,iytop-1,iztop),(*utop)(ixtop,iytop,iztop),(*utop)(ixtop,iytop+1,iztop), fac*((real_t)j-0.5) );
+							ustar3 = interp2( (*utop)(ixtop,iytop-1,iztop+1),(*utop)(ixtop,iytop,iztop+1),(*utop)(ixtop,iytop+1,iztop+1), fac*((real_t)j-0.5) );
+							
+							uhat   = interp2( -1.0, 0.0, 1.0, ustar1, ustar2, ustar3, fac*((real_t)k-0.5) );
+							
+							(*u)(ix,iy+j,iz+k) = interp2right( (*u)(ix-2,iy+j,iz+k), (*u)(ix-1,iy+j,iz+k), uhat );
+							flux += ((*u)(ix,iy+j,iz+k)-(*u)(ix-1,iy+j,iz+k));
 						}
+					flux /= 4.0;
+					real_t dflux = ((*utop)(ixtop,iytop,iztop)-(*utop)(ixtop-1,iytop,iztop))/2.0 - flux;
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+							(*u)(ix,iy+j,iz+k) += dflux;
+				}
 
-						// bottom boundary
-						if( iy == -1 && ix%2==0 && iz%2==0 )
+				// bottom boundary
+				if( face == bnd_face_tasks::bottom )
+				{
+					flux = 0.0;
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
 						{
-							flux = 0.0;
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{
-									ustar1 = interp2( (*utop)(ixtop-1,iytop,iztop-1),(*utop)(ixtop,iytop,iztop-1),(*utop)(ixtop+1,iytop,iztop-1), fac*(j-0.5) );
-									ustar2 = interp2( (*utop)(ixtop-1,iytop,iztop),(*utop)(ixtop,iytop,iztop),(*utop)(ixtop+1,iytop,iztop), fac*(j-0.5) );
-									ustar3 = interp2( (*utop)(ixtop-1,iytop,iztop+1),(*utop)(ixtop,iytop,iztop+1),(*utop)(ixtop+1,iytop,iztop+1), fac*(j-0.5) );
-									
-									uhat   = interp2( -1.0, 0.0, 1.0, ustar1, ustar2, ustar3, fac*((real_t)k-0.5) );
-									
-									(*u)(ix+j,iy,iz+k) = interp2left( uhat, (*u)(ix+j,iy+1,iz+k), (*u)(ix+j,iy+2,iz+k) );
-									
-									flux += ((*u)(ix+j,iy+1,iz+k)-(*u)(ix+j,iy,iz+k));
-								}
-							flux /= 4.0;
-							real_t dflux = ((*utop)(ixtop,iytop+1,iztop)-(*utop)(ixtop,iytop,iztop))/2.0 - flux;
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-									(*u)(ix+j,iy,iz+k) -= dflux;
+							ustar1 = interp2( (*utop)(ixtop-1,iytop,iztop-1),(*utop)(ixtop,iytop,iztop-1),(*utop)(ixtop+1,iytop,iztop-1), fac*(j-0.5) );
+							ustar2 = interp2( (*utop)(ixtop-1,iytop,iztop),(*utop)(ixtop,iytop,iztop),(*utop)(ixtop+1,iytop,iztop), fac*(j-0.5) );
+							ustar3 = interp2( (*utop)(ixtop-1,iytop,iztop+1),(*utop)(ixtop,iytop,iztop+1),(*utop)(ixtop+1,iytop,iztop+1), fac*(j-0.5) );
+							
+							uhat   = interp2( -1.0, 0.0, 1.0, ustar1, ustar2, ustar3, fac*((real_t)k-0.5) );
+							
+							(*u)(ix+j,iy,iz+k) = interp2left( uhat, (*u)(ix+j,iy+1,iz+k), (*u)(ix+j,iy+2,iz+k) );
+							
+							flux += ((*u)(ix+j,iy+1,iz+k)-(*u)(ix+j,iy,iz+k));
 						}
-						// top boundary
-						if( iy == ny && ix%2==0 && iz%2==0 )
-						{
-							flux = 0.0;
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{		
-									ustar1 = interp2( (*utop)(ixtop-1,iytop,iztop-1),(*utop)(ixtop,iytop,iztop-1),(*utop)(ixtop+1,iytop,iztop-1), fac*(j-0.5) );
-									ustar2 = interp2( (*utop)(ixtop-1,iytop,iztop),(*utop)(ixtop,iytop,iztop),(*utop)(ixtop+1,iytop,iztop), fac*(j-0.5) );
-									ustar3 = interp2( (*utop)(ixtop-1,iytop,iztop+1),(*utop)(ixtop,iytop,iztop+1),(*utop)(ixtop+1,iytop,iztop+1), fac*(j-0.5) );
-									
-									uhat   = interp2( -1.0, 0.0, 1.0, ustar1, ustar2, ustar3, fac*((real_t)k-0.5) );
-									
-									(*u)(ix+j,iy,iz+k) = interp2right( (*u)(ix+j,iy-2,iz+k), (*u)(ix+j,iy-1,iz+k), uhat  );
-									
-									flux += ((*u)(ix+j,iy,iz+k)-(*u)(ix+j,iy-1,iz+k));
-								}
-							flux /= 4.0;
-							real_t dflux = ((*utop)(ixtop,iytop,iztop)-(*utop)(ixtop,iytop-1,iztop))/2.0 - flux;
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-									(*u)(ix+j,iy,iz+k) += dflux;
+					flux /= 4.0;
+					real_t dflux = ((*utop)(ixtop,iytop+1,iztop)-(*utop)(ixtop,iytop,iztop))/2.0 - flux;
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+							(*u)(ix+j,iy,iz+k) -= dflux;
+				}
+				// top boundary
+				if( face == bnd_face_tasks::top )
+				{
+					flux = 0.0;
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+						{		
+							ustar1 = interp2( (*utop)(ixtop-1,iytop,iztop-1),(*utop)(ixtop,iytop,iztop-1),(*utop)(ixtop+1,iytop,iztop-1), fac*(j-0.5) );
+							ustar2 = interp2( (*utop)(ixtop-1,iytop,iztop),(*utop)(ixtop,iytop,iztop),(*utop)(ixtop+1,iytop,iztop), fac*(j-0.5) );
+							ustar3 = interp2( (*utop)(ixtop-1,iytop,iztop+1),(*utop)(ixtop,iytop,iztop+1),(*utop)(ixtop+1,iytop,iztop+1), fac*(j-0.5) );
+							
+							uhat   = interp2( -1.0, 0.0, 1.0, ustar1, ustar2, ustar3, fac*((real_t)k-0.5) );
+							
+							(*u)(ix+j,iy,iz+k) = interp2right( (*u)(ix+j,iy-2,iz+k), (*u)(ix+j,iy-1,iz+k), uhat  );
+							
+							flux += ((*u)(ix+j,iy,iz+k)-(*u)(ix+j,iy-1,iz+k));
 						}
+					flux /= 4.0;
+					real_t dflux = ((*utop)(ixtop,iytop,iztop)-(*utop)(ixtop,iytop-1,iztop))/2.0 - flux;
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+							(*u)(ix+j,iy,iz+k) += dflux;
+				}
 
-						// front boundary
-						if( iz == -1 && ix%2==0 && iy%2==0 )
-						{
-							flux = 0.0;
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{		
-									ustar1 = interp2( (*utop)(ixtop-1,iytop-1,iztop),(*utop)(ixtop,iytop-1,iztop),(*utop)(ixtop+1,iytop-1,iztop), fac*(j-0.5) );
-									ustar2 = interp2( (*utop)(ixtop-1,iytop,iztop),(*utop)(ixtop,iytop,iztop),(*utop)(ixtop+1,iytop,iztop), fac*(j-0.5) );
-									ustar3 = interp2( (*utop)(ixtop-1,iytop+1,iztop),(*utop)(ixtop,iytop+1,iztop),(*utop)(ixtop+1,iytop+1,iztop), fac*(j-0.5) );
-									
-									uhat   = interp2( -1.0, 0.0, 1.0, ustar1, ustar2, ustar3, fac*((real_t)k-0.5) );
-									
-									(*u)(ix+j,iy+k,iz) = interp2left( uhat, (*u)(ix+j,iy+k,iz+1), (*u)(ix+j,iy+k,iz+2) );
-									
-									flux += ((*u)(ix+j,iy+k,iz+1)-(*u)(ix+j,iy+k,iz));
-								}
-							flux /= 4.0;
-							real_t dflux = ((*utop)(ixtop,iytop,iztop+1)-(*utop)(ixtop,iytop,iztop))/2.0 - flux;
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-									(*u)(ix+j,iy+k,iz) -= dflux;
+				// front boundary
+				if( face == bnd_face_tasks::front )
+				{
+					flux = 0.0;
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+						{		
+							ustar1 = interp2( (*utop)(ixtop-1,iytop-1,iztop),(*utop)(ixtop,iytop-1,iztop),(*utop)(ixtop+1,iytop-1,iztop), fac*(j-0.5) );
+							ustar2 = interp2( (*utop)(ixtop-1,iytop,iztop),(*utop)(ixtop,iytop,iztop),(*utop)(ixtop+1,iytop,iztop), fac*(j-0.5) );
+							ustar3 = interp2( (*utop)(ixtop-1,iytop+1,iztop),(*utop)(ixtop,iytop+1,iztop),(*utop)(ixtop+1,iytop+1,iztop), fac*(j-0.5) );
+							
+							uhat   = interp2( -1.0, 0.0, 1.0, ustar1, ustar2, ustar3, fac*((real_t)k-0.5) );
+							
+							(*u)(ix+j,iy+k,iz) = interp2left( uhat, (*u)(ix+j,iy+k,iz+1), (*u)(ix+j,iy+k,iz+2) );
+							
+							flux += ((*u)(ix+j,iy+k,iz+1)-(*u)(ix+j,iy+k,iz));
 						}
+					flux /= 4.0;
+					real_t dflux = ((*utop)(ixtop,iytop,iztop+1)-(*utop)(ixtop,iytop,iztop))/2.0 - flux;
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+							(*u)(ix+j,iy+k,iz) -= dflux;
+				}
 
-						// back boundary
-						if( iz == nz && ix%2==0 && iy%2==0 )
-						{
-							flux = 0.0;
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{		
-									ustar1 = interp2( (*utop)(ixtop-1,iytop-1,iztop),(*utop)(ixtop,iytop-1,iztop),(*utop)(ixtop+1,iytop-1,iztop), fac*(j-0.5) );
-									ustar2 = interp2( (*utop)(ixtop-1,iytop,iztop),(*utop)(ixtop,iytop,iztop),(*utop)(ixtop+1,iytop,iztop), fac*(j-0.5) );
-									ustar3 = interp2( (*utop)(ixtop-1,iytop+1,iztop),(*utop)(ixtop,iytop+1,iztop),(*utop)(ixtop+1,iytop+1,iztop), fac*(j-0.5) );
-									
-									uhat   = interp2( -1.0, 0.0, 1.0, ustar1, ustar2, ustar3, fac*((real_t)k-0.5) );
-									
-									(*u)(ix+j,iy+k,iz) = interp2right( (*u)(ix+j,iy+k,iz-2), (*u)(ix+j,iy+k,iz-1), uhat );
-									
-									flux += ((*u)(ix+j,iy+k,iz)-(*u)(ix+j,iy+k,iz-1));
-								}
-							flux /= 4.0;
-							real_t dflux = ((*utop)(ixtop,iytop,iztop)-(*utop)(ixtop,iytop,iztop-1))/2.0 - flux;
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-									(*u)(ix+j,iy+k,iz) += dflux;
+				// back boundary
+				if( face == bnd_face_tasks::back )
+				{
+					flux = 0.0;
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+						{		
+							ustar1 = interp2( (*utop)(ixtop-1,iytop-1,iztop),(*utop)(ixtop,iytop-1,iztop),(*utop)(ixtop+1,iytop-1,iztop), fac*(j-0.5) );
+							ustar2 = interp2( (*utop)(ixtop-1,iytop,iztop),(*utop)(ixtop,iytop,iztop),(*utop)(ixtop+1,iytop,iztop), fac*(j-0.5) );
+							ustar3 = interp2( (*utop)(ixtop-1,iytop+1,iztop),(*utop)(ixtop,iytop+1,iztop),(*utop)(ixtop+1,iytop+1,iztop), fac*(j-0.5) );
+							
+							uhat   = interp2( -1.0, 0.0, 1.0, ustar1, ustar2, ustar3, fac*((real_t)k-0.5) );
+							
+							(*u)(ix+j,iy+k,iz) = interp2right( (*u)(ix+j,iy+k,iz-2), (*u)(ix+j,iy+k,iz-1), uhat );
+							
+							flux += ((*u)(ix+j,iy+k,iz)-(*u)(ix+j,iy+k,iz-1));
 						}
-						
-					}
+					flux /= 4.0;
+					real_t dflux = ((*utop)(ixtop,iytop,iztop)-(*utop)(ixtop,iytop,iztop-1))/2.0 - flux;
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+							(*u)(ix+j,iy+k,iz) += dflux;
 				}
+				
+			}
+		}
 		
 	}
 };
@@ -668,277 +741,279 @@ struct interp_O5_fluxcorr
 		ny = u->size(1), 
 		nz = u->size(2);
 		
-		//... set boundary condition for fine grid
-		#pragma omp parallel for schedule(dynamic)
-		for( int ix=-1; ix<=nx; ++ix )
-			for( int iy=-1; iy<=ny; ++iy )
-				for( int iz=-1; iz<=nz; ++iz )
+		//... set boundary condition for fine grid, one axis after the other so that
+		//... the faces of an axis can read the completed ghost zones of earlier ones
+		const bnd_face_tasks& ftasks = bnd_face_tasks::get( nx, ny, nz, true );
+		
+		for( int idir=0; idir<3; ++idir )
+		{
+			const std::vector<bnd_face_tasks::task>& tl = ftasks.tasks[idir];
+			int ntasks = (int)tl.size();
+			
+			#pragma omp parallel for schedule(static)
+			for( int itask=0; itask<ntasks; ++itask )
+			{
+				int ix = tl[itask].ix, iy = tl[itask].iy, iz = tl[itask].iz, face = tl[itask].face;
+				
+				int ixtop = (int)(0.5*(real_t)(ix))+xoff;
+				int iytop = (int)(0.5*(real_t)(iy))+yoff;
+				int iztop = (int)(0.5*(real_t)(iz))+zoff;
+				
+				if( ix==-1 ) ixtop=xoff-1;
+				if( iy==-1 ) iytop=yoff-1;
+				if( iz==-1 ) iztop=zoff-1;
+				
+				real_t ustar[5], uhat[2];			
+				real_t fac = 0.5;
+				
+				real_t coarse_flux, fine_flux, dflux;
+				
+				real_t ffac = 12./14.;
+							
+				// left boundary
+				if( face == bnd_face_tasks::left )
 				{
-					bool xbnd=(ix==-1||ix==nx),ybnd=(iy==-1||iy==ny),zbnd=(iz==-1||iz==nz);
-					bool bnd=xbnd|ybnd|zbnd;
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+						{		
+							for( int p=0; p<2; ++p )
+							{
+								for( int q=-2;q<=2;++q )
+									ustar[q+2] = interp4( (*utop)(ixtop+p-1,iytop-2,iztop+q), (*utop)(ixtop+p-1,iytop-1,iztop+q), 
+														(*utop)(ixtop+p-1,iytop,iztop+q),   (*utop)(ixtop+p-1,iytop+1,iztop+q), 
+														(*utop)(ixtop+p-1,iytop+2,iztop+q), fac*((real_t)j-0.5) );
+								uhat[p] = interp4( ustar, fac*((real_t)k-0.5) );//-1.5 );
+							}
+							
+							(*u)(ix,iy+j,iz+k)   = interp4left( uhat[0], uhat[1], (*u)(ix+1,iy+j,iz+k), 
+															   (*u)(ix+2,iy+j,iz+k), (*u)(ix+3,iy+j,iz+k) );
+							(*u)(ix-1,iy+j,iz+k) = interp4lleft( uhat[0], uhat[1], (*u)(ix+1,iy+j,iz+k), 
+																(*u)(ix+2,iy+j,iz+k), (*u)(ix+3,iy+j,iz+k) );
+						}
 					
-					if( bnd )
-					{
-						
-						int ixtop = (int)(0.5*(real_t)(ix))+xoff;
-						int iytop = (int)(0.5*(real_t)(iy))+yoff;
-						int iztop = (int)(0.5*(real_t)(iz))+zoff;
-						
-						if( ix==-1 ) ixtop=xoff-1;
-						if( iy==-1 ) iytop=yoff-1;
-						if( iz==-1 ) iztop=zoff-1;
-						
-						real_t ustar[5], uhat[2];			
-						real_t fac = 0.5;
-						
-						real_t coarse_flux, fine_flux, dflux;
-						
-						real_t ffac = 12./14.;
-									
-						// left boundary
-						if( ix == -1 && iy%2==0 && iz%2==0 )
+					fine_flux = 0.0;
+					fine_flux += Laplace_flux_O4<real_t>().apply_x(-1,*u,ix+1,iy,iz);
+					fine_flux += Laplace_flux_O4<real_t>().apply_x(-1,*u,ix+1,iy+1,iz);
+					fine_flux += Laplace_flux_O4<real_t>().apply_x(-1,*u,ix+1,iy,iz+1);
+					fine_flux += Laplace_flux_O4<real_t>().apply_x(-1,*u,ix+1,iy+1,iz+1);
+					fine_flux /= 4.0;
+					
+					coarse_flux = Laplace_flux_O4<real_t>().apply_x(-1,*utop,ixtop+1,iytop,iztop)/2.0;
+					
+					dflux = coarse_flux - fine_flux;
+					
+					for(int j=0;j<2;++j)
+						for( int k=0;k<2;++k)
 						{
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{		
-									for( int p=0; p<2; ++p )
-									{
-										for( int q=-2;q<=2;++q )
-											ustar[q+2] = interp4( (*utop)(ixtop+p-1,iytop-2,iztop+q), (*utop)(ixtop+p-1,iytop-1,iztop+q), 
-																(*utop)(ixtop+p-1,iytop,iztop+q),   (*utop)(ixtop+p-1,iytop+1,iztop+q), 
-																(*utop)(ixtop+p-1,iytop+2,iztop+q), fac*((real_t)j-0.5) );
-										uhat[p] = interp4( ustar, fac*((real_t)k-0.5) );//-1.5 );
-									}
-									
-									(*u)(ix,iy+j,iz+k)   = interp4left( uhat[0], uhat[1], (*u)(ix+1,iy+j,iz+k), 
-																	   (*u)(ix+2,iy+j,iz+k), (*u)(ix+3,iy+j,iz+k) );
-									(*u)(ix-1,iy+j,iz+k) = interp4lleft( uhat[0], uhat[1], (*u)(ix+1,iy+j,iz+k), 
-																		(*u)(ix+2,iy+j,iz+k), (*u)(ix+3,iy+j,iz+k) );
-								}
-							
-							fine_flux = 0.0;
-							fine_flux += Laplace_flux_O4<real_t>().apply_x(-1,*u,ix+1,iy,iz);
-							fine_flux += Laplace_flux_O4<real_t>().apply_x(-1,*u,ix+1,iy+1,iz);
-							fine_flux += Laplace_flux_O4<real_t>().apply_x(-1,*u,ix+1,iy,iz+1);
-							fine_flux += Laplace_flux_O4<real_t>().apply_x(-1,*u,ix+1,iy+1,iz+1);
-							fine_flux /= 4.0;
-							
-							coarse_flux = Laplace_flux_O4<real_t>().apply_x(-1,*utop,ixtop+1,iytop,iztop)/2.0;
-							
-							dflux = coarse_flux - fine_flux;
-							
-							for(int j=0;j<2;++j)
-								for( int k=0;k<2;++k)
-								{
-									(*u)(ix,iy+j,iz+k)   += ffac*dflux;
-									(*u)(ix-1,iy+j,iz+k) += ffac*dflux;
-								}
-							
+							(*u)(ix,iy+j,iz+k)   += ffac*dflux;
+							(*u)(ix-1,iy+j,iz+k) += ffac*dflux;
+						}
+					
+					
+				}
+				// right boundary
+				if( face == bnd_face_tasks::right )
+				{
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+						{		
+							for( int p=0; p<2; ++p )
+							{
+								for( int q=-2;q<=2;++q )
+									ustar[q+2] = interp4( (*utop)(ixtop+p,iytop-2,iztop+q), (*utop)(ixtop+p,iytop-1,iztop+q), 
+														 (*utop)(ixtop+p,iytop,iztop+q),   (*utop)(ixtop+p,iytop+1,iztop+q), 
+														 (*utop)(ixtop+p,iytop+2,iztop+q), fac*((real_t)j-0.5) );
+								uhat[p] = interp4( ustar, fac*((real_t)k-0.5));//-1.5 );
+							}
 							
+							(*u)(ix,iy+j,iz+k)   = interp4right( (*u)(ix-3,iy+j,iz+k), (*u)(ix-2,iy+j,iz+k), 
+																(*u)(ix-1,iy+j,iz+k), uhat[0], uhat[1] );
+							(*u)(ix+1,iy+j,iz+k) = interp4rright( (*u)(ix-3,iy+j,iz+k), (*u)(ix-2,iy+j,iz+k), 
+																 (*u)(ix-1,iy+j,iz+k), uhat[0], uhat[1] );
 						}
-						// right boundary
-						if( ix == nx && iy%2==0 && iz%2==0 )
+					
+					fine_flux = 0.0;
+					fine_flux += Laplace_flux_O4<real_t>().apply_x(+1,*u,ix,iy,iz);
+					fine_flux += Laplace_flux_O4<real_t>().apply_x(+1,*u,ix,iy+1,iz);
+					fine_flux += Laplace_flux_O4<real_t>().apply_x(+1,*u,ix,iy,iz+1);
+					fine_flux += Laplace_flux_O4<real_t>().apply_x(+1,*u,ix,iy+1,iz+1);
+					
+					coarse_flux = Laplace_flux_O4<real_t>().apply_x(+1,*utop,ixtop,iytop,iztop)/2.0;
+					fine_flux /= 4.0;
+					
+					dflux = coarse_flux - fine_flux;
+					
+					for(int j=0;j<2;++j)
+						for( int k=0;k<2;++k)
 						{
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{		
-									for( int p=0; p<2; ++p )
-									{
-										for( int q=-2;q<=2;++q )
-											ustar[q+2] = interp4( (*utop)(ixtop+p,iytop-2,iztop+q), (*utop)(ixtop+p,iytop-1,iztop+q), 
-																 (*utop)(ixtop+p,iytop,iztop+q),   (*utop)(ixtop+p,iytop+1,iztop+q), 
-																 (*utop)(ixtop+p,iytop+2,iztop+q), fac*((real_t)j-0.5) );
-										uhat[p] = interp4( ustar, fac*((real_t)k-0.5));//-1.5 );
-									}
-									
-									(*u)(ix,iy+j,iz+k)   = interp4right( (*u)(ix-3,iy+j,iz+k), (*u)(ix-2,iy+j,iz+k), 
-																		(*u)(ix-1,iy+j,iz+k), uhat[0], uhat[1] );
-									(*u)(ix+1,iy+j,iz+k) = interp4rright( (*u)(ix-3,iy+j,iz+k), (*u)(ix-2,iy+j,iz+k), 
-																		 (*u)(ix-1,iy+j,iz+k), uhat[0], uhat[1] );
-								}
-							
-							fine_flux = 0.0;
-							fine_flux += Laplace_flux_O4<real_t>().apply_x(+1,*u,ix,iy,iz);
-							fine_flux += Laplace_flux_O4<real_t>().apply_x(+1,*u,ix,iy+1,iz);
-							fine_flux += Laplace_flux_O4<real_t>().apply_x(+1,*u,ix,iy,iz+1);
-							fine_flux += Laplace_flux_O4<real_t>().apply_x(+1,*u,ix,iy+1,iz+1);
-							
-							coarse_flux = Laplace_flux_O4<real_t>().apply_x(+1,*utop,ixtop,iytop,iztop)/2.0;
-							fine_flux /= 4.0;
-							
-							dflux = coarse_flux - fine_flux;
-							
-							for(int j=0;j<2;++j)
-								for( int k=0;k<2;++k)
-								{
-									(*u)(ix,iy+j,iz+k)   += ffac*dflux;
-									(*u)(ix+1,iy+j,iz+k) += ffac*dflux;
-								}
+							(*u)(ix,iy+j,iz+k)   += ffac*dflux;
+							(*u)(ix+1,iy+j,iz+k) += ffac*dflux;
+						}
+					
+				}
+				// bottom boundary
+				if( face == bnd_face_tasks::bottom )
+				{
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+						{	
+							for( int p=0; p<2; ++p )
+							{
+								for( int q=-2;q<=2;++q )
+									ustar[q+2] = interp4( (*utop)(ixtop-2,iytop+p-1,iztop+q), (*utop)(ixtop-1,iytop+p-1,iztop+q), 
+														 (*utop)(ixtop,iytop+p-1,iztop+q),   (*utop)(ixtop+1,iytop+p-1,iztop+q), 
+														 (*utop)(ixtop+2,iytop+p-1,iztop+q), fac*((real_t)j-0.5) );
+								uhat[p] = interp4( ustar, fac*((real_t)k-0.5));//-1.5 );
+							}
 							
+							(*u)(ix+j,iy,iz+k)   = interp4left( uhat[0], uhat[1], (*u)(ix+j,iy+1,iz+k), 
+															   (*u)(ix+j,iy+2,iz+k), (*u)(ix+j,iy+3,iz+k) );									
+							(*u)(ix+j,iy-1,iz+k) = interp4lleft( uhat[0], uhat[1], (*u)(ix+j,iy+1,iz+k), 
+																(*u)(ix+j,iy+2,iz+k), (*u)(ix+j,iy+3,iz+k) );
 						}
-						// bottom boundary
-						if( iy == -1 && ix%2==0 && iz%2==0 )
+					
+					fine_flux = 0.0;
+					fine_flux += Laplace_flux_O4<real_t>().apply_y(-1,*u,ix,iy+1,iz);
+					fine_flux += Laplace_flux_O4<real_t>().apply_y(-1,*u,ix+1,iy+1,iz);
+					fine_flux += Laplace_flux_O4<real_t>().apply_y(-1,*u,ix,iy+1,iz+1);
+					fine_flux += Laplace_flux_O4<real_t>().apply_y(-1,*u,ix+1,iy+1,iz+1);
+					
+					coarse_flux = Laplace_flux_O4<real_t>().apply_y(-1,*utop,ixtop,iytop+1,iztop)/2.0;
+					fine_flux /= 4.0;
+					
+					dflux = coarse_flux - fine_flux;
+					
+					for(int i=0;i<2;++i)
+						for( int k=0;k<2;++k)
 						{
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{	
-									for( int p=0; p<2; ++p )
-									{
-										for( int q=-2;q<=2;++q )
-											ustar[q+2] = interp4( (*utop)(ixtop-2,iytop+p-1,iztop+q), (*utop)(ixtop-1,iytop+p-1,iztop+q), 
-																 (*utop)(ixtop,iytop+p-1,iztop+q),   (*utop)(ixtop+1,iytop+p-1,iztop+q), 
-																 (*utop)(ixtop+2,iytop+p-1,iztop+q), fac*((real_t)j-0.5) );
-										uhat[p] = interp4( ustar, fac*((real_t)k-0.5));//-1.5 );
-									}
-									
-									(*u)(ix+j,iy,iz+k)   = interp4left( uhat[0], uhat[1], (*u)(ix+j,iy+1,iz+k), 
-																	   (*u)(ix+j,iy+2,iz+k), (*u)(ix+j,iy+3,iz+k) );									
-									(*u)(ix+j,iy-1,iz+k) = interp4lleft( uhat[0], uhat[1], (*u)(ix+j,iy+1,iz+k), 
-																		(*u)(ix+j,iy+2,iz+k), (*u)(ix+j,iy+3,iz+k) );
-								}
-							
-							fine_flux = 0.0;
-							fine_flux += Laplace_flux_O4<real_t>().apply_y(-1,*u,ix,iy+1,iz);
-							fine_flux += Laplace_flux_O4<real_t>().apply_y(-1,*u,ix+1,iy+1,iz);
-							fine_flux += Laplace_flux_O4<real_t>().apply_y(-1,*u,ix,iy+1,iz+1);
-							fine_flux += Laplace_flux_O4<real_t>().apply_y(-1,*u,ix+1,iy+1,iz+1);
-							
-							coarse_flux = Laplace_flux_O4<real_t>().apply_y(-1,*utop,ixtop,iytop+1,iztop)/2.0;
-							fine_flux /= 4.0;
-							
-							dflux = coarse_flux - fine_flux;
-							
-							for(int i=0;i<2;++i)
-								for( int k=0;k<2;++k)
-								{
-									(*u)(ix+i,iy,iz+k)   += ffac*dflux;
-									(*u)(ix+i,iy-1,iz+k) += ffac*dflux;
-								}
+							(*u)(ix+i,iy,iz+k)   += ffac*dflux;
+							(*u)(ix+i,iy-1,iz+k) += ffac*dflux;
+						}
+					
+				}
+				// top boundary
+				if( face == bnd_face_tasks::top )
+				{
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+						{	
+							for( int p=0; p<2; ++p )
+							{
+								for( int q=-2;q<=2;++q )
+									ustar[q+2] = interp4( (*utop)(ixtop-2,iytop+p,iztop+q), (*utop)(ixtop-1,iytop+p,iztop+q), 
+														 (*utop)(ixtop,iytop+p,iztop+q),   (*utop)(ixtop+1,iytop+p,iztop+q), 
+														 (*utop)(ixtop+2,iytop+p,iztop+q), fac*((real_t)j-0.5) );
+								uhat[p] = interp4( ustar, fac*((real_t)k-0.5));//+1.5 );
+							}
 							
+							(*u)(ix+j,iy,iz+k)   = interp4right( (*u)(ix+j,iy-3,iz+k), (*u)(ix+j,iy-2,iz+k), 
+																(*u)(ix+j,iy-1,iz+k), uhat[0], uhat[1] );									
+							(*u)(ix+j,iy+1,iz+k) = interp4rright( (*u)(ix+j,iy-3,iz+k), (*u)(ix+j,iy-2,iz+k), 
+																 (*u)(ix+j,iy-1,iz+k), uhat[0], uhat[1] );									
 						}
-						// top boundary
-						if( iy == ny && ix%2==0 && iz%2==0 )
+					
+					fine_flux = 0.0;
+					fine_flux += Laplace_flux_O4<real_t>().apply_y(+1,*u,ix,iy,iz);
+					fine_flux += Laplace_flux_O4<real_t>().apply_y(+1,*u,ix+1,iy,iz);
+					fine_flux += Laplace_flux_O4<real_t>().apply_y(+1,*u,ix,iy,iz+1);
+					fine_flux += Laplace_flux_O4<real_t>().apply_y(+1,*u,ix+1,iy,iz+1);
+					
+					coarse_flux = Laplace_flux_O4<real_t>().apply_y(+1,*utop,ixtop,iytop,iztop)/2.0;
+					fine_flux /= 4.0;
+					
+					dflux = coarse_flux - fine_flux;
+					
+					for(int i=0;i<2;++i)
+						for( int k=0;k<2;++k)
 						{
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{	
-									for( int p=0; p<2; ++p )
-									{
-										for( int q=-2;q<=2;++q )
-											ustar[q+2] = interp4( (*utop)(ixtop-2,iytop+p,iztop+q), (*utop)(ixtop-1,iytop+p,iztop+q), 
-																 (*utop)(ixtop,iytop+p,iztop+q),   (*utop)(ixtop+1,iytop+p,iztop+q), 
-																 (*utop)(ixtop+2,iytop+p,iztop+q), fac*((real_t)j-0.5) );
-										uhat[p] = interp4( ustar, fac*((real_t)k-0.5));//+1.5 );
-									}
-									
-									(*u)(ix+j,iy,iz+k)   = interp4right( (*u)(ix+j,iy-3,iz+k), (*u)(ix+j,iy-2,iz+k), 
-																		(*u)(ix+j,iy-1,iz+k), uhat[0], uhat[1] );									
-									(*u)(ix+j,iy+1,iz+k) = interp4rright( (*u)(ix+j,iy-3,iz+k), (*u)(ix+j,iy-2,iz+k), 
-																		 (*u)(ix+j,iy-1,iz+k), uhat[0], uhat[1] );									
-								}
-							
-							fine_flux = 0.0;
-							fine_flux += Laplace_flux_O4<real_t>().apply_y(+1,*u,ix,iy,iz);
-							fine_flux += Laplace_flux_O4<real_t>().apply_y(+1,*u,ix+1,iy,iz);
-							fine_flux += Laplace_flux_O4<real_t>().apply_y(+1,*u,ix,iy,iz+1);
-							fine_flux += Laplace_flux_O4<real_t>().apply_y(+1,*u,ix+1,iy,iz+1);
-							
-							coarse_flux = Laplace_flux_O4<real_t>().apply_y(+1,*utop,ixtop,iytop,iztop)/2.0;
-							fine_flux /= 4.0;
-							
-							dflux = coarse_flux - fine_flux;
-							
-							for(int i=0;i<2;++i)
-								for( int k=0;k<2;++k)
-								{
-									(*u)(ix+i,iy,iz+k)   += ffac*dflux;
-									(*u)(ix+i,iy+1,iz+k) += ffac*dflux;
-								}
-							
+							(*u)(ix+i,iy,iz+k)   += ffac*dflux;
+							(*u)(ix+i,iy+1,iz+k) += ffac*dflux;
+						}
+					
+					
+				}
+				// front boundary
+				if( face == bnd_face_tasks::front )
+				{
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+						{		
+							for( int p=0; p<2; ++p )
+							{
+								for( int q=-2;q<=2;++q )
+									ustar[q+2] = interp4( (*utop)(ixtop-2,iytop+q,iztop+p-1), (*utop)(ixtop-1,iytop+q,iztop+p-1), 
+														 (*utop)(ixtop,iytop+q,iztop+p-1),   (*utop)(ixtop+1,iytop+q,iztop+p-1), 
+														 (*utop)(ixtop+2,iytop+q,iztop+p-1), fac*((real_t)j-0.5) );
+								uhat[p] = interp4( ustar, fac*((real_t)k-0.5));//-1.5 );
+							}
 							
+							(*u)(ix+j,iy+k,iz)   = interp4left( uhat[0], uhat[1], (*u)(ix+j,iy+k,iz+1), 
+															   (*u)(ix+j,iy+k,iz+2), (*u)(ix+j,iy+k,iz+3) );									
+							(*u)(ix+j,iy+k,iz-1) = interp4lleft( uhat[0], uhat[1], (*u)(ix+j,iy+k,iz+1), 
+																(*u)(ix+j,iy+k,iz+2), (*u)(ix+j,iy+k,iz+3) );
 						}
-						// front boundary
-						if( iz == -1 && ix%2==0 && iy%2==0 )
-						{
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{		
-									for( int p=0; p<2; ++p )
-									{
-										for( int q=-2;q<=2;++q )
-											ustar[q+2] = interp4( (*utop)(ixtop-2,iytop+q,iztop+p-1), (*utop)(ixtop-1,iytop+q,iztop+p-1), 
-																 (*utop)(ixtop,iytop+q,iztop+p-1),   (*utop)(ixtop+1,iytop+q,iztop+p-1), 
-																 (*utop)(ixtop+2,iytop+q,iztop+p-1), fac*((real_t)j-0.5) );
-										uhat[p] = interp4( ustar, fac*((real_t)k-0.5));//-1.5 );
-									}
-									
-									(*u)(ix+j,iy+k,iz)   = interp4left( uhat[0], uhat[1], (*u)(ix+j,iy+k,iz+1), 
-																	   (*u)(ix+j,iy+k,iz+2), (*u)(ix+j,iy+k,iz+3) );									
-									(*u)(ix+j,iy+k,iz-1) = interp4lleft( uhat[0], uhat[1], (*u)(ix+j,iy+k,iz+1), 
-																		(*u)(ix+j,iy+k,iz+2), (*u)(ix+j,iy+k,iz+3) );
-								}
 
+					
+					fine_flux = 0.0;
+					fine_flux += Laplace_flux_O4<real_t>().apply_z(-1,*u,ix,iy,iz+1);
+					fine_flux += Laplace_flux_O4<real_t>().apply_z(-1,*u,ix+1,iy,iz+1);
+					fine_flux += Laplace_flux_O4<real_t>().apply_z(-1,*u,ix,iy+1,iz+1);
+					fine_flux += Laplace_flux_O4<real_t>().apply_z(-1,*u,ix+1,iy+1,iz+1);
+					
+					coarse_flux = Laplace_flux_O4<real_t>().apply_z(-1,*utop,ixtop,iytop,iztop+1)/2.0;
+					fine_flux /= 4.0;
+					
+					dflux = coarse_flux - fine_flux;
+					
+					for(int i=0;i<2;++i)
+						for( int j=0;j<2;++j)
+						{
+							(*u)(ix+i,iy+j,iz)   += ffac*dflux;
+							(*u)(ix+i,iy+j,iz-1) += ffac*dflux;
+						}
+					
+				}
+				// back boundary
+				if( face == bnd_face_tasks::back )
+				{
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+						{		
+							for( int p=0; p<2; ++p )
+							{
+								for( int q=-2;q<=2;++q )
+									ustar[q+2] = interp4( (*utop)(ixtop-2,iytop+q,iztop+p), (*utop)(ixtop-1,iytop+q,iztop+p), 
+														 (*utop)(ixtop,iytop+q,iztop+p),   (*utop)(ixtop+1,iytop+q,iztop+p), 
+														 (*utop)(ixtop+2,iytop+q,iztop+p), fac*((real_t)j-0.5) );
+								uhat[p] = interp4( ustar, fac*((real_t)k-0.5));//+1.5 );
+							}
 							
-							fine_flux = 0.0;
-							fine_flux += Laplace_flux_O4<real_t>().apply_z(-1,*u,ix,iy,iz+1);
-							fine_flux += Laplace_flux_O4<real_t>().apply_z(-1,*u,ix+1,iy,iz+1);
-							fine_flux += Laplace_flux_O4<real_t>().apply_z(-1,*u,ix,iy+1,iz+1);
-							fine_flux += Laplace_flux_O4<real_t>().apply_z(-1,*u,ix+1,iy+1,iz+1);
-							
-							coarse_flux = Laplace_flux_O4<real_t>().apply_z(-1,*utop,ixtop,iytop,iztop+1)/2.0;
-							fine_flux /= 4.0;
-							
-							dflux = coarse_flux - fine_flux;
-							
-							for(int i=0;i<2;++i)
-								for( int j=0;j<2;++j)
-								{
-									(*u)(ix+i,iy+j,iz)   += ffac*dflux;
-									(*u)(ix+i,iy+j,iz-1) += ffac*dflux;
-								}
-							
+							(*u)(ix+j,iy+k,iz)   = interp4right( (*u)(ix+j,iy+k,iz-3), (*u)(ix+j,iy+k,iz-2), 
+																(*u)(ix+j,iy+k,iz-1), uhat[0], uhat[1] );									
+							(*u)(ix+j,iy+k,iz+1) = interp4rright((*u)(ix+j,iy+k,iz-3), (*u)(ix+j,iy+k,iz-2), 
+																 (*u)(ix+j,iy+k,iz-1), uhat[0], uhat[1] );
 						}
-						// back boundary
-						if( iz == nz && ix%2==0 && iy%2==0 )
+					
+					fine_flux = 0.0;
+					fine_flux += Laplace_flux_O4<real_t>().apply_z(+1,*u,ix,iy,iz);
+					fine_flux += Laplace_flux_O4<real_t>().apply_z(+1,*u,ix+1,iy,iz);
+					fine_flux += Laplace_flux_O4<real_t>().apply_z(+1,*u,ix,iy+1,iz);
+					fine_flux += Laplace_flux_O4<real_t>().apply_z(+1,*u,ix+1,iy+1,iz);
+					
+					coarse_flux = Laplace_flux_O4<real_t>().apply_z(+1,*utop,ixtop,iytop,iztop)/2.0;
+					fine_flux /= 4.0;
+					
+					dflux = coarse_flux - fine_flux;
+					
+					for(int i=0;i<2;++i)
+						for( int j=0;j<2;++j)
 						{
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{		
-									for( int p=0; p<2; ++p )
-									{
-										for( int q=-2;q<=2;++q )
-											ustar[q+2] = interp4( (*utop)(ixtop-2,iytop+q,iztop+p), (*utop)(ixtop-1,iytop+q,iztop+p), 
-																 (*utop)(ixtop,iytop+q,iztop+p),   (*utop)(ixtop+1,iytop+q,iztop+p), 
-																 (*utop)(ixtop+2,iytop+q,iztop+p), fac*((real_t)j-0.5) );
-										uhat[p] = interp4( ustar, fac*((real_t)k-0.5));//+1.5 );
-									}
-									
-									(*u)(ix+j,iy+k,iz)   = interp4right( (*u)(ix+j,iy+k,iz-3), (*u)(ix+j,iy+k,iz-2), 
-																		(*u)(ix+j,iy+k,iz-1), uhat[0], uhat[1] );									
-									(*u)(ix+j,iy+k,iz+1) = interp4rright((*u)(ix+j,iy+k,iz-3), (*u)(ix+j,iy+k,iz-2), 
-																		 (*u)(ix+j,iy+k,iz-1), uhat[0], uhat[1] );
-								}
-							
-							fine_flux = 0.0;
-							fine_flux += Laplace_flux_O4<real_t>().apply_z(+1,*u,ix,iy,iz);
-							fine_flux += Laplace_flux_O4<real_t>().apply_z(+1,*u,ix+1,iy,iz);
-							fine_flux += Laplace_flux_O4<real_t>().apply_z(+1,*u,ix,iy+1,iz);
-							fine_flux += Laplace_flux_O4<real_t>().apply_z(+1,*u,ix+1,iy+1,iz);
-							
-							coarse_flux = Laplace_flux_O4<real_t>().apply_z(+1,*utop,ixtop,iytop,iztop)/2.0;
-							fine_flux /= 4.0;
-							
-							dflux = coarse_flux - fine_flux;
-							
-							for(int i=0;i<2;++i)
-								for( int j=0;j<2;++j)
-								{
-									(*u)(ix+i,iy+j,iz)   += ffac*dflux;
-									(*u)(ix+i,iy+j,iz+1) += ffac*dflux;
-								}
+							(*u)(ix+i,iy+j,iz)   += ffac*dflux;
+							(*u)(ix+i,iy+j,iz+1) += ffac*dflux;
 						}
-					}
 				}
+			}
+		}
 	}
 };
 
@@ -975,306 +1050,308 @@ struct interp_O7_fluxcorr
 		ny = u->size(1), 
 		nz = u->size(2);
 		
-		//... set boundary condition for fine grid
-#pragma omp parallel for schedule(dynamic)
-		for( int ix=-1; ix<=nx; ++ix )
-			for( int iy=-1; iy<=ny; ++iy )
-				for( int iz=-1; iz<=nz; ++iz )
+		//... set boundary condition for fine grid, one axis after the other so that
+		//... the faces of an axis can read the completed ghost zones of earlier ones
+		const bnd_face_tasks& ftasks = bnd_face_tasks::get( nx, ny, nz, true );
+		
+		for( int idir=0; idir<3; ++idir )
+		{
+			const std::vector<bnd_face_tasks::task>& tl = ftasks.tasks[idir];
+			int ntasks = (int)tl.size();
+			
+			#pragma omp parallel for schedule(static)
+			for( int itask=0; itask<ntasks; ++itask )
+			{
+				int ix = tl[itask].ix, iy = tl[itask].iy, iz = tl[itask].iz, face = tl[itask].face;
+				
+				int ixtop = (int)(0.5*(real_t)(ix))+xoff;
+				int iytop = (int)(0.5*(real_t)(iy))+yoff;
+				int iztop = (int)(0.5*(real_t)(iz))+zoff;
+				
+				if( ix==-1 ) ixtop=xoff-1;
+				if( iy==-1 ) iytop=yoff-1;
+				if( iz==-1 ) iztop=zoff-1;
+				
+				real_t ustar[7], uhat[3];			
+				real_t fac = 0.5;
+				
+				real_t coarse_flux, fine_flux, dflux;
+				
+				real_t ffac = 180./222.;
+				
+				// left boundary
+				if( face == bnd_face_tasks::left )
 				{
-					bool xbnd=(ix==-1||ix==nx),ybnd=(iy==-1||iy==ny),zbnd=(iz==-1||iz==nz);
-					bool bnd=xbnd|ybnd|zbnd;
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+						{		
+							for( int p=0; p<3; ++p )
+							{
+								for( int q=-3;q<=3;++q )
+									ustar[q+3] = interp6( (*utop)(ixtop+p-2,iytop-3,iztop+q), (*utop)(ixtop+p-2,iytop-2,iztop+q), 
+														 (*utop)(ixtop+p-2,iytop-1,iztop+q), (*utop)(ixtop+p-2,iytop,iztop+q),   
+														 (*utop)(ixtop+p-2,iytop+1,iztop+q), (*utop)(ixtop+p-2,iytop+2,iztop+q), 
+														 (*utop)(ixtop+p-2,iytop+3,iztop+q), fac*((real_t)j-0.5) );
+								uhat[p] = interp6( ustar, fac*((real_t)k-0.5));//-1.5 );
+							}
+							
+							(*u)(ix,iy+j,iz+k)   = interp6left( uhat[0], uhat[1], uhat[2], (*u)(ix+1,iy+j,iz+k), 
+															   (*u)(ix+2,iy+j,iz+k), (*u)(ix+3,iy+j,iz+k), (*u)(ix+4,iy+j,iz+k) );
+							(*u)(ix-1,iy+j,iz+k) = interp6lleft( uhat[0], uhat[1], uhat[2], (*u)(ix+1,iy+j,iz+k), 
+																(*u)(ix+2,iy+j,iz+k), (*u)(ix+3,iy+j,iz+k),(*u)(ix+4,iy+j,iz+k) );
+							(*u)(ix-2,iy+j,iz+k) = interp6llleft( uhat[0], uhat[1], uhat[2], (*u)(ix+1,iy+j,iz+k), 
+																(*u)(ix+2,iy+j,iz+k), (*u)(ix+3,iy+j,iz+k),(*u)(ix+4,iy+j,iz+k) );
+						}
 					
-					if( bnd )
-					{
-						
-						int ixtop = (int)(0.5*(real_t)(ix))+xoff;
-						int iytop = (int)(0.5*(real_t)(iy))+yoff;
-						int iztop = (int)(0.5*(real_t)(iz))+zoff;
-						
-						if( ix==-1 ) ixtop=xoff-1;
-						if( iy==-1 ) iytop=yoff-1;
-						if( iz==-1 ) iztop=zoff-1;
-						
-						real_t ustar[7], uhat[3];			
-						real_t fac = 0.5;
-						
-						real_t coarse_flux, fine_flux, dflux;
-						
-						real_t ffac = 180./222.;
-						
-						// left boundary
-						if( ix == -1 && iy%2==0 && iz%2==0 )
+					fine_flux = 0.0;
+					fine_flux += Laplace_flux_O6<real_t>().apply_x(-1,*u,ix+1,iy,iz);
+					fine_flux += Laplace_flux_O6<real_t>().apply_x(-1,*u,ix+1,iy+1,iz);
+					fine_flux += Laplace_flux_O6<real_t>().apply_x(-1,*u,ix+1,iy,iz+1);
+					fine_flux += Laplace_flux_O6<real_t>().apply_x(-1,*u,ix+1,iy+1,iz+1);
+					fine_flux /= 4.0;
+					
+					coarse_flux = Laplace_flux_O6<real_t>().apply_x(-1,*utop,ixtop+1,iytop,iztop)/2.0;
+					
+					dflux = coarse_flux - fine_flux;
+					
+					for(int j=0;j<2;++j)
+						for( int k=0;k<2;++k)
 						{
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{		
-									for( int p=0; p<3; ++p )
-									{
-										for( int q=-3;q<=3;++q )
-											ustar[q+3] = interp6( (*utop)(ixtop+p-2,iytop-3,iztop+q), (*utop)(ixtop+p-2,iytop-2,iztop+q), 
-																 (*utop)(ixtop+p-2,iytop-1,iztop+q), (*utop)(ixtop+p-2,iytop,iztop+q),   
-																 (*utop)(ixtop+p-2,iytop+1,iztop+q), (*utop)(ixtop+p-2,iytop+2,iztop+q), 
-																 (*utop)(ixtop+p-2,iytop+3,iztop+q), fac*((real_t)j-0.5) );
-										uhat[p] = interp6( ustar, fac*((real_t)k-0.5));//-1.5 );
-									}
-									
-									(*u)(ix,iy+j,iz+k)   = interp6left( uhat[0], uhat[1], uhat[2], (*u)(ix+1,iy+j,iz+k), 
-																	   (*u)(ix+2,iy+j,iz+k), (*u)(ix+3,iy+j,iz+k), (*u)(ix+4,iy+j,iz+k) );
-									(*u)(ix-1,iy+j,iz+k) = interp6lleft( uhat[0], uhat[1], uhat[2], (*u)(ix+1,iy+j,iz+k), 
-																		(*u)(ix+2,iy+j,iz+k), (*u)(ix+3,iy+j,iz+k),(*u)(ix+4,iy+j,iz+k) );
-									(*u)(ix-2,iy+j,iz+k) = interp6llleft( uhat[0], uhat[1], uhat[2], (*u)(ix+1,iy+j,iz+k), 
-																		(*u)(ix+2,iy+j,iz+k), (*u)(ix+3,iy+j,iz+k),(*u)(ix+4,iy+j,iz+k) );
-								}
-							
-							fine_flux = 0.0;
-							fine_flux += Laplace_flux_O6<real_t>().apply_x(-1,*u,ix+1,iy,iz);
-							fine_flux += Laplace_flux_O6<real_t>().apply_x(-1,*u,ix+1,iy+1,iz);
-							fine_flux += Laplace_flux_O6<real_t>().apply_x(-1,*u,ix+1,iy,iz+1);
-							fine_flux += Laplace_flux_O6<real_t>().apply_x(-1,*u,ix+1,iy+1,iz+1);
-							fine_flux /= 4.0;
-							
-							coarse_flux = Laplace_flux_O6<real_t>().apply_x(-1,*utop,ixtop+1,iytop,iztop)/2.0;
-							
-							dflux = coarse_flux - fine_flux;
-							
-							for(int j=0;j<2;++j)
-								for( int k=0;k<2;++k)
-								{
-									(*u)(ix,iy+j,iz+k)   += ffac*dflux;
-									(*u)(ix-1,iy+j,iz+k) += ffac*dflux;
-									(*u)(ix-2,iy+j,iz+k) += ffac*dflux;
-								}
+							(*u)(ix,iy+j,iz+k)   += ffac*dflux;
+							(*u)(ix-1,iy+j,iz+k) += ffac*dflux;
+							(*u)(ix-2,iy+j,iz+k) += ffac*dflux;
+						}
+					
+					
+				}
+				// right boundary
+				if( face == bnd_face_tasks::right )
+				{
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+						{		
+							for( int p=0; p<3; ++p )
+							{
+								for( int q=-3;q<=3;++q )
+									ustar[q+3] = interp6( (*utop)(ixtop+p,iytop-3,iztop+q), (*utop)(ixtop+p,iytop-2,iztop+q), 
+														 (*utop)(ixtop+p,iytop-1,iztop+q), (*utop)(ixtop+p,iytop,iztop+q),
+														 (*utop)(ixtop+p,iytop+1,iztop+q), (*utop)(ixtop+p,iytop+2,iztop+q),
+														 (*utop)(ixtop+p,iytop+3,iztop+q), fac*((real_t)j-0.5) );
+								uhat[p] = interp6( ustar, fac*((real_t)k-0.5) );//-1.5 );
+							}
 							
+							(*u)(ix,iy+j,iz+k)   = interp6right( (*u)(ix-4,iy+j,iz+k), (*u)(ix-3,iy+j,iz+k), (*u)(ix-2,iy+j,iz+k), 
+																(*u)(ix-1,iy+j,iz+k), uhat[0], uhat[1], uhat[2] );
+							(*u)(ix+1,iy+j,iz+k)   = interp6rright( (*u)(ix-4,iy+j,iz+k), (*u)(ix-3,iy+j,iz+k), (*u)(ix-2,iy+j,iz+k), 
+																(*u)(ix-1,iy+j,iz+k), uhat[0], uhat[1], uhat[2] );
+							(*u)(ix+2,iy+j,iz+k)   = interp6rrright( (*u)(ix-4,iy+j,iz+k), (*u)(ix-3,iy+j,iz+k), (*u)(ix-2,iy+j,iz+k), 
+																(*u)(ix-1,iy+j,iz+k), uhat[0], uhat[1], uhat[2] );
+
 							
 						}
-						// right boundary
-						if( ix == nx && iy%2==0 && iz%2==0 )
+					
+					fine_flux = 0.0;
+					fine_flux += Laplace_flux_O6<real_t>().apply_x(+1,*u,ix,iy,iz);
+					fine_flux += Laplace_flux_O6<real_t>().apply_x(+1,*u,ix,iy+1,iz);
+					fine_flux += Laplace_flux_O6<real_t>().apply_x(+1,*u,ix,iy,iz+1);
+					fine_flux += Laplace_flux_O6<real_t>().apply_x(+1,*u,ix,iy+1,iz+1);
+					
+					coarse_flux = Laplace_flux_O6<real_t>().apply_x(+1,*utop,ixtop,iytop,iztop)/2.0;
+					fine_flux /= 4.0;
+					
+					dflux = coarse_flux - fine_flux;
+					
+					for(int j=0;j<2;++j)
+						for( int k=0;k<2;++k)
 						{
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{		
-									for( int p=0; p<3; ++p )
-									{
-										for( int q=-3;q<=3;++q )
-											ustar[q+3] = interp6( (*utop)(ixtop+p,iytop-3,iztop+q), (*utop)(ixtop+p,iytop-2,iztop+q), 
-																 (*utop)(ixtop+p,iytop-1,iztop+q), (*utop)(ixtop+p,iytop,iztop+q),
-																 (*utop)(ixtop+p,iytop+1,iztop+q), (*utop)(ixtop+p,iytop+2,iztop+q),
-																 (*utop)(ixtop+p,iytop+3,iztop+q), fac*((real_t)j-0.5) );
-										uhat[p] = interp6( ustar, fac*((real_t)k-0.5) );//-1.5 );
-									}
-									
-									(*u)(ix,iy+j,iz+k)   = interp6right( (*u)(ix-4,iy+j,iz+k), (*u)(ix-3,iy+j,iz+k), (*u)(ix-2,iy+j,iz+k), 
-																		(*u)(ix-1,iy+j,iz+k), uhat[0], uhat[1], uhat[2] );
-									(*u)(ix+1,iy+j,iz+k)   = interp6rright( (*u)(ix-4,iy+j,iz+k), (*u)(ix-3,iy+j,iz+k), (*u)(ix-2,iy+j,iz+k), 
-																		(*u)(ix-1,iy+j,iz+k), uhat[0], uhat[1], uhat[2] );
-									(*u)(ix+2,iy+j,iz+k)   = interp6rrright( (*u)(ix-4,iy+j,iz+k), (*u)(ix-3,iy+j,iz+k), (*u)(ix-2,iy+j,iz+k), 
-																		(*u)(ix-1,iy+j,iz+k), uhat[0], uhat[1], uhat[2] );
-
-									
-								}
-							
-							fine_flux = 0.0;
-							fine_flux += Laplace_flux_O6<real_t>().apply_x(+1,*u,ix,iy,iz);
-							fine_flux += Laplace_flux_O6<real_t>().apply_x(+1,*u,ix,iy+1,iz);
-							fine_flux += Laplace_flux_O6<real_t>().apply_x(+1,*u,ix,iy,iz+1);
-							fine_flux += Laplace_flux_O6<real_t>().apply_x(+1,*u,ix,iy+1,iz+1);
-							
-							coarse_flux = Laplace_flux_O6<real_t>().apply_x(+1,*utop,ixtop,iytop,iztop)/2.0;
-							fine_flux /= 4.0;
-							
-							dflux = coarse_flux - fine_flux;
-							
-							for(int j=0;j<2;++j)
-								for( int k=0;k<2;++k)
-								{
-									(*u)(ix,iy+j,iz+k)   += ffac*dflux;
-									(*u)(ix+1,iy+j,iz+k) += ffac*dflux;
-									(*u)(ix+2,iy+j,iz+k) += ffac*dflux;
-								}
+							(*u)(ix,iy+j,iz+k)   += ffac*dflux;
+							(*u)(ix+1,iy+j,iz+k) += ffac*dflux;
+							(*u)(ix+2,iy+j,iz+k) += ffac*dflux;
+						}
+					
+				}
+				// bottom boundary
+				if( face == bnd_face_tasks::bottom )
+				{
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+						{	
+							for( int p=0; p<3; ++p )
+							{
+								for( int q=-3;q<=3;++q )
+									ustar[q+3] = interp6( (*utop)(ixtop-3,iytop+p-2,iztop+q), (*utop)(ixtop-2,iytop+p-2,iztop+q),
+														 (*utop)(ixtop-1,iytop+p-2,iztop+q), (*utop)(ixtop,iytop+p-2,iztop+q),   
+														 (*utop)(ixtop+1,iytop+p-2,iztop+q), (*utop)(ixtop+2,iytop+p-2,iztop+q),
+														 (*utop)(ixtop+3,iytop+p-2,iztop+q), fac*((real_t)j-0.5) );
+								uhat[p] = interp6( ustar, fac*((real_t)k-0.5));//-1.5 );
+							}
 							
+							(*u)(ix+j,iy,iz+k)   = interp6left( uhat[0], uhat[1], uhat[2], (*u)(ix+j,iy+1,iz+k), 
+															   (*u)(ix+j,iy+2,iz+k), (*u)(ix+j,iy+3,iz+k),(*u)(ix+j,iy+4,iz+k) );									
+							(*u)(ix+j,iy-1,iz+k)   = interp6lleft( uhat[0], uhat[1], uhat[2], (*u)(ix+j,iy+1,iz+k), 
+															   (*u)(ix+j,iy+2,iz+k), (*u)(ix+j,iy+3,iz+k),(*u)(ix+j,iy+4,iz+k) );									
+							(*u)(ix+j,iy-2,iz+k)   = interp6llleft( uhat[0], uhat[1], uhat[2], (*u)(ix+j,iy+1,iz+k), 
+															   (*u)(ix+j,iy+2,iz+k), (*u)(ix+j,iy+3,iz+k),(*u)(ix+j,iy+4,iz+k) );									
+
 						}
-						// bottom boundary
-						if( iy == -1 && ix%2==0 && iz%2==0 )
+					
+					fine_flux = 0.0;
+					fine_flux += Laplace_flux_O6<real_t>().apply_y(-1,*u,ix,iy+1,iz);
+					fine_flux += Laplace_flux_O6<real_t>().apply_y(-1,*u,ix+1,iy+1,iz);
+					fine_flux += Laplace_flux_O6<real_t>().apply_y(-1,*u,ix,iy+1,iz+1);
+					fine_flux += Laplace_flux_O6<real_t>().apply_y(-1,*u,ix+1,iy+1,iz+1);
+					
+					coarse_flux = Laplace_flux_O6<real_t>().apply_y(-1,*utop,ixtop,iytop+1,iztop)/2.0;
+					fine_flux /= 4.0;
+					
+					dflux = coarse_flux - fine_flux;
+					
+					for(int i=0;i<2;++i)
+						for( int k=0;k<2;++k)
 						{
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{	
-									for( int p=0; p<3; ++p )
-									{
-										for( int q=-3;q<=3;++q )
-											ustar[q+3] = interp6( (*utop)(ixtop-3,iytop+p-2,iztop+q), (*utop)(ixtop-2,iytop+p-2,iztop+q),
-																 (*utop)(ixtop-1,iytop+p-2,iztop+q), (*utop)(ixtop,iytop+p-2,iztop+q),   
-																 (*utop)(ixtop+1,iytop+p-2,iztop+q), (*utop)(ixtop+2,iytop+p-2,iztop+q),
-																 (*utop)(ixtop+3,iytop+p-2,iztop+q), fac*((real_t)j-0.5) );
-										uhat[p] = interp6( ustar, fac*((real_t)k-0.5));//-1.5 );
-									}
-									
-									(*u)(ix+j,iy,iz+k)   = interp6left( uhat[0], uhat[1], uhat[2], (*u)(ix+j,iy+1,iz+k), 
-																	   (*u)(ix+j,iy+2,iz+k), (*u)(ix+j,iy+3,iz+k),(*u)(ix+j,iy+4,iz+k) );									
-									(*u)(ix+j,iy-1,iz+k)   = interp6lleft( uhat[0], uhat[1], uhat[2], (*u)(ix+j,iy+1,iz+k), 
-																	   (*u)(ix+j,iy+2,iz+k), (*u)(ix+j,iy+3,iz+k),(*u)(ix+j,iy+4,iz+k) );									
-									(*u)(ix+j,iy-2,iz+k)   = interp6llleft( uhat[0], uhat[1], uhat[2], (*u)(ix+j,iy+1,iz+k), 
-																	   (*u)(ix+j,iy+2,iz+k), (*u)(ix+j,iy+3,iz+k),(*u)(ix+j,iy+4,iz+k) );									
-
-								}
-							
-							fine_flux = 0.0;
-							fine_flux += Laplace_flux_O6<real_t>().apply_y(-1,*u,ix,iy+1,iz);
-							fine_flux += Laplace_flux_O6<real_t>().apply_y(-1,*u,ix+1,iy+1,iz);
-							fine_flux += Laplace_flux_O6<real_t>().apply_y(-1,*u,ix,iy+1,iz+1);
-							fine_flux += Laplace_flux_O6<real_t>().apply_y(-1,*u,ix+1,iy+1,iz+1);
-							
-							coarse_flux = Laplace_flux_O6<real_t>().apply_y(-1,*utop,ixtop,iytop+1,iztop)/2.0;
-							fine_flux /= 4.0;
-							
-							dflux = coarse_flux - fine_flux;
-							
-							for(int i=0;i<2;++i)
-								for( int k=0;k<2;++k)
-								{
-									(*u)(ix+i,iy,iz+k)   += ffac*dflux;
-									(*u)(ix+i,iy-1,iz+k) += ffac*dflux;
-									(*u)(ix+i,iy-2,iz+k) += ffac*dflux;
-								}
+							(*u)(ix+i,iy,iz+k)   += ffac*dflux;
+							(*u)(ix+i,iy-1,iz+k) += ffac*dflux;
+							(*u)(ix+i,iy-2,iz+k) += ffac*dflux;
+						}
+					
+				}
+				// top boundary
+				if( face == bnd_face_tasks::top )
+				{
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+						{	
+							for( int p=0; p<3; ++p )
+							{
+								for( int q=-3;q<=3;++q )
+									ustar[q+3] = interp6( (*utop)(ixtop-3,iytop+p,iztop+q),  (*utop)(ixtop-2,iytop+p,iztop+q), 
+														 (*utop)(ixtop-1,iytop+p,iztop+q), (*utop)(ixtop,iytop+p,iztop+q), 
+														 (*utop)(ixtop+1,iytop+p,iztop+q), (*utop)(ixtop+2,iytop+p,iztop+q),
+														  (*utop)(ixtop+3,iytop+p,iztop+q), fac*((real_t)j-0.5) );
+								uhat[p] = interp6( ustar, fac*((real_t)k-0.5));//+1.5 );
+							}
 							
+							(*u)(ix+j,iy,iz+k)   = interp6right( (*u)(ix+j,iy-4,iz+k), (*u)(ix+j,iy-3,iz+k), (*u)(ix+j,iy-2,iz+k), 
+																(*u)(ix+j,iy-1,iz+k), uhat[0], uhat[1], uhat[2] );									
+							(*u)(ix+j,iy+1,iz+k)   = interp6rright( (*u)(ix+j,iy-4,iz+k), (*u)(ix+j,iy-3,iz+k), (*u)(ix+j,iy-2,iz+k), 
+																(*u)(ix+j,iy-1,iz+k), uhat[0], uhat[1], uhat[2] );									
+							(*u)(ix+j,iy+2,iz+k)   = interp6rrright( (*u)(ix+j,iy-4,iz+k), (*u)(ix+j,iy-3,iz+k), (*u)(ix+j,iy-2,iz+k), 
+																(*u)(ix+j,iy-1,iz+k), uhat[0], uhat[1], uhat[2] );									
+
 						}
-						// top boundary
-						if( iy == ny && ix%2==0 && iz%2==0 )
+					
+					fine_flux = 0.0;
+					fine_flux += Laplace_flux_O6<real_t>().apply_y(+1,*u,ix,iy,iz);
+					fine_flux += Laplace_flux_O6<real_t>().apply_y(+1,*u,ix+1,iy,iz);
+					fine_flux += Laplace_flux_O6<real_t>().apply_y(+1,*u,ix,iy,iz+1);
+					fine_flux += Laplace_flux_O6<real_t>().apply_y(+1,*u,ix+1,iy,iz+1);
+					
+					coarse_flux = Laplace_flux_O6<real_t>().apply_y(+1,*utop,ixtop,iytop,iztop)/2.0;
+					fine_flux /= 4.0;
+					
+					dflux = coarse_flux - fine_flux;
+					
+					for(int i=0;i<2;++i)
+						for( int k=0;k<2;++k)
 						{
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{	
-									for( int p=0; p<3; ++p )
-									{
-										for( int q=-3;q<=3;++q )
-											ustar[q+3] = interp6( (*utop)(ixtop-3,iytop+p,iztop+q),  (*utop)(ixtop-2,iytop+p,iztop+q), 
-																 (*utop)(ixtop-1,iytop+p,iztop+q), (*utop)(ixtop,iytop+p,iztop+q), 
-																 (*utop)(ixtop+1,iytop+p,iztop+q), (*utop)(ixtop+2,iytop+p,iztop+q),
-																  (*utop)(ixtop+3,iytop+p,iztop+q), fac*((real_t)j-0.5) );
-										uhat[p] = interp6( ustar, fac*((real_t)k-0.5));//+1.5 );
-									}
-									
-									(*u)(ix+j,iy,iz+k)   = interp6right( (*u)(ix+j,iy-4,iz+k), (*u)(ix+j,iy-3,iz+k), (*u)(ix+j,iy-2,iz+k), 
-																		(*u)(ix+j,iy-1,iz+k), uhat[0], uhat[1], uhat[2] );									
-									(*u)(ix+j,iy+1,iz+k)   = interp6rright( (*u)(ix+j,iy-4,iz+k), (*u)(ix+j,iy-3,iz+k), (*u)(ix+j,iy-2,iz+k), 
-																		(*u)(ix+j,iy-1,iz+k), uhat[0], uhat[1], uhat[2] );									
-									(*u)(ix+j,iy+2,iz+k)   = interp6rrright( (*u)(ix+j,iy-4,iz+k), (*u)(ix+j,iy-3,iz+k), (*u)(ix+j,iy-2,iz+k), 
-																		(*u)(ix+j,iy-1,iz+k), uhat[0], uhat[1], uhat[2] );									
-
-								}
-							
-							fine_flux = 0.0;
-							fine_flux += Laplace_flux_O6<real_t>().apply_y(+1,*u,ix,iy,iz);
-							fine_flux += Laplace_flux_O6<real_t>().apply_y(+1,*u,ix+1,iy,iz);
-							fine_flux += Laplace_flux_O6<real_t>().apply_y(+1,*u,ix,iy,iz+1);
-							fine_flux += Laplace_flux_O6<real_t>().apply_y(+1,*u,ix+1,iy,iz+1);
-							
-							coarse_flux = Laplace_flux_O6<real_t>().apply_y(+1,*utop,ixtop,iytop,iztop)/2.0;
-							fine_flux /= 4.0;
-							
-							dflux = coarse_flux - fine_flux;
-							
-							for(int i=0;i<2;++i)
-								for( int k=0;k<2;++k)
-								{
-									(*u)(ix+i,iy,iz+k)   += ffac*dflux;
-									(*u)(ix+i,iy+1,iz+k) += ffac*dflux;
-									(*u)(ix+i,iy+2,iz+k) += ffac*dflux;
-								}
-							
+							(*u)(ix+i,iy,iz+k)   += ffac*dflux;
+							(*u)(ix+i,iy+1,iz+k) += ffac*dflux;
+							(*u)(ix+i,iy+2,iz+k) += ffac*dflux;
+						}
+					
+					
+				}
+				// front boundary
+				if( face == bnd_face_tasks::front )
+				{
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+						{		
+							for( int p=0; p<3; ++p )
+							{
+								for( int q=-3;q<=3;++q )
+									ustar[q+3] = interp6( (*utop)(ixtop-3,iytop+q,iztop+p-2), (*utop)(ixtop-2,iytop+q,iztop+p-2),
+														 (*utop)(ixtop-1,iytop+q,iztop+p-2), (*utop)(ixtop,iytop+q,iztop+p-2), 
+														 (*utop)(ixtop+1,iytop+q,iztop+p-2), (*utop)(ixtop+2,iytop+q,iztop+p-2),
+														 (*utop)(ixtop+3,iytop+q,iztop+p-2), fac*((real_t)j-0.5) );
+								uhat[p] = interp6( ustar, fac*((real_t)k-0.5));//-1.5 );
+							}
 							
+							(*u)(ix+j,iy+k,iz)   = interp6left( uhat[0], uhat[1], uhat[2], (*u)(ix+j,iy+k,iz+1), 
+															   (*u)(ix+j,iy+k,iz+2), (*u)(ix+j,iy+k,iz+3),(*u)(ix+j,iy+k,iz+4) );									
+							(*u)(ix+j,iy+k,iz-1)   = interp6lleft( uhat[0], uhat[1], uhat[2], (*u)(ix+j,iy+k,iz+1), 
+															   (*u)(ix+j,iy+k,iz+2), (*u)(ix+j,iy+k,iz+3), (*u)(ix+j,iy+k,iz+4) );									
+							(*u)(ix+j,iy+k,iz-2)   = interp6llleft( uhat[0], uhat[1], uhat[2], (*u)(ix+j,iy+k,iz+1), 
+															   (*u)(ix+j,iy+k,iz+2), (*u)(ix+j,iy+k,iz+3), (*u)(ix+j,iy+k,iz+4) );									
 						}
-						// front boundary
-						if( iz == -1 && ix%2==0 && iy%2==0 )
+					
+					
+					fine_flux = 0.0;
+					fine_flux += Laplace_flux_O6<real_t>().apply_z(-1,*u,ix,iy,iz+1);
+					fine_flux += Laplace_flux_O6<real_t>().apply_z(-1,*u,ix+1,iy,iz+1);
+					fine_flux += Laplace_flux_O6<real_t>().apply_z(-1,*u,ix,iy+1,iz+1);
+					fine_flux += Laplace_flux_O6<real_t>().apply_z(-1,*u,ix+1,iy+1,iz+1);
+					
+					coarse_flux = Laplace_flux_O6<real_t>().apply_z(-1,*utop,ixtop,iytop,iztop+1)/2.0;
+					fine_flux /= 4.0;
+					
+					dflux = coarse_flux - fine_flux;
+					
+					for(int i=0;i<2;++i)
+						for( int j=0;j<2;++j)
 						{
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{		
-									for( int p=0; p<3; ++p )
-									{
-										for( int q=-3;q<=3;++q )
-											ustar[q+3] = interp6( (*utop)(ixtop-3,iytop+q,iztop+p-2), (*utop)(ixtop-2,iytop+q,iztop+p-2),
-																 (*utop)(ixtop-1,iytop+q,iztop+p-2), (*utop)(ixtop,iytop+q,iztop+p-2), 
-																 (*utop)(ixtop+1,iytop+q,iztop+p-2), (*utop)(ixtop+2,iytop+q,iztop+p-2),
-																 (*utop)(ixtop+3,iytop+q,iztop+p-2), fac*((real_t)j-0.5) );
-										uhat[p] = interp6( ustar, fac*((real_t)k-0.5));//-1.5 );
-									}
-									
-									(*u)(ix+j,iy+k,iz)   = interp6left( uhat[0], uhat[1], uhat[2], (*u)(ix+j,iy+k,iz+1), 
-																	   (*u)(ix+j,iy+k,iz+2), (*u)(ix+j,iy+k,iz+3),(*u)(ix+j,iy+k,iz+4) );									
-									(*u)(ix+j,iy+k,iz-1)   = interp6lleft( uhat[0], uhat[1], uhat[2], (*u)(ix+j,iy+k,iz+1), 
-																	   (*u)(ix+j,iy+k,iz+2), (*u)(ix+j,iy+k,iz+3), (*u)(ix+j,iy+k,iz+4) );									
-									(*u)(ix+j,iy+k,iz-2)   = interp6llleft( uhat[0], uhat[1], uhat[2], (*u)(ix+j,iy+k,iz+1), 
-																	   (*u)(ix+j,iy+k,iz+2), (*u)(ix+j,iy+k,iz+3), (*u)(ix+j,iy+k,iz+4) );									
-								}
-							
-							
-							fine_flux = 0.0;
-							fine_flux += Laplace_flux_O6<real_t>().apply_z(-1,*u,ix,iy,iz+1);
-							fine_flux += Laplace_flux_O6<real_t>().apply_z(-1,*u,ix+1,iy,iz+1);
-							fine_flux += Laplace_flux_O6<real_t>().apply_z(-1,*u,ix,iy+1,iz+1);
-							fine_flux += Laplace_flux_O6<real_t>().apply_z(-1,*u,ix+1,iy+1,iz+1);
-							
-							coarse_flux = Laplace_flux_O6<real_t>().apply_z(-1,*utop,ixtop,iytop,iztop+1)/2.0;
-							fine_flux /= 4.0;
-							
-							dflux = coarse_flux - fine_flux;
-							
-							for(int i=0;i<2;++i)
-								for( int j=0;j<2;++j)
-								{
-									(*u)(ix+i,iy+j,iz)   += ffac*dflux;
-									(*u)(ix+i,iy+j,iz-1) += ffac*dflux;
-									(*u)(ix+i,iy+j,iz-2) += ffac*dflux;
-								}
+							(*u)(ix+i,iy+j,iz)   += ffac*dflux;
+							(*u)(ix+i,iy+j,iz-1) += ffac*dflux;
+							(*u)(ix+i,iy+j,iz-2) += ffac*dflux;
+						}
+					
+				}
+				// back boundary
+				if( face == bnd_face_tasks::back )
+				{
+					for( int j=0;j<=1;j++)
+						for( int k=0;k<=1;k++)
+						{		
+							for( int p=0; p<3; ++p )
+							{
+								for( int q=-3;q<=3;++q )
+									ustar[q+3] = interp6( (*utop)(ixtop-3,iytop+q,iztop+p), (*utop)(ixtop-2,iytop+q,iztop+p), 
+														 (*utop)(ixtop-1,iytop+q,iztop+p), (*utop)(ixtop,iytop+q,iztop+p),   
+														 (*utop)(ixtop+1,iytop+q,iztop+p), (*utop)(ixtop+2,iytop+q,iztop+p), 
+														 (*utop)(ixtop+3,iytop+q,iztop+p), fac*((real_t)j-0.5) );
+								uhat[p] = interp6( ustar, fac*((real_t)k-0.5));//+1.5 );
+							}
 							
+							(*u)(ix+j,iy+k,iz)   = interp6right( (*u)(ix+j,iy+k,iz-4), (*u)(ix+j,iy+k,iz-3), (*u)(ix+j,iy+k,iz-2), 
+																(*u)(ix+j,iy+k,iz-1), uhat[0], uhat[1], uhat[2] );
+							(*u)(ix+j,iy+k,iz+1)   = interp6rright( (*u)(ix+j,iy+k,iz-4), (*u)(ix+j,iy+k,iz-3), (*u)(ix+j,iy+k,iz-2), 
+																(*u)(ix+j,iy+k,iz-1), uhat[0], uhat[1], uhat[2] );
+							(*u)(ix+j,iy+k,iz+2)   = interp6rrright( (*u)(ix+j,iy+k,iz-4), (*u)(ix+j,iy+k,iz-3), (*u)(ix+j,iy+k,iz-2), 
+																(*u)(ix+j,iy+k,iz-1), uhat[0], uhat[1], uhat[2] );
+
 						}
-						// back boundary
-						if( iz == nz && ix%2==0 && iy%2==0 )
+					
+					fine_flux = 0.0;
+					fine_flux += Laplace_flux_O6<real_t>().apply_z(+1,*u,ix,iy,iz);
+					fine_flux += Laplace_flux_O6<real_t>().apply_z(+1,*u,ix+1,iy,iz);
+					fine_flux += Laplace_flux_O6<real_t>().apply_z(+1,*u,ix,iy+1,iz);
+					fine_flux += Laplace_flux_O6<real_t>().apply_z(+1,*u,ix+1,iy+1,iz);
+					
+					coarse_flux = Laplace_flux_O6<real_t>().apply_z(+1,*utop,ixtop,iytop,iztop)/2.0;
+					fine_flux /= 4.0;
+					
+					dflux = coarse_flux - fine_flux;
+					
+					for(int i=0;i<2;++i)
+						for( int j=0;j<2;++j)
 						{
-							for( int j=0;j<=1;j++)
-								for( int k=0;k<=1;k++)
-								{		
-									for( int p=0; p<3; ++p )
-									{
-										for( int q=-3;q<=3;++q )
-											ustar[q+3] = interp6( (*utop)(ixtop-3,iytop+q,iztop+p), (*utop)(ixtop-2,iytop+q,iztop+p), 
-																 (*utop)(ixtop-1,iytop+q,iztop+p), (*utop)(ixtop,iytop+q,iztop+p),   
-																 (*utop)(ixtop+1,iytop+q,iztop+p), (*utop)(ixtop+2,iytop+q,iztop+p), 
-																 (*utop)(ixtop+3,iytop+q,iztop+p), fac*((real_t)j-0.5) );
-										uhat[p] = interp6( ustar, fac*((real_t)k-0.5));//+1.5 );
-									}
-									
-									(*u)(ix+j,iy+k,iz)   = interp6right( (*u)(ix+j,iy+k,iz-4), (*u)(ix+j,iy+k,iz-3), (*u)(ix+j,iy+k,iz-2), 
-																		(*u)(ix+j,iy+k,iz-1), uhat[0], uhat[1], uhat[2] );
-									(*u)(ix+j,iy+k,iz+1)   = interp6rright( (*u)(ix+j,iy+k,iz-4), (*u)(ix+j,iy+k,iz-3), (*u)(ix+j,iy+k,iz-2), 
-																		(*u)(ix+j,iy+k,iz-1), uhat[0], uhat[1], uhat[2] );
-									(*u)(ix+j,iy+k,iz+2)   = interp6rrright( (*u)(ix+j,iy+k,iz-4), (*u)(ix+j,iy+k,iz-3), (*u)(ix+j,iy+k,iz-2), 
-																		(*u)(ix+j,iy+k,iz-1), uhat[0], uhat[1], uhat[2] );
-
-								}
-							
-							fine_flux = 0.0;
-							fine_flux += Laplace_flux_O6<real_t>().apply_z(+1,*u,ix,iy,iz);
-							fine_flux += Laplace_flux_O6<real_t>().apply_z(+1,*u,ix+1,iy,iz);
-							fine_flux += Laplace_flux_O6<real_t>().apply_z(+1,*u,ix,iy+1,iz);
-							fine_flux += Laplace_flux_O6<real_t>().apply_z(+1,*u,ix+1,iy+1,iz);
-							
-							coarse_flux = Laplace_flux_O6<real_t>().apply_z(+1,*utop,ixtop,iytop,iztop)/2.0;
-							fine_flux /= 4.0;
-							
-							dflux = coarse_flux - fine_flux;
-							
-							for(int i=0;i<2;++i)
-								for( int j=0;j<2;++j)
-								{
-									(*u)(ix+i,iy+j,iz)   += ffac*dflux;
-									(*u)(ix+i,iy+j,iz+1) += ffac*dflux;
-									(*u)(ix+i,iy+j,iz+2) += ffac*dflux;
-								}
+							(*u)(ix+i,iy+j,iz)   += ffac*dflux;
+							(*u)(ix+i,iy+j,iz+1) += ffac*dflux;
+							(*u)(ix+i,iy+j,iz+2) += ffac*dflux;
 						}
-					}
 				}
+			}
+		}
 	}
 };
 
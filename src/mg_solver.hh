@@ -12,12 +12,15 @@
 #define __MG_SOLVER_HH
 
 #include <cmath>
+#include <vector>
 #include <iostream>
+#include <type_traits>
 
 #include "mg_operators.hh"
 #include "mg_interp.hh"
 
 #include "mesh.hh"
+#include "profile.hh"
 
 #define BEGIN_MULTIGRID_NAMESPACE namespace multigrid {
 #define END_MULTIGRID_NAMESPACE }
@@ -26,9 +29,21 @@ BEGIN_MULTIGRID_NAMESPACE
 	
 //! options for multigrid smoothing operation
 namespace opt {
-	enum smtype { sm_jacobi, sm_gauss_seidel, sm_sor };
+	enum smtype { sm_jacobi, sm_gauss_seidel, sm_sor, sm_gauss_seidel_blocked };
+	
+	//! interpolation used for the full multigrid initial guess
+	enum fmgtype { fmg_none, fmg_linear, fmg_cubic };
 }
 
+//! unit field at one point, used to read off the coefficients of a stencil
+struct stencil_probe
+{
+	int i, j, k;
+	
+	double operator()( int ii, int jj, int kk ) const
+	{ return (ii==i && jj==j && kk==k)? 1.0 : 0.0; }
+};
+
 
 //! actual implementation of FAS adaptive multigrid solver
 template< class S, class I, class O, typename T=double >
@@ -58,6 +73,17 @@ protected:
 	
 	const MeshvarBnd<T> *m_pubnd;
 	
+	opt::fmgtype		m_fmg;					//!< full multigrid start and its prolongation
+	unsigned			m_ncycle,				//!< number of coarse grid visits per level, 1: V-cycle, 2: W-cycle
+						m_nmaxsmooth;			//!< upper limit for adaptive pre+post sweeps, 0: fixed sweeps
+	std::vector<double> m_levelerr;				//!< residual of each level, measured by the last post sweep
+	
+	int m_srad;									//!< extent of the stencil along the axes
+	std::vector<T> m_scoeff;					//!< stencil coefficients at distance 1..m_srad
+	
+	//! determine the coefficients if the stencil only couples along the axes, sets m_srad=0 otherwise
+	void probe_stencil( void );
+	
 	//! compute residual for a level
   double compute_error( const MeshvarBnd<T>& u, const MeshvarBnd<T>& unew, int ilevel );
 	
@@ -66,17 +92,30 @@ protected:
 	
 	//! compute residuals for entire grid hierarchy
 	double compute_RMS_resid( const GridHierarchy<T>& uh, const GridHierarchy<T>& fh, bool verbose );
+	
+	//! maximum of the residuals measured during the post smoothing of the last cycle
+	double smoothing_error( unsigned levelmin, unsigned levelmax, bool verbose );
+	
+	//! full multigrid: solve the coarse levels first and prolong each to the next level as initial guess
+	void fullMultigrid( unsigned ilevelmax );
 
 protected:
 	
 	//! Jacobi smoothing 
-	void Jacobi( T h, MeshvarBnd<T>* u, const MeshvarBnd<T>* f );
+	void Jacobi( T h, MeshvarBnd<T>* u, const MeshvarBnd<T>* f, double *perr=NULL );
 	
 	//! Gauss-Seidel smoothing
-	void GaussSeidel( T h, MeshvarBnd<T>* u, const MeshvarBnd<T>* f );
+	void GaussSeidel( T h, MeshvarBnd<T>* u, const MeshvarBnd<T>* f, double *perr=NULL );
 	
 	//! Successive-Overrelaxation smoothing
-	void SOR( T h, MeshvarBnd<T>* u, const MeshvarBnd<T>* f );
+	void SOR( T h, MeshvarBnd<T>* u, const MeshvarBnd<T>* f, double *perr=NULL );
+	
+	//! Gauss-Seidel smoothing, both colours pipelined plane by plane with vectorized row updates
+	void GaussSeidelBlocked( T h, MeshvarBnd<T>* u, const MeshvarBnd<T>* f, double *perr=NULL );
+	
+	//! one smoothing step with the selected smoother, if perr is given it receives the
+	//! mean relative residual of the cells just before they were updated
+	void smooth( T h, MeshvarBnd<T>* u, const MeshvarBnd<T>* f, double *perr=NULL );
 	
 	//! main two-grid (V-cycle) for multi-grid iterations
 	void twoGrid( unsigned ilevel );
@@ -98,6 +137,14 @@ public:
 	~solver()
 	{  }
 	
+	//! select full multigrid start, cycle type and adaptive number of smoothing sweeps
+	void set_schedule( opt::fmgtype fmg, unsigned ncycle, unsigned nmaxsmooth )
+	{
+		m_fmg = fmg;
+		m_ncycle = std::max(1u,ncycle);
+		m_nmaxsmooth = nmaxsmooth;
+	}
+	
 	//! solve Poisson's equation 
 	double solve( GridHierarchy<T>& u, double accuracy, double h=-1.0, bool verbose=false );
 	
@@ -115,14 +162,89 @@ public:
 template< class S, class I, class O, typename T >
 solver<S,I,O,T>::solver( GridHierarchy<T>& f, opt::smtype smoother, unsigned npresmooth, unsigned npostsmooth )
 :	m_scheme(), m_gridop(), m_npresmooth( npresmooth ), m_npostsmooth( npostsmooth ), 
-m_smoother( smoother ), m_ilevelmin( f.levelmin() ), m_is_ini( true ), m_pf( &f )
+m_smoother( smoother ), m_ilevelmin( f.levelmin() ), m_is_ini( true ), m_pf( &f ),
+m_fmg( opt::fmg_none ), m_ncycle( 1 ), m_nmaxsmooth( 0 )
 { 
 	m_is_ini = true;
+	
+	probe_stencil();
+	if( m_smoother == opt::sm_gauss_seidel_blocked && m_srad == 0 )
+	{
+		LOGWARN("Blocked Gauss-Seidel needs an axis-aligned stencil, using plain Gauss-Seidel.");
+		m_smoother = opt::sm_gauss_seidel;
+	}
+}
+
+template< class S, class I, class O, typename T >
+void solver<S,I,O,T>::probe_stencil( void )
+{
+	const int maxrad = 4;
+	stencil_probe p;
+	
+	m_scoeff.assign( 1, 0.0 );
+	m_srad = 0;
+	
+	for( int d=1; d<=maxrad; ++d )
+	{
+		p.i = d; p.j = 0; p.k = 0;
+		double c = m_scheme.rhs( p, 0, 0, 0 );
+		
+		//... all six directions must have the same weight
+		const int dir[6][3] = { {d,0,0}, {-d,0,0}, {0,d,0}, {0,-d,0}, {0,0,d}, {0,0,-d} };
+		for( int q=0; q<6; ++q )
+		{
+			p.i = dir[q][0]; p.j = dir[q][1]; p.k = dir[q][2];
+			if( fabs( m_scheme.rhs( p, 0, 0, 0 ) - c ) > 1e-12*fabs(c) )
+			{
+				m_srad = 0;
+				return;
+			}
+		}
+		
+		m_scoeff.push_back( (T)c );
+		if( c != 0.0 )
+			m_srad = d;
+	}
+	
+	//... nothing may couple off the axes
+	double sum = 0.0;
+	for( int i=-maxrad; i<=maxrad; ++i )
+		for( int j=-maxrad; j<=maxrad; ++j )
+			for( int k=-maxrad; k<=maxrad; ++k )
+			{
+				p.i = i; p.j = j; p.k = k;
+				sum += fabs( m_scheme.rhs( p, 0, 0, 0 ) );
+			}
+	
+	double sumaxes = 0.0;
+	for( int d=1; d<=m_srad; ++d )
+		sumaxes += 6.0 * fabs( (double)m_scoeff[d] );
+	
+	if( fabs( sum - sumaxes ) > 1e-12 * sumaxes )
+		m_srad = 0;
+	
+	m_scoeff.resize( m_srad+1 );
+}
+
+template< class S, class I, class O, typename T >
+void solver<S,I,O,T>::smooth( T h, MeshvarBnd<T>* u, const MeshvarBnd<T>* f, double *perr )
+{
+	if( m_smoother == opt::sm_gauss_seidel )
+		GaussSeidel( h, u, f, perr );
+	
+	else if( m_smoother == opt::sm_gauss_seidel_blocked )
+		GaussSeidelBlocked( h, u, f, perr );
+	
+	else if( m_smoother == opt::sm_jacobi )
+		Jacobi( h, u, f, perr );
+	
+	else if( m_smoother == opt::sm_sor )
+		SOR( h, u, f, perr );
 }
 
 
 template< class S, class I, class O, typename T >
-void solver<S,I,O,T>::Jacobi( T h, MeshvarBnd<T> *u, const MeshvarBnd<T>* f )
+void solver<S,I,O,T>::Jacobi( T h, MeshvarBnd<T> *u, const MeshvarBnd<T>* f, double *perr )
 {
 	int
 		nx = u->size(0), 
@@ -136,17 +258,29 @@ void solver<S,I,O,T>::Jacobi( T h, MeshvarBnd<T> *u, const MeshvarBnd<T>* f )
 	MeshvarBnd<T> uold(*u);
 	
 	double alpha = 0.95, ialpha = 1.0-alpha;
+	double err = 0.0, cc = m_scheme.ccoeff();
+	size_t count = 0;
 	
-	#pragma omp parallel for
+	#pragma omp parallel for reduction(+:err,count)
 	for( int ix=0; ix<nx; ++ix )
 		for( int iy=0; iy<ny; ++iy )
 			for( int iz=0; iz<nz; ++iz )
-				(*u)(ix,iy,iz) = ialpha * uold(ix,iy,iz) + alpha * (m_scheme.rhs( uold, ix, iy, iz ) + h2 * (*f)(ix,iy,iz))*c0;
+			{
+				double r = m_scheme.rhs( uold, ix, iy, iz ) + h2 * (*f)(ix,iy,iz), val = uold(ix,iy,iz);
+				if( perr != NULL && val != 0.0 )
+				{
+					err += fabs( (r + cc*val)/val );
+					++count;
+				}
+				(*u)(ix,iy,iz) = ialpha * val + alpha * r*c0;
+			}
 	
+	if( perr != NULL )
+		*perr = (count != 0)? err/count : 0.0;
 }
 
 template< class S, class I, class O, typename T >
-void solver<S,I,O,T>::SOR( T h, MeshvarBnd<T> *u, const MeshvarBnd<T>* f )
+void solver<S,I,O,T>::SOR( T h, MeshvarBnd<T> *u, const MeshvarBnd<T>* f, double *perr )
 {
 	int
 		nx = u->size(0), 
@@ -163,28 +297,35 @@ void solver<S,I,O,T>::SOR( T h, MeshvarBnd<T> *u, const MeshvarBnd<T>* f )
 		alpha = 1.2, 
 	//alpha = 2 / (1 + 4 * atan(1.0) / double(u->size(0)))-1.0, //.. ideal alpha
 		ialpha = 1.0-alpha;
+	double err = 0.0, cc = m_scheme.ccoeff();
+	size_t count = 0;
 	
-	#pragma omp parallel for
-	for( int ix=0; ix<nx; ++ix )
-		for( int iy=0; iy<ny; ++iy )
-			for( int iz=0; iz<nz; ++iz )
-				if( (ix+iy+iz)%2==0 )
-					(*u)(ix,iy,iz) = ialpha * uold(ix,iy,iz) + alpha * (m_scheme.rhs( uold, ix, iy, iz ) + h2 * (*f)(ix,iy,iz))*c0;
-	
-	
-	#pragma omp parallel for
-	for( int ix=0; ix<nx; ++ix )
-		for( int iy=0; iy<ny; ++iy )
-			for( int iz=0; iz<nz; ++iz )
-				if( (ix+iy+iz)%2!=0 )
-					(*u)(ix,iy,iz) = ialpha * uold(ix,iy,iz) + alpha * (m_scheme.rhs( *u, ix, iy, iz ) + h2 * (*f)(ix,iy,iz))*c0;
-	
-	
+	for( int color=0; color < 2; ++color )
+	{
+		const MeshvarBnd<T>& usrc = (color==0)? uold : *u;
+		
+		#pragma omp parallel for reduction(+:err,count)
+		for( int ix=0; ix<nx; ++ix )
+			for( int iy=0; iy<ny; ++iy )
+				for( int iz=0; iz<nz; ++iz )
+					if( (ix+iy+iz)%2 == color )
+					{
+						double r = m_scheme.rhs( usrc, ix, iy, iz ) + h2 * (*f)(ix,iy,iz), val = uold(ix,iy,iz);
+						if( perr != NULL && val != 0.0 )
+						{
+							err += fabs( (r + cc*val)/val );
+							++count;
+						}
+						(*u)(ix,iy,iz) = ialpha * val + alpha * r*c0;
+					}
+	}
 	
+	if( perr != NULL )
+		*perr = (count != 0)? err/count : 0.0;
 }
 
 template< class S, class I, class O, typename T >
-void solver<S,I,O,T>::GaussSeidel( T h, MeshvarBnd<T>* u, const MeshvarBnd<T>* f )
+void solver<S,I,O,T>::GaussSeidel( T h, MeshvarBnd<T>* u, const MeshvarBnd<T>* f, double *perr )
 {
 	int 
 		nx = u->size(0), 
@@ -195,17 +336,119 @@ void solver<S,I,O,T>::GaussSeidel( T h, MeshvarBnd<T>* u, const MeshvarBnd<T>* f
 		c0 = -1.0/m_scheme.ccoeff(),
 		h2 = h*h; 
 	
+	double err = 0.0, cc = m_scheme.ccoeff();
+	size_t count = 0;
+	
 	for( int color=0; color < 2; ++color )
-		#pragma omp parallel for
+		#pragma omp parallel for reduction(+:err,count)
 		for( int ix=0; ix<nx; ++ix )
 			for( int iy=0; iy<ny; ++iy )
 				for( int iz=0; iz<nz; ++iz )
 					if( (ix+iy+iz)%2 == color )
-						(*u)(ix,iy,iz) = (m_scheme.rhs( *u, ix, iy, iz ) + h2 * (*f)(ix,iy,iz))*c0;
-	
+					{
+						T r = m_scheme.rhs( *u, ix, iy, iz ) + h2 * (*f)(ix,iy,iz);
+						if( perr != NULL && (*u)(ix,iy,iz) != 0.0 )
+						{
+							double val = (*u)(ix,iy,iz);
+							err += fabs( ((double)r + cc*val)/val );
+							++count;
+						}
+						(*u)(ix,iy,iz) = r*c0;
+					}
+	
+	if( perr != NULL )
+		*perr = (count != 0)? err/count : 0.0;
 }
 
 
+/*
+ * The black sweep of plane ix only needs the red values of the planes up to
+ * ix+m_srad, so it runs m_srad+1 planes behind the red sweep and both colours
+ * pass through the cache together. Rows of a plane are updated in parallel; rows
+ * two apart share the coloured cells, so they are done in separate phases.
+ * Within a row the cells of one colour are evaluated with stride 2 from the
+ * values before the row update and written back afterwards.
+ */
+template< class S, class I, class O, typename T >
+void solver<S,I,O,T>::GaussSeidelBlocked( T h, MeshvarBnd<T>* u, const MeshvarBnd<T>* f, double *perr )
+{
+	int 
+		nx = u->size(0), 
+		ny = u->size(1), 
+		nz = u->size(2);
+	
+	const int R = m_srad, D = m_srad+1, nstage = 2;
+	const T
+		c0 = -1.0/m_scheme.ccoeff(),
+		h2 = h*h;
+	double err = 0.0, cc = m_scheme.ccoeff();
+	size_t count = 0;
+	
+	#pragma omp parallel
+	{
+		std::vector<T> buf( nz/2+1 );
+		std::vector<const T*> nb( 4*R );
+		
+		for( int t=0; t<nx+(nstage-1)*D; ++t )
+			for( int phase=0; phase<2; ++phase )
+			{
+				#pragma omp for schedule(static) reduction(+:err,count)
+				for( int q=0; q<nstage*ny; ++q )
+				{
+					int color = q/ny, iy = q%ny, ix = t-color*D;
+					
+					if( ix < 0 || ix >= nx || ((iy>>1)&1) != phase )
+						continue;
+					
+					T *urow = &(*u)(ix,iy,0);
+					const T *frow = &(*f)(ix,iy,0);
+					
+					for( int d=1; d<=R; ++d )
+					{
+						nb[4*(d-1)+0] = &(*u)(ix-d,iy,0);
+						nb[4*(d-1)+1] = &(*u)(ix+d,iy,0);
+						nb[4*(d-1)+2] = &(*u)(ix,iy-d,0);
+						nb[4*(d-1)+3] = &(*u)(ix,iy+d,0);
+					}
+					
+					int iz0 = ((color-ix-iy)%2+2)%2, nc = (nz-iz0+1)/2;
+					
+					for( int m=0; m<nc; ++m )
+						buf[m] = h2 * frow[iz0+2*m];
+					
+					for( int d=1; d<=R; ++d )
+					{
+						const T c = m_scoeff[d];
+						const T *xm = nb[4*(d-1)+0], *xp = nb[4*(d-1)+1], *ym = nb[4*(d-1)+2], *yp = nb[4*(d-1)+3];
+						
+						for( int m=0; m<nc; ++m )
+						{
+							int iz = iz0+2*m;
+							buf[m] += c * (xm[iz]+xp[iz]+ym[iz]+yp[iz]+urow[iz-d]+urow[iz+d]);
+						}
+					}
+					
+					if( perr != NULL )
+						for( int m=0; m<nc; ++m )
+						{
+							double val = urow[iz0+2*m];
+							if( val != 0.0 )
+							{
+								err += fabs( ((double)buf[m] + cc*val)/val );
+								++count;
+							}
+						}
+					
+					for( int m=0; m<nc; ++m )
+						urow[iz0+2*m] = buf[m] * c0;
+				}
+			}
+	}
+	
+	if( perr != NULL )
+		*perr = (count != 0)? err/count : 0.0;
+}
+
 template< class S, class I, class O, typename T >
 void solver<S,I,O,T>::twoGrid( unsigned ilevel )
 {
@@ -240,14 +483,7 @@ void solver<S,I,O,T>::twoGrid( unsigned ilevel )
 		if( ilevel > m_ilevelmin )
 			interp().interp_coarse_fine(ilevel,*uc,*uf);
 		
-		if( m_smoother == opt::sm_gauss_seidel )
-			GaussSeidel( h, uf, ff );
-			
-		else if( m_smoother == opt::sm_jacobi )
-			Jacobi( h, uf, ff);		
-			
-		else if( m_smoother == opt::sm_sor )
-			SOR( h, uf, ff );
+		smooth( h, uf, ff );
 		
 		if( m_bperiodic && ilevel <= m_ilevelmin )
 			make_periodic( uf );
@@ -287,44 +523,61 @@ void solver<S,I,O,T>::twoGrid( unsigned ilevel )
 		oyp = uf->offset(1),
 		ozp = uf->offset(2);
 	
-	meshvar_bnd tLu(*uc,false);
-	#pragma omp parallel for
-	for( int ix=0; ix<nx/2; ++ix )
-	{	
-		int iix=2*ix;
-		for( int iy=0,iiy=0; iy<ny/2; ++iy,iiy+=2 )
-		
-		
-			for( int iz=0,iiz=0; iz<nz/2; ++iz,iiz+=2 )
-				tLu(ix+oxp,iy+oyp,iz+ozp) = 0.125 * (
-							 m_scheme.apply( (*uf), iix, iiy, iiz )
-							+m_scheme.apply( (*uf), iix, iiy, iiz+1 )
-							+m_scheme.apply( (*uf), iix, iiy+1, iiz )
-							+m_scheme.apply( (*uf), iix, iiy+1, iiz+1 )
-							+m_scheme.apply( (*uf), iix+1, iiy, iiz )
-							+m_scheme.apply( (*uf), iix+1, iiy, iiz+1 )
-							+m_scheme.apply( (*uf), iix+1, iiy+1, iiz )
-							+m_scheme.apply( (*uf), iix+1, iiy+1, iiz+1 )
-						)/h2;
+	if( std::is_same<O,mg_straight>::value )
+	{
+		//... one pass computes the restricted Lu with the 2x2x2 average of mg_straight,
+		//... restricts the source term the same way and adds the FAS correction
+		#pragma omp parallel for
+		for( int ix=0; ix<nx/2; ++ix )
+		{	
+			int iix=2*ix;
+			for( int iy=0,iiy=0; iy<ny/2; ++iy,iiy+=2 )
+				for( int iz=0,iiz=0; iz<nz/2; ++iz,iiz+=2 )
+				{
+					double Lu = 0.125 * (
+								 m_scheme.apply( (*uf), iix, iiy, iiz )
+								+m_scheme.apply( (*uf), iix, iiy, iiz+1 )
+								+m_scheme.apply( (*uf), iix, iiy+1, iiz )
+								+m_scheme.apply( (*uf), iix, iiy+1, iiz+1 )
+								+m_scheme.apply( (*uf), iix+1, iiy, iiz )
+								+m_scheme.apply( (*uf), iix+1, iiy, iiz+1 )
+								+m_scheme.apply( (*uf), iix+1, iiy+1, iiz )
+								+m_scheme.apply( (*uf), iix+1, iiy+1, iiz+1 )
+							)/h2;
+					
+					double fs = 0.125 * ( (*ff)(iix+1,iiy,iiz) + (*ff)(iix,iiy+1,iiz) + (*ff)(iix,iiy,iiz+1) + (*ff)(iix+1,iiy+1,iiz) +
+										 (*ff)(iix+1,iiy,iiz+1) + (*ff)(iix+1,iiy+1,iiz+1) + (*ff)(iix,iiy+1,iiz+1) + (*ff)(iix,iiy,iiz) );
+					
+					(*fc)(ix+oxp,iy+oyp,iz+ozp) = fs + (Lu - m_scheme.apply( *uc, ix+oxp, iy+oyp, iz+ozp )/(4.0*h2));
+				}
+		}
+	}
+	else
+	{
+		//... other grid operators restrict Lu and the source term themselves
+		MeshvarBnd<T> Lu(*uf,false), tLu(*uc,false);
+		
+		#pragma omp parallel for
+		for( int ix=0; ix<nx; ++ix )
+			for( int iy=0; iy<ny; ++iy )
+				for( int iz=0; iz<nz; ++iz )
+					Lu(ix,iy,iz) = m_scheme.apply( (*uf), ix, iy, iz )/h2;
+		
+		m_gridop.restrict( Lu, tLu );
+		Lu.deallocate();
+		
+		m_gridop.restrict( *ff, *fc );
+		
+		#pragma omp parallel for
+		for( int ix=oxp; ix<oxp+nx/2; ++ix )
+			for( int iy=oyp; iy<oyp+ny/2; ++iy )
+				for( int iz=ozp; iz<ozp+nz/2; ++iz )
+					(*fc)(ix,iy,iz) += tLu(ix,iy,iz) - m_scheme.apply( *uc, ix, iy, iz )/(4.0*h2);
+		
+		tLu.deallocate();
 	}
 	
-	//... restrict source term
-	m_gridop.restrict( *ff, *fc );
-	
-	int oi, oj, ok;
-	oi = ff->offset(0);
-	oj = ff->offset(1);
-	ok = ff->offset(2);
-	
-	#pragma omp parallel for 
-	for( int ix=oi; ix<oi+(int)ff->size(0)/2; ++ix )
-		for( int iy=oj; iy<oj+(int)ff->size(1)/2; ++iy )
-			for( int iz=ok; iz<ok+(int)ff->size(2)/2; ++iz )
-				(*fc)(ix,iy,iz) += ((tLu( ix, iy, iz ) - (m_scheme.apply( *uc, ix, iy, iz )/(4.0*h2))));
-									
-	tLu.deallocate();
-	
-	meshvar_bnd ucsave(*uc,true);
+	MeshvarBnd<T> ucsave(*uc,true);
 						
 	//... have we reached the end of the recursion or do we need to go up one level?
 	if( ilevel == 1 )
@@ -333,25 +586,25 @@ void solver<S,I,O,T>::twoGrid( unsigned ilevel )
 		else 
 			(*uc)(0,0,0) = (m_scheme.rhs( (*uc), 0, 0, 0 ) + 4.0 * h2 * (*fc)(0,0,0))*c0;
 	else
-		twoGrid( ilevel-1 );
+		for( unsigned icycle=0; icycle<m_ncycle; ++icycle )
+			twoGrid( ilevel-1 );
 	
-	meshvar_bnd cc(*uc,false);
+	//... compute correction on coarse grid, in place of the saved state
+	MeshvarBnd<T>& cc = ucsave;
 	
-		
-	//... compute correction on coarse grid
 	#pragma omp parallel for
 	for( int ix=0; ix<(int)cc.size(0); ++ix )
 		for( int iy=0; iy<(int)cc.size(1); ++iy )
 			for( int iz=0; iz<(int)cc.size(2); ++iz )
-				cc(ix,iy,iz) = (*uc)(ix,iy,iz) - ucsave(ix,iy,iz);	
+				cc(ix,iy,iz) = (*uc)(ix,iy,iz) - cc(ix,iy,iz);	
 		
-	ucsave.deallocate();
-
 	if( m_bperiodic && ilevel <= m_ilevelmin )
 		make_periodic( &cc );
 
 	m_gridop.prolong_add( cc, *uf );
 	
+	ucsave.deallocate();
+	
 	//... interpolate and apply coarse-fine boundary conditions on fine level
 	if( m_bperiodic && ilevel <= m_ilevelmin )
 		make_periodic( uf );
@@ -364,14 +617,9 @@ void solver<S,I,O,T>::twoGrid( unsigned ilevel )
 		if( ilevel > m_ilevelmin )
 			interp().interp_coarse_fine(ilevel,*uc,*uf);
 
-		if( m_smoother == opt::sm_gauss_seidel )
-			GaussSeidel( h, uf, ff );
-		
-		else if( m_smoother == opt::sm_jacobi )
-			Jacobi( h, uf, ff);		
-		
-		else if( m_smoother == opt::sm_sor )
-			SOR( h, uf, ff );
+		//... the last sweep also measures the residual for the convergence test
+		bool last = (i+1 == m_npostsmooth) && ilevel < m_levelerr.size();
+		smooth( h, uf, ff, last? &m_levelerr[ilevel] : NULL );
 		
 		if( m_bperiodic && ilevel <= m_ilevelmin )
 			make_periodic( uf );
@@ -518,10 +766,52 @@ double solver<S,I,O,T>::compute_RMS_resid( const GridHierarchy<T>& uh, const Gri
 }
 
 
+template< class S, class I, class O, typename T >
+double solver<S,I,O,T>::smoothing_error( unsigned levelmin, unsigned levelmax, bool verbose )
+{
+	double maxerr = 0.0;
+	
+	for( unsigned ilevel=levelmin; ilevel <= levelmax; ++ilevel )
+	{
+		if( verbose )
+			std::cout << "      Level " << std::setw(6) << ilevel << ",   Error = " << m_levelerr[ilevel] << std::endl;
+		
+		LOGDEBUG("[mg]      level %3d,  rel. error %g",ilevel, m_levelerr[ilevel]);
+		
+		maxerr = std::max(maxerr,m_levelerr[ilevel]);
+	}
+	return maxerr;
+}
+
+template< class S, class I, class O, typename T >
+void solver<S,I,O,T>::fullMultigrid( unsigned ilevelmax )
+{
+	//... start from a right-hand-side that is consistent on all levels
+	for( int i=ilevelmax; i>0; --i )
+		m_gridop.restrict( *m_pf->get_grid(i), *m_pf->get_grid(i-1) );
+	
+	for( unsigned ilevel=1; ilevel<ilevelmax; ++ilevel )
+	{
+		twoGrid( ilevel );
+		
+		MeshvarBnd<T> *uc = m_pu->get_grid(ilevel), *uf = m_pu->get_grid(ilevel+1);
+		
+		if( m_bperiodic && ilevel <= m_ilevelmin )
+			make_periodic( uc );
+		
+		if( m_fmg == opt::fmg_cubic )
+			mg_cubic().prolong( *uc, *uf );
+		else
+			mg_linear().prolong( *uc, *uf );
+	}
+}
+
 template< class S, class I, class O, typename T >
 double solver<S,I,O,T>::solve( GridHierarchy<T>& uh, double acc, double h, bool verbose )
 {
 
+	profile::timer ptimer("multigrid");
+	
 	double err, maxerr = 1e30;
 	unsigned niter = 0;
 	
@@ -529,19 +819,47 @@ double solver<S,I,O,T>::solve( GridHierarchy<T>& uh, double acc, double h, bool
 	
 	m_pu = &uh;
 	
+	//... residuals are measured during the last post smoothing sweep if there is one
+	if( m_npostsmooth > 0 )
+		m_levelerr.assign( uh.levelmax()+1, 0.0 );
+	else
+		m_levelerr.clear();
+	
+	if( m_fmg != opt::fmg_none )
+	{
+		LOGUSER("Performing full multi-grid initial cycle...");
+		fullMultigrid( uh.levelmax() );
+		profile::count( "multigrid/full_cycles" );
+	}
+	
 	//err = compute_RMS_resid( *m_pu, *m_pf, fullverbose );
 	
+	double errold = 1e30;
+	
 	//... iterate ...//
 	while (true)
 	{
 		
-		LOGUSER("Performing multi-grid V-cycle...");
+		LOGUSER("Performing multi-grid %c-cycle...", (m_ncycle>1)? 'W' : 'V');
 		twoGrid( uh.levelmax() );
+		profile::count( "multigrid/cycles" );
 		
 		//err = compute_RMS_resid( *m_pu, *m_pf, fullverbose );
-		err = compute_error( *m_pu, *m_pf, fullverbose );
+		if( m_npostsmooth > 0 )
+			err = smoothing_error( uh.levelmin(), uh.levelmax(), fullverbose );
+		else
+			err = compute_error( *m_pu, *m_pf, fullverbose );
 		++niter;
 		
+		//... add sweeps when a cycle reduces the error by less than 1/2
+		if( m_nmaxsmooth > 0 && err > 0.5*errold && err > acc && m_npresmooth+m_npostsmooth+2 <= m_nmaxsmooth )
+		{
+			++m_npresmooth;
+			++m_npostsmooth;
+			LOGINFO("Poor multigrid convergence, using %u pre and %u post smoothing sweeps.", m_npresmooth, m_npostsmooth);
+		}
+		errold = err;
+		
 		if( fullverbose ){
 			LOGUSER("  multigrid iteration %3d, maximum RMS residual = %g", niter, err );
 			std::cout << "   - Step No. " << std::setw(3) << niter << ", Max Err = " << err << std::endl;
@@ -674,6 +992,157 @@ void solver<S,I,O,T>::make_periodic( MeshvarBnd<T> *u )
 }
 
 
+/*!
+ * @brief mixed precision multigrid by iterative refinement
+ *
+ * The solution u and the residual r = f + L u are kept in precision T, the
+ * correction equation L e = -r is solved by the multigrid solver in precision
+ * Tl (smoothing, restriction and prolongation) and e is added to u. Residuals
+ * are evaluated on the cells that are not refined, since the right-hand side
+ * of refined cells is replaced by the restricted fine level during the solve.
+ */
+template< class S, class Sl, class I, class O, typename T, typename Tl >
+class mixed_solver : public solver<S,I,O,T>
+{
+protected:
+	double				m_inner_acc;			//!< relative accuracy of each correction solve
+	unsigned			m_nmaxouter;			//!< maximum number of refinement steps
+	
+	//! refresh the boundary cells of u and store f + L u in r, returns the maximum mean relative residual of the levels
+	double residual( GridHierarchy<T>& u, GridHierarchy<Tl>& r, bool verbose );
+	
+public:
+	
+	//! constructor
+	mixed_solver( GridHierarchy<T>& f, opt::smtype smoother, unsigned npresmooth, unsigned npostsmooth, double inner_acc=1e-3 )
+	: solver<S,I,O,T>( f, smoother, npresmooth, npostsmooth ), m_inner_acc( inner_acc ), m_nmaxouter( 10 )
+	{ }
+	
+	//! solve Poisson's equation 
+	double solve( GridHierarchy<T>& u, double accuracy, bool verbose=false );
+};
+
+template< class S, class Sl, class I, class O, typename T, typename Tl >
+double mixed_solver<S,Sl,I,O,T,Tl>::residual( GridHierarchy<T>& uh, GridHierarchy<Tl>& rh, bool verbose )
+{
+	double maxerr = 0.0;
+	
+	for( unsigned ilevel=uh.levelmin(); ilevel <= uh.levelmax(); ++ilevel )
+	{
+		MeshvarBnd<T> *u = uh.get_grid(ilevel);
+		const MeshvarBnd<T> *f = this->m_pf->get_grid(ilevel);
+		MeshvarBnd<Tl> *r = rh.get_grid(ilevel);
+		
+		if( ilevel == uh.levelmin() )
+			this->make_periodic( u );
+		else
+			I().interp_coarse_fine( ilevel, *uh.get_grid(ilevel-1), *u );
+		
+		int nx = u->size(0), ny = u->size(1), nz = u->size(2);
+		double h = 1.0/(1ul<<ilevel), h2 = h*h, err = 0.0;
+		size_t count = 0;
+		
+		#pragma omp parallel for reduction(+:err,count)
+		for( int ix=0; ix<nx; ++ix )
+			for( int iy=0; iy<ny; ++iy )
+				for( int iz=0; iz<nz; ++iz )
+				{
+					if( uh.is_refined( ilevel, ix, iy, iz ) )
+					{
+						(*r)(ix,iy,iz) = 0.0;
+						continue;
+					}
+					
+					double res = (double)this->m_scheme.apply( *u, ix, iy, iz ) + h2 * (double)(*f)(ix,iy,iz);
+					double val = (*u)(ix,iy,iz);
+					
+					(*r)(ix,iy,iz) = (Tl)(res/h2);
+					
+					if( fabs(val) > 0.0 )
+					{
+						err += fabs( res/val );
+						++count;
+					}
+				}
+		
+		if( count != 0 )
+			err /= count;
+		
+		if( verbose )
+			std::cout << "      Level " << std::setw(6) << ilevel << ",   Error = " << err << std::endl;
+		
+		LOGDEBUG("[mg]      level %3d,  rel. error %g (mixed precision)",ilevel, err);
+		
+		maxerr = std::max(maxerr,err);
+	}
+	
+	return maxerr;
+}
+
+template< class S, class Sl, class I, class O, typename T, typename Tl >
+double mixed_solver<S,Sl,I,O,T,Tl>::solve( GridHierarchy<T>& uh, double acc, bool verbose )
+{
+	//... low precision hierarchies of the same structure as u
+	GridHierarchy<Tl> rh( uh.m_nbnd );
+	rh.create_base_hierarchy( uh.levelmin() );
+	for( unsigned ilevel=uh.levelmin()+1; ilevel<=uh.levelmax(); ++ilevel )
+		rh.add_patch( uh.offset(ilevel,0), uh.offset(ilevel,1), uh.offset(ilevel,2),
+					  uh.size(ilevel,0), uh.size(ilevel,1), uh.size(ilevel,2) );
+	
+	GridHierarchy<Tl> eh( rh );
+	
+	double err = 1e30;
+	unsigned niter = 0;
+	
+	while( niter < m_nmaxouter )
+	{
+		err = residual( uh, rh, false );
+		LOGUSER("Mixed precision multigrid step %d, maximum error = %g", niter, err);
+		
+		if( err < acc )
+			break;
+		
+		eh.zero();
+		
+		solver<Sl,I,O,Tl> ps( rh, this->m_smoother, this->m_npresmooth, this->m_npostsmooth );
+		ps.set_schedule( this->m_fmg, this->m_ncycle, this->m_nmaxsmooth );
+		ps.solve( eh, std::max( m_inner_acc, acc ), false );
+		
+		for( unsigned ilevel=uh.levelmin(); ilevel <= uh.levelmax(); ++ilevel )
+		{
+			MeshvarBnd<T> *u = uh.get_grid(ilevel);
+			const MeshvarBnd<Tl> *e = eh.get_grid(ilevel);
+			int nx = u->size(0), ny = u->size(1), nz = u->size(2);
+			
+			#pragma omp parallel for
+			for( int ix=0; ix<nx; ++ix )
+				for( int iy=0; iy<ny; ++iy )
+					for( int iz=0; iz<nz; ++iz )
+						(*u)(ix,iy,iz) += (T)(*e)(ix,iy,iz);
+		}
+		
+		++niter;
+	}
+	
+	if( err > acc )
+	{	
+		std::cout << "Error : no convergence in Poisson solver" << std::endl;
+		LOGERR("No convergence in mixed precision Poisson solver, final error: %g.",err);
+	}
+	else if( verbose )
+	{	
+		std::cout << " - Converged in " << niter << " mixed precision steps to " << err << std::endl;
+		LOGUSER("Mixed precision Poisson solver converged to max. error of %g in %d steps.",err,niter);
+	}
+	
+	//.. leave the right-hand-side as the single precision solver does
+	for( int i=this->m_pf->levelmax(); i>0; --i )
+		this->m_gridop.restrict( *this->m_pf->get_grid(i), *this->m_pf->get_grid(i-1) );
+	
+	return err;
+}
+
+
 END_MULTIGRID_NAMESPACE
  
 #endif
@@ -0,0 +1,103 @@
+/*
+
+ music.hh - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#ifndef __MUSIC_HH
+#define __MUSIC_HH
+
+#include <string>
+#include <functional>
+
+#include "config_file.hh"
+#include "output.hh"
+
+/*!
+ * @brief interface for running MUSIC inside another program
+ *
+ * Built as a library (CMake option MUSIC_BUILD_LIBRARY, or 'make lib'), the
+ * code does not define main(). The caller runs the full generation with
+ * music::generate() and receives the fields through an output plug-in of its
+ * own instead of one of the file formats, e.g. to fill the in-memory data of a
+ * simulation code directly. The library registers its plug-ins in static
+ * initialisers, so it has to be linked as a whole (e.g. -Wl,--whole-archive).
+ */
+namespace music
+{
+	//! creates the output plug-in for a realization from the configuration
+	typedef std::function< output_plugin*( config_file& ) > output_factory;
+
+	//! run MUSIC for the parameter file paramfile
+	/*! the fields are handed to the plug-in created by make_output for each realization, which is
+	 *  finalized and deleted by MUSIC, without make_output it is selected by [output] format.
+	 *  Returns 0 on success and 1 if the run was stopped by an error.
+	 */
+	int generate( const std::string& paramfile, const output_factory& make_output = output_factory() );
+
+	/*!
+	 * @class output_sink
+	 * @brief output plug-in that passes every field to a callback
+	 *
+	 * The callback receives the name of the field ("dm_mass", "dm_density", "dm_potential",
+	 * "dm_position", "dm_velocity", "gas_density", "gas_potential", "gas_position" or
+	 * "gas_velocity"), its component (0-2 for vectors, -1 otherwise) and the hierarchy.
+	 * The hierarchy is only valid during the call and the same field may be passed again
+	 * for the next realization of a batch. The callback is called from one thread at a
+	 * time, but with [setup] async_output or overlap_output not from the calling thread.
+	 */
+	class output_sink : public output_plugin
+	{
+	public:
+		typedef std::function< void( const std::string& field, int coord, const grid_hierarchy& gh ) > sink_fn;
+		typedef std::function< void( void ) > finalize_fn;
+
+	protected:
+		sink_fn sink_;
+		finalize_fn finalize_;
+
+	public:
+		output_sink( config_file& cf, const sink_fn& sink, const finalize_fn& fin = finalize_fn() )
+		: output_plugin( cf ), sink_( sink ), finalize_( fin )
+		{ }
+
+		void write_dm_mass( const grid_hierarchy& gh )
+		{	sink_( "dm_mass", -1, gh );	}
+
+		void write_dm_density( const grid_hierarchy& gh )
+		{	sink_( "dm_density", -1, gh );	}
+
+		void write_dm_potential( const grid_hierarchy& gh )
+		{	sink_( "dm_potential", -1, gh );	}
+
+		void write_dm_velocity( int coord, const grid_hierarchy& gh )
+		{	sink_( "dm_velocity", coord, gh );	}
+
+		void write_dm_position( int coord, const grid_hierarchy& gh )
+		{	sink_( "dm_position", coord, gh );	}
+
+		void write_gas_velocity( int coord, const grid_hierarchy& gh )
+		{	sink_( "gas_velocity", coord, gh );	}
+
+		void write_gas_position( int coord, const grid_hierarchy& gh )
+		{	sink_( "gas_position", coord, gh );	}
+
+		void write_gas_density( const grid_hierarchy& gh )
+		{	sink_( "gas_density", -1, gh );	}
+
+		void write_gas_potential( const grid_hierarchy& gh )
+		{	sink_( "gas_potential", -1, gh );	}
+
+		void finalize( void )
+		{
+			if( finalize_ )
+				finalize_();
+		}
+	};
+}
+
+#endif //__MUSIC_HH
@@ -8,6 +8,10 @@
  
 */
 
+#include <cstdio>
+#include <dirent.h>
+#include <sys/stat.h>
+
 #include "output.hh"
 
 
@@ -56,5 +60,61 @@ output_plugin *select_output_plugin( config_file& cf )
 	return the_output_plugin;
 }
 
+void output_profiler::count_field( const grid_hierarchy& gh )
+{
+	double nbytes = 0.0;
+	for( unsigned ilevel=gh.levelmin(); ilevel<=gh.levelmax(); ++ilevel )
+		nbytes += (double)gh.size(ilevel,0) * (double)gh.size(ilevel,1) * (double)gh.size(ilevel,2) * sizeof(real_t);
+	profile::count( "output/" + format_ + "/field_bytes", nbytes );
+}
 
+//! size of the file fname, or of the regular files in the directory fname, -1 if there is neither
+static double output_size( const std::string& fname )
+{
+	struct stat st;
+	if( stat( fname.c_str(), &st ) != 0 )
+		return -1.0;
+	
+	if( S_ISREG( st.st_mode ) )
+		return (double)st.st_size;
+	
+	if( !S_ISDIR( st.st_mode ) )
+		return -1.0;
+	
+	double nbytes = 0.0;
+	DIR *dir = opendir( fname.c_str() );
+	if( dir == NULL )
+		return -1.0;
+	
+	struct dirent *pe;
+	while( (pe = readdir( dir )) != NULL )
+	{
+		std::string fentry = fname + "/" + pe->d_name;
+		if( stat( fentry.c_str(), &st ) == 0 && S_ISREG( st.st_mode ) )
+			nbytes += (double)st.st_size;
+	}
+	closedir( dir );
+	
+	return nbytes;
+}
 
+output_profiler::~output_profiler()
+{
+	delete pout_;
+	
+	//... the output is a file or directory, or is split into the files <filename>.0, <filename>.1, ...
+	double nbytes = output_size( fname_ );
+	if( nbytes < 0.0 )
+		for( int ifile=0; ; ++ifile )
+		{
+			char suffix[32];
+			snprintf( suffix, sizeof(suffix), ".%d", ifile );
+			double n = output_size( fname_ + suffix );
+			if( n < 0.0 )
+				break;
+			nbytes = std::max( nbytes, 0.0 ) + n;
+		}
+	
+	if( nbytes >= 0.0 )
+		profile::count( "output/" + format_ + "/file_bytes", nbytes );
+}
@@ -13,9 +13,12 @@
 
 #include <string>
 #include <map>
+#include <vector>
+#include <algorithm>
 
 #include "general.hh"
 #include "mesh.hh"
+#include "profile.hh"
 
 
 /*!
@@ -73,7 +76,8 @@ public:
 	explicit output_plugin( config_file& cf )
 	: cf_(cf)
 	{ 
-		fname_		= cf.getValue<std::string>("output","filename");
+		//... checked by the driver for the built-in plug-ins, a plug-in supplied by the caller may not need one
+		fname_		= cf.getValueSafe<std::string>("output","filename","");
 		levelmin_	= cf.getValue<unsigned>( "setup", "levelmin" );
 		levelmax_	= cf.getValue<unsigned>( "setup", "levelmax" );
 
@@ -121,6 +125,157 @@ public:
 	virtual void finalize( void ) = 0;
 };
 
+/*!
+ * @class output_profiler
+ * @brief output plug-in that passes all calls on to another one and profiles them
+ *
+ * Every call is timed as 'output/<call>' and the bytes of the fields handed over
+ * are counted as 'output/<format>/field_bytes'. Once the wrapped plug-in, which
+ * is owned by the profiler, is deleted, the size of the output written to
+ * [output] filename is counted as 'output/<format>/file_bytes'.
+ */
+class output_profiler : public output_plugin
+{
+protected:
+	output_plugin *pout_;
+	std::string format_;
+	
+	void count_field( const grid_hierarchy& gh );
+	
+public:
+	output_profiler( config_file& cf, output_plugin *pout, const std::string& format )
+	: output_plugin( cf ), pout_( pout ), format_( format )
+	{ }
+	
+	~output_profiler();
+	
+	void write_dm_mass( const grid_hierarchy& gh )
+	{	profile::timer t("output/write_dm_mass"); count_field( gh ); pout_->write_dm_mass( gh );	}
+	
+	void write_dm_density( const grid_hierarchy& gh )
+	{	profile::timer t("output/write_dm_density"); count_field( gh ); pout_->write_dm_density( gh );	}
+	
+	void write_dm_potential( const grid_hierarchy& gh )
+	{	profile::timer t("output/write_dm_potential"); count_field( gh ); pout_->write_dm_potential( gh );	}
+	
+	void write_dm_velocity( int coord, const grid_hierarchy& gh )
+	{	profile::timer t("output/write_dm_velocity"); count_field( gh ); pout_->write_dm_velocity( coord, gh );	}
+	
+	void write_dm_position( int coord, const grid_hierarchy& gh )
+	{	profile::timer t("output/write_dm_position"); count_field( gh ); pout_->write_dm_position( coord, gh );	}
+	
+	void write_gas_velocity( int coord, const grid_hierarchy& gh )
+	{	profile::timer t("output/write_gas_velocity"); count_field( gh ); pout_->write_gas_velocity( coord, gh );	}
+	
+	void write_gas_position( int coord, const grid_hierarchy& gh )
+	{	profile::timer t("output/write_gas_position"); count_field( gh ); pout_->write_gas_position( coord, gh );	}
+	
+	void write_gas_density( const grid_hierarchy& gh )
+	{	profile::timer t("output/write_gas_density"); count_field( gh ); pout_->write_gas_density( gh );	}
+	
+	void write_gas_potential( const grid_hierarchy& gh )
+	{	profile::timer t("output/write_gas_potential"); count_field( gh ); pout_->write_gas_potential( gh );	}
+	
+	void finalize( void )
+	{	profile::timer t("output/finalize"); pout_->finalize();	}
+};
+
+/*!
+ * @class particle_batches
+ * @brief the particles of a grid hierarchy, assembled in batches on all threads
+ *
+ * The particles are the leaf cells (in the mask and not refined) of the levels
+ * lmin..lmax, ordered from the finest level to the coarsest and by i,j,k within
+ * a level, which is the order in which the particle plug-ins store them. Each
+ * call of next() fills a batch with one value per particle computed by a functor
+ * f(ilevel,i,j,k), so that a plug-in only serializes batches instead of looping
+ * over the hierarchy itself. The functor is called concurrently and must not
+ * modify shared state; the level it reads is fetched before it is called.
+ */
+class particle_batches
+{
+protected:
+	const grid_hierarchy& gh_;
+	int lmin_, lmax_;
+	size_t np_, pos_;
+	
+	//! index of the first particle of each x-plane of each level (finest first), plus the end
+	std::vector< std::vector<size_t> > first_;
+	
+public:
+	
+	particle_batches( const grid_hierarchy& gh, unsigned lmin, unsigned lmax )
+	: gh_( gh ), lmin_( lmin ), lmax_( lmax ), np_( 0 ), pos_( 0 )
+	{
+		for( int ilevel=lmax_; ilevel>=lmin_; --ilevel )
+		{
+			int nx = gh.size(ilevel,0), ny = gh.size(ilevel,1), nz = gh.size(ilevel,2);
+			std::vector<size_t> n( nx+1, 0 );
+			
+			#pragma omp parallel for
+			for( int i=0; i<nx; ++i )
+				for( int j=0; j<ny; ++j )
+					for( int k=gh.next_leaf(ilevel,i,j,0); k<nz; k=gh.next_leaf(ilevel,i,j,k+1) )
+						++n[i+1];
+			
+			n[0] = np_;
+			for( int i=0; i<nx; ++i )
+				n[i+1] += n[i];
+			np_ = n[nx];
+			
+			first_.push_back( n );
+		}
+	}
+	
+	//! total number of particles
+	size_t size( void ) const
+	{	return np_;	}
+	
+	//! number of particles returned so far
+	size_t position( void ) const
+	{	return pos_;	}
+	
+	//! start over with the first particle
+	void rewind( void )
+	{	pos_ = 0;	}
+	
+	//! store f(ilevel,i,j,k) of the next (at most nmax) particles in out, returns their number, 0 at the end
+	template< typename T, typename F >
+	size_t next( T* out, size_t nmax, F f )
+	{
+		size_t p0 = pos_, p1 = std::min( np_, pos_+nmax );
+		
+		for( size_t l=0; l<first_.size(); ++l )
+		{
+			const std::vector<size_t>& n = first_[l];
+			int nx = (int)n.size()-1;
+			if( n[nx] <= p0 || n[0] >= p1 )
+				continue;
+			
+			int ilevel = lmax_ - (int)l;
+			int ny = gh_.size(ilevel,1), nz = gh_.size(ilevel,2);
+			gh_.get_grid( ilevel );
+			
+			//... the x-planes that hold particles p0..p1-1
+			int i0 = std::max( 0, (int)(std::upper_bound( n.begin(), n.end(), p0 ) - n.begin()) - 1 );
+			int i1 = std::min( nx, (int)(std::lower_bound( n.begin(), n.end(), p1 ) - n.begin()) );
+			
+			#pragma omp parallel for schedule(dynamic)
+			for( int i=i0; i<i1; ++i )
+			{
+				size_t p = n[i];
+				for( int j=0; j<ny && p<p1; ++j )
+					for( int k=gh_.next_leaf(ilevel,i,j,0); k<nz && p<p1; k=gh_.next_leaf(ilevel,i,j,k+1), ++p )
+						if( p >= p0 )
+							out[p-p0] = (T)f( ilevel, i, j, k );
+			}
+		}
+		
+		pos_ = p1;
+		return p1-p0;
+	}
+};
+
 /*!
  * @brief implements abstract factory design pattern for output plug-ins
  */
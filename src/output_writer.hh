@@ -0,0 +1,224 @@
+/*
+
+ output_writer.hh - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#ifndef __OUTPUT_WRITER_HH
+#define __OUTPUT_WRITER_HH
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "log.hh"
+#include "mesh.hh"
+
+/*!
+ * @brief background writer that hands grid hierarchies off to the output plugin
+ *
+ * Writes of whole hierarchies are queued to a single writer thread, so output
+ * plugins, which are not thread-safe, are still called one at a time and in
+ * order. The hierarchy is either snapshotted into a pooled buffer (the caller
+ * keeps using its own) or moved into the queue when the caller is done with it.
+ * At most max_pending buffers are in flight, further writes wait for a free one;
+ * a buffer keeps its storage for reuse only while further writes are queued.
+ * With [setup] stream_levels the queued hierarchies wait in scratch files and
+ * are read back level by level by the plugin.
+ * When disabled, all writes are performed immediately on the calling thread.
+ *
+ * Everything else that calls the plugin has to call wait() first.
+ */
+class output_writer
+{
+public:
+	typedef std::function<void(const grid_hierarchy&)> write_fn;
+
+protected:
+	struct job
+	{
+		std::string name;
+		grid_hierarchy *gh;
+		write_fn fn;
+	};
+
+	bool async_;
+	unsigned max_pending_, nbuffers_;
+	std::deque< job > queue_;
+	std::vector< grid_hierarchy* > free_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::exception_ptr error_;
+	bool busy_, stop_;
+	std::thread thread_;
+
+	void work( void )
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		while( true )
+		{
+			while( queue_.empty() && !stop_ )
+				cv_.wait( lock );
+			if( queue_.empty() )
+				return;
+
+			job j = queue_.front();
+			queue_.pop_front();
+			busy_ = true;
+			bool skip = (bool)error_;
+			lock.unlock();
+
+			LOGUSER("Writing %s", j.name.c_str());
+			std::exception_ptr e;
+			try{
+				if( !skip )
+				{
+					profile::timer ptimer( "writing " + j.name );
+					j.fn( *j.gh );
+				}
+			}catch(...){
+				e = std::current_exception();
+			}
+
+			lock.lock();
+			if( e && !error_ )
+				error_ = e;
+			//... keep the storage only while more writes are waiting
+			if( queue_.empty() )
+				j.gh->deallocate();
+			else
+				j.gh->discard_stream();
+			free_.push_back( j.gh );
+			busy_ = false;
+			cv_.notify_all();
+		}
+	}
+
+	//! rethrow an error of the writer thread, call with the lock held
+	void check( std::unique_lock<std::mutex>& lock )
+	{
+		if( error_ )
+		{
+			std::exception_ptr e = error_;
+			error_ = std::exception_ptr();
+			lock.unlock();
+			std::rethrow_exception( e );
+		}
+	}
+
+	//! a buffer that is not in flight, waits for one if max_pending are
+	grid_hierarchy* acquire( std::unique_lock<std::mutex>& lock, unsigned nbnd )
+	{
+		while( free_.empty() && nbuffers_ >= max_pending_ && !error_ )
+			cv_.wait( lock );
+		check( lock );
+
+		if( free_.empty() )
+		{
+			++nbuffers_;
+			return new grid_hierarchy( nbnd );
+		}
+
+		grid_hierarchy *gh = free_.back();
+		free_.pop_back();
+		return gh;
+	}
+
+	void enqueue( const std::string& name, grid_hierarchy* gh, const write_fn& fn )
+	{
+		std::lock_guard<std::mutex> lock( mutex_ );
+		job j = { name, gh, fn };
+		queue_.push_back( j );
+		cv_.notify_all();
+	}
+
+public:
+
+	explicit output_writer( bool async, unsigned max_pending = 1 )
+	: async_( async ), max_pending_( max_pending>0? max_pending : 1 ), nbuffers_( 0 ), busy_( false ), stop_( false )
+	{
+		if( async_ )
+			thread_ = std::thread( &output_writer::work, this );
+	}
+
+	~output_writer()
+	{
+		{
+			std::lock_guard<std::mutex> lock( mutex_ );
+			stop_ = true;
+			cv_.notify_all();
+		}
+		if( thread_.joinable() )
+			thread_.join();
+
+		for( size_t i=0; i<free_.size(); ++i )
+			delete free_[i];
+	}
+
+	bool is_async( void ) const
+	{	return async_;	}
+
+	//! write a snapshot of gh, gh may be changed as soon as the call returns
+	void write( const std::string& name, const grid_hierarchy& gh, const write_fn& fn )
+	{
+		if( !async_ )
+		{
+			LOGUSER("Writing %s", name.c_str());
+			profile::timer ptimer( "writing " + name );
+			fn( gh );
+			return;
+		}
+
+		grid_hierarchy *buf;
+		{
+			std::unique_lock<std::mutex> lock( mutex_ );
+			buf = acquire( lock, gh.m_nbnd );
+		}
+		*buf = gh;
+		buf->stream();
+		enqueue( name, buf, fn );
+	}
+
+	//! write gh, which is taken over and left empty
+	void write( const std::string& name, grid_hierarchy&& gh, const write_fn& fn )
+	{
+		if( !async_ )
+		{
+			LOGUSER("Writing %s", name.c_str());
+			profile::timer ptimer( "writing " + name );
+			fn( gh );
+			gh.deallocate();
+			return;
+		}
+
+		grid_hierarchy *buf;
+		{
+			std::unique_lock<std::mutex> lock( mutex_ );
+			buf = acquire( lock, gh.m_nbnd );
+		}
+		*buf = std::move( gh );
+		buf->stream();
+		enqueue( name, buf, fn );
+	}
+
+	//! wait until all queued writes are done, rethrows the first error of the writer
+	void wait( void )
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		while( !queue_.empty() || busy_ )
+			cv_.wait( lock );
+		check( lock );
+	}
+
+};
+
+#endif //__OUTPUT_WRITER_HH
@@ -0,0 +1,149 @@
+/*
+
+ philox.hh - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#ifndef __PHILOX_HH
+#define __PHILOX_HH
+
+#include <stdint.h>
+#include <cstddef>
+#include <cmath>
+
+//! transform n pairs of uniform deviates in ]0,1] into n pairs of unit variance Gaussians
+/*! plain Box-Muller without branches, so that the loop can be vectorized by the compiler
+ *  (a scalar loop is the fallback), used by the row-wise batch samplers
+ */
+inline void box_muller_batch( const double *u1, const double *u2, double *g1, double *g2, size_t n )
+{
+#pragma omp simd
+	for( size_t m=0; m<n; ++m )
+	{
+		double rad = sqrt( -2.0 * log( u1[m] ) ), phi = 2.0 * M_PI * u2[m];
+		g1[m] = rad * cos( phi );
+		g2[m] = rad * sin( phi );
+	}
+}
+
+/*!
+ * @brief stateless counter-based random number generator (Philox4x32-10)
+ *
+ * Implements the Philox4x32 generator of Salmon et al. (2011). The output is a
+ * pure function of a 128bit counter and a 64bit key, so any random number in a
+ * stream can be computed independently of all others. We use the global cell
+ * index as counter and the seed as key, which makes a white noise field independent
+ * of the decomposition into cubes and of the number of threads.
+ */
+class philox4x32
+{
+protected:
+	uint32_t key_[2];
+
+	static inline uint32_t mulhilo( uint32_t a, uint32_t b, uint32_t& hi )
+	{
+		uint64_t p = (uint64_t)a * (uint64_t)b;
+		hi = (uint32_t)(p >> 32);
+		return (uint32_t)p;
+	}
+
+public:
+
+	//! constructor, the 64bit seed is used as key
+	explicit philox4x32( uint64_t seed )
+	{
+		key_[0] = (uint32_t)seed;
+		key_[1] = (uint32_t)(seed >> 32);
+	}
+
+	//! compute the four 32bit random words for a given counter
+	inline void operator()( uint64_t ctr_lo, uint64_t ctr_hi, uint32_t *out ) const
+	{
+		uint32_t c[4] = { (uint32_t)ctr_lo, (uint32_t)(ctr_lo >> 32), (uint32_t)ctr_hi, (uint32_t)(ctr_hi >> 32) };
+		uint32_t k[2] = { key_[0], key_[1] };
+
+		for( int r=0; r<10; ++r )
+		{
+			uint32_t hi0, hi1;
+			uint32_t lo0 = mulhilo( 0xD2511F53u, c[0], hi0 );
+			uint32_t lo1 = mulhilo( 0xCD9E8D57u, c[2], hi1 );
+
+			c[0] = hi1 ^ c[1] ^ k[0];
+			c[1] = lo1;
+			c[2] = hi0 ^ c[3] ^ k[1];
+			c[3] = lo0;
+
+			k[0] += 0x9E3779B9u;
+			k[1] += 0xBB67AE85u;
+		}
+
+		out[0] = c[0]; out[1] = c[1]; out[2] = c[2]; out[3] = c[3];
+	}
+
+	//! convert two 32bit words into a double uniformly distributed in ]0,1]
+	static inline double to_uniform_pos( uint32_t a, uint32_t b )
+	{
+		return ((double)(a >> 5) * 67108864.0 + (double)(b >> 6) + 1.0) * (1.0/9007199254740992.0);
+	}
+
+	//! unit variance Gaussian deviate associated with a counter via Box-Muller
+	/*! one call of the generator yields a pair of deviates, so two consecutive
+	 *  counters share one evaluation, the parity of idx selects the member of the pair
+	 */
+	inline double gaussian( uint64_t idx ) const
+	{
+		uint32_t r[4];
+		(*this)( idx >> 1, 0, r );
+
+		double u1 = to_uniform_pos( r[0], r[1] );
+		double u2 = to_uniform_pos( r[2], r[3] );
+		double rad = sqrt( -2.0 * log( u1 ) ), phi = 2.0 * M_PI * u2;
+
+		return (idx & 1) ? rad * sin( phi ) : rad * cos( phi );
+	}
+
+	//! fill n consecutive Gaussian deviates starting at counter idx0, identical to n calls of gaussian()
+	/*! the generator is evaluated for a block of pairs at a time and the transformation is
+	 *  done in one batch, so that both loops are free of dependencies between elements
+	 */
+	template< typename T >
+	void gaussian_row( uint64_t idx0, size_t n, T *out ) const
+	{
+		const size_t nblock = 64;
+		double u1[nblock], u2[nblock], g1[nblock], g2[nblock];
+
+		uint64_t idx = idx0, idxend = idx0 + n;
+
+		while( idx < idxend )
+		{
+			uint64_t p0 = idx >> 1;
+			size_t np = (size_t)(((idxend - 1) >> 1) - p0 + 1);
+			if( np > nblock ) np = nblock;
+
+			for( size_t m=0; m<np; ++m )
+			{
+				uint32_t r[4];
+				(*this)( p0 + m, 0, r );
+				u1[m] = to_uniform_pos( r[0], r[1] );
+				u2[m] = to_uniform_pos( r[2], r[3] );
+			}
+
+			box_muller_batch( u1, u2, g1, g2, np );
+
+			uint64_t iend = (p0 + np) << 1;
+			if( iend > idxend ) iend = idxend;
+
+			for( ; idx < iend; ++idx )
+			{
+				size_t m = (size_t)((idx >> 1) - p0);
+				*out++ = (T)((idx & 1) ? g2[m] : g1[m]);
+			}
+		}
+	}
+};
+
+#endif //__PHILOX_HH
@@ -0,0 +1,126 @@
+/*
+
+ art_pages.hh - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2012  Jose Onorbe & Oliver Hahn
+
+ */
+
+#ifndef __ART_PAGES_HH
+#define __ART_PAGES_HH
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+
+#include "log.hh"
+#include "byte_order.hh"
+
+/*!
+ * @brief writes the particle pages of the ART and CART direct format files
+ *
+ * Each page holds npage values of every field, one field after the other, and
+ * the last page is padded with zeros. The fields are read from their temporary
+ * files (a size_t byte count followed by npart values) by one thread each and
+ * byte swapped if requested, while the previous page is written by a separate
+ * thread, so reading, swapping and writing overlap.
+ */
+template< typename T >
+void assemble_art_pages( const std::string& partfname, const std::vector<std::string>& fields,
+						size_t npart, size_t npage, bool swap_endianness, const char* format )
+{
+	const size_t nfields = fields.size();
+	std::vector< std::ifstream > ifs( nfields );
+
+	for( size_t i=0; i<nfields; ++i )
+	{
+		size_t blk = 0;
+
+		ifs[i].open( fields[i].c_str(), std::ios::binary );
+		if( !ifs[i].good() )
+		{
+			LOGERR("Could not open buffer file \'%s\' in %s output plug-in", fields[i].c_str(), format);
+			throw std::runtime_error("Could not open buffer file in output plug-in");
+		}
+
+		ifs[i].read( (char*)&blk, sizeof(size_t) );
+		if( blk != npart*sizeof(T) )
+		{
+			LOGERR("Internal consistency error in %s output plug-in", format);
+			LOGERR("Expected %llu bytes in temp file but found %llu", (unsigned long long)(npart*sizeof(T)), (unsigned long long)blk);
+			throw std::runtime_error("Internal consistency error in output plug-in");
+		}
+	}
+
+	std::ofstream ofs( partfname.c_str(), std::ios::binary|std::ios::trunc );
+	if( !ofs.good() )
+	{
+		LOGERR("%s output plug-in could not open output file \'%s\' for writing!", format, partfname.c_str());
+		throw std::runtime_error("Could not open output file in output plug-in");
+	}
+
+	// two pages: one is filled while the other one is written
+	std::vector<T> page[2];
+	page[0].resize( nfields*npage );
+	page[1].resize( nfields*npage );
+
+	std::thread writer;
+	bool bread_ok = true;
+
+	for( size_t ip=0, npleft=npart; npleft > 0; ++ip )
+	{
+		size_t n2read = std::min( npage, npleft );
+		T* buf = &page[ip%2][0];
+
+		#pragma omp parallel for num_threads(nfields)
+		for( int i=0; i<(int)nfields; ++i )
+		{
+			T* p = buf + i*npage;
+			ifs[i].read( reinterpret_cast<char*>(p), n2read*sizeof(T) );
+
+			// To make sure last page in zooms have 0s in non-relevant values
+			std::fill( p+n2read, p+npage, T(0) );
+
+			if( swap_endianness )
+				byte_order::swap( p, npage );
+		}
+
+		for( size_t i=0; i<nfields; ++i )
+			bread_ok &= ifs[i].good();
+
+		if( writer.joinable() )
+			writer.join();
+
+		if( !bread_ok || !ofs.good() )
+			break;
+
+		writer = std::thread( [&ofs,buf,nfields,npage](){
+			ofs.write( reinterpret_cast<const char*>(buf), nfields*npage*sizeof(T) ); } );
+
+		npleft -= n2read;
+	}
+
+	if( writer.joinable() )
+		writer.join();
+
+	ofs.close();
+
+	if( !bread_ok )
+	{
+		LOGERR("I/O error while reading temporary files in %s output plug-in", format);
+		throw std::runtime_error("I/O error while reading temporary files in output plug-in");
+	}
+
+	if( ofs.fail() )
+	{
+		LOGERR("I/O error while writing file \'%s\' in %s output plug-in", partfname.c_str(), format);
+		throw std::runtime_error("I/O error while writing output file in output plug-in");
+	}
+}
+
+#endif //__ART_PAGES_HH
@@ -247,6 +247,51 @@ struct convex_hull{
         return true;
     }
     
+    //! check the row of n points (x,y,z[k]), inside[k] is set to 1 if check_point would return true and to 0 otherwise
+    template< typename T >
+    void check_row( T x, T y, const T* z, size_t n, unsigned char *inside, double dist = 0.0 ) const
+    {
+        dist *= -1.0;
+        
+        // take care of possible periodic boundaries, the wrapped z values are kept per point
+        T xw[2], xin[2] = { x, y };
+        for( size_t p=0; p<2; ++p )
+        {
+            T d = xin[p] - anchor_pt_[p];
+            if( d>0.5 ) xw[p] = xin[p]-1.0; else if ( d<-0.5 ) xw[p] = xin[p]+1.0; else xw[p] = xin[p];
+        }
+        
+        std::vector<T> zw( n );
+        for( size_t k=0; k<n; ++k )
+        {
+            T d = z[k] - anchor_pt_[2];
+            if( d>0.5 ) zw[k] = z[k]-1.0; else if ( d<-0.5 ) zw[k] = z[k]+1.0; else zw[k] = z[k];
+            inside[k] = 1;
+        }
+        
+        // the x and y parts of the distance to each plane are shared by the row, a plane
+        // excludes a point if its distance is below dist, as in check_point
+        size_t ninside = n;
+        for( int iul=0; iul<2 && ninside>0; ++iul )
+        {
+            const std::vector<real_t>& normals = (iul==0)? normals_L_ : normals_U_;
+            const std::vector<real_t>& x0 = (iul==0)? x0_L_ : x0_U_;
+            
+            for( size_t i=0; i<normals.size()/3 && ninside>0; ++i )
+            {
+                const real_t *nn = &normals[3*i];
+                double dxy = (xw[0]-x0[3*i+0])*nn[0] + (xw[1]-x0[3*i+1])*nn[1];
+                
+                ninside = 0;
+                for( size_t k=0; k<n; ++k )
+                {
+                    inside[k] &= (dxy + (zw[k]-x0[3*i+2])*nn[2] >= dist);
+                    ninside += inside[k];
+                }
+            }
+        }
+    }
+    
     void expand_vector_from_centroid( real_t *v, double dr  )
     {
         double dx[3], d = 0.0;
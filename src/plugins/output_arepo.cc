@@ -19,6 +19,7 @@
 #include <sstream>
 #include <string>
 #include <algorithm>
+#include <map>
 #include "output.hh"
 #include "HDF_IO.hh"
 
@@ -50,48 +51,127 @@ protected:
 
   using output_plugin::cf_;
 
-  // Nx1 vector (e.g. masses,particleids)
-  template <typename T>
-  void writeHDF5_a(std::string fieldName, int partTypeNum, const std::vector<T> &data)
+  // open files, their particle type groups and the datasets created so far, all kept open until finalize()
+  std::vector<hid_t> fileIDs;
+  std::vector<std::map<int, hid_t>> groupIDs;
+  std::map<std::string, std::vector<hid_t>> datasetIDs;
+  hsize_t chunkRows;
+
+  // coarse DM positions/velocities of multimass runs with baryons are combined with the coarse gas
+  // before they are written, whichever of the two components arrives first is held here in the output
+  // precision (only the buffers of that precision are used)
+  std::vector<float> coarseHeldFloat[2][3];
+  std::vector<double> coarseHeldDouble[2][3];
+  bool coarseHeldGas[2][3];
+
+  std::vector<float> &coarseHeld(int field, int coord, float) { return coarseHeldFloat[field][coord]; }
+  std::vector<double> &coarseHeld(int field, int coord, double) { return coarseHeldDouble[field][coord]; }
+
+  std::string fileName(unsigned i) const
   {
-    hid_t HDF_FileID, HDF_GroupID, HDF_DatasetID, HDF_DataspaceID, HDF_Type;
-    hsize_t HDF_Dims, offset = 0;
+    std::string filename = fname_;
+    if (numFiles > 1)
+    {
+      std::stringstream s;
+      s << "." << i << ".hdf5";
+      filename.replace(filename.find(".hdf5"), 5, s.str());
+    }
+    return filename;
+  }
+
+  // number of the n entries that go to file i, offset = entries in the files before it
+  hsize_t fileCount(size_t n, unsigned i, hsize_t offset) const
+  {
+    if (numFiles == 1)
+      return n;
+    if (i == numFiles - 1)
+      return n - offset;
+    return n / numFiles;
+  }
 
+  void createGroup(unsigned i, int partTypeNum)
+  {
     std::stringstream GrpName;
     GrpName << "PartType" << partTypeNum;
 
-    for (unsigned i = 0; i < numFiles; i++)
+    hid_t HDF_GroupID = H5Gcreate(fileIDs[i], GrpName.str().c_str(), 0);
+    if (HDF_GroupID < 0)
+      throw std::runtime_error("Error: Could not create group " + GrpName.str() + " in Arepo output file.");
+
+    groupIDs[i][partTypeNum] = HDF_GroupID;
+  }
+
+  // dataset fieldName of a particle type in file i, created with nrows x ncol entries on first use
+  template <typename T>
+  hid_t openDataset(const std::string &fieldName, int partTypeNum, unsigned i, hsize_t nrows, int ncol)
+  {
+    std::stringstream key;
+    key << "PartType" << partTypeNum << "/" << fieldName;
+
+    std::vector<hid_t> &ids = datasetIDs[key.str()];
+    if (ids.empty())
+      ids.assign(numFiles, -1);
+
+    if (ids[i] < 0)
     {
-      std::string filename = fname_;
-      HDF_Dims = data.size();
+      std::map<int, hid_t>::iterator it = groupIDs[i].find(partTypeNum);
+      if (it == groupIDs[i].end())
+        throw std::runtime_error("Error: Arepo output has no group for dataset " + key.str() + ".");
 
-      // modify local filename and write size
-      if (numFiles > 1)
-      {
-        std::stringstream s;
-        s << "." << i << ".hdf5";
-        filename.replace(filename.find(".hdf5"), 5, s.str());
+      hsize_t dims[2] = {nrows, (hsize_t)ncol};
+      hid_t HDF_DataspaceID = H5Screate_simple(ncol > 1 ? 2 : 1, dims, NULL);
 
-        HDF_Dims = ceil(data.size() / numFiles);
-        if (i == numFiles - 1)
-          HDF_Dims = data.size() - offset;
+      // chunks span one column, as Nx3 datasets are written one coordinate at a time
+      hid_t HDF_PropID = H5Pcreate(H5P_DATASET_CREATE);
+      if (nrows > 0)
+      {
+        hsize_t chunk[2] = {std::min(nrows, chunkRows), 1};
+        H5Pset_chunk(HDF_PropID, ncol > 1 ? 2 : 1, chunk);
       }
 
-      HDF_FileID = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
-      HDF_GroupID = H5Gopen(HDF_FileID, GrpName.str().c_str());
+      ids[i] = H5Dcreate(it->second, fieldName.c_str(), GetDataType<T>(), HDF_DataspaceID, HDF_PropID);
 
-      HDF_Type = GetDataType<T>();
-      HDF_DataspaceID = H5Screate_simple(1, &HDF_Dims, NULL);
-      HDF_DatasetID = H5Dcreate(HDF_GroupID, fieldName.c_str(), HDF_Type, HDF_DataspaceID, H5P_DEFAULT);
+      H5Pclose(HDF_PropID);
+      H5Sclose(HDF_DataspaceID);
 
-      // write and close
-      H5Dwrite(HDF_DatasetID, HDF_Type, H5S_ALL, H5S_ALL, H5P_DEFAULT, &data[offset]);
+      if (ids[i] < 0)
+        throw std::runtime_error("Error: Could not create Arepo dataset " + key.str() + ".");
+    }
 
-      H5Dclose(HDF_DatasetID);
-      H5Sclose(HDF_DataspaceID);
+    return ids[i];
+  }
 
-      H5Gclose(HDF_GroupID);
-      H5Fclose(HDF_FileID);
+  void closeFiles(void)
+  {
+    for (auto &d : datasetIDs)
+      for (size_t i = 0; i < d.second.size(); i++)
+        if (d.second[i] >= 0)
+          H5Dclose(d.second[i]);
+    datasetIDs.clear();
+
+    for (size_t i = 0; i < groupIDs.size(); i++)
+      for (auto &g : groupIDs[i])
+        H5Gclose(g.second);
+    groupIDs.clear();
+
+    for (size_t i = 0; i < fileIDs.size(); i++)
+      H5Fclose(fileIDs[i]);
+    fileIDs.clear();
+  }
+
+  // Nx1 vector (e.g. masses,particleids)
+  template <typename T>
+  void writeHDF5_a(std::string fieldName, int partTypeNum, const std::vector<T> &data)
+  {
+    hsize_t offset = 0;
+
+    for (unsigned i = 0; i < numFiles; i++)
+    {
+      hsize_t HDF_Dims = fileCount(data.size(), i, offset);
+      hid_t HDF_DatasetID = openDataset<T>(fieldName, partTypeNum, i, HDF_Dims, 1);
+
+      if (HDF_Dims > 0 && H5Dwrite(HDF_DatasetID, GetDataType<T>(), H5S_ALL, H5S_ALL, H5P_DEFAULT, &data[offset]) < 0)
+        throw std::runtime_error("Error: Could not write Arepo dataset " + fieldName + ".");
 
       offset += HDF_Dims;
     }
@@ -99,77 +179,72 @@ protected:
 
   // Nx3 vector (e.g. pos,vel), where coord = index of the second dimension (written one at a time)
   template <typename T>
-  void writeHDF5_b(std::string fieldName, int coord, int partTypeNum, std::vector<T> &data, bool readFlag = false)
+  void writeHDF5_b(std::string fieldName, int coord, int partTypeNum, const std::vector<T> &data)
   {
-    hid_t HDF_FileID, HDF_GroupID, HDF_DatasetID, HDF_DataspaceID, HDF_Type;
-    hsize_t HDF_Dims[2], HDF_DimsMem[2], w_offset = 0;
-
-    std::stringstream GrpName;
-    GrpName << "PartType" << partTypeNum;
+    hsize_t w_offset = 0;
 
     for (unsigned i = 0; i < numFiles; i++)
     {
-      std::string filename = fname_;
-      HDF_Dims[0] = data.size();
+      hsize_t nrows = fileCount(data.size(), i, w_offset);
+      hid_t HDF_DatasetID = openDataset<T>(fieldName, partTypeNum, i, nrows, 3);
 
-      // modify local filename and write size
-      if (numFiles > 1)
+      if (nrows > 0)
       {
-        std::stringstream s;
-        s << "." << i << ".hdf5";
-        filename.replace(filename.find(".hdf5"), 5, s.str());
-
-        HDF_Dims[0] = ceil(data.size() / numFiles);
-        if (i == numFiles - 1)
-          HDF_Dims[0] = data.size() - w_offset;
-      }
-
-      HDF_FileID = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
-      HDF_GroupID = H5Gopen(HDF_FileID, GrpName.str().c_str());
+        // memory space is a single column, written to column coord of the dataset
+        hsize_t HDF_DimsMem[2] = {nrows, 1};
+        hid_t HDF_MemoryspaceID = H5Screate_simple(2, HDF_DimsMem, NULL);
 
-      HDF_Type = GetDataType<T>();
-      HDF_Dims[1] = 3;
+        hsize_t count[2] = {nrows, 1}, offset[2] = {0, (hsize_t)coord};
+        hid_t HDF_DataspaceID = H5Dget_space(HDF_DatasetID);
+        H5Sselect_hyperslab(HDF_DataspaceID, H5S_SELECT_SET, offset, NULL, count, NULL);
 
-      // if dataset does not yet exist, create it (on first coord call)
-      if (!(H5Lexists(HDF_GroupID, fieldName.c_str(), H5P_DEFAULT)))
-      {
-        HDF_DataspaceID = H5Screate_simple(2, HDF_Dims, NULL);
-        HDF_DatasetID = H5Dcreate(HDF_GroupID, fieldName.c_str(), HDF_Type, HDF_DataspaceID, H5P_DEFAULT);
+        herr_t status = H5Dwrite(HDF_DatasetID, GetDataType<T>(), HDF_MemoryspaceID, HDF_DataspaceID, H5P_DEFAULT,
+                                 &data[w_offset]);
 
         H5Sclose(HDF_DataspaceID);
-        H5Dclose(HDF_DatasetID);
-      }
+        H5Sclose(HDF_MemoryspaceID);
 
-      // make memory space (just indicates the size/shape of data)
-      HDF_DimsMem[0] = HDF_Dims[0];
-      HDF_DimsMem[1] = 1;
-      hid_t HDF_MemoryspaceID = H5Screate_simple(2, HDF_DimsMem, NULL);
+        if (status < 0)
+          throw std::runtime_error("Error: Could not write Arepo dataset " + fieldName + ".");
+      }
 
-      // open hyperslab
-      hsize_t count[2] = {1, 1}, stride[2] = {1, 1}, offset[2] = {0, 0};
+      w_offset += nrows;
+    }
+  }
 
-      offset[1] = coord;      // set where in the second dimension to write
-      count[0] = HDF_Dims[0]; // set size in the first dimension (num particles of this type)
+  // write coarse DM field 0=Coordinates, 1=Velocities as the mass weighted mean of the npcoarse DM and gas
+  // values, the component passed first is held until the other one arrives
+  template <typename T, typename U>
+  void writeCoarseCombined(int field, int coord, const U *values, bool isGas)
+  {
+    std::vector<T> &held = coarseHeld(field, coord, T());
 
-      HDF_DatasetID = H5Dopen(HDF_GroupID, fieldName.c_str());
-      HDF_DataspaceID = H5Dget_space(HDF_DatasetID);
+    if (held.empty())
+    {
+      held.assign(values, values + npcoarse);
+      coarseHeldGas[field][coord] = isGas;
+      return;
+    }
 
-      H5Sselect_hyperslab(HDF_DataspaceID, H5S_SELECT_SET, offset, stride, count, NULL);
+    if (coarseHeldGas[field][coord] == isGas)
+      throw std::runtime_error("Internal consistency error while combining coarse DM and gas");
 
-      // write (or read) and close
-      if (readFlag)
-        H5Dread(HDF_DatasetID, HDF_Type, HDF_MemoryspaceID, HDF_DataspaceID, H5P_DEFAULT,
-                &data[w_offset]);
-      else
-        H5Dwrite(HDF_DatasetID, HDF_Type, HDF_MemoryspaceID, HDF_DataspaceID, H5P_DEFAULT,
-                 &data[w_offset]);
+    double facb = omega_b / omega0;
+    double facc = (omega0 - omega_b) / omega0;
 
-      H5Dclose(HDF_DatasetID);
-      H5Gclose(HDF_GroupID);
-      H5Fclose(HDF_FileID);
+    // combined in place, the held buffer is written and released
+    for (size_t i = 0; i < npcoarse; i++)
+    {
+      double dm = isGas ? held[i] : values[i];
+      double gas = isGas ? values[i] : held[i];
 
-      w_offset += HDF_Dims[0];
+      double v = facc * dm + facb * gas;
+      held[i] = (T)(field == 0 ? fmod(v + boxSize, boxSize) * posFac : v);
     }
+
+    writeHDF5_b(field == 0 ? "Coordinates" : "Velocities", coord, coarsePartType, held);
+
+    std::vector<T>().swap(held); // deallocate
   }
 
   // called from finalize()
@@ -233,23 +308,14 @@ protected:
     if (levelmax_ > levelmin_ + 1) // morethan2bnd
     {
       // DM particles will have variable masses
-      size_t count = 0;
-
       std::vector<T> data(npcoarse);
 
-      for (int ilevel = gh.levelmax() - 1; ilevel >= (int)gh.levelmin(); --ilevel)
-      {
-        // baryon particles live only on finest grid, these particles here are total matter particles
-        T pmass = omega0 * rhoCrit * pow(boxSize * posFac, 3.0) / pow(2, 3 * ilevel);
-
-        for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
-          for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
-            for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
-              if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
-              {
-                data[count++] = pmass;
-              }
-      }
+      particle_batches particles(gh, gh.levelmin(), gh.levelmax() - 1);
+      size_t count = particles.next(&data[0], npcoarse, [&](int ilevel, int, int, int) -> T
+                                    {
+                                      // baryon particles live only on finest grid, these particles here are total matter particles
+                                      return omega0 * rhoCrit * pow(boxSize * posFac, 3.0) / pow(2, 3 * ilevel);
+                                    });
 
       if (count != npcoarse)
         throw std::runtime_error("Internal consistency error while writing masses");
@@ -297,21 +363,18 @@ protected:
     int ilevel = gh.levelmax();
 
     std::vector<T> data(npfine);
-    size_t count = 0;
 
-    for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
-      for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
-        for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
-          if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
-          {
-            double xx[3];
-            gh.cell_pos(ilevel, i, j, k, xx);
+    particle_batches fine(gh, ilevel, ilevel);
+    size_t count = fine.next(&data[0], npfine, [&](int ilevel, int i, int j, int k) -> double
+                             {
+                               double xx[3];
+                               gh.cell_pos(ilevel, i, j, k, xx);
 
-            xx[coord] = (xx[coord] + (*gh.get_grid(ilevel))(i, j, k)) * boxSize;
-            xx[coord] = fmod(xx[coord] + boxSize, boxSize);
+                               xx[coord] = (xx[coord] + (*gh.get_grid(ilevel))(i, j, k)) * boxSize;
+                               xx[coord] = fmod(xx[coord] + boxSize, boxSize);
 
-            data[count++] = (T)(xx[coord] * posFac);
-          }
+                               return xx[coord] * posFac;
+                             });
 
     writeHDF5_b("Coordinates", coord, HIGHRES_DM_PARTTYPE, data); // write fine DM
 
@@ -322,29 +385,28 @@ protected:
     if (levelmax_ != levelmin_) // multimass
     {
       data = std::vector<T>(npcoarse, 0.0);
-      count = 0;
 
-      for (int ilevel = gh.levelmax() - 1; ilevel >= (int)gh.levelmin(); --ilevel)
-        for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
-          for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
-            for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
-              if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
-              {
-                double xx[3];
-                gh.cell_pos(ilevel, i, j, k, xx);
+      particle_batches coarse(gh, gh.levelmin(), gh.levelmax() - 1);
+      count = coarse.next(&data[0], npcoarse, [&](int ilevel, int i, int j, int k) -> double
+                          {
+                            double xx[3];
+                            gh.cell_pos(ilevel, i, j, k, xx);
 
-                xx[coord] = (xx[coord] + (*gh.get_grid(ilevel))(i, j, k)) * boxSize;
+                            xx[coord] = (xx[coord] + (*gh.get_grid(ilevel))(i, j, k)) * boxSize;
 
-                if (!doBaryons) // if so, we will handle the mod in write_gas_position
-                  xx[coord] = fmod(xx[coord] + boxSize, boxSize) * posFac;
+                            if (!doBaryons) // if so, we will handle the mod in write_gas_position
+                              xx[coord] = fmod(xx[coord] + boxSize, boxSize) * posFac;
 
-                data[count++] = (T)xx[coord];
-              }
+                            return xx[coord];
+                          });
 
       if (count != npcoarse)
         throw std::runtime_error("Internal consistency error while writing coarse DM pos");
 
-      writeHDF5_b("Coordinates", coord, coarsePartType, data); // write coarse DM
+      if (doBaryons)
+        writeCoarseCombined<T>(0, coord, &data[0], false); // combined with coarse gas
+      else
+        writeHDF5_b("Coordinates", coord, coarsePartType, data); // write coarse DM
     }
   }
 
@@ -357,15 +419,10 @@ protected:
     int ilevel = gh.levelmax();
 
     std::vector<T> data(npfine);
-    size_t count = 0;
 
-    for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
-      for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
-        for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
-          if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
-          {
-            data[count++] = (T)(*gh.get_grid(ilevel))(i, j, k) * velFac;
-          }
+    particle_batches fine(gh, ilevel, ilevel);
+    size_t count = fine.next(&data[0], npfine, [&](int ilevel, int i, int j, int k) -> double
+                             { return (T)(*gh.get_grid(ilevel))(i, j, k) * velFac; });
 
     writeHDF5_b("Velocities", coord, HIGHRES_DM_PARTTYPE, data); // write fine DM
 
@@ -376,21 +433,18 @@ protected:
     if (levelmax_ != levelmin_) // multimass
     {
       data = std::vector<T>(npcoarse, 0.0);
-      count = 0;
 
-      for (int ilevel = gh.levelmax() - 1; ilevel >= (int)gh.levelmin(); --ilevel)
-        for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
-          for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
-            for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
-              if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
-              {
-                data[count++] = (T)(*gh.get_grid(ilevel))(i, j, k) * velFac;
-              }
+      particle_batches coarse(gh, gh.levelmin(), gh.levelmax() - 1);
+      count = coarse.next(&data[0], npcoarse, [&](int ilevel, int i, int j, int k) -> double
+                          { return (T)(*gh.get_grid(ilevel))(i, j, k) * velFac; });
 
       if (count != npcoarse)
         throw std::runtime_error("Internal consistency error while writing coarse DM pos");
 
-      writeHDF5_b("Velocities", coord, coarsePartType, data); // write coarse DM
+      if (doBaryons)
+        writeCoarseCombined<T>(1, coord, &data[0], false); // combined with coarse gas
+      else
+        writeHDF5_b("Velocities", coord, coarsePartType, data); // write coarse DM
     }
   }
 
@@ -400,36 +454,17 @@ protected:
     countLeafCells(gh);
 
     std::vector<T> gas_data(npart); // read/write gas at all levels from the gh
-    size_t count = 0;
 
-    for (int ilevel = levelmax_; ilevel >= (int)levelmin_; --ilevel)
-      for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
-        for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
-          for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
-            if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
-            {
-              gas_data[count++] = (T)(*gh.get_grid(ilevel))(i, j, k) * velFac;
-            }
+    particle_batches particles(gh, levelmin_, levelmax_);
+    size_t count = particles.next(&gas_data[0], npart, [&](int ilevel, int i, int j, int k) -> double
+                                  { return (T)(*gh.get_grid(ilevel))(i, j, k) * velFac; });
 
     if (count != npart)
       throw std::runtime_error("Internal consistency error while writing GAS pos");
 
     // calculate modified DM velocities if: multimass and baryons present
     if (doBaryons && npcoarse)
-    {
-      double facb = omega_b / omega0;
-      double facc = (omega0 - omega_b) / omega0;
-
-      std::vector<T> dm_data(npcoarse);
-
-      writeHDF5_b("Velocities", coord, coarsePartType, dm_data, true); // read coarse DM vels
-
-      // overwrite
-      for (size_t i = 0; i < npcoarse; i++)
-        dm_data[i] = facc * dm_data[i] + facb * gas_data[npfine + i];
-
-      writeHDF5_b("Velocities", coord, coarsePartType, dm_data); // overwrite coarse DM vels
-    }                                                            // dm_data deallocated
+      writeCoarseCombined<T>(1, coord, &gas_data[npfine], true);
 
     // restrict gas_data to fine only and request write
     std::vector<T> data(gas_data.begin() + 0, gas_data.begin() + npfine);
@@ -460,50 +495,28 @@ protected:
     nPartTotal[GAS_PARTTYPE] = npfine;
 
     std::vector<double> gas_data(npart); // read/write gas at all levels from the gh
-    size_t count = 0;
 
     double h = 1.0 / (1ul << gh.levelmax());
 
-    for (int ilevel = gh.levelmax(); ilevel >= (int)gh.levelmin(); --ilevel)
-      for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
-        for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
-          for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
-            if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
-            {
-              double xx[3];
-              gh.cell_pos(ilevel, i, j, k, xx);
-
-              // shift particle positions (this has to be done as the same shift
-              // is used when computing the convolution kernel for SPH baryons)
-              xx[coord] += 0.5 * h;
+    particle_batches particles(gh, gh.levelmin(), gh.levelmax());
+    size_t count = particles.next(&gas_data[0], npart, [&](int ilevel, int i, int j, int k) -> double
+                                  {
+                                    double xx[3];
+                                    gh.cell_pos(ilevel, i, j, k, xx);
 
-              xx[coord] = (xx[coord] + (*gh.get_grid(ilevel))(i, j, k)) * boxSize;
+                                    // shift particle positions (this has to be done as the same shift
+                                    // is used when computing the convolution kernel for SPH baryons)
+                                    xx[coord] += 0.5 * h;
 
-              gas_data[count++] = xx[coord];
-            }
+                                    return (xx[coord] + (*gh.get_grid(ilevel))(i, j, k)) * boxSize;
+                                  });
 
     if (count != npart)
       throw std::runtime_error("Internal consistency error while writing coarse DM pos");
 
     // calculate modified DM coordinates if: multimass and baryons present
     if (doBaryons && npcoarse)
-    {
-      double facb = omega_b / omega0;
-      double facc = (omega0 - omega_b) / omega0;
-
-      std::vector<T> dm_data(npcoarse);
-
-      writeHDF5_b("Coordinates", coord, coarsePartType, dm_data, true); // read coarse DM vels
-
-      // overwrite
-      for (size_t i = 0; i < npcoarse; i++)
-      {
-        dm_data[i] = facc * dm_data[i] + facb * gas_data[npfine + i];
-        dm_data[i] = fmod(dm_data[i] + boxSize, boxSize) * posFac;
-      }
-
-      writeHDF5_b("Coordinates", coord, coarsePartType, dm_data); // overwrite coarse DM vels
-    }
+      writeCoarseCombined<T>(0, coord, &gas_data[npfine], true);
 
     // restrict gas_data to fine only and request write
     //std::vector<float> data( gas_data.begin() + 0, gas_data.begin() + npfine );
@@ -543,6 +556,7 @@ public:
     useLongIDs = cf.getValueSafe<bool>("output", "arepo_longids", false);
     numFiles = cf.getValueSafe<unsigned>("output", "arepo_num_files", 1);
     doublePrec = cf.getValueSafe<bool>("output", "arepo_doubleprec", 0);
+    chunkRows = std::max(1u, cf.getValueSafe<unsigned>("output", "arepo_chunk_size", 1 << 18));
 
     for (unsigned i = 0; i < numFiles; i++)
       nPart.push_back(std::vector<unsigned int>(NTYPES, 0));
@@ -606,47 +620,33 @@ public:
     if (coarsePartType == STAR_PARTTYPE)
       LOGWARN("WARNING: Specified coarse particle type will collide with stars if USE_SFR enabled.");
 
-    // create file(s)
+    if (numFiles > 1 && fname_.find(".hdf5") != fname_.length() - 5)
+      throw std::runtime_error("Error: Unexpected output filename (doesn't end in .hdf5).");
+
+    // create file(s), they stay open until finalize()
     for (unsigned i = 0; i < numFiles; i++)
     {
-      std::string filename = fname_;
-      if (numFiles > 1)
-      {
-        size_t pos = filename.find(".hdf5");
-        if (pos != filename.length() - 5)
-          throw std::runtime_error("Error: Unexpected output filename (doesn't end in .hdf5).");
-
-        std::stringstream s;
-        s << "." << i << ".hdf5";
-        filename.replace(pos, 5, s.str());
-      }
+      hid_t HDF_FileID = H5Fcreate(fileName(i).c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+      if (HDF_FileID < 0)
+        throw std::runtime_error("Error: Could not create Arepo output file " + fileName(i) + ".");
 
-      HDFCreateFile(filename);
+      fileIDs.push_back(HDF_FileID);
+      groupIDs.push_back(std::map<int, hid_t>());
 
       // create particle type groups
-      std::stringstream GrpName;
-      GrpName << "PartType" << HIGHRES_DM_PARTTYPE;
-
-      HDFCreateGroup(filename, GrpName.str().c_str()); // highres or unigrid DM
+      createGroup(i, HIGHRES_DM_PARTTYPE); // highres or unigrid DM
 
       if (doBaryons)
-      {
-        GrpName.str("");
-        GrpName << "PartType" << GAS_PARTTYPE;
-        HDFCreateGroup(filename, GrpName.str().c_str()); // gas
-      }
+        createGroup(i, GAS_PARTTYPE); // gas
 
       if (levelmax_ != levelmin_) // multimass
-      {
-        GrpName.str("");
-        GrpName << "PartType" << coarsePartType;
-        HDFCreateGroup(filename, GrpName.str().c_str()); // coarse DM
-      }
+        createGroup(i, coarsePartType); // coarse DM
     }
   }
 
   ~arepo_output_plugin()
   {
+    closeFiles();
   }
 
   /* ------------------------------------------------------------------------------- */
@@ -713,9 +713,30 @@ public:
 
   void finalize(void)
   {
+    // coarse DM components that never got their gas counterpart are written as they are
+    for (int field = 0; field < 2; field++)
+      for (int coord = 0; coord < 3; coord++)
+        if ((!coarseHeldFloat[field][coord].empty() || !coarseHeldDouble[field][coord].empty()) && !coarseHeldGas[field][coord])
+        {
+          LOGWARN("Arepo output: no gas to combine coarse DM component %d of %s with.", coord, field == 0 ? "Coordinates" : "Velocities");
+          if (!doublePrec)
+          {
+            std::vector<float> dm(coarseHeldFloat[field][coord]); // as gas, the weighted mean is dm itself
+            writeCoarseCombined<float>(field, coord, &dm[0], true);
+          }
+          else
+          {
+            std::vector<double> dm(coarseHeldDouble[field][coord]);
+            writeCoarseCombined<double>(field, coord, &dm[0], true);
+          }
+        }
+
     // generate and add contiguous IDs for each particle type we have written
     generateAndWriteIDs();
 
+    // all particle data is written, the header is added through the file name
+    closeFiles();
+
     std::vector<unsigned int> nPartTotalLW(nPartTotal.size());
     std::vector<unsigned int> nPartTotalHW(nPartTotal.size());
     for (size_t i = 0; i < nPartTotalHW.size(); i++)
@@ -733,13 +754,9 @@ public:
     // write final header (some of these fields are required, others are extra info)
     for (unsigned i = 0; i < numFiles; i++)
     {
-      std::string filename = fname_;
+      std::string filename = fileName(i);
       if (numFiles > 1)
       {
-        std::stringstream s;
-        s << "." << i << ".hdf5";
-        filename.replace(filename.find(".hdf5"), 5, s.str());
-
         std::cout << "    " << filename;
         for (size_t j = 0; j < nPart[i].size(); j++)
           std::cout << " " << std::setw(10) << nPart[i][j];
@@ -15,6 +15,7 @@
 #include <vector>
 
 #include "output.hh"
+#include "art_pages.hh"
 
 template <typename T>
 inline T bytereorder(T v)
@@ -111,57 +112,6 @@ protected:
 
 	double YHe_;
 
-	// helper class to read temp files
-	class pistream : public std::ifstream
-	{
-	public:
-		pistream(std::string fname, size_t npart)
-				: std::ifstream(fname.c_str(), std::ios::binary)
-		{
-			size_t blk;
-
-			if (!this->good())
-			{
-				LOGERR("Could not open buffer file in ART output plug-in");
-				throw std::runtime_error("Could not open buffer file in ART output plug-in");
-			}
-
-			this->read((char *)&blk, sizeof(size_t));
-
-			if (blk != (size_t)(npart * sizeof(T_store)))
-			{
-				LOGERR("Internal consistency error in ART output plug-in");
-				LOGERR("Expected %d bytes in temp file but found %d", npart * (unsigned)sizeof(T_store), blk);
-				throw std::runtime_error("Internal consistency error in ART output plug-in");
-			}
-		}
-
-		pistream()
-		{
-		}
-
-		void open(std::string fname, size_t npart)
-		{
-			std::ifstream::open(fname.c_str(), std::ios::binary);
-			size_t blk;
-
-			if (!this->good())
-			{
-				LOGERR("Could not open buffer file \'%s\' in ART output plug-in", fname.c_str());
-				throw std::runtime_error("Could not open buffer file in ART output plug-in");
-			}
-
-			this->read((char *)&blk, sizeof(size_t));
-
-			if (blk != (size_t)(npart * sizeof(T_store)))
-			{
-				LOGERR("Internal consistency error in ART output plug-in");
-				LOGERR("Expected %d bytes in temp file but found %d", npart * (unsigned)sizeof(T_store), blk);
-				throw std::runtime_error("Internal consistency error in ART output plug-in");
-			}
-		}
-	};
-
 	// non-public member functions
 	void write_header_file(void) //PMcrd.DAT
 	{
@@ -265,14 +215,6 @@ protected:
 		LOGINFO("ART : done writing pt file.");
 	}
 
-	void adjust_buf_endianness(T_store *buf)
-	{
-		if (swap_endianness_)
-		{
-			for (size_t i = 0; i < block_buf_size_; ++i)
-				buf[i] = bytereorder<T_store>(buf[i]);
-		}
-	}
 
 	/*
      The direct format write the particle data in pages. Each page of particles is read into a common block,
@@ -296,7 +238,6 @@ protected:
 			fout = "/PMcrs0.DAT";
 
 		std::string partfname = fname_ + fout;
-		std::ofstream ofs(partfname.c_str(), std::ios::trunc);
 
 		// generate all temp file names
 		char fnx[256], fny[256], fnz[256], fnvx[256], fnvy[256], fnvz[256];
@@ -307,84 +248,10 @@ protected:
 		sprintf(fnvy, "___ic_temp_%05d.bin", 100 * id_dm_vel + 1);
 		sprintf(fnvz, "___ic_temp_%05d.bin", 100 * id_dm_vel + 2);
 
-		// create buffers for temporary data
-		T_store *tmp1, *tmp2, *tmp3, *tmp4, *tmp5, *tmp6;
-
-		tmp1 = new T_store[block_buf_size_];
-		tmp2 = new T_store[block_buf_size_];
-		tmp3 = new T_store[block_buf_size_];
-		tmp4 = new T_store[block_buf_size_];
-		tmp5 = new T_store[block_buf_size_];
-		tmp6 = new T_store[block_buf_size_];
-
-		// read in the data from the temporary files in slabs and write it to the output file
-		size_t npleft, n2read;
-		size_t npcdm = npcdm_;
-
 		LOGINFO("writing DM data to ART format file");
-		//ofs.open(fname_.c_str(), std::ios::binary|std::ios::trunc );
-
-		pistream ifs_x, ifs_y, ifs_z, ifs_vx, ifs_vy, ifs_vz;
-
-		ifs_x.open(fnx, npcdm);
-		ifs_y.open(fny, npcdm);
-		ifs_z.open(fnz, npcdm);
-		ifs_vx.open(fnvx, npcdm);
-		ifs_vy.open(fnvy, npcdm);
-		ifs_vz.open(fnvz, npcdm);
-
-		npleft = npcdm;
-		n2read = std::min(block_buf_size_, npleft);
-		while (n2read > 0)
-		{
-			// To make sure last page in zooms have 0s in non-relevant values
-			// NOT MANDATORY. Can be commented if makes things slow
-			// but I do not like the idea of writting data in the file
-			//  that could be interpreted as real.
-			if (n2read < block_buf_size_)
-			{
-				for (int i = 0; i < int(block_buf_size_); i++)
-				{
-					tmp1[i] = 0.0;
-					tmp2[i] = 0.0;
-					tmp3[i] = 0.0;
-					tmp4[i] = 0.0;
-					tmp5[i] = 0.0;
-					tmp6[i] = 0.0;
-				}
-			}
-			ifs_x.read(reinterpret_cast<char *>(&tmp1[0]), n2read * sizeof(T_store));
-			ifs_y.read(reinterpret_cast<char *>(&tmp2[0]), n2read * sizeof(T_store));
-			ifs_z.read(reinterpret_cast<char *>(&tmp3[0]), n2read * sizeof(T_store));
-			ifs_vx.read(reinterpret_cast<char *>(&tmp4[0]), n2read * sizeof(T_store));
-			ifs_vy.read(reinterpret_cast<char *>(&tmp5[0]), n2read * sizeof(T_store));
-			ifs_vz.read(reinterpret_cast<char *>(&tmp6[0]), n2read * sizeof(T_store));
-
-			adjust_buf_endianness(tmp1);
-			adjust_buf_endianness(tmp2);
-			adjust_buf_endianness(tmp3);
-			adjust_buf_endianness(tmp4);
-			adjust_buf_endianness(tmp5);
-			adjust_buf_endianness(tmp6);
-
-			ofs.write(reinterpret_cast<char *>(&tmp1[0]), block_buf_size_ * sizeof(T_store));
-			ofs.write(reinterpret_cast<char *>(&tmp2[0]), block_buf_size_ * sizeof(T_store));
-			ofs.write(reinterpret_cast<char *>(&tmp3[0]), block_buf_size_ * sizeof(T_store));
-			ofs.write(reinterpret_cast<char *>(&tmp4[0]), block_buf_size_ * sizeof(T_store));
-			ofs.write(reinterpret_cast<char *>(&tmp5[0]), block_buf_size_ * sizeof(T_store));
-			ofs.write(reinterpret_cast<char *>(&tmp6[0]), block_buf_size_ * sizeof(T_store));
-
-			npleft -= n2read;
-			n2read = std::min(block_buf_size_, npleft);
-		}
 
-		ifs_x.close();
-		ifs_y.close();
-		ifs_z.close();
-		ifs_vx.close();
-		ifs_vy.close();
-		ifs_vz.close();
-		ofs.close();
+		std::vector<std::string> fields = { fnx, fny, fnz, fnvx, fnvy, fnvz };
+		assemble_art_pages<T_store>( partfname, fields, npcdm_, block_buf_size_, swap_endianness_, "ART" );
 
 		// clean up temp files
 		unlink(fnx);
@@ -394,13 +261,6 @@ protected:
 		unlink(fnvy);
 		unlink(fnvz);
 
-		delete[] tmp1;
-		delete[] tmp2;
-		delete[] tmp3;
-		delete[] tmp4;
-		delete[] tmp5;
-		delete[] tmp6;
-
 		LOGINFO("ART : done writing DM file.");
 	}
 
@@ -416,7 +276,6 @@ protected:
 	{
 		// file name
 		std::string partfname = fname_ + "/PMcrs0_GAS.DAT";
-		std::ofstream ofs(partfname.c_str(), std::ios::trunc);
 
 		// generate all temp file names
 		char fnx[256], fny[256], fnz[256], fnvx[256], fnvy[256], fnvz[256];
@@ -427,84 +286,10 @@ protected:
 		sprintf(fnvy, "___ic_temp_%05d.bin", 100 * id_gas_vel + 1);
 		sprintf(fnvz, "___ic_temp_%05d.bin", 100 * id_gas_vel + 2);
 
-		// create buffers for temporary data
-		T_store *tmp1, *tmp2, *tmp3, *tmp4, *tmp5, *tmp6;
-
-		tmp1 = new T_store[block_buf_size_];
-		tmp2 = new T_store[block_buf_size_];
-		tmp3 = new T_store[block_buf_size_];
-		tmp4 = new T_store[block_buf_size_];
-		tmp5 = new T_store[block_buf_size_];
-		tmp6 = new T_store[block_buf_size_];
-
-		// read in the data from the temporary files in slabs and write it to the output file
-		size_t npleft, n2read;
-		size_t npcgas = npcdm_; // # of gas elemets should be equal to # of dm elements
-
 		LOGINFO("writing gas data to ART format file");
-		//ofs.open(fname_.c_str(), std::ios::binary|std::ios::trunc );
-
-		pistream ifs_x, ifs_y, ifs_z, ifs_vx, ifs_vy, ifs_vz;
-
-		ifs_x.open(fnx, npcgas);
-		ifs_y.open(fny, npcgas);
-		ifs_z.open(fnz, npcgas);
-		ifs_vx.open(fnvx, npcgas);
-		ifs_vy.open(fnvy, npcgas);
-		ifs_vz.open(fnvz, npcgas);
 
-		npleft = npcgas;
-		n2read = std::min(block_buf_size_, npleft);
-		while (n2read > 0)
-		{
-			// To make sure last page in zooms have 0s in non-relevant values
-			// NOT MANDATORY. Can be commented if makes things slow
-			// but I do not like the idea of writting data in the file
-			//  that could be interpreted as real.
-			if (n2read < block_buf_size_)
-			{
-				for (int i = 0; i < int(block_buf_size_); i++)
-				{
-					tmp1[i] = 0.0;
-					tmp2[i] = 0.0;
-					tmp3[i] = 0.0;
-					tmp4[i] = 0.0;
-					tmp5[i] = 0.0;
-					tmp6[i] = 0.0;
-				}
-			}
-			ifs_x.read(reinterpret_cast<char *>(&tmp1[0]), n2read * sizeof(T_store));
-			ifs_y.read(reinterpret_cast<char *>(&tmp2[0]), n2read * sizeof(T_store));
-			ifs_z.read(reinterpret_cast<char *>(&tmp3[0]), n2read * sizeof(T_store));
-			ifs_vx.read(reinterpret_cast<char *>(&tmp4[0]), n2read * sizeof(T_store));
-			ifs_vy.read(reinterpret_cast<char *>(&tmp5[0]), n2read * sizeof(T_store));
-			ifs_vz.read(reinterpret_cast<char *>(&tmp6[0]), n2read * sizeof(T_store));
-
-			adjust_buf_endianness(tmp1);
-			adjust_buf_endianness(tmp2);
-			adjust_buf_endianness(tmp3);
-			adjust_buf_endianness(tmp4);
-			adjust_buf_endianness(tmp5);
-			adjust_buf_endianness(tmp6);
-
-			ofs.write(reinterpret_cast<char *>(&tmp1[0]), block_buf_size_ * sizeof(T_store));
-			ofs.write(reinterpret_cast<char *>(&tmp2[0]), block_buf_size_ * sizeof(T_store));
-			ofs.write(reinterpret_cast<char *>(&tmp3[0]), block_buf_size_ * sizeof(T_store));
-			ofs.write(reinterpret_cast<char *>(&tmp4[0]), block_buf_size_ * sizeof(T_store));
-			ofs.write(reinterpret_cast<char *>(&tmp5[0]), block_buf_size_ * sizeof(T_store));
-			ofs.write(reinterpret_cast<char *>(&tmp6[0]), block_buf_size_ * sizeof(T_store));
-
-			npleft -= n2read;
-			n2read = std::min(block_buf_size_, npleft);
-		}
-
-		ifs_x.close();
-		ifs_y.close();
-		ifs_z.close();
-		ifs_vx.close();
-		ifs_vy.close();
-		ifs_vz.close();
-		ofs.close();
+		std::vector<std::string> fields = { fnx, fny, fnz, fnvx, fnvy, fnvz };
+		assemble_art_pages<T_store>( partfname, fields, npcdm_, block_buf_size_, swap_endianness_, "ART" );
 
 		// clean up temp files
 		unlink(fnx);
@@ -514,13 +299,6 @@ protected:
 		unlink(fnvy);
 		unlink(fnvz);
 
-		delete[] tmp1;
-		delete[] tmp2;
-		delete[] tmp3;
-		delete[] tmp4;
-		delete[] tmp5;
-		delete[] tmp6;
-
 		LOGINFO("ART : done writing gas file.");
 		// Temperature
 		const double Tcmb0 = 2.726;
@@ -637,8 +415,7 @@ public:
 		}
 
 		// Now, let us write the dm particle info
-		std::vector<T_store> temp_data;
-		temp_data.reserve(block_buf_size_);
+		std::vector<T_store> temp_data(block_buf_size_);
 
 		//coordinates are in the range 1 - (NGRID+1)
 		// so scale factor is  scaleX = Box/NGRID -> to Mpc/h (Box in Mpc/h)
@@ -651,35 +428,22 @@ public:
 		size_t blksize = sizeof(T_store) * nptot;
 		ofs_temp.write((char *)&blksize, sizeof(size_t));
 
-		size_t nwritten = 0;
-		for (int ilevel = gh.levelmax(); ilevel >= (int)gh.levelmin(); --ilevel)
-			for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
-				for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
-					for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
-						if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
-						{
-							double xx[3];
-							gh.cell_pos(ilevel, i, j, k, xx);
-
-							xx[coord] = fmod((xx[coord] + (*gh.get_grid(ilevel))(i, j, k)) + 1.0, 1.0);
-							xx[coord] = (xx[coord] * xfac) + 1.0;
-							//xx[coord] = ((xx[coord]+(*gh.get_grid(ilevel))(i,j,k)));
-
-							if (temp_data.size() < block_buf_size_)
-								temp_data.push_back(xx[coord]);
-							else
-							{
-								ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * block_buf_size_);
-								nwritten += block_buf_size_;
-								temp_data.clear();
-								temp_data.push_back(xx[coord]);
-							}
-						}
-
-		if (temp_data.size() > 0)
+		size_t nwritten = 0, n;
+		particle_batches particles(gh, gh.levelmin(), gh.levelmax());
+		while ((n = particles.next(&temp_data[0], block_buf_size_, [&](int ilevel, int i, int j, int k) -> double
+					{
+						double xx[3];
+						gh.cell_pos(ilevel, i, j, k, xx);
+
+						xx[coord] = fmod((xx[coord] + (*gh.get_grid(ilevel))(i, j, k)) + 1.0, 1.0);
+						xx[coord] = (xx[coord] * xfac) + 1.0;
+						//xx[coord] = ((xx[coord]+(*gh.get_grid(ilevel))(i,j,k)));
+
+						return xx[coord];
+					})) > 0)
 		{
-			ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * temp_data.size());
-			nwritten += temp_data.size();
+			ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * n);
+			nwritten += n;
 		}
 
 		if (nwritten != nptot)
@@ -698,8 +462,7 @@ public:
 	{
 		size_t nptot = gh.count_leaf_cells(gh.levelmin(), gh.levelmax());
 
-		std::vector<T_store> temp_data;
-		temp_data.reserve(block_buf_size_);
+		std::vector<T_store> temp_data(block_buf_size_);
 
 		//In ART velocities are P = a_expansion*V_pec/(x_0H_0)
 		// where x_0 = comoving cell_size=Box/Ngrid;H_0 = Hubble at z=0
@@ -715,28 +478,13 @@ public:
 		size_t blksize = sizeof(T_store) * nptot;
 		ofs_temp.write((char *)&blksize, sizeof(size_t));
 
-		size_t nwritten = 0;
-		for (int ilevel = gh.levelmax(); ilevel >= (int)gh.levelmin(); --ilevel)
-			for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
-				for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
-					for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
-						if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
-						{
-							if (temp_data.size() < block_buf_size_)
-								temp_data.push_back((*gh.get_grid(ilevel))(i, j, k) * vfac);
-							else
-							{
-								ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * block_buf_size_);
-								nwritten += block_buf_size_;
-								temp_data.clear();
-								temp_data.push_back((*gh.get_grid(ilevel))(i, j, k) * vfac);
-							}
-						}
-
-		if (temp_data.size() > 0)
+		size_t nwritten = 0, n;
+		particle_batches particles(gh, gh.levelmin(), gh.levelmax());
+		while ((n = particles.next(&temp_data[0], block_buf_size_, [&](int ilevel, int i, int j, int k) -> double
+					{ return (*gh.get_grid(ilevel))(i, j, k) * vfac; })) > 0)
 		{
-			ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * temp_data.size());
-			nwritten += temp_data.size();
+			ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * n);
+			nwritten += n;
 		}
 
 		if (nwritten != nptot)
@@ -765,8 +513,7 @@ public:
 
 		size_t nptot = gh.count_leaf_cells(gh.levelmin(), gh.levelmax());
 
-		std::vector<T_store> temp_data;
-		temp_data.reserve(block_buf_size_);
+		std::vector<T_store> temp_data(block_buf_size_);
 
 		//ART coordinates are in the range 1 - (NGRID+1)
 		double xfac = (double)header_.NGRIDC;
@@ -778,34 +525,21 @@ public:
 		size_t blksize = sizeof(T_store) * nptot;
 		ofs_temp.write((char *)&blksize, sizeof(size_t));
 
-		size_t nwritten = 0;
-		for (int ilevel = gh.levelmax(); ilevel >= (int)gh.levelmin(); --ilevel)
-			for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
-				for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
-					for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
-						if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
-						{
-							double xx[3];
-							gh.cell_pos(ilevel, i, j, k, xx);
-
-							xx[coord] = fmod((xx[coord] + (*gh.get_grid(ilevel))(i, j, k)) + 1.0, 1.0);
-							xx[coord] = (xx[coord] * xfac) + 1.0;
-
-							if (temp_data.size() < block_buf_size_)
-								temp_data.push_back(xx[coord]);
-							else
-							{
-								ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * block_buf_size_);
-								nwritten += block_buf_size_;
-								temp_data.clear();
-								temp_data.push_back(xx[coord]);
-							}
-						}
-
-		if (temp_data.size() > 0)
+		size_t nwritten = 0, n;
+		particle_batches particles(gh, gh.levelmin(), gh.levelmax());
+		while ((n = particles.next(&temp_data[0], block_buf_size_, [&](int ilevel, int i, int j, int k) -> double
+					{
+						double xx[3];
+						gh.cell_pos(ilevel, i, j, k, xx);
+
+						xx[coord] = fmod((xx[coord] + (*gh.get_grid(ilevel))(i, j, k)) + 1.0, 1.0);
+						xx[coord] = (xx[coord] * xfac) + 1.0;
+
+						return xx[coord];
+					})) > 0)
 		{
-			ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * temp_data.size());
-			nwritten += temp_data.size();
+			ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * n);
+			nwritten += n;
 		}
 
 		if (nwritten != nptot)
@@ -825,8 +559,7 @@ public:
 
 		size_t nptot = gh.count_leaf_cells(gh.levelmin(), gh.levelmax());
 
-		std::vector<T_store> temp_data;
-		temp_data.reserve(block_buf_size_);
+		std::vector<T_store> temp_data(block_buf_size_);
 
 		//In ART velocities are P = a_expansion*V_pec/(x_0H_0)
 		// where x_0 = comoving cell_size=Box/Ngrid;H_0 = Hubble at z=0
@@ -842,28 +575,13 @@ public:
 		size_t blksize = sizeof(T_store) * nptot;
 		ofs_temp.write((char *)&blksize, sizeof(size_t));
 
-		size_t nwritten = 0;
-		for (int ilevel = gh.levelmax(); ilevel >= (int)gh.levelmin(); --ilevel)
-			for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
-				for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
-					for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
-						if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
-						{
-							if (temp_data.size() < block_buf_size_)
-								temp_data.push_back((*gh.get_grid(ilevel))(i, j, k) * vfac);
-							else
-							{
-								ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * block_buf_size_);
-								nwritten += block_buf_size_;
-								temp_data.clear();
-								temp_data.push_back((*gh.get_grid(ilevel))(i, j, k) * vfac);
-							}
-						}
-
-		if (temp_data.size() > 0)
+		size_t nwritten = 0, n;
+		particle_batches particles(gh, gh.levelmin(), gh.levelmax());
+		while ((n = particles.next(&temp_data[0], block_buf_size_, [&](int ilevel, int i, int j, int k) -> double
+					{ return (*gh.get_grid(ilevel))(i, j, k) * vfac; })) > 0)
 		{
-			ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * temp_data.size());
-			nwritten += temp_data.size();
+			ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * n);
+			nwritten += n;
 		}
 
 		if (nwritten != nptot)
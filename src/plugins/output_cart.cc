@@ -15,6 +15,7 @@
 #include <vector>
 
 #include "output.hh"
+#include "art_pages.hh"
 
 template<typename T>
 inline T bytereorder(T v )
@@ -102,57 +103,6 @@ class cart_output_plugin : public output_plugin
 
 		double YHe_;
 
-
-		// helper class to read temp files
-		class pistream : public std::ifstream
-	{
-		public:
-			pistream (std::string fname, size_t npart )
-				: std::ifstream( fname.c_str(), std::ios::binary )
-			{
-				size_t blk;
-
-				if( !this->good() )
-				{
-					LOGERR("Could not open buffer file in CART output plug-in");
-					throw std::runtime_error("Could not open buffer file in CART output plug-in");
-				}
-
-				this->read( (char*)&blk, sizeof(size_t) );
-
-				if( blk != (size_t)(npart*sizeof(T_store)) )
-				{
-					LOGERR("Internal consistency error in CART output plug-in");
-					LOGERR("Expected %d bytes in temp file but found %d",npart*(unsigned)sizeof(T_store),blk);
-					throw std::runtime_error("Internal consistency error in CART output plug-in");
-				}
-			}
-
-			pistream (){}
-
-			void open(std::string fname, size_t npart )
-			{
-				std::ifstream::open( fname.c_str(), std::ios::binary );
-				size_t blk;
-
-				if( !this->good() )
-				{
-					LOGERR("Could not open buffer file \'%s\' in CART output plug-in",fname.c_str());
-					throw std::runtime_error("Could not open buffer file in CART output plug-in");
-				}
-
-				this->read( (char*)&blk, sizeof(size_t) );
-
-				if( blk != (size_t)(npart*sizeof(T_store)) )
-				{
-					LOGERR("Internal consistency error in CART output plug-in");
-					LOGERR("Expected %d bytes in temp file but found %d",npart*(unsigned)sizeof(T_store),blk);
-					throw std::runtime_error("Internal consistency error in CART output plug-in");
-				}
-			}
-	};
-
-
 		// non-public member functions
 		void write_header_file( void ) //PMcrd.DAT
 		{
@@ -262,16 +212,6 @@ class cart_output_plugin : public output_plugin
 			// 	    LOGINFO("CART : done writing pt file.");
 		}
 
-
-		void adjust_buf_endianness( T_store* buf )
-		{
-			if( swap_endianness_ )
-			{
-				for( size_t i=0; i<block_buf_size_; ++i )
-					buf[i] = bytereorder<T_store>( buf[i] );
-			}
-		}
-
 		/*
 		   The direct format write the particle data in pages. Each page of particles is read into a common block,
 		   which has the structure: X(Npage),Y(Npage),Z(Npage),Vx(Npage),Vy(Npage),Vz(Npage).
@@ -293,7 +233,6 @@ class cart_output_plugin : public output_plugin
 				partfname = fname_ + "/music_D.mdxv";
 			}
 			//std::string partfname = fname_ + "/PMcrs0.DAT";
-			std::ofstream ofs( partfname.c_str(), std::ios::trunc );
 
 			// generate all temp file names
 			char fnx[256],fny[256],fnz[256],fnvx[256],fnvy[256],fnvz[256];
@@ -304,81 +243,10 @@ class cart_output_plugin : public output_plugin
 			sprintf( fnvy, "___ic_temp_%05d.bin", 100*id_dm_vel+1 );
 			sprintf( fnvz, "___ic_temp_%05d.bin", 100*id_dm_vel+2 );
 
-			// create buffers for temporary data
-			T_store *tmp1, *tmp2, *tmp3, *tmp4, *tmp5, *tmp6;
-
-			tmp1 = new T_store[block_buf_size_];
-			tmp2 = new T_store[block_buf_size_];
-			tmp3 = new T_store[block_buf_size_];
-			tmp4 = new T_store[block_buf_size_];
-			tmp5 = new T_store[block_buf_size_];
-			tmp6 = new T_store[block_buf_size_];
-
-
-			// read in the data from the temporary files in slabs and write it to the output file
-			size_t npleft, n2read;
-			size_t npcdm = npcdm_;
-
 			LOGINFO("writing DM data to CART format file");
-			//ofs.open(fname_.c_str(), std::ios::binary|std::ios::trunc );
 
-			pistream ifs_x, ifs_y, ifs_z, ifs_vx, ifs_vy, ifs_vz;
-
-			ifs_x.open( fnx, npcdm );
-			ifs_y.open( fny, npcdm );
-			ifs_z.open( fnz, npcdm );
-			ifs_vx.open( fnvx, npcdm );
-			ifs_vy.open( fnvy, npcdm );
-			ifs_vz.open( fnvz, npcdm );
-
-			npleft = npcdm;
-			n2read = std::min(block_buf_size_,npleft);
-			while( n2read > 0 )
-			{
-				// To make sure last page in zooms have 0s in non-relevant values
-				// NOT MANDATORY. Can be commented if makes things slow
-				// but I do not like the idea of writting data in the file
-				//  that could be interpreted as real.
-				if(n2read<block_buf_size_)
-				{
-					for (uint i = 0; i < block_buf_size_; i++)
-					{
-						tmp1[i]=0.0;tmp2[i]=0.0;tmp3[i]=0.0;tmp4[i]=0.0;
-						tmp5[i]=0.0;tmp6[i]=0.0;
-					}
-				}
-				ifs_x.read( reinterpret_cast<char*>(&tmp1[0]), n2read*sizeof(T_store) );
-				ifs_y.read( reinterpret_cast<char*>(&tmp2[0]), n2read*sizeof(T_store) );
-				ifs_z.read( reinterpret_cast<char*>(&tmp3[0]), n2read*sizeof(T_store) );
-				ifs_vx.read( reinterpret_cast<char*>(&tmp4[0]), n2read*sizeof(T_store) );
-				ifs_vy.read( reinterpret_cast<char*>(&tmp5[0]), n2read*sizeof(T_store) );
-				ifs_vz.read( reinterpret_cast<char*>(&tmp6[0]), n2read*sizeof(T_store) );
-
-				adjust_buf_endianness( tmp1 );
-				adjust_buf_endianness( tmp2 );
-				adjust_buf_endianness( tmp3 );
-				adjust_buf_endianness( tmp4 );
-				adjust_buf_endianness( tmp5 );
-				adjust_buf_endianness( tmp6 );
-
-				ofs.write( reinterpret_cast<char*>(&tmp1[0]), block_buf_size_*sizeof(T_store) );
-				ofs.write( reinterpret_cast<char*>(&tmp2[0]), block_buf_size_*sizeof(T_store) );
-				ofs.write( reinterpret_cast<char*>(&tmp3[0]), block_buf_size_*sizeof(T_store) );
-				ofs.write( reinterpret_cast<char*>(&tmp4[0]), block_buf_size_*sizeof(T_store) );
-				ofs.write( reinterpret_cast<char*>(&tmp5[0]), block_buf_size_*sizeof(T_store) );
-				ofs.write( reinterpret_cast<char*>(&tmp6[0]), block_buf_size_*sizeof(T_store) );
-
-				npleft -= n2read;
-				n2read = std::min( block_buf_size_,npleft );
-			}
-
-			ifs_x.close();
-			ifs_y.close();
-			ifs_z.close();
-			ifs_vx.close();
-			ifs_vy.close();
-			ifs_vz.close();
-			ofs.close();
+			std::vector<std::string> fields = { fnx, fny, fnz, fnvx, fnvy, fnvz };
+			assemble_art_pages<T_store>( partfname, fields, npcdm_, block_buf_size_, swap_endianness_, "CART" );
 
 			// clean up temp files
 			unlink(fnx);
@@ -388,13 +256,6 @@ class cart_output_plugin : public output_plugin
 			unlink(fnvy);
 			unlink(fnvz);
 
-			delete[] tmp1;
-			delete[] tmp2;
-			delete[] tmp3;
-			delete[] tmp4;
-			delete[] tmp5;
-			delete[] tmp6;
-
 			LOGINFO("CART : done writing DM file.");
 
 		}
@@ -418,7 +279,6 @@ class cart_output_plugin : public output_plugin
 			}else{
 				hydrofname = fname_ + "/music_D.md";
 			}
-			std::ofstream ofs( hydrofname.c_str(), std::ios::trunc );
 
 			// generate all temp file names
 			char fnx[256],fny[256],fnz[256],fnvx[256],fnvy[256],fnvz[256],fnpma[256]; //add fields here
@@ -430,88 +290,10 @@ class cart_output_plugin : public output_plugin
 			sprintf( fnvz, "___ic_temp_%05d.bin", 100*id_gas_vel+2 );
 			sprintf( fnpma,  "___ic_temp_%05d.bin", 100*id_gas_pma ); //add fields here
 
-			// create buffers for temporary data
-			T_store *tmp1, *tmp2, *tmp3, *tmp4, *tmp5, *tmp6, *tmp7; //add fields here
-
-			tmp1 = new T_store[block_buf_size_];
-			tmp2 = new T_store[block_buf_size_];
-			tmp3 = new T_store[block_buf_size_];
-			tmp4 = new T_store[block_buf_size_];
-			tmp5 = new T_store[block_buf_size_];
-			tmp6 = new T_store[block_buf_size_];
-			tmp7 = new T_store[block_buf_size_]; //add fields here
-
-
-			// read in the data from the temporary files in slabs and write it to the output file
-			size_t npleft, n2read;
-			size_t npcgas = npcdm_; // # of gas elemets should be equal to # of dm elements
-
 			LOGINFO("writing gas data to CART format file");
-			//ofs.open(fname_.c_str(), std::ios::binary|std::ios::trunc );
-
-			pistream ifs_x, ifs_y, ifs_z, ifs_vx, ifs_vy, ifs_vz, ifs_pma;
-
-
-			ifs_x.open( fnx, npcgas );
-			ifs_y.open( fny, npcgas );
-			ifs_z.open( fnz, npcgas );
-			ifs_vx.open( fnvx, npcgas );
-			ifs_vy.open( fnvy, npcgas );
-			ifs_vz.open( fnvz, npcgas );
-			ifs_pma.open( fnpma, npcgas );
 
-			npleft = npcgas;
-			n2read = std::min(block_buf_size_,npleft);
-			while( n2read > 0 )
-			{
-				// To make sure last page in zooms have 0s in non-relevant values
-				// NOT MANDATORY. Can be commented if makes things slow
-				// but I do not like the idea of writting data in the file
-				//  that could be interpreted as real.
-				if(n2read<block_buf_size_)
-				{
-					for (uint i = 0; i < block_buf_size_; i++)
-					{
-						tmp1[i]=0.0;tmp2[i]=0.0;tmp3[i]=0.0;tmp4[i]=0.0;
-						tmp5[i]=0.0;tmp6[i]=0.0;
-					}
-				}
-				ifs_x.read( reinterpret_cast<char*>(&tmp1[0]), n2read*sizeof(T_store) );
-				ifs_y.read( reinterpret_cast<char*>(&tmp2[0]), n2read*sizeof(T_store) );
-				ifs_z.read( reinterpret_cast<char*>(&tmp3[0]), n2read*sizeof(T_store) );
-				ifs_vx.read( reinterpret_cast<char*>(&tmp4[0]), n2read*sizeof(T_store) );
-				ifs_vy.read( reinterpret_cast<char*>(&tmp5[0]), n2read*sizeof(T_store) );
-				ifs_vz.read( reinterpret_cast<char*>(&tmp6[0]), n2read*sizeof(T_store) );
-				ifs_pma.read( reinterpret_cast<char*>(&tmp7[0]), n2read*sizeof(T_store) );
-
-				adjust_buf_endianness( tmp1 );
-				adjust_buf_endianness( tmp2 );
-				adjust_buf_endianness( tmp3 );
-				adjust_buf_endianness( tmp4 );
-				adjust_buf_endianness( tmp5 );
-				adjust_buf_endianness( tmp6 );
-				adjust_buf_endianness( tmp7 );
-
-				ofs.write( reinterpret_cast<char*>(&tmp1[0]), block_buf_size_*sizeof(T_store) );
-				ofs.write( reinterpret_cast<char*>(&tmp2[0]), block_buf_size_*sizeof(T_store) );
-				ofs.write( reinterpret_cast<char*>(&tmp3[0]), block_buf_size_*sizeof(T_store) );
-				ofs.write( reinterpret_cast<char*>(&tmp4[0]), block_buf_size_*sizeof(T_store) );
-				ofs.write( reinterpret_cast<char*>(&tmp5[0]), block_buf_size_*sizeof(T_store) );
-				ofs.write( reinterpret_cast<char*>(&tmp6[0]), block_buf_size_*sizeof(T_store) );
-				ofs.write( reinterpret_cast<char*>(&tmp7[0]), block_buf_size_*sizeof(T_store) );
-
-				npleft -= n2read;
-				n2read = std::min( block_buf_size_,npleft );
-			}
-
-			ifs_x.close();
-			ifs_y.close();
-			ifs_z.close();
-			ifs_vx.close();
-			ifs_vy.close();
-			ifs_vz.close();
-			ifs_pma.close();
-			ofs.close();
+			std::vector<std::string> fields = { fnx, fny, fnz, fnvx, fnvy, fnvz, fnpma };
+			assemble_art_pages<T_store>( hydrofname, fields, npcdm_, block_buf_size_, swap_endianness_, "CART" );
 
 			// clean up temp files
 			unlink(fnx);
@@ -522,14 +304,6 @@ class cart_output_plugin : public output_plugin
 			unlink(fnvz);
 			unlink(fnpma);
 
-			delete[] tmp1;
-			delete[] tmp2;
-			delete[] tmp3;
-			delete[] tmp4;
-			delete[] tmp5;
-			delete[] tmp6;
-			delete[] tmp7;
-
 			LOGINFO("CART : done writing gas file.");
 
 		}
@@ -550,7 +324,7 @@ class cart_output_plugin : public output_plugin
 			zstart_  = cf.getValue<double>("setup","zstart");
 			astart_ = 1.0/(1.0+zstart_);
 
-			//snl this doesn't corrently swap particle endianness and you check on the CART end anyway
+			//snl off by default, you check on the CART end anyway
 			swap_endianness_ = cf.getValueSafe<bool>("output","art_swap_endian",false);
 
 			int levelmin = cf.getValue<unsigned>("setup","levelmin");
@@ -659,8 +433,7 @@ class cart_output_plugin : public output_plugin
 			}
 
 			// Now, let us write the dm particle info
-			std::vector<T_store> temp_data;
-			temp_data.reserve( block_buf_size_ );
+			std::vector<T_store> temp_data( block_buf_size_ );
 
 
 			//coordinates are in the range 1 - (NGRID+1)
@@ -674,12 +447,9 @@ class cart_output_plugin : public output_plugin
 			size_t blksize = sizeof(T_store)*nptot;
 			ofs_temp.write( (char *)&blksize, sizeof(size_t) );
 
-			size_t nwritten = 0;
-			for( int ilevel=gh.levelmax(); ilevel>=(int)gh.levelmin(); --ilevel )
-				for( unsigned i=0; i<gh.get_grid(ilevel)->size(0); ++i )
-					for( unsigned j=0; j<gh.get_grid(ilevel)->size(1); ++j )
-						for( unsigned k=0; k<gh.get_grid(ilevel)->size(2); ++k )
-							if( gh.is_in_mask(ilevel,i,j,k) && !gh.is_refined(ilevel,i,j,k) )
+			size_t nwritten = 0, n;
+			particle_batches particles( gh, gh.levelmin(), gh.levelmax() );
+			while( (n = particles.next( &temp_data[0], block_buf_size_, [&]( int ilevel, int i, int j, int k ) -> double
 							{
 								double xx[3];
 								gh.cell_pos(ilevel, i, j, k, xx);
@@ -688,21 +458,11 @@ class cart_output_plugin : public output_plugin
 								xx[coord] = (xx[coord]*xfac)+1.0;
 								//xx[coord] = ((xx[coord]+(*gh.get_grid(ilevel))(i,j,k)));
 
-								if( temp_data.size() < block_buf_size_ )
-									temp_data.push_back( xx[coord] );
-								else
-								{
-									ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*block_buf_size_ );
-									nwritten += block_buf_size_;
-									temp_data.clear();
-									temp_data.push_back( xx[coord] );
-								}
-							}
-
-			if( temp_data.size() > 0 )
+								return xx[coord];
+							} )) > 0 )
 			{
-				ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*temp_data.size() );
-				nwritten += temp_data.size();
+				ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*n );
+				nwritten += n;
 			}
 
 			if( nwritten != nptot )
@@ -721,8 +481,7 @@ class cart_output_plugin : public output_plugin
 		{
 			size_t nptot = gh.count_leaf_cells(gh.levelmin(), gh.levelmax());
 
-			std::vector<T_store> temp_data;
-			temp_data.reserve( block_buf_size_ );
+			std::vector<T_store> temp_data( block_buf_size_ );
 
 			// t0_internal = 2 * aexpn^2/(100*h*sqrt(Om0))
 			// r0_internal^{-1} = Ng/(boxh/h*aexpn)
@@ -752,30 +511,16 @@ class cart_output_plugin : public output_plugin
 			size_t blksize = sizeof(T_store)*nptot;
 			ofs_temp.write( (char *)&blksize, sizeof(size_t) );
 
-			size_t nwritten = 0;
-			for( int ilevel=gh.levelmax(); ilevel>=(int)gh.levelmin(); --ilevel )
-				for( unsigned i=0; i<gh.get_grid(ilevel)->size(0); ++i )
-					for( unsigned j=0; j<gh.get_grid(ilevel)->size(1); ++j )
-						for( unsigned k=0; k<gh.get_grid(ilevel)->size(2); ++k )
-							if( gh.is_in_mask(ilevel,i,j,k) && !gh.is_refined(ilevel,i,j,k) )
+			size_t nwritten = 0, n;
+			particle_batches particles( gh, gh.levelmin(), gh.levelmax() );
+			while( (n = particles.next( &temp_data[0], block_buf_size_, [&]( int ilevel, int i, int j, int k ) -> double
 							{
-								if( temp_data.size() < block_buf_size_ ){
-									//snl					std::cout << "coord " << coord<< " "<< i <<" " << j << " " << k << " " << (*gh.get_grid(ilevel))(i,j,k) * header_.extras[NFILL-1] << "\n" ; //snl
-									temp_data.push_back( (*gh.get_grid(ilevel))(i,j,k) * vfac );
-								}else
-								{
-									ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*block_buf_size_ );
-									nwritten += block_buf_size_;
-									temp_data.clear();
-									temp_data.push_back( (*gh.get_grid(ilevel))(i,j,k) * vfac );
-								}
-
-							}
-
-			if( temp_data.size() > 0 )
+								//snl					std::cout << "coord " << coord<< " "<< i <<" " << j << " " << k << " " << (*gh.get_grid(ilevel))(i,j,k) * header_.extras[NFILL-1] << "\n" ; //snl
+								return (*gh.get_grid(ilevel))(i,j,k) * vfac;
+							} )) > 0 )
 			{
-				ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*temp_data.size() );
-				nwritten += temp_data.size();
+				ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*n );
+				nwritten += n;
 			}
 
 			if( nwritten != nptot )
@@ -799,8 +544,7 @@ class cart_output_plugin : public output_plugin
 		{
 			size_t nptot = gh.count_leaf_cells(gh.levelmin(), gh.levelmax());
 
-			std::vector<T_store> temp_data;
-			temp_data.reserve( block_buf_size_ );
+			std::vector<T_store> temp_data( block_buf_size_ );
 
 			// 	    // t0_internal = 2 * aexpn^2/(100*h*sqrt(Om0))
 			// 	    // r0_internal^{-1} = Ng/(boxh*aexpn)
@@ -825,29 +569,13 @@ class cart_output_plugin : public output_plugin
 			size_t blksize = sizeof(T_store)*nptot;
 			ofs_temp.write( (char *)&blksize, sizeof(size_t) );
 
-			size_t nwritten = 0;
-			for( int ilevel=gh.levelmax(); ilevel>=(int)gh.levelmin(); --ilevel )
-				for( unsigned i=0; i<gh.get_grid(ilevel)->size(0); ++i )
-					for( unsigned j=0; j<gh.get_grid(ilevel)->size(1); ++j )
-						for( unsigned k=0; k<gh.get_grid(ilevel)->size(2); ++k )
-							if( gh.is_in_mask(ilevel,i,j,k) && !gh.is_refined(ilevel,i,j,k) )
-							{
-								if( temp_data.size() < block_buf_size_ )
-									temp_data.push_back( (*gh.get_grid(ilevel))(i,j,k) * vfac );
-								else
-								{
-									ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*block_buf_size_ );
-									nwritten += block_buf_size_;
-									temp_data.clear();
-									temp_data.push_back( (*gh.get_grid(ilevel))(i,j,k) * vfac );
-								}
-
-							}
-
-			if( temp_data.size() > 0 )
+			size_t nwritten = 0, n;
+			particle_batches particles( gh, gh.levelmin(), gh.levelmax() );
+			while( (n = particles.next( &temp_data[0], block_buf_size_, [&]( int ilevel, int i, int j, int k ) -> double
+							{	return (*gh.get_grid(ilevel))(i,j,k) * vfac;	} )) > 0 )
 			{
-				ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*temp_data.size() );
-				nwritten += temp_data.size();
+				ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*n );
+				nwritten += n;
 			}
 
 			if( nwritten != nptot )
@@ -865,47 +593,32 @@ class cart_output_plugin : public output_plugin
 		void write_gas_density( const grid_hierarchy& gh ){
 			size_t nptot = gh.count_leaf_cells(gh.levelmin(), gh.levelmax());
 			char temp_fname[256];
-			std::vector<T_store> temp_data;
-			temp_data.reserve( block_buf_size_ );
+			std::vector<T_store> temp_data( block_buf_size_ );
 			size_t blksize = sizeof(T_store)*nptot;
 
 			double xfac = (double) header_.NGRIDC;
 
+			particle_batches particles( gh, gh.levelmin(), gh.levelmax() );
+
 			// write gas positions to cell centers
 			for (int coord=0; coord < 3; coord++ ) {
 				sprintf( temp_fname, "___ic_temp_%05d.bin", 100*id_gas_pos+coord );
 				std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
 				ofs_temp.write( (char *)&blksize, sizeof(size_t) );
 
-				size_t nwritten = 0;
-				for( int ilevel=gh.levelmax(); ilevel>=(int)gh.levelmin(); --ilevel )
-					for( unsigned i=0; i<gh.get_grid(ilevel)->size(0); ++i )
-						for( unsigned j=0; j<gh.get_grid(ilevel)->size(1); ++j )
-							for( unsigned k=0; k<gh.get_grid(ilevel)->size(2); ++k )
-								if( gh.is_in_mask(ilevel,i,j,k) && !gh.is_refined(ilevel,i,j,k) )
+				size_t nwritten = 0, n;
+				particles.rewind();
+				while( (n = particles.next( &temp_data[0], block_buf_size_, [&]( int ilevel, int i, int j, int k ) -> double
 								{
 									double xx[3];
 									gh.cell_pos(ilevel, i, j, k, xx);
 
 									// for gas positions just leave particle centered on the grid cell (no gh shift)
-									xx[coord] = (xx[coord]*xfac)+1.0;
-
-									if( temp_data.size() < block_buf_size_ )
-										temp_data.push_back( xx[coord] );
-									else
-									{
-										ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*block_buf_size_ );
-										nwritten += block_buf_size_;
-										temp_data.clear();
-										temp_data.push_back( xx[coord] );
-									}
-								}
-
-				if( temp_data.size() > 0 )
+									return (xx[coord]*xfac)+1.0;
+								} )) > 0 )
 				{
-					ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*temp_data.size() );
-					nwritten += temp_data.size();
-					temp_data.clear();
+					ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*n );
+					nwritten += n;
 				}
 
 				if( nwritten != nptot )
@@ -923,34 +636,17 @@ class cart_output_plugin : public output_plugin
 			// write gas densities
 			{
 				double pmafac = header_.Omb0 / header_.Om0 ;
-				double pma;
 				sprintf( temp_fname, "___ic_temp_%05d.bin", 100*id_gas_pma);
 				std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
 				ofs_temp.write( (char *)&blksize, sizeof(size_t) );
 
-				size_t nwritten = 0;
-				for( int ilevel=gh.levelmax(); ilevel>=(int)gh.levelmin(); --ilevel )
-					for( unsigned i=0; i<gh.get_grid(ilevel)->size(0); ++i )
-						for( unsigned j=0; j<gh.get_grid(ilevel)->size(1); ++j )
-							for( unsigned k=0; k<gh.get_grid(ilevel)->size(2); ++k )
-								if( gh.is_in_mask(ilevel,i,j,k) && !gh.is_refined(ilevel,i,j,k) )
-								{
-									pma = ( 1 + (*gh.get_grid(ilevel))(i,j,k) ) * pmafac * pow(8.0, -1.0*(ilevel-gh.levelmin())) ;
-									if( temp_data.size() < block_buf_size_ )
-										temp_data.push_back( pma );
-									else
-									{
-										ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*block_buf_size_ );
-										nwritten += block_buf_size_;
-										temp_data.clear();
-										temp_data.push_back( pma );
-									}
-								}
-
-				if( temp_data.size() > 0 )
+				size_t nwritten = 0, n;
+				particles.rewind();
+				while( (n = particles.next( &temp_data[0], block_buf_size_, [&]( int ilevel, int i, int j, int k ) -> double
+								{	return ( 1 + (*gh.get_grid(ilevel))(i,j,k) ) * pmafac * pow(8.0, -1.0*(ilevel-gh.levelmin()));	} )) > 0 )
 				{
-					ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*temp_data.size() );
-					nwritten += temp_data.size();
+					ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*n );
+					nwritten += n;
 				}
 
 				if( nwritten != nptot )
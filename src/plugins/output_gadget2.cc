@@ -10,11 +10,17 @@
 
 #include <fstream>
 #include <map>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <unistd.h>
 #include "log.hh"
 #include "region_generator.hh"
 #include "output.hh"
 #include "mg_interp.hh"
 #include "mesh.hh"
+#include "fft_mpi.hh"
 
 const int empty_fill_bytes = 56;
 
@@ -80,6 +86,7 @@ protected:
   };
   
   size_t np_per_type_[6];
+  size_t np_total_per_type_[6];          //!< over all ranks of a distributed run
   
   size_t block_buf_size_;
   size_t npartmax_;
@@ -94,6 +101,27 @@ protected:
   
   refinement_mask refmask;
   
+  //... direct output: components are written in place into the final files
+  struct file_layout
+  {
+    size_t ngas, ndm, ncoarse;           //!< particles of the file
+    size_t gas_start, dm_start, coarse_start; //!< index of its first particle in the component sequences
+    off_t pos, vel, ids, mass, eint;     //!< offsets of the blocks (of their leading size marker)
+    off_t size;
+  };
+  
+  bool bdirect_;
+  bool odirect_;
+  unsigned write_threads_;
+  bool bneed_long_ids_;
+  std::vector< int > fds_;
+  std::vector< file_layout > layout_;
+  std::vector< std::vector<unsigned> > np_per_file_;
+  std::vector<unsigned> np_tot_per_file_;
+  std::vector<T_store> chunk_;
+  int coarse_first_[2][3];               //!< component that wrote the coarse part of a pos/vel block first, -1 if none
+  int ncomp_done_[2];                    //!< components completely written to the pos/vel blocks
+  
   void distribute_particles( unsigned nfiles, std::vector< std::vector<unsigned> >& np_per_file, std::vector<unsigned>& np_tot_per_file )
   {
     np_per_file.assign( nfiles, std::vector<unsigned>( 6, 0 ) );
@@ -134,6 +162,322 @@ protected:
   }
 	
 
+  //! weights of dark matter and baryons in the velocities and positions of coarse particles
+  void coarse_weights( double& facc, double& facb ) const
+  {
+    facb = omegab_/header_.Omega0;
+    facc = (header_.Omega0-omegab_-omega_adm_)/header_.Omega0;
+    if(do_adm_ == 1) { // if baryons are ADM
+		facb = omega_adm_/header_.Omega0;
+	} else if(do_adm_ == 2) { // if baryons are ADM+Baryons
+		facb = (omega_adm_ + omegab_)/header_.Omega0;
+	}
+  }
+  
+  //! initial internal energy of the gas particles
+  double gas_internal_energy( void ) const
+  {
+    const double astart = 1./(1.+header_.redshift);
+    const double npol  = (fabs(1.0-gamma_)>1e-7)? 1.0/(gamma_-1.) : 1.0;
+    const double unitv = 1e5;
+    const double h2    = header_.HubbleParam*header_.HubbleParam;//*0.0001;
+    const double adec  = 1.0/(160.*pow(omegab_*h2/0.022,2.0/5.0));
+    const double Tcmb0 = 2.726;
+    const double Tini  = astart<adec? Tcmb0/astart : Tcmb0/astart/astart*adec;
+    const double mu    = (Tini>1.e4) ? 4.0/(8.-5.*YHe_) : 4.0/(1.+3.*(1.-YHe_));
+    
+    static bool bdisplayed = false;
+    if( !bdisplayed )
+      {
+	LOGINFO("Gadget2 : set initial gas temperature to %.2f K/mu",Tini/mu);
+	bdisplayed = true;
+      }
+    
+    return 1.3806e-16/1.6726e-24 * Tini * npol / mu / unitv / unitv;
+  }
+  
+  bool need_long_ids( size_t nptot ) const
+  {
+    if( nptot >= 1ul<<32 && !blongids_ )
+      {
+	LOGWARN("Need long particle IDs, will write 64bit, make sure to enable in Gadget!");
+	return true;
+      }
+    return blongids_;
+  }
+  
+  std::string file_name( unsigned ifile ) const
+  {
+    if( nfiles_ == 1 )
+      return fname_;
+    char ffname[256];
+    sprintf(ffname,"%s.%d",fname_.c_str(), ifile);
+    return ffname;
+  }
+  
+  void pwrite_all( int fd, const void* p, size_t nbytes, off_t off )
+  {
+    const char* q = reinterpret_cast<const char*>(p);
+    while( nbytes > 0 )
+      {
+	ssize_t nw = pwrite( fd, q, nbytes, off );
+	if( nw <= 0 )
+	  {
+	    LOGERR("gadget-2 output plug-in : I/O error while writing output file");
+	    throw std::runtime_error("I/O error while writing gadget-2 output file");
+	  }
+	q += nw; off += nw; nbytes -= (size_t)nw;
+      }
+  }
+  
+  void pread_all( int fd, void* p, size_t nbytes, off_t off )
+  {
+    char* q = reinterpret_cast<char*>(p);
+    while( nbytes > 0 )
+      {
+	ssize_t nr = pread( fd, q, nbytes, off );
+	if( nr <= 0 )
+	  {
+	    LOGERR("gadget-2 output plug-in : I/O error while reading back output file");
+	    throw std::runtime_error("I/O error while reading gadget-2 output file");
+	  }
+	q += nr; off += nr; nbytes -= (size_t)nr;
+      }
+  }
+  
+  //! write the size markers enclosing a block of nbytes at off
+  void write_block_markers( int fd, off_t off, size_t nbytes )
+  {
+    int blksize = nbytes;
+    pwrite_all( fd, &blksize, sizeof(int), off );
+    pwrite_all( fd, &blksize, sizeof(int), off+sizeof(int)+nbytes );
+  }
+  
+  //! create the output files with their final size, write the IDs, internal energies and block markers
+  void open_direct_files( void )
+  {
+    if( !fds_.empty() )
+      return;
+    
+    distribute_particles( nfiles_, np_per_file_, np_tot_per_file_ );
+    
+    size_t nptot = 0, npglobal = 0;
+    for( int i=0; i<6; ++i )
+      {
+	nptot += np_per_type_[i];
+	npglobal += np_total_per_type_[i];
+      }
+    bneed_long_ids_ = need_long_ids( npglobal );
+    
+    const bool bbaryons = np_per_type_[0] > 0;
+    const size_t idsize = bneed_long_ids_? sizeof(size_t) : sizeof(unsigned);
+    const off_t marker = 2*sizeof(int);
+    
+    layout_.assign( nfiles_, file_layout() );
+    //... IDs continue from the particles of the ranks before this one
+    size_t idcount = fft_mpi::exclusive_sum( nptot ), gas_start = 0, dm_start = 0, coarse_start = 0;
+    
+    for( unsigned ifile=0; ifile<nfiles_; ++ifile )
+      {
+	file_layout& l = layout_[ifile];
+	size_t np = np_tot_per_file_[ifile];
+	
+	l.ngas = np_per_file_[ifile][0];
+	l.ndm = np - l.ngas;
+	l.ncoarse = np_per_file_[ifile][bndparticletype_];
+	l.gas_start = gas_start;
+	l.dm_start = dm_start;
+	l.coarse_start = coarse_start;
+	
+	l.pos  = marker + sizeof(header);
+	l.vel  = l.pos + marker + 3*np*sizeof(T_store);
+	l.ids  = l.vel + marker + 3*np*sizeof(T_store);
+	l.mass = l.ids + marker + np*idsize;
+	l.eint = l.mass + (bmorethan2bnd_? marker + l.ncoarse*sizeof(T_store) : 0);
+	l.size = l.eint + ((bbaryons && l.ngas > 0)? marker + l.ngas*sizeof(T_store) : 0);
+	
+	gas_start += l.ngas;
+	dm_start += l.ndm;
+	coarse_start += l.ncoarse;
+	
+	std::string ffname = file_name( ifile );
+	int fd = open( ffname.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644 );
+	if( fd < 0 || ftruncate( fd, l.size ) != 0 )
+	  {
+	    LOGERR("gadget-2 output plug-in could not open output file '%s' for writing!",ffname.c_str());
+	    throw std::runtime_error(std::string("gadget-2 output plug-in could not open output file '")+ffname+"' for writing!\n");
+	  }
+	fds_.push_back( fd );
+	
+	write_block_markers( fd, 0, sizeof(header) );
+	write_block_markers( fd, l.pos, 3*np*sizeof(T_store) );
+	write_block_markers( fd, l.vel, 3*np*sizeof(T_store) );
+	write_block_markers( fd, l.ids, np*idsize );
+	if( bmorethan2bnd_ )
+	  write_block_markers( fd, l.mass, l.ncoarse*sizeof(T_store) );
+	
+	//... generate contiguous IDs
+	std::vector<unsigned> short_ids;
+	std::vector<size_t> long_ids;
+	for( size_t i0=0; i0<np; i0+=block_buf_size_ )
+	  {
+	    size_t n = std::min( (size_t)block_buf_size_, np-i0 );
+	    off_t off = l.ids + sizeof(int) + i0*idsize;
+	    if( bneed_long_ids_ )
+	      {
+		long_ids.resize( n );
+		for( size_t i=0; i<n; ++i )
+		  long_ids[i] = idcount++;
+		pwrite_all( fd, &long_ids[0], n*idsize, off );
+	      }else{
+	      short_ids.resize( n );
+	      for( size_t i=0; i<n; ++i )
+		short_ids[i] = idcount++;
+	      pwrite_all( fd, &short_ids[0], n*idsize, off );
+	    }
+	  }
+	
+	//... initial internal energy for gas particles
+	if( bbaryons && l.ngas > 0 )
+	  {
+	    write_block_markers( fd, l.eint, l.ngas*sizeof(T_store) );
+	    std::vector<T_store> eint( std::min( (size_t)block_buf_size_, l.ngas ), gas_internal_energy() );
+	    for( size_t i0=0; i0<l.ngas; i0+=eint.size() )
+	      pwrite_all( fd, &eint[0], std::min( eint.size(), l.ngas-i0 )*sizeof(T_store), l.eint + sizeof(int) + i0*sizeof(T_store) );
+	  }
+      }
+    
+    for( int k=0; k<2; ++k )
+      {
+	ncomp_done_[k] = 0;
+	for( int c=0; c<3; ++c )
+	  coarse_first_[k][c] = -1;
+      }
+  }
+  
+  //! write n values of a component, starting at particle s0 of its sequence, to their final place
+  /*! positions and velocities are interleaved, so the affected part of the block is read, the
+   *  component inserted and written back; coarse particles combine the dark matter and gas values
+   *  as soon as the second of the two has been written. Only the first component of a block skips
+   *  the read, so this moves more data than the temporary files do; what it saves is their disk space
+   */
+  void write_direct( int id, int coord, size_t s0, const T_store* data, size_t n )
+  {
+    const size_t npfine = np_per_type_[1];
+    const bool bgas = (id == id_gas_pos || id == id_gas_vel);
+    const bool bpos = (id == id_dm_pos || id == id_gas_pos);
+    const int kind = bpos? 0 : 1;
+    const bool bsecond = coarse_first_[kind][coord] >= 0 && coarse_first_[kind][coord] != id;
+    
+    double facc = 1.0, facb = 0.0;
+    coarse_weights( facc, facb );
+    
+    for( unsigned ifile=0; ifile<nfiles_; ++ifile )
+      {
+	const file_layout& l = layout_[ifile];
+	
+	if( id == id_dm_mass )
+	  {
+	    size_t a = std::max( s0, l.coarse_start ), b = std::min( s0+n, l.coarse_start+l.ncoarse );
+	    if( a < b )
+	      pwrite_all( fds_[ifile], data+(a-s0), (b-a)*sizeof(T_store), l.mass + sizeof(int) + (a-l.coarse_start)*sizeof(T_store) );
+	    continue;
+	  }
+	
+	//... the fine gas particles come first in each file, all other sequence entries are dark matter particles
+	for( int part=0; part<2; ++part )
+	  {
+	    size_t a, b;
+	    if( part == 0 )
+	      {
+		if( !bgas ) continue;
+		a = std::max( s0, l.gas_start ); b = std::min( std::min( s0+n, l.gas_start+l.ngas ), npfine );
+	      }else{
+	      a = std::max( s0, l.dm_start ); b = std::min( s0+n, l.dm_start+l.ndm );
+	      if( bgas ) a = std::max( a, npfine );
+	    }
+	    if( a >= b ) continue;
+	    
+	    size_t ifirst = (part == 0)? a-l.gas_start : l.ngas+(a-l.dm_start);
+	    off_t off = (bpos? l.pos : l.vel) + sizeof(int) + 3*ifirst*sizeof(T_store);
+	    chunk_.resize( 3*(b-a) );
+	    if( ncomp_done_[kind] > 0 )
+	      pread_all( fds_[ifile], &chunk_[0], chunk_.size()*sizeof(T_store), off );
+	    else
+	      std::fill( chunk_.begin(), chunk_.end(), T_store(0) );  // nothing written to this block yet
+	    
+	    for( size_t s=a; s<b; ++s )
+	      {
+		T_store v = data[s-s0], &t = chunk_[3*(s-a)+coord];
+		bool bcoarse = do_baryons_ && part == 1 && s >= npfine;
+		if( bcoarse && !bsecond )
+		  {
+		    t = v;  // combined when the other component arrives
+		    continue;
+		  }
+		if( bcoarse )
+		  v = bgas? facc*t + facb*v : facc*v + facb*t;
+		t = bpos? fmod(v+header_.BoxSize,header_.BoxSize) : v;
+	      }
+	    pwrite_all( fds_[ifile], &chunk_[0], chunk_.size()*sizeof(T_store), off );
+	  }
+      }
+  }
+  
+  //! a component was written completely
+  void end_direct( int id, int coord )
+  {
+    if( id == id_dm_mass )
+      return;
+    int kind = (id == id_dm_pos || id == id_gas_pos)? 0 : 1;
+    ++ncomp_done_[kind];
+    if( !do_baryons_ )
+      return;
+    if( coarse_first_[kind][coord] >= 0 && coarse_first_[kind][coord] != id )
+      coarse_first_[kind][coord] = -2; // both written
+    else
+      coarse_first_[kind][coord] = id;
+  }
+  
+  //! write the headers and close the files of the direct output
+  void close_direct_files( void )
+  {
+    for( int k=0; k<2; ++k )
+      for( int c=0; c<3; ++c )
+	if( do_baryons_ && coarse_first_[k][c] != -2 )
+	  {
+	    LOGERR("Gadget2 : dark matter or gas %s %d missing for the coarse particles.", k==0? "position" : "velocity", c);
+	    throw std::runtime_error("Internal consistency error in gadget2 output plug-in");
+	  }
+    
+    for( unsigned ifile=0; ifile<nfiles_; ++ifile )
+      {
+	header this_header( header_ );
+	for( int i=0; i<6; ++i ){
+	  this_header.npart[i] = np_per_file_[ifile][i];
+	  this_header.npartTotal[i] = (unsigned)np_total_per_type_[i];
+	  this_header.npartTotalHighWord[i] = (unsigned)(np_total_per_type_[i]>>32);
+	}
+	pwrite_all( fds_[ifile], &this_header, sizeof(header), sizeof(int) );
+	
+	if( close( fds_[ifile] ) != 0 )
+	  {
+	    LOGERR("gadget-2 output plug-in : I/O error while closing output file '%s'", file_name( ifile ).c_str());
+	    throw std::runtime_error("I/O error while writing gadget-2 output file");
+	  }
+      }
+    fds_.clear();
+  }
+  
+  //! write a buffer of a component to its temporary file or, with direct output, to the output files
+  void store( std::ofstream& ofs, int id, int coord, size_t s0, const T_store* data, size_t n )
+  {
+    if( bdirect_ )
+      write_direct( id, coord, s0, data, n );
+    else
+      ofs.write( (const char*)data, sizeof(T_store)*n );
+  }
+  
   std::ifstream& open_and_check( std::string ffname, size_t npart, size_t offset=0 )
   {
     std::ifstream ifs( ffname.c_str(), std::ios::binary );
@@ -203,6 +547,102 @@ protected:
     }
   };
   
+  //! sequential output file written in large aligned blocks, optionally bypassing the page cache
+  class block_writer
+  {
+    int fd_;
+    bool odirect_;
+    char *buf_;
+    size_t bufsize_, nbuf_;
+    std::string fname_;
+    
+    void flush_full( void )
+    {
+      size_t nw = 0;
+      while( nw < nbuf_ )
+	{
+	  ssize_t n = ::write( fd_, buf_+nw, nbuf_-nw );
+	  if( n <= 0 )
+	    {
+	      LOGERR("gadget-2 output plug-in : I/O error while writing output file \'%s\'", fname_.c_str());
+	      throw std::runtime_error("I/O error while writing gadget-2 output file");
+	    }
+	  nw += (size_t)n;
+	}
+      nbuf_ = 0;
+    }
+    
+  public:
+    block_writer( void )
+    : fd_( -1 ), odirect_( false ), buf_( NULL ), bufsize_( 0 ), nbuf_( 0 )
+    { }
+    
+    ~block_writer()
+    {
+      if( fd_ >= 0 )
+	::close( fd_ );
+      free( buf_ );
+    }
+    
+    void open( const std::string& fname, bool odirect, size_t bufsize )
+    {
+      const size_t align = 4096;
+      fname_ = fname;
+      bufsize_ = std::max( align, (bufsize+align-1)/align*align );
+      nbuf_ = 0;
+      if( posix_memalign( (void**)&buf_, align, bufsize_ ) != 0 )
+	throw std::bad_alloc();
+      
+      odirect_ = false;
+#ifdef O_DIRECT
+      if( odirect )
+	{
+	  fd_ = ::open( fname.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_DIRECT, 0644 );
+	  odirect_ = fd_ >= 0;
+	  if( !odirect_ )
+	    LOGWARN("Gadget2 : could not open \'%s\' with O_DIRECT, using buffered output.", fname.c_str());
+	}
+#endif
+      if( fd_ < 0 )
+	fd_ = ::open( fname.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644 );
+      if( fd_ < 0 )
+	{
+	  LOGERR("gadget-2 output plug-in could not open output file \'%s\' for writing!",fname.c_str());
+	  throw std::runtime_error(std::string("gadget-2 output plug-in could not open output file \'")+fname+"\' for writing!\n");
+	}
+    }
+    
+    void write( const char* p, size_t n )
+    {
+      while( n > 0 )
+	{
+	  size_t m = std::min( n, bufsize_-nbuf_ );
+	  memcpy( buf_+nbuf_, p, m );
+	  nbuf_ += m; p += m; n -= m;
+	  if( nbuf_ == bufsize_ )
+	    flush_full();
+	}
+    }
+    
+    //! write the remaining partial block and close the file
+    void close( void )
+    {
+#ifdef O_DIRECT
+      //... the tail is not a multiple of the block size, so it goes through the page cache
+      if( odirect_ && nbuf_ > 0 )
+	fcntl( fd_, F_SETFL, fcntl( fd_, F_GETFL ) & ~O_DIRECT );
+#endif
+      flush_full();
+      if( ::close( fd_ ) != 0 )
+	{
+	  fd_ = -1;
+	  LOGERR("gadget-2 output plug-in : I/O error while closing output file \'%s\'", fname_.c_str());
+	  throw std::runtime_error("I/O error while writing gadget-2 output file");
+	}
+      fd_ = -1;
+    }
+  };
+  
   class postream : public std::fstream
   {
   public:
@@ -261,107 +701,31 @@ protected:
     }
   };
   
-  void combine_components_for_coarse( void )
-  {        
-    const size_t
-      nptot = np_per_type_[1]+np_per_type_[2]+np_per_type_[3]+np_per_type_[4]+np_per_type_[5],
-      npfine = np_per_type_[1],
-      npcoarse = nptot-npfine;
-    
-    std::vector<T_store> tmp1, tmp2;
+  //! mass weight the coarse particles of n DM values starting at DM index p with the gas values read from gas[0..2]
+  void combine_coarse( size_t p, size_t n, T_store* c1, T_store* c2, T_store* c3, pistream* gas, T_store* buf )
+  {
+    const size_t npfine = np_per_type_[1];
+    if( p+n <= npfine )
+      return;
     
-    tmp1.assign(block_buf_size_,0.0);
-    tmp2.assign(block_buf_size_,0.0);
+    size_t i0 = (p < npfine)? npfine-p : 0, m = n-i0;
+    T_store* c[3] = { c1+i0, c2+i0, c3+i0 };
     
-    double facb = omegab_/header_.Omega0, facc = (header_.Omega0-omegab_-omega_adm_)/header_.Omega0;
-    if(do_adm_ == 1) { // if baryons are ADM
-		facb = omega_adm_/header_.Omega0;
-	} else if(do_adm_ == 2) { // if baryons are ADM+Baryons
-		facb = (omega_adm_ + omegab_)/header_.Omega0;
-	}
+    double facc, facb;
+    coarse_weights( facc, facb );
     
-    for( int icomp=0; icomp < 3; ++icomp )
+    for( int icomp=0; icomp<3; ++icomp )
       {
-	char fc[256], fb[256];
-	postream iffs1, iffs2;
-        
-	/*** positions ***/
-	
-	sprintf( fc, "___ic_temp_%05d.bin", 100*id_dm_pos+icomp );
-	sprintf( fb, "___ic_temp_%05d.bin", 100*id_gas_pos+icomp );
-        
-	iffs1.open( fc, nptot, npfine*sizeof(T_store) );
-	iffs2.open( fb, nptot, npfine*sizeof(T_store) );
-        
-	size_t npleft = npcoarse;
-	size_t n2read = std::min((size_t)block_buf_size_,npleft);
-	while( n2read > 0ul )
-	  {
-	    std::streampos sp = iffs1.tellg();
-	    iffs1.read( reinterpret_cast<char*>(&tmp1[0]), n2read*sizeof(T_store) );
-	    iffs2.read( reinterpret_cast<char*>(&tmp2[0]), n2read*sizeof(T_store) );
-            
-	    for( size_t i=0; i<n2read; ++i )
-	      {
-		tmp1[i] = facc*tmp1[i] + facb*tmp2[i];
-	      }
-	    
-	    iffs1.seekp( sp );
-	    iffs1.write( reinterpret_cast<char*>(&tmp1[0]), n2read*sizeof(T_store) );
-            
-	    npleft -= n2read;
-	    n2read = std::min( (size_t)block_buf_size_,npleft );
-	  }
-	
-	iffs1.close();
-	iffs2.close();
-        
-	/*** velocities ***/
-        
-	sprintf( fc, "___ic_temp_%05d.bin", 100*id_dm_vel+icomp );
-	sprintf( fb, "___ic_temp_%05d.bin", 100*id_gas_vel+icomp );
-        
-	iffs1.open( fc, nptot, npfine*sizeof(T_store) );
-	iffs2.open( fb, nptot, npfine*sizeof(T_store) );
-        
-	npleft = npcoarse;
-	n2read = std::min( (size_t)block_buf_size_,npleft);
-	
-	while( n2read > 0ul )
-	  {
-	    std::streampos sp = iffs1.tellg();
-	    iffs1.read( reinterpret_cast<char*>(&tmp1[0]), n2read*sizeof(T_store) );
-	    iffs2.read( reinterpret_cast<char*>(&tmp2[0]), n2read*sizeof(T_store) );
-            
-	    for( size_t i=0; i<n2read; ++i )
-	      {
-		tmp1[i] = facc*tmp1[i] + facb*tmp2[i];
-	      }
-	    
-	    iffs1.seekp( sp );
-	    iffs1.write( reinterpret_cast<char*>(&tmp1[0]), n2read*sizeof(T_store) );
-            
-	    npleft -= n2read;
-	    n2read = std::min( (size_t)block_buf_size_,npleft );
-	  }
-	
-	iffs1.close();
-	iffs2.close();
+	gas[icomp].read( reinterpret_cast<char*>(buf), m*sizeof(T_store) );
+	for( size_t i=0; i<m; ++i )
+	  c[icomp][i] = facc*c[icomp][i] + facb*buf[i];
       }
-    
   }
   
-  void assemble_gadget_file( void )
+  //! write output file ifile from the temporary files, its particles start at the given indices of the components
+  void assemble_file( unsigned ifile, const std::vector< std::vector<unsigned> >& np_per_file, const std::vector<unsigned>& np_tot_per_file,
+		      size_t wrote_gas, size_t wrote_dm, size_t wrote_coarse, size_t idcount, bool bneed_long_ids, double ceint )
   {
-    
-    if( do_baryons_ )
-      combine_components_for_coarse();
-    
-    
-    
-    //............................................................................
-    //... copy from the temporary files, interleave the data and save ............
-		
     char fnx[256],fny[256],fnz[256],fnvx[256],fnvy[256],fnvz[256],fnm[256];
     char fnbx[256], fnby[256], fnbz[256], fnbvx[256], fnbvy[256], fnbvz[256];
     
@@ -385,76 +749,28 @@ protected:
     
     const size_t 
       nptot = np_per_type_[0]+np_per_type_[1]+np_per_type_[2]+np_per_type_[3]+np_per_type_[4]+np_per_type_[5],
-      //npgas = np_fine_gas_,
       npcdm = nptot-np_per_type_[0];
     
-    size_t
-      wrote_coarse = 0,
-      wrote_gas  = 0,
-      wrote_dm   = 0;
-    
-    size_t
-      npleft = nptot, 
-      n2read = std::min((size_t)block_buf_size_,npleft);
-    
-    std::cout << " - Gadget2 : writing " << nptot << " particles to file...\n";
-    for( int i=0; i<6; ++i )
-      if( np_per_type_[i] > 0 )
-	LOGINFO("      type   %d : %12llu [m=%g]", i, np_per_type_[i], header_.mass[i] );
-    
+    size_t npleft, n2read;
+    size_t curr_block_buf_size = block_buf_size_;
     bool bbaryons = np_per_type_[0] > 0;
     
     std::vector<T_store> adata3;
     adata3.reserve( 3*block_buf_size_ );
-    T_store *tmp1, *tmp2, *tmp3;
-    
-    tmp1 = new T_store[block_buf_size_];
-    tmp2 = new T_store[block_buf_size_];
-    tmp3 = new T_store[block_buf_size_];
-    
-    //... for multi-file output
-    //int fileno = 0;
-    //size_t npart_left = nptot;
-    
-    //std::vector<unsigned> nfdm_per_file, nfgas_per_file, nc_per_file;
-        
-    std::vector< std::vector<unsigned> > np_per_file;
-    std::vector<unsigned> np_tot_per_file;
-    
-    distribute_particles( nfiles_, np_per_file, np_tot_per_file );
-    
-    if( nfiles_ > 1 )
-      {
-	LOGINFO("Gadget2 : distributing particles to %d files", nfiles_ );
-	//<< "                 " << std::setw(12) << "type 0" << "," << std::setw(12) << "type 1" << "," << std::setw(12) << "type " << bndparticletype_ << std::endl;
-	for( unsigned i=0; i<nfiles_; ++i )
-	  LOGINFO("      file %i : %12llu", i, np_tot_per_file[i], header_.mass[i] );
-      }
-    
+    std::vector<T_store> buf1( block_buf_size_ ), buf2( block_buf_size_ ), buf3( block_buf_size_ ), bufc;
+    T_store *tmp1 = &buf1[0], *tmp2 = &buf2[0], *tmp3 = &buf3[0];
     
-    size_t curr_block_buf_size = block_buf_size_;
+    //... coarse DM particles are combined with the coarse gas while they are copied
+    const size_t npfine = np_per_type_[1], npdm_this_file = np_tot_per_file[ifile] - np_per_file[ifile][0];
+    bool bcombine = do_baryons_ && wrote_dm + npdm_this_file > npfine;
+    size_t coarse_first = std::max( wrote_dm, npfine );
+    pistream gas[3];
+    if( bcombine )
+      bufc.resize( block_buf_size_ );
     
-    size_t idcount = 0;
-    bool bneed_long_ids = blongids_;
-    if( nptot >= 1ul<<32 && !bneed_long_ids )
-      {
-	bneed_long_ids = true;
-	LOGWARN("Need long particle IDs, will write 64bit, make sure to enable in Gadget!");
-      }   
+    block_writer out;
+    out.open( file_name( ifile ), odirect_, 3*block_buf_size_*sizeof(T_store) );
     
-    for( unsigned ifile=0; ifile<nfiles_; ++ifile )
-      {
-	
-	if( nfiles_ > 1 )
-	  {
-	    char ffname[256];
-	    sprintf(ffname,"%s.%d",fname_.c_str(), ifile);
-	    ofs_.open(ffname, std::ios::binary|std::ios::trunc );
-	  }else{
-	  ofs_.open(fname_.c_str(), std::ios::binary|std::ios::trunc );
-	}
-	
-        
 	size_t np_this_file = np_tot_per_file[ifile];
 	
 	int blksize = sizeof(header);
@@ -468,14 +784,14 @@ protected:
 	  this_header.npartTotalHighWord[i] = (unsigned)(np_per_type_[i]>>32);
 	}
             
-	ofs_.write( (char *)&blksize, sizeof(int) );
-	ofs_.write( (char *)&this_header, sizeof(header) );
-	ofs_.write( (char *)&blksize, sizeof(int) );
+	out.write( (char *)&blksize, sizeof(int) );
+	out.write( (char *)&this_header, sizeof(header) );
+	out.write( (char *)&blksize, sizeof(int) );
 	
 	
 	//... particle positions ..................................................
 	blksize = 3ul*np_this_file*sizeof(T_store);
-	ofs_.write( (char *)&blksize, sizeof(int) );
+	out.write( (char *)&blksize, sizeof(int) );
 	
 	if( bbaryons && np_per_file[ifile][0] > 0ul )
 	  {
@@ -498,7 +814,7 @@ protected:
 		    adata3.push_back( fmod(tmp2[i]+header_.BoxSize,header_.BoxSize) );
 		    adata3.push_back( fmod(tmp3[i]+header_.BoxSize,header_.BoxSize) );
 		  }
-		ofs_.write( reinterpret_cast<char*>(&adata3[0]), 3*n2read*sizeof(T_store) );
+		out.write( reinterpret_cast<char*>(&adata3[0]), 3*n2read*sizeof(T_store) );
 		
 		adata3.clear();
 		npleft -= n2read;
@@ -518,34 +834,50 @@ protected:
 	iffs2.open( fny, npcdm, wrote_dm*sizeof(T_store) );
 	iffs3.open( fnz, npcdm, wrote_dm*sizeof(T_store) );
 	
+	if( bcombine )
+	  {
+	    gas[0].open( fnbx, npcdm, coarse_first*sizeof(T_store) );
+	    gas[1].open( fnby, npcdm, coarse_first*sizeof(T_store) );
+	    gas[2].open( fnbz, npcdm, coarse_first*sizeof(T_store) );
+	  }
+	
+	size_t pdm = wrote_dm;
 	while( n2read > 0ul )
 	  {
 	    iffs1.read( reinterpret_cast<char*>(&tmp1[0]), n2read*sizeof(T_store) );
 	    iffs2.read( reinterpret_cast<char*>(&tmp2[0]), n2read*sizeof(T_store) );
 	    iffs3.read( reinterpret_cast<char*>(&tmp3[0]), n2read*sizeof(T_store) );
 	    
+	    if( bcombine )
+	      combine_coarse( pdm, n2read, tmp1, tmp2, tmp3, gas, &bufc[0] );
+	    pdm += n2read;
+	    
 	    for( size_t i=0; i<n2read; ++i )
 	      {
 		adata3.push_back( fmod(tmp1[i]+header_.BoxSize,header_.BoxSize) );
 		adata3.push_back( fmod(tmp2[i]+header_.BoxSize,header_.BoxSize) );
 		adata3.push_back( fmod(tmp3[i]+header_.BoxSize,header_.BoxSize) );
 	      }
-	    ofs_.write( reinterpret_cast<char*>(&adata3[0]), 3*n2read*sizeof(T_store) );
+	    out.write( reinterpret_cast<char*>(&adata3[0]), 3*n2read*sizeof(T_store) );
 	    
 	    adata3.clear();
 	    npleft -= n2read;
 	    n2read = std::min( curr_block_buf_size,npleft );
 	  }
-	ofs_.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
+	out.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
 	
 	iffs1.close();
 	iffs2.close();
 	iffs3.close();
 	
+	if( bcombine )
+	  for( int icomp=0; icomp<3; ++icomp )
+	    gas[icomp].close();
+	
 	
 	//... particle velocities ..................................................
 	blksize = 3ul*np_this_file*sizeof(T_store);
-	ofs_.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
+	out.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
 	
 	
 	if( bbaryons && np_per_file[ifile][0] > 0ul )
@@ -569,7 +901,7 @@ protected:
 		    adata3.push_back( tmp3[i] );
 		  }
 		
-		ofs_.write( reinterpret_cast<char*>(&adata3[0]), 3*n2read*sizeof(T_store) );
+		out.write( reinterpret_cast<char*>(&adata3[0]), 3*n2read*sizeof(T_store) );
 		
 		adata3.clear();
 		npleft -= n2read;
@@ -587,14 +919,26 @@ protected:
 	iffs2.open( fnvy, npcdm, wrote_dm*sizeof(T_store) );
 	iffs3.open( fnvz, npcdm, wrote_dm*sizeof(T_store) );
 	
+	if( bcombine )
+	  {
+	    gas[0].open( fnbvx, npcdm, coarse_first*sizeof(T_store) );
+	    gas[1].open( fnbvy, npcdm, coarse_first*sizeof(T_store) );
+	    gas[2].open( fnbvz, npcdm, coarse_first*sizeof(T_store) );
+	  }
+	
 	npleft = np_this_file - np_per_file[ifile][0];
 	n2read = std::min(curr_block_buf_size,npleft);
+	pdm = wrote_dm;
 	while( n2read > 0ul )
 	  {
 	    iffs1.read( reinterpret_cast<char*>(&tmp1[0]), n2read*sizeof(T_store) );
 	    iffs2.read( reinterpret_cast<char*>(&tmp2[0]), n2read*sizeof(T_store) );
 	    iffs3.read( reinterpret_cast<char*>(&tmp3[0]), n2read*sizeof(T_store) );
 	    
+	    if( bcombine )
+	      combine_coarse( pdm, n2read, tmp1, tmp2, tmp3, gas, &bufc[0] );
+	    pdm += n2read;
+	    
 	    for( size_t i=0; i<n2read; ++i )
 	      {
 		adata3.push_back( tmp1[i] );
@@ -602,18 +946,22 @@ protected:
 		adata3.push_back( tmp3[i] );
 	      }
 	    
-	    ofs_.write( reinterpret_cast<char*>(&adata3[0]), 3*n2read*sizeof(T_store) );
+	    out.write( reinterpret_cast<char*>(&adata3[0]), 3*n2read*sizeof(T_store) );
 	    
 	    adata3.clear();
 	    npleft -= n2read;
 	    n2read = std::min( curr_block_buf_size,npleft );
 	  }
-	ofs_.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
+	out.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
 	
 	iffs1.close();
 	iffs2.close();
 	iffs3.close();
 	
+	if( bcombine )
+	  for( int icomp=0; icomp<3; ++icomp )
+	    gas[icomp].close();
+	
 	//... particle IDs ..........................................................
 	std::vector<unsigned> short_ids;
 	std::vector<size_t> long_ids;
@@ -632,23 +980,23 @@ protected:
 	
 	
 	//... generate contiguous IDs and store in file ..
-	ofs_.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
+	out.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
 	while( n2read > 0ul )
 	  {
 	    if( bneed_long_ids )
 	      {
                    for( size_t i=0; i<n2read; ++i )
 		     long_ids[i] = idcount++;
-                   ofs_.write( reinterpret_cast<char*>(&long_ids[0]), n2read*sizeof(size_t) );
+                   out.write( reinterpret_cast<char*>(&long_ids[0]), n2read*sizeof(size_t) );
                 }else{
 	      for( size_t i=0; i<n2read; ++i )
 		short_ids[i] = idcount++;
-	      ofs_.write( reinterpret_cast<char*>(&short_ids[0]), n2read*sizeof(unsigned) );
+	      out.write( reinterpret_cast<char*>(&short_ids[0]), n2read*sizeof(unsigned) );
 	    }
 	    npleft -= n2read;
 	    n2read = std::min( curr_block_buf_size,npleft );
 	  }
-	ofs_.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
+	out.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
 	
 	std::vector<unsigned>().swap( short_ids );
 	std::vector<size_t>().swap( long_ids );
@@ -664,17 +1012,17 @@ protected:
 	    n2read  = std::min(curr_block_buf_size,npleft);
 	    blksize = npcoarse*sizeof(T_store);
 	    
-	    ofs_.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
+	    out.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
 	    while( n2read > 0ul )
 	      {
 		iffs1.read( reinterpret_cast<char*>(&tmp1[0]), n2read*sizeof(T_store) );
-		ofs_.write( reinterpret_cast<char*>(&tmp1[0]), n2read*sizeof(T_store) );
+		out.write( reinterpret_cast<char*>(&tmp1[0]), n2read*sizeof(T_store) );
 		
 		npleft -= n2read;
 		n2read = std::min( curr_block_buf_size,npleft );
 		
 	      }
-	    ofs_.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
+	    out.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
 	    
 	    iffs1.close();
 	    
@@ -687,53 +1035,104 @@ protected:
 	    
 	    std::vector<T_store> eint(curr_block_buf_size,0.0);
 	    
-	    const double astart = 1./(1.+header_.redshift);
-	    const double npol  = (fabs(1.0-gamma_)>1e-7)? 1.0/(gamma_-1.) : 1.0;
-	    const double unitv = 1e5;
-	    const double h2    = header_.HubbleParam*header_.HubbleParam;//*0.0001;
-	    const double adec  = 1.0/(160.*pow(omegab_*h2/0.022,2.0/5.0));
-	    const double Tcmb0 = 2.726;
-	    const double Tini  = astart<adec? Tcmb0/astart : Tcmb0/astart/astart*adec;
-	    const double mu    = (Tini>1.e4) ? 4.0/(8.-5.*YHe_) : 4.0/(1.+3.*(1.-YHe_));
-	    const double ceint = 1.3806e-16/1.6726e-24 * Tini * npol / mu / unitv / unitv;
 	    
 	    npleft	= np_per_file[ifile][0];
 	    n2read	= std::min(curr_block_buf_size,npleft);
 	    blksize = sizeof(T_store)*np_per_file[ifile][0]; //*npgas
 	    
-	    ofs_.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
+	    out.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
 	    while( n2read > 0ul )
 	      {
 		for( size_t i=0; i<n2read; ++i )
 		  eint[i] = ceint;
-		ofs_.write( reinterpret_cast<char*>(&eint[0]), n2read*sizeof(T_store) );
+		out.write( reinterpret_cast<char*>(&eint[0]), n2read*sizeof(T_store) );
 		npleft -= n2read;
 		n2read = std::min( curr_block_buf_size,npleft );
 	      }
-	    ofs_.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
-	    
-	    static bool bdisplayed = false;
-	    if( !bdisplayed )
-	      {
-		LOGINFO("Gadget2 : set initial gas temperature to %.2f K/mu",Tini/mu);
-		bdisplayed = true;
-	      }
+	    out.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
 	  }
 	
 	
-	ofs_.flush();
-	ofs_.close();
-	
-	wrote_gas       += np_per_file[ifile][0];
-	wrote_dm        += np_this_file-np_per_file[ifile][0];
-	wrote_coarse    += np_per_file[ifile][5];
-	
-        
+	out.close();
+  }
+  
+  void assemble_gadget_file( void )
+  {
+    //............................................................................
+    //... copy from the temporary files, interleave the data and save ............
+		
+    char fnx[256],fny[256],fnz[256],fnvx[256],fnvy[256],fnvz[256],fnm[256];
+    char fnbx[256], fnby[256], fnbz[256], fnbvx[256], fnbvy[256], fnbvz[256];
+    
+    sprintf( fnx,  "___ic_temp_%05d.bin", 100*id_dm_pos+0 );
+    sprintf( fny,  "___ic_temp_%05d.bin", 100*id_dm_pos+1 );
+    sprintf( fnz,  "___ic_temp_%05d.bin", 100*id_dm_pos+2 );
+    sprintf( fnvx, "___ic_temp_%05d.bin", 100*id_dm_vel+0 );
+    sprintf( fnvy, "___ic_temp_%05d.bin", 100*id_dm_vel+1 );
+    sprintf( fnvz, "___ic_temp_%05d.bin", 100*id_dm_vel+2 );
+    sprintf( fnm,  "___ic_temp_%05d.bin", 100*id_dm_mass  );
+    
+    sprintf( fnbx,  "___ic_temp_%05d.bin", 100*id_gas_pos+0 );
+    sprintf( fnby,  "___ic_temp_%05d.bin", 100*id_gas_pos+1 );
+    sprintf( fnbz,  "___ic_temp_%05d.bin", 100*id_gas_pos+2 );
+    sprintf( fnbvx, "___ic_temp_%05d.bin", 100*id_gas_vel+0 );
+    sprintf( fnbvy, "___ic_temp_%05d.bin", 100*id_gas_vel+1 );
+    sprintf( fnbvz, "___ic_temp_%05d.bin", 100*id_gas_vel+2 );
+    
+    
+    const size_t 
+      nptot = np_per_type_[0]+np_per_type_[1]+np_per_type_[2]+np_per_type_[3]+np_per_type_[4]+np_per_type_[5];
+    
+    std::cout << " - Gadget2 : writing " << nptot << " particles to file...\n";
+    for( int i=0; i<6; ++i )
+      if( np_per_type_[i] > 0 )
+	LOGINFO("      type   %d : %12llu [m=%g]", i, np_per_type_[i], header_.mass[i] );
+    
+    std::vector< std::vector<unsigned> > np_per_file;
+    std::vector<unsigned> np_tot_per_file;
+    
+    distribute_particles( nfiles_, np_per_file, np_tot_per_file );
+    
+    if( nfiles_ > 1 )
+      {
+	LOGINFO("Gadget2 : distributing particles to %d files", nfiles_ );
+	for( unsigned i=0; i<nfiles_; ++i )
+	  LOGINFO("      file %i : %12llu", i, np_tot_per_file[i], header_.mass[i] );
       }
     
-    delete[] tmp1;
-    delete[] tmp2;
-    delete[] tmp3;
+    bool bneed_long_ids = need_long_ids( nptot );
+    double ceint = (np_per_type_[0] > 0)? gas_internal_energy() : 0.0;
+    
+    //... where the particles of each file start in the temporary files
+    std::vector<size_t> wrote_gas( nfiles_, 0 ), wrote_dm( nfiles_, 0 ), wrote_coarse( nfiles_, 0 ), idstart( nfiles_, 0 );
+    for( unsigned ifile=1; ifile<nfiles_; ++ifile )
+      {
+	wrote_gas[ifile]    = wrote_gas[ifile-1] + np_per_file[ifile-1][0];
+	wrote_dm[ifile]     = wrote_dm[ifile-1] + np_tot_per_file[ifile-1] - np_per_file[ifile-1][0];
+	wrote_coarse[ifile] = wrote_coarse[ifile-1] + np_per_file[ifile-1][bndparticletype_];
+	idstart[ifile]      = idstart[ifile-1] + np_tot_per_file[ifile-1];
+      }
+    
+    //... the files are independent, with [output] gadget_write_threads several are written at once
+    int nthreads = std::max( 1, std::min( (int)write_threads_, (int)nfiles_ ) );
+    if( nthreads > 1 )
+      LOGINFO("Gadget2 : writing %d files at a time", nthreads );
+    
+    std::exception_ptr error;
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+    for( int ifile=0; ifile<(int)nfiles_; ++ifile )
+      {
+	try{
+	  assemble_file( ifile, np_per_file, np_tot_per_file, wrote_gas[ifile], wrote_dm[ifile], wrote_coarse[ifile],
+			 idstart[ifile], bneed_long_ids, ceint );
+	}catch(...){
+	  #pragma omp critical(gadget2_error)
+	  if( !error )
+	    error = std::current_exception();
+	}
+      }
+    if( error )
+      std::rethrow_exception( error );
     
     remove( fnbx );
     remove( fnby );
@@ -817,6 +1216,9 @@ protected:
 	
 	if( do_baryons_ )
 	  np_per_type_[0] = np_per_type_[1];
+	
+	for( int i=0; i<6; ++i )
+	  np_total_per_type_[i] = fft_mpi::sum( np_per_type_[i] );
       }
   }
   
@@ -851,6 +1253,25 @@ public:
     
     shift_halfcell_ = cf.getValueSafe<bool>("output","gadget_cell_centered",false);
     
+    //... write the components in place instead of through temporary files; this saves the temporary
+    //... disk space, not I/O, since each component reads back and rewrites the interleaved rows
+    bdirect_ = cf.getValueSafe<bool>("output","gadget_direct",false);
+    
+    //... in distributed runs every rank writes its slab in place to the file <filename>.<rank>
+    if( fft_mpi::active() )
+      {
+	char ffname[256];
+	sprintf(ffname,"%s.%d",fname_.c_str(), fft_mpi::rank());
+	fname_ = ffname;
+	nfiles_ = 1;
+	bdirect_ = true;
+      }
+    
+    //... multi-file output: files written concurrently, optionally with O_DIRECT
+    write_threads_ = cf.getValueSafe<unsigned>("output","gadget_write_threads",1);
+    odirect_ = cf.getValueSafe<bool>("output","gadget_odirect",false);
+    bneed_long_ids_ = blongids_;
+    
     //if( nfiles_ < (int)ceil((double)npart/(double)npartmax_) )
     //	LOGWARN("Should use more files.");
     
@@ -989,7 +1410,7 @@ public:
     header_.flag_cooling = 0;
     
     //... 
-    header_.num_files = nfiles_;//1;
+    header_.num_files = fft_mpi::active()? fft_mpi::size() : nfiles_;//1;
     header_.BoxSize = cf.getValue<double>("setup","boxlength");
     header_.Omega0 = cf.getValue<double>("cosmology","Omega_m");
     header_.OmegaLambda = cf.getValue<double>("cosmology","Omega_L");
@@ -1033,48 +1454,38 @@ public:
 	size_t npcoarse = np_per_type_[bndparticletype_];
 	size_t nwritten = 0;
 	
-	std::vector<T_store> temp_dat;
-	temp_dat.reserve(block_buf_size_);
+	std::vector<T_store> temp_dat( block_buf_size_ );
 	
 	char temp_fname[256];
 	sprintf( temp_fname, "___ic_temp_%05d.bin", 100*id_dm_mass );
-	std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
+	std::ofstream ofs_temp;
+	if( bdirect_ )
+	  open_direct_files();
+	else
+	  ofs_temp.open( temp_fname, std::ios::binary|std::ios::trunc );
 	
 	size_t blksize = sizeof(T_store)*npcoarse;
 	
-	ofs_temp.write( (char *)&blksize, sizeof(size_t) );
+	if( !bdirect_ )
+	  ofs_temp.write( (char *)&blksize, sizeof(size_t) );
           
 	int levelmaxcoarse = gh.levelmax()-4;
 	if( !spread_coarse_acrosstypes_ )
 	  levelmaxcoarse = gh.levelmax()-1;
 	
+	// baryon particles live only on finest grid
+	// these particles here are total matter particles
+	std::vector<double> pmass( gh.levelmax()+1, 0.0 );
 	for( int ilevel=levelmaxcoarse; ilevel>=(int)gh.levelmin(); --ilevel )
-	  {
-	    // baryon particles live only on finest grid
-	    // these particles here are total matter particles
-	    double pmass = header_.Omega0 * rhoc * pow(header_.BoxSize,3.)/pow(2,3*ilevel);	
-	    
-	    for( unsigned i=0; i<gh.get_grid(ilevel)->size(0); ++i )
-	      for( unsigned j=0; j<gh.get_grid(ilevel)->size(1); ++j )
-		for( unsigned k=0; k<gh.get_grid(ilevel)->size(2); ++k )
-		  if( gh.is_in_mask(ilevel,i,j,k) && !gh.is_refined(ilevel,i,j,k) )
-		    {
-		      if( temp_dat.size() <  block_buf_size_ )
-			temp_dat.push_back( pmass );	
-		      else
-			{
-			  ofs_temp.write( (char*)&temp_dat[0], sizeof(T_store)*block_buf_size_ );	
-			  nwritten += block_buf_size_;
-			  temp_dat.clear();
-			  temp_dat.push_back( pmass );	
-			}
-		    }
-	  }
+	  pmass[ilevel] = header_.Omega0 * rhoc * pow(header_.BoxSize,3.)/pow(2,3*ilevel);
 	
-	if( temp_dat.size() > 0 )
-	  {	
-	    ofs_temp.write( (char*)&temp_dat[0], sizeof(T_store)*temp_dat.size() );		
-	    nwritten+=temp_dat.size();
+	particle_batches particles( gh, gh.levelmin(), levelmaxcoarse );
+	size_t n;
+	while( (n = particles.next( &temp_dat[0], block_buf_size_, [&]( int ilevel, int, int, int )
+				    {	return pmass[ilevel];	} )) > 0 )
+	  {
+	    store( ofs_temp, id_dm_mass, 0, nwritten, &temp_dat[0], n );
+	    nwritten += n;
 	  }
 	
 	if( nwritten != npcoarse ){
@@ -1082,7 +1493,8 @@ public:
 	  throw std::runtime_error("Internal consistency error while writing temporary file for masses");
 	}
 
-	ofs_temp.write( (char *)&blksize, sizeof(size_t) );
+	if( !bdirect_ )
+	  ofs_temp.write( (char *)&blksize, sizeof(size_t) );
 	
 	if( ofs_temp.bad() )
 	  throw std::runtime_error("I/O error while writing temporary file for masses");
@@ -1113,53 +1525,47 @@ public:
     size_t nwritten = 0;
     //... collect displacements and convert to absolute coordinates with correct
     //... units
-    std::vector<T_store> temp_data;
-    temp_data.reserve( block_buf_size_ );
+    std::vector<T_store> temp_data( block_buf_size_ );
     
     char temp_fname[256];
     sprintf( temp_fname, "___ic_temp_%05d.bin", 100*id_dm_pos+coord );
-    std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
+    std::ofstream ofs_temp;
+    if( bdirect_ )
+      open_direct_files();
+    else
+      ofs_temp.open( temp_fname, std::ios::binary|std::ios::trunc );
     
     size_t blksize = sizeof(T_store)*npart;
-    ofs_temp.write( (char *)&blksize, sizeof(size_t) );
+    if( !bdirect_ )
+      ofs_temp.write( (char *)&blksize, sizeof(size_t) );
     
     double xfac = header_.BoxSize;
     
-    for( int ilevel=gh.levelmax(); ilevel>=(int)gh.levelmin(); --ilevel )
-      for( unsigned i=0; i<gh.get_grid(ilevel)->size(0); ++i )
-	for( unsigned j=0; j<gh.get_grid(ilevel)->size(1); ++j )
-	  for( unsigned k=0; k<gh.get_grid(ilevel)->size(2); ++k )
-	    if( gh.is_in_mask(ilevel,i,j,k) && !gh.is_refined(ilevel,i,j,k) )
-	      {
-		double xx[3];
-		gh.cell_pos(ilevel, i, j, k, xx);
-		if( shift != NULL )
-		  xx[coord] += shift[coord];
-		
-		xx[coord] = (xx[coord]+(*gh.get_grid(ilevel))(i,j,k))*xfac;
-		
-		if( temp_data.size() < block_buf_size_ )
-		  temp_data.push_back( xx[coord] );
-		else
-		  {
-		    ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*block_buf_size_ );
-		    nwritten += block_buf_size_;
-		    temp_data.clear();
-		    temp_data.push_back( xx[coord] );
-		  }
-	      }
-    
-    if( temp_data.size() > 0 )
-      {	
-	ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*temp_data.size() );
-	nwritten += temp_data.size();
+    particle_batches particles( gh, gh.levelmin(), gh.levelmax() );
+    size_t n;
+    while( (n = particles.next( &temp_data[0], block_buf_size_, [&]( int ilevel, int i, int j, int k ) -> double
+				{
+				  double xx[3];
+				  gh.cell_pos(ilevel, i, j, k, xx);
+				  if( shift != NULL )
+				    xx[coord] += shift[coord];
+				  
+				  return (xx[coord]+(*gh.get_grid(ilevel))(i,j,k))*xfac;
+				} )) > 0 )
+      {
+	store( ofs_temp, id_dm_pos, coord, nwritten, &temp_data[0], n );
+	nwritten += n;
       }
     
     if( nwritten != npart )
       throw std::runtime_error("Internal consistency error while writing temporary file for positions");
     
     //... dump to temporary file
-    ofs_temp.write( (char *)&blksize, sizeof(size_t) );
+    if( bdirect_ )
+      end_direct( id_dm_pos, coord );
+    
+    if( !bdirect_ )
+      ofs_temp.write( (char *)&blksize, sizeof(size_t) );
     
     if( ofs_temp.bad() )
       throw std::runtime_error("I/O error while writing temporary file for positions");
@@ -1182,8 +1588,7 @@ public:
       
     //... collect displacements and convert to absolute coordinates with correct
     //... units
-    std::vector<T_store> temp_data;
-    temp_data.reserve( block_buf_size_ );
+    std::vector<T_store> temp_data( block_buf_size_ );
     
     float isqrta = 1.0f/sqrt(header_.time);
     float vfac = isqrta*header_.BoxSize;
@@ -1196,38 +1601,33 @@ public:
     
     char temp_fname[256];
     sprintf( temp_fname, "___ic_temp_%05d.bin", 100*id_dm_vel+coord );
-    std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
+    std::ofstream ofs_temp;
+    if( bdirect_ )
+      open_direct_files();
+    else
+      ofs_temp.open( temp_fname, std::ios::binary|std::ios::trunc );
     
     size_t blksize = sizeof(T_store)*npart;
-    ofs_temp.write( (char *)&blksize, sizeof(size_t) );
+    if( !bdirect_ )
+      ofs_temp.write( (char *)&blksize, sizeof(size_t) );
     
-    for( int ilevel=levelmax_; ilevel>=(int)levelmin_; --ilevel )
-      for( unsigned i=0; i<gh.get_grid(ilevel)->size(0); ++i )
-	for( unsigned j=0; j<gh.get_grid(ilevel)->size(1); ++j )
-	  for( unsigned k=0; k<gh.get_grid(ilevel)->size(2); ++k )
-	    if( gh.is_in_mask(ilevel,i,j,k) && !gh.is_refined(ilevel,i,j,k) )
-	      {
-		if( temp_data.size() < block_buf_size_ )
-		  temp_data.push_back( (*gh.get_grid(ilevel))(i,j,k) * vfac );
-		else 
-		  {
-		    ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*block_buf_size_ );
-		    nwritten += block_buf_size_;
-		    temp_data.clear();
-		    temp_data.push_back( (*gh.get_grid(ilevel))(i,j,k) * vfac );
-		  }
-		
-	      }
-    if( temp_data.size() > 0 )
-      {	
-	ofs_temp.write( (char*)&temp_data[0], temp_data.size()*sizeof(T_store) );
-	nwritten += temp_data.size();
+    particle_batches particles( gh, levelmin_, levelmax_ );
+    size_t n;
+    while( (n = particles.next( &temp_data[0], block_buf_size_, [&]( int ilevel, int i, int j, int k )
+				{	return (*gh.get_grid(ilevel))(i,j,k) * vfac;	} )) > 0 )
+      {
+	store( ofs_temp, id_dm_vel, coord, nwritten, &temp_data[0], n );
+	nwritten += n;
       }
     
     if( nwritten != npart )
       throw std::runtime_error("Internal consistency error while writing temporary file for velocities");
       
-    ofs_temp.write( (char *)&blksize, sizeof(int) );
+    if( bdirect_ )
+      end_direct( id_dm_vel, coord );
+    
+    if( !bdirect_ )
+      ofs_temp.write( (char *)&blksize, sizeof(int) );
     
     if( ofs_temp.bad() )
       throw std::runtime_error("I/O error while writing temporary file for velocities");
@@ -1260,8 +1660,7 @@ public:
     
     //... collect velocities and convert to absolute coordinates with correct
     //... units
-    std::vector<T_store> temp_data;
-    temp_data.reserve( block_buf_size_ );
+    std::vector<T_store> temp_data( block_buf_size_ );
     
     float isqrta = 1.0f/sqrt(header_.time);
     float vfac = isqrta*header_.BoxSize;
@@ -1275,41 +1674,36 @@ public:
     
     char temp_fname[256];
     sprintf( temp_fname, "___ic_temp_%05d.bin", 100*id_gas_vel+coord );
-    std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
+    std::ofstream ofs_temp;
+    if( bdirect_ )
+      open_direct_files();
+    else
+      ofs_temp.open( temp_fname, std::ios::binary|std::ios::trunc );
     
     size_t blksize = sizeof(T_store)*npart;
-    ofs_temp.write( (char *)&blksize, sizeof(size_t) );
+    if( !bdirect_ )
+      ofs_temp.write( (char *)&blksize, sizeof(size_t) );
     
     
-    for( int ilevel=levelmax_; ilevel>=(int)levelmin_; --ilevel )
-      for( unsigned i=0; i<gh.get_grid(ilevel)->size(0); ++i )
-	for( unsigned j=0; j<gh.get_grid(ilevel)->size(1); ++j )
-	  for( unsigned k=0; k<gh.get_grid(ilevel)->size(2); ++k )
-	    if( gh.is_in_mask(ilevel,i,j,k) && !gh.is_refined(ilevel,i,j,k) )
-	      {
-		if( temp_data.size() < block_buf_size_ )
-		  temp_data.push_back( (*gh.get_grid(ilevel))(i,j,k) * vfac );
-		else 
-		  {
-		    ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*block_buf_size_ );
-		    nwritten += block_buf_size_;
-		    temp_data.clear();
-		    temp_data.push_back( (*gh.get_grid(ilevel))(i,j,k) * vfac );
-		  }
-		
-	      }
+    particle_batches particles( gh, levelmin_, levelmax_ );
+    size_t n;
+    while( (n = particles.next( &temp_data[0], block_buf_size_, [&]( int ilevel, int i, int j, int k )
+				{	return (*gh.get_grid(ilevel))(i,j,k) * vfac;	} )) > 0 )
+      {
+	store( ofs_temp, id_gas_vel, coord, nwritten, &temp_data[0], n );
+	nwritten += n;
+      }
     
     
-    if( temp_data.size() > 0 )
-      {	
-	ofs_temp.write( (char*)&temp_data[0], temp_data.size()*sizeof(T_store) );
-	nwritten += temp_data.size();
-      }
     
     if( nwritten != npart )
       throw std::runtime_error("Internal consistency error while writing temporary file for gas velocities");
     
-    ofs_temp.write( (char *)&blksize, sizeof(int) );
+    if( bdirect_ )
+      end_direct( id_gas_vel, coord );
+    
+    if( !bdirect_ )
+      ofs_temp.write( (char *)&blksize, sizeof(int) );
     
     if( ofs_temp.bad() )
       throw std::runtime_error("I/O error while writing temporary file for gas velocities");
@@ -1343,62 +1737,53 @@ public:
     //...
     //... collect displacements and convert to absolute coordinates with correct
     //... units
-    std::vector<T_store> temp_data;
-    temp_data.reserve( block_buf_size_ );
+    std::vector<T_store> temp_data( block_buf_size_ );
     
     char temp_fname[256];
     sprintf( temp_fname, "___ic_temp_%05d.bin", 100*id_gas_pos+coord );
-    std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
+    std::ofstream ofs_temp;
+    if( bdirect_ )
+      open_direct_files();
+    else
+      ofs_temp.open( temp_fname, std::ios::binary|std::ios::trunc );
     
     size_t blksize = sizeof(T_store)*npart;
-    ofs_temp.write( (char *)&blksize, sizeof(size_t) );
+    if( !bdirect_ )
+      ofs_temp.write( (char *)&blksize, sizeof(size_t) );
 		
     double xfac = header_.BoxSize;
     
     double h = 1.0/(1ul<<gh.levelmax());
     
-    for( int ilevel=gh.levelmax(); ilevel>=(int)gh.levelmin(); --ilevel )
-      {	
-   	for( unsigned i=0; i<gh.get_grid(ilevel)->size(0); ++i )
-	  for( unsigned j=0; j<gh.get_grid(ilevel)->size(1); ++j )
-	    for( unsigned k=0; k<gh.get_grid(ilevel)->size(2); ++k )
-	      //if( ! gh.is_refined(ilevel,i,j,k) )
-	      if( gh.is_in_mask(ilevel,i,j,k) && !gh.is_refined(ilevel,i,j,k) )
-		{
-		  double xx[3];
-		  gh.cell_pos(ilevel, i, j, k, xx);
-		  if( shift != NULL )
-		    xx[coord] += shift[coord];
-		  
-		  //... shift particle positions (this has to be done as the same shift
-		  //... is used when computing the convolution kernel for SPH baryons)
-		  xx[coord] += 0.5*h;
-                  
-		  xx[coord] = (xx[coord]+(*gh.get_grid(ilevel))(i,j,k))*xfac;
-		  
-		  if( temp_data.size() < block_buf_size_ )
-		    temp_data.push_back( xx[coord] );
-		  else
-		    {
-		      ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*block_buf_size_ );
-		      nwritten += block_buf_size_;
-		      temp_data.clear();
-		      temp_data.push_back( xx[coord] );
-		    }
-		}
-      }
-    
-    if( temp_data.size() > 0 )
-      {	
-	ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*temp_data.size() );
-	nwritten += temp_data.size();
+    particle_batches particles( gh, gh.levelmin(), gh.levelmax() );
+    size_t n;
+    while( (n = particles.next( &temp_data[0], block_buf_size_, [&]( int ilevel, int i, int j, int k ) -> double
+				{
+				  double xx[3];
+				  gh.cell_pos(ilevel, i, j, k, xx);
+				  if( shift != NULL )
+				    xx[coord] += shift[coord];
+				  
+				  //... shift particle positions (this has to be done as the same shift
+				  //... is used when computing the convolution kernel for SPH baryons)
+				  xx[coord] += 0.5*h;
+				  
+				  return (xx[coord]+(*gh.get_grid(ilevel))(i,j,k))*xfac;
+				} )) > 0 )
+      {
+	store( ofs_temp, id_gas_pos, coord, nwritten, &temp_data[0], n );
+	nwritten += n;
       }
     
     if( nwritten != npart )
       throw std::runtime_error("Internal consistency error while writing temporary file for gas positions");
     
     //... dump to temporary file
-    ofs_temp.write( (char *)&blksize, sizeof(size_t) );
+    if( bdirect_ )
+      end_direct( id_gas_pos, coord );
+    
+    if( !bdirect_ )
+      ofs_temp.write( (char *)&blksize, sizeof(size_t) );
     
     if( ofs_temp.bad() )
       throw std::runtime_error("I/O error while writing temporary file for gas positions");
@@ -1416,7 +1801,18 @@ public:
   
   void finalize( void )
   {	
-    this->assemble_gadget_file();
+    if( bdirect_ )
+      {
+	if( fds_.empty() )
+	  {
+	    LOGERR("Gadget2 : no particle data was written.");
+	    throw std::runtime_error("Internal consistency error in gadget2 output plug-in");
+	  }
+	close_direct_files();
+	LOGINFO("Gadget2 : wrote particle data directly to %d file(s)", nfiles_);
+      }
+    else
+      this->assemble_gadget_file();
   }
 };
 
@@ -0,0 +1,710 @@
+/*
+
+ output_gadget_hdf5.cc - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#ifdef HAVE_HDF5
+
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "log.hh"
+#include "output.hh"
+#include "mesh.hh"
+#include "HDF_IO.hh"
+
+/*!
+ * @class gadget_hdf5_output_plugin
+ * @brief Gadget-2/3/4 and SWIFT initial conditions in HDF5 format
+ *
+ * The particles are split into types and files exactly as by the gadget2
+ * plug-in: gas (type 0) and dark matter (type 1) on the finest level, the
+ * coarse particles of all other levels in type gadget_coarsetype, each type
+ * ordered from the finest level to the coarsest and files filled with the types
+ * in turn. Every component is assembled in batches on all threads and written
+ * straight into the chunked datasets PartTypeN/Coordinates, Velocities, Masses
+ * and ParticleIDs (and InternalEnergy for gas) through hyperslab selections,
+ * so no temporary files are needed for them. With baryons, the coarse particles
+ * carry the mass weighted mean of the dark matter and gas displacements: the
+ * weighted coarse part of whichever component comes first is kept in a temporary
+ * file and added to the other one before the rows are written, as in the gadget2
+ * plug-in, so every row is written once.
+ */
+template< typename T_store=float >
+class gadget_hdf5_output_plugin : public output_plugin
+{
+protected:
+
+  unsigned nfiles_, bndparticletype_;
+  bool blongids_, shift_halfcell_, do_baryons_, bmorethan2bnd_, bhave_particlenumbers_;
+  double omega0_, omegab_, omegal_, hubble_, boxsize_, time_, redshift_, YHe_, gamma_;
+  double unit_length_chosen_, unit_mass_chosen_, unit_vel_chosen_;
+  int do_adm_;        //!< 1: type 0 is ADM, 2: type 0 is ADM and baryons, as in the gadget2 plug-in
+  double omega_adm_;
+  size_t block_buf_size_;
+  hsize_t chunk_rows_;
+
+  size_t np_per_type_[6];
+  double mass_[6];
+  std::vector< std::vector<unsigned> > np_per_file_;
+
+  //! open files, their particle type groups and the datasets created so far, all kept open until finalize()
+  std::vector<hid_t> files_;
+  std::vector< std::map<int,hid_t> > groups_;
+  std::map< std::string, std::vector<hid_t> > datasets_;
+
+  //! number of components that went into the coarse Coordinates (0) and Velocities (1) so far
+  int ncoarse_written_[2][3];
+
+  //! weighted coarse part of the first of the two components, until the second one arrives
+  FILE* coarse_tmp_[2][3];
+
+  std::string coarse_tmp_name( int icomb, int coord ) const
+  {
+    char fname[64];
+    sprintf( fname, "___ic_temp_hdf5_%d%d.bin", icomb, coord );
+    return fname;
+  }
+
+  void close_coarse_tmp( int icomb, int coord )
+  {
+    if( coarse_tmp_[icomb][coord] == NULL )
+      return;
+    fclose( coarse_tmp_[icomb][coord] );
+    coarse_tmp_[icomb][coord] = NULL;
+    remove( coarse_tmp_name( icomb, coord ).c_str() );
+  }
+
+  void coarse_tmp_io( bool bwrite, int icomb, int coord, T_store* data, size_t n )
+  {
+    FILE* fp = coarse_tmp_[icomb][coord];
+    if( fp == NULL || (bwrite? fwrite( data, sizeof(T_store), n, fp ) : fread( data, sizeof(T_store), n, fp )) != n )
+      {
+	LOGERR("Gadget-HDF5 : I/O error in temporary file '%s'", coarse_tmp_name( icomb, coord ).c_str());
+	throw std::runtime_error("I/O error in temporary file of gadget_hdf5 output plug-in");
+      }
+  }
+
+  std::string file_name( unsigned ifile ) const
+  {
+    if( nfiles_ == 1 )
+      return fname_;
+
+    char ext[32];
+    sprintf( ext, ".%d", ifile );
+
+    std::string ffname = fname_;
+    size_t p = ffname.rfind(".hdf5");
+    if( p != std::string::npos && p == ffname.length()-5 )
+      ffname.insert( p, ext );
+    else
+      ffname += ext;
+    return ffname;
+  }
+
+  //! weights of dark matter and baryons in the velocities and positions of coarse particles
+  void coarse_weights( double& facc, double& facb ) const
+  {
+    facb = omegab_/omega0_;
+    facc = (omega0_-omegab_-omega_adm_)/omega0_;
+    if( do_adm_ == 1 )
+      facb = omega_adm_/omega0_;
+    else if( do_adm_ == 2 )
+      facb = (omega_adm_+omegab_)/omega0_;
+  }
+
+  //! density parameter of the type 0 particles
+  double omega_gas( void ) const
+  {
+    if( do_adm_ == 1 )
+      return omega_adm_;
+    if( do_adm_ == 2 )
+      return omega_adm_+omegab_;
+    return omegab_;
+  }
+
+  //! initial internal energy of the gas particles
+  double gas_internal_energy( void ) const
+  {
+    const double npol  = (fabs(1.0-gamma_)>1e-7)? 1.0/(gamma_-1.) : 1.0;
+    const double unitv = 1e5;
+    const double h2    = hubble_*hubble_;
+    const double adec  = 1.0/(160.*pow(omegab_*h2/0.022,2.0/5.0));
+    const double Tcmb0 = 2.726;
+    const double Tini  = time_<adec? Tcmb0/time_ : Tcmb0/time_/time_*adec;
+    const double mu    = (Tini>1.e4) ? 4.0/(8.-5.*YHe_) : 4.0/(1.+3.*(1.-YHe_));
+
+    LOGINFO("Gadget-HDF5 : set initial gas temperature to %.2f K/mu",Tini/mu);
+
+    return 1.3806e-16/1.6726e-24 * Tini * npol / mu / unitv / unitv;
+  }
+
+  //! count the particles of each type, set the mass table and split them into files as the gadget2 plug-in
+  void determine_particle_numbers( const grid_hierarchy& gh )
+  {
+    if( bhave_particlenumbers_ )
+      return;
+    bhave_particlenumbers_ = true;
+
+    double rhoc = 27.7519737; // in h^2 1e10 M_sol / Mpc^3
+    rhoc /= unit_mass_chosen_ / (unit_length_chosen_*unit_length_chosen_*unit_length_chosen_);
+
+    for( int i=0; i<6; ++i )
+      {
+	np_per_type_[i] = 0;
+	mass_[i] = 0.0;
+      }
+
+    np_per_type_[1] = gh.count_leaf_cells( gh.levelmax(), gh.levelmax() );
+    if( gh.levelmax() > gh.levelmin() )
+      np_per_type_[bndparticletype_] = gh.count_leaf_cells( gh.levelmin(), gh.levelmax()-1 );
+
+    if( do_baryons_ )
+      {
+	np_per_type_[0] = np_per_type_[1];
+	mass_[0] = omega_gas() * rhoc * pow(boxsize_,3.)/pow(2,3*levelmax_);
+	mass_[1] = (omega0_-omegab_-omega_adm_) * rhoc * pow(boxsize_,3.)/pow(2,3*levelmax_);
+	LOGINFO("Gadget-HDF5 : type 0 particles with do_adm = %d carry Omega = %g", do_adm_, omega_gas());
+      }
+    else
+      mass_[1] = omega0_ * rhoc * pow(boxsize_,3.)/pow(2,3*levelmax_);
+
+    // with more than one coarse level the coarse particles have individual masses
+    bmorethan2bnd_ = gh.levelmax() > gh.levelmin()+1;
+    if( gh.levelmax() > gh.levelmin() && !bmorethan2bnd_ )
+      mass_[bndparticletype_] = omega0_ * rhoc * pow(boxsize_,3.)/pow(2,3*levelmin_);
+
+    //... each file takes its share of the particles, filled with the types in turn
+    size_t ntotal = 0, n2dist[6];
+    for( int i=0; i<6; ++i )
+      {
+	ntotal += np_per_type_[i];
+	n2dist[i] = np_per_type_[i];
+      }
+
+    size_t nnominal = (size_t)((double)ntotal/(double)nfiles_);
+    size_t nlast = ntotal - nnominal * (nfiles_-1);
+
+    np_per_file_.assign( nfiles_, std::vector<unsigned>( 6, 0 ) );
+    for( unsigned ifile=0; ifile<nfiles_; ++ifile )
+      {
+	size_t nthisfile = 0, nmax = (ifile==nfiles_-1)? nlast : nnominal;
+
+	for( int itype=0; itype<6 && nthisfile<nmax; ++itype )
+	  {
+	    np_per_file_[ifile][itype] = std::min( n2dist[itype], nmax-nthisfile );
+	    n2dist[itype] -= np_per_file_[ifile][itype];
+	    nthisfile += np_per_file_[ifile][itype];
+	  }
+
+	for( int itype=0; itype<6; ++itype )
+	  if( np_per_file_[ifile][itype] > 0 )
+	    {
+	      char grpname[32];
+	      sprintf( grpname, "PartType%d", itype );
+	      hid_t grp = H5Gcreate( files_[ifile], grpname, 0 );
+	      if( grp < 0 )
+		{
+		  LOGERR("Gadget-HDF5 : could not create group %s in file \'%s\'", grpname, file_name(ifile).c_str());
+		  throw std::runtime_error("Could not create particle group in gadget_hdf5 output plug-in");
+		}
+	      groups_[ifile][itype] = grp;
+	    }
+      }
+  }
+
+  //! dataset field of type itype in file ifile, created chunked with ncol columns on first use
+  template< typename T >
+  hid_t dataset( const std::string& field, int itype, unsigned ifile, int ncol )
+  {
+    char key[64];
+    sprintf( key, "PartType%d/%s", itype, field.c_str() );
+
+    std::vector<hid_t>& ids = datasets_[key];
+    if( ids.empty() )
+      ids.assign( nfiles_, -1 );
+
+    if( ids[ifile] < 0 )
+      {
+	hsize_t nrows = np_per_file_[ifile][itype];
+	hsize_t dims[2] = { nrows, (hsize_t)ncol };
+	hid_t space = H5Screate_simple( ncol>1? 2 : 1, dims, NULL );
+
+	//... chunks span one column, as the components of vectors are written one at a time
+	hid_t prop = H5Pcreate( H5P_DATASET_CREATE );
+	hsize_t chunk[2] = { std::min( nrows, chunk_rows_ ), 1 };
+	H5Pset_chunk( prop, ncol>1? 2 : 1, chunk );
+
+	ids[ifile] = H5Dcreate( groups_[ifile][itype], field.c_str(), GetDataType<T>(), space, prop );
+
+	H5Pclose( prop );
+	H5Sclose( space );
+
+	if( ids[ifile] < 0 )
+	  {
+	    LOGERR("Gadget-HDF5 : could not create dataset %s in file \'%s\'", key, file_name(ifile).c_str());
+	    throw std::runtime_error("Could not create dataset in gadget_hdf5 output plug-in");
+	  }
+      }
+
+    return ids[ifile];
+  }
+
+  //! write n values of column coord to the particles p0.. of type itype
+  template< typename T >
+  void write_rows( const std::string& field, int itype, int ncol, int coord, size_t p0, const T* data, size_t n )
+  {
+    size_t first = 0;
+
+    for( unsigned ifile=0; ifile<nfiles_ && n>0; ++ifile )
+      {
+	size_t nfile = np_per_file_[ifile][itype];
+	if( p0 >= first+nfile )
+	  {
+	    first += nfile;
+	    continue;
+	  }
+
+	size_t m = std::min( n, first+nfile-p0 );
+	hid_t dset = dataset<T>( field, itype, ifile, ncol );
+
+	hsize_t offset[2] = { p0-first, (hsize_t)coord }, count[2] = { m, 1 };
+	hid_t memspace = H5Screate_simple( 1, count, NULL );
+	hid_t filespace = H5Dget_space( dset );
+	H5Sselect_hyperslab( filespace, H5S_SELECT_SET, offset, NULL, count, NULL );
+
+	herr_t status = H5Dwrite( dset, GetDataType<T>(), memspace, filespace, H5P_DEFAULT, data );
+
+	H5Sclose( filespace );
+	H5Sclose( memspace );
+
+	if( status < 0 )
+	  {
+	    LOGERR("Gadget-HDF5 : I/O error in dataset PartType%d/%s of file \'%s\'", itype, field.c_str(), file_name(ifile).c_str());
+	    throw std::runtime_error("I/O error while writing dataset in gadget_hdf5 output plug-in");
+	  }
+
+	data += m;
+	p0 += m;
+	n -= m;
+	first += nfile;
+      }
+
+    if( n > 0 )
+      throw std::runtime_error("Internal consistency error in gadget_hdf5 output plug-in");
+  }
+
+  //! write f(ilevel,i,j,k) of the DM (or gas) particles to column coord of field
+  /*! the finest level goes to type 1 (or 0), the coarser levels to the coarse type. The coarse
+   *  values are skipped for gas, except for the components icomb=0 (Coordinates) and 1 (Velocities)
+   *  with baryons, which are weighted and summed with those of the other component: the first
+   *  of the two goes to a temporary file, the second adds it and writes the sums. Positions
+   *  are wrapped into the box once they are complete.
+   */
+  template< typename F >
+  void write_particles( const std::string& field, int ncol, int coord, const grid_hierarchy& gh, bool bgas, int icomb, F f )
+  {
+    determine_particle_numbers( gh );
+    if( bgas && np_per_type_[0] == 0 )
+      return;
+
+    const size_t npfine = np_per_type_[1];
+    const bool bcombine = icomb >= 0 && do_baryons_ && np_per_type_[bndparticletype_] > 0;
+    const bool bfirst = bcombine && ncoarse_written_[icomb][coord] == 0;
+
+    if( bfirst && (coarse_tmp_[icomb][coord] = fopen( coarse_tmp_name( icomb, coord ).c_str(), "w+b" )) == NULL )
+      {
+	LOGERR("Gadget-HDF5 : could not open temporary file '%s'", coarse_tmp_name( icomb, coord ).c_str());
+	throw std::runtime_error("Could not open temporary file in gadget_hdf5 output plug-in");
+      }
+
+    double facc = 1.0, facb = 0.0;
+    if( bcombine )
+      coarse_weights( facc, facb );
+    const T_store fac = bgas? facb : facc;
+
+    particle_batches particles( gh, (bgas && !bcombine)? gh.levelmax() : gh.levelmin(), gh.levelmax() );
+    std::vector<T_store> buf( block_buf_size_ ), held( bcombine && !bfirst? block_buf_size_ : 0 );
+    size_t n;
+
+    while( (n = particles.next( &buf[0], block_buf_size_, f )) > 0 )
+      {
+	size_t p0 = particles.position()-n;
+	size_t nf = (p0 < npfine)? std::min( n, npfine-p0 ) : 0;
+	size_t nwrap = (bcombine? nf : n);
+
+	if( icomb == 0 )
+	  {
+	    #pragma omp parallel for
+	    for( long i=0; i<(long)nwrap; ++i )
+	      buf[i] = fmod( buf[i]+boxsize_, boxsize_ );
+	  }
+
+	if( nf > 0 )
+	  write_rows( field, bgas? 0 : 1, ncol, coord, p0, &buf[0], nf );
+
+	if( n > nf && (!bgas || bcombine) )
+	  {
+	    if( bcombine )
+	      {
+		#pragma omp parallel for
+		for( long i=nf; i<(long)n; ++i )
+		  buf[i] *= fac;
+		
+		if( bfirst )
+		  {
+		    coarse_tmp_io( true, icomb, coord, &buf[nf], n-nf );
+		    continue;
+		  }
+		
+		coarse_tmp_io( false, icomb, coord, &held[0], n-nf );
+		#pragma omp parallel for
+		for( long i=nf; i<(long)n; ++i )
+		  {
+		    buf[i] += held[i-nf];
+		    if( icomb == 0 )
+		      buf[i] = fmod( buf[i]+boxsize_, boxsize_ );
+		  }
+	      }
+	    write_rows( field, bndparticletype_, ncol, coord, p0+nf-npfine, &buf[nf], n-nf );
+	  }
+      }
+
+    if( bcombine )
+      {
+	if( bfirst )
+	  rewind( coarse_tmp_[icomb][coord] );
+	else
+	  close_coarse_tmp( icomb, coord );
+	++ncoarse_written_[icomb][coord];
+      }
+  }
+
+  //! write the coarse part of a component that never got its counterpart as it is
+  void flush_coarse_tmp( int icomb, int coord )
+  {
+    const size_t nc = np_per_type_[bndparticletype_];
+    std::vector<T_store> buf( std::min( block_buf_size_, nc ) );
+
+    for( size_t p0=0; p0<nc; p0+=block_buf_size_ )
+      {
+	size_t n = std::min( block_buf_size_, nc-p0 );
+	coarse_tmp_io( false, icomb, coord, &buf[0], n );
+	if( icomb == 0 )
+	  for( size_t i=0; i<n; ++i )
+	    buf[i] = fmod( buf[i]+boxsize_, boxsize_ );
+	write_rows( icomb==0? "Coordinates" : "Velocities", bndparticletype_, 3, coord, p0, &buf[0], n );
+      }
+    close_coarse_tmp( icomb, coord );
+  }
+
+  //! write g(p) of the particles p of type itype computed in batches
+  template< typename T, typename G >
+  void write_generated( const std::string& field, int itype, G g )
+  {
+    std::vector<T> buf( block_buf_size_ );
+
+    for( size_t p0=0; p0<np_per_type_[itype]; p0+=block_buf_size_ )
+      {
+	size_t n = std::min( block_buf_size_, np_per_type_[itype]-p0 );
+
+	#pragma omp parallel for
+	for( long i=0; i<(long)n; ++i )
+	  buf[i] = g( p0+i );
+
+	write_rows( field, itype, 1, 0, p0, &buf[0], n );
+      }
+  }
+
+  double coordinate( const grid_hierarchy& gh, int coord, int ilevel, int i, int j, int k, double shift ) const
+  {
+    double xx[3];
+    gh.cell_pos(ilevel, i, j, k, xx);
+    if( shift_halfcell_ )
+      xx[coord] -= 1.0/(1<<(levelmin_+1));
+
+    return (xx[coord]+shift+(*gh.get_grid(ilevel))(i,j,k))*boxsize_;
+  }
+
+  void close_files( void )
+  {
+    for( auto& d : datasets_ )
+      for( size_t i=0; i<d.second.size(); ++i )
+	if( d.second[i] >= 0 )
+	  H5Dclose( d.second[i] );
+    datasets_.clear();
+
+    for( size_t i=0; i<groups_.size(); ++i )
+      for( auto& g : groups_[i] )
+	H5Gclose( g.second );
+    groups_.clear();
+
+    for( size_t i=0; i<files_.size(); ++i )
+      H5Fclose( files_[i] );
+    files_.clear();
+  }
+
+public:
+
+  gadget_hdf5_output_plugin( config_file& cf )
+  : output_plugin( cf ), bmorethan2bnd_( false ), bhave_particlenumbers_( false )
+  {
+    //... ensure that everyone knows we want to do SPH
+    cf.insertValue("setup","do_SPH","yes");
+
+    nfiles_ = std::max( 1u, cf.getValueSafe<unsigned>("output","gadget_num_files",1) );
+    blongids_ = cf.getValueSafe<bool>("output","gadget_longids",false);
+    shift_halfcell_ = cf.getValueSafe<bool>("output","gadget_cell_centered",false);
+    block_buf_size_ = std::max( 1u, cf.getValueSafe<unsigned>("output","gadget_blksize",1048576) );
+    chunk_rows_ = std::max( 1u, cf.getValueSafe<unsigned>("output","gadget_chunk_size",1<<18) );
+
+    do_baryons_ = cf.getValueSafe<bool>("setup","baryons",false);
+    omegab_ = cf.getValueSafe<double>("cosmology","Omega_b",0.045);
+    do_adm_ = cf.getValueSafe<int>("cosmology","do_adm",0);
+    omega_adm_ = cf.getValueSafe<double>("cosmology","Omega_adm",0.0);
+    omega0_ = cf.getValue<double>("cosmology","Omega_m");
+    omegal_ = cf.getValue<double>("cosmology","Omega_L");
+    hubble_ = cf.getValue<double>("cosmology","H0")/100.0;
+    YHe_ = cf.getValueSafe<double>("cosmology","YHe",0.248);
+    gamma_ = cf.getValueSafe<double>("cosmology","gamma",5.0/3.0);
+
+    redshift_ = cf.getValue<double>("setup","zstart");
+    time_ = 1.0/(1.0+redshift_);
+
+    //... units as for the gadget2 plug-in
+    std::map<std::string,double> units_length, units_mass, units_vel;
+    units_mass["1e10Msol"] = 1.0;  units_mass["Msol"] = 1.0e-10;  units_mass["Mearth"] = 3.002e-16;
+    units_length["Mpc"] = 1.0;     units_length["kpc"] = 1.0e-3;  units_length["pc"] = 1.0e-6;
+    units_vel["km/s"] = 1.0;       units_vel["m/s"] = 1.0e-3;     units_vel["cm/s"] = 1.0e-5;
+
+    std::string lunitstr = cf.getValueSafe<std::string>("output","gadget_lunit","Mpc");
+    std::string munitstr = cf.getValueSafe<std::string>("output","gadget_munit","1e10Msol");
+    std::string vunitstr = cf.getValueSafe<std::string>("output","gadget_vunit","km/s");
+
+    if( !units_length.count( lunitstr ) || !units_mass.count( munitstr ) || !units_vel.count( vunitstr ) )
+      {
+	LOGERR("Gadget-HDF5 : unknown unit in gadget_lunit, gadget_munit or gadget_vunit");
+	throw std::runtime_error("Unknown unit specified for gadget_hdf5 output plug-in");
+      }
+    unit_length_chosen_ = units_length[lunitstr];
+    unit_mass_chosen_ = units_mass[munitstr];
+    unit_vel_chosen_ = units_vel[vunitstr];
+
+    boxsize_ = cf.getValue<double>("setup","boxlength") / unit_length_chosen_;
+
+    bndparticletype_ = cf.getValueSafe<unsigned>("output","gadget_coarsetype",5);
+    if( bndparticletype_ < 2 || bndparticletype_ > 5 )
+      {
+	LOGERR("Coarse particles cannot be of Gadget particle type %d in output plugin.", bndparticletype_);
+	throw std::runtime_error("Specified illegal Gadget particle type for coarse particles");
+      }
+    if( cf.getValueSafe<bool>("output","gadget_spreadcoarse",false) )
+      LOGWARN("Gadget-HDF5 : option \'gadget_spreadcoarse\' is not supported, all coarse particles are of type %d.", bndparticletype_);
+
+    for( int i=0; i<2; ++i )
+      for( int j=0; j<3; ++j )
+	{
+	  ncoarse_written_[i][j] = 0;
+	  coarse_tmp_[i][j] = NULL;
+	}
+
+    //... create the files, they stay open until finalize()
+    for( unsigned ifile=0; ifile<nfiles_; ++ifile )
+      {
+	std::string ffname = file_name( ifile );
+	hid_t fid = H5Fcreate( ffname.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT );
+	if( fid < 0 )
+	  {
+	    close_files();
+	    LOGERR("gadget_hdf5 output plug-in could not open output file \'%s\' for writing!",ffname.c_str());
+	    throw std::runtime_error(std::string("gadget_hdf5 output plug-in could not open output file \'")+ffname+"\' for writing!\n");
+	  }
+	files_.push_back( fid );
+	groups_.push_back( std::map<int,hid_t>() );
+      }
+  }
+
+  ~gadget_hdf5_output_plugin()
+  {
+    for( int i=0; i<2; ++i )
+      for( int j=0; j<3; ++j )
+	close_coarse_tmp( i, j );
+    close_files();
+  }
+
+  void write_dm_mass( const grid_hierarchy& gh )
+  {
+    determine_particle_numbers( gh );
+
+    double rhoc = 27.7519737; // in h^2 1e10 M_sol / Mpc^3
+    rhoc /= unit_mass_chosen_ / (unit_length_chosen_*unit_length_chosen_*unit_length_chosen_);
+
+    // baryon particles live only on finest grid, the coarse particles are total matter particles
+    std::vector<double> pmass( gh.levelmax()+1, 0.0 );
+    for( int ilevel=gh.levelmax(); ilevel>=(int)gh.levelmin(); --ilevel )
+      pmass[ilevel] = (ilevel==(int)gh.levelmax())? mass_[1] : omega0_ * rhoc * pow(boxsize_,3.)/pow(2,3*ilevel);
+
+    write_particles( "Masses", 1, 0, gh, false, -1, [&]( int ilevel, int, int, int )
+		     {	return pmass[ilevel];	} );
+  }
+
+  void write_dm_position( int coord, const grid_hierarchy& gh )
+  {
+    write_particles( "Coordinates", 3, coord, gh, false, 0, [&]( int ilevel, int i, int j, int k )
+		     {	return coordinate( gh, coord, ilevel, i, j, k, 0.0 );	} );
+  }
+
+  void write_dm_velocity( int coord, const grid_hierarchy& gh )
+  {
+    double vfac = boxsize_/sqrt(time_) * unit_length_chosen_ / unit_vel_chosen_;
+
+    write_particles( "Velocities", 3, coord, gh, false, 1, [&]( int ilevel, int i, int j, int k )
+		     {	return (*gh.get_grid(ilevel))(i,j,k) * vfac;	} );
+  }
+
+  void write_dm_density( const grid_hierarchy& gh )
+  {
+    //... we don't care about DM density for Gadget
+  }
+
+  void write_dm_potential( const grid_hierarchy& gh )
+  {
+    //... we don't care about DM potential for Gadget
+  }
+
+  void write_gas_potential( const grid_hierarchy& gh )
+  {
+    //... we don't care about gas potential for Gadget
+  }
+
+  void write_gas_velocity( int coord, const grid_hierarchy& gh )
+  {
+    double vfac = boxsize_/sqrt(time_) * unit_length_chosen_ / unit_vel_chosen_;
+
+    write_particles( "Velocities", 3, coord, gh, true, 1, [&]( int ilevel, int i, int j, int k )
+		     {	return (*gh.get_grid(ilevel))(i,j,k) * vfac;	} );
+  }
+
+  void write_gas_position( int coord, const grid_hierarchy& gh )
+  {
+    //... shift particle positions (this has to be done as the same shift
+    //... is used when computing the convolution kernel for SPH baryons)
+    double h = 1.0/(1ul<<gh.levelmax());
+
+    write_particles( "Coordinates", 3, coord, gh, true, 0, [&]( int ilevel, int i, int j, int k )
+		     {	return coordinate( gh, coord, ilevel, i, j, k, 0.5*h );	} );
+  }
+
+  void write_gas_density( const grid_hierarchy& gh )
+  {
+    //... gas particles all have the same mass and initial internal energy
+    determine_particle_numbers( gh );
+    if( np_per_type_[0] == 0 )
+      return;
+
+    const double m = mass_[0], u = gas_internal_energy();
+    write_generated<T_store>( "Masses", 0, [m]( size_t ){ return m; } );
+    write_generated<T_store>( "InternalEnergy", 0, [u]( size_t ){ return u; } );
+  }
+
+  void finalize( void )
+  {
+    if( !bhave_particlenumbers_ )
+      {
+	LOGERR("Gadget-HDF5 : no particle data was written.");
+	throw std::runtime_error("Internal consistency error in gadget_hdf5 output plug-in");
+      }
+
+    //... coarse components without gas counterpart carry only the DM weight
+    for( int icomb=0; icomb<2; ++icomb )
+      for( int coord=0; coord<3; ++coord )
+	if( do_baryons_ && ncoarse_written_[icomb][coord] == 1 )
+	  {
+	    LOGWARN("Gadget-HDF5 : coarse %s component %d was not combined with gas.", icomb==0? "position" : "velocity", coord);
+	    flush_coarse_tmp( icomb, coord );
+	  }
+
+    //... contiguous IDs over all types
+    size_t nptot = 0, idstart[6];
+    for( int itype=0; itype<6; ++itype )
+      {
+	idstart[itype] = nptot;
+	nptot += np_per_type_[itype];
+      }
+
+    bool blongids = blongids_;
+    if( nptot >= 1ul<<32 && !blongids_ )
+      {
+	LOGWARN("Need long particle IDs, will write 64bit, make sure to enable in Gadget!");
+	blongids = true;
+      }
+
+    for( int itype=0; itype<6; ++itype )
+      {
+	if( np_per_type_[itype] == 0 )
+	  continue;
+
+	size_t id0 = idstart[itype];
+	if( blongids )
+	  write_generated<size_t>( "ParticleIDs", itype, [id0]( size_t p ){ return id0+p; } );
+	else
+	  write_generated<unsigned>( "ParticleIDs", itype, [id0]( size_t p ){ return (unsigned)(id0+p); } );
+      }
+
+    //... all particle data is written, the header is added through the file name
+    close_files();
+
+    std::vector<unsigned> nptot_lw( 6 ), nptot_hw( 6 );
+    std::vector<double> masstab( mass_, mass_+6 );
+    for( int i=0; i<6; ++i )
+      {
+	nptot_lw[i] = (unsigned)np_per_type_[i];
+	nptot_hw[i] = (unsigned)(np_per_type_[i]>>32);
+      }
+
+    for( unsigned ifile=0; ifile<nfiles_; ++ifile )
+      {
+	std::string ffname = file_name( ifile );
+
+	HDFCreateGroup( ffname, "Header" );
+	HDFWriteGroupAttribute( ffname, "Header", "NumPart_ThisFile", np_per_file_[ifile] );
+	HDFWriteGroupAttribute( ffname, "Header", "NumPart_Total", nptot_lw );
+	HDFWriteGroupAttribute( ffname, "Header", "NumPart_Total_HighWord", nptot_hw );
+	HDFWriteGroupAttribute( ffname, "Header", "MassTable", masstab );
+	HDFWriteGroupAttribute( ffname, "Header", "BoxSize", boxsize_ );
+	HDFWriteGroupAttribute( ffname, "Header", "NumFilesPerSnapshot", (int)nfiles_ );
+	HDFWriteGroupAttribute( ffname, "Header", "Time", time_ );
+	HDFWriteGroupAttribute( ffname, "Header", "Redshift", redshift_ );
+	HDFWriteGroupAttribute( ffname, "Header", "Omega0", omega0_ );
+	HDFWriteGroupAttribute( ffname, "Header", "OmegaLambda", omegal_ );
+	HDFWriteGroupAttribute( ffname, "Header", "OmegaBaryon", do_baryons_? omegab_ : 0.0 );
+	HDFWriteGroupAttribute( ffname, "Header", "HubbleParam", hubble_ );
+	HDFWriteGroupAttribute( ffname, "Header", "Flag_Sfr", 0 );
+	HDFWriteGroupAttribute( ffname, "Header", "Flag_Cooling", 0 );
+	HDFWriteGroupAttribute( ffname, "Header", "Flag_StellarAge", 0 );
+	HDFWriteGroupAttribute( ffname, "Header", "Flag_Metals", 0 );
+	HDFWriteGroupAttribute( ffname, "Header", "Flag_Feedback", 0 );
+	HDFWriteGroupAttribute( ffname, "Header", "Flag_Entropy_ICs", 0 );
+	HDFWriteGroupAttribute( ffname, "Header", "Flag_DoublePrecision", (int)(sizeof(T_store)==sizeof(double)) );
+      }
+
+    LOGINFO("Gadget-HDF5 : wrote %llu particles to %d file(s)", (unsigned long long)nptot, nfiles_);
+    if( blongids )
+      LOGINFO("Gadget-HDF5 : wrote 64bit IDs, enable LONGIDS / LONG_IDS.");
+  }
+};
+
+namespace{
+  output_plugin_creator_concrete< gadget_hdf5_output_plugin<float> > creator1("gadget_hdf5");
+#ifndef SINGLE_PRECISION
+  output_plugin_creator_concrete< gadget_hdf5_output_plugin<double> > creator2("gadget_hdf5_double");
+#endif
+}
+
+#endif // HAVE_HDF5
@@ -51,7 +51,6 @@ const int conn[][4] = { {1,0,2,4}, {3,1,2,4}, {3,5,1,4}, {3,6,5,4}, {3,2,6,4}, {
 std::map<MyIDType,size_t> idmap;
 typedef std::map<MyIDType,size_t>::iterator idmap_it;
 
-const size_t num_p_realloc_blocksize = 1000000;
 const size_t newnum_p_per_split = 19;
 
 int tetgrid_levelmax = 0;
@@ -205,28 +204,36 @@ inline real_t get_cic( const grid_hierarchy & gh, int ilevel, real_t u, real_t v
 }
 
 
-MyIDType compute_midpoint( const MyIDType *connect )
+//! index of the particle with Lagrange ID lid among the first n particles (sorted by ID), n if there is none
+inline size_t find_particle( MyIDType lid, size_t n )
 {
+    size_t lo = 0, hi = n;
     
-    MyIDType lid1, lid2, newlid, lcoord1[3], lcoord2[3];
-    
-    idmap_it it;
+    while( lo < hi )
+    {
+        size_t mid = (lo+hi)/2;
+        if( REMOVE_DECORATION_BITS(P[mid].Lagrange_ID) < lid )
+            lo = mid+1;
+        else
+            hi = mid;
+    }
     
-    if( (it=idmap.find( REMOVE_DECORATION_BITS(connect[0]) )) == idmap.end() )
-    { lid1 = 0; std::cerr << "1111 -- UWEHFFB YAUDASBOHASDJ" << std::endl; }
-    else
-        lid1 = connect[0];
+    if( lo < n && REMOVE_DECORATION_BITS(P[lo].Lagrange_ID) == lid )
+        return lo;
     
-    if( (it=idmap.find( connect[1] )) == idmap.end() )
-    { lid2 = 0; std::cerr << "1111 -- UWEHFFB YAUDASBOHASDJ" << std::endl; }
-    else
-        lid2 = connect[1];
+    return n;
+}
+
+//! Lagrange ID of the midpoint of the edge between two vertices (periodic)
+MyIDType compute_midpoint( const MyIDType *connect )
+{
+    MyIDType lcoord1[3], lcoord2[3];
     
     // take care of periodic boundary conditions
     for( int k=0; k<3; ++k )
     {
-        lcoord1[k] = get_lagrange_coord(REMOVE_DECORATION_BITS(lid1),k);
-        lcoord2[k] = get_lagrange_coord(REMOVE_DECORATION_BITS(lid2),k);
+        lcoord1[k] = get_lagrange_coord(REMOVE_DECORATION_BITS(connect[0]),k);
+        lcoord2[k] = get_lagrange_coord(REMOVE_DECORATION_BITS(connect[1]),k);
         
         
         long long dx = lcoord2[k]-lcoord1[k];
@@ -236,92 +243,287 @@ MyIDType compute_midpoint( const MyIDType *connect )
         lcoord1[k] = (lcoord1[k]+(dx>>1)+(1ll<<20)) % (1ll<<20);
     }
     
-    newlid = SET_REFINEMENT_COUNTER(get_lagrange_ID(lcoord1[0],lcoord1[1],lcoord1[2]),1);
-    return newlid;
+    return get_lagrange_ID(lcoord1[0],lcoord1[1],lcoord1[2]);
 }
 
+//! check if the cube spanned by particle ip (and its 7 upper neighbours) is split for level ilevel+1
+/*! returns 1 if it is, 0 if not, and -1 if one of its vertices is not among the first n
+ *  particles (then lost is set to the Lagrange ID of that vertex)
+ */
+int check_lagrange_cube( const grid_hierarchy& gh, int ilevel, const MyIDType *off, size_t ip, size_t n, MyIDType& lost )
+{
+    int rfac = 20-ilevel;
+    
+    if( P[ip].Level != ilevel || !P[ip].can_refine() || P[ip].Type == 2 )
+        return 0;
+    
+    for( int i=0; i<8; ++i )
+    {
+        MyIDType lid = REMOVE_DECORATION_BITS( P[ip].get_vertex(i) );
+        
+        if( find_particle( lid, n ) == n )
+        {
+            lost = lid;
+            return -1;
+        }
+        
+        MyIDType xc[3] = { get_lagrange_coord( lid, 0 ), get_lagrange_coord( lid, 1 ), get_lagrange_coord( lid, 2 ) };
+        
+        if( xc[0] < off[0] || xc[1] < off[1] || xc[2] < off[2] )
+            return 0;
+        
+        int ix, iy, iz;
+        
+        ix = (xc[0]-off[0])>>rfac;
+        iy = (xc[1]-off[1])>>rfac;
+        iz = (xc[2]-off[2])>>rfac;
+        
+        if( ix >= (int)gh.size(ilevel,0) || iy >= (int)gh.size(ilevel,1) || iz >= (int)gh.size(ilevel,2) )
+            return 0;
+        
+        if( gh.is_in_mask(ilevel,ix,iy,iz) && !gh.is_refined(ilevel,ix,iy,iz) )
+            return 0;
+    }
+    
+    return 1;
+}
 
+//! merge the sorted ranges [a,m) and [m,b) in place by rotations
+/*! each rotation leaves two independent merges, which are run as separate tasks while depth > 0 */
+void merge_in_place( particle *a, particle *m, particle *b, int depth )
+{
+    size_t n1 = m-a, n2 = b-m;
+    if( n1 == 0 || n2 == 0 )
+        return;
+    
+    if( n1 + n2 == 2 )
+    {
+        if( *m < *a )
+            std::swap( *a, *m );
+        return;
+    }
+    
+    particle *c1, *c2;
+    if( n1 > n2 )
+    {
+        c1 = a + n1/2;
+        c2 = std::lower_bound( m, b, *c1 );
+    }else{
+        c2 = m + n2/2;
+        c1 = std::upper_bound( a, m, *c2 );
+    }
+    
+    std::rotate( c1, m, c2 );
+    particle *nm = c1 + (c2-m);
+    
+    if( depth > 0 )
+    {
+        #pragma omp task
+        merge_in_place( a, c1, nm, depth-1 );
+        merge_in_place( nm, c2, b, depth-1 );
+        #pragma omp taskwait
+    }else{
+        merge_in_place( a, c1, nm, 0 );
+        merge_in_place( nm, c2, b, 0 );
+    }
+}
 
-void split_lagrange_cube( size_t ip )
+//! merge the sorted runs r0..r1-1 delimited by bounds, pairs of runs in parallel tasks
+void merge_runs( const std::vector<size_t>& bounds, size_t r0, size_t r1, int depth )
 {
-    int k, count;
+    if( r1 - r0 < 2 )
+        return;
     
-    size_t newi = num_p;//, new_tracer_id = num_p;
+    size_t rm = (r0 + r1)/2;
     
+    #pragma omp task
+    merge_runs( bounds, r0, rm, depth );
+    merge_runs( bounds, rm, r1, depth );
+    #pragma omp taskwait
+    
+    merge_in_place( P+bounds[r0], P+bounds[rm], P+bounds[r1], depth );
+}
+
+//! sort all particles by Lagrange ID, the first n0 are sorted already
+/*! the new particles are sorted in one chunk per thread and all runs are merged in place,
+ *  so no second copy of the particle array is needed
+ */
+void sort_particles( size_t n0 )
+{
+    int nt = omp_get_max_threads();
+    
+    // runs: the sorted particles, then one chunk of the new ones per thread
+    std::vector<size_t> bounds( 1, 0 );
+    bounds.push_back( n0 );
+    for( int it=0; it<nt; ++it )
+        bounds.push_back( n0 + (num_p-n0)*(it+1)/nt );
+    
+    #pragma omp parallel for
+    for( int it=0; it<nt; ++it )
+        std::sort( P+bounds[it+1], P+bounds[it+2] );
+    
+    int depth = 1;
+    while( (1<<depth) < 4*nt )
+        ++depth;
+    
+    #pragma omp parallel
+    #pragma omp single
+    merge_runs( bounds, 0, bounds.size()-1, depth );
+}
+
+//! split all cubes of level ilevel that lie in the refined region into 8
+/*! the cubes are checked and split in parallel, each thread taking a contiguous range of
+ *  particles. Every new vertex is emitted only once, by the refined cube with the lowest
+ *  index among those sharing it, with its refinement counter (the number of refined cubes
+ *  sharing it) and type (1 if the cube it belongs to is refined, 2 otherwise) known from
+ *  its neighbourhood, so that no duplicates have to be removed afterwards.
+ */
+void refine_lagrange_level( const grid_hierarchy& gh, int ilevel )
+{
     const int massc_edge[][2] = {{0,1},{0,2},{1,2},{0,4},{1,4},{2,4},{3,4}};
     const int nmassc = 7; // +1 for the already existing 0
-                          //                              8    9    10     11    12    13    14    15    16   17     18   19
     const int massl_edge[][2] = {{1,3},{1,5},{2,3},{2,6},{3,5},{3,6},{3,7},{4,5},{4,6},{5,6},{5,7},{6,7}};
-    const int nmassl = 12; // the massless dangling vertices
+    const int req_h[] = {4,2,1}; // required: 4x ref for edge, 2x for face, 1x for volume
     
-    /*const int new_conn[][8] =
-    {
-        { 0, 8, 9,10,11,12,13,14},
-        { 8, 1,10,15,12,16,14,19},
-        { 9,10, 2,17,13,14,18,20},
-        {10,15,17, 3,14,19,20,21},
-        {11,12,13,14, 4,22,23,24},
-        {12,16,14,19,22, 5,24,25},
-        {13,14,18,20,23,24, 6,26},
-        {14,19,20,21,24,25,26, 7},
-    };*/
+    const size_t nbefore = num_p;
+    const int rfac = 20-ilevel;
+    const MyIDType full = 1ll<<rfac, half = 1ll<<(rfac-1), nfull = 1ll<<20;
     
-    //////////////////////
-    /** spawn new particles **/
+    MyIDType off[3];
     
-    //float newmass = P[ip].Mass * 0.125;
-    //float zeromass = newmass; // this should eventually be set to zero
-    //int masslesstype = 2;
-    int this_level = P[ip].Level + 1;
+    off[0] = gh.offset_abs(ilevel, 0) * (1<<rfac);
+    off[1] = gh.offset_abs(ilevel, 1) * (1<<rfac);
+    off[2] = gh.offset_abs(ilevel, 2) * (1<<rfac);
     
-    tetgrid_levelmax = std::max(this_level,tetgrid_levelmax);
+    std::vector<char> brefine( nbefore, 0 );
+    bool bmissing = false;
+    MyIDType lost = 0;
+    
+    #pragma omp parallel for schedule(dynamic,4096)
+    for( long long ip=0; ip<(long long)nbefore; ++ip )
+    {
+        MyIDType lid;
+        int ires = check_lagrange_cube( gh, ilevel, off, ip, nbefore, lid );
+        
+        if( ires < 0 )
+        {
+            #pragma omp critical
+            {   bmissing = true; lost = lid;    }
+        }
+        brefine[ip] = (ires > 0);
+    }
     
-    count = 0;
+    if( bmissing )
+    {
+        LOGERR("This should not happen : Lagrange ID %llu not found!", lost );
+        throw std::runtime_error("FATAL");
+    }
     
+    std::vector< std::vector<particle> > newp( omp_get_max_threads() );
     
-    // insert mass carying "true" particles
-    for( k=0; k<nmassc; ++k )
+    #pragma omp parallel num_threads(newp.size())
     {
-        MyIDType edge_ids[2] = { P[ip].get_vertex( massc_edge[k][0] ), P[ip].get_vertex( massc_edge[k][1] ) };
-        
-        P[newi+count].Lagrange_ID = compute_midpoint( edge_ids );
+        int it = omp_get_thread_num(), nt = omp_get_num_threads();
+        std::vector<particle>& pt = newp[it];
         
-        assert( REMOVE_DECORATION_BITS(P[newi+count].Lagrange_ID) == REMOVE_DECORATION_BITS(P[ip].get_vertex(k+1,1)));
-        
-        //P[newi+count].ID = new_tracer_id+count;
-        //P[newi+count].Mass = newmass;
-        P[newi+count].Type = 1;
-        P[newi+count].Level = this_level;
-        count++;
+        for( size_t ip=nbefore*it/nt; ip<nbefore*(it+1)/nt; ++ip )
+        {
+            if( !brefine[ip] )
+                continue;
+            
+            for( size_t k=0; k<newnum_p_per_split; ++k )
+            {
+                const int *edge = (k<(size_t)nmassc)? massc_edge[k] : massl_edge[k-nmassc];
+                MyIDType edge_ids[2] = { P[ip].get_vertex( edge[0] ), P[ip].get_vertex( edge[1] ) };
+                MyIDType lid = compute_midpoint( edge_ids );
+                MyIDType xc[3] = { get_lagrange_coord( lid, 0 ), get_lagrange_coord( lid, 1 ), get_lagrange_coord( lid, 2 ) };
+                
+                // the cubes sharing the vertex start half a cell below it where it lies on a cell
+                // midpoint, at it or one cell below it along the other axes, ic=0 is the one it belongs to
+                int num_h = 0, ref_count = 0;
+                size_t iemit = nbefore;
+                bool bowner = false;
+                
+                for( int a=0; a<3; ++a )
+                    if( xc[a] & half ) ++num_h;
+                
+                for( int ic=0; ic<8; ++ic )
+                {
+                    MyIDType xo[3];
+                    bool bvalid = true;
+                    
+                    for( int a=0; a<3 && bvalid; ++a )
+                    {
+                        int is = (ic>>a)&1;
+                        if( xc[a] & half )
+                        {
+                            bvalid = (is==0);
+                            xo[a] = xc[a]-half;
+                        }
+                        else
+                            xo[a] = (xc[a]+nfull-is*full) % nfull;
+                    }
+                    
+                    if( !bvalid )
+                        continue;
+                    
+                    size_t jp = find_particle( get_lagrange_ID(xo[0],xo[1],xo[2]), nbefore );
+                    if( jp < nbefore && brefine[jp] )
+                    {
+                        ++ref_count;
+                        iemit = std::min( iemit, jp );
+                        if( ic == 0 ) bowner = true;
+                    }
+                }
+                
+                if( iemit != ip )
+                    continue;
+                
+                particle pnew;
+                pnew.Lagrange_ID = SET_REFINEMENT_COUNTER( lid, ref_count );
+                
+                // the vertex is 'free' if all neighbouring cubes are refined
+                if( ref_count == req_h[num_h-1] )
+                    SET_FREE_PARTICLE_BIT( pnew.Lagrange_ID );
+                
+                pnew.Type = bowner? 1 : 2;
+                pnew.Level = ilevel+1;
+                pt.push_back( pnew );
+            }
+        }
     }
-    // the innermost particle is a freely moving particle to begin with
-    SET_FREE_PARTICLE_BIT( P[newi+count-1].Lagrange_ID );
     
-    // insert massless helper particles
-    for( k=0; k<nmassl; ++k )
+    std::vector<size_t> first( newp.size()+1, nbefore );
+    for( size_t it=0; it<newp.size(); ++it )
+        first[it+1] = first[it] + newp[it].size();
+    
+    num_p = first.back();
+    
+    if( num_p > num_p_alloc )
     {
-        MyIDType edge_ids[2] = { P[ip].get_vertex( massl_edge[k][0] ), P[ip].get_vertex( massl_edge[k][1] ) };
-        
-        //P[newi+count].ID = new_tracer_id+count;
-        P[newi+count].Lagrange_ID = compute_midpoint( edge_ids );
-        
-        //P[newi+count].Mass = zeromass;
-        P[newi+count].Type = 2;//masslesstype;
-        P[newi+count].Level = this_level;
-        count++;
+        P = (particle*) realloc( P, (num_p_alloc=num_p)*sizeof(particle) );
+        LOGINFO("reallocated particle buffer. new size = %llu MBytes.",  num_p_alloc * sizeof(particle)/1024/1024 );
     }
     
-    // update spawning particle
-    //P[ip].Mass = newmass;
-    P[ip].Level = this_level;
+    #pragma omp parallel for
+    for( long long it=0; it<(long long)newp.size(); ++it )
+        if( !newp[it].empty() )
+            std::copy( newp[it].begin(), newp[it].end(), P+first[it] );
+    
+    #pragma omp parallel for
+    for( long long ip=0; ip<(long long)nbefore; ++ip )
+        if( brefine[ip] )
+            P[ip].Level = ilevel+1;
     
+    if( num_p > nbefore )
+        tetgrid_levelmax = std::max(ilevel+1,tetgrid_levelmax);
     
-    num_p += count;
+    sort_particles( nbefore );
 }
 
 void init_base_grid( int ilevel, size_t prealloc_particles = 0 )
 {
-    size_t nbase = 1<<ilevel;//, lid;
+    size_t nbase = 1<<ilevel;
     TetRefinementIDFactor = 20-ilevel;
     
     tetgrid_baselevel = ilevel;
@@ -330,77 +532,30 @@ void init_base_grid( int ilevel, size_t prealloc_particles = 0 )
     P = (particle*)malloc( sizeof(particle) * prealloc_particles );
     num_p_alloc = prealloc_particles;
     
-    //double dx = 1.0 / nbase;
-    
-    num_p = 0;
-    
-    for( size_t ix=0; ix<nbase; ++ix )
+    // stored in the order of their Lagrange IDs
+    #pragma omp parallel for
+    for( long long ix=0; ix<(long long)nbase; ++ix )
         for( size_t iy=0; iy<nbase; ++iy )
             for( size_t iz=0; iz<nbase; ++iz )
             {
                 size_t idx = (ix*nbase+iy)*nbase+iz;
                 
                 P[idx].Lagrange_ID =
-                SET_REFINEMENT_COUNTER((ix<<(TetRefinementIDFactor+40))
+                SET_REFINEMENT_COUNTER((((MyIDType)ix)<<(TetRefinementIDFactor+40))
                                        +(iy<<(TetRefinementIDFactor+20))
                                        +(iz<<TetRefinementIDFactor),1);
                 
-                //P[idx].ID = idx;
                 P[idx].Type = 1;
                 P[idx].Level = ilevel;
                 
                 SET_FREE_PARTICLE_BIT( P[idx].Lagrange_ID );
-                
-                //... insert into access map
-                //lid = REMOVE_FREE_PARTICLE_BIT( REMOVE_REFINEMENT_COUNTER( P[idx].Lagrange_ID ) );
-                idmap[ REMOVE_DECORATION_BITS(P[idx].Lagrange_ID) ] = num_p;
-                
-                num_p++;
             }
     
+    num_p = nbase*nbase*nbase;
     tetgrid_levelmax = ilevel;
 }
 
 
-
-void delete_duplicates( void )
-{
-    std::sort<particle*>( P, P+num_p );
-    
-    idmap.clear();
-    idmap[ REMOVE_DECORATION_BITS(P[0].Lagrange_ID) ] = 0;
-    
-    size_t j=1;
-    for( size_t i=1; i<num_p; ++i )
-    {
-        if( REMOVE_DECORATION_BITS(P[i].Lagrange_ID) != REMOVE_DECORATION_BITS(P[j-1].Lagrange_ID) )
-        {
-            memcpy( &P[j], &P[i], sizeof(particle) );
-            idmap[ REMOVE_DECORATION_BITS(P[j].Lagrange_ID) ] = j;
-            ++j;
-        }else{
-            P[j-1].Lagrange_ID = ADD_REFINEMENT_COUNTERS( P[j-1].Lagrange_ID, P[i].Lagrange_ID );
-            
-            // check if the vertex is part of all neighbouring, if yes, set as 'free' vertex
-            size_t lid = REMOVE_DECORATION_BITS( P[j-1].Lagrange_ID );
-            size_t rx = GET_SUBSHIFT( lid, 2, P[j-1].Level );
-            size_t ry = GET_SUBSHIFT( lid, 1, P[j-1].Level );
-            size_t rz = GET_SUBSHIFT( lid, 0, P[j-1].Level );
-            
-            int num_h = rx+ry+rz;  // type of vertex: 1 is on edge, 2 is on face, 3 is in vol
-            int req_h[] = {4,2,1}; // required: 4x ref for edge, 2x for face, 1x for volume
-            
-            int ref_count = GET_REFINEMENT_COUNTER( P[j-1].Lagrange_ID );
-            if( ref_count == req_h[ num_h-1 ] )
-                SET_FREE_PARTICLE_BIT( P[j-1].Lagrange_ID );
-            
-        }
-    }
-    //size_t ndeleted = num_p-j;
-    num_p = j;
-}
-
-
 //////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////
@@ -1046,91 +1201,7 @@ public:
         
         for( int ilevel=gh.levelmin(); ilevel<(int)gh.levelmax(); ++ilevel )
         {
-            int rfac = 20-ilevel;
-            
-            MyIDType off[3];
-            
-            off[0] = gh.offset_abs(ilevel, 0) * (1<<rfac);// + (1<<(rfac-1));
-            off[1] = gh.offset_abs(ilevel, 1) * (1<<rfac);// + (1<<(rfac-1));
-            off[2] = gh.offset_abs(ilevel, 2) * (1<<rfac);// + (1<<(rfac-1));
-            
-            
-            size_t num_p_before_refinement_sweep = num_p;
-            
-            for( size_t ip=0; ip<num_p_before_refinement_sweep; ++ip )
-            {
-                if( P[ip].Level != ilevel || !P[ip].can_refine() )
-                    continue;
-
-                MyIDType lidsum = 0, xc[3] = {0,0,0};
-                
-                bool foundall = true;
-                bool dorefine = true;
-                
-                if( P[ip].Type == 2 ) continue;
-                
-                for( int i=0; i<8; ++i )
-                {
-                    idmap_it it = idmap.find( REMOVE_DECORATION_BITS( P[ip].get_vertex(i) ) );
-                    
-                    if( it==idmap.end() ){
-                        foundall = false;
-                        LOGERR("This should not happen : Lagrange ID %llu not found!", REMOVE_DECORATION_BITS( P[ip].get_vertex(i) ));
-                        throw std::runtime_error("FATAL");
-                        break;
-                    }
-                    
-                    
-                    
-                    size_t cid = (*it).second;
-                    MyIDType lid = P[cid].Lagrange_ID;
-                    
-                    lid = REMOVE_DECORATION_BITS(lid);
-                    
-                    xc[0] = get_lagrange_coord( lid, 0 );//; - (1<<(rfac-1)); // -dx/2
-                    xc[1] = get_lagrange_coord( lid, 1 );// - (1<<(rfac-1)); // -dx/2
-                    xc[2] = get_lagrange_coord( lid, 2 );// - (1<<(rfac-1)); // -dx/2
-                
-                    if( xc[0] < off[0] || xc[1] < off[1] || xc[2] < off[2] ){
-                        dorefine = false;
-                        break;
-                    }
-                    
-                    int ix, iy, iz;
-                    
-                    ix = (xc[0]-off[0])>>rfac;//(int)((double)(xc[0] - off[0])*dlm);
-                    iy = (xc[1]-off[1])>>rfac;//(int)((double)(xc[1] - off[1])*dlm);
-                    iz = (xc[2]-off[2])>>rfac;//(int)((double)(xc[2] - off[2])*dlm);
-                    
-                    
-                    if( ix >= (int)gh.size(ilevel,0) || iy >= (int)gh.size(ilevel,1) || iz >= (int)gh.size(ilevel,2) )
-                    {
-                        dorefine = false;
-                        break;
-                    }
-                    
-                    
-                    if( gh.is_in_mask(ilevel,ix,iy,iz) && !gh.is_refined(ilevel,ix,iy,iz) )
-                    {
-                        dorefine = false;
-                        break;
-                    }
-                    
-                    lidsum += lid;
-                }
-                
-                if( !foundall ) continue;
-                if( !dorefine ) continue;
-                
-                if( num_p + newnum_p_per_split > num_p_alloc )
-                {
-                    P = (particle*) realloc( P, (num_p_alloc+=num_p_realloc_blocksize)*sizeof(particle) );
-                    LOGINFO("reallocated particle buffer. new size = %llu MBytes.",  num_p_alloc * sizeof(particle)/1024/1024 );
-                }
-                split_lagrange_cube( ip );
-            }
-            
-            delete_duplicates();
+            refine_lagrange_level( gh, ilevel );
             LOGINFO("refined tet mesh to level %d : now have %lld particles", ilevel+1, num_p );
             
         }
@@ -11,6 +11,7 @@
 
 #ifdef HAVE_HDF5
 
+#include <sstream>
 #include "output.hh"
 #include "HDF_IO.hh"
 
@@ -20,20 +21,71 @@ class generic_output_plugin : public output_plugin
 protected:
 	
 	using output_plugin::cf_;
+	
+	hid_t file_id_;							//!< output file, open from construction to finalize()
+	unsigned chunk_;						//!< edge length of the dataset chunks
+	int deflate_;							//!< gzip level, 0 for no deflate
+	int filter_;							//!< id of an additional registered HDF5 filter (e.g. zstd, SZ, ZFP), 0 for none
+	std::vector<unsigned> filter_params_;	//!< its parameters
+	
+	//! dataset creation properties: chunked, with the configured compression
+	hid_t create_plist( const hsize_t nd[3] ) const
+	{
+		hid_t plist = H5Pcreate( H5P_DATASET_CREATE );
 		
+		hsize_t chunk[3];
+		for( int i=0; i<3; ++i )
+			chunk[i] = std::max<hsize_t>( 1, std::min<hsize_t>( nd[i], chunk_ ) );
+		H5Pset_chunk( plist, 3, chunk );
+		
+		if( deflate_ > 0 )
+		{
+			H5Pset_shuffle( plist );
+			H5Pset_deflate( plist, deflate_ );
+		}
+		
+		if( filter_ > 0 )
+			H5Pset_filter( plist, (H5Z_filter_t)filter_, H5Z_FLAG_OPTIONAL, filter_params_.size(),
+						   filter_params_.empty()? NULL : &filter_params_[0] );
+		
+		return plist;
+	}
+	
 	template< typename Tt >
-	void write2HDF5( std::string fname, std::string dname, const MeshvarBnd<Tt>& data )
+	void write2HDF5( std::string dname, const MeshvarBnd<Tt>& data )
 	{
 		int n0 = data.size(0), n1 = data.size(1), n2 = data.size(2), nb = data.m_nbnd;
-		std::vector<Tt> vdata;
-		vdata.reserve((unsigned)(n0+2*nb)*(n1+2*nb)*(n2+2*nb));
+		hsize_t nd[3] = { (hsize_t)(n0+2*nb),(hsize_t)(n1+2*nb),(hsize_t)(n2+2*nb) };
+		std::vector<Tt> vdata( nd[0]*nd[1]*nd[2] );
+		
+		#pragma omp parallel for
 		for(int i=-nb; i<n0+nb; ++i )
+		{
+			size_t q = (size_t)(i+nb)*nd[1]*nd[2];
 			for(int j=-nb; j<n1+nb; ++j )
 				for(int k=-nb; k<n2+nb; ++k )
-					vdata.push_back( data(i,j,k) );
+					vdata[q++] = data(i,j,k);
+		}
+		
+		hid_t type = GetDataType<Tt>();
+		hid_t space = H5Screate_simple( 3, nd, NULL );
+		hid_t plist = create_plist( nd );
+		hid_t dset = H5Dcreate( file_id_, dname.c_str(), type, space, plist );
+		
+		herr_t status = -1;
+		if( dset >= 0 )
+		{
+			status = H5Dwrite( dset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, &vdata[0] );
+			H5Dclose( dset );
+		}
+		H5Pclose( plist );
+		H5Sclose( space );
 		
-		unsigned nd[3] = { (unsigned)(n0+2*nb),(unsigned)(n1+2*nb),(unsigned)(n2+2*nb)	};
-		HDFWriteDataset3D( fname, dname, nd, vdata);
+		if( status < 0 )
+		{
+			LOGERR("Could not write dataset '%s' to file '%s'.", dname.c_str(), fname_.c_str() );
+			throw std::runtime_error("generic output: HDF5 write failed");
+		}
 	}
 	
 public:
@@ -55,10 +107,37 @@ public:
 		
 		HDFWriteGroupAttribute(fname_, "header", "levelmin", levelmin_ );
 		HDFWriteGroupAttribute(fname_, "header", "levelmax", levelmax_ );
+		
+		chunk_ = std::max( 1u, cf.getValueSafe<unsigned>("output","generic_chunk_size",64) );
+		deflate_ = std::min( 9, cf.getValueSafe<int>("output","generic_deflate",0) );
+		filter_ = cf.getValueSafe<int>("output","generic_filter",0);
+		
+		//... e.g. generic_filter = 32013 (ZFP) with its encoded parameters as a comma separated list
+		std::stringstream ss( cf.getValueSafe<std::string>("output","generic_filter_params","") );
+		std::string tok;
+		while( std::getline( ss, tok, ',' ) )
+			if( tok.find_first_not_of(" \t") != std::string::npos )
+				filter_params_.push_back( (unsigned)strtoul( tok.c_str(), NULL, 0 ) );
+		
+		if( filter_ > 0 && H5Zfilter_avail( (H5Z_filter_t)filter_ ) <= 0 )
+		{
+			LOGWARN("HDF5 filter %d is not available, writing without it.", filter_ );
+			filter_ = 0;
+		}
+		
+		file_id_ = H5Fopen( fname_.c_str(), H5F_ACC_RDWR, H5P_DEFAULT );
+		if( file_id_ < 0 )
+		{
+			LOGERR("Could not open output file '%s'.", fname_.c_str() );
+			throw std::runtime_error("generic output: could not open file");
+		}
 	}
 	
 	~generic_output_plugin()
-	{	}
+	{
+		if( file_id_ >= 0 )
+			H5Fclose( file_id_ );
+	}
 	
 	void write_dm_mass( const grid_hierarchy& gh )
 	{	}
@@ -76,7 +155,7 @@ public:
 			else if( coord == 2 )
 				sprintf(sstr,"level_%03d_DM_vz",ilevel);
 			
-			write2HDF5( fname_, sstr, *gh.get_grid(ilevel) );
+			write2HDF5( sstr, *gh.get_grid(ilevel) );
 		}
 	}
 	
@@ -93,7 +172,7 @@ public:
 			else if( coord == 2 )
 				sprintf(sstr,"level_%03d_DM_dz",ilevel);
 			
-			write2HDF5( fname_, sstr, *gh.get_grid(ilevel) );
+			write2HDF5( sstr, *gh.get_grid(ilevel) );
 		}
 	}
 	
@@ -104,7 +183,7 @@ public:
 		for( unsigned ilevel=0; ilevel<=levelmax_; ++ilevel )
 		{
 			sprintf(sstr,"level_%03d_DM_rho",ilevel);
-			write2HDF5( fname_, sstr, *gh.get_grid(ilevel) );
+			write2HDF5( sstr, *gh.get_grid(ilevel) );
 		}
 
 
@@ -192,7 +271,7 @@ public:
 		for( unsigned ilevel=0; ilevel<=levelmax_; ++ilevel )
 		{
 			sprintf(sstr,"level_%03d_DM_potential",ilevel);
-			write2HDF5( fname_, sstr, *gh.get_grid(ilevel) );
+			write2HDF5( sstr, *gh.get_grid(ilevel) );
 		}
 	}
 	
@@ -203,7 +282,7 @@ public:
 		for( unsigned ilevel=0; ilevel<=levelmax_; ++ilevel )
 		{
 			sprintf(sstr,"level_%03d_BA_potential",ilevel);
-			write2HDF5( fname_, sstr, *gh.get_grid(ilevel) );
+			write2HDF5( sstr, *gh.get_grid(ilevel) );
 		}
 	}
 	
@@ -222,7 +301,7 @@ public:
 			else if( coord == 2 )
 				sprintf(sstr,"level_%03d_BA_vz",ilevel);
 			
-			write2HDF5( fname_, sstr, *gh.get_grid(ilevel) );
+			write2HDF5( sstr, *gh.get_grid(ilevel) );
 		}
 	}
 	
@@ -236,12 +315,16 @@ public:
 		for( unsigned ilevel=0; ilevel<=levelmax_; ++ilevel )
 		{
 			sprintf(sstr,"level_%03d_BA_rho",ilevel);
-			write2HDF5( fname_, sstr, *gh.get_grid(ilevel) );
+			write2HDF5( sstr, *gh.get_grid(ilevel) );
 		}
 	}
 	
 	void finalize( void )
-	{	}
+	{
+		if( file_id_ >= 0 )
+			H5Fclose( file_id_ );
+		file_id_ = -1;
+	}
 };
 
 
@@ -10,6 +10,9 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
 #include <fstream>
 #include "output.hh"
 
@@ -37,10 +40,11 @@ protected:
     int passive_variable_index_;
     float passive_variable_value_;
 	
-	void write_file_header( std::ofstream& ofs, unsigned ilevel, const grid_hierarchy& gh )
+	size_t slab_buffer_;		//!< bytes of slices each thread packs before writing them
+	int write_threads_;			//!< number of threads packing and writing slices
+	
+	void fill_file_header( header& loc_head, unsigned ilevel, const grid_hierarchy& gh )
 	{
-		header loc_head;
-		
 		double 
 			boxlength	= cf_.getValue<double>("setup","boxlength"),
 			H0			= cf_.getValue<double>("cosmology","H0"),
@@ -63,41 +67,94 @@ protected:
 		loc_head.omega_m0 = omegam;
 		loc_head.omega_l0 = omegaL;
 		loc_head.h00 = H0;
-		
-		
-		int blksz = sizeof(header);
-		ofs.write( reinterpret_cast<char*> (&blksz), sizeof(int) );
-		ofs.write( reinterpret_cast<char*> (&loc_head), blksz );
-		ofs.write( reinterpret_cast<char*> (&blksz), sizeof(int) );
-		
 	}
 	
-	void write_sliced_array( std::ofstream& ofs, unsigned ilevel, const grid_hierarchy& gh, float fac = 1.0f )
+	static bool pwrite_all( int fd, const char* p, size_t nbytes, off_t off )
+	{
+		while( nbytes > 0 )
+		{
+			ssize_t nw = pwrite( fd, p, nbytes, off );
+			if( nw <= 0 )
+				return false;
+			p += nw; off += nw; nbytes -= (size_t)nw;
+		}
+		return true;
+	}
+	
+	//! write a level file: the header record followed by one record for each z-slice of value(i,j,k)
+	/*! every record has a fixed length, so the threads pack chunks of slices with their record
+	 *  markers and write them at their offsets concurrently, value is called from all threads
+	 */
+	template< typename F >
+	void write_level_file( const char* fname, unsigned ilevel, const grid_hierarchy& gh, F value )
 	{
-		unsigned n1,n2,n3;
-		n1 = gh.get_grid(ilevel)->size(0);
-		n2 = gh.get_grid(ilevel)->size(1);
-		n3 = gh.get_grid(ilevel)->size(2);
+		const size_t n1 = gh.size(ilevel,0), n2 = gh.size(ilevel,1), n3 = gh.size(ilevel,2);
+		
+		int fd = open( fname, O_WRONLY|O_CREAT|O_TRUNC, 0644 );
+		if( fd < 0 )
+		{
+			LOGERR("grafic2 output plug-in could not open file \'%s\' for writing!", fname);
+			throw std::runtime_error("grafic2 output plug-in could not open output file");
+		}
+		
+		header loc_head;
+		fill_file_header( loc_head, ilevel, gh );
+		
+		int blksz = sizeof(header);
+		char head[sizeof(header)+2*sizeof(int)];
+		memcpy( head, &blksz, sizeof(int) );
+		memcpy( head+sizeof(int), &loc_head, sizeof(header) );
+		memcpy( head+sizeof(int)+sizeof(header), &blksz, sizeof(int) );
+		bool ok = pwrite_all( fd, head, sizeof(head), 0 );
 		
-		std::vector<float> data(n1*n2,0.0f);
+		const unsigned blksize = n1*n2*sizeof(float);
+		const size_t reclen = blksize + 2*sizeof(unsigned);
+		const size_t nslices = std::min( n3, std::max<size_t>( 1, slab_buffer_/reclen ) );
+		const long long nchunks = (n3+nslices-1)/nslices;
 		
-		for( unsigned i=0; i<n3; ++i )
+		#pragma omp parallel num_threads(write_threads_)
 		{
+			std::vector<float> buf( nslices*reclen/sizeof(float) );
+			char *pbuf = reinterpret_cast<char*>( &buf[0] );
 			
-			data.clear();
-			
-			for( unsigned j=0; j<n2; ++j )
-				for( unsigned k=0; k<n1; ++k )
-					data[j*n1+k] = (*gh.get_grid(ilevel))(k,j,i) * fac;
-			
-			unsigned blksize = n1*n2*sizeof(float);
-			
-			ofs.write( reinterpret_cast<char*> (&blksize), sizeof(unsigned) );
-			ofs.write( reinterpret_cast<char*> (&data[0]), blksize );
-			ofs.write( reinterpret_cast<char*> (&blksize), sizeof(unsigned) );
-			
+			#pragma omp for schedule(dynamic)
+			for( long long ic=0; ic<nchunks; ++ic )
+			{
+				size_t k0 = ic*nslices, k1 = std::min( n3, k0+nslices );
+				
+				for( size_t k=k0; k<k1; ++k )
+				{
+					char *rec = pbuf + (k-k0)*reclen;
+					float *data = reinterpret_cast<float*>( rec+sizeof(unsigned) );
+					
+					memcpy( rec, &blksize, sizeof(unsigned) );
+					for( size_t j=0; j<n2; ++j )
+						for( size_t i=0; i<n1; ++i )
+							data[j*n1+i] = value(i,j,k);
+					memcpy( rec+sizeof(unsigned)+blksize, &blksize, sizeof(unsigned) );
+				}
+				
+				if( !pwrite_all( fd, pbuf, (k1-k0)*reclen, sizeof(head)+k0*reclen ) )
+				{
+					#pragma omp atomic write
+					ok = false;
+				}
+			}
+		}
+		
+		if( close( fd ) != 0 || !ok )
+		{
+			LOGERR("grafic2 output plug-in : I/O error while writing file \'%s\'", fname);
+			throw std::runtime_error("I/O error while writing grafic2 output file");
 		}
 	}
+	
+	void write_sliced_array( const char* fname, unsigned ilevel, const grid_hierarchy& gh, float fac = 1.0f )
+	{
+		const MeshvarBnd<real_t>& g = *gh.get_grid(ilevel);
+		write_level_file( fname, ilevel, gh, [&]( size_t i, size_t j, size_t k ) -> float
+			{	return g(i,j,k) * fac;	} );
+	}
     
     size_t restrict_mask( size_t n1, size_t n2, size_t n3, size_t o1, size_t o2, size_t o3,
                         size_t n1c, size_t n2c, size_t n3c, const float* finemask, float* coarsemask )
@@ -134,11 +191,30 @@ protected:
         
     }
     
+    //! write the refinement map of a level (and the passive variable derived from it), mask is indexed (i*n2+j)*n3+k
+    void write_mask_files( unsigned ilevel, const grid_hierarchy& gh, const std::vector<float>& mask )
+    {
+        char ff[256];
+        const size_t n2 = gh.size(ilevel,1), n3 = gh.size(ilevel,2);
+        const float *m = &mask[0];
+        
+        sprintf(ff,"%s/level_%03d/ic_refmap",fname_.c_str(), ilevel );
+        write_level_file( ff, ilevel, gh, [&]( size_t i, size_t j, size_t k ) -> float
+            {   return m[(i*n2+j)*n3+k];    } );
+        
+        if( passive_variable_value_ > 0.0f )
+        {
+            const float pval = passive_variable_value_;
+            sprintf(ff,"%s/level_%03d/ic_pvar_%05d",fname_.c_str(), ilevel, passive_variable_index_ );
+            write_level_file( ff, ilevel, gh, [&]( size_t i, size_t j, size_t k ) -> float
+                {   return m[(i*n2+j)*n3+k] * pval;    } );
+        }
+    }
+    
     void write_refinement_mask( const grid_hierarchy& gh )
     {
         
         // generate mask for highest level
-        char ff[256];
        
         size_t n1,n2,n3;
             n1 = gh.get_grid(gh.levelmax())->size(0);
@@ -159,48 +235,7 @@ protected:
                             data[(i*n2+j)*n3+k] = 0.0;
             
             // write mask
-            sprintf(ff,"%s/level_%03d/ic_refmap",fname_.c_str(), gh.levelmax() );
-            std::ofstream ofs(ff,std::ios::binary|std::ios::trunc);
-	    write_file_header( ofs, gh.levelmax(), gh );
-
-	    std::ofstream ofs_metals;
-	    
-	    if( passive_variable_value_ > 0.0f )
-	      {
-            sprintf(ff,"%s/level_%03d/ic_pvar_%05d",fname_.c_str(), gh.levelmax(), passive_variable_index_ );
-            ofs_metals.open(ff,std::ios::binary|std::ios::trunc);
-            write_file_header( ofs_metals, gh.levelmax(), gh );
-	      }
-
-           
-            
-            std::vector<float> block(n1*n2,0.0f);
-            for( unsigned k=0; k<n3; ++k )
-            {
-                for( unsigned j=0; j<n2; ++j )
-                    for( unsigned i=0; i<n1; ++i )
-                        block[j*n1+i] = data[(i*n2+j)*n3+k];
-                
-                unsigned blksize = n1*n2*sizeof(float);
-                
-                ofs.write( reinterpret_cast<char*> (&blksize), sizeof(unsigned) );
-                ofs.write( reinterpret_cast<char*> (&block[0]), blksize );
-                ofs.write( reinterpret_cast<char*> (&blksize), sizeof(unsigned) );
-
-
-		if( passive_variable_value_ > 0.0f ){
-
-		  for( unsigned j=0; j<n2; ++j )
-		    for( unsigned i=0; i<n1; ++i )
-		      block[j*n1+i] = data[(i*n2+j)*n3+k] * passive_variable_value_;
-                
-		  unsigned blksize = n1*n2*sizeof(float);
-                
-		  ofs_metals.write( reinterpret_cast<char*> (&blksize), sizeof(unsigned) );
-		  ofs_metals.write( reinterpret_cast<char*> (&block[0]), blksize );
-		  ofs_metals.write( reinterpret_cast<char*> (&blksize), sizeof(unsigned) );
-		}
-            }
+            write_mask_files( gh.levelmax(), gh, data );
         }
         
         // do all coarser levels
@@ -237,45 +272,7 @@ protected:
             
             LOGINFO("%f of cells on level %d are refined",(double)nref/(n1c*n2c*n3c),ilevel);
             
-            sprintf(ff,"%s/level_%03d/ic_refmap",fname_.c_str(), ilevel );
-            std::ofstream ofs(ff,std::ios::binary|std::ios::trunc);
-            write_file_header( ofs, ilevel, gh );
-
-	    std::ofstream ofs_metals;
-	    if( passive_variable_value_ > 0.0f )
-	      {
-		sprintf(ff,"%s/level_%03d/ic_pvar_%05d",fname_.c_str(), ilevel, passive_variable_index_ );
-		ofs_metals.open(ff,std::ios::binary|std::ios::trunc);
-		write_file_header( ofs_metals, ilevel, gh );
-	      }
-
-
-            std::vector<float> block(n1c*n2c,0.0f);
-            for( unsigned i=0; i<n3c; ++i )
-            {
-                for( unsigned j=0; j<n2c; ++j )
-                    for( unsigned k=0; k<n1c; ++k )
-                        block[j*n1c+k] = data_coarse[(k*n2c+j)*n3c+i];
-                
-                unsigned blksize = n1c*n2c*sizeof(float);
-                
-                ofs.write( reinterpret_cast<char*> (&blksize), sizeof(unsigned) );
-                ofs.write( reinterpret_cast<char*> (&block[0]), blksize );
-                ofs.write( reinterpret_cast<char*> (&blksize), sizeof(unsigned) );
-
-		if( passive_variable_value_ > 0.0f ){
-
-		  for( unsigned j=0; j<n2c; ++j )
-                    for( unsigned k=0; k<n1c; ++k )
-                        block[j*n1c+k] = data_coarse[(k*n2c+j)*n3c+i] * passive_variable_value_;
-                
-		  unsigned blksize = n1c*n2c*sizeof(float);
-                
-		  ofs_metals.write( reinterpret_cast<char*> (&blksize), sizeof(unsigned) );
-		  ofs_metals.write( reinterpret_cast<char*> (&block[0]), blksize );
-		  ofs_metals.write( reinterpret_cast<char*> (&blksize), sizeof(unsigned) );
-		}
-            }
+            write_mask_files( ilevel, gh, data_coarse );
             
             data.swap( data_coarse );
             
@@ -478,6 +475,11 @@ public:
       //metal_floor_ = cf.getValueSafe<float>("output","ramses_metal_floor",1e-5);
         passive_variable_index_ = cf.getValueSafe<int>("output","ramses_pvar_idx",1);
         passive_variable_value_ = cf.getValueSafe<float>("output","ramses_pvar_val",1.0f);
+		
+		slab_buffer_ = cf.getValueSafe<size_t>("output","grafic_buffer_mb",16) << 20;
+		write_threads_ = cf.getValueSafe<int>("output","grafic_write_threads",0);
+		if( write_threads_ <= 0 )
+			write_threads_ = omp_get_max_threads();
 	}
 	
 	/*~grafic2_output_plugin()
@@ -495,10 +497,7 @@ public:
 			char ff[256];
 			sprintf(ff,"%s/level_%03d/ic_posc%c",fname_.c_str(), ilevel, (char)('x'+coord) );
 			
-			std::ofstream ofs(ff,std::ios::binary|std::ios::trunc);
-			
-			write_file_header( ofs, ilevel, gh );
-			write_sliced_array( ofs, ilevel, gh, boxlength );
+			write_sliced_array( ff, ilevel, gh, boxlength );
 		}
 	}
 	
@@ -513,10 +512,7 @@ public:
 			char ff[256];
 			sprintf(ff,"%s/level_%03d/ic_velc%c",fname_.c_str(), ilevel, (char)('x'+coord) );
 			
-			std::ofstream ofs(ff,std::ios::binary|std::ios::trunc);
-			
-			write_file_header( ofs, ilevel, gh );
-			write_sliced_array( ofs, ilevel, gh, boxlength );
+			write_sliced_array( ff, ilevel, gh, boxlength );
 		}
 	}
 	
@@ -531,10 +527,7 @@ public:
 			char ff[256];
 			sprintf(ff,"%s/level_%03d/ic_velb%c",fname_.c_str(), ilevel, (char)('x'+coord) );
 			
-			std::ofstream ofs(ff,std::ios::binary|std::ios::trunc);
-			
-			write_file_header( ofs, ilevel, gh );
-			write_sliced_array( ofs, ilevel, gh, boxlength );
+			write_sliced_array( ff, ilevel, gh, boxlength );
 		}
 	}
 	
@@ -546,10 +539,7 @@ public:
 			char ff[256];
 			sprintf(ff,"%s/level_%03d/ic_deltab",fname_.c_str(), ilevel );
 			
-			std::ofstream ofs(ff,std::ios::binary|std::ios::trunc);
-			
-			write_file_header( ofs, ilevel, gh );
-			write_sliced_array( ofs, ilevel, gh );
+			write_sliced_array( ff, ilevel, gh );
 		}
 		
 	}
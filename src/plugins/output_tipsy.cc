@@ -16,6 +16,7 @@
 #include <fstream>
 
 #include "output.hh"
+#include "byte_order.hh"
 
 
 template< typename T_store=float >
@@ -126,7 +127,7 @@ protected:
 	    
 	}
 	
-	void open(std::string fname, size_t npart )
+	void open(std::string fname, size_t npart, size_t offset=0 )
 	{
 	    std::ifstream::open( fname.c_str(), std::ios::binary );
 	    size_t blk;
@@ -145,6 +146,8 @@ protected:
 		LOGERR("Expected %d bytes in temp file but found %d",npart*(unsigned)sizeof(T_store),blk);
 		throw std::runtime_error("Internal consistency error in TIPSY output plug-in");
 	    }
+	    
+	    this->seekg( offset, std::ios::cur );
 	}
     };
     
@@ -211,6 +214,21 @@ protected:
     int xdr_dump( XDR *xdrs, T_store *fp )
     { return 0; }
     
+    //! particles packed per block are written with one call, XDR encodes floats and doubles in big endian order
+    static const size_t pack_block_ = 1<<18;
+    
+    void write_packed( T_store* p, size_t nvalues )
+    {
+	if( !native_ )
+	    byte_order::to_big_endian( p, nvalues );
+	
+	if( fwrite( p, sizeof(T_store), nvalues, fp_ ) != nvalues )
+	{
+	    LOGERR("TIPSY : I/O error while writing output file \'%s\'", fname_.c_str());
+	    throw std::runtime_error("I/O error while writing TIPSY output file");
+	}
+    }
+    
     int convert_header_XDR( XDR *pxdrs, struct dump* ph )
     {
 	if (!xdr_double(pxdrs,&ph->time)) return 0;
@@ -239,99 +257,23 @@ protected:
         return pow(m/omegab_,0.333333333333)*epsfac_gas_;
     }
     
-    void combine_components_for_coarse( void )
-    {        
-        const size_t 
-	    nptot = np_fine_dm_+np_coarse_dm_,
-	    npfine = np_fine_dm_,
-	    npcoarse = np_coarse_dm_;
-	
-        std::vector<T_store> tmp1, tmp2;
-	
-        tmp1.assign(block_buf_size_,0.0);
-        tmp2.assign(block_buf_size_,0.0);
+    //! mass weight the coarse particles among n DM values starting at DM index p with the gas values read from gas
+    void combine_coarse( size_t p, size_t n, T_store* c, pistream& gas, T_store* buf )
+    {
+        if( p+n <= np_fine_dm_ )
+            return;
 	
+        size_t i0 = (p < np_fine_dm_)? np_fine_dm_-p : 0, m = n-i0;
         double facb = omegab_/omegam_, facc = (omegam_-omegab_)/omegam_;
 	
-	
-        for( int icomp=0; icomp < 3; ++icomp )
-        {
-            char fc[256], fb[256];
-            postream iffs1, iffs2;
-	    
-            /*** positions ***/
-	    
-            sprintf( fc, "___ic_temp_%05d.bin", 100*id_dm_pos+icomp );
-            sprintf( fb, "___ic_temp_%05d.bin", 100*id_gas_pos+icomp );
-	    
-            iffs1.open( fc, nptot, npfine*sizeof(T_store) );
-            iffs2.open( fb, nptot, npfine*sizeof(T_store) );
-	    
-            size_t npleft = npcoarse;
-            size_t n2read = std::min((size_t)block_buf_size_,npleft);
-            while( n2read > 0ul )
-            {
-                std::streampos sp = iffs1.tellg();
-                iffs1.read( reinterpret_cast<char*>(&tmp1[0]), n2read*sizeof(T_store) );
-                iffs2.read( reinterpret_cast<char*>(&tmp2[0]), n2read*sizeof(T_store) );
-		
-                for( size_t i=0; i<n2read; ++i )
-                {
-                    tmp1[i] = facc*tmp1[i] + facb*tmp2[i];
-                }
-		
-                iffs1.seekp( sp );
-                iffs1.write( reinterpret_cast<char*>(&tmp1[0]), n2read*sizeof(T_store) );
-		
-                npleft -= n2read;
-                n2read = std::min( (size_t)block_buf_size_,npleft );
-            }
-	    
-            iffs1.close();
-            iffs2.close();
-	    
-            /*** velocities ***/
-	    
-            sprintf( fc, "___ic_temp_%05d.bin", 100*id_dm_vel+icomp );
-            sprintf( fb, "___ic_temp_%05d.bin", 100*id_gas_vel+icomp );
-	    
-            iffs1.open( fc, nptot, npfine*sizeof(T_store) );
-            iffs2.open( fb, nptot, npfine*sizeof(T_store) );
-	    
-            npleft = npcoarse;
-            n2read = std::min( (size_t)block_buf_size_,npleft);
-	    
-            while( n2read > 0ul )
-            {
-                std::streampos sp = iffs1.tellg();
-                iffs1.read( reinterpret_cast<char*>(&tmp1[0]), n2read*sizeof(T_store) );
-                iffs2.read( reinterpret_cast<char*>(&tmp2[0]), n2read*sizeof(T_store) );
-		
-                for( size_t i=0; i<n2read; ++i )
-                {
-                    tmp1[i] = facc*tmp1[i] + facb*tmp2[i];
-                }
-		
-                iffs1.seekp( sp );
-                iffs1.write( reinterpret_cast<char*>(&tmp1[0]), n2read*sizeof(T_store) );
-		
-                npleft -= n2read;
-                n2read = std::min( (size_t)block_buf_size_,npleft );
-            }
-	    
-            iffs1.close();
-            iffs2.close();
-        }
-	
+        gas.read( reinterpret_cast<char*>(buf), m*sizeof(T_store) );
+        for( size_t i=0; i<m; ++i )
+            c[i0+i] = facc*c[i0+i] + facb*buf[i];
     }
     
     void assemble_tipsy_file( void )
     {
 	
-	if( with_baryons_ && bmultimass_ )
-	    combine_components_for_coarse();
-	
-	
 	fp_ = fopen( fname_.c_str(), "w+" );
 	
 	//............................................................................
@@ -391,6 +333,7 @@ protected:
 	
 	
 	T_store zero = (T_store)0.0;
+	std::vector<T_store> pack( 12*std::min( pack_block_, (size_t)block_buf_size_ ) );
 	
 	while( true )
 	{
@@ -405,8 +348,6 @@ protected:
 
 		xdrstdio_create(&xdrs, fp_, XDR_ENCODE);
 		convert_header_XDR( &xdrs, &header_ );
-		
-		std::vector<T_store> dump_store ( 9*block_buf_size_, (T_store)0.0 );
 	    }
 
             //... sph particles ..................................................
@@ -452,51 +393,31 @@ protected:
                     ifs_vz.read( reinterpret_cast<char*>(&tmp6[0]), n2read*sizeof(T_store) );
                     ifs_m.read( reinterpret_cast<char*>(&tmp7[0]), n2read*sizeof(T_store) );
 		    
-		    if( native_ ) {
-
-			for( size_t i=0; i<n2read; ++i )
-			{                        
-			    fwrite( &tmp7[i], sizeof(tmp7[i]), 1, fp_); // mass
-			    fwrite( &tmp1[i], sizeof(tmp1[i]), 1, fp_); // x
-			    fwrite( &tmp2[i], sizeof(tmp2[i]), 1, fp_); // y
-			    fwrite( &tmp3[i], sizeof(tmp3[i]), 1, fp_); // z
-			    fwrite( &tmp4[i], sizeof(tmp4[i]), 1, fp_); // vx
-			    fwrite( &tmp5[i], sizeof(tmp5[i]), 1, fp_); // vy
-			    fwrite( &tmp6[i], sizeof(tmp6[i]), 1, fp_); // vz
-			    fwrite( &zero, sizeof(zero), 1, fp_);       // rho
-			    fwrite( &temperature, sizeof(temperature), 1, fp_); // temp
-			    
-			    T_store eps = mass2eps_gas( tmp7[i] );
-			    
-			    fwrite( &eps, sizeof(eps), 1, fp_);
-			    fwrite( &zero, sizeof(zero), 1, fp_);
-			    fwrite( &zero, sizeof(zero), 1, fp_);
-			}
-
-		    } else {
-
-			for( size_t i=0; i<n2read; ++i )
-			{                        
-			    xdr_dump(&xdrs,&tmp7[i]); // mass
-			    xdr_dump(&xdrs,&tmp1[i]); // x
-			    xdr_dump(&xdrs,&tmp2[i]); // y
-			    xdr_dump(&xdrs,&tmp3[i]); // z
-			    xdr_dump(&xdrs,&tmp4[i]); // vx
-			    xdr_dump(&xdrs,&tmp5[i]); // vy
-			    xdr_dump(&xdrs,&tmp6[i]); // vz
-			    xdr_dump(&xdrs, &zero );  // rho
-			    xdr_dump(&xdrs, &temperature );  // temp
-			    
-			    T_store eps = mass2eps_gas( tmp7[i] );
-			    
-			    xdr_dump(&xdrs, &eps );   // epsilon / hsmooth
-			    xdr_dump(&xdrs, &zero );  // metals
-			    xdr_dump(&xdrs, &zero );  //potential
+		    for( size_t i0=0; i0<n2read; i0+=pack_block_ )
+		    {
+			const size_t n = std::min( pack_block_, n2read-i0 );
+			
+			#pragma omp parallel for
+			for( long long ii=0; ii<(long long)n; ++ii )
+			{
+			    size_t i = i0+ii;
+			    T_store *q = &pack[12*ii];
+			    q[0] = tmp7[i]; // mass
+			    q[1] = tmp1[i]; // x
+			    q[2] = tmp2[i]; // y
+			    q[3] = tmp3[i]; // z
+			    q[4] = tmp4[i]; // vx
+			    q[5] = tmp5[i]; // vy
+			    q[6] = tmp6[i]; // vz
+			    q[7] = zero;    // rho
+			    q[8] = temperature; // temp
+			    q[9] = mass2eps_gas( tmp7[i] ); // epsilon / hsmooth
+			    q[10] = zero;   // metals
+			    q[11] = zero;   // potential
 			}
-		    
+			write_packed( &pack[0], 12*n );
 		    }
 		    
-		    
                     npleft -= n2read;
                     n2read = std::min( block_buf_size_,npleft );
                 }
@@ -524,6 +445,19 @@ protected:
             ifs_vz.open( fnvz, npcdm );
             ifs_m.open( fnm, npcdm );
 	    
+	    //... coarse DM particles are combined with the coarse gas while they are copied
+	    const bool bcombine = with_baryons_ && bmultimass_;
+	    const char *fnc[6] = { fnbx, fnby, fnbz, fnbvx, fnbvy, fnbvz };
+	    T_store *tmpc[6] = { tmp1, tmp2, tmp3, tmp4, tmp5, tmp6 };
+	    pistream ifs_c[6];
+	    std::vector<T_store> bufc;
+	    if( bcombine )
+	    {
+		for( int icomp=0; icomp<6; ++icomp )
+		    ifs_c[icomp].open( fnc[icomp], npcdm, np_fine_dm_*sizeof(T_store) );
+		bufc.resize( block_buf_size_ );
+	    }
+	    
 	    npleft = npcdm;
 	    npcount = 0;
 	    n2read = std::min(block_buf_size_,npleft);
@@ -536,48 +470,33 @@ protected:
 		ifs_vy.read( reinterpret_cast<char*>(&tmp5[0]), n2read*sizeof(T_store) );
 		ifs_vz.read( reinterpret_cast<char*>(&tmp6[0]), n2read*sizeof(T_store) );
 		ifs_m.read( reinterpret_cast<char*>(&tmp7[0]), n2read*sizeof(T_store) );
-
 		
-		if( native_ ) {
-		    
-		    for( size_t i=0; i<n2read; ++i )
-		    {                        
-			fwrite( &tmp7[i], sizeof(tmp7[i]), 1, fp_); // mass
-			fwrite( &tmp1[i], sizeof(tmp1[i]), 1, fp_); // x
-			fwrite( &tmp2[i], sizeof(tmp2[i]), 1, fp_); // y
-			fwrite( &tmp3[i], sizeof(tmp3[i]), 1, fp_); // z
-			fwrite( &tmp4[i], sizeof(tmp4[i]), 1, fp_); // vx
-			fwrite( &tmp5[i], sizeof(tmp5[i]), 1, fp_); // vy
-			fwrite( &tmp6[i], sizeof(tmp6[i]), 1, fp_); // vz
-
-			T_store eps = (npcount<np_fine_dm_)? mass2eps( tmp7[i] ) : mass2eps_coarse( tmp7[i] );
-			
-			fwrite( &eps, sizeof(eps), 1, fp_);
-			fwrite( &zero, sizeof(zero), 1, fp_);
-			++npcount;
-		    }
-		    
-		} else {
-		    
+		if( bcombine )
+		    for( int icomp=0; icomp<6; ++icomp )
+			combine_coarse( npcount, n2read, tmpc[icomp], ifs_c[icomp], &bufc[0] );
+		
+		for( size_t i0=0; i0<n2read; i0+=pack_block_ )
+		{
+		    const size_t n = std::min( pack_block_, n2read-i0 );
 		    
-		    for( size_t i=0; i<n2read; ++i )
+		    #pragma omp parallel for
+		    for( long long ii=0; ii<(long long)n; ++ii )
 		    {
-			xdr_dump(&xdrs,&tmp7[i]); // mass
-			xdr_dump(&xdrs,&tmp1[i]); // x
-			xdr_dump(&xdrs,&tmp2[i]); // y
-			xdr_dump(&xdrs,&tmp3[i]); // z
-			xdr_dump(&xdrs,&tmp4[i]); // vx
-			xdr_dump(&xdrs,&tmp5[i]); // vy
-			xdr_dump(&xdrs,&tmp6[i]); // vz
-			
-			T_store eps = (npcount<np_fine_dm_)? mass2eps( tmp7[i] ) : mass2eps_coarse( tmp7[i] );
-			
-			xdr_dump(&xdrs, &eps ); // epsilon
-			xdr_dump(&xdrs, &zero ); //potential
-			++npcount;
+			size_t i = i0+ii;
+			T_store *q = &pack[9*ii];
+			q[0] = tmp7[i]; // mass
+			q[1] = tmp1[i]; // x
+			q[2] = tmp2[i]; // y
+			q[3] = tmp3[i]; // z
+			q[4] = tmp4[i]; // vx
+			q[5] = tmp5[i]; // vy
+			q[6] = tmp6[i]; // vz
+			q[7] = (npcount+i<np_fine_dm_)? mass2eps( tmp7[i] ) : mass2eps_coarse( tmp7[i] ); // epsilon
+			q[8] = zero;    // potential
 		    }
-
-		}		
+		    write_packed( &pack[0], 9*n );
+		}
+		npcount += n2read;
 		
 		npleft -= n2read;
 		n2read = std::min( block_buf_size_,npleft );
@@ -591,6 +510,9 @@ protected:
             ifs_vz.close();
             ifs_m.close();
 	    
+	    if( bcombine )
+		for( int icomp=0; icomp<6; ++icomp )
+		    ifs_c[icomp].close();
 	    
 	    break;
 	}
@@ -702,8 +624,7 @@ public:
 	//... write data for dark matter......
 	size_t nptot = header_.ndark;
 	
-	std::vector<T_store> temp_dat;
-	temp_dat.reserve(block_buf_size_);
+	std::vector<T_store> temp_dat( block_buf_size_ );
 	
 	char temp_fname[256];
 	sprintf( temp_fname, "___ic_temp_%05d.bin", 100*id_dm_mass );
@@ -713,35 +634,20 @@ public:
 	size_t blksize = sizeof(T_store)*nptot;
 	ofs_temp.write( (char *)&blksize, sizeof(size_t) );
 	
-	size_t nwritten = 0;
-	for( int ilevel=gh.levelmax(); ilevel>=(int)gh.levelmin(); --ilevel )
+	size_t nwritten = 0, n;
+	particle_batches particles( gh, gh.levelmin(), gh.levelmax() );
+	while( (n = particles.next( &temp_dat[0], block_buf_size_, [&]( int ilevel, int, int, int ) -> double
+				{
+				    double pmass = omegam_/(1ul<<(3*ilevel));
+				    
+				    if( with_baryons_ && ilevel == (int)gh.levelmax() )
+					pmass *= (omegam_-omegab_)/omegam_;
+				    
+				    return pmass;
+				} )) > 0 )
 	{
-	    double pmass = omegam_/(1ul<<(3*ilevel));
-        
-            if( with_baryons_ && ilevel == (int)gh.levelmax() )
-                pmass *= (omegam_-omegab_)/omegam_;
-	    
-	    for( unsigned i=0; i<gh.get_grid(ilevel)->size(0); ++i )
-		for( unsigned j=0; j<gh.get_grid(ilevel)->size(1); ++j )
-		    for( unsigned k=0; k<gh.get_grid(ilevel)->size(2); ++k )
-			if( gh.is_in_mask(ilevel,i,j,k) && !gh.is_refined(ilevel,i,j,k) )
-			{
-			    if( temp_dat.size() <  block_buf_size_ )
-				temp_dat.push_back( pmass );	
-			    else
-			    {
-				ofs_temp.write( (char*)&temp_dat[0], sizeof(T_store)*block_buf_size_ );	
-				nwritten += block_buf_size_;
-				temp_dat.clear();
-				temp_dat.push_back( pmass );	
-			    }
-			}
-	}
-	
-	if( temp_dat.size() > 0 )
-	{	
-	    ofs_temp.write( (char*)&temp_dat[0], sizeof(T_store)*temp_dat.size() );		
-	    nwritten+=temp_dat.size();
+	    ofs_temp.write( (char*)&temp_dat[0], sizeof(T_store)*n );
+	    nwritten += n;
 	}
 	
 	if( nwritten != nptot )
@@ -762,9 +668,6 @@ public:
         {
             nptot = header_.nsph;
 	    
-            temp_dat.clear();
-            temp_dat.reserve(block_buf_size_);
-	    
             char temp_fnameb[256];
             sprintf( temp_fnameb, "___ic_temp_%05d.bin", 100*id_gas_mass );
             ofs_temp.open( temp_fnameb, std::ios::binary|std::ios::trunc );
@@ -779,28 +682,12 @@ public:
 	    
             pmass *= omegab_/omegam_;
 	    
-            for( unsigned i=0; i<gh.get_grid(ilevel)->size(0); ++i )
-                for( unsigned j=0; j<gh.get_grid(ilevel)->size(1); ++j )
-                    for( unsigned k=0; k<gh.get_grid(ilevel)->size(2); ++k )
-                    {
-                        if( gh.is_in_mask(ilevel,i,j,k) && !gh.is_refined(ilevel,i,j,k) )
-			  {
-			    if( temp_dat.size() <  block_buf_size_ )
-			      temp_dat.push_back( pmass );	
-			    else
-			      {
-				ofs_temp.write( (char*)&temp_dat[0], sizeof(T_store)*block_buf_size_ );	
-				nwritten += block_buf_size_;
-				temp_dat.clear();
-				temp_dat.push_back( pmass );	
-			      }
-			  }
-                    }
-	    
-            if( temp_dat.size() > 0 )
-            {	
-                ofs_temp.write( (char*)&temp_dat[0], sizeof(T_store)*temp_dat.size() );		
-                nwritten+=temp_dat.size();
+            particle_batches gas( gh, ilevel, ilevel );
+            while( (n = gas.next( &temp_dat[0], block_buf_size_, [&]( int, int, int, int ) -> double
+                                  {	return pmass;	} )) > 0 )
+            {
+                ofs_temp.write( (char*)&temp_dat[0], sizeof(T_store)*n );
+                nwritten += n;
             }
 	    
             if( nwritten != nptot ){
@@ -823,8 +710,7 @@ public:
     {
 	size_t nptot = gh.count_leaf_cells(gh.levelmin(), gh.levelmax());
 	
-	std::vector<T_store> temp_data;
-	temp_data.reserve( block_buf_size_ );
+	std::vector<T_store> temp_data( block_buf_size_ );
 	
 	
 	char temp_fname[256];
@@ -834,34 +720,19 @@ public:
 	size_t blksize = sizeof(T_store)*nptot;
 	ofs_temp.write( (char *)&blksize, sizeof(size_t) );
 	
-	size_t nwritten = 0;
-	for( int ilevel=gh.levelmax(); ilevel>=(int)gh.levelmin(); --ilevel )
-	    for( unsigned i=0; i<gh.get_grid(ilevel)->size(0); ++i )
-		for( unsigned j=0; j<gh.get_grid(ilevel)->size(1); ++j )
-		    for( unsigned k=0; k<gh.get_grid(ilevel)->size(2); ++k )
-			if( gh.is_in_mask(ilevel,i,j,k) && !gh.is_refined(ilevel,i,j,k) )
-			{
-			    double xx[3];
-			    gh.cell_pos(ilevel, i, j, k, xx);
-			    
-			    //xx[coord] = fmod( (xx[coord]+(*gh.get_grid(ilevel))(i,j,k)) + 1.0, 1.0 ) - 0.5;
-			    xx[coord] = (xx[coord]+(T_store)(*gh.get_grid(ilevel))(i,j,k)) - 0.5;
-			    
-			    if( temp_data.size() < block_buf_size_ )
-				temp_data.push_back( xx[coord] );
-			    else
-			    {
-				ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*block_buf_size_ );
-				nwritten += block_buf_size_;
-				temp_data.clear();
-				temp_data.push_back( xx[coord] );
-			    }
-			}
-	
-	if( temp_data.size() > 0 )
-	{	
-	    ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*temp_data.size() );
-	    nwritten += temp_data.size();
+	size_t nwritten = 0, n;
+	particle_batches particles( gh, gh.levelmin(), gh.levelmax() );
+	while( (n = particles.next( &temp_data[0], block_buf_size_, [&]( int ilevel, int i, int j, int k ) -> double
+				{
+				    double xx[3];
+				    gh.cell_pos(ilevel, i, j, k, xx);
+				    
+				    //xx[coord] = fmod( (xx[coord]+(*gh.get_grid(ilevel))(i,j,k)) + 1.0, 1.0 ) - 0.5;
+				    return (xx[coord]+(T_store)(*gh.get_grid(ilevel))(i,j,k)) - 0.5;
+				} )) > 0 )
+	{
+	    ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*n );
+	    nwritten += n;
 	}
 	
 	if( nwritten != nptot )
@@ -883,8 +754,7 @@ public:
     {
 	size_t nptot = gh.count_leaf_cells(gh.levelmin(), gh.levelmax());
 	
-	std::vector<T_store> temp_data;
-	temp_data.reserve( block_buf_size_ );
+	std::vector<T_store> temp_data( block_buf_size_ );
 	
 	double vfac = 2.894405/(100.0 * astart_); 
 	
@@ -896,28 +766,13 @@ public:
 	ofs_temp.write( (char *)&blksize, sizeof(size_t) );
 	
 	size_t nwritten = 0;
-	for( int ilevel=gh.levelmax(); ilevel>=(int)gh.levelmin(); --ilevel )
-	    for( unsigned i=0; i<gh.get_grid(ilevel)->size(0); ++i )
-		for( unsigned j=0; j<gh.get_grid(ilevel)->size(1); ++j )
-		    for( unsigned k=0; k<gh.get_grid(ilevel)->size(2); ++k )
-			if( gh.is_in_mask(ilevel,i,j,k) && !gh.is_refined(ilevel,i,j,k) )
-			{
-			    if( temp_data.size() < block_buf_size_ )
-				temp_data.push_back( (*gh.get_grid(ilevel))(i,j,k) * vfac );
-			    else 
-			    {
-				ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*block_buf_size_ );
-				nwritten += block_buf_size_;
-				temp_data.clear();
-				temp_data.push_back( (*gh.get_grid(ilevel))(i,j,k) * vfac );
-			    }
-			    
-			}
-	
-	if( temp_data.size() > 0 )
-	{	
-	    ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*temp_data.size() );
-	    nwritten += temp_data.size();
+	size_t n;
+	particle_batches particles( gh, gh.levelmin(), gh.levelmax() );
+	while( (n = particles.next( &temp_data[0], block_buf_size_, [&]( int ilevel, int i, int j, int k ) -> double
+				{	return (*gh.get_grid(ilevel))(i,j,k) * vfac;	} )) > 0 )
+	{
+	    ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*n );
+	    nwritten += n;
 	}
 	
 	if( nwritten != nptot )
@@ -956,8 +811,7 @@ public:
         //size_t npgas = gh.count_leaf_cells(gh.levelmax(), gh.levelmax());
 	size_t npart = gh.count_leaf_cells(gh.levelmin(), gh.levelmax());
 	
-	std::vector<T_store> temp_data;
-	temp_data.reserve( block_buf_size_ );
+	std::vector<T_store> temp_data( block_buf_size_ );
 	
 	double vfac = 2.894405/(100.0 * astart_); 
 	
@@ -970,28 +824,13 @@ public:
 	
 	size_t nwritten = 0;
 	
-	for( int ilevel=levelmax_; ilevel>=(int)levelmin_; --ilevel )
-	    for( unsigned i=0; i<gh.get_grid(ilevel)->size(0); ++i )
-		for( unsigned j=0; j<gh.get_grid(ilevel)->size(1); ++j )
-		    for( unsigned k=0; k<gh.get_grid(ilevel)->size(2); ++k )
-			if( gh.is_in_mask(ilevel,i,j,k) && !gh.is_refined(ilevel,i,j,k) )
-			{
-			    if( temp_data.size() < block_buf_size_ )
-				temp_data.push_back( (*gh.get_grid(ilevel))(i,j,k) * vfac );
-			    else 
-			    {
-				ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*block_buf_size_ );
-				nwritten += block_buf_size_;
-				temp_data.clear();
-				temp_data.push_back( (*gh.get_grid(ilevel))(i,j,k) * vfac );
-			    }
-			    
-			}
-	
-	if( temp_data.size() > 0 )
-	{	
-	    ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*temp_data.size() );
-	    nwritten += temp_data.size();
+	size_t n;
+	particle_batches particles( gh, levelmin_, levelmax_ );
+	while( (n = particles.next( &temp_data[0], block_buf_size_, [&]( int ilevel, int i, int j, int k ) -> double
+				{	return (*gh.get_grid(ilevel))(i,j,k) * vfac;	} )) > 0 )
+	{
+	    ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*n );
+	    nwritten += n;
 	}
 	
 	if( nwritten != npart )
@@ -1016,8 +855,7 @@ public:
         //size_t npgas = gh.count_leaf_cells(gh.levelmax(), gh.levelmax());
 	size_t npart = gh.count_leaf_cells(gh.levelmin(), gh.levelmax());
 	
-	std::vector<T_store> temp_data;
-	temp_data.reserve( block_buf_size_ );
+	std::vector<T_store> temp_data( block_buf_size_ );
 	
 	
 	char temp_fname[256];
@@ -1030,40 +868,23 @@ public:
         double h = 1.0/(1ul<<gh.levelmax());
 	
 	
-	size_t nwritten = 0;
-	for( int ilevel=gh.levelmax(); ilevel>=(int)gh.levelmin(); --ilevel )
+	size_t nwritten = 0, n;
+	particle_batches particles( gh, gh.levelmin(), gh.levelmax() );
+	while( (n = particles.next( &temp_data[0], block_buf_size_, [&]( int ilevel, int i, int j, int k ) -> double
+				{
+				    double xx[3];
+				    gh.cell_pos(ilevel, i, j, k, xx);
+				    
+				    //... shift particle positions (this has to be done as the same shift
+				    //... is used when computing the convolution kernel for SPH baryons)
+				    xx[coord] += 0.5*h;
+				    
+				    //xx[coord] = fmod( (xx[coord]+(*gh.get_grid(ilevel))(i,j,k)) + 1.0, 1.0 ) - 0.5;
+				    return (xx[coord]+(T_store)(*gh.get_grid(ilevel))(i,j,k)) - 0.5;
+				} )) > 0 )
 	{
-	    for( unsigned i=0; i<gh.get_grid(ilevel)->size(0); ++i )
-		for( unsigned j=0; j<gh.get_grid(ilevel)->size(1); ++j )
-		    for( unsigned k=0; k<gh.get_grid(ilevel)->size(2); ++k )
-			if( gh.is_in_mask(ilevel,i,j,k) && !gh.is_refined(ilevel,i,j,k) )
-			{
-			    double xx[3];
-			    gh.cell_pos(ilevel, i, j, k, xx);
-			    
-			    //... shift particle positions (this has to be done as the same shift
-			    //... is used when computing the convolution kernel for SPH baryons)
-			    xx[coord] += 0.5*h;
-			    
-			    //xx[coord] = fmod( (xx[coord]+(*gh.get_grid(ilevel))(i,j,k)) + 1.0, 1.0 ) - 0.5;
-			    xx[coord] = (xx[coord]+(T_store)(*gh.get_grid(ilevel))(i,j,k)) - 0.5;
-			    
-			    if( temp_data.size() < block_buf_size_ )
-				temp_data.push_back( xx[coord] );
-			    else
-			    {
-				ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*block_buf_size_ );
-				nwritten += block_buf_size_;
-				temp_data.clear();
-				temp_data.push_back( xx[coord] );
-			    }
-			}
-	}
-	
-	if( temp_data.size() > 0 )
-	{	
-	    ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*temp_data.size() );
-	    nwritten += temp_data.size();
+	    ofs_temp.write( (char*)&temp_data[0], sizeof(T_store)*n );
+	    nwritten += n;
 	}
 	
 	if( nwritten != npart )
@@ -1092,6 +913,9 @@ public:
     }
 };
 
+template< typename T >
+const size_t tipsy_output_plugin<T>::pack_block_;
+
 template<>
 int tipsy_output_plugin<float>::xdr_dump( XDR *xdrs, float*p )
 {
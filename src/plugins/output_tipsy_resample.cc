@@ -17,6 +17,7 @@
 #include <unistd.h>
 
 #include "output.hh"
+#include "byte_order.hh"
 
 
 template < typename T_store = float >class tipsy_output_plugin_res:public output_plugin
@@ -133,7 +134,7 @@ protected:
 
         }
 
-        void open (std::string fname, size_t npart)
+        void open (std::string fname, size_t npart, size_t offset = 0)
         {
             std::ifstream::open (fname.c_str (), std::ios::binary);
             size_t blk;
@@ -152,6 +153,8 @@ protected:
                 LOGERR ("Expected %d bytes in temp file but found %d", npart * (unsigned) sizeof (T_store), blk);
                 throw std::runtime_error("Internal consistency error in TIPSY output plug-in");
             }
+
+            this->seekg (offset, std::ios::cur);
         }
     };
     
@@ -222,6 +225,20 @@ protected:
         return 0;
     }
 
+    //! particles packed per block are written with one call in XDR (big endian) byte order
+    static const size_t pack_block_ = 1 << 18;
+
+    void write_packed (T_store * p, size_t nvalues)
+    {
+        byte_order::to_big_endian (p, nvalues);
+
+        if (fwrite (p, sizeof (T_store), nvalues, fp_) != nvalues)
+        {
+            LOGERR ("TIPSY : I/O error while writing output file \'%s\'", fname_.c_str ());
+            throw std::runtime_error ("I/O error while writing TIPSY output file");
+        }
+    }
+
     int convert_header_XDR (XDR * pxdrs, struct dump *ph)
     {
         int pad = 0;
@@ -249,98 +266,23 @@ protected:
         return pow (m / omegam_, 0.333333333333) * epsfac_;
     }
 
-    void combine_components_for_coarse (void)
+    //! mass weight the coarse particles among n DM values starting at DM index p with the gas values read from gas
+    void combine_coarse (size_t p, size_t n, T_store * c, pistream & gas, T_store * buf)
     {
-        const size_t
-            nptot = np_fine_dm_ + np_coarse_dm_,
-            npfine = np_fine_dm_, npcoarse = np_coarse_dm_;
-
-        std::vector < T_store > tmp1, tmp2;
-
-        tmp1.assign (block_buf_size_, 0.0);
-        tmp2.assign (block_buf_size_, 0.0);
+        if (p + n <= np_fine_dm_)
+            return;
 
+        size_t i0 = (p < np_fine_dm_) ? np_fine_dm_ - p : 0, m = n - i0;
         double facb = omegab_ / omegam_, facc = (omegam_ - omegab_) / omegam_;
 
-
-        for (int icomp = 0; icomp < 3; ++icomp)
-        {
-            char fc[256], fb[256];
-            postream iffs1, iffs2;
-
-                /*** positions ***/
-
-            sprintf (fc, "___ic_temp_%05d.bin", 100 * id_dm_pos + icomp);
-            sprintf (fb, "___ic_temp_%05d.bin", 100 * id_gas_pos + icomp);
-
-            iffs1.open (fc, nptot, npfine * sizeof (T_store));
-            iffs2.open (fb, nptot, npfine * sizeof (T_store));
-
-            size_t npleft = npcoarse;
-            size_t n2read = std::min ((size_t) block_buf_size_, npleft);
-            while (n2read > 0ul)
-            {
-                std::streampos sp = iffs1.tellg ();
-                iffs1.read (reinterpret_cast < char *>(&tmp1[0]), n2read * sizeof (T_store));
-                iffs2.read (reinterpret_cast < char *>(&tmp2[0]), n2read * sizeof (T_store));
-
-                for (size_t i = 0; i < n2read; ++i)
-                {
-                    tmp1[i] = facc * tmp1[i] + facb * tmp2[i];
-                }
-
-                iffs1.seekp (sp);
-                iffs1.write (reinterpret_cast < char *>(&tmp1[0]), n2read * sizeof (T_store));
-
-                npleft -= n2read;
-                n2read = std::min ((size_t) block_buf_size_, npleft);
-            }
-
-            iffs1.close ();
-            iffs2.close ();
-
-            /*** velocities ***/
-
-            sprintf (fc, "___ic_temp_%05d.bin", 100 * id_dm_vel + icomp);
-            sprintf (fb, "___ic_temp_%05d.bin", 100 * id_gas_vel + icomp);
-
-            iffs1.open (fc, nptot, npfine * sizeof (T_store));
-            iffs2.open (fb, nptot, npfine * sizeof (T_store));
-
-            npleft = npcoarse;
-            n2read = std::min ((size_t) block_buf_size_, npleft);
-
-            while (n2read > 0ul)
-            {
-                std::streampos sp = iffs1.tellg ();
-                iffs1.read (reinterpret_cast < char *>(&tmp1[0]), n2read * sizeof (T_store));
-                iffs2.read (reinterpret_cast < char *>(&tmp2[0]), n2read * sizeof (T_store));
-
-                for (size_t i = 0; i < n2read; ++i)
-                {
-                    tmp1[i] = facc * tmp1[i] + facb * tmp2[i];
-                }
-
-                iffs1.seekp (sp);
-                iffs1.write (reinterpret_cast < char *>(&tmp1[0]), n2read * sizeof (T_store));
-
-                npleft -= n2read;
-                n2read = std::min ((size_t) block_buf_size_, npleft);
-            }
-
-            iffs1.close ();
-            iffs2.close ();
-        }
-
+        gas.read (reinterpret_cast < char *>(buf), m * sizeof (T_store));
+        for (size_t i = 0; i < m; ++i)
+            c[i0 + i] = facc * c[i0 + i] + facb * buf[i];
     }
 
     void assemble_tipsy_file (void)
     {
 
-        if (with_baryons_ && bmultimass_)
-            combine_components_for_coarse ();
-
-
         fp_ = fopen (fname_.c_str (), "w+");
 
         //............................................................................
@@ -400,6 +342,7 @@ protected:
 
 
         T_store zero = (T_store) 0.0;
+        std::vector < T_store > pack (12 * std::min (pack_block_, (size_t) block_buf_size_));
 
         while (true)
           {
@@ -408,9 +351,6 @@ protected:
         xdrstdio_create (&xdrs, fp_, XDR_ENCODE);
         convert_header_XDR (&xdrs, &header_);
 
-        std::vector < T_store > dump_store (9 * block_buf_size_,
-                            (T_store) 0.0);
-
         //... sph particles ..................................................
         if (with_baryons_)
         {
@@ -465,26 +405,30 @@ protected:
             ifs_m.read (reinterpret_cast < char *>(&tmp7[0]),
                     n2read * sizeof (T_store));
 
-            for (size_t i = 0; i < n2read; ++i)
+            for (size_t i0 = 0; i0 < n2read; i0 += pack_block_)
             {
-                xdr_dump (&xdrs, &tmp7[i]);	// mass
-                xdr_dump (&xdrs, &tmp1[i]);	// x
-                xdr_dump (&xdrs, &tmp2[i]);	// y
-                xdr_dump (&xdrs, &tmp3[i]);	// z
-                xdr_dump (&xdrs, &tmp4[i]);	// vx
-                xdr_dump (&xdrs, &tmp5[i]);	// vy
-                xdr_dump (&xdrs, &tmp6[i]);	// vz
-                xdr_dump (&xdrs, &zero);	// rho
-                xdr_dump (&xdrs, &temperature);	// temp
-
-                T_store eps = mass2eps (tmp7[i]);
-
-                xdr_dump (&xdrs, &eps);	// epsilon / hsmooth
-                xdr_dump (&xdrs, &zero);	// metals
-                xdr_dump (&xdrs, &zero);	//potential
-            }
-
+                const size_t n = std::min (pack_block_, (size_t) n2read - i0);
 
+                #pragma omp parallel for
+                for (long long ii = 0; ii < (long long) n; ++ii)
+                {
+                    size_t i = i0 + ii;
+                    T_store *q = &pack[12 * ii];
+                    q[0] = tmp7[i];	// mass
+                    q[1] = tmp1[i];	// x
+                    q[2] = tmp2[i];	// y
+                    q[3] = tmp3[i];	// z
+                    q[4] = tmp4[i];	// vx
+                    q[5] = tmp5[i];	// vy
+                    q[6] = tmp6[i];	// vz
+                    q[7] = zero;	// rho
+                    q[8] = temperature;	// temp
+                    q[9] = mass2eps (tmp7[i]);	// epsilon / hsmooth
+                    q[10] = zero;	// metals
+                    q[11] = zero;	//potential
+                }
+                write_packed (&pack[0], 12 * n);
+            }
 
             npleft -= n2read;
             n2read = std::min (block_buf_size_, npleft);
@@ -513,7 +457,21 @@ protected:
 	ifs_vz.open (fnvz, npcdm);
 	ifs_m.open (fnm, npcdm);
 
+	//... coarse DM particles are combined with the coarse gas while they are copied
+	const bool bcombine = with_baryons_ && bmultimass_;
+	const char *fnc[6] = { fnbx, fnby, fnbz, fnbvx, fnbvy, fnbvz };
+	T_store *tmpc[6] = { tmp1, tmp2, tmp3, tmp4, tmp5, tmp6 };
+	pistream ifs_c[6];
+	std::vector < T_store > bufc;
+	if (bcombine)
+	{
+	    for (int icomp = 0; icomp < 6; ++icomp)
+		ifs_c[icomp].open (fnc[icomp], npcdm, np_fine_dm_ * sizeof (T_store));
+	    bufc.resize (block_buf_size_);
+	}
+
 	npleft = npcdm;
+	size_t npcount = 0;
 	n2read = std::min (block_buf_size_, npleft);
               while (n2read > 0)
               {
@@ -532,25 +490,33 @@ protected:
                   ifs_m.read (reinterpret_cast < char *>(&tmp7[0]),
                               n2read * sizeof (T_store));
 
-                for (size_t i = 0; i < n2read; ++i)
-                {
-                    xdr_dump (&xdrs, &tmp7[i]);	// mass
-                    xdr_dump (&xdrs, &tmp1[i]);	// x
-                    xdr_dump (&xdrs, &tmp2[i]);	// y
-                    xdr_dump (&xdrs, &tmp3[i]);	// z
-                    xdr_dump (&xdrs, &tmp4[i]);	// vx
-                    xdr_dump (&xdrs, &tmp5[i]);	// vy
-                    xdr_dump (&xdrs, &tmp6[i]);	// vz
+                if (bcombine)
+                    for (int icomp = 0; icomp < 6; ++icomp)
+                        combine_coarse (npcount, n2read, tmpc[icomp], ifs_c[icomp], &bufc[0]);
+                npcount += n2read;
 
-                    T_store eps = mass2eps (tmp7[i]);
-
-                    xdr_dump (&xdrs, &eps);	// epsilon
-                    xdr_dump (&xdrs, &zero);	//potential
+                for (size_t i0 = 0; i0 < n2read; i0 += pack_block_)
+                {
+                    const size_t n = std::min (pack_block_, (size_t) n2read - i0);
 
+                    #pragma omp parallel for
+                    for (long long ii = 0; ii < (long long) n; ++ii)
+                    {
+                        size_t i = i0 + ii;
+                        T_store *q = &pack[9 * ii];
+                        q[0] = tmp7[i];	// mass
+                        q[1] = tmp1[i];	// x
+                        q[2] = tmp2[i];	// y
+                        q[3] = tmp3[i];	// z
+                        q[4] = tmp4[i];	// vx
+                        q[5] = tmp5[i];	// vy
+                        q[6] = tmp6[i];	// vz
+                        q[7] = mass2eps (tmp7[i]);	// epsilon
+                        q[8] = zero;	//potential
+                    }
+                    write_packed (&pack[0], 9 * n);
                 }
 
-
-
                 npleft -= n2read;
                 n2read = std::min (block_buf_size_, npleft);
             }
@@ -563,6 +529,9 @@ protected:
               ifs_vz.close ();
               ifs_m.close ();
 
+	if (bcombine)
+	    for (int icomp = 0; icomp < 6; ++icomp)
+		ifs_c[icomp].close ();
 
               break;
           }
@@ -666,6 +635,96 @@ public:
 	}
     }
 
+    //! store one value per particle in the temporary file of field id: fres(i,j,k) for the resampled
+    //! particles if resampling, then f(ilevel,i,j,k) for the leaf cells of the levels lmin..levelmax
+    //! (without the finest level if it is resampled). Both are computed in parallel, a batch at a time.
+    template < typename FR, typename F >
+    void write_temp_file (int id, const char *what, const grid_hierarchy & gh, unsigned lmin, size_t nptot, FR fres, F f)
+    {
+        char temp_fname[256];
+        sprintf (temp_fname, "___ic_temp_%05d.bin", id);
+        std::ofstream ofs_temp (temp_fname, std::ios::binary | std::ios::trunc);
+
+        size_t blksize = sizeof (T_store) * nptot;
+        ofs_temp.write ((char *) &blksize, sizeof (size_t));
+
+        std::vector < T_store > temp_data (std::max (std::min ((size_t) block_buf_size_, nptot), np_resample_));
+        size_t nwritten = 0;
+
+        //... the resampled particles, whole rows in i,j,k order
+        if (bresample_)
+        {
+            const size_t nr = np_resample_, nrows = nr * nr;
+            const size_t rows_per_batch = std::max ((size_t) 1, temp_data.size () / nr);
+
+            //... read the finest level in before the threads sample it, a streamed level is not fetched thread-safely
+            gh.get_grid (gh.levelmax ());
+
+            for (size_t r0 = 0; r0 < nrows; r0 += rows_per_batch)
+            {
+                const size_t nbatch = std::min (rows_per_batch, nrows - r0);
+
+                #pragma omp parallel for
+                for (long long r = 0; r < (long long) nbatch; ++r)
+                {
+                    size_t i = (r0 + r) / nr, j = (r0 + r) % nr;
+                    T_store *p = &temp_data[r * nr];
+                    for (size_t k = 0; k < nr; ++k)
+                        p[k] = (T_store) fres (i, j, k);
+                }
+
+                ofs_temp.write ((char *) &temp_data[0], sizeof (T_store) * nbatch * nr);
+                nwritten += nbatch * nr;
+            }
+        }
+
+        //... the leaf cells, from the finest level to the coarsest
+        int lmax = bresample_ ? (int) gh.levelmax () - 1 : (int) gh.levelmax ();
+        if (lmax >= (int) lmin)
+        {
+            particle_batches particles (gh, lmin, lmax);
+            size_t n;
+            while ((n = particles.next (&temp_data[0], temp_data.size (), f)) > 0)
+            {
+                ofs_temp.write ((char *) &temp_data[0], sizeof (T_store) * n);
+                nwritten += n;
+            }
+        }
+
+        if (nwritten != nptot)
+        {
+            LOGERR ("TIPSY output plugin wrote %ld, should have %ld", nwritten, nptot);
+            throw std::runtime_error (std::string ("Internal consistency error while writing temporary file for ") + what);
+        }
+
+        //... dump to temporary file
+        ofs_temp.write ((char *) &blksize, sizeof (size_t));
+
+        if (ofs_temp.bad ())
+            throw std::runtime_error (std::string ("I/O error while writing temporary file for ") + what);
+    }
+
+    //! number of dark matter and of gas particles, with the resampled ones replacing the finest level
+    size_t count_particles (const grid_hierarchy & gh)
+    {
+        size_t npart = gh.count_leaf_cells (gh.levelmin (), gh.levelmax ());
+
+        if (bresample_)
+            npart += np_resample_ * np_resample_ * np_resample_ - gh.count_leaf_cells (gh.levelmax (), gh.levelmax ());
+
+        return npart;
+    }
+
+    //! the resampling grid: left edge, spacing of the particles and spacing in units of the finest cells
+    void resample_geometry (const grid_hierarchy & gh, double *left, double &h, double &q)
+    {
+        double right[3];
+        gh.grid_bbox (gh.levelmax (), left, right);
+        const double h0 = 1.0 / (1ul << gh.levelmax ());
+        h = (right[0] - left[0]) / np_resample_;
+        q = h / h0;
+    }
+
     void write_dm_mass (const grid_hierarchy & gh)
     {
         //.. get meta data about coarse/fine particle number
@@ -710,148 +769,34 @@ public:
 
 
         //... write data for dark matter......
-        size_t nptot = header_.ndark;
-
-        std::vector < T_store > temp_dat;
-        temp_dat.reserve (block_buf_size_);
-
-        char temp_fname[256];
-        sprintf (temp_fname, "___ic_temp_%05d.bin", 100 * id_dm_mass);
-        std::ofstream ofs_temp (temp_fname, std::ios::binary | std::ios::trunc);
-
-
-        size_t blksize = sizeof (T_store) * nptot;
-        ofs_temp.write ((char *) &blksize, sizeof (size_t));
-
-        size_t nwritten = 0;
-        for (int ilevel = gh.levelmax (); ilevel >= (int) gh.levelmin ();--ilevel)
+        std::vector < double > pmass (gh.levelmax () + 1, 0.0);
+        for (int ilevel = gh.levelmax (); ilevel >= (int) gh.levelmin (); --ilevel)
         {
-            double pmass = omegam_ / (1ul << (3 * ilevel));
-
-
+            pmass[ilevel] = omegam_ / (1ul << (3 * ilevel));
 
             if (with_baryons_ && ilevel == (int) gh.levelmax ())
-                pmass *= (omegam_ - omegab_) / omegam_;
-
-            if( ilevel == (int)gh.levelmax() && bresample_ )
-            {
-                pmass *= mass_ratio;
-
-                for (unsigned i = 0; i < np_resample_; ++i)
-                    for (unsigned j = 0; j < np_resample_; ++j)
-                        for (unsigned k = 0; k < np_resample_; ++k)
-                        {
-	                    if (temp_dat.size () < block_buf_size_)
-                                temp_dat.push_back (pmass);
-                            else
-                            {
-                                ofs_temp.write ((char *) &temp_dat[0], sizeof (T_store) * block_buf_size_);
-                                nwritten += block_buf_size_;
-                                temp_dat.clear ();
-                                temp_dat.push_back (pmass);
-                            }
-                        }
-            }
-            else
-            {
-                for (unsigned i = 0; i < gh.get_grid (ilevel)->size (0); ++i)
-                    for (unsigned j = 0; j < gh.get_grid (ilevel)->size (1); ++j)
-                        for (unsigned k = 0; k < gh.get_grid (ilevel)->size (2); ++k)
-                            if (!gh.is_refined (ilevel, i, j, k))
-                            {
-			      if (temp_dat.size () < block_buf_size_)
-                                    temp_dat.push_back (pmass);
-                                else
-                                {
-                                    ofs_temp.write ((char *) &temp_dat[0], sizeof (T_store) * block_buf_size_);
-                                    nwritten += block_buf_size_;
-                                    temp_dat.clear ();
-                                    temp_dat.push_back (pmass);
-                                }
-                            }
-            }
+                pmass[ilevel] *= (omegam_ - omegab_) / omegam_;
         }
+        const double pmass_res = pmass[gh.levelmax ()] * mass_ratio;
 
-        if (temp_dat.size () > 0)
-        {
-            ofs_temp.write ((char *) &temp_dat[0], sizeof (T_store) * temp_dat.size ());
-            nwritten += temp_dat.size ();
-        }
-
-      
-        if (nwritten != nptot)
-        {
-            LOGERR ("TIPSY output plugin wrote %ld, should have %ld", nwritten, nptot);
-            throw std::runtime_error("Internal consistency error while writing temporary file for DM masses");
-        }
-        ofs_temp.write ((char *) &blksize, sizeof (size_t));
-
-        if (ofs_temp.bad ())
-            throw std::runtime_error("I/O error while writing temporary file for DM masses");
-
-
-        ofs_temp.close ();
+        write_temp_file (100 * id_dm_mass, "DM masses", gh, gh.levelmin (), header_.ndark,
+            [&](size_t, size_t, size_t) { return pmass_res; },
+            [&](int ilevel, int, int, int) { return pmass[ilevel]; });
 
         //... write data for baryons......
         if (with_baryons_)
         {
-            nptot = header_.nsph;
-
-            temp_dat.clear ();
-            temp_dat.reserve (block_buf_size_);
-
-            char temp_fname[256];
-            sprintf (temp_fname, "___ic_temp_%05d.bin", 100 * id_gas_mass);
-            ofs_temp.open (temp_fname, std::ios::binary | std::ios::trunc);
-
-
-            blksize = sizeof (T_store) * nptot;
-            ofs_temp.write ((char *) &blksize, sizeof (size_t));
-
-            nwritten = 0;
             int ilevel = gh.levelmax ();
-            double pmass = omegam_ / (1ul << (3 * ilevel));
-
-            pmass *= omegab_ / omegam_;
-            
-            unsigned nx = gh.get_grid (ilevel)->size (0);
-            unsigned ny = gh.get_grid (ilevel)->size (1);
-            unsigned nz = gh.get_grid (ilevel)->size (2);
-            
-            if( bresample_ )
-	    {
-		nx = ny = nz = np_resample_;
-		pmass *= pow((double) gh.get_grid(ilevel)->size(0)/(double)np_resample_,3.0);
-	    }
-            
-	    for (unsigned i = 0; i < nx; ++i)
-                for (unsigned j = 0; j < ny; ++j)
-                    for (unsigned k = 0; k < nz; ++k)
-                    {
-                        if (temp_dat.size () < block_buf_size_)
-                            temp_dat.push_back (pmass);
-                        else
-                        {
-                            ofs_temp.write ((char *) &temp_dat[0], sizeof (T_store) * block_buf_size_);
-                            nwritten += block_buf_size_;
-                            temp_dat.clear ();
-                            temp_dat.push_back (pmass);
-                        }
-                    }
-
-            if (temp_dat.size () > 0)
-            {
-                ofs_temp.write ((char *) &temp_dat[0], sizeof (T_store) * temp_dat.size ());
-                nwritten += temp_dat.size ();
-            }
+            double bmass = omegam_ / (1ul << (3 * ilevel));
 
-            if (nwritten != nptot)
-                throw std::runtime_error("Internal consistency error while writing temporary file for baryon masses");
+            bmass *= omegab_ / omegam_;
 
-            ofs_temp.write ((char *) &blksize, sizeof (size_t));
+            if( bresample_ )
+                bmass *= pow((double) gh.get_grid(ilevel)->size(0)/(double)np_resample_,3.0);
 
-            if (ofs_temp.bad ())
-                throw std::runtime_error("I/O error while writing temporary file for baryon masses");
+            write_temp_file (100 * id_gas_mass, "baryon masses", gh, ilevel, header_.nsph,
+                [&](size_t, size_t, size_t) { return bmass; },
+                [&](int, int, int, int) { return bmass; });
         }
 
 	// output statistics if resampling is enabled
@@ -940,208 +885,42 @@ public:
 
     void write_dm_position (int coord, const grid_hierarchy & gh)
     {
-        size_t nptot = gh.count_leaf_cells (gh.levelmin (), gh.levelmax ());
-          
-          if( bresample_ )
-              nptot += np_resample_*np_resample_*np_resample_ - gh.count_leaf_cells (gh.levelmax (), gh.levelmax ());
-
-        std::vector < T_store > temp_data;
-        temp_data.reserve (block_buf_size_);
-
-
-        char temp_fname[256];
-        sprintf (temp_fname, "___ic_temp_%05d.bin", 100 * id_dm_pos + coord);
-        std::ofstream ofs_temp (temp_fname, std::ios::binary | std::ios::trunc);
-
-        size_t blksize = sizeof (T_store) * nptot;
-        ofs_temp.write ((char *) &blksize, sizeof (size_t));
-         
-	size_t nwritten = 0;
-          
-          if( bresample_ )
-          {
-              double left[3], right[3], xx[3];
-              
-              gh.grid_bbox(gh.levelmax(), left, right );
-              const double h0 = 1.0/(1ul<<gh.levelmax());
-              const double h = (right[0] - left[0])/np_resample_;
-              const double q = h / h0;
-              
-              for( size_t i=0; i<np_resample_; ++i )
-              {
-                  xx[0] = left[0] + ((double)i+0.5)*h;
-                  for( size_t j=0; j<np_resample_; ++j )
-                  {
-                      xx[1] = left[1] + ((double)j+0.5)*h;
-                      for( size_t k=0; k<np_resample_; ++k )
-                      {
-                          xx[2] = left[2] + ((double)k+0.5)*h;
-                          
-			  real_t dx = get_cic(gh, ((double)i+0.5)*q-0.5, ((double)j+0.5)*q-0.5, ((double)k+0.5)*q-0.5 );
-			  real_t pos = (xx[coord]-0.5) + dx;
-
-                          if (temp_data.size () < block_buf_size_)
-			      temp_data.push_back (pos);   
-			  else
-                          {
-                              ofs_temp.write ((char *) &temp_data[0],
-                                              sizeof (T_store) * block_buf_size_);
-                              nwritten += block_buf_size_;
-                              temp_data.clear ();
-                              temp_data.push_back (pos);
-                          }
-                          
-                      }
-                  }
-              }
-          }
-
-    
-        for (int ilevel = gh.levelmax (); ilevel >= (int) gh.levelmin (); --ilevel)
-            for (unsigned i = 0; i < gh.get_grid (ilevel)->size (0); ++i)
-                for (unsigned j = 0; j < gh.get_grid (ilevel)->size (1); ++j)
-                    for (unsigned k = 0; k < gh.get_grid (ilevel)->size (2); ++k)
-                        if (!gh.is_refined (ilevel, i, j, k))
-                        {
-                            if( ilevel==(int)gh.levelmax() && bresample_ )
-                                continue;
-                            
-                            double xx[3];
-                            gh.cell_pos (ilevel, i, j, k, xx);
-                            xx[coord] = (xx[coord] + (*gh.get_grid (ilevel)) (i, j, k)) - 0.5;
-
-                            if (temp_data.size () < block_buf_size_)
-                              temp_data.push_back (xx[coord]);
-                            else
-                              {
-                                ofs_temp.write ((char *) &temp_data[0],
-                                        sizeof (T_store) * block_buf_size_);
-                                nwritten += block_buf_size_;
-                                temp_data.clear ();
-                                temp_data.push_back (xx[coord]);
-                              }
-                        }
-
-        if (temp_data.size () > 0)
-        {
-            ofs_temp.write ((char *) &temp_data[0], sizeof (T_store) * temp_data.size ());
-            nwritten += temp_data.size ();
-        }
-
-        if (nwritten != nptot)
-          {
-        LOGERR ("TIPSY output plugin wrote %ld, should have %ld", nwritten,
-            nptot);
-        throw std::
-          runtime_error
-          ("Internal consistency error while writing temporary file for positions");
-          }
-
-        //... dump to temporary file
-        ofs_temp.write ((char *) &blksize, sizeof (size_t));
-
-        if (ofs_temp.bad ())
-          throw std::
-        runtime_error
-        ("I/O error while writing temporary file for positions");
+        double left[3], h = 0.0, q = 0.0;
+        if( bresample_ )
+            resample_geometry (gh, left, h, q);
 
-        ofs_temp.close ();
+        write_temp_file (100 * id_dm_pos + coord, "positions", gh, gh.levelmin (), count_particles (gh),
+            [&](size_t i, size_t j, size_t k) -> real_t
+            {
+                const size_t idx[3] = { i, j, k };
+                double xx = left[coord] + ((double)idx[coord]+0.5)*h;
+                real_t dx = get_cic(gh, ((double)i+0.5)*q-0.5, ((double)j+0.5)*q-0.5, ((double)k+0.5)*q-0.5 );
+                return (xx-0.5) + dx;
+            },
+            [&](int ilevel, int i, int j, int k)
+            {
+                double xx[3];
+                gh.cell_pos (ilevel, i, j, k, xx);
+                return (xx[coord] + (*gh.get_grid (ilevel)) (i, j, k)) - 0.5;
+            });
     }
 
     void write_dm_velocity (int coord, const grid_hierarchy & gh)
     {
-        size_t nptot = gh.count_leaf_cells (gh.levelmin (), gh.levelmax ());
-
-          if( bresample_ )
-              nptot += np_resample_*np_resample_*np_resample_ - gh.count_leaf_cells (gh.levelmax (), gh.levelmax ());
-
-          
-          
-        std::vector < T_store > temp_data;
-        temp_data.reserve (block_buf_size_);
-
         double vfac = 2.894405 / (100.0 * astart_);
 
-        char temp_fname[256];
-        sprintf (temp_fname, "___ic_temp_%05d.bin", 100 * id_dm_vel + coord);
-        std::ofstream ofs_temp (temp_fname, std::ios::binary | std::ios::trunc);
-
-        size_t blksize = sizeof (T_store) * nptot;
-        ofs_temp.write ((char *) &blksize, sizeof (size_t));
-
-        size_t nwritten = 0;
-          
+        double left[3], h = 0.0, q = 0.0;
         if( bresample_ )
-        {
-            double left[3], right[3];
-          
-            gh.grid_bbox(gh.levelmax(), left, right );
-            const double h0 = 1.0/(1ul<<gh.levelmax());
-            const double h = (right[0] - left[0])/np_resample_;
-            const double q = h / h0;
-          
-          
-          
-            for( size_t i=0; i<np_resample_; ++i )
-                for( size_t j=0; j<np_resample_; ++j )
-                    for( size_t k=0; k<np_resample_; ++k )
-                    {
-                        real_t v = get_cic(gh, ((double)i+0.5)*q-0.5, ((double)j+0.5)*q-0.5, ((double)k+0.5)*q-0.5 );
-                      
-                        if (temp_data.size () < block_buf_size_)
-                            temp_data.push_back (v*vfac);
-                        else
-                        {
-                            ofs_temp.write ((char *) &temp_data[0], sizeof (T_store) * block_buf_size_);
-                            nwritten += block_buf_size_;
-                            temp_data.clear ();
-                            temp_data.push_back (v*vfac);
-                        }
-                      
-                    }
-        }
-      
-      
-        for (int ilevel = gh.levelmax (); ilevel >= (int) gh.levelmin (); --ilevel)
-            for (unsigned i = 0; i < gh.get_grid (ilevel)->size (0); ++i)
-                for (unsigned j = 0; j < gh.get_grid (ilevel)->size (1); ++j)
-                    for (unsigned k = 0; k < gh.get_grid (ilevel)->size (2); ++k)
-                        if (!gh.is_refined (ilevel, i, j, k))
-                        {
-                            if( ilevel==(int)gh.levelmax() && bresample_ )
-                                continue;
-                            
-                            if (temp_data.size () < block_buf_size_)
-                                temp_data.push_back ((*gh.get_grid (ilevel)) (i, j, k) * vfac);
-                            else
-                            {
-                                ofs_temp.write ((char *) &temp_data[0], sizeof (T_store) * block_buf_size_);
-                                nwritten += block_buf_size_;
-                                temp_data.clear ();
-                                temp_data.push_back ((*gh.get_grid (ilevel)) (i, j, k) * vfac);
-                            }
-
-                        }
-
-        if (temp_data.size () > 0)
-        {
-            ofs_temp.write ((char *) &temp_data[0], sizeof (T_store) * temp_data.size ());
-            nwritten += temp_data.size ();
-        }
+            resample_geometry (gh, left, h, q);
 
-        if (nwritten != nptot)
-        {
-            LOGERR ("TIPSY output plugin wrote %ld, should have %ld", nwritten, nptot);
-            throw std::runtime_error("Internal consistency error while writing temporary file for DM velocities");
-        }
-
-        //... dump to temporary file
-        ofs_temp.write ((char *) &blksize, sizeof (size_t));
-
-        if (ofs_temp.bad ())
-            throw std::runtime_error("I/O error while writing temporary file for DM velocities");
-
-        ofs_temp.close ();
+        write_temp_file (100 * id_dm_vel + coord, "DM velocities", gh, gh.levelmin (), count_particles (gh),
+            [&](size_t i, size_t j, size_t k)
+            {
+                real_t v = get_cic(gh, ((double)i+0.5)*q-0.5, ((double)j+0.5)*q-0.5, ((double)k+0.5)*q-0.5 );
+                return v*vfac;
+            },
+            [&](int ilevel, int i, int j, int k)
+            {   return (*gh.get_grid (ilevel)) (i, j, k) * vfac;   });
     }
 
     void write_dm_density (const grid_hierarchy & gh)
@@ -1162,211 +941,49 @@ public:
     //... write data for gas
     void write_gas_velocity (int coord, const grid_hierarchy & gh)
     {
-        //size_t npgas = gh.count_leaf_cells(gh.levelmax(), gh.levelmax());
-        size_t npart = gh.count_leaf_cells (gh.levelmin (), gh.levelmax ());
-        
-        if( bresample_ )
-            npart += np_resample_*np_resample_*np_resample_ - gh.count_leaf_cells (gh.levelmax (), gh.levelmax ());
-
-        std::vector < T_store > temp_data;
-        temp_data.reserve (block_buf_size_);
-
         double vfac = 2.894405 / (100.0 * astart_);
 
-        char temp_fname[256];
-        sprintf (temp_fname, "___ic_temp_%05d.bin", 100 * id_gas_vel + coord);
-        std::ofstream ofs_temp (temp_fname, std::ios::binary | std::ios::trunc);
-
-        size_t blksize = sizeof (T_store) * npart;
-        ofs_temp.write ((char *) &blksize, sizeof (size_t));
-
-        size_t nwritten = 0;
-          
+        double left[3], h = 0.0, q = 0.0;
         if( bresample_ )
-        {
-            double left[3], right[3];
-            
-            gh.grid_bbox(gh.levelmax(), left, right );
-            const double h0 = 1.0/(1ul<<gh.levelmax());
-            const double h = (right[0] - left[0])/np_resample_;
-            const double q = h / h0;
-            
-            for( size_t i=0; i<np_resample_; ++i )
-                for( size_t j=0; j<np_resample_; ++j )
-                    for( size_t k=0; k<np_resample_; ++k )
-                    {
-                        real_t v = get_cic(gh, ((double)i+0.5)*q-0.5, ((double)j+0.5)*q-0.5, ((double)k+0.5)*q-0.5 );
-                        
-                        if (temp_data.size () < block_buf_size_)
-                            temp_data.push_back (v*vfac);
-                        else
-                        {
-                            ofs_temp.write ((char *) &temp_data[0], sizeof (T_store) * block_buf_size_);
-                            nwritten += block_buf_size_;
-                            temp_data.clear ();
-                            temp_data.push_back (v*vfac);
-                        }
-                        
-                    }
-        }
-
-        for (int ilevel = levelmax_; ilevel >= (int) levelmin_; --ilevel)
-            for (unsigned i = 0; i < gh.get_grid (ilevel)->size (0); ++i)
-                for (unsigned j = 0; j < gh.get_grid (ilevel)->size (1); ++j)
-                    for (unsigned k = 0; k < gh.get_grid (ilevel)->size (2); ++k)
-                        if (!gh.is_refined (ilevel, i, j, k))
-                        {
-                            
-                            if( ilevel==(int)gh.levelmax() && bresample_ )
-                                continue;
-                            
-                            if (temp_data.size () < block_buf_size_)
-                                temp_data.push_back ((*gh.get_grid (ilevel)) (i, j, k) * vfac);
-                            else
-                            {
-                                ofs_temp.write ((char *) &temp_data[0], sizeof (T_store) * block_buf_size_);
-                                nwritten += block_buf_size_;
-                                temp_data.clear ();
-                                temp_data.push_back ((*gh.get_grid (ilevel)) (i, j, k) * vfac);
-                            }
-
-                        }
-
-        if (temp_data.size () > 0)
-        {
-            ofs_temp.write ((char *) &temp_data[0], sizeof (T_store) * temp_data.size ());
-            nwritten += temp_data.size ();
-        }
+            resample_geometry (gh, left, h, q);
 
-        if (nwritten != npart)
-        {
-            LOGERR ("TIPSY output plugin wrote %ld, should have %ld", nwritten, npart);
-            throw std::runtime_error("Internal consistency error while writing temporary file for baryon velocities");
-        }
-
-        //... dump to temporary file
-        ofs_temp.write ((char *) &blksize, sizeof (size_t));
-
-        if (ofs_temp.bad ())
-            throw std::runtime_error("I/O error while writing temporary file for baryon velocities");
-
-        ofs_temp.close ();
+        write_temp_file (100 * id_gas_vel + coord, "baryon velocities", gh, gh.levelmin (), count_particles (gh),
+            [&](size_t i, size_t j, size_t k)
+            {
+                real_t v = get_cic(gh, ((double)i+0.5)*q-0.5, ((double)j+0.5)*q-0.5, ((double)k+0.5)*q-0.5 );
+                return v*vfac;
+            },
+            [&](int ilevel, int i, int j, int k)
+            {   return (*gh.get_grid (ilevel)) (i, j, k) * vfac;   });
     }
 
 
     //... write only for fine level
     void write_gas_position (int coord, const grid_hierarchy & gh)
     {
-        //size_t npgas = gh.count_leaf_cells(gh.levelmax(), gh.levelmax());
-        size_t npart = gh.count_leaf_cells (gh.levelmin (), gh.levelmax ());
-        
+        double left[3], h = 0.0, q = 0.0;
         if( bresample_ )
-            npart += np_resample_*np_resample_*np_resample_ - gh.count_leaf_cells (gh.levelmax (), gh.levelmax ());
-
-        std::vector < T_store > temp_data;
-        temp_data.reserve (block_buf_size_);
+            resample_geometry (gh, left, h, q);
 
+        //... shift particle positions (this has to be done as the same shift
+        //... is used when computing the convolution kernel for SPH baryons)
+        const double hfine = 1.0 / (1ul << gh.levelmax ());
 
-        char temp_fname[256];
-        sprintf (temp_fname, "___ic_temp_%05d.bin", 100 * id_gas_pos + coord);
-        std::ofstream ofs_temp (temp_fname, std::ios::binary | std::ios::trunc);
-
-        size_t blksize = sizeof (T_store) * npart;
-        ofs_temp.write ((char *) &blksize, sizeof (size_t));
-
-        size_t nwritten = 0;
-      
-        if( bresample_ )
-        {
-            double left[3], right[3], xx[3];
-          
-            gh.grid_bbox(gh.levelmax(), left, right );
-            const double h0 = 1.0/(1ul<<gh.levelmax());
-            const double h = (right[0] - left[0])/np_resample_;
-            const double q = h / h0;
-          
-            for( size_t i=0; i<np_resample_; ++i )
+        write_temp_file (100 * id_gas_pos + coord, "baryon positions", gh, gh.levelmin (), count_particles (gh),
+            [&](size_t i, size_t j, size_t k) -> real_t
             {
-                xx[0] = left[0] + ((double)i+0.5)*h+0.5*h;
-                for( size_t j=0; j<np_resample_; ++j )
-                {
-                    xx[1] = left[1] + ((double)j+0.5)*h+0.5*h;
-                    for( size_t k=0; k<np_resample_; ++k )
-                    {
-                        xx[2] = left[2] + ((double)k+0.5)*h+0.5*h;
-                      
-                        real_t dx = get_cic(gh, ((double)i+0.5)*q-0.5, ((double)j+0.5)*q-0.5, ((double)k+0.5)*q-0.5 );
-                        real_t pos = (xx[coord] + dx) - 0.5;
-                      
-                        if (temp_data.size () < block_buf_size_)
-                            temp_data.push_back (pos);
-                        else
-                        {
-                            ofs_temp.write ((char *) &temp_data[0], sizeof (T_store) * block_buf_size_);
-                            nwritten += block_buf_size_;
-                            temp_data.clear ();
-                            temp_data.push_back (pos);
-                        }
-                      
-                    }
-                }
-            }
-        }
-        
-        double h = 1.0 / (1ul << gh.levelmax ());
-
-    
-        for (int ilevel = gh.levelmax (); ilevel >= (int) gh.levelmin (); --ilevel)
-        {
-            for (unsigned i = 0; i < gh.get_grid (ilevel)->size (0); ++i)
-                for (unsigned j = 0; j < gh.get_grid (ilevel)->size (1); ++j)
-                    for (unsigned k = 0; k < gh.get_grid (ilevel)->size (2); ++k)
-                        if (!gh.is_refined (ilevel, i, j, k))
-                        {
-                          
-                          if( ilevel==(int)gh.levelmax() && bresample_ )
-                              continue;
-                          
-                          double xx[3];
-                          gh.cell_pos (ilevel, i, j, k, xx);
-
-                          //... shift particle positions (this has to be done as the same shift
-                          //... is used when computing the convolution kernel for SPH baryons)
-                          xx[coord] += 0.5 * h;
-
-                          xx[coord] = (xx[coord] + (*gh.get_grid (ilevel)) (i, j, k)) - 0.5;
-
-                          if (temp_data.size () < block_buf_size_)
-                              temp_data.push_back (xx[coord]);
-                          else
-                          {
-                              ofs_temp.write ((char *) &temp_data[0], sizeof (T_store) * block_buf_size_);
-                              nwritten += block_buf_size_;
-                              temp_data.clear ();
-                              temp_data.push_back (xx[coord]);
-                          }
-                      }
-        }
-
-        if (temp_data.size () > 0)
-        {
-            ofs_temp.write ((char *) &temp_data[0], sizeof (T_store) * temp_data.size ());
-            nwritten += temp_data.size ();
-        }
-
-        if (nwritten != npart)
-        {
-            LOGERR ("TIPSY output plugin wrote %ld, should have %ld", nwritten, npart);
-            throw std::runtime_error("Internal consistency error while writing temporary file for baryon positions");
-        }
-
-        //... dump to temporary file
-        ofs_temp.write ((char *) &blksize, sizeof (size_t));
-
-        if (ofs_temp.bad ())
-            throw std::runtime_error("I/O error while writing temporary file for baryon positions");
-
-        ofs_temp.close ();
+                const size_t idx[3] = { i, j, k };
+                double xx = left[coord] + ((double)idx[coord]+0.5)*h+0.5*h;
+                real_t dx = get_cic(gh, ((double)i+0.5)*q-0.5, ((double)j+0.5)*q-0.5, ((double)k+0.5)*q-0.5 );
+                return (xx + dx) - 0.5;
+            },
+            [&](int ilevel, int i, int j, int k)
+            {
+                double xx[3];
+                gh.cell_pos (ilevel, i, j, k, xx);
+                xx[coord] += 0.5 * hfine;
+                return (xx[coord] + (*gh.get_grid (ilevel)) (i, j, k)) - 0.5;
+            });
     }
 
     void write_gas_density (const grid_hierarchy & gh)
@@ -1380,6 +997,9 @@ public:
     }
 };
 
+template < typename T >
+const size_t tipsy_output_plugin_res < T >::pack_block_;
+
 template <>
 int tipsy_output_plugin_res < float >::xdr_dump (XDR * xdrs, float *p)
 {
@@ -1,84 +1,368 @@
 #ifndef POINT_FILE_READER_HH
 #define POINT_FILE_READER_HH
 
-#include <fstream>
-#include <sstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <string>
 #include <vector>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//... the stand-alone tools include this header with their own LOGERR and LOGINFO
+#ifndef LOGERR
 #include "log.hh"
+#endif
+
+/*!
+ * @brief read-only view of the contents of a point file
+ *
+ * The file is mapped into memory, if that fails it is read into a buffer instead.
+ */
+class point_file_view
+{
+protected:
+    const char *data_;
+    size_t size_;
+    void *map_;
+    std::vector<char> buf_;
+
+    point_file_view( const point_file_view& );
+    point_file_view& operator=( const point_file_view& );
+
+public:
+    explicit point_file_view( const std::string& fname )
+    : data_( NULL ), size_( 0 ), map_( NULL )
+    {
+        int fd = open( fname.c_str(), O_RDONLY );
+        struct stat st;
+        if( fd < 0 || fstat( fd, &st ) != 0 )
+        {
+            if( fd >= 0 ) close( fd );
+            LOGERR("point_reader : Could not open file \'%s\'",fname.c_str());
+            throw std::runtime_error("point_reader : cannot open point file.");
+        }
+
+        size_ = st.st_size;
+        if( size_ > 0 )
+        {
+            map_ = mmap( NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0 );
+            if( map_ == MAP_FAILED )
+            {
+                map_ = NULL;
+                buf_.resize( size_ );
+                size_t nread = 0;
+                ssize_t n;
+                while( nread < size_ && (n = read( fd, &buf_[nread], size_-nread )) > 0 )
+                    nread += n;
+                size_ = nread;
+                data_ = buf_.empty()? NULL : &buf_[0];
+            }
+            else
+            {
+                madvise( map_, size_, MADV_SEQUENTIAL );
+                data_ = reinterpret_cast<const char*>( map_ );
+            }
+        }
+        close( fd );
+    }
 
+    ~point_file_view()
+    {
+        if( map_ != NULL )
+            munmap( map_, size_ );
+    }
+
+    const char* data( void ) const
+    {   return data_;   }
+
+    size_t size( void ) const
+    {   return size_;   }
+};
+
+/*!
+ * @brief reader for the region point files
+ *
+ * A point file is either an ASCII table with one point per line (positions, optionally followed
+ * by velocities), or a binary point file as written by write_binary_point_file. ASCII files are
+ * parsed in parallel in chunks of whole lines, tokens that are not numbers (e.g. in comment lines)
+ * are skipped, and so are lines without any numbers. Binary files start with the magic string
+ * "MUSICPF1" followed by the number of columns, the number of points and the size of a value in
+ * bytes (4 or 8) as 64bit integers, and then the values point by point.
+ */
 struct point_reader{
-    
+
     int num_columns;
-    
+
     point_reader( void )
     : num_columns( 0 )
     { }
-    
-    bool isFloat( std::string myString )
+
+    static const char* binary_magic( void )
+    {   return "MUSICPF1";   }
+
+    //! write the values p, ncols per point, as a binary point file
+    template< typename real_t >
+    static void write_binary_point_file( std::string fname, int ncols, const std::vector<real_t>& p )
+    {
+        if( ncols <= 0 || p.size()%ncols != 0 )
+        {
+            LOGERR("point_reader : %llu values do not make up points of %d columns",(unsigned long long)p.size(),ncols);
+            throw std::runtime_error("point_reader : inconsistent number of columns.");
+        }
+
+        FILE *fp = fopen( fname.c_str(), "wb" );
+        if( fp == NULL )
+        {
+            LOGERR("point_reader : Could not open file \'%s\' for writing",fname.c_str());
+            throw std::runtime_error("point_reader : cannot write point file.");
+        }
+
+        unsigned long long head[3] = { (unsigned long long)ncols, (unsigned long long)(p.size()/ncols), sizeof(real_t) };
+        bool ok = fwrite( binary_magic(), 8, 1, fp ) == 1 && fwrite( head, sizeof(head), 1, fp ) == 1
+            && (p.empty() || fwrite( &p[0], sizeof(real_t), p.size(), fp ) == p.size());
+        ok &= fclose( fp ) == 0;
+
+        if( !ok )
+        {
+            LOGERR("point_reader : Error writing file \'%s\'",fname.c_str());
+            throw std::runtime_error("point_reader : cannot write point file.");
+        }
+    }
+
+protected:
+
+    static bool is_blank( char c )
+    {   return c==' ' || c=='\t' || c=='\r';   }
+
+    //! parse the numbers in the line [p,eol), which is followed by a non-numeric character, returns their count
+    template< typename real_t >
+    static int parse_line( const char *p, const char *eol, std::vector<real_t>& v )
     {
-        std::istringstream iss(myString);
-        double f;
-        //iss >> std::noskipws >> f; // noskipws considers leading whitespace invalid
-        // Check the entire string was consumed and if either failbit or badbit is set
-        iss >> f;
-        return iss.eof() && !iss.fail();
+        int count = 0;
+        while( p < eol )
+        {
+            while( p < eol && is_blank(*p) ) ++p;
+            if( p == eol ) break;
+
+            const char *tend = p;
+            while( tend < eol && !is_blank(*tend) ) ++tend;
+
+            char *end;
+            double val = strtod( p, &end );
+            if( end == tend )
+            {
+                v.push_back( val );
+                ++count;
+            }
+            p = tend;
+        }
+        return count;
     }
-    
+
+    //! numbers of one chunk of lines of an ASCII point file
     template< typename real_t >
-    void read_points_from_file( std::string fname, float vfac_, std::vector<real_t>& p )
+    struct chunk
+    {
+        std::vector<real_t> v;
+        size_t nlines;      //!< number of lines in the chunk
+        int ncols;          //!< number of values in its first line that has any, 0 if none has
+        size_t ifirst;      //!< line of the first value, relative to the chunk
+        size_t ibad;        //!< first line (from 1) with a different number of values, 0 if there is none
+
+        chunk( void )
+        : nlines( 0 ), ncols( 0 ), ifirst( 0 ), ibad( 0 )
+        { }
+    };
+
+    template< typename real_t >
+    static void parse_chunk( const char *b, const char *e, const char *fend, chunk<real_t>& c )
     {
-        std::ifstream ifs(fname.c_str());
-        if( !ifs )
+        std::string tail;
+
+        while( b < e )
         {
-            LOGERR("region_ellipsoid_plugin::read_points_from_file : Could not open file \'%s\'",fname.c_str());
-            throw std::runtime_error("region_ellipsoid_plugin::read_points_from_file : cannot open point file.");
+            const char *eol = (const char*)memchr( b, '\n', e-b );
+            if( eol == NULL ) eol = e;
+
+            int n;
+            if( eol == fend )
+            {
+                //... strtod must not run past the end of the file
+                tail.assign( b, eol );
+                n = parse_line( tail.c_str(), tail.c_str()+tail.size(), c.v );
+            }
+            else
+                n = parse_line( b, eol, c.v );
+
+            if( n > 0 )
+            {
+                if( c.ncols == 0 )
+                {
+                    c.ncols = n;
+                    c.ifirst = c.nlines;
+                }
+                else if( n != c.ncols && c.ibad == 0 )
+                    c.ibad = c.nlines+1;
+            }
+
+            ++c.nlines;
+            b = eol+1;
         }
-        
-        int colcount = 0, colcount1 = 0, row = 0;
-        p.clear();
-        
-        while( ifs )
-        {
-            std::string s;
-            if( !getline(ifs,s) )break;
-            std::stringstream ss(s);
-            colcount1 = 0;
-            while(ss)
+    }
+
+    template< typename real_t >
+    static int read_binary( const point_file_view& f, const std::string& fname, std::vector<real_t>& p )
+    {
+        unsigned long long head[3] = { 0, 0, 0 };
+        if( f.size() >= 8+sizeof(head) )
+            memcpy( head, f.data()+8, sizeof(head) );
+
+        if( (head[2] != sizeof(float) && head[2] != sizeof(double)) || head[0] == 0
+           || f.size() != 8 + sizeof(head) + head[0]*head[1]*head[2] )
+        {
+            LOGERR("point_reader : Binary point file \'%s\' is corrupt",fname.c_str());
+            throw std::runtime_error("point_reader : corrupt binary point file.");
+        }
+
+        size_t n = head[0]*head[1];
+        const char *src = f.data()+8+sizeof(head);
+        p.resize( n );
+
+        if( head[2] == sizeof(real_t) )
+        {
+            if( n > 0 ) memcpy( &p[0], src, n*sizeof(real_t) );
+        }
+        else if( head[2] == sizeof(float) )
+        {
+            for( size_t i=0; i<n; ++i )
+            {
+                float val;
+                memcpy( &val, src+i*sizeof(float), sizeof(float) );
+                p[i] = val;
+            }
+        }
+        else
+        {
+            for( size_t i=0; i<n; ++i )
+            {
+                double val;
+                memcpy( &val, src+i*sizeof(double), sizeof(double) );
+                p[i] = val;
+            }
+        }
+
+        return (int)head[0];
+    }
+
+    template< typename real_t >
+    static int read_ascii( const point_file_view& f, const std::string& fname, std::vector<real_t>& p )
+    {
+        const char *fb = f.data(), *fe = f.data()+f.size();
+
+        int nchunks = 1;
+#ifdef _OPENMP
+        nchunks = omp_get_max_threads();
+#endif
+        //... no need to split small files
+        if( f.size() < ((size_t)1<<20) ) nchunks = 1;
+
+        //... the chunks start after the line break following equal divisions of the file
+        std::vector<const char*> cb( nchunks+1, fe );
+        cb[0] = fb;
+        for( int i=1; i<nchunks; ++i )
+        {
+            const char *q = fb + f.size()/nchunks*i;
+            q = std::max( q, cb[i-1] );
+            const char *eol = (const char*)memchr( q, '\n', fe-q );
+            cb[i] = (eol == NULL)? fe : eol+1;
+        }
+
+        std::vector< chunk<real_t> > chunks( nchunks );
+
+        #pragma omp parallel for schedule(static,1)
+        for( int i=0; i<nchunks; ++i )
+            parse_chunk( cb[i], cb[i+1], fe, chunks[i] );
+
+        //... merge the chunks, and find the first line with a different number of columns
+        int colcount = 0;
+        size_t nvals = 0, iline = 0, ibad = 0;
+        for( int i=0; i<nchunks; ++i )
+        {
+            const chunk<real_t>& c = chunks[i];
+            if( c.ncols > 0 )
             {
-                if( !getline(ss,s,' ') ) break;
-                if( !isFloat( s ) ) continue;
-                p.push_back( strtod(s.c_str(),NULL) );
-                
-                if( row == 0 )
-                    colcount++;
-                else
-                    colcount1++;
+                if( colcount == 0 )
+                    colcount = c.ncols;
+
+                if( ibad == 0 && c.ncols != colcount )
+                    ibad = iline + c.ifirst + 1;
+                else if( ibad == 0 && c.ibad > 0 )
+                    ibad = iline + c.ibad;
             }
-            ++row;
-            
-            if( row>1 && colcount != colcount1 )
-                LOGERR("error on line %d of input file",row);
-            
-            //std::cout << std::endl;
-        }
-        
+            nvals += c.v.size();
+            iline += c.nlines;
+        }
+
+        if( ibad > 0 )
+            LOGERR("error on line %llu of input file",(unsigned long long)ibad);
+
+        p.clear();
+        p.reserve( nvals );
+        for( int i=0; i<nchunks; ++i )
+        {
+            p.insert( p.end(), chunks[i].v.begin(), chunks[i].v.end() );
+            std::vector<real_t>().swap( chunks[i].v );
+        }
+
+        return colcount;
+    }
+
+public:
+
+    //! read the values of a point file without any processing, returns the number of columns
+    template< typename real_t >
+    static int read_values_from_file( std::string fname, std::vector<real_t>& p )
+    {
+        point_file_view f( fname );
+
+        if( f.size() >= 8 && memcmp( f.data(), binary_magic(), 8 ) == 0 )
+            return read_binary( f, fname, p );
+
+        return read_ascii( f, fname, p );
+    }
+
+    template< typename real_t >
+    void read_points_from_file( std::string fname, float vfac_, std::vector<real_t>& p )
+    {
+        int colcount = read_values_from_file( fname, p );
+
         LOGINFO("region point file appears to contain %d columns",colcount);
-        
-        if( p.size()%3 != 0 && p.size()%6 != 0 )
+
+        if( p.empty() || (p.size()%3 != 0 && p.size()%6 != 0) )
         {
-            LOGERR("Region point file \'%s\' does not contain triplets (%d elems)",fname.c_str(),p.size());
+            LOGERR("Region point file \'%s\' does not contain triplets (%d elems)",fname.c_str(),(int)p.size());
             throw std::runtime_error("region_ellipsoid_plugin::read_points_from_file : file does not contain triplets.");
         }
-        
-        
+
+
         double x0[3] = { p[0],p[1],p[2] }, dx;
-        
+
         if( colcount == 3 )
         {
             // only positions are given
-            
-            for( size_t i=3; i<p.size(); i+=3 )
+
+            #pragma omp parallel for private(dx)
+            for( long long i=3; i<(long long)p.size(); i+=3 )
             {
                 for( size_t j=0; j<3; ++j )
                 {
@@ -92,9 +376,9 @@ struct point_reader{
         else if( colcount == 6 )
         {
             // positions and velocities are given
-            
+
             //... include the velocties to unapply Zeldovich approx.
-            
+
             for( size_t j=3; j<6; ++j )
             {
                 dx = (p[j-3]-p[j]/vfac_)-x0[j-3];
@@ -102,8 +386,9 @@ struct point_reader{
                 else if( dx > 0.5 ) dx -= 1.0;
                 p[j] = x0[j-3] + dx;
             }
-            
-            for( size_t i=6; i<p.size(); i+=6 )
+
+            #pragma omp parallel for private(dx)
+            for( long long i=6; i<(long long)p.size(); i+=6 )
             {
                 for( size_t j=0; j<3; ++j )
                 {
@@ -112,7 +397,7 @@ struct point_reader{
                     else if( dx > 0.5 ) dx -= 1.0;
                     p[i+j] = x0[j] + dx;
                 }
-                
+
                 for( size_t j=3; j<6; ++j )
                 {
                     dx = (p[i+j-3]-p[i+j]/vfac_)-x0[j-3];
@@ -124,12 +409,12 @@ struct point_reader{
         }
         else
             LOGERR("Problem interpreting the region point file \'%s\'", fname.c_str() );
-        
+
         num_columns = colcount;
     }
-    
-    
+
+
 };
 
 
-#endif
\ No newline at end of file
+#endif
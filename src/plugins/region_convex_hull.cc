@@ -154,6 +154,9 @@ public:
     bool query_point( double *x, int ilevel )
     {   return phull_->check_point( x, level_dist_[ilevel] );   }
     
+    void query_row( double x, double y, const double *z, size_t n, int ilevel, unsigned char *inside )
+    {   phull_->check_row( x, y, z, n, inside, level_dist_[ilevel] );   }
+    
     bool is_grid_dim_forced( size_t* ndims )
     {   return false;   }
     
@@ -56,7 +56,8 @@ inline void Inverse_3x3( const float *data, float *m )
     m[8] = (data[0]*data[4]-data[1]*data[3])*invdet;
 }
 
-void Inverse_4x4( float *mat )
+template< typename T >
+void Inverse_4x4( T *mat )
 {
     double tmp[12]; /* temp array for pairs */
     double src[16]; /* array of transpose source matrix */
@@ -163,6 +164,12 @@ void Inverse_4x4( float *mat )
  *     (x-c)' A (x-c) <= 1
  *
  * Code was adapted from the MATLAB version by Nima Moshtagh (nima@seas.upenn.edu)
+ *
+ * Instead of the Khachiyan iteration starting from uniform weights, the
+ * Kumar-Yildirim variant can be used: it starts from the extreme points along
+ * the axes and also takes the away steps of Todd & Yildirim, which lower and
+ * eventually drop the weight of the point closest to the center, so that far
+ * fewer iterations are needed for many points.
  */
 class min_ellipsoid
 {
@@ -171,8 +178,8 @@ protected:
     float X[16];
     float c[3];
     float A[9], Ainv[9];
-    float *Q;
-    float *u;
+    float *Q;       //!< point coordinates, all x, then all y, then all z
+    double *u;      //!< weights of the points
     
     float detA, detA13;
     
@@ -238,73 +245,220 @@ protected:
         axes_computed = true;
     }
   
+    //! the moment matrix X = sum_l w_l q_l q_l^T of the points q_l = (x_l,1), returns sum_l w_l^2
+    double compute_X( const double *w, double *XX ) const
+    {
+        const float *qx = Q, *qy = Q+N, *qz = Q+2*N;
+        double sxx = 0.0, sxy = 0.0, sxz = 0.0, syy = 0.0, syz = 0.0, szz = 0.0;
+        double sx = 0.0, sy = 0.0, sz = 0.0, s1 = 0.0, sww = 0.0;
+        
+        #pragma omp parallel for reduction(+:sxx,sxy,sxz,syy,syz,szz,sx,sy,sz,s1,sww)
+        for( long l=0; l<(long)N; ++l )
+        {
+            double x = qx[l], y = qy[l], z = qz[l], wl = w[l];
+            double wx = wl*x, wy = wl*y, wz = wl*z;
+            sxx += wx*x; sxy += wx*y; sxz += wx*z;
+            syy += wy*y; syz += wy*z; szz += wz*z;
+            sx += wx; sy += wy; sz += wz; s1 += wl;
+            sww += wl*wl;
+        }
+        
+        XX[ 0] = sxx; XX[ 1] = sxy; XX[ 2] = sxz; XX[ 3] = sx;
+        XX[ 4] = sxy; XX[ 5] = syy; XX[ 6] = syz; XX[ 7] = sy;
+        XX[ 8] = sxz; XX[ 9] = syz; XX[10] = szz; XX[11] = sz;
+        XX[12] = sx;  XX[13] = sy;  XX[14] = sz;  XX[15] = s1;
+        
+        return sww;
+    }
+    
+    //! whether the weighted points of the moment matrix XX span less than three dimensions
+    /*! the covariance C of the points is compared with an isotropic one of the same trace, det(C)
+     *  vanishes when the points with w>0 are not affinely independent and X cannot be inverted */
+    static bool is_degenerate( const double *XX )
+    {
+        double s1 = XX[15];
+        if( !(s1 > 0.0) )
+            return true;
+        
+        double mx = XX[3]/s1, my = XX[7]/s1, mz = XX[11]/s1;
+        double cxx = XX[0]/s1 - mx*mx, cxy = XX[1]/s1 - mx*my, cxz = XX[2]/s1 - mx*mz;
+        double cyy = XX[5]/s1 - my*my, cyz = XX[6]/s1 - my*mz, czz = XX[10]/s1 - mz*mz;
+        
+        double det = cxx*(cyy*czz - cyz*cyz) - cxy*(cxy*czz - cyz*cxz) + cxz*(cxy*cyz - cyy*cxz);
+        double tr3 = (cxx + cyy + czz)/3.0;
+        
+        return !(tr3 > 0.0) || det <= 1e-10 * tr3*tr3*tr3;
+    }
+    
+    //! the points with the largest Mahalanobis distance q^T Xi q and with the smallest one among those with w>0
+    void scan_distances( const double *Xi, const double *w, size_t& imax, double& Mmax, size_t& imin, double& Mmin ) const
+    {
+        const float *qx = Q, *qy = Q+N, *qz = Q+2*N;
+        const double
+            axx = Xi[0], ayy = Xi[5], azz = Xi[10], a11 = Xi[15],
+            axy = 2.0*Xi[1], axz = 2.0*Xi[2], ayz = 2.0*Xi[6],
+            ax = 2.0*Xi[3], ay = 2.0*Xi[7], az = 2.0*Xi[11];
+        
+        imax = 0; Mmax = -1e30;
+        imin = 0; Mmin = 1e30;
+        
+        #pragma omp parallel
+        {
+            size_t lmax = 0, lmin = 0;
+            double lMmax = -1e30, lMmin = 1e30;
+            
+            #pragma omp for nowait
+            for( long i=0; i<(long)N; ++i )
+            {
+                double x = qx[i], y = qy[i], z = qz[i];
+                double m = x*(axx*x + axy*y + axz*z + ax) + y*(ayy*y + ayz*z + ay) + z*(azz*z + az) + a11;
+                
+                if( m > lMmax ){ lMmax = m; lmax = i; }
+                if( m < lMmin && w[i] > 0.0 ){ lMmin = m; lmin = i; }
+            }
+            
+            // ties go to the lowest index, as in a serial scan
+            #pragma omp critical
+            {
+                if( lMmax > Mmax || (lMmax == Mmax && lmax < imax) ){ Mmax = lMmax; imax = lmax; }
+                if( lMmin < Mmin || (lMmin == Mmin && lmin < imin) ){ Mmin = lMmin; imin = lmin; }
+            }
+        }
+    }
+    
     // use the Khachiyan Algorithm to find the minimum bounding ellipsoid
-    void compute( double tol = 1e-4, int maxit = 10000 )
+    /* the weights are kept as u = uscale * w, so that the scaling of all weights in a step
+     * is applied to uscale only, and X follows from the rank-one change of the weights */
+    void compute( bool kumar_yildirim, double tol = 1e-4, int maxit = 10000 )
     {
+        const double n = 4.0; // dimension of the lifted points (x,1)
+        const int nrecompute = 100;
         double err = 10.0 * tol;
-        float *unew = new float[N];
         int count = 0;
-        double temp;
+        
+        double *w = u, uscale = 1.0, usq;
+        double XX[16], Xi[16];
+        
+        if( kumar_yildirim )
+        {
+            //... start from the points extreme along the coordinate axes
+            std::vector<size_t> core;
+            for( int j=0; j<3; ++j )
+            {
+                const float *q = Q + j*N;
+                size_t il = std::min_element( q, q+N ) - q, ir = std::max_element( q, q+N ) - q;
+                core.push_back( il );
+                core.push_back( ir );
+            }
+            std::sort( core.begin(), core.end() );
+            core.erase( std::unique( core.begin(), core.end() ), core.end() );
+            
+            for( size_t i=0; i<N; ++i )
+                w[i] = 0.0;
+            for( size_t i=0; i<core.size(); ++i )
+                w[core[i]] = 1.0/core.size();
+        }
+        else
+        {
+            for( size_t i=0; i<N; ++i )
+                w[i] = 1.0/N;
+        }
+        
+        usq = compute_X( w, XX );
+        
+        //... the extreme points can lie in a plane (or coincide), X would be singular then
+        if( kumar_yildirim && is_degenerate( XX ) )
+        {
+            LOGINFO("min_ellipsoid: initial core set is degenerate, starting from uniform weights.");
+            for( size_t i=0; i<N; ++i )
+                w[i] = 1.0/N;
+            usq = compute_X( w, XX );
+        }
         
         while( err > tol && count < maxit )
         {
-            for( int i=0; i<4; ++i )
-                for( int j=0,i4=4*i; j<4; ++j )
-                {
-                    const int k = i4+j;
-                    temp = 0.0;
-                    for( size_t l=0; l<N; ++l )
-                        temp += (double)(Q[4*l+i] * u[l] * Q[4*l+j]);
-                    X[k] = temp;
-                }
+            for( int k=0; k<16; ++k )
+                Xi[k] = XX[k];
+            Inverse_4x4( Xi );
             
-            Inverse_4x4(X);
+            size_t imax, imin;
+            double Mmax, Mmin;
+            scan_distances( Xi, w, imax, Mmax, imin, Mmin );
             
-            int imax = 0; float Mmax = -1e30;
-            double m;
-            for( size_t i=0; i<N; ++i )
+            //... new weights u' = a*u + b*e_j
+            size_t j = imax;
+            double a, b;
+            bool bdrop = false;
+            
+            //... no away step from a point that carries all the weight, it cannot be decreased
+            bool baway = kumar_yildirim && Mmax/n - 1.0 < 1.0 - Mmin/n && uscale*w[imin] < 1.0 - 1e-12;
+            
+            if( !baway )
             {
-                m = 0.0;
-                for( int k=0; k<4; ++k )
-                    for( int l=0; l<4; ++l )
-                        m += (double)(Q[4*i+k] * X[4*l+k] * Q[4*i+l]);
-                if( m > Mmax )
-                {
-                    imax = i;
-                    Mmax = m;
-                }
+                double step_size = (Mmax-n)/(n*(Mmax-1.0));
+                a = 1.0-step_size;
+                b = step_size;
+            }
+            else
+            {
+                //... away step, bounded by dropping the point
+                j = imin;
+                double uj = uscale*w[j], lmax = uj/(1.0-uj), lambda = lmax;
+                if( Mmin-1.0 > 1e-12 )
+                    lambda = std::min( (n-Mmin)/(n*(Mmin-1.0)), lmax );
+                bdrop = lambda >= lmax;
+                a = 1.0+lambda;
+                b = -lambda;
             }
             
-            float step_size = (Mmax-4.0f)/(4.0f*(Mmax-1.0f)), step_size1 = 1.0f-step_size;
-            for( size_t i=0; i<N; ++i )
-                unew[i] = u[i] * step_size1;
-            unew[imax] += step_size;
+            double uj = uscale*w[j];
+            err = sqrt( std::max( (a-1.0)*(a-1.0)*usq + 2.0*(a-1.0)*b*uj + b*b, 0.0 ) );
+            usq = a*a*usq + 2.0*a*b*uj + b*b;
             
-            err = 0.0;
-            for( size_t i=0; i<N; ++i )
+            uscale *= a;
+            w[j] = bdrop? 0.0 : w[j] + b/uscale;
+            
+            const double q[4] = { Q[j], Q[N+j], Q[2*N+j], 1.0 };
+            for( int k=0; k<4; ++k )
+                for( int l=0; l<4; ++l )
+                    XX[4*k+l] = a*XX[4*k+l] + b*q[k]*q[l];
+            
+            ++count;
+            
+            //... fold the scale into the weights before it under- or overflows, and
+            //... recompute X from time to time to keep rounding errors from accumulating
+            if( uscale < 1e-100 || uscale > 1e100 || count%nrecompute == 0 )
             {
-                err += sqr(unew[i]-u[i]);
-                u[i] = unew[i];
+                #pragma omp parallel for
+                for( long i=0; i<(long)N; ++i )
+                    w[i] *= uscale;
+                uscale = 1.0;
+                usq = compute_X( w, XX );
             }
-            err = sqrt(err);
-            ++count;
         }
         
         if( count >= maxit )
             LOGERR("No convergence in min_ellipsoid::compute: maximum number of iterations reached!");
+        else
+            LOGINFO("minimum bounding ellipsoid converged after %d iterations", count);
+        
+        #pragma omp parallel for
+        for( long i=0; i<(long)N; ++i )
+            w[i] *= uscale;
         
-        delete[] unew;
+        for( int k=0; k<16; ++k )
+            X[k] = Xi[k];
     }
     
 public:
-    min_ellipsoid( size_t N_, double* P )
+    min_ellipsoid( size_t N_, double* P, bool kumar_yildirim = false )
     : N( N_ ), axes_computed( false ), hold_point_data( true )
     {
         // --- initialize ---
         LOGINFO("computing minimum bounding ellipsoid from %lld points",N);
       
-        Q = new float[4*N];
-        u = new float[N];
+        Q = new float[3*N];
+        u = new double[N];
         
         // normalize coordinate frame
         double xcenter[3] = {0.0,0.0,0.0};
@@ -341,27 +495,26 @@ public:
         
         
         for( size_t i=0; i<N; ++i )
-            u[i] = 1.0/N;
-        
-        for( size_t i=0; i<N; ++i )
-        {
-            int i4=4*i, i3=3*i;
             for( size_t j=0; j<3; ++j )
-                Q[i4+j] = P[i3+j];
-            Q[i4+3] = 1.0f;
-        }
+                Q[j*N+i] = P[3*i+j];
         
         //--- compute the actual ellipsoid using the Khachiyan Algorithm ---
-        compute();
+        compute( kumar_yildirim );
         
         //--- determine the ellipsoid A matrix ---
-        double Pu[3];
-        for( int j=0; j<3; ++j )
+        double Pu[3], pu0 = 0.0, pu1 = 0.0, pu2 = 0.0;
+        double a00 = 0.0, a01 = 0.0, a02 = 0.0, a11 = 0.0, a12 = 0.0, a22 = 0.0;
+        
+        #pragma omp parallel for reduction(+:pu0,pu1,pu2,a00,a01,a02,a11,a12,a22)
+        for( long l=0; l<(long)N; ++l )
         {
-            Pu[j] = 0.0;
-            for( size_t i=0; i<N; ++i )
-                Pu[j] += P[3*i+j] * u[i];
+            const double *p = &P[3*l];
+            double ux = p[0]*u[l], uy = p[1]*u[l], uz = p[2]*u[l];
+            pu0 += ux; pu1 += uy; pu2 += uz;
+            a00 += ux*p[0]; a01 += ux*p[1]; a02 += ux*p[2];
+            a11 += uy*p[1]; a12 += uy*p[2]; a22 += uz*p[2];
         }
+        Pu[0] = pu0; Pu[1] = pu1; Pu[2] = pu2;
       
         // determine center
         c[0] = Pu[0]; c[1] = Pu[1]; c[2] = Pu[2];
@@ -369,16 +522,10 @@ public:
         // need to do summation in double precision due to
         // possible catastrophic cancellation issues when
         // using many input points
-        double Atmp[9];
+        double Atmp[9] = { a00, a01, a02, a01, a11, a12, a02, a12, a22 };
         for( int i=0; i<3; ++i )
-            for( int j=0,i3=3*i; j<3; ++j )
-            {
-                const int k = i3+j;
-                Atmp[k] = 0.0;
-                for( size_t l=0; l<N; ++l )
-                    Atmp[k] += P[3*l+i] * u[l] * P[3*l+j];
-                Atmp[k] -= Pu[i]*Pu[j];
-            }
+            for( int j=0; j<3; ++j )
+                Atmp[3*i+j] -= Pu[i]*Pu[j];
       
         for( int i=0;i<9;++i)
           Ainv[i] = Atmp[i] * L * L;
@@ -459,6 +606,31 @@ public:
         return r <= 1.0;
     }
     
+    //! check the row of n points (x,y,z[k]), inside[k] is set to 1 if check_point would return true and to 0 otherwise
+    /*! the terms of the quadratic form not depending on z are computed once for the row */
+    template<typename T>
+    void check_row( T x, T y, const T *z, size_t n, unsigned char *inside )
+    {
+        T q[2] = {x-c[0],y-c[1]};
+        for( int i=0; i<2; ++i )
+            q[i] = (q[i]>0.5)?q[i]-1.0:(q[i]<-0.5)?q[i]+1.0:q[i];
+        
+        T r0 = 0.0, r1 = 0.0, r2 = A[8];
+        for( int i=0; i<2; ++i )
+        {
+            for( int j=0; j<2; ++j )
+                r0 += q[i]*A[3*j+i]*q[j];
+            r1 += (A[3*i+2]+A[6+i])*q[i];
+        }
+        
+        for( size_t k=0; k<n; ++k )
+        {
+            T qz = z[k]-c[2];
+            qz = (qz>0.5)?qz-1.0:(qz<-0.5)?qz+1.0:qz;
+            inside[k] = (r0 + qz*(r1 + qz*r2)) <= 1.0;
+        }
+    }
+    
     void print( void )
     {
         std::cout << "A = \n";
@@ -632,7 +804,14 @@ public:
             
             
             
-            pellip_[levelmax_] = new min_ellipsoid( pp.size()/3, &pp[0] );
+            std::string method = cf.getValueSafe<std::string>("setup","region_ellipsoid_method","khachiyan");
+            if( method != "khachiyan" && method != "kumar_yildirim" )
+            {
+                LOGERR("Unknown region_ellipsoid_method \'%s\' (khachiyan/kumar_yildirim).", method.c_str());
+                throw std::runtime_error("Unknown region_ellipsoid_method");
+            }
+            
+            pellip_[levelmax_] = new min_ellipsoid( pp.size()/3, &pp[0], method == "kumar_yildirim" );
             
             
         } else {
@@ -780,6 +959,11 @@ public:
         return pellip_[level]->check_point( x );
     }
     
+    void query_row( double x, double y, const double *z, size_t n, int level, unsigned char *inside )
+    {
+        pellip_[level]->check_row( x, y, z, n, inside );
+    }
+    
     bool is_grid_dim_forced( size_t* ndims )
     {   return false;   }
     
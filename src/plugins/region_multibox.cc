@@ -230,6 +230,18 @@ public:
         return (level <= int(refgrid[(x[0])*res][(x[1])*res][(x[2])*res]));
     }
     
+    void query_row( double x, double y, const double *z, size_t n, int level, unsigned char *inside )
+    {
+        if(x >= 1.0 || x <= 0.0 || y >= 1.0 || y <= 0.0)
+        {
+            std::fill(inside, inside+n, 0);
+            return;
+        }
+        const col& c = refgrid[x*res][y*res];
+        for(size_t k=0; k<n; ++k)
+            inside[k] = (z[k] < 1.0 && z[k] > 0.0) && (level <= int(c[z[k]*res]));
+    }
+    
     bool is_grid_dim_forced( size_t* ndims )
     {   
         return false; //is this true?
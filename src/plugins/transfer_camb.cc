@@ -8,6 +8,7 @@
 */
 
 #include "transfer_function.hh"
+#include "transfer_table.hh"
 
 const double tiny = 1e-30;
 
@@ -25,7 +26,7 @@ private:
   double m_kmin, m_kmax, m_Omega_b, m_Omega_m, m_Omega_adm, DeltaN_adm, m_zstart;
   unsigned m_nlines;
 
-  bool m_linbaryoninterp;
+  bool m_linbaryoninterp, m_bcache;
 
   int do_adm;
 
@@ -42,12 +43,7 @@ private:
 
       LOGINFO("CAUTION: make sure that this transfer function \n\t has been output for z=%f!",m_zstart);
 
-      std::string line;
-      std::ifstream ifs(m_filename_Tk.c_str());
-
-      if (!ifs.good())
-        throw std::runtime_error("Could not find transfer function file \'" +
-                                 m_filename_Tk + "\'");
+      transfer_table tab(m_filename_Tk, 13, m_bcache);
 
       m_tab_k.clear();
       m_tab_Tk_tot.clear();
@@ -59,38 +55,18 @@ private:
 
       m_kmin = 1e30;
       m_kmax = -1e30;
-      std::ofstream ofs("dump_transfer.txt");
-
-      while (!ifs.eof()) {
-        getline(ifs, line);
-        if (ifs.eof()) break;
-
-        // OH: ignore line if it has a comment:
-        if (line.find("#") != std::string::npos) continue;
-
-        std::stringstream ss(line);
-
-        double k, Tkc, Tkb, Tktot, Tkvtot, Tkvc, Tkvb, dummy;
-
-        ss >> k;
-        ss >> Tkc;   // cdm
-        ss >> Tkb;   // baryon
-        ss >> dummy; // photon
-        ss >> dummy; // nu
-        ss >> dummy; // mass_nu
-        ss >> Tktot; // total
-        ss >> dummy; // no_nu
-        ss >> dummy; // total_de
-        ss >> dummy; // Weyl
-        ss >> Tkvc;  //>[150609SH: add] // v_cdm
-        ss >> Tkvb;  //>[150609SH: add] // v_b
-        ss >> dummy; // v_b-v_cdm
-
-        if( ss.bad() || ss.fail() ){
-          LOGERR("Error reading the transfer function file (corrupt or not in expected format)!");
-          throw std::runtime_error("Error reading transfer function file \'" +
-                                   m_filename_Tk + "\'");
-        }
+
+      for (size_t i = 0; i < tab.size(); ++i) {
+        double k, Tkc, Tkb, Tktot, Tkvtot, Tkvc, Tkvb;
+
+        // columns: k, cdm, baryon, photon, nu, mass_nu, total, no_nu,
+        // total_de, Weyl, v_cdm, v_b, v_b-v_cdm
+        k = tab(i, 0);
+        Tkc = tab(i, 1);   // cdm
+        Tkb = tab(i, 2);   // baryon
+        Tktot = tab(i, 6); // total
+        Tkvc = tab(i, 10); //>[150609SH: add] // v_cdm
+        Tkvb = tab(i, 11); //>[150609SH: add] // v_b
   if( do_adm == 1 ) { // baryons are actually ADM
     //if( m_Omega_adm < 1e-6 ) Tkvtot = Tktot;
     Tkvtot=((m_Omega_m-m_Omega_b-m_Omega_adm)*Tkvc+m_Omega_adm*Tkvb)/m_Omega_m; //MvD
@@ -133,8 +109,6 @@ private:
         }
       }
 
-      ifs.close();
-
       LOGINFO("Read CAMB transfer function table with %d rows", m_nlines);
 
       if (m_linbaryoninterp)
@@ -183,6 +157,7 @@ public:
     m_Omega_adm = cf.getValueSafe<double>("cosmology","Omega_adm",0.0);
     do_adm = cf.getValueSafe<int>("cosmology","do_adm",0);
     DeltaN_adm = cf.getValueSafe<double>("cosmology","DeltaN_adm",0.0);
+    m_bcache = cf.getValueSafe<bool>("cosmology","transfer_file_cache",false);
     read_table();
 
     acc_tot = gsl_interp_accel_alloc();
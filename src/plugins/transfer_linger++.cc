@@ -9,6 +9,7 @@
  */
 
 #include "transfer_function.hh"
+#include "transfer_table.hh"
 
 class transfer_LINGERpp_plugin : public transfer_function_plugin
 {
@@ -21,6 +22,7 @@ private:
 	
 	bool m_bnovrel;	
 	bool m_bz0norm;
+	bool m_bcache;
 	
 	void read_table( void ){
 #ifdef WITH_MPI
@@ -30,11 +32,7 @@ private:
 			<< " - reading tabulated transfer function data from file \n"
 			<< "    \'" << m_filename_Tk << "\'\n";
 			
-			std::string line;
-			std::ifstream ifs( m_filename_Tk.c_str() );
-			
-			if(! ifs.good() )
-				throw std::runtime_error("Could not find transfer function file \'"+m_filename_Tk+"\'");
+			transfer_table tab( m_filename_Tk, 8, m_bcache );
 			
 			m_tab_k.clear();
 			m_tab_Tk_tot.clear();
@@ -47,22 +45,16 @@ private:
 			
 			const double zero = 1e-10;
 			
-			while( !ifs.eof() ){
-				getline(ifs,line);
-				
-				if(ifs.eof()) break;
-				
-				std::stringstream ss(line);
-				
+			for( size_t i=0; i<tab.size(); ++i ){
 				double k, Tkc, Tkb, Tktot, Tkvc, Tkvb, Tkvtot, Tktot0;
-				ss >> k;
-				ss >> Tktot;
-				ss >> Tkc;
-				ss >> Tkb;
-				ss >> Tkvc;
-				ss >> Tkvb;
-                ss >> Tkvtot;
-                ss >> Tktot0;
+				k      = tab(i,0);
+				Tktot  = tab(i,1);
+				Tkc    = tab(i,2);
+				Tkb    = tab(i,3);
+				Tkvc   = tab(i,4);
+				Tkvb   = tab(i,5);
+				Tkvtot = tab(i,6);
+				Tktot0 = tab(i,7);
 
 		if( m_bnovrel )
 		{
@@ -89,7 +81,6 @@ private:
 				
 			}
 			
-			ifs.close();			
 #ifdef WITH_MPI
 		}
 		
@@ -125,6 +116,7 @@ public:
 	: transfer_function_plugin( cf )
 	{
 		m_filename_Tk	= pcf_->getValue<std::string>("cosmology","transfer_file");
+		m_bcache		= pcf_->getValueSafe<bool>("cosmology","transfer_file_cache",false);
 		
 		//.. disable the baryon-CDM relative velocity (both follow the total matter potential)
 		m_bnovrel		= pcf_->getValueSafe<bool>("cosmology","no_vrel",false);
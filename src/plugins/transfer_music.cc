@@ -9,6 +9,7 @@
  */
 
 #include "transfer_function.hh"
+#include "transfer_table.hh"
 
 class transfer_MUSIC_plugin : public transfer_function_plugin
 {
@@ -18,6 +19,7 @@ private:
 	std::vector<double> m_tab_k, m_tab_Tk_tot, m_tab_Tk_cdm, m_tab_Tk_baryon, m_tab_Tvk_cdm, m_tab_Tvk_baryon;
 	gsl_interp_accel *acc_dtot, *acc_dcdm, *acc_dbaryon, *acc_vcdm, *acc_vbaryon;
 	gsl_spline *spline_dtot, *spline_dcdm, *spline_dbaryon, *spline_vcdm, *spline_vbaryon;
+	bool m_bcache;
 	
 	
 	
@@ -29,11 +31,7 @@ private:
 			<< " - reading tabulated transfer function data from file \n"
 			<< "    \'" << m_filename_Tk << "\'\n";
 			
-			std::string line;
-			std::ifstream ifs( m_filename_Tk.c_str() );
-			
-			if(! ifs.good() )
-				throw std::runtime_error("Could not find transfer function file \'"+m_filename_Tk+"\'");
+			transfer_table tab( m_filename_Tk, 6, m_bcache );
 			
 			m_tab_k.clear();
 			m_tab_Tk_tot.clear();
@@ -45,20 +43,14 @@ private:
             double Tktotmin = 1e30, Tkcmin = 1e30, Tkbmin = 1e30, Tkvcmin = 1e30, Tkvbmin = 1e30;
 			double ktotmin = 1e30, kcmin = 1e30, kbmin = 1e30, kvcmin = 1e30, kvbmin = 1e30;
             
-			while( !ifs.eof() ){
-				getline(ifs,line);
-				
-				if(ifs.eof()) break;
-				
-				std::stringstream ss(line);
-				
+			for( size_t i=0; i<tab.size(); ++i ){
 				double k, Tkc, Tkb, Tktot, Tkvc, Tkvb;
-				ss >> k;
-				ss >> Tktot;
-				ss >> Tkc;
-				ss >> Tkb;
-				ss >> Tkvc;
-				ss >> Tkvb;
+				k     = tab(i,0);
+				Tktot = tab(i,1);
+				Tkc   = tab(i,2);
+				Tkb   = tab(i,3);
+				Tkvc  = tab(i,4);
+				Tkvb  = tab(i,5);
                 
                 // store log(k)
                 m_tab_k.push_back( log10(k) );
@@ -90,7 +82,6 @@ private:
                 m_tab_Tvk_baryon[i] = log10( (m_tab_Tvk_baryon[i]>0.0)? m_tab_Tvk_baryon[i] : Tkvbmin*kvbmin*ik2);
             }
 			
-			ifs.close();			
 #ifdef WITH_MPI
 		}
 		
@@ -121,6 +112,7 @@ public:
 	: transfer_function_plugin( cf )
 	{
 		m_filename_Tk = pcf_->getValue<std::string>("cosmology","transfer_file");
+		m_bcache = pcf_->getValueSafe<bool>("cosmology","transfer_file_cache",false);
 		
 		read_table( );
 		
@@ -0,0 +1,193 @@
+/*
+
+ transfer_table.hh - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#ifndef __TRANSFER_TABLE_HH
+#define __TRANSFER_TABLE_HH
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "log.hh"
+
+/*!
+ * @class transfer_table
+ * @brief numeric columns of a tabulated transfer function file
+ *
+ * The file is read in one piece and parsed with strtod, lines containing a '#'
+ * and blank lines are skipped, and only the first ncols values of each row are
+ * kept. With a cache, the parsed values are also stored in the binary file
+ * '<file>.bin' next to the table, keyed by a hash of the table's contents, so
+ * that later runs on the same table only read and hash it. The cache holds the
+ * raw values and not the plug-ins' splines, since these depend on options and
+ * are built in linear time.
+ */
+class transfer_table
+{
+protected:
+	size_t ncols_, nrows_;
+	std::vector<double> data_;
+
+	//! 64bit FNV-1a hash of the table contents
+	static unsigned long long hash( const std::vector<char>& buf, size_t ncols )
+	{
+		unsigned long long h = 14695981039346656037ull ^ ncols;
+		h *= 1099511628211ull;
+		for( size_t i=0; i<buf.size(); ++i )
+		{
+			h ^= (unsigned char)buf[i];
+			h *= 1099511628211ull;
+		}
+		return h;
+	}
+
+	static const char* magic( void )
+	{	return "MUSICTF1";	}
+
+	bool read_cache( const std::string& fname, unsigned long long key )
+	{
+		FILE *fp = fopen( fname.c_str(), "rb" );
+		if( fp == NULL )
+			return false;
+
+		char m[8];
+		unsigned long long head[3]; // key, number of columns, number of rows
+		bool ok = fread( m, sizeof(m), 1, fp ) == 1 && memcmp( m, magic(), sizeof(m) ) == 0
+			&& fread( head, sizeof(head), 1, fp ) == 1 && head[0] == key && head[1] == ncols_;
+
+		if( ok )
+		{
+			nrows_ = head[2];
+			data_.assign( ncols_*nrows_, 0.0 );
+			ok = data_.empty() || fread( &data_[0], sizeof(double), data_.size(), fp ) == data_.size();
+		}
+		fclose( fp );
+		return ok;
+	}
+
+	void write_cache( const std::string& fname, unsigned long long key ) const
+	{
+		std::string ftmp = fname + ".tmp";
+		FILE *fp = fopen( ftmp.c_str(), "wb" );
+		if( fp == NULL )
+		{
+			LOGWARN("Could not write transfer function cache file \'%s\'.", fname.c_str());
+			return;
+		}
+
+		unsigned long long head[3] = { key, (unsigned long long)ncols_, (unsigned long long)nrows_ };
+		bool ok = fwrite( magic(), 8, 1, fp ) == 1 && fwrite( head, sizeof(head), 1, fp ) == 1
+			&& (data_.empty() || fwrite( &data_[0], sizeof(double), data_.size(), fp ) == data_.size());
+		ok &= fclose( fp ) == 0;
+
+		if( ok )
+			ok = rename( ftmp.c_str(), fname.c_str() ) == 0;
+
+		if( !ok )
+		{
+			LOGWARN("Could not write transfer function cache file \'%s\'.", fname.c_str());
+			remove( ftmp.c_str() );
+		}
+	}
+
+	//! parse the rows of the NUL-terminated buffer
+	void parse( const std::vector<char>& buf, const std::string& fname )
+	{
+		const char *p = &buf[0];
+		size_t iline = 0;
+
+		data_.clear();
+		nrows_ = 0;
+
+		while( *p != '\0' )
+		{
+			const char *eol = strchr( p, '\n' );
+			if( eol == NULL )
+				eol = p + strlen( p );
+			++iline;
+
+			const char *q = p;
+			while( q < eol && (*q==' ' || *q=='\t' || *q=='\r') )
+				++q;
+
+			if( q < eol && memchr( q, '#', eol-q ) == NULL )
+			{
+				for( size_t i=0; i<ncols_; ++i )
+				{
+					char *end;
+					double v = strtod( q, &end );
+					if( end == q || end > eol )
+					{
+						LOGERR("Error reading the transfer function file (corrupt or not in expected format)!");
+						LOGERR("Expected %llu values in line %llu of \'%s\'.", (unsigned long long)ncols_,
+							   (unsigned long long)iline, fname.c_str());
+						throw std::runtime_error("Error reading transfer function file \'" + fname + "\'");
+					}
+					data_.push_back( v );
+					q = end;
+				}
+				++nrows_;
+			}
+
+			p = (*eol == '\0')? eol : eol+1;
+		}
+	}
+
+public:
+	//! read the first ncols columns of the table in file fname, using the binary cache if bcache
+	transfer_table( const std::string& fname, size_t ncols, bool bcache )
+	: ncols_( ncols ), nrows_( 0 )
+	{
+		FILE *fp = fopen( fname.c_str(), "rb" );
+		if( fp == NULL )
+			throw std::runtime_error("Could not find transfer function file \'" + fname + "\'");
+
+		std::vector<char> buf;
+		size_t nread;
+		char chunk[1<<16];
+		while( (nread = fread( chunk, 1, sizeof(chunk), fp )) > 0 )
+			buf.insert( buf.end(), chunk, chunk+nread );
+		bool bfail = ferror( fp ) != 0;
+		fclose( fp );
+
+		if( bfail )
+			throw std::runtime_error("Error reading transfer function file \'" + fname + "\'");
+
+		unsigned long long key = 0;
+		if( bcache )
+		{
+			key = hash( buf, ncols_ );
+			if( read_cache( fname + ".bin", key ) )
+			{
+				LOGINFO("Read transfer function table from cache file \'%s.bin\'", fname.c_str());
+				return;
+			}
+		}
+
+		buf.push_back( '\0' );
+		parse( buf, fname );
+
+		if( bcache )
+			write_cache( fname + ".bin", key );
+	}
+
+	//! number of rows read
+	size_t size( void ) const
+	{	return nrows_;	}
+
+	//! value in column icol of row irow
+	double operator()( size_t irow, size_t icol ) const
+	{	return data_[irow*ncols_+icol];	}
+};
+
+#endif //__TRANSFER_TABLE_HH
@@ -48,12 +48,43 @@ void print_poisson_plugins()
 typedef multigrid::solver< stencil_7P<float>, interp_O3_fluxcorr, mg_straight, float > poisson_solver_O2;
 typedef multigrid::solver< stencil_13P<float>, interp_O5_fluxcorr, mg_straight, float > poisson_solver_O4;
 typedef multigrid::solver< stencil_19P<float>, interp_O7_fluxcorr, mg_straight, float > poisson_solver_O6;
+
+//... there is no lower precision to solve for corrections in, mixed mode is switched off
+typedef multigrid::mixed_solver< stencil_7P<float>, stencil_7P<float>, interp_O3_fluxcorr, mg_straight, float, float > poisson_solver_O2_mixed;
+typedef multigrid::mixed_solver< stencil_13P<float>, stencil_13P<float>, interp_O5_fluxcorr, mg_straight, float, float > poisson_solver_O4_mixed;
+typedef multigrid::mixed_solver< stencil_19P<float>, stencil_19P<float>, interp_O7_fluxcorr, mg_straight, float, float > poisson_solver_O6_mixed;
 #else
 typedef multigrid::solver< stencil_7P<double>, interp_O3_fluxcorr, mg_straight, double > poisson_solver_O2;
 typedef multigrid::solver< stencil_13P<double>, interp_O5_fluxcorr, mg_straight, double > poisson_solver_O4;
 typedef multigrid::solver< stencil_19P<double>, interp_O7_fluxcorr, mg_straight, double > poisson_solver_O6;
+
+//... double precision solution and residuals, single precision correction solves
+typedef multigrid::mixed_solver< stencil_7P<double>, stencil_7P<float>, interp_O3_fluxcorr, mg_straight, double, float > poisson_solver_O2_mixed;
+typedef multigrid::mixed_solver< stencil_13P<double>, stencil_13P<float>, interp_O5_fluxcorr, mg_straight, double, float > poisson_solver_O4_mixed;
+typedef multigrid::mixed_solver< stencil_19P<double>, stencil_19P<float>, interp_O7_fluxcorr, mg_straight, double, float > poisson_solver_O6_mixed;
 #endif
 
+namespace
+{
+	//! run a multigrid solver, or its mixed precision version
+	template< class Solver, class MixedSolver >
+	double run_multigrid( grid_hierarchy& f, grid_hierarchy& u, double acc, bool mixed, double inner_acc,
+						 multigrid::opt::smtype smtype, unsigned npresmooth, unsigned npostsmooth,
+						 multigrid::opt::fmgtype fmg, unsigned ncycle, unsigned nmaxsmooth )
+	{
+		if( mixed )
+		{
+			MixedSolver ps( f, smtype, npresmooth, npostsmooth, inner_acc );
+			ps.set_schedule( fmg, ncycle, nmaxsmooth );
+			return ps.solve( u, acc, true );
+		}
+		
+		Solver ps( f, smtype, npresmooth, npostsmooth );
+		ps.set_schedule( fmg, ncycle, nmaxsmooth );
+		return ps.solve( u, acc, true );
+	}
+}
+
 
 /**************************************************************************************/
 /**************************************************************************************/
@@ -61,6 +92,9 @@ typedef multigrid::solver< stencil_19P<double>, interp_O7_fluxcorr, mg_straight,
 
 double multigrid_poisson_plugin::solve( grid_hierarchy& f, grid_hierarchy& u )
 {
+	memory_stats::stage mstage("multigrid Poisson solver");
+	profile::timer ptimer("multigrid Poisson solver");
+	
 	LOGUSER("Initializing multi-grid Poisson solver...");
 	
 	unsigned verbosity = cf_.getValueSafe<unsigned>("setup","verbosity",2);
@@ -81,6 +115,47 @@ double multigrid_poisson_plugin::solve( grid_hierarchy& f, grid_hierarchy& u )
 	ps_smoother_name	= cf_.getValueSafe<std::string>("poisson","smoother","gs");
 	order				= cf_.getValueSafe<unsigned>( "poisson", "laplace_order", 4 );
 	
+	std::string ps_fmg_name = cf_.getValueSafe<std::string>("poisson","fmg","none");
+	std::string ps_cycle_name = cf_.getValueSafe<std::string>("poisson","cycle","V");
+	unsigned ps_maxsmooth = cf_.getValueSafe<unsigned>("poisson","max_smooth",0);
+	
+	multigrid::opt::fmgtype ps_fmg = multigrid::opt::fmg_none;
+	
+	if( ps_fmg_name == std::string("cubic") )
+		ps_fmg = multigrid::opt::fmg_cubic;
+	else if( ps_fmg_name == std::string("linear") )
+		ps_fmg = multigrid::opt::fmg_linear;
+	else if( ps_fmg_name != std::string("none") )
+	{
+		LOGERR("Unknown full multigrid interpolation \'%s\' (none/linear/cubic).",ps_fmg_name.c_str());
+		throw std::runtime_error("Unknown full multigrid interpolation");
+	}
+	
+	if( ps_cycle_name != std::string("V") && ps_cycle_name != std::string("W") )
+	{
+		LOGERR("Unknown multigrid cycle \'%s\' (V/W).",ps_cycle_name.c_str());
+		throw std::runtime_error("Unknown multigrid cycle");
+	}
+	unsigned ps_ncycle = (ps_cycle_name == std::string("W"))? 2 : 1;
+	
+	if( ps_fmg != multigrid::opt::fmg_none )
+		LOGUSER("Starting multigrid from a full multigrid cycle with %s prolongation",ps_fmg_name.c_str());
+	
+	//... iterative refinement with single precision correction solves
+	bool ps_mixed = cf_.getValueSafe<bool>("poisson","mixed_precision",false);
+	double ps_inner_acc = cf_.getValueSafe<double>("poisson","mixed_inner_accuracy",1e-3);
+	
+#ifdef SINGLE_PRECISION
+	if( ps_mixed )
+	{
+		LOGWARN("Mixed precision multigrid needs a double precision build, it is switched off.");
+		ps_mixed = false;
+	}
+#else
+	if( ps_mixed )
+		LOGUSER("Using mixed precision multigrid, corrections are solved in single precision");
+#endif
+	
 	multigrid::opt::smtype ps_smtype = multigrid::opt::sm_gauss_seidel;
 	
 	if ( ps_smoother_name == std::string("gs") )
@@ -93,6 +168,11 @@ double multigrid_poisson_plugin::solve( grid_hierarchy& f, grid_hierarchy& u )
 		ps_smtype = multigrid::opt::sm_jacobi;
 		LOGUSER("Selected Jacobi multigrid smoother");	
 	}
+	else if ( ps_smoother_name == std::string("gs_blocked") )
+	{	
+		ps_smtype = multigrid::opt::sm_gauss_seidel_blocked;
+		LOGUSER("Selected blocked Gauss-Seidel multigrid smoother");
+	}
 	else if ( ps_smoother_name == std::string("sor") )
 	{	
 		ps_smtype = multigrid::opt::sm_sor;
@@ -120,20 +200,20 @@ double multigrid_poisson_plugin::solve( grid_hierarchy& f, grid_hierarchy& u )
 	if( order == 2 )
 	{
 		LOGUSER("Running multigrid solver with 2nd order Laplacian...");
-		poisson_solver_O2 ps( f, ps_smtype, ps_presmooth, ps_postsmooth );
-		err = ps.solve( u, acc, true );	
+		err = run_multigrid< poisson_solver_O2, poisson_solver_O2_mixed >( f, u, acc, ps_mixed, ps_inner_acc,
+			ps_smtype, ps_presmooth, ps_postsmooth, ps_fmg, ps_ncycle, ps_maxsmooth );
 	}
 	else if( order == 4 )
 	{
 		LOGUSER("Running multigrid solver with 4th order Laplacian...");
-		poisson_solver_O4 ps( f, ps_smtype, ps_presmooth, ps_postsmooth );
-		err = ps.solve( u, acc, true );	
+		err = run_multigrid< poisson_solver_O4, poisson_solver_O4_mixed >( f, u, acc, ps_mixed, ps_inner_acc,
+			ps_smtype, ps_presmooth, ps_postsmooth, ps_fmg, ps_ncycle, ps_maxsmooth );
 	}
 	else if( order == 6 )
 	{
 		LOGUSER("Running multigrid solver with 6th order Laplacian..");
-		poisson_solver_O6 ps( f, ps_smtype, ps_presmooth, ps_postsmooth );
-		err = ps.solve( u, acc, true );	
+		err = run_multigrid< poisson_solver_O6, poisson_solver_O6_mixed >( f, u, acc, ps_mixed, ps_inner_acc,
+			ps_smtype, ps_presmooth, ps_postsmooth, ps_fmg, ps_ncycle, ps_maxsmooth );
 	}	
 	else
 	{	
@@ -208,6 +288,85 @@ double multigrid_poisson_plugin::gradient_add( int dir, grid_hierarchy& u, grid_
 	return 0.0;
 }
 
+double multigrid_poisson_plugin::gradient_all( grid_hierarchy& u, grid_hierarchy* Du[3] )
+{
+	unsigned order = cf_.getValueSafe<unsigned>( "poisson", "grad_order", 4 );
+	implementation().gradient_all( order, u, Du, false );
+	return 0.0;
+}
+
+double multigrid_poisson_plugin::gradient_add_all( grid_hierarchy& u, grid_hierarchy* Du[3] )
+{
+	unsigned order = cf_.getValueSafe<unsigned>( "poisson", "grad_order", 4 );
+	implementation().gradient_all( order, u, Du, true );
+	return 0.0;
+}
+
+void multigrid_poisson_plugin::implementation::gradient_all( unsigned order, grid_hierarchy& u, grid_hierarchy* Du[3], bool add )
+{
+	//... central difference coefficients of u(i+d)-u(i-d), d=1..3
+	double c[4] = { 0.0, 0.0, 0.0, 0.0 };
+	int nd;
+	
+	switch( order )
+	{
+		case 2:
+			nd = 1; c[1] = 0.5;
+			break;
+		case 4:
+			nd = 2; c[1] = 8.0/12.0; c[2] = -1.0/12.0;
+			break;
+		case 6:
+			nd = 3; c[1] = 45.0/60.0; c[2] = -9.0/60.0; c[3] = 1.0/60.0;
+			break;
+		default:
+			LOGERR("Invalid order %d specified for gradient operator!",order);
+			throw std::runtime_error("Invalid order specified for gradient operator!");
+	}
+	
+	LOGUSER("Computing all components of a %dth order finite difference gradient...", order);
+	
+	for( unsigned ilevel=u.levelmin(); ilevel<=u.levelmax(); ++ilevel )
+	{
+		double h = pow(2.0,ilevel);
+		const meshvar_bnd &v = *u.get_grid(ilevel);
+		meshvar_bnd *px = Du[0]->get_grid(ilevel), *py = Du[1]->get_grid(ilevel), *pz = Du[2]->get_grid(ilevel);
+		
+		int nx = v.size(0), ny = v.size(1), nz = v.size(2);
+		const mesh_bricks bricks( nx, ny, nz );
+		
+		#pragma omp parallel for schedule(static)
+		for( int ib = 0; ib < (int)bricks.size(); ++ib )
+			for( int ix = bricks[ib].ix0; ix < bricks[ib].ix1; ++ix )
+				for( int iy = bricks[ib].iy0; iy < bricks[ib].iy1; ++iy )
+					for( int iz = bricks[ib].iz0; iz < bricks[ib].iz1; ++iz )
+					{
+						double gx = 0.0, gy = 0.0, gz = 0.0;
+						for( int d=1; d<=nd; ++d )
+						{
+							gx += c[d] * ((double)v(ix+d,iy,iz)-(double)v(ix-d,iy,iz));
+							gy += c[d] * ((double)v(ix,iy+d,iz)-(double)v(ix,iy-d,iz));
+							gz += c[d] * ((double)v(ix,iy,iz+d)-(double)v(ix,iy,iz-d));
+						}
+					
+						if( add )
+						{
+							(*px)(ix,iy,iz) += gx*h;
+							(*py)(ix,iy,iz) += gy*h;
+							(*pz)(ix,iy,iz) += gz*h;
+						}
+						else
+						{
+							(*px)(ix,iy,iz) = gx*h;
+							(*py)(ix,iy,iz) = gy*h;
+							(*pz)(ix,iy,iz) = gz*h;
+						}
+					}
+	}
+	
+	LOGUSER("Done computing a %dth order finite difference gradient.", order);
+}
+
 void multigrid_poisson_plugin::implementation::gradient_O2( int dir, grid_hierarchy& u, grid_hierarchy& Du )
 {
 	LOGUSER("Computing a 2nd order finite difference gradient...");
@@ -376,47 +535,51 @@ void multigrid_poisson_plugin::implementation::gradient_O6( int dir, grid_hierar
 	{
 		double h = pow(2.0,ilevel);
 		meshvar_bnd *pvar = Du.get_grid(ilevel);
+		const mesh_bricks bricks( (*u.get_grid(ilevel)).size(0), (*u.get_grid(ilevel)).size(1), (*u.get_grid(ilevel)).size(2) );
 		
 		h /= 60.;
 		if( dir == 0 )
-			#pragma omp parallel for
-			for( int ix = 0; ix < (int)(*u.get_grid(ilevel)).size(0); ++ix )
-				for( int iy = 0; iy < (int)(*u.get_grid(ilevel)).size(1); ++iy )
-					for( int iz = 0; iz < (int)(*u.get_grid(ilevel)).size(2); ++iz )
-						(*pvar)(ix,iy,iz) = 
-						(-(*u.get_grid(ilevel))(ix-3,iy,iz)
-						 +9.0*(*u.get_grid(ilevel))(ix-2,iy,iz)
-						 -45.0*(*u.get_grid(ilevel))(ix-1,iy,iz)
-						 +45.0*(*u.get_grid(ilevel))(ix+1,iy,iz)
-						 -9.0*(*u.get_grid(ilevel))(ix+2,iy,iz)
-						 +(*u.get_grid(ilevel))(ix+3,iy,iz))*h;
+			#pragma omp parallel for schedule(static)
+			for( int ib = 0; ib < (int)bricks.size(); ++ib )
+				for( int ix = bricks[ib].ix0; ix < bricks[ib].ix1; ++ix )
+					for( int iy = bricks[ib].iy0; iy < bricks[ib].iy1; ++iy )
+						for( int iz = bricks[ib].iz0; iz < bricks[ib].iz1; ++iz )
+							(*pvar)(ix,iy,iz) = 
+							(-(*u.get_grid(ilevel))(ix-3,iy,iz)
+							 +9.0*(*u.get_grid(ilevel))(ix-2,iy,iz)
+							 -45.0*(*u.get_grid(ilevel))(ix-1,iy,iz)
+							 +45.0*(*u.get_grid(ilevel))(ix+1,iy,iz)
+							 -9.0*(*u.get_grid(ilevel))(ix+2,iy,iz)
+							 +(*u.get_grid(ilevel))(ix+3,iy,iz))*h;
 		
 		else if( dir == 1 )
-			#pragma omp parallel for
-			for( int ix = 0; ix < (int)(*u.get_grid(ilevel)).size(0); ++ix )
-				for( int iy = 0; iy < (int)(*u.get_grid(ilevel)).size(1); ++iy )
-					for( int iz = 0; iz < (int)(*u.get_grid(ilevel)).size(2); ++iz )
-						(*pvar)(ix,iy,iz) = 
-						(-(*u.get_grid(ilevel))(ix,iy-3,iz)
-						 +9.0*(*u.get_grid(ilevel))(ix,iy-2,iz)
-						 -45.0*(*u.get_grid(ilevel))(ix,iy-1,iz)
-						 +45.0*(*u.get_grid(ilevel))(ix,iy+1,iz)
-						 -9.0*(*u.get_grid(ilevel))(ix,iy+2,iz)
-						 +(*u.get_grid(ilevel))(ix,iy+3,iz))*h;
+			#pragma omp parallel for schedule(static)
+			for( int ib = 0; ib < (int)bricks.size(); ++ib )
+				for( int ix = bricks[ib].ix0; ix < bricks[ib].ix1; ++ix )
+					for( int iy = bricks[ib].iy0; iy < bricks[ib].iy1; ++iy )
+						for( int iz = bricks[ib].iz0; iz < bricks[ib].iz1; ++iz )
+							(*pvar)(ix,iy,iz) = 
+							(-(*u.get_grid(ilevel))(ix,iy-3,iz)
+							 +9.0*(*u.get_grid(ilevel))(ix,iy-2,iz)
+							 -45.0*(*u.get_grid(ilevel))(ix,iy-1,iz)
+							 +45.0*(*u.get_grid(ilevel))(ix,iy+1,iz)
+							 -9.0*(*u.get_grid(ilevel))(ix,iy+2,iz)
+							 +(*u.get_grid(ilevel))(ix,iy+3,iz))*h;
 		
 		else if( dir == 2 )
-			#pragma omp parallel for
-			for( int ix = 0; ix < (int)(*u.get_grid(ilevel)).size(0); ++ix )
-				for( int iy = 0; iy < (int)(*u.get_grid(ilevel)).size(1); ++iy )
-					for( int iz = 0; iz < (int)(*u.get_grid(ilevel)).size(2); ++iz )
-						(*pvar)(ix,iy,iz) = 
-						(-(*u.get_grid(ilevel))(ix,iy,iz-3)
-						 +9.0*(*u.get_grid(ilevel))(ix,iy,iz-2)
-						 -45.0*(*u.get_grid(ilevel))(ix,iy,iz-1)
-						 +45.0*(*u.get_grid(ilevel))(ix,iy,iz+1)
-						 -9.0*(*u.get_grid(ilevel))(ix,iy,iz+2)
-						 +(*u.get_grid(ilevel))(ix,iy,iz+3))*h;
-	}
+			#pragma omp parallel for schedule(static)
+			for( int ib = 0; ib < (int)bricks.size(); ++ib )
+				for( int ix = bricks[ib].ix0; ix < bricks[ib].ix1; ++ix )
+					for( int iy = bricks[ib].iy0; iy < bricks[ib].iy1; ++iy )
+						for( int iz = bricks[ib].iz0; iz < bricks[ib].iz1; ++iz )
+							(*pvar)(ix,iy,iz) = 
+							(-(*u.get_grid(ilevel))(ix,iy,iz-3)
+							 +9.0*(*u.get_grid(ilevel))(ix,iy,iz-2)
+							 -45.0*(*u.get_grid(ilevel))(ix,iy,iz-1)
+							 +45.0*(*u.get_grid(ilevel))(ix,iy,iz+1)
+							 -9.0*(*u.get_grid(ilevel))(ix,iy,iz+2)
+							 +(*u.get_grid(ilevel))(ix,iy,iz+3))*h;
+		}
 		
 	LOGUSER("Done computing a 6th order finite difference gradient.");
 }
@@ -430,47 +593,51 @@ void multigrid_poisson_plugin::implementation::gradient_add_O6( int dir, grid_hi
 	{
 		double h = pow(2.0,ilevel);
 		meshvar_bnd *pvar = Du.get_grid(ilevel);
+		const mesh_bricks bricks( (*u.get_grid(ilevel)).size(0), (*u.get_grid(ilevel)).size(1), (*u.get_grid(ilevel)).size(2) );
 		
 		h /= 60.;
 		if( dir == 0 )
-			#pragma omp parallel for
-			for( int ix = 0; ix < (int)(*u.get_grid(ilevel)).size(0); ++ix )
-				for( int iy = 0; iy < (int)(*u.get_grid(ilevel)).size(1); ++iy )
-					for( int iz = 0; iz < (int)(*u.get_grid(ilevel)).size(2); ++iz )
-						(*pvar)(ix,iy,iz) += 
-						(-(*u.get_grid(ilevel))(ix-3,iy,iz)
-						 +9.0*(*u.get_grid(ilevel))(ix-2,iy,iz)
-						 -45.0*(*u.get_grid(ilevel))(ix-1,iy,iz)
-						 +45.0*(*u.get_grid(ilevel))(ix+1,iy,iz)
-						 -9.0*(*u.get_grid(ilevel))(ix+2,iy,iz)
-						 +(*u.get_grid(ilevel))(ix+3,iy,iz))*h;
+			#pragma omp parallel for schedule(static)
+			for( int ib = 0; ib < (int)bricks.size(); ++ib )
+				for( int ix = bricks[ib].ix0; ix < bricks[ib].ix1; ++ix )
+					for( int iy = bricks[ib].iy0; iy < bricks[ib].iy1; ++iy )
+						for( int iz = bricks[ib].iz0; iz < bricks[ib].iz1; ++iz )
+							(*pvar)(ix,iy,iz) += 
+							(-(*u.get_grid(ilevel))(ix-3,iy,iz)
+							 +9.0*(*u.get_grid(ilevel))(ix-2,iy,iz)
+							 -45.0*(*u.get_grid(ilevel))(ix-1,iy,iz)
+							 +45.0*(*u.get_grid(ilevel))(ix+1,iy,iz)
+							 -9.0*(*u.get_grid(ilevel))(ix+2,iy,iz)
+							 +(*u.get_grid(ilevel))(ix+3,iy,iz))*h;
 		
 		else if( dir == 1 )
-			#pragma omp parallel for
-			for( int ix = 0; ix < (int)(*u.get_grid(ilevel)).size(0); ++ix )
-				for( int iy = 0; iy < (int)(*u.get_grid(ilevel)).size(1); ++iy )
-					for( int iz = 0; iz < (int)(*u.get_grid(ilevel)).size(2); ++iz )
-						(*pvar)(ix,iy,iz) += 
-						(-(*u.get_grid(ilevel))(ix,iy-3,iz)
-						 +9.0*(*u.get_grid(ilevel))(ix,iy-2,iz)
-						 -45.0*(*u.get_grid(ilevel))(ix,iy-1,iz)
-						 +45.0*(*u.get_grid(ilevel))(ix,iy+1,iz)
-						 -9.0*(*u.get_grid(ilevel))(ix,iy+2,iz)
-						 +(*u.get_grid(ilevel))(ix,iy+3,iz))*h;
+			#pragma omp parallel for schedule(static)
+			for( int ib = 0; ib < (int)bricks.size(); ++ib )
+				for( int ix = bricks[ib].ix0; ix < bricks[ib].ix1; ++ix )
+					for( int iy = bricks[ib].iy0; iy < bricks[ib].iy1; ++iy )
+						for( int iz = bricks[ib].iz0; iz < bricks[ib].iz1; ++iz )
+							(*pvar)(ix,iy,iz) += 
+							(-(*u.get_grid(ilevel))(ix,iy-3,iz)
+							 +9.0*(*u.get_grid(ilevel))(ix,iy-2,iz)
+							 -45.0*(*u.get_grid(ilevel))(ix,iy-1,iz)
+							 +45.0*(*u.get_grid(ilevel))(ix,iy+1,iz)
+							 -9.0*(*u.get_grid(ilevel))(ix,iy+2,iz)
+							 +(*u.get_grid(ilevel))(ix,iy+3,iz))*h;
 		
 		else if( dir == 2 )
-			#pragma omp parallel for
-			for( int ix = 0; ix < (int)(*u.get_grid(ilevel)).size(0); ++ix )
-				for( int iy = 0; iy < (int)(*u.get_grid(ilevel)).size(1); ++iy )
-					for( int iz = 0; iz < (int)(*u.get_grid(ilevel)).size(2); ++iz )
-						(*pvar)(ix,iy,iz) += 
-						(-(*u.get_grid(ilevel))(ix,iy,iz-3)
-						 +9.0*(*u.get_grid(ilevel))(ix,iy,iz-2)
-						 -45.0*(*u.get_grid(ilevel))(ix,iy,iz-1)
-						 +45.0*(*u.get_grid(ilevel))(ix,iy,iz+1)
-						 -9.0*(*u.get_grid(ilevel))(ix,iy,iz+2)
-						 +(*u.get_grid(ilevel))(ix,iy,iz+3))*h;
-	}
+			#pragma omp parallel for schedule(static)
+			for( int ib = 0; ib < (int)bricks.size(); ++ib )
+				for( int ix = bricks[ib].ix0; ix < bricks[ib].ix1; ++ix )
+					for( int iy = bricks[ib].iy0; iy < bricks[ib].iy1; ++iy )
+						for( int iz = bricks[ib].iz0; iz < bricks[ib].iz1; ++iz )
+							(*pvar)(ix,iy,iz) += 
+							(-(*u.get_grid(ilevel))(ix,iy,iz-3)
+							 +9.0*(*u.get_grid(ilevel))(ix,iy,iz-2)
+							 -45.0*(*u.get_grid(ilevel))(ix,iy,iz-1)
+							 +45.0*(*u.get_grid(ilevel))(ix,iy,iz+1)
+							 -9.0*(*u.get_grid(ilevel))(ix,iy,iz+2)
+							 +(*u.get_grid(ilevel))(ix,iy,iz+3))*h;
+		}
 	
 	LOGUSER("Done computing a 6th order finite difference gradient.");
 }
@@ -479,9 +646,14 @@ void multigrid_poisson_plugin::implementation::gradient_add_O6( int dir, grid_hi
 /**************************************************************************************/
 /**************************************************************************************/
 #include "general.hh"
+#include "fft_plans.hh"
+#include "fft_mpi.hh"
 
 double fft_poisson_plugin::solve( grid_hierarchy& f, grid_hierarchy& u )
 {
+	memory_stats::stage mstage("k-space Poisson solver");
+	profile::timer ptimer("k-space Poisson solver");
+	
 	LOGUSER("Entering k-space Poisson solver...");
 	
 	unsigned verbosity = cf_.getValueSafe<unsigned>("setup","verbosity",2);
@@ -504,6 +676,14 @@ double fft_poisson_plugin::solve( grid_hierarchy& f, grid_hierarchy& u )
 	nz = f.get_grid(f.levelmax())->size(2);
 	nzp = 2*(nz/2+1);
 	
+	//... in distributed runs the grid holds the planes x0...x0+nx-1 of the base grid
+	fft_mpi::slab sl = fft_mpi::decompose( fft_mpi::active()? (1<<f.levelmax()) : nx, ny, nz );
+	int nxg = sl.n0, x0 = sl.local_0_start;
+	if( sl.local_n0 != nx )
+	{
+		LOGERR("Slab of %d planes does not match the FFT decomposition.",nx);
+		throw std::runtime_error("fft_poisson_plugin::solve : slab does not match the FFT decomposition");
+	}
 	
 	//... copy data ..................................................
 	fftw_real *data = new fftw_real[(size_t)nx*(size_t)ny*(size_t)nzp];
@@ -522,19 +702,18 @@ double fft_poisson_plugin::solve( grid_hierarchy& f, grid_hierarchy& u )
 	LOGUSER("Performing forward transform.");
 
 #ifdef FFTW3
-	#ifdef SINGLE_PRECISION
-	fftwf_plan 
-		plan  = fftwf_plan_dft_r2c_3d( nx, ny, nz, data, cdata, FFTW_ESTIMATE ),
-		iplan = fftwf_plan_dft_c2r_3d( nx, ny, nz, cdata, data, FFTW_ESTIMATE );
-	
-	fftwf_execute(plan);
-	#else
-	fftw_plan 
-	plan  = fftw_plan_dft_r2c_3d( nx, ny, nz, data, cdata, FFTW_ESTIMATE ),
-	iplan = fftw_plan_dft_c2r_3d( nx, ny, nz, cdata, data, FFTW_ESTIMATE );
+	fft_plans::transform plan, iplan;
+#ifdef USE_FFTW_MPI
+	if( fft_mpi::active() )
+		fft_mpi::forward( sl, data );
+	else
+#endif
+	{
+		plan  = fft_plans::r2c( nx, ny, nz, data, cdata );
+		iplan = fft_plans::c2r( nx, ny, nz, cdata, data );
 	
-	fftw_execute(plan);
-	#endif
+		fft_plans::execute(plan);
+	}
 	
 #else
 	rfftwnd_plan 
@@ -552,14 +731,14 @@ double fft_poisson_plugin::solve( grid_hierarchy& f, grid_hierarchy& u )
 	
 #endif
 	double kfac = 2.0*M_PI;
-	double fac = -1.0/(double)((size_t)nx*(size_t)ny*(size_t)nz);
+	double fac = -1.0/(double)((size_t)nxg*(size_t)ny*(size_t)nz);
 	
 	#pragma omp parallel for
 	for( int i=0; i<nx; ++i )
 		for( int j=0; j<ny; ++j )	
 			for( int k=0; k<nz/2+1; ++k )
 			{
-				int ii = i; if(ii>nx/2) ii-=nx;
+				int ii = i+x0; if(ii>nxg/2) ii-=nxg;
 				int jj = j; if(jj>ny/2) jj-=ny;
 				double ki = (double)ii;
 				double kj = (double)jj;
@@ -573,21 +752,21 @@ double fft_poisson_plugin::solve( grid_hierarchy& f, grid_hierarchy& u )
 				IM(cdata[idx]) *= -1.0/kk2*fac;
 			}
 
-	RE(cdata[0]) = 0.0;
-	IM(cdata[0]) = 0.0;
+	if( x0 == 0 )
+	{
+		RE(cdata[0]) = 0.0;
+		IM(cdata[0]) = 0.0;
+	}
 	
 	LOGUSER("Performing backward transform.");
 	
 #ifdef FFTW3
-	#ifdef SINGLE_PRECISION
-	fftwf_execute(iplan);
-	fftwf_destroy_plan(plan);
-	fftwf_destroy_plan(iplan);
-	#else
-	fftw_execute(iplan);
-	fftw_destroy_plan(plan);
-	fftw_destroy_plan(iplan);
-	#endif
+#ifdef USE_FFTW_MPI
+	if( fft_mpi::active() )
+		fft_mpi::backward( sl, data );
+	else
+#endif
+		fft_plans::execute(iplan);
 #else
 	#ifndef SINGLETHREAD_FFTW		
 	rfftwnd_threads_one_complex_to_real( omp_get_max_threads(), iplan, cdata, NULL );
@@ -615,25 +794,12 @@ double fft_poisson_plugin::solve( grid_hierarchy& f, grid_hierarchy& u )
 	
 	delete[] data;
 	
-	//... set boundary values ................................
+	//... set boundary values along y and z, then along x from the neighbouring slabs
 	int nb = u.get_grid(u.levelmax())->m_nbnd;
-	for( int iy=-nb; iy<ny+nb; ++iy )
+	for( int ix=0; ix<nx; ++ix )
 		for( int iz=-nb; iz<nz+nb; ++iz )
 		{
-			int iiy( (iy+ny)%ny ), iiz( (iz+nz)%nz );
-			
-			for( int i=-nb; i<0; ++i )
-			{
-				(*u.get_grid(u.levelmax()))(i,iy,iz) = (*u.get_grid(u.levelmax()))(nx+i,iiy,iiz);
-				(*u.get_grid(u.levelmax()))(nx-1-i,iy,iz) = (*u.get_grid(u.levelmax()))(-1-i,iiy,iiz);	
-			}
-			
-		}
-		
-	for( int ix=-nb; ix<nx+nb; ++ix )
-		for( int iz=-nb; iz<nz+nb; ++iz )
-		{
-			int iix( (ix+nx)%nx ), iiz( (iz+nz)%nz );
+			int iix( ix ), iiz( (iz+nz)%nz );
 			
 			for( int i=-nb; i<0; ++i )
 			{
@@ -642,10 +808,10 @@ double fft_poisson_plugin::solve( grid_hierarchy& f, grid_hierarchy& u )
 			}
 		}
 		
-	for( int ix=-nb; ix<nx+nb; ++ix )
+	for( int ix=0; ix<nx; ++ix )
 		for( int iy=-nb; iy<ny+nb; ++iy )
 		{
-			int iix( (ix+nx)%nx ), iiy( (iy+ny)%ny );
+			int iix( ix ), iiy( (iy+ny)%ny );
 			
 			for( int i=-nb; i<0; ++i )
 			{
@@ -653,6 +819,8 @@ double fft_poisson_plugin::solve( grid_hierarchy& f, grid_hierarchy& u )
 				(*u.get_grid(u.levelmax()))(ix,iy,nz-1-i) = (*u.get_grid(u.levelmax()))(iix,iiy,-1-i);
 			}
 		}
+	
+	fft_mpi::exchange_ghosts( *u.get_grid(u.levelmax()) );
 		
 		
 
@@ -678,6 +846,15 @@ double fft_poisson_plugin::gradient( int dir, grid_hierarchy& u, grid_hierarchy&
 	nz = u.get_grid(u.levelmax())->size(2);
 	nzp = 2*(nz/2+1);
 	
+	//... in distributed runs the grid holds the planes x0...x0+nx-1 of the base grid
+	fft_mpi::slab sl = fft_mpi::decompose( fft_mpi::active()? (1<<u.levelmax()) : nx, ny, nz );
+	int nxg = sl.n0, x0 = sl.local_0_start;
+	if( sl.local_n0 != nx )
+	{
+		LOGERR("Slab of %d planes does not match the FFT decomposition.",nx);
+		throw std::runtime_error("fft_poisson_plugin::gradient : slab does not match the FFT decomposition");
+	}
+	
 	//... copy data ..................................................
 	fftw_real *data = new fftw_real[(size_t)nx*(size_t)ny*(size_t)nzp];
 	fftw_complex *cdata = reinterpret_cast<fftw_complex*> (data);
@@ -694,19 +871,18 @@ double fft_poisson_plugin::gradient( int dir, grid_hierarchy& u, grid_hierarchy&
 	//... perform FFT and Poisson solve................................
 	
 #ifdef FFTW3
-	#ifdef SINGLE_PRECISION
-	fftwf_plan 
-		plan  = fftwf_plan_dft_r2c_3d(nx, ny, nz, data, cdata, FFTW_ESTIMATE),
-		iplan = fftwf_plan_dft_c2r_3d(nx, ny, nz, cdata, data, FFTW_ESTIMATE);
-	
-	fftwf_execute(plan);
-	#else	
-	fftw_plan 
-	plan  = fftw_plan_dft_r2c_3d(nx, ny, nz, data, cdata, FFTW_ESTIMATE),
-	iplan = fftw_plan_dft_c2r_3d(nx, ny, nz, cdata, data, FFTW_ESTIMATE);
-	
-	fftw_execute(plan);
-	#endif
+	fft_plans::transform plan, iplan;
+#ifdef USE_FFTW_MPI
+	if( fft_mpi::active() )
+		fft_mpi::forward( sl, data );
+	else
+#endif
+	{
+		plan  = fft_plans::r2c(nx, ny, nz, data, cdata);
+		iplan = fft_plans::c2r(nx, ny, nz, cdata, data);
+	
+		fft_plans::execute(plan);
+	}
 #else
 	rfftwnd_plan 
 		plan = rfftw3d_create_plan( nx,ny,nz,
@@ -723,7 +899,7 @@ double fft_poisson_plugin::gradient( int dir, grid_hierarchy& u, grid_hierarchy&
 	
 #endif
 	
-	double fac = -1.0/(double)((size_t)nx*(size_t)ny*(size_t)nz);
+	double fac = -1.0/(double)((size_t)nxg*(size_t)ny*(size_t)nz);
 	double kfac = 2.0*M_PI;
 	
 	
@@ -740,7 +916,7 @@ double fft_poisson_plugin::gradient( int dir, grid_hierarchy& u, grid_hierarchy&
 			for( int k=0; k<nz/2+1; ++k )
 			{
 				size_t idx = (size_t)(i*ny+j)*(size_t)(nzp/2)+(size_t)k;
-				int ii = i; if(ii>nx/2) ii-=nx;
+				int ii = i+x0; if(ii>nxg/2) ii-=nxg;
 				int jj = j; if(jj>ny/2) jj-=ny;
 				const double ki = (double)ii;
 				const double kj = (double)jj;
@@ -760,7 +936,7 @@ double fft_poisson_plugin::gradient( int dir, grid_hierarchy& u, grid_hierarchy&
 				if( deconvolve_cic )
 				{
 					double dfx, dfy, dfz;
-					dfx = M_PI*ki/(double)nx; dfx = (i!=0)? sin(dfx)/dfx : 1.0;
+					dfx = M_PI*ki/(double)nxg; dfx = (ii!=0)? sin(dfx)/dfx : 1.0;
 					dfy = M_PI*kj/(double)ny; dfy = (j!=0)? sin(dfy)/dfy : 1.0;
 					dfz = M_PI*kk/(double)nz; dfz = (k!=0)? sin(dfz)/dfz : 1.0;
 					
@@ -773,7 +949,7 @@ double fft_poisson_plugin::gradient( int dir, grid_hierarchy& u, grid_hierarchy&
 				if( deconvolve_cic )
 				{
 					double dfx, dfy, dfz;
-					dfx = M_PI*ki/(double)nx; dfx = (i!=0)? sin(dfx)/dfx : 1.0;
+					dfx = M_PI*ki/(double)nxg; dfx = (ii!=0)? sin(dfx)/dfx : 1.0;
 					dfy = M_PI*kj/(double)ny; dfy = (j!=0)? sin(dfy)/dfy : 1.0;
 					dfz = M_PI*kk/(double)nz; dfz = (k!=0)? sin(dfz)/dfz : 1.0;
 					
@@ -792,19 +968,19 @@ double fft_poisson_plugin::gradient( int dir, grid_hierarchy& u, grid_hierarchy&
 				}*/
 			}
 	
-	RE(cdata[0]) = 0.0;
-	IM(cdata[0]) = 0.0;
+	if( x0 == 0 )
+	{
+		RE(cdata[0]) = 0.0;
+		IM(cdata[0]) = 0.0;
+	}
 	
 #ifdef FFTW3
-	#ifdef SINGLE_PRECISION
-	fftwf_execute(iplan);
-	fftwf_destroy_plan(plan);
-	fftwf_destroy_plan(iplan);
-	#else
-	fftw_execute(iplan);
-	fftw_destroy_plan(plan);
-	fftw_destroy_plan(iplan);
-	#endif
+#ifdef USE_FFTW_MPI
+	if( fft_mpi::active() )
+		fft_mpi::backward( sl, data );
+	else
+#endif
+		fft_plans::execute(iplan);
 
 #else
 	#ifndef SINGLETHREAD_FFTW		
@@ -958,28 +1134,63 @@ inline double poisson_hybrid_kernel<6>(int idir, int i, int j, int k, int n )
 }
 	   
 	   
+//! multiply the spectrum in by the hybrid correction kernel for direction idir, out may be equal to in
 template<int order>
-void do_poisson_hybrid( fftw_real* data, int idir, int nxp, int nyp, int nzp, bool periodic, bool deconvolve_cic )
+void apply_poisson_hybrid_kernel( const fftw_complex* in, fftw_complex* out, int idir, int nxp, int nyp, int nzp, bool deconvolve_cic )
 {
 	double fftnorm = 1.0/((double)nxp*(double)nyp*(double)nzp);
-		
+	
+	#pragma omp parallel for
+	for( int i=0; i<nxp; ++i )
+		for( int j=0; j<nyp; ++j )
+			for( int k=0; k<nzp/2+1; ++k )
+			{
+			
+				size_t ii = (size_t)(i*nyp + j) * (size_t)(nzp/2+1) + (size_t)k;
+	
+				int ki(i), kj(j), kk(k);
+				if( ki > nxp/2 ) ki-=nxp;
+				if( kj > nyp/2 ) kj-=nyp;
+				
+				//... apply hybrid correction
+				double dk = poisson_hybrid_kernel<order>(idir, ki, kj, k, nxp/2 );
+				
+				fftw_real re = RE(in[ii]), im = IM(in[ii]);
+				
+				RE(out[ii]) = -im*dk*fftnorm;
+				IM(out[ii]) = re*dk*fftnorm;
+
+				if( deconvolve_cic )
+				{
+					double dfx, dfy, dfz;
+					dfx = M_PI*ki/(double)nxp; dfx = (i!=0)? sin(dfx)/dfx : 1.0;
+					dfy = M_PI*kj/(double)nyp; dfy = (j!=0)? sin(dfy)/dfy : 1.0;
+					dfz = M_PI*kk/(double)nzp; dfz = (k!=0)? sin(dfz)/dfz : 1.0;
+					
+					dfx = 1.0/(dfx*dfy*dfz); dfx = dfx*dfx;
+					RE(out[ii]) *= dfx;
+					IM(out[ii]) *= dfx;
+					
+				}
+			}
+	
+	RE(out[0]) = 0.0;
+	IM(out[0]) = 0.0;
+}
+
+template<int order>
+void do_poisson_hybrid( fftw_real* data, int idir, int nxp, int nyp, int nzp, bool periodic, bool deconvolve_cic )
+{
 	fftw_complex	*cdata = reinterpret_cast<fftw_complex*>(data);
 	
 	if( deconvolve_cic )
 	  LOGINFO("CIC deconvolution step is enabled.");
 
 #ifdef FFTW3
-	#ifdef SINGLE_PRECISION
-	fftwf_plan iplan, plan;
-	plan  = fftwf_plan_dft_r2c_3d(nxp, nyp, nzp, data, cdata, FFTW_ESTIMATE);
-	iplan = fftwf_plan_dft_c2r_3d(nxp, nyp, nzp, cdata, data, FFTW_ESTIMATE);
-	fftwf_execute(plan);
-	#else
-	fftw_plan iplan, plan;
-	plan  = fftw_plan_dft_r2c_3d(nxp, nyp, nzp, data, cdata, FFTW_ESTIMATE);
-	iplan = fftw_plan_dft_c2r_3d(nxp, nyp, nzp, cdata, data, FFTW_ESTIMATE);
-	fftw_execute(plan);
-	#endif
+	fft_plans::transform iplan, plan;
+	plan  = fft_plans::r2c(nxp, nyp, nzp, data, cdata);
+	iplan = fft_plans::c2r(nxp, nyp, nzp, cdata, data);
+	fft_plans::execute(plan);
 #else
 	rfftwnd_plan	iplan, plan;
 	
@@ -1020,64 +1231,10 @@ void do_poisson_hybrid( fftw_real* data, int idir, int nxp, int nyp, int nzp, bo
 	kcount = 0;
 	
 	
-	#pragma omp parallel for
-	for( int i=0; i<nxp; ++i )
-		for( int j=0; j<nyp; ++j )
-			for( int k=0; k<nzp/2+1; ++k )
-			{
-			
-				size_t ii = (size_t)(i*nyp + j) * (size_t)(nzp/2+1) + (size_t)k;
-	
-				int ki(i), kj(j), kk(k);
-				if( ki > nxp/2 ) ki-=nxp;
-				if( kj > nyp/2 ) kj-=nyp;
-				
-				//... apply hybrid correction
-				double dk = poisson_hybrid_kernel<order>(idir, ki, kj, k, nxp/2 );
-				//RE(cdata[ii]) -= ksum;
-				
-				fftw_real re = RE(cdata[ii]), im = IM(cdata[ii]);
-				
-				RE(cdata[ii]) = -im*dk*fftnorm;
-				IM(cdata[ii]) = re*dk*fftnorm;
-
-				if( deconvolve_cic )
-				{
-					double dfx, dfy, dfz;
-					dfx = M_PI*ki/(double)nxp; dfx = (i!=0)? sin(dfx)/dfx : 1.0;
-					dfy = M_PI*kj/(double)nyp; dfy = (j!=0)? sin(dfy)/dfy : 1.0;
-					dfz = M_PI*kk/(double)nzp; dfz = (k!=0)? sin(dfz)/dfz : 1.0;
-					
-					dfx = 1.0/(dfx*dfy*dfz); dfx = dfx*dfx;
-					RE(cdata[ii]) *= dfx;
-					IM(cdata[ii]) *= dfx;
-					
-				}
-
-				
-
-				//RE(cdata[ii]) += ksum*fftnorm;
-				
-				//if( i==nxp/2||j==nyp/2||k==nzp/2 )
-				//{
-				//	RE(cdata[ii]) = 0.0;
-				//	IM(cdata[ii]) = 0.0;
-				//}
-			}
-	
-	RE(cdata[0]) = 0.0;
-	IM(cdata[0]) = 0.0;
+	apply_poisson_hybrid_kernel<order>( cdata, cdata, idir, nxp, nyp, nzp, deconvolve_cic );
 	
 #ifdef FFTW3
-	#ifdef SINGLE_PRECISION
-	fftwf_execute(iplan);
-	fftwf_destroy_plan(plan);
-	fftwf_destroy_plan(iplan);
-	#else
-	fftw_execute(iplan);
-	fftw_destroy_plan(plan);
-	fftw_destroy_plan(iplan);
-	#endif	
+	fft_plans::execute(iplan);
 #else
 	#ifndef SINGLETHREAD_FFTW		
 	rfftwnd_threads_one_complex_to_real( omp_get_max_threads(), iplan, cdata, NULL);
@@ -1181,11 +1338,122 @@ void poisson_hybrid( T& f, int idir, int order, bool periodic, bool deconvolve_c
 }
 	   
 	   
+/*
+ * Same as poisson_hybrid for the three directions at once: the padded field is
+ * transformed only once and its spectrum is kept while each direction gets its
+ * own kernel and inverse transform in a second buffer. f may be one of Df.
+ */
+template< typename T >
+void poisson_hybrid_all( T& f, T* Df[3], int order, bool periodic, bool deconvolve_cic )
+{
+	int nx=f.size(0), ny=f.size(1), nz=f.size(2), nxp, nyp, nzp;
+	int xo=0,yo=0,zo=0;
+	int nmax = std::max(nx,std::max(ny,nz));
+	
+	if( order != 2 && order != 4 && order != 6 )
+	{
+		LOGERR("Invalid operator order specified in deconvolution.");
+		throw std::runtime_error("Invalid operator order specified in deconvolution");
+	}
+	
+	LOGUSER("Entering hybrid Poisson solver for all directions...");
+	
+	if(!periodic)
+	{
+		nxp = nyp = nzp = 2*nmax;
+		xo = yo = zo = nmax/2;
+	}
+	else
+		nxp = nyp = nzp = nmax;
+	
+	size_t npad = (size_t)nxp*(size_t)nyp*(size_t)(nzp+2);
+	fftw_real *data = new fftw_real[npad], *work = new fftw_real[npad];
+	fftw_complex *cdata = reinterpret_cast<fftw_complex*>(data), *cwork = reinterpret_cast<fftw_complex*>(work);
+	
+	std::cout << "   - Performing hybrid Poisson step for all directions... (" << nxp <<  ", " << nyp << ", " << nzp << ")\n";
+	
+	#pragma omp parallel for
+	for( int i=0; i<nxp; ++i )
+		for( int j=0; j<nyp; ++j )
+			for( int k=0; k<=nzp; ++k )
+				data[((size_t)i*(size_t)nyp+(size_t)j)*(size_t)(nzp+2)+(size_t)k] = 0.0;
+	
+	#pragma omp parallel for
+	for( int i=0; i<nx; ++i )
+		for( int j=0; j<ny; ++j )
+			for( int k=0; k<nz; ++k )
+			{
+				size_t idx = (size_t)((i+xo)*nyp + j+yo) * (size_t)(nzp+2) + (size_t)(k+zo);
+				data[idx] = f(i,j,k);
+			}
+	
+	if( deconvolve_cic )
+		LOGINFO("CIC deconvolution step is enabled.");
+	
+#ifdef FFTW3
+	fft_plans::execute( fft_plans::r2c(nxp, nyp, nzp, data, cdata) );
+	fft_plans::transform iplan = fft_plans::c2r(nxp, nyp, nzp, cwork, work);
+#else
+	rfftwnd_plan	iplan, plan;
+	plan  = rfftw3d_create_plan( nxp, nyp, nzp, FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE|FFTW_IN_PLACE);
+	iplan = rfftw3d_create_plan( nxp, nyp, nzp, FFTW_COMPLEX_TO_REAL, FFTW_ESTIMATE|FFTW_IN_PLACE);
+	
+	#ifndef SINGLETHREAD_FFTW		
+	rfftwnd_threads_one_real_to_complex( omp_get_max_threads(), plan, data, NULL );
+	#else
+	rfftwnd_one_real_to_complex( plan, data, NULL );
+	#endif
+#endif
+	
+	for( int idir=0; idir<3; ++idir )
+	{
+		if( order == 2 )
+			apply_poisson_hybrid_kernel<2>( cdata, cwork, idir, nxp, nyp, nzp, deconvolve_cic );
+		else if( order == 4 )
+			apply_poisson_hybrid_kernel<4>( cdata, cwork, idir, nxp, nyp, nzp, deconvolve_cic );
+		else
+			apply_poisson_hybrid_kernel<6>( cdata, cwork, idir, nxp, nyp, nzp, deconvolve_cic );
+		
+#ifdef FFTW3
+		fft_plans::execute( iplan );
+#else
+	#ifndef SINGLETHREAD_FFTW		
+		rfftwnd_threads_one_complex_to_real( omp_get_max_threads(), iplan, cwork, NULL);
+	#else		
+		rfftwnd_one_complex_to_real(iplan, cwork, NULL);
+	#endif
+#endif
+		
+		T& D = *Df[idir];
+		
+		#pragma omp parallel for
+		for( int i=0; i<nx; ++i )
+			for( int j=0; j<ny; ++j )
+				for( int k=0; k<nz; ++k )
+				{
+					size_t idx = ((size_t)(i+xo)*nyp + (size_t)(j+yo)) * (size_t)(nzp+2) + (size_t)(k+zo);	
+					D(i,j,k) = work[idx];
+				}
+	}
+	
+#ifndef FFTW3
+	rfftwnd_destroy_plan(plan);
+	rfftwnd_destroy_plan(iplan);
+#endif
+	
+	delete[] work;
+	delete[] data;
+	
+	LOGUSER("Done with hybrid Poisson solve.");
+}
+
 /**************************************************************************************/
 /**************************************************************************************/
 
 template void poisson_hybrid< MeshvarBnd<double> >( MeshvarBnd<double>& f, int idir, int order, bool periodic, bool deconvolve_cic );
 template void poisson_hybrid< MeshvarBnd<float> >( MeshvarBnd<float>& f, int idir, int order, bool periodic, bool deconvolve_cic );
+template void poisson_hybrid_all< MeshvarBnd<double> >( MeshvarBnd<double>& f, MeshvarBnd<double>* Df[3], int order, bool periodic, bool deconvolve_cic );
+template void poisson_hybrid_all< MeshvarBnd<float> >( MeshvarBnd<float>& f, MeshvarBnd<float>* Df[3], int order, bool periodic, bool deconvolve_cic );
 
 namespace{
 	poisson_plugin_creator_concrete<multigrid_poisson_plugin> multigrid_poisson_creator("mg_poisson");
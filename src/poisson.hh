@@ -45,6 +45,22 @@ public:
 	//! compute the gradient and add
 	virtual double gradient_add( int dir, grid_hierarchy& u, grid_hierarchy& Du ) = 0;
 	
+	//! compute all three components of the gradient of u, Du[i] receives component i
+	virtual double gradient_all( grid_hierarchy& u, grid_hierarchy* Du[3] )
+	{
+		for( int i=0; i<3; ++i )
+			gradient( i, u, *Du[i] );
+		return 0.0;
+	}
+	
+	//! compute all three components of the gradient of u and add them to Du[i]
+	virtual double gradient_add_all( grid_hierarchy& u, grid_hierarchy* Du[3] )
+	{
+		for( int i=0; i<3; ++i )
+			gradient_add( i, u, *Du[i] );
+		return 0.0;
+	}
+	
 };
 
 /*!
@@ -107,6 +123,12 @@ public:
 	//! compute the gradient and add
 	double gradient_add( int dir, grid_hierarchy& u, grid_hierarchy& Du );
 	
+	//! compute all three gradient components in one pass, Du[i] must have the structure of u
+	double gradient_all( grid_hierarchy& u, grid_hierarchy* Du[3] );
+	
+	//! compute and add all three gradient components in one pass
+	double gradient_add_all( grid_hierarchy& u, grid_hierarchy* Du[3] );
+	
 protected:
 	
 	//! various FD approximation implementations
@@ -138,6 +160,9 @@ protected:
 		
 		//! compute and add 6th order FD gradient
 		void gradient_add_O6( int dir, grid_hierarchy& u, grid_hierarchy& Du );
+		
+		//! compute (or add) all components of an FD gradient of given order in one pass over u
+		void gradient_all( unsigned order, grid_hierarchy& u, grid_hierarchy* Du[3], bool add );
 	};
 };
 
@@ -172,6 +197,10 @@ public:
 template< typename T >
 void poisson_hybrid( T& f, int idir, int order, bool periodic, bool deconvolve_cic );
 
+//! hybrid Poisson correction of f for all three directions from one forward FFT, Df[idir] receives direction idir
+template< typename T >
+void poisson_hybrid_all( T& f, T* Df[3], int order, bool periodic, bool deconvolve_cic );
+
 
 #endif // __POISSON_HH
 
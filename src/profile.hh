@@ -0,0 +1,195 @@
+/*
+
+ profile.hh - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#ifndef __PROFILE_HH
+#define __PROFILE_HH
+
+#include <cstdio>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+
+/*!
+ * @brief run-time profile of the driver stages
+ *
+ * Stages are timed by profile::timer objects, which nest per thread: a timer
+ * started while another one is running on the same thread is recorded under
+ * the path 'outer/inner'. Counters accumulate the number of events and a
+ * quantity per event, e.g. the points of each FFT size, multigrid cycles, grid
+ * bytes allocated or bytes written by the output plug-in. At the end of a run
+ * both are written as JSON, together with what was stored by info().
+ */
+namespace profile
+{
+	//! number of calls or events and the sum, minimum and maximum of the recorded values
+	struct entry
+	{
+		long long calls;
+		double sum, min, max;
+	};
+
+	typedef std::map< std::string, entry > entry_map;
+
+	struct profile_state
+	{
+		std::mutex mutex;
+		entry_map timers, counters;
+		std::map< std::string, std::string > info;
+		std::chrono::steady_clock::time_point start;
+
+		profile_state( void )
+		: start( std::chrono::steady_clock::now() )
+		{ }
+	};
+
+	inline profile_state& state( void )
+	{
+		static profile_state s;
+		return s;
+	}
+
+	inline double seconds_since( const std::chrono::steady_clock::time_point& t )
+	{	return std::chrono::duration<double>( std::chrono::steady_clock::now() - t ).count();	}
+
+	inline void record( entry_map& m, const std::string& name, double value )
+	{
+		std::lock_guard<std::mutex> lock( state().mutex );
+		entry_map::iterator it = m.find( name );
+		if( it == m.end() )
+		{
+			entry e = { 1, value, value, value };
+			m.insert( std::make_pair( name, e ) );
+			return;
+		}
+		entry& e = it->second;
+		++e.calls;
+		e.sum += value;
+		if( value < e.min ) e.min = value;
+		if( value > e.max ) e.max = value;
+	}
+
+	//! drop everything recorded so far and restart the clock
+	inline void reset( void )
+	{
+		profile_state& s = state();
+		std::lock_guard<std::mutex> lock( s.mutex );
+		s.timers.clear();
+		s.counters.clear();
+		s.info.clear();
+		s.start = std::chrono::steady_clock::now();
+	}
+
+	//! count one event of the kind name with the quantity value
+	inline void count( const std::string& name, double value = 1.0 )
+	{	record( state().counters, name, value );	}
+
+	//! store a property of the run that is written with the profile
+	inline void info( const std::string& key, const std::string& value )
+	{
+		std::lock_guard<std::mutex> lock( state().mutex );
+		state().info[key] = value;
+	}
+
+	//! path of the timers running on the calling thread
+	inline std::string& current_path( void )
+	{
+		static thread_local std::string path;
+		return path;
+	}
+
+	//! times the stage name for the lifetime of the object, timers on one thread have to end in reverse order
+	class timer
+	{
+	protected:
+		std::string path_;
+		size_t parent_length_;
+		bool running_;
+		std::chrono::steady_clock::time_point start_;
+
+	public:
+		explicit timer( const std::string& name )
+		: running_( true )
+		{
+			std::string& p = current_path();
+			parent_length_ = p.size();
+			if( !p.empty() )
+				p += '/';
+			p += name;
+			path_ = p;
+			start_ = std::chrono::steady_clock::now();
+		}
+
+		~timer()
+		{	stop();	}
+
+		//! end the stage before the object goes out of scope
+		void stop( void )
+		{
+			if( !running_ )
+				return;
+
+			record( state().timers, path_, seconds_since( start_ ) );
+			current_path().resize( parent_length_ );
+			running_ = false;
+		}
+	};
+
+	inline std::string json_string( const std::string& s )
+	{
+		std::string out( "\"" );
+		for( size_t i=0; i<s.size(); ++i )
+		{
+			if( s[i] == '\"' || s[i] == '\\' )
+				out += '\\';
+			if( (unsigned char)s[i] < 0x20 )
+				out += ' ';
+			else
+				out += s[i];
+		}
+		return out + "\"";
+	}
+
+	inline void write_entries( FILE *fp, const char *name, const entry_map& m, bool last )
+	{
+		fprintf( fp, "  \"%s\": {", name );
+		for( entry_map::const_iterator it = m.begin(); it != m.end(); ++it )
+			fprintf( fp, "%s\n    %s: { \"calls\": %lld, \"sum\": %.9g, \"min\": %.9g, \"max\": %.9g }",
+					 (it==m.begin())? "" : ",", json_string( it->first ).c_str(),
+					 it->second.calls, it->second.sum, it->second.min, it->second.max );
+		fprintf( fp, "%s}%s\n", m.empty()? "" : "\n  ", last? "" : "," );
+	}
+
+	//! write the profile as JSON, timer sums are in seconds, false if the file could not be written
+	inline bool write( const std::string& fname )
+	{
+		profile_state& s = state();
+		std::lock_guard<std::mutex> lock( s.mutex );
+
+		FILE *fp = fopen( fname.c_str(), "w" );
+		if( fp == NULL )
+			return false;
+
+		fprintf( fp, "{\n  \"info\": {" );
+		for( std::map< std::string, std::string >::const_iterator it = s.info.begin(); it != s.info.end(); ++it )
+			fprintf( fp, "%s\n    %s: %s", (it==s.info.begin())? "" : ",",
+					 json_string( it->first ).c_str(), json_string( it->second ).c_str() );
+		fprintf( fp, "%s},\n", s.info.empty()? "" : "\n  " );
+		fprintf( fp, "  \"wall_seconds\": %.9g,\n", seconds_since( s.start ) );
+
+		write_entries( fp, "timers", s.timers, false );
+		write_entries( fp, "counters", s.counters, true );
+		fprintf( fp, "}\n" );
+
+		return fclose( fp ) == 0;
+	}
+}
+
+#endif //__PROFILE_HH
@@ -8,7 +8,17 @@
  
  */
 
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
 #include "random.hh"
+#include "byte_order.hh"
+#include "fft_plans.hh"
+#include "first_touch.hh"
+#include "fft_mpi.hh"
 
 // TODO: move all this into a plugin!!!
 
@@ -103,98 +113,120 @@ void rapid_proto_ngenic_rng(size_t res, long baseseed, random_numbers<T> &R)
 
 	double fnorm = 1. / sqrt(res * res * res);
 
-#warning need to check for race conditions below
-	//#pragma omp parallel for
-	for (size_t i = 0; i < res; i++)
+	//... modes that are not set below (Nyquist planes, zero mode) must vanish
+#pragma omp parallel for
+	for (long q = 0; q < (long)(res * res * (res + 2)); ++q)
+		rnoise[q] = 0.0;
+
+	//... every (i,j) column is drawn from its own seed in the seed table, so the columns
+	//... are independent and can be generated by thread-private generators. The k=0
+	//... plane is written for rows i<res/2 directly and for rows i>res/2 only through
+	//... the hermitian mirror, so no two columns write to the same element.
+#pragma omp parallel
 	{
-		int ii = (int)res - (int)i;
-		if (ii == (int)res)
-			ii = 0;
+		gsl_rng *column_generator = gsl_rng_alloc(gsl_rng_ranlxd1);
+		std::vector<double> rowphase(res / 2), rowampl(res / 2), rowre(res / 2), rowim(res / 2);
 
-		for (size_t j = 0; j < res; j++)
+#pragma omp for schedule(dynamic)
+		for (long il = 0; il < (long)res; il++)
 		{
-			gsl_rng_set(random_generator, seedtable[i * res + j]);
+			size_t i = (size_t)il;
+			int ii = (int)res - (int)i;
+			if (ii == (int)res)
+				ii = 0;
 
-			for (size_t k = 0; k < res / 2; k++)
+			for (size_t j = 0; j < res; j++)
 			{
-				double phase = gsl_rng_uniform(random_generator) * 2 * M_PI;
-				double ampl;
-				do
-					ampl = gsl_rng_uniform(random_generator);
-				while (ampl == 0);
+				gsl_rng_set(column_generator, seedtable[i * res + j]);
 
-				if (i == res / 2 || j == res / 2 || k == res / 2)
-					continue;
-				if (i == 0 && j == 0 && k == 0)
-					continue;
-
-				T rp = -sqrt(-log(ampl)) * cos(phase) * fnorm;
-				T ip = -sqrt(-log(ampl)) * sin(phase) * fnorm;
+				//... draw the whole row from the sequential stream first, then transform in one batch
+				for (size_t k = 0; k < res / 2; k++)
+				{
+					rowphase[k] = gsl_rng_uniform(column_generator) * 2 * M_PI;
+					do
+						rowampl[k] = gsl_rng_uniform(column_generator);
+					while (rowampl[k] == 0);
+				}
 
-				if (k > 0)
+	#pragma omp simd
+				for (size_t k = 0; k < res / 2; k++)
 				{
-					RE(knoise[(i * res + j) * (res / 2 + 1) + k]) = rp;
-					IM(knoise[(i * res + j) * (res / 2 + 1) + k]) = ip;
+					double a = -sqrt(-log(rowampl[k]));
+					rowre[k] = a * cos(rowphase[k]) * fnorm;
+					rowim[k] = a * sin(rowphase[k]) * fnorm;
 				}
-				else /* k=0 plane needs special treatment */
+
+				for (size_t k = 0; k < res / 2; k++)
 				{
-					if (i == 0)
-					{
-						if (j >= res / 2)
-							continue;
-						else
-						{
-							int jj = (int)res - (int)j; /* note: j!=0 surely holds at this point */
+					if (i == res / 2 || j == res / 2 || k == res / 2)
+						continue;
+					if (i == 0 && j == 0 && k == 0)
+						continue;
 
-							RE(knoise[(i * res + j) * (res / 2 + 1) + k]) = rp;
-							IM(knoise[(i * res + j) * (res / 2 + 1) + k]) = ip;
+					T rp = rowre[k];
+					T ip = rowim[k];
 
-							RE(knoise[(i * res + jj) * (res / 2 + 1) + k]) = rp;
-							IM(knoise[(i * res + jj) * (res / 2 + 1) + k]) = -ip;
-						}
+					if (k > 0)
+					{
+						RE(knoise[(i * res + j) * (res / 2 + 1) + k]) = rp;
+						IM(knoise[(i * res + j) * (res / 2 + 1) + k]) = ip;
 					}
-					else
+					else /* k=0 plane needs special treatment */
 					{
-						if (i >= res / 2)
-							continue;
-						else
+						if (i == 0)
 						{
-							int ii = (int)res - (int)i;
-							if (ii == (int)res)
-								ii = 0;
-							int jj = (int)res - (int)j;
-							if (jj == (int)res)
-								jj = 0;
+							if (j >= res / 2)
+								continue;
+							else
+							{
+								int jj = (int)res - (int)j; /* note: j!=0 surely holds at this point */
 
-							RE(knoise[(i * res + j) * (res / 2 + 1) + k]) = rp;
-							IM(knoise[(i * res + j) * (res / 2 + 1) + k]) = ip;
+								RE(knoise[(i * res + j) * (res / 2 + 1) + k]) = rp;
+								IM(knoise[(i * res + j) * (res / 2 + 1) + k]) = ip;
 
-							if (ii >= 0 && ii < (int)res)
+								RE(knoise[(i * res + jj) * (res / 2 + 1) + k]) = rp;
+								IM(knoise[(i * res + jj) * (res / 2 + 1) + k]) = -ip;
+							}
+						}
+						else
+						{
+							if (i >= res / 2)
+								continue;
+							else
 							{
-								RE(knoise[(ii * res + jj) * (res / 2 + 1) + k]) = rp;
-								IM(knoise[(ii * res + jj) * (res / 2 + 1) + k]) = -ip;
+								int ii = (int)res - (int)i;
+								if (ii == (int)res)
+									ii = 0;
+								int jj = (int)res - (int)j;
+								if (jj == (int)res)
+									jj = 0;
+
+								RE(knoise[(i * res + j) * (res / 2 + 1) + k]) = rp;
+								IM(knoise[(i * res + j) * (res / 2 + 1) + k]) = ip;
+
+								if (ii >= 0 && ii < (int)res)
+								{
+									RE(knoise[(ii * res + jj) * (res / 2 + 1) + k]) = rp;
+									IM(knoise[(ii * res + jj) * (res / 2 + 1) + k]) = -ip;
+								}
 							}
 						}
 					}
 				}
 			}
 		}
+
+		gsl_rng_free(column_generator);
 	}
 
+	gsl_rng_free(random_generator);
 	delete[] seedtable;
 
 	//... perform FT to real space
 
 #ifdef FFTW3
-#ifdef SINGLE_PRECISION
-	fftwf_plan plan = fftwf_plan_dft_c2r_3d(res, res, res, knoise, rnoise, FFTW_ESTIMATE);
-	fftwf_execute(plan);
-	fftwf_destroy_plan(plan);
-#else
-	fftw_plan plan = fftw_plan_dft_c2r_3d(res, res, res, knoise, rnoise, FFTW_ESTIMATE);
-	fftw_execute(plan);
-	fftw_destroy_plan(plan);
-#endif
+	fft_plans::transform plan = fft_plans::c2r(res, res, res, knoise, rnoise);
+	fft_plans::execute(plan);
 #else
 	rfftwnd_plan plan = rfftw3d_create_plan(res, res, res, FFTW_COMPLEX_TO_REAL, FFTW_ESTIMATE | FFTW_IN_PLACE);
 #ifndef SINGLETHREAD_FFTW
@@ -248,9 +280,7 @@ random_numbers<T>::random_numbers(unsigned res, unsigned cubesize, long baseseed
 		mean = fill_all();
 	else
 	{
-		rnums_.push_back(new Meshvar<T>(res, 0, 0, 0));
-		cubemap_[0] = 0; // create dummy map index
-		register_cube(0, 0, 0);
+		cubes_.assign_single(new Meshvar<T>(res, 0, 0, 0)); // single cube covering the whole mesh
 		rapid_proto_ngenic_rng(res_, baseseed_, *this);
 	}
 
@@ -275,212 +305,195 @@ random_numbers<T>::random_numbers(unsigned res, unsigned cubesize, long baseseed
 	}
 }
 
+//... helpers to read Fortran unformatted records from a memory-mapped white noise file
+namespace
+{
+	inline uint32_t read_u32(const char *p, bool swap)
+	{
+		uint32_t v;
+		memcpy(&v, p, sizeof(uint32_t));
+		return swap ? byte_order::swap32(v) : v;
+	}
+
+	inline uint64_t read_u64(const char *p, bool swap)
+	{
+		uint64_t v;
+		memcpy(&v, p, sizeof(uint64_t));
+		return swap ? byte_order::swap64(v) : v;
+	}
+
+	//! read a record marker of 4 or 8 bytes
+	inline size_t read_marker(const char *p, size_t markersize, bool swap)
+	{
+		return (markersize == 4) ? (size_t)read_u32(p, swap) : (size_t)read_u64(p, swap);
+	}
+
+	inline float read_float(const char *p, bool swap)
+	{
+		uint32_t v = read_u32(p, swap);
+		float f;
+		memcpy(&f, &v, sizeof(float));
+		return f;
+	}
+
+	inline double read_double(const char *p, bool swap)
+	{
+		uint64_t v = read_u64(p, swap);
+		double d;
+		memcpy(&d, &v, sizeof(double));
+		return d;
+	}
+}
+
 template <typename T>
 random_numbers<T>::random_numbers(unsigned res, std::string randfname, bool randsign)
 		: res_(res), cubesize_(res), ncubes_(1)
 {
-	rnums_.push_back(new Meshvar<T>(res, 0, 0, 0));
-	cubemap_[0] = 0; // create dummy map index
+	cubes_.assign_single(new Meshvar<T>(res, 0, 0, 0)); // single cube covering the whole mesh
 
-	std::ifstream ifs(randfname.c_str(), std::ios::binary);
-	if (!ifs)
+	int fd = open(randfname.c_str(), O_RDONLY);
+	struct stat sb;
+	if (fd < 0 || fstat(fd, &sb) != 0)
 	{
+		if (fd >= 0)
+			close(fd);
 		LOGERR("Could not open random number file \'%s\'!", randfname.c_str());
 		throw std::runtime_error(std::string("Could not open random number file \'") + randfname + std::string("\'!"));
 	}
 
-	unsigned vartype;
-	unsigned nx, ny, nz, blksz32;
-	size_t blksz64;
-	int iseed;
-	//long seed;
+	size_t fsize = (size_t)sb.st_size;
+	void *pmap = (fsize > 0) ? mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+
+	if (pmap == MAP_FAILED)
+	{
+		LOGERR("Could not map random number file \'%s\' into memory!", randfname.c_str());
+		throw std::runtime_error(std::string("Could not map random number file \'") + randfname + std::string("\'!"));
+	}
+
+	const char *base = reinterpret_cast<const char *>(pmap);
 
 	float sign4 = -1.0f;
 	double sign8 = -1.0;
 
-	int addrtype = 32;
-
 	if (randsign) // use grafic2 sign convention
 	{
 		sign4 = 1.0f;
 		sign8 = 1.0;
 	}
 
-	//... read header and check if 32bit or 64bit block size .../
-	ifs.read(reinterpret_cast<char *>(&blksz32), sizeof(int));
-	ifs.read(reinterpret_cast<char *>(&nx), sizeof(unsigned));
-	if (blksz32 != 4 * sizeof(int) || nx != res_)
-	{
-		addrtype = 64;
+	//... determine size of the record markers (32 or 64bit) and the byte order from the header,
+	//... the header record holds nx,ny,nz,iseed
+	size_t msz = 0;
+	bool swap = false;
+	const size_t hdrsz = 4 * sizeof(int);
 
-		ifs.seekg(0);
-		ifs.read(reinterpret_cast<char *>(&blksz64), sizeof(size_t));
-		ifs.read(reinterpret_cast<char *>(&nx), sizeof(unsigned));
+	for (int itry = 0; itry < 4 && msz == 0; ++itry)
+	{
+		size_t m = (itry < 2) ? 4 : 8;
+		bool sw = (itry % 2) == 1;
 
-		if (blksz64 != 4 * sizeof(int) || nx != res_)
-			addrtype = -1;
+		if (fsize >= 2 * m + hdrsz && read_marker(base, m, sw) == hdrsz && read_u32(base + m, sw) == res_)
+		{
+			msz = m;
+			swap = sw;
+		}
 	}
-	ifs.seekg(0);
 
-	if (addrtype < 0)
+	if (msz == 0)
 	{
+		munmap(pmap, fsize);
+		LOGERR("Random number file \'%s\' is corrupt or does not match the level resolution.", randfname.c_str());
 		throw std::runtime_error("corrupt random number file");
 	}
 
-	if (addrtype == 32)
-	{
-		ifs.read(reinterpret_cast<char *>(&blksz32), sizeof(int));
-	}
-	else
-	{
-		ifs.read(reinterpret_cast<char *>(&blksz64), sizeof(size_t));
-	}
-	ifs.read(reinterpret_cast<char *>(&nx), sizeof(unsigned));
-	ifs.read(reinterpret_cast<char *>(&ny), sizeof(unsigned));
-	ifs.read(reinterpret_cast<char *>(&nz), sizeof(unsigned));
-	ifs.read(reinterpret_cast<char *>(&iseed), sizeof(int));
-	//seed = (long)iseed;
+	unsigned nx, ny, nz;
+	nx = read_u32(base + msz, swap);
+	ny = read_u32(base + msz + 4, swap);
+	nz = read_u32(base + msz + 8, swap);
 
 	if (nx != res_ || ny != res_ || nz != res_)
 	{
+		munmap(pmap, fsize);
 		char errmsg[128];
 		sprintf(errmsg, "White noise file dimensions do not match level dimensions: %ux%ux%u vs. %u**3", nx, ny, nz, res_);
 		throw std::runtime_error(errmsg);
 	}
 
-	if (addrtype == 32)
-		ifs.read(reinterpret_cast<char *>(&blksz32), sizeof(int));
-	else
-		ifs.read(reinterpret_cast<char *>(&blksz64), sizeof(size_t));
-
-	//... read data ...//
-	//check whether random numbers are single or double precision numbers
-	if (addrtype == 32)
+	//... check whether random numbers are single or double precision numbers
+	size_t off0 = 2 * msz + hdrsz, nplane = (size_t)nx * (size_t)ny, vartype = 0;
+	if (fsize >= off0 + msz)
 	{
-		ifs.read(reinterpret_cast<char *>(&blksz32), sizeof(int));
-		if (blksz32 == nx * ny * sizeof(float))
+		size_t blksz = read_marker(base + off0, msz, swap);
+		if (blksz == nplane * sizeof(float))
 			vartype = 4;
-		else if (blksz32 == nx * ny * sizeof(double))
+		else if (blksz == nplane * sizeof(double))
 			vartype = 8;
-		else
-			throw std::runtime_error("corrupt random number file");
 	}
-	else
+
+	size_t recsz = 2 * msz + nplane * vartype;
+
+	if (vartype == 0 || fsize < off0 + nz * recsz)
 	{
+		munmap(pmap, fsize);
+		throw std::runtime_error("corrupt random number file");
+	}
 
-		ifs.read(reinterpret_cast<char *>(&blksz64), sizeof(size_t));
-		if (blksz64 == nx * ny * sizeof(float))
-			vartype = 4;
-		else if (blksz64 == nx * ny * sizeof(double))
-			vartype = 8;
-		else
+	//... validate all record markers once before touching the data
+	for (size_t ii = 0; ii < nz; ++ii)
+	{
+		const char *prec = base + off0 + ii * recsz;
+		if (read_marker(prec, msz, swap) != nplane * vartype || read_marker(prec + msz + nplane * vartype, msz, swap) != nplane * vartype)
+		{
+			munmap(pmap, fsize);
 			throw std::runtime_error("corrupt random number file");
+		}
 	}
 
-	//rewind to beginning of block
-	if (addrtype == 32)
-		ifs.seekg(-sizeof(int), std::ios::cur);
-	else
-		ifs.seekg(-sizeof(size_t), std::ios::cur);
-
-	std::vector<float> in_float;
-	std::vector<double> in_double;
+#ifdef MADV_WILLNEED
+	madvise(pmap, fsize, MADV_WILLNEED);
+#endif
 
 	LOGINFO("Random number file \'%s\'\n   contains %ld numbers. Reading...", randfname.c_str(), nx * ny * nz);
 
 	long double sum = 0.0, sum2 = 0.0;
-	size_t count = 0;
+	size_t count = (size_t)nx * ny * nz;
+
+	//... perform actual reading, planes are independent records and are converted in parallel.
+	//... the file stores planes of constant z with x running fastest, so the data has to be
+	//... transposed into the mesh and cannot be used in place
+	Meshvar<T> &mesh = *cubes_.single();
 
-	//perform actual reading
-	if (vartype == 4)
+#pragma omp parallel for reduction(+ \
+																	 : sum, sum2)
+	for (int ii = 0; ii < (int)nz; ++ii)
 	{
-		for (int ii = 0; ii < (int)nz; ++ii)
-		{
+		const char *pdata = base + off0 + (size_t)ii * recsz + msz;
 
-			if (addrtype == 32)
-			{
-				ifs.read(reinterpret_cast<char *>(&blksz32), sizeof(int));
-				if (blksz32 != nx * ny * sizeof(float))
-					throw std::runtime_error("corrupt random number file");
-			}
-			else
+		for (int jj = 0; jj < (int)ny; ++jj)
+			for (int kk = 0; kk < (int)nx; ++kk)
 			{
-				ifs.read(reinterpret_cast<char *>(&blksz64), sizeof(size_t));
-				if (blksz64 != nx * ny * sizeof(float))
-					throw std::runtime_error("corrupt random number file");
-			}
+				size_t q = (size_t)jj * nx + (size_t)kk;
 
-			in_float.assign(nx * ny, 0.0f);
-			ifs.read((char *)&in_float[0], nx * ny * sizeof(float));
-
-			for (int jj = 0, q = 0; jj < (int)ny; ++jj)
-				for (int kk = 0; kk < (int)nx; ++kk)
+				if (vartype == 4)
 				{
-					sum += in_float[q];
-					sum2 += in_float[q] * in_float[q];
-					++count;
-
-					(*rnums_[0])(kk, jj, ii) = sign4 * in_float[q++];
+					float val = read_float(pdata + q * sizeof(float), swap);
+					sum += val;
+					sum2 += val * val;
+					mesh(kk, jj, ii) = sign4 * val;
 				}
-
-			if (addrtype == 32)
-			{
-				ifs.read(reinterpret_cast<char *>(&blksz32), sizeof(int));
-				if (blksz32 != nx * ny * sizeof(float))
-					throw std::runtime_error("corrupt random number file");
-			}
-			else
-			{
-				ifs.read(reinterpret_cast<char *>(&blksz64), sizeof(size_t));
-				if (blksz64 != nx * ny * sizeof(float))
-					throw std::runtime_error("corrupt random number file");
-			}
-		}
-	}
-	else if (vartype == 8)
-	{
-		for (int ii = 0; ii < (int)nz; ++ii)
-		{
-			if (addrtype == 32)
-			{
-				ifs.read(reinterpret_cast<char *>(&blksz32), sizeof(int));
-				if (blksz32 != nx * ny * sizeof(double))
-					throw std::runtime_error("corrupt random number file");
-			}
-			else
-			{
-				ifs.read(reinterpret_cast<char *>(&blksz64), sizeof(size_t));
-				if (blksz64 != nx * ny * sizeof(double))
-					throw std::runtime_error("corrupt random number file");
-			}
-
-			in_double.assign(nx * ny, 0.0f);
-			ifs.read((char *)&in_double[0], nx * ny * sizeof(double));
-
-			for (int jj = 0, q = 0; jj < (int)ny; ++jj)
-				for (int kk = 0; kk < (int)nx; ++kk)
+				else
 				{
-					sum += in_double[q];
-					sum2 += in_double[q] * in_double[q];
-					++count;
-					(*rnums_[0])(kk, jj, ii) = sign8 * in_double[q++];
+					double val = read_double(pdata + q * sizeof(double), swap);
+					sum += val;
+					sum2 += val * val;
+					mesh(kk, jj, ii) = sign8 * val;
 				}
-
-			if (addrtype == 32)
-			{
-				ifs.read(reinterpret_cast<char *>(&blksz32), sizeof(int));
-				if (blksz32 != nx * ny * sizeof(double))
-					throw std::runtime_error("corrupt random number file");
-			}
-			else
-			{
-				ifs.read(reinterpret_cast<char *>(&blksz64), sizeof(size_t));
-				if (blksz64 != nx * ny * sizeof(double))
-					throw std::runtime_error("corrupt random number file");
 			}
-		}
 	}
 
+	munmap(pmap, fsize);
+
 	double mean, var;
 	mean = sum / count;
 	var = sum2 / count - mean * mean;
@@ -523,15 +536,9 @@ random_numbers<T>::random_numbers(/*const*/ random_numbers<T> &rc, bool kdegrade
 
 		int nx(rc.res_), ny(rc.res_), nz(rc.res_), nxc(res_), nyc(res_), nzc(res_);
 #ifdef FFTW3
-#ifdef SINGLE_PRECISION
-		fftwf_plan
-				pf = fftwf_plan_dft_r2c_3d(nx, ny, nz, rfine, cfine, FFTW_ESTIMATE),
-				ipc = fftwf_plan_dft_c2r_3d(nxc, nyc, nzc, ccoarse, rcoarse, FFTW_ESTIMATE);
-#else
-		fftw_plan
-				pf = fftw_plan_dft_r2c_3d(nx, ny, nz, rfine, cfine, FFTW_ESTIMATE),
-				ipc = fftw_plan_dft_c2r_3d(nxc, nyc, nzc, ccoarse, rcoarse, FFTW_ESTIMATE);
-#endif
+		fft_plans::transform
+				pf = fft_plans::r2c(nx, ny, nz, rfine, cfine),
+				ipc = fft_plans::c2r(nxc, nyc, nzc, ccoarse, rcoarse);
 
 #else
 		rfftwnd_plan
@@ -549,11 +556,7 @@ random_numbers<T>::random_numbers(/*const*/ random_numbers<T> &rc, bool kdegrade
 				}
 
 #ifdef FFTW3
-#ifdef SINGLE_PRECISION
-		fftwf_execute(pf);
-#else
-		fftw_execute(pf);
-#endif
+		fft_plans::execute(pf);
 #else
 #ifndef SINGLETHREAD_FFTW
 		rfftwnd_threads_one_real_to_complex(omp_get_max_threads(), pf, rfine, NULL);
@@ -597,11 +600,7 @@ random_numbers<T>::random_numbers(/*const*/ random_numbers<T> &rc, bool kdegrade
 
 		delete[] rfine;
 #ifdef FFTW3
-#ifdef SINGLE_PRECISION
-		fftwf_execute(ipc);
-#else
-		fftw_execute(ipc);
-#endif
+		fft_plans::execute(ipc);
 #else
 #ifndef SINGLETHREAD_FFTW
 		rfftwnd_threads_one_complex_to_real(omp_get_max_threads(), ipc, ccoarse, NULL);
@@ -609,8 +608,7 @@ random_numbers<T>::random_numbers(/*const*/ random_numbers<T> &rc, bool kdegrade
 		rfftwnd_one_complex_to_real(ipc, ccoarse, NULL);
 #endif
 #endif
-		rnums_.push_back(new Meshvar<T>(res_, 0, 0, 0));
-		cubemap_[0] = 0; // map all to single array
+		cubes_.assign_single(new Meshvar<T>(res_, 0, 0, 0)); // map all to single array
 
 #pragma omp parallel for reduction(+ \
 																	 : sum, sum2, count)
@@ -619,23 +617,15 @@ random_numbers<T>::random_numbers(/*const*/ random_numbers<T> &rc, bool kdegrade
 				for (int k = 0; k < nzc; k++)
 				{
 					size_t q = ((size_t)i * nyc + (size_t)j) * (nzc + 2) + (size_t)k;
-					(*rnums_[0])(i, j, k) = rcoarse[q];
-					sum += (*rnums_[0])(i, j, k);
-					sum2 += (*rnums_[0])(i, j, k) * (*rnums_[0])(i, j, k);
+					(*cubes_.single())(i, j, k) = rcoarse[q];
+					sum += (*cubes_.single())(i, j, k);
+					sum2 += (*cubes_.single())(i, j, k) * (*cubes_.single())(i, j, k);
 					++count;
 				}
 
 		delete[] rcoarse;
 
-#ifdef FFTW3
-#ifdef SINGLE_PRECISION
-		fftwf_destroy_plan(pf);
-		fftwf_destroy_plan(ipc);
-#else
-		fftw_destroy_plan(pf);
-		fftw_destroy_plan(ipc);
-#endif
-#else
+#ifndef FFTW3
 		rfftwnd_destroy_plan(pf);
 		rfftwnd_destroy_plan(ipc);
 #endif
@@ -643,7 +633,7 @@ random_numbers<T>::random_numbers(/*const*/ random_numbers<T> &rc, bool kdegrade
 	else
 	{
 		LOGINFO("Generating a coarse white noise field by averaging");
-		if (rc.rnums_.size() == 1)
+		if (rc.cubes_.size() == 1)
 		{
 			//... initialize properties of container
 			res_ = rc.res_ / 2;
@@ -653,19 +643,18 @@ random_numbers<T>::random_numbers(/*const*/ random_numbers<T> &rc, bool kdegrade
 
 			//... use restriction to get consistent random numbers on coarser grid
 			mg_straight gop;
-			rnums_.push_back(new Meshvar<T>(res_, 0, 0, 0));
-			cubemap_[0] = 0; // map all to single array
-			gop.restrict(*rc.rnums_[0], *rnums_[0]);
+			cubes_.assign_single(new Meshvar<T>(res_, 0, 0, 0)); // map all to single array
+			gop.restrict(*rc.cubes_.single(), *cubes_.single());
 
 #pragma omp parallel for reduction(+ \
 																	 : sum, sum2, count)
-			for (int i = 0; i < (int)rnums_[0]->size(0); ++i)
-				for (unsigned j = 0; j < rnums_[0]->size(1); ++j)
-					for (unsigned k = 0; k < rnums_[0]->size(2); ++k)
+			for (int i = 0; i < (int)cubes_.single()->size(0); ++i)
+				for (unsigned j = 0; j < cubes_.single()->size(1); ++j)
+					for (unsigned k = 0; k < cubes_.single()->size(2); ++k)
 					{
-						(*rnums_[0])(i, j, k) *= sqrt(8); //.. maintain that var(delta)=1
-						sum += (*rnums_[0])(i, j, k);
-						sum2 += (*rnums_[0])(i, j, k) * (*rnums_[0])(i, j, k);
+						(*cubes_.single())(i, j, k) *= sqrt(8); //.. maintain that var(delta)=1
+						sum += (*cubes_.single())(i, j, k);
+						sum2 += (*cubes_.single())(i, j, k) * (*cubes_.single())(i, j, k);
 						++count;
 					}
 		}
@@ -677,8 +666,7 @@ random_numbers<T>::random_numbers(/*const*/ random_numbers<T> &rc, bool kdegrade
 			ncubes_ = 1;
 			baseseed_ = -2;
 
-			rnums_.push_back(new Meshvar<T>(res_, 0, 0, 0));
-			cubemap_[0] = 0;
+			cubes_.assign_single(new Meshvar<T>(res_, 0, 0, 0));
 			double fac = 1.0 / sqrt(8);
 
 #pragma omp parallel for reduction(+ \
@@ -690,12 +678,12 @@ random_numbers<T>::random_numbers(/*const*/ random_numbers<T> &rc, bool kdegrade
 				for (unsigned j = 0, jj = 0; j < rc.res_; j += 2, ++jj)
 					for (unsigned k = 0, kk = 0; k < rc.res_; k += 2, ++kk)
 					{
-						(*rnums_[0])(ii, jj, kk) = fac *
+						(*cubes_.single())(ii, jj, kk) = fac *
 																			 (rc(i, j, k) + rc(i + 1, j, k) + rc(i, j + 1, k) + rc(i, j, k + 1) +
 																				rc(i + 1, j + 1, k) + rc(i + 1, j, k + 1) + rc(i, j + 1, k + 1) + rc(i + 1, j + 1, k + 1));
 
-						sum += (*rnums_[0])(ii, jj, kk);
-						sum2 += (*rnums_[0])(ii, jj, kk) * (*rnums_[0])(ii, jj, kk);
+						sum += (*cubes_.single())(ii, jj, kk);
+						sum2 += (*cubes_.single())(ii, jj, kk) * (*cubes_.single())(ii, jj, kk);
 						++count;
 					}
 			}
@@ -744,44 +732,38 @@ random_numbers<T>::random_numbers(random_numbers<T> &rc, unsigned cubesize, long
 		size_t nx = lx[0], ny = lx[1], nz = lx[2],
 					 nxc = lx[0] / 2, nyc = lx[1] / 2, nzc = lx[2] / 2;
 
-		fftw_real *rfine = new fftw_real[nx * ny * (nz + 2l)];
+		//... the copy below runs over y only, so first touch by x-slabs as the transforms do
+		fftw_real *rfine = first_touch::new_array<fftw_real>(nx, ny * (nz + 2l));
 		fftw_complex *cfine = reinterpret_cast<fftw_complex *>(rfine);
 
 #ifdef FFTW3
-#ifdef SINGLE_PRECISION
-		fftwf_plan
-				pf = fftwf_plan_dft_r2c_3d(nx, ny, nz, rfine, cfine, FFTW_ESTIMATE),
-				ipf = fftwf_plan_dft_c2r_3d(nx, ny, nz, cfine, rfine, FFTW_ESTIMATE);
-#else
-		fftw_plan
-				pf = fftw_plan_dft_r2c_3d(nx, ny, nz, rfine, cfine, FFTW_ESTIMATE),
-				ipf = fftw_plan_dft_c2r_3d(nx, ny, nz, cfine, rfine, FFTW_ESTIMATE);
-#endif
+		fft_plans::transform
+				pf = fft_plans::r2c(nx, ny, nz, rfine, cfine),
+				ipf = fft_plans::c2r(nx, ny, nz, cfine, rfine);
 #else
 		rfftwnd_plan
 				pf = rfftw3d_create_plan(nx, ny, nz, FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE | FFTW_IN_PLACE),
 				ipf = rfftw3d_create_plan(nx, ny, nz, FFTW_COMPLEX_TO_REAL, FFTW_ESTIMATE | FFTW_IN_PLACE);
 #endif
 
-#pragma omp parallel for
 		for (int i = 0; i < (int)nx; i++)
+		{
+#pragma omp parallel for
 			for (int j = 0; j < (int)ny; j++)
 				for (int k = 0; k < (int)nz; k++)
 				{
 					size_t q = ((size_t)i * (size_t)ny + (size_t)j) * (size_t)(nz + 2) + (size_t)k;
 					rfine[q] = (*this)(x0[0] + i, x0[1] + j, x0[2] + k);
 				}
+			trim_cache();
+		}
 		//this->free_all_mem();	// temporarily free memory, allocate again later
 
 		fftw_real *rcoarse = new fftw_real[nxc * nyc * (nzc + 2)];
 		fftw_complex *ccoarse = reinterpret_cast<fftw_complex *>(rcoarse);
 
 #ifdef FFTW3
-#ifdef SINGLE_PRECISION
-		fftwf_plan pc = fftwf_plan_dft_r2c_3d(nxc, nyc, nzc, rcoarse, ccoarse, FFTW_ESTIMATE);
-#else
-		fftw_plan pc = fftw_plan_dft_r2c_3d(nxc, nyc, nzc, rcoarse, ccoarse, FFTW_ESTIMATE);
-#endif
+		fft_plans::transform pc = fft_plans::r2c(nxc, nyc, nzc, rcoarse, ccoarse);
 #else
 		rfftwnd_plan pc = rfftw3d_create_plan(nxc, nyc, nzc, FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE | FFTW_IN_PLACE);
 #endif
@@ -795,13 +777,8 @@ random_numbers<T>::random_numbers(random_numbers<T> &rc, unsigned cubesize, long
 					rcoarse[q] = rc(x0[0] / 2 + i, x0[1] / 2 + j, x0[2] / 2 + k);
 				}
 #ifdef FFTW3
-#ifdef SINGLE_PRECISION
-		fftwf_execute(pc);
-		fftwf_execute(pf);
-#else
-		fftw_execute(pc);
-		fftw_execute(pf);
-#endif
+		fft_plans::execute(pc);
+		fft_plans::execute(pf);
 #else
 #ifndef SINGLETHREAD_FFTW
 		rfftwnd_threads_one_real_to_complex(omp_get_max_threads(), pc, rcoarse, NULL);
@@ -820,179 +797,56 @@ random_numbers<T>::random_numbers(random_numbers<T> &rc, unsigned cubesize, long
 
 		// embedding of coarse white noise by fourier interpolation
 
-#if 1
-#pragma omp parallel for
-		for (int i = 0; i < (int)nxc; i++)
-			for (int j = 0; j < (int)nyc; j++)
-				for (int k = 0; k < (int)nzc / 2 + 1; k++)
-				{
-					int ii(i), jj(j), kk(k);
-
-					//if( i==(int)nxc/2 ) continue;
-					//if( j==(int)nyc/2 ) continue;
-
-					if (i > (int)nxc / 2)
-						ii += (int)nx / 2;
-					if (j > (int)nyc / 2)
-						jj += (int)ny / 2;
-
-					size_t qc, qf;
-
-					double kx = (i <= (int)nxc / 2) ? (double)i : (double)(i - (int)nxc);
-					double ky = (j <= (int)nyc / 2) ? (double)j : (double)(j - (int)nyc);
-					double kz = (k <= (int)nzc / 2) ? (double)k : (double)(k - (int)nzc);
-
-					qc = ((size_t)i * nyc + (size_t)j) * (nzc / 2 + 1) + (size_t)k;
-					qf = ((size_t)ii * ny + (size_t)jj) * (nz / 2 + 1) + (size_t)kk;
+		//... the phase shift is separable, exp(i phi) = ex(kx) ey(ky) ez(kz), so one
+		//... table per axis replaces the trigonometric functions in the mode loop
+		std::vector<std::complex<double> > phasex(nxc), phasey(nyc), phasez(nzc / 2 + 1);
 
-					std::complex<double> val(RE(ccoarse[qc]), IM(ccoarse[qc]));
-					double phase = (kx / nxc + ky / nyc + kz / nzc) * phasefac * M_PI;
-
-					std::complex<double> val_phas(cos(phase), sin(phase));
-
-					val *= val_phas * sqrt8;
-
-					if (i != (int)nxc / 2 && j != (int)nyc / 2 && k != (int)nzc / 2)
-					{
-						RE(cfine[qf]) = val.real();
-						IM(cfine[qf]) = val.imag();
-					}
-					else
-					{
-						//RE(cfine[qf]) = val.real();
-						//IM(cfine[qf]) = 0.0;
-					}
-				}
-
-#else
-
-		// 0 0
-#pragma omp parallel for
-		for (int i = 0; i < (int)nxc / 2 + 1; i++)
-			for (int j = 0; j < (int)nyc / 2 + 1; j++)
-				for (int k = 0; k < (int)nzc / 2 + 1; k++)
-				{
-					int ii(i), jj(j), kk(k);
-					size_t qc, qf;
-					qc = ((size_t)i * (size_t)nyc + (size_t)j) * (nzc / 2 + 1) + (size_t)k;
-					qf = ((size_t)ii * (size_t)ny + (size_t)jj) * (nz / 2 + 1) + (size_t)kk;
-
-					double kx = (i <= (int)nxc / 2) ? (double)i : (double)(i - (int)nxc);
-					double ky = (j <= (int)nyc / 2) ? (double)j : (double)(j - (int)nyc);
-					double kz = (k <= (int)nzc / 2) ? (double)k : (double)(k - (int)nzc);
-
-					double phase = phasefac * (kx / nxc + ky / nyc + kz / nzc) * M_PI;
-					std::complex<double> val_phas(cos(phase), sin(phase));
-
-					std::complex<double> val(RE(ccoarse[qc]), IM(ccoarse[qc]));
-					val *= sqrt8 * val_phas;
-
-					RE(cfine[qf]) = val.real();
-					IM(cfine[qf]) = val.imag();
-
-					//if( k==0 & (i==(int)nxc/2 || j==(int)nyc/2) )
-					//  IM(cfine[qf]) *= -1.0;
-				}
-				// 1 0
-#pragma omp parallel for
-		for (int i = nxc / 2; i < (int)nxc; i++)
-			for (int j = 0; j < (int)nyc / 2 + 1; j++)
-				for (int k = 0; k < (int)nzc / 2 + 1; k++)
-				{
-					int ii(i + nx / 2), jj(j), kk(k);
-					size_t qc, qf;
-					qc = ((size_t)i * (size_t)nyc + (size_t)j) * (nzc / 2 + 1) + (size_t)k;
-					qf = ((size_t)ii * (size_t)ny + (size_t)jj) * (nz / 2 + 1) + (size_t)kk;
-
-					double kx = (i <= (int)nxc / 2) ? (double)i : (double)(i - (int)nxc);
-					double ky = (j <= (int)nyc / 2) ? (double)j : (double)(j - (int)nyc);
-					double kz = (k <= (int)nzc / 2) ? (double)k : (double)(k - (int)nzc);
-
-					double phase = phasefac * (kx / nxc + ky / nyc + kz / nzc) * M_PI;
-					std::complex<double> val_phas(cos(phase), sin(phase));
-
-					std::complex<double> val(RE(ccoarse[qc]), IM(ccoarse[qc]));
-					val *= sqrt8 * val_phas;
-
-					RE(cfine[qf]) = val.real();
-					IM(cfine[qf]) = val.imag();
+		for (int i = 0; i < (int)nxc; i++)
+		{
+			double kx = (i <= (int)nxc / 2) ? (double)i : (double)(i - (int)nxc);
+			phasex[i] = std::polar(1.0, phasefac * M_PI * kx / nxc);
+		}
+		for (int j = 0; j < (int)nyc; j++)
+		{
+			double ky = (j <= (int)nyc / 2) ? (double)j : (double)(j - (int)nyc);
+			phasey[j] = std::polar(1.0, phasefac * M_PI * ky / nyc);
+		}
+		for (int k = 0; k < (int)nzc / 2 + 1; k++)
+			phasez[k] = std::polar(sqrt8, phasefac * M_PI * (double)k / nzc); //... includes the normalization
 
-					//if( k==0 & (i==(int)nxc/2 || j==(int)nyc/2) )
-					//IM(cfine[qf]) *= -1.0;
-				}
-				// 0 1
 #pragma omp parallel for
-		for (int i = 0; i < (int)nxc / 2 + 1; i++)
-			for (int j = nyc / 2; j < (int)nyc; j++)
-				for (int k = 0; k < (int)nzc / 2 + 1; k++)
-				{
-					int ii(i), jj(j + ny / 2), kk(k);
-					size_t qc, qf;
-					qc = ((size_t)i * (size_t)nyc + (size_t)j) * (nzc / 2 + 1) + (size_t)k;
-					qf = ((size_t)ii * (size_t)ny + (size_t)jj) * (nz / 2 + 1) + (size_t)kk;
-
-					double kx = (i <= (int)nxc / 2) ? (double)i : (double)(i - (int)nxc);
-					double ky = (j <= (int)nyc / 2) ? (double)j : (double)(j - (int)nyc);
-					double kz = (k <= (int)nzc / 2) ? (double)k : (double)(k - (int)nzc);
+		for (int i = 0; i < (int)nxc; i++)
+		{
+			int ii = (i > (int)nxc / 2) ? i + (int)nx / 2 : i;
 
-					double phase = phasefac * (kx / nxc + ky / nyc + kz / nzc) * M_PI;
-					std::complex<double> val_phas(cos(phase), sin(phase));
+			for (int j = 0; j < (int)nyc; j++)
+			{
+				int jj = (j > (int)nyc / 2) ? j + (int)ny / 2 : j;
 
-					std::complex<double> val(RE(ccoarse[qc]), IM(ccoarse[qc]));
-					val *= sqrt8 * val_phas;
+				//... Nyquist modes of the coarse grid are not transplanted
+				if (i == (int)nxc / 2 || j == (int)nyc / 2)
+					continue;
 
-					RE(cfine[qf]) = val.real();
-					IM(cfine[qf]) = val.imag();
+				std::complex<double> phasexy = phasex[i] * phasey[j];
 
-					//if( k==0 && (i==(int)nxc/2 || j==(int)nyc/2) )
-					//  IM(cfine[qf]) *= -1.0;
-				}
+				size_t qc = ((size_t)i * nyc + (size_t)j) * (nzc / 2 + 1);
+				size_t qf = ((size_t)ii * ny + (size_t)jj) * (nz / 2 + 1);
 
-				// 1 1
-#pragma omp parallel for
-		for (int i = nxc / 2; i < (int)nxc; i++)
-			for (int j = nyc / 2; j < (int)nyc; j++)
-				for (int k = 0; k < (int)nzc / 2 + 1; k++)
+				for (int k = 0; k < (int)nzc / 2; k++)
 				{
-					int ii(i + nx / 2), jj(j + ny / 2), kk(k);
-					size_t qc, qf;
-					qc = ((size_t)i * (size_t)nyc + (size_t)j) * (nzc / 2 + 1) + (size_t)k;
-					qf = ((size_t)ii * (size_t)ny + (size_t)jj) * (nz / 2 + 1) + (size_t)kk;
-
-					double kx = (i <= (int)nxc / 2) ? (double)i : (double)(i - (int)nxc);
-					double ky = (j <= (int)nyc / 2) ? (double)j : (double)(j - (int)nyc);
-					double kz = (k <= (int)nzc / 2) ? (double)k : (double)(k - (int)nzc);
-
-					double phase = phasefac * (kx / nxc + ky / nyc + kz / nzc) * M_PI;
-					std::complex<double> val_phas(cos(phase), sin(phase));
-
-					std::complex<double> val(RE(ccoarse[qc]), IM(ccoarse[qc]));
-					val *= sqrt8 * val_phas;
+					std::complex<double> val(RE(ccoarse[qc + k]), IM(ccoarse[qc + k]));
+					val *= phasexy * phasez[k];
 
-					RE(cfine[qf]) = val.real();
-					IM(cfine[qf]) = val.imag();
+					RE(cfine[qf + k]) = val.real();
+					IM(cfine[qf + k]) = val.imag();
 				}
-#endif
+			}
+		}
 
 		delete[] rcoarse;
 
-#pragma omp parallel for
-		for (int i = 0; i < (int)nx; i++)
-			for (int j = 0; j < (int)ny; j++)
-				for (int k = 0; k < (int)nz / 2 + 1; k++)
-				{
-					size_t q = ((size_t)i * ny + (size_t)j) * (nz / 2 + 1) + (size_t)k;
-
-					RE(cfine[q]) *= fftnorm;
-					IM(cfine[q]) *= fftnorm;
-				}
-
 #ifdef FFTW3
-#ifdef SINGLE_PRECISION
-		fftwf_execute(ipf);
-#else
-		fftw_execute(ipf);
-#endif
+		fft_plans::execute(ipf);
 #else
 #ifndef SINGLETHREAD_FFTW
 		rfftwnd_threads_one_complex_to_real(omp_get_max_threads(), ipf, cfine, NULL);
@@ -1007,22 +861,12 @@ random_numbers<T>::random_numbers(random_numbers<T> &rc, unsigned cubesize, long
 				for (int k = 0; k < (int)nz; k++)
 				{
 					size_t q = ((size_t)i * ny + (size_t)j) * (nz + 2) + (size_t)k;
-					(*this)(x0[0] + i, x0[1] + j, x0[2] + k, false) = rfine[q];
+					(*this)(x0[0] + i, x0[1] + j, x0[2] + k, false) = rfine[q] * fftnorm; //... FFT normalization applied here to save a pass over k-space
 				}
 
 		delete[] rfine;
 
-#ifdef FFTW3
-#ifdef SINGLE_PRECISION
-		fftwf_destroy_plan(pf);
-		fftwf_destroy_plan(pc);
-		fftwf_destroy_plan(ipf);
-#else
-		fftw_destroy_plan(pf);
-		fftw_destroy_plan(pc);
-		fftw_destroy_plan(ipf);
-#endif
-#else
+#ifndef FFTW3
 		fftwnd_destroy_plan(pf);
 		fftwnd_destroy_plan(pc);
 		fftwnd_destroy_plan(ipf);
@@ -1043,81 +887,180 @@ random_numbers<T>::random_numbers(random_numbers<T> &rc, unsigned cubesize, long
 																		(*this)(i + 1, j + 1, k) + (*this)(i + 1, j, k + 1) + (*this)(i, j + 1, k + 1) + (*this)(i + 1, j + 1, k + 1));
 					double dif = fac * topval - locmean;
 
-					(*this)(i, j, k) += dif;
-					(*this)(i + 1, j, k) += dif;
-					(*this)(i, j + 1, k) += dif;
-					(*this)(i, j, k + 1) += dif;
-					(*this)(i + 1, j + 1, k) += dif;
-					(*this)(i + 1, j, k + 1) += dif;
-					(*this)(i, j + 1, k + 1) += dif;
-					(*this)(i + 1, j + 1, k + 1) += dif;
+					(*this)(i, j, k, false) += dif;
+					(*this)(i + 1, j, k, false) += dif;
+					(*this)(i, j + 1, k, false) += dif;
+					(*this)(i, j, k + 1, false) += dif;
+					(*this)(i + 1, j + 1, k, false) += dif;
+					(*this)(i + 1, j, k + 1, false) += dif;
+					(*this)(i, j + 1, k + 1, false) += dif;
+					(*this)(i + 1, j + 1, k + 1, false) += dif;
 				}
 	}
 }
 
 template <typename T>
-void random_numbers<T>::register_cube(int i, int j, int k)
+bool random_numbers<T>::register_cube(int i, int j, int k)
 {
 	i = (i + ncubes_) % ncubes_;
 	j = (j + ncubes_) % ncubes_;
 	k = (k + ncubes_) % ncubes_;
-	size_t icube = ((size_t)i * ncubes_ + (size_t)j) * ncubes_ + (size_t)k;
-
-	cubemap_iterator it = cubemap_.find(icube);
 
-	if (it == cubemap_.end())
-	{
-		rnums_.push_back(NULL);
-		cubemap_[icube] = rnums_.size() - 1;
+	bool bnew = cubes_.insert(i, j, k);
 #ifdef DEBUG
-		LOGDEBUG("registering new cube %d,%d,%d . ID = %ld, memloc = %ld", i, j, k, icube, cubemap_[icube]);
+	if (bnew)
+		LOGDEBUG("registering new cube %d,%d,%d", i, j, k);
 #endif
-	}
+	return bnew;
 }
 
 template <typename T>
-double random_numbers<T>::fill_cube(int i, int j, int k)
+double random_numbers<T>::fill_cube(int i, int j, int k, bool pin)
 {
-
-	gsl_rng *RNG = gsl_rng_alloc(gsl_rng_mt19937);
-
 	i = (i + ncubes_) % ncubes_;
 	j = (j + ncubes_) % ncubes_;
 	k = (k + ncubes_) % ncubes_;
 
 	size_t icube = ((size_t)i * ncubes_ + (size_t)j) * ncubes_ + (size_t)k;
-	long cubeseed = baseseed_ + icube; //... each cube gets its unique seed
-
-	gsl_rng_set(RNG, cubeseed);
 
-	cubemap_iterator it = cubemap_.find(icube);
+	cube_slot *cs = cubes_.find(i, j, k);
 
-	if (it == cubemap_.end())
+	if (cs == NULL)
 	{
 		LOGERR("Attempt to access non-registered random number cube!");
 		throw std::runtime_error("Attempt to access non-registered random number cube!");
 	}
 
-	size_t cubeidx = it->second;
-
-	if (rnums_[cubeidx] == NULL)
-		rnums_[cubeidx] = new Meshvar<T>(cubesize_, 0, 0, 0);
+	//... fill into new memory first and only then attach it to the table, so that
+	//... concurrent readers never see a partially filled cube
+	Meshvar<T> *pcube = cs->data;
+	if (pcube == NULL)
+		pcube = new Meshvar<T>(cubesize_, 0, 0, 0);
 
 	double mean = 0.0;
 
-	for (int ii = 0; ii < (int)cubesize_; ++ii)
-		for (int jj = 0; jj < (int)cubesize_; ++jj)
-			for (int kk = 0; kk < (int)cubesize_; ++kk)
+	if (algorithm_ == rng_philox)
+	{
+		//... every cell is keyed by its global index, so the cube can be filled in parallel
+		//... if we are not already called from within a parallel loop over cubes
+		philox4x32 RNG((uint64_t)baseseed_);
+		Meshvar<T> &cube = *pcube;
+		size_t i0 = (size_t)i * cubesize_, j0 = (size_t)j * cubesize_, k0 = (size_t)k * cubesize_;
+
+#pragma omp parallel for reduction(+ \
+																	 : mean) if (!omp_in_parallel())
+		for (int ii = 0; ii < (int)cubesize_; ++ii)
+			for (int jj = 0; jj < (int)cubesize_; ++jj)
 			{
-				(*rnums_[cubeidx])(ii, jj, kk) = gsl_ran_ugaussian_ratio_method(RNG);
-				mean += (*rnums_[cubeidx])(ii, jj, kk);
+				uint64_t grow = ((uint64_t)(i0 + ii) * res_ + (uint64_t)(j0 + jj)) * res_ + k0;
+				RNG.gaussian_row(grow, cubesize_, &cube(ii, jj, 0));
+				for (int kk = 0; kk < (int)cubesize_; ++kk)
+					mean += cube(ii, jj, kk);
+			}
+	}
+	else if (gaussian_method_ == gauss_boxmuller)
+	{
+		//... the uniforms are drawn sequentially from the cube's stream, only the
+		//... transformation of a whole row is done in one batch
+		gsl_rng *RNG = gsl_rng_alloc(gsl_rng_mt19937);
+		long cubeseed = baseseed_ + icube; //... each cube gets its unique seed
+
+		gsl_rng_set(RNG, cubeseed);
+
+		Meshvar<T> &cube = *pcube;
+		size_t np = (cubesize_ + 1) / 2;
+		std::vector<double> u1(np), u2(np), g1(np), g2(np);
+
+		for (int ii = 0; ii < (int)cubesize_; ++ii)
+			for (int jj = 0; jj < (int)cubesize_; ++jj)
+			{
+				for (size_t m = 0; m < np; ++m)
+				{
+					u1[m] = gsl_rng_uniform_pos(RNG);
+					u2[m] = gsl_rng_uniform_pos(RNG);
+				}
+
+				box_muller_batch(&u1[0], &u2[0], &g1[0], &g2[0], np);
+
+				for (int kk = 0; kk < (int)cubesize_; ++kk)
+				{
+					cube(ii, jj, kk) = (kk & 1) ? g2[kk / 2] : g1[kk / 2];
+					mean += cube(ii, jj, kk);
+				}
 			}
 
-	gsl_rng_free(RNG);
+		gsl_rng_free(RNG);
+	}
+	else
+	{
+		gsl_rng *RNG = gsl_rng_alloc(gsl_rng_mt19937);
+		long cubeseed = baseseed_ + icube; //... each cube gets its unique seed
+
+		gsl_rng_set(RNG, cubeseed);
+
+		for (int ii = 0; ii < (int)cubesize_; ++ii)
+			for (int jj = 0; jj < (int)cubesize_; ++jj)
+				for (int kk = 0; kk < (int)cubesize_; ++kk)
+				{
+					(*pcube)(ii, jj, kk) = gsl_ran_ugaussian_ratio_method(RNG);
+					mean += (*pcube)(ii, jj, kk);
+				}
+
+		gsl_rng_free(RNG);
+	}
+
+	if (cs->data == NULL)
+		cubes_.publish(cs, pcube, pin);
 
 	return mean / (cubesize_ * cubesize_ * cubesize_);
 }
 
+template <typename T>
+void random_numbers<T>::fill_cube_lazy(int ic, int jc, int kc, cube_slot *cs, bool pin)
+{
+	//... the first thread to claim the slot generates the cube, others wait for it
+	while (cs->data == NULL)
+	{
+		if (__sync_bool_compare_and_swap(&cs->filling, 0, 1))
+		{
+			if (cs->data == NULL)
+				fill_cube(ic, jc, kc, pin);
+			__sync_lock_release(&cs->filling);
+		}
+		__sync_synchronize();
+	}
+
+	if (pin)
+		cs->pinned = 1;
+}
+
+template <typename T>
+void random_numbers<T>::trim_cache(void)
+{
+	if (cache_bytes_ == 0 || omp_in_parallel())
+		return;
+
+	size_t cubebytes = (size_t)cubesize_ * cubesize_ * cubesize_ * sizeof(T);
+	size_t nevict = cubes_.evict(std::max(cache_bytes_ / cubebytes, (size_t)1));
+
+#ifdef DEBUG
+	if (nevict > 0)
+		LOGDEBUG("evicted %ld random number cubes from memory cache", nevict);
+#else
+	(void)nevict;
+#endif
+}
+
+template <typename T>
+bool random_numbers<T>::parallel_over_cubes(size_t ncubes_fill) const
+{
+	//... with the counter-based generator a single cube can be filled by all threads,
+	//... so only distribute cubes over threads if there are enough of them
+	if (algorithm_ == rng_philox)
+		return ncubes_fill >= (size_t)omp_get_max_threads();
+	return true;
+}
+
 template <typename T>
 void random_numbers<T>::subtract_from_cube(int i, int j, int k, double val)
 {
@@ -1125,22 +1068,18 @@ void random_numbers<T>::subtract_from_cube(int i, int j, int k, double val)
 	j = (j + ncubes_) % ncubes_;
 	k = (k + ncubes_) % ncubes_;
 
-	size_t icube = ((size_t)i * ncubes_ + (size_t)j) * ncubes_ + (size_t)k;
-
-	cubemap_iterator it = cubemap_.find(icube);
+	cube_slot *cs = cubes_.find(i, j, k);
 
-	if (it == cubemap_.end())
+	if (cs == NULL)
 	{
 		LOGERR("Attempt to access unallocated RND cube %d,%d,%d in random_numbers::subtract_from_cube", i, j, k);
 		throw std::runtime_error("Attempt to access unallocated RND cube in random_numbers::subtract_from_cube");
 	}
 
-	size_t cubeidx = it->second;
-
 	for (int ii = 0; ii < (int)cubesize_; ++ii)
 		for (int jj = 0; jj < (int)cubesize_; ++jj)
 			for (int kk = 0; kk < (int)cubesize_; ++kk)
-				(*rnums_[cubeidx])(ii, jj, kk) -= val;
+				(*cs->data)(ii, jj, kk) -= val;
 }
 
 template <typename T>
@@ -1151,23 +1090,15 @@ void random_numbers<T>::free_cube(int i, int j, int k)
 	j = (j + ncubes_) % ncubes_;
 	k = (k + ncubes_) % ncubes_;
 
-	size_t icube = ((size_t)i * (size_t)ncubes_ + (size_t)j) * (size_t)ncubes_ + (size_t)k;
+	cube_slot *cs = cubes_.find(i, j, k);
 
-	cubemap_iterator it = cubemap_.find(icube);
-
-	if (it == cubemap_.end())
+	if (cs == NULL)
 	{
 		LOGERR("Attempt to access unallocated RND cube %d,%d,%d in random_numbers::free_cube", i, j, k);
 		throw std::runtime_error("Attempt to access unallocated RND cube in random_numbers::free_cube");
 	}
 
-	size_t cubeidx = it->second;
-
-	if (rnums_[cubeidx] != NULL)
-	{
-		delete rnums_[cubeidx];
-		rnums_[cubeidx] = NULL;
-	}
+	cubes_.release(cs);
 }
 
 template <typename T>
@@ -1181,6 +1112,8 @@ void random_numbers<T>::initialize(void)
 		cubesize_ = res_;
 	}
 
+	cubes_.resize(ncubes_);
+
 	LOGINFO("Generating random numbers w/ sample cube size of %d", cubesize_);
 }
 
@@ -1204,21 +1137,25 @@ double random_numbers<T>::fill_subvolume(int *i0, int *n)
 
 	double mean = 0.0;
 
-	for (int i = i0cube[0]; i < i0cube[0] + ncube[0]; ++i)
-		for (int j = i0cube[1]; j < i0cube[1] + ncube[1]; ++j)
-			for (int k = i0cube[2]; k < i0cube[2] + ncube[2]; ++k)
-			{
-				int ii(i), jj(j), kk(k);
-
-				ii = (ii + ncubes_) % ncubes_;
-				jj = (jj + ncubes_) % ncubes_;
-				kk = (kk + ncubes_) % ncubes_;
+	//... with a memory budget, cubes are only registered here and generated on first access
+	if (cache_bytes_ > 0)
+	{
+		for (int i = i0cube[0]; i < i0cube[0] + ncube[0]; ++i)
+			for (int j = i0cube[1]; j < i0cube[1] + ncube[1]; ++j)
+				for (int k = i0cube[2]; k < i0cube[2] + ncube[2]; ++k)
+					register_cube(i, j, k);
+		return 0.0;
+	}
 
-				register_cube(ii, jj, kk);
-			}
+	//... registration is thread-safe, so cubes are registered and filled in one pass;
+	//... a cube that is hit twice due to periodic wrapping is only filled once
+	//... fill_cube returns the mean of one cube, so weight it by the cube's cells and
+	//... normalise by the number of cells that were actually filled
+	bool bpar = parallel_over_cubes((size_t)ncube[0] * ncube[1] * ncube[2]);
+	size_t ncells_cube = (size_t)cubesize_ * cubesize_ * cubesize_, ncells = 0;
 
 #pragma omp parallel for reduction(+ \
-																	 : mean)
+																	 : mean, ncells) if (bpar)
 	for (int i = i0cube[0]; i < i0cube[0] + ncube[0]; ++i)
 		for (int j = i0cube[1]; j < i0cube[1] + ncube[1]; ++j)
 			for (int k = i0cube[2]; k < i0cube[2] + ncube[2]; ++k)
@@ -1229,9 +1166,13 @@ double random_numbers<T>::fill_subvolume(int *i0, int *n)
 				jj = (jj + ncubes_) % ncubes_;
 				kk = (kk + ncubes_) % ncubes_;
 
-				mean += fill_cube(ii, jj, kk);
+				if (register_cube(ii, jj, kk))
+				{
+					mean += fill_cube(ii, jj, kk) * (double)ncells_cube;
+					ncells += ncells_cube;
+				}
 			}
-	return mean / (ncube[0] * ncube[1] * ncube[2]);
+	return (ncells > 0) ? mean / (double)ncells : 0.0;
 }
 
 template <typename T>
@@ -1239,21 +1180,10 @@ double random_numbers<T>::fill_all(void)
 {
 	double sum = 0.0;
 
-	for (int i = 0; i < (int)ncubes_; ++i)
-		for (int j = 0; j < (int)ncubes_; ++j)
-			for (int k = 0; k < (int)ncubes_; ++k)
-			{
-				int ii(i), jj(j), kk(k);
-
-				ii = (ii + ncubes_) % ncubes_;
-				jj = (jj + ncubes_) % ncubes_;
-				kk = (kk + ncubes_) % ncubes_;
-
-				register_cube(ii, jj, kk);
-			}
+	bool bpar = parallel_over_cubes((size_t)ncubes_ * ncubes_ * ncubes_);
 
 #pragma omp parallel for reduction(+ \
-																	 : sum)
+																	 : sum) if (bpar)
 	for (int i = 0; i < (int)ncubes_; ++i)
 		for (int j = 0; j < (int)ncubes_; ++j)
 			for (int k = 0; k < (int)ncubes_; ++k)
@@ -1264,6 +1194,7 @@ double random_numbers<T>::fill_all(void)
 				jj = (jj + ncubes_) % ncubes_;
 				kk = (kk + ncubes_) % ncubes_;
 
+				register_cube(ii, jj, kk);
 				sum += fill_cube(ii, jj, kk);
 			}
 
@@ -1288,10 +1219,7 @@ double random_numbers<T>::fill_all(void)
 template <typename T>
 void random_numbers<T>::print_allocated(void)
 {
-	unsigned ncount = 0, ntot = rnums_.size();
-	for (size_t i = 0; i < rnums_.size(); ++i)
-		if (rnums_[i] != NULL)
-			ncount++;
+	unsigned ncount = cubes_.count_allocated(), ntot = cubes_.size();
 
 	LOGINFO(" -> %d of %d random number cubes currently allocated", ncount, ntot);
 }
@@ -1309,7 +1237,60 @@ random_number_generator<rng, T>::random_number_generator(config_file &cf, refine
 	levelmax_ = prefh_->levelmax();
 
 	ran_cube_size_ = pcf_->getValueSafe<unsigned>("random", "cubesize", DEF_RAN_CUBE_SIZE);
+
+	std::string algo = pcf_->getValueSafe<std::string>("random", "algorithm", "mt19937");
+	if (algo == "mt19937")
+		rng::algorithm_ = rng_mt19937;
+	else if (algo == "philox")
+	{
+		rng::algorithm_ = rng_philox;
+		LOGINFO("Using counter-based Philox4x32 white noise generator.");
+	}
+	else
+	{
+		LOGERR("Unknown white noise algorithm \'%s\' in [random]/algorithm.", algo.c_str());
+		throw std::runtime_error("Unknown white noise algorithm in [random]/algorithm");
+	}
+
+	std::string gmethod = pcf_->getValueSafe<std::string>("random", "gaussian", "ratio");
+	if (gmethod == "ratio")
+		rng::gaussian_method_ = gauss_ratio;
+	else if (gmethod == "boxmuller")
+	{
+		rng::gaussian_method_ = gauss_boxmuller;
+		if (rng::algorithm_ == rng_mt19937)
+			LOGINFO("Using batched Box-Muller sampling for white noise.");
+	}
+	else
+	{
+		LOGERR("Unknown Gaussian sampling method \'%s\' in [random]/gaussian.", gmethod.c_str());
+		throw std::runtime_error("Unknown Gaussian sampling method in [random]/gaussian");
+	}
+
+	double cache_mb = pcf_->getValueSafe<double>("random", "cache_mb", 0.0);
+	rng::cache_bytes_ = (cache_mb > 0.0) ? (size_t)(cache_mb * 1024.0 * 1024.0) : 0;
+	if (rng::cache_bytes_ > 0)
+		LOGINFO("Keeping at most %.1f MB of regenerable white noise cubes in memory.", cache_mb);
+
+	//... the cubes can be kept in either precision, independent of the one compiled for
+	std::string precision = pcf_->getValueSafe<std::string>("random", "noise_precision", sizeof(T) == sizeof(float) ? "float" : "double");
+	if (precision != "float" && precision != "double")
+	{
+		LOGERR("Unknown white noise precision \'%s\' in [random]/noise_precision (float/double).", precision.c_str());
+		throw std::runtime_error("Unknown white noise precision in [random]/noise_precision");
+	}
+	noise_single_ = (precision == "float");
+	if (noise_single_ != (sizeof(T) == sizeof(float)))
+		LOGINFO("Keeping white noise cubes in %s precision.", precision.c_str());
+
+	random_numbers<float>::algorithm_ = random_numbers<double>::algorithm_ = rng::algorithm_;
+	random_numbers<float>::gaussian_method_ = random_numbers<double>::gaussian_method_ = rng::gaussian_method_;
+	random_numbers<float>::cache_bytes_ = random_numbers<double>::cache_bytes_ = rng::cache_bytes_;
+
 	disk_cached_ = pcf_->getValueSafe<bool>("random", "disk_cached", true);
+	disk_compressed_ = pcf_->getValueSafe<bool>("random", "disk_compressed", false);
+	disk_async_ = pcf_->getValueSafe<bool>("random", "disk_async", true);
+	writer_ = NULL;
 	restart_ = pcf_->getValueSafe<bool>("random", "restart", false);
 
 	mem_cache_.assign(levelmax_ - levelmin_ + 1, (std::vector<T> *)NULL);
@@ -1324,7 +1305,17 @@ random_number_generator<rng, T>::random_number_generator(config_file &cf, refine
 	//... determine seed/white noise file data to be applied
 	parse_rand_parameters();
 
-	if (!restart_)
+	//... in distributed runs the first rank writes the disk cache, all ranks read their slab from it
+	if (fft_mpi::active())
+	{
+		if (!restart_ && fft_mpi::rank() == 0)
+		{
+			compute_random_numbers();
+			wait_for_writer();
+		}
+		fft_mpi::barrier();
+	}
+	else if (!restart_)
 	{
 		//... compute the actual random numbers
 		compute_random_numbers();
@@ -1334,6 +1325,14 @@ random_number_generator<rng, T>::random_number_generator(config_file &cf, refine
 template <typename rng, typename T>
 random_number_generator<rng, T>::~random_number_generator()
 {
+	try
+	{
+		wait_for_writer();
+	}
+	catch (std::exception &e)
+	{
+		LOGERR("Background white noise writer failed: %s", e.what());
+	}
 
 	//... clear memory caches
 	for (unsigned i = 0; i < mem_cache_.size(); ++i)
@@ -1463,18 +1462,23 @@ void random_number_generator<rng, T>::correct_avg(int icoarse, int ifine)
 		sprintf(fncoarse, "wnoise_%04d.bin", icoarse);
 		sprintf(fnfine, "wnoise_%04d.bin", ifine);
 
-		std::ifstream
-				iffine(fnfine, std::ios::binary),
-				ifcoarse(fncoarse, std::ios::binary);
+		wait_for_writer();
+
+		wnoise_cache_file<T> iffine, ifcoarse;
+		if (!iffine.open(fnfine) || !ifcoarse.open(fncoarse))
+		{
+			LOGERR("White noise files \'%s\' and \'%s\' could not be opened.", fnfine, fncoarse);
+			throw std::runtime_error("White noise file not found. This should not happen. Notify a developer!");
+		}
 
 		int nxc, nyc, nzc, nxf, nyf, nzf;
-		iffine.read(reinterpret_cast<char *>(&nxf), sizeof(unsigned));
-		iffine.read(reinterpret_cast<char *>(&nyf), sizeof(unsigned));
-		iffine.read(reinterpret_cast<char *>(&nzf), sizeof(unsigned));
+		nxf = iffine.size(0);
+		nyf = iffine.size(1);
+		nzf = iffine.size(2);
 
-		ifcoarse.read(reinterpret_cast<char *>(&nxc), sizeof(unsigned));
-		ifcoarse.read(reinterpret_cast<char *>(&nyc), sizeof(unsigned));
-		ifcoarse.read(reinterpret_cast<char *>(&nzc), sizeof(unsigned));
+		nxc = ifcoarse.size(0);
+		nyc = ifcoarse.size(1);
+		nzc = ifcoarse.size(2);
 
 		if (nxf != nf[0] || nyf != nf[1] || nzf != nf[2] || nxc != nc[0] || nyc != nc[1] || nzc != nc[2])
 		{
@@ -1488,7 +1492,8 @@ void random_number_generator<rng, T>::correct_avg(int icoarse, int ifine)
 		for (int i = 0, ic = 0; i < nxf; i += 2, ic++)
 		{
 			std::vector<T> fine_rand(2 * nyf * nzf, 0.0);
-			iffine.read(reinterpret_cast<char *>(&fine_rand[0]), 2 * nyf * nzf * sizeof(T));
+			iffine.read_plane(&fine_rand[0]);
+			iffine.read_plane(&fine_rand[(size_t)nyf * nzf]);
 
 #pragma omp parallel for
 			for (int j = 0; j < nyf; j += 2)
@@ -1518,8 +1523,10 @@ void random_number_generator<rng, T>::correct_avg(int icoarse, int ifine)
 		}
 
 		//... now deg_rand holds the oct-averaged fine field, store this in the coarse field
-		std::vector<T> coarse_rand(nxc * nyc * nzc, 0.0);
-		ifcoarse.read(reinterpret_cast<char *>(&coarse_rand[0]), nxc * nyc * nzc * sizeof(T));
+		std::vector<T> coarse_rand((size_t)nxc * nyc * nzc, 0.0);
+		for (int i = 0; i < nxc; ++i)
+			ifcoarse.read_plane(&coarse_rand[(size_t)i * nyc * nzc]);
+		iffine.close();
 
 		int di, dj, dk;
 
@@ -1546,11 +1553,10 @@ void random_number_generator<rng, T>::correct_avg(int icoarse, int ifine)
 		deg_rand.clear();
 
 		ifcoarse.close();
-		std::ofstream ofcoarse(fncoarse, std::ios::binary | std::ios::trunc);
-		ofcoarse.write(reinterpret_cast<char *>(&nxc), sizeof(unsigned));
-		ofcoarse.write(reinterpret_cast<char *>(&nyc), sizeof(unsigned));
-		ofcoarse.write(reinterpret_cast<char *>(&nzc), sizeof(unsigned));
-		ofcoarse.write(reinterpret_cast<char *>(&coarse_rand[0]), nxc * nyc * nzc * sizeof(T));
+		wnoise_cache_file<T> ofcoarse;
+		ofcoarse.create(fncoarse, nxc, nyc, nzc, disk_compressed_);
+		for (int i = 0; i < nxc; ++i)
+			ofcoarse.write_plane(&coarse_rand[(size_t)i * nyc * nzc]);
 		ofcoarse.close();
 	}
 	else
@@ -1603,12 +1609,22 @@ void random_number_generator<rng, T>::correct_avg(int icoarse, int ifine)
 
 template <typename rng, typename T>
 void random_number_generator<rng, T>::compute_random_numbers(void)
+{
+	if (noise_single_)
+		compute_random_numbers_with<random_numbers<float> >();
+	else
+		compute_random_numbers_with<random_numbers<double> >();
+}
+
+template <typename rng, typename T>
+template <typename R>
+void random_number_generator<rng, T>::compute_random_numbers_with(void)
 {
 	bool kavg = pcf_->getValueSafe<bool>("random", "kaveraging", true);
 	bool rndsign = pcf_->getValueSafe<bool>("random", "grafic_sign", false);
 	bool brealspace_tf = !pcf_->getValue<bool>("setup", "kspace_TF");
 
-	std::vector<rng *> randc(std::max(levelmax_, levelmin_seed_) + 1, (rng *)NULL);
+	std::vector<R *> randc(std::max(levelmax_, levelmin_seed_) + 1, (R *)NULL);
 
 	//--- FILL ALL WHITE NOISE ARRAYS FOR WHICH WE NEED THE FULL FIELD ---//
 
@@ -1616,9 +1632,9 @@ void random_number_generator<rng, T>::compute_random_numbers(void)
 	if (levelmin_seed_ < levelmin_)
 	{
 		if (rngfnames_[levelmin_seed_].size() > 0)
-			randc[levelmin_seed_] = new rng(1 << levelmin_seed_, rngfnames_[levelmin_seed_], rndsign);
+			randc[levelmin_seed_] = new R(1 << levelmin_seed_, rngfnames_[levelmin_seed_], rndsign);
 		else
-			randc[levelmin_seed_] = new rng(1 << levelmin_seed_, ran_cube_size_, rngseeds_[levelmin_seed_], true);
+			randc[levelmin_seed_] = new R(1 << levelmin_seed_, ran_cube_size_, rngseeds_[levelmin_seed_], true);
 
 		for (int i = levelmin_seed_ + 1; i <= levelmin_; ++i)
 		{
@@ -1627,7 +1643,7 @@ void random_number_generator<rng, T>::compute_random_numbers(void)
 			if (rngfnames_[i].size() > 0)
 				LOGINFO("Warning: Cannot use filenames for higher levels currently! Ignoring!");
 
-			randc[i] = new rng(*randc[i - 1], ran_cube_size_, rngseeds_[i], kavg);
+			randc[i] = new R(*randc[i - 1], ran_cube_size_, rngseeds_[i], kavg);
 			delete randc[i - 1];
 			randc[i - 1] = NULL;
 		}
@@ -1637,9 +1653,9 @@ void random_number_generator<rng, T>::compute_random_numbers(void)
 	if (levelmin_seed_ > levelmin_)
 	{
 		if (rngfnames_[levelmin_seed_].size() > 0)
-			randc[levelmin_seed_] = new rng(1 << levelmin_seed_, rngfnames_[levelmin_seed_], rndsign);
+			randc[levelmin_seed_] = new R(1 << levelmin_seed_, rngfnames_[levelmin_seed_], rndsign);
 		else
-			randc[levelmin_seed_] = new rng(1 << levelmin_seed_, ran_cube_size_, rngseeds_[levelmin_seed_], true); //, x0, lx );
+			randc[levelmin_seed_] = new R(1 << levelmin_seed_, ran_cube_size_, rngseeds_[levelmin_seed_], true); //, x0, lx );
 
 		for (int ilevel = levelmin_seed_ - 1; ilevel >= (int)levelmin_; --ilevel)
 		{
@@ -1649,9 +1665,9 @@ void random_number_generator<rng, T>::compute_random_numbers(void)
 								ilevel, levelmin_seed_);
 
 			//if( brealspace_tf && ilevel < levelmax_ )
-			//  randc[ilevel] = new rng( *randc[ilevel+1], false );
+			//  randc[ilevel] = new R( *randc[ilevel+1], false );
 			//else // do k-space averaging
-			randc[ilevel] = new rng(*randc[ilevel + 1], kavg);
+			randc[ilevel] = new R(*randc[ilevel + 1], kavg);
 
 			if (ilevel + 1 > levelmax_)
 			{
@@ -1667,9 +1683,9 @@ void random_number_generator<rng, T>::compute_random_numbers(void)
 	if (randc[levelmin_] == NULL)
 	{
 		if (rngfnames_[levelmin_].size() > 0)
-			randc[levelmin_] = new rng(1 << levelmin_, rngfnames_[levelmin_], rndsign);
+			randc[levelmin_] = new R(1 << levelmin_, rngfnames_[levelmin_], rndsign);
 		else
-			randc[levelmin_] = new rng(1 << levelmin_, ran_cube_size_, rngseeds_[levelmin_], true);
+			randc[levelmin_] = new R(1 << levelmin_, ran_cube_size_, rngseeds_[levelmin_], true);
 	}
 
 	//if( levelmax_ == levelmin_ )
@@ -1705,7 +1721,7 @@ void random_number_generator<rng, T>::compute_random_numbers(void)
 		x0[2] = prefh_->offset_abs(ilevel, 2) - lfac * shift[2] - lx[2] / 4;
 
 		if (randc[ilevel] == NULL)
-			randc[ilevel] = new rng(*randc[ilevel - 1], ran_cube_size_, rngseeds_[ilevel], kavg, ilevel == levelmin_ + 1, x0, lx);
+			randc[ilevel] = new R(*randc[ilevel - 1], ran_cube_size_, rngseeds_[ilevel], kavg, ilevel == levelmin_ + 1, x0, lx);
 		delete randc[ilevel - 1];
 		randc[ilevel - 1] = NULL;
 
@@ -1720,6 +1736,8 @@ void random_number_generator<rng, T>::compute_random_numbers(void)
 	delete randc[levelmax_];
 	randc[levelmax_] = NULL;
 
+	wait_for_writer();
+
 	//... make sure that the coarse grid contains oct averages where it overlaps with a fine grid
 	//... this also ensures that constraints enforced on fine grids are carried to the coarser grids
 	if (brealspace_tf)
@@ -1732,14 +1750,35 @@ void random_number_generator<rng, T>::compute_random_numbers(void)
 	/*if( levelmax_rand_ >= (int)levelmin_ )
 	 {
 	 std::cerr << "lmaxread >= (int)levelmin\n";
-	 randc[levelmax_rand_] = new rng( (unsigned)pow(2,levelmax_rand_), rngfnames_[levelmax_rand_] );
+	 randc[levelmax_rand_] = new R( (unsigned)pow(2,levelmax_rand_), rngfnames_[levelmax_rand_] );
 	 for( int ilevel = levelmax_rand_-1; ilevel >= (int)levelmin_; --ilevel )
-	 randc[ilevel] = new rng( *randc[ilevel+1] );
+	 randc[ilevel] = new R( *randc[ilevel+1] );
 	 }*/
 }
 
 template <typename rng, typename T>
-void random_number_generator<rng, T>::store_rnd(int ilevel, rng *prng)
+void random_number_generator<rng, T>::wait_for_writer(void)
+{
+	if (writer_ != NULL)
+	{
+		wnoise_cache_writer<T> *w = writer_;
+		writer_ = NULL;
+		try
+		{
+			w->finish();
+		}
+		catch (...)
+		{
+			delete w;
+			throw;
+		}
+		delete w;
+	}
+}
+
+template <typename rng, typename T>
+template <typename R>
+void random_number_generator<rng, T>::store_rnd(int ilevel, R *prng)
 {
 	int shift[3], levelmin_poisson;
 	shift[0] = pcf_->getValue<int>("setup", "shift_x");
@@ -1846,73 +1885,73 @@ void random_number_generator<rng, T>::store_rnd(int ilevel, rng *prng)
 
 	if (disk_cached_)
 	{
-		std::vector<T> data;
+		int nx, ny, nz;
+		int i0, j0, k0;
+
 		if (ilevel == levelmin_)
 		{
-			int N = 1 << levelmin_;
-			int i0, j0, k0;
-
 			i0 = -lfac * shift[0];
 			j0 = -lfac * shift[1];
 			k0 = -lfac * shift[2];
 
-			char fname[128];
-			sprintf(fname, "wnoise_%04d.bin", ilevel);
-
-			LOGUSER("Storing white noise field in file \'%s\'...", fname);
-
-			std::ofstream ofs(fname, std::ios::binary | std::ios::trunc);
-
-			ofs.write(reinterpret_cast<char *>(&N), sizeof(unsigned));
-			ofs.write(reinterpret_cast<char *>(&N), sizeof(unsigned));
-			ofs.write(reinterpret_cast<char *>(&N), sizeof(unsigned));
-
-			data.assign(N * N, 0.0);
-			for (int i = 0; i < N; ++i)
-			{
-#pragma omp parallel for
-				for (int j = 0; j < N; ++j)
-					for (int k = 0; k < N; ++k)
-						data[j * N + k] = (*prng)(i + i0, j + j0, k + k0);
-
-				ofs.write(reinterpret_cast<char *>(&data[0]), N * N * sizeof(T));
-			}
-			ofs.close();
+			nx = ny = nz = 1 << levelmin_;
 		}
 		else
 		{
-			int nx, ny, nz;
-			int i0, j0, k0;
-
 			nx = 2 * prefh_->size(ilevel, 0);
 			ny = 2 * prefh_->size(ilevel, 1);
 			nz = 2 * prefh_->size(ilevel, 2);
 			i0 = prefh_->offset_abs(ilevel, 0) - lfac * shift[0] - nx / 4;
 			j0 = prefh_->offset_abs(ilevel, 1) - lfac * shift[1] - ny / 4; // was nx/4
 			k0 = prefh_->offset_abs(ilevel, 2) - lfac * shift[2] - nz / 4; // was nx/4
+		}
 
-			char fname[128];
-			sprintf(fname, "wnoise_%04d.bin", ilevel);
+		char fname[128];
+		sprintf(fname, "wnoise_%04d.bin", ilevel);
 
-			LOGUSER("Storing white noise field in file \'%s\'...", fname);
+		//... only one level is written in the background at any time
+		wait_for_writer();
 
-			std::ofstream ofs(fname, std::ios::binary | std::ios::trunc);
+		LOGUSER("Storing white noise field in file \'%s\'...", fname);
 
-			ofs.write(reinterpret_cast<char *>(&nx), sizeof(unsigned));
-			ofs.write(reinterpret_cast<char *>(&ny), sizeof(unsigned));
-			ofs.write(reinterpret_cast<char *>(&nz), sizeof(unsigned));
+		if (disk_async_)
+		{
+			//... planes are compressed and written in the background while the next ones
+			//... are extracted; only the last few are still in flight when the next level starts
+			const size_t queuebytes = (size_t)256 << 20;
+			size_t planebytes = (size_t)ny * nz * sizeof(T);
+			size_t maxplanes = std::max((size_t)2, queuebytes / std::max(planebytes, (size_t)1));
+			writer_ = new wnoise_cache_writer<T>(fname, nx, ny, nz, disk_compressed_, maxplanes);
 
-			data.assign(ny * nz, 0.0);
 			for (int i = 0; i < nx; ++i)
 			{
+				std::vector<T> *plane = writer_->acquire();
+
 #pragma omp parallel for
 				for (int j = 0; j < ny; ++j)
 					for (int k = 0; k < nz; ++k)
-						data[j * nz + k] = (*prng)(i + i0, j + j0, k + k0);
+						(*plane)[(size_t)j * nz + k] = (*prng)(i + i0, j + j0, k + k0);
 
-				ofs.write(reinterpret_cast<char *>(&data[0]), ny * nz * sizeof(T));
+				prng->trim_cache();
+				writer_->push(plane);
+			}
+		}
+		else
+		{
+			wnoise_cache_file<T> wf;
+			wf.create(fname, nx, ny, nz, disk_compressed_);
+
+			std::vector<T> data((size_t)ny * nz, 0.0);
+			for (int i = 0; i < nx; ++i)
+			{
+#pragma omp parallel for
+				for (int j = 0; j < ny; ++j)
+					for (int k = 0; k < nz; ++k)
+						data[(size_t)j * nz + k] = (*prng)(i + i0, j + j0, k + k0);
+
+				prng->trim_cache();
+				wf.write_plane(&data[0]);
 			}
-			ofs.close();
 		}
 	}
 	else
@@ -1955,6 +1994,15 @@ void random_number_generator<rng, T>::store_rnd(int ilevel, rng *prng)
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+template <typename T>
+rng_algorithm random_numbers<T>::algorithm_ = rng_mt19937;
+
+template <typename T>
+rng_gaussian_method random_numbers<T>::gaussian_method_ = gauss_ratio;
+
+template <typename T>
+size_t random_numbers<T>::cache_bytes_ = 0;
+
 template class random_numbers<float>;
 template class random_numbers<double>;
 template class random_number_generator<random_numbers<float>, float>;
@@ -30,6 +30,22 @@
 #include "mesh.hh"
 #include "mg_operators.hh"
 #include "constraints.hh"
+#include "philox.hh"
+#include "wnoise_cache.hh"
+
+//! algorithms to draw the white noise in a random number cube
+enum rng_algorithm
+{
+	rng_mt19937,	//!< one GSL Mersenne twister per cube, seeded with baseseed+cube index (default)
+	rng_philox		//!< counter-based generator keyed by seed and global cell index
+};
+
+//! transformation from uniform to Gaussian deviates used with the Mersenne twister
+enum rng_gaussian_method
+{
+	gauss_ratio,		//!< GSL ratio method, one deviate per call (default)
+	gauss_boxmuller		//!< batched Box-Muller over a whole row of a cube
+};
 
 
 class RNG_plugin{
@@ -75,6 +91,209 @@ typedef RNG_plugin RNG_instance;
 RNG_plugin *select_RNG_plugin( config_file& cf );
 
 
+/*!
+ * @brief dense table of random number cubes, addressed by the 3D cube index
+ *
+ * The table holds one row of ncubes slots along k for each (i,j), rows are allocated
+ * on first use. Registration uses atomic compare-and-swap only, so that cubes can be
+ * registered and filled concurrently from within OpenMP regions, lookup is O(1).
+ * Cubes that can be regenerated from their seed may be left unpinned, these are
+ * then candidates for eviction in least-recently-used order.
+ */
+template< typename T >
+class cube_table
+{
+public:
+	//! one table entry: the cube data (NULL if not allocated) and its state
+	struct slot
+	{
+		Meshvar<T> *data;
+		int registered;		//!< cube belongs to the field
+		int pinned;			//!< data cannot be regenerated and must not be evicted
+		int filling;		//!< a thread is currently generating the data
+		size_t stamp;		//!< epoch of last use, for LRU eviction
+	};
+
+protected:
+	size_t n_;						//!< number of cubes per dimension
+	std::vector< slot* > rows_;		//!< n_*n_ rows of n_ slots each, NULL if not used yet
+	size_t nregistered_;			//!< number of registered cubes
+	size_t nallocated_;				//!< number of cubes that hold data
+	size_t epoch_;					//!< current epoch, advanced at each eviction point
+
+	slot *get_row( size_t i, size_t j )
+	{
+		slot *row = rows_[i*n_+j];
+		if( row != NULL )
+			return row;
+
+		slot *newrow = new slot[n_];
+		for( size_t k=0; k<n_; ++k )
+		{
+			newrow[k].data = NULL;
+			newrow[k].registered = 0;
+			newrow[k].pinned = 0;
+			newrow[k].filling = 0;
+			newrow[k].stamp = 0;
+		}
+
+		//... another thread may have been faster
+		if( !__sync_bool_compare_and_swap( &rows_[i*n_+j], (slot*)NULL, newrow ) )
+			delete[] newrow;
+
+		return rows_[i*n_+j];
+	}
+
+	static bool older( const slot *a, const slot *b )
+	{
+		return a->stamp < b->stamp;
+	}
+
+public:
+	cube_table( void )
+	: n_( 0 ), nregistered_( 0 ), nallocated_( 0 ), epoch_( 0 )
+	{ }
+
+	~cube_table()
+	{
+		clear();
+	}
+
+	//! delete all cubes and set up an empty table for n^3 cubes
+	void resize( size_t n )
+	{
+		clear();
+		n_ = n;
+		rows_.assign( n_*n_, (slot*)NULL );
+	}
+
+	//! delete all cubes and rows
+	void clear( void )
+	{
+		for( size_t q=0; q<rows_.size(); ++q )
+			if( rows_[q] != NULL )
+			{
+				for( size_t k=0; k<n_; ++k )
+					delete rows_[q][k].data;
+				delete[] rows_[q];
+			}
+		rows_.clear();
+		nregistered_ = 0;
+		nallocated_ = 0;
+	}
+
+	//! register cube (i,j,k), returns true if it was not registered before, thread-safe
+	bool insert( size_t i, size_t j, size_t k )
+	{
+		slot &s = get_row( i, j )[k];
+
+		if( s.registered || !__sync_bool_compare_and_swap( &s.registered, 0, 1 ) )
+			return false;
+
+		__sync_fetch_and_add( &nregistered_, (size_t)1 );
+		return true;
+	}
+
+	//! slot of cube (i,j,k), NULL if the cube was not registered
+	inline slot *find( size_t i, size_t j, size_t k ) const
+	{
+		slot *row = rows_[i*n_+j];
+		if( row == NULL || !row[k].registered )
+			return NULL;
+		return &row[k];
+	}
+
+	//! attach fully initialized data to a slot, visible to all threads afterwards
+	void publish( slot *s, Meshvar<T> *m, bool pinned )
+	{
+		s->pinned = pinned;
+		s->stamp = epoch_;
+		__sync_synchronize();
+		s->data = m;
+		__sync_fetch_and_add( &nallocated_, (size_t)1 );
+	}
+
+	//! delete the data of a slot, it stays registered
+	void release( slot *s )
+	{
+		if( s->data == NULL )
+			return;
+		delete s->data;
+		s->data = NULL;
+		s->pinned = 0;
+		__sync_fetch_and_sub( &nallocated_, (size_t)1 );
+	}
+
+	//! mark a slot as used in the current epoch
+	inline void touch( slot *s ) const
+	{
+		if( s->stamp != epoch_ )
+			s->stamp = epoch_;
+	}
+
+	//! start a new epoch and evict unpinned cubes, least recently used first,
+	//! until at most maxalloc cubes hold data. Must not be called from a parallel region.
+	size_t evict( size_t maxalloc )
+	{
+		++epoch_;
+
+		if( nallocated_ <= maxalloc )
+			return 0;
+
+		std::vector< slot* > cand;
+		for( size_t q=0; q<rows_.size(); ++q )
+			if( rows_[q] != NULL )
+				for( size_t k=0; k<n_; ++k )
+					if( rows_[q][k].data != NULL && !rows_[q][k].pinned )
+						cand.push_back( &rows_[q][k] );
+
+		std::sort( cand.begin(), cand.end(), older );
+
+		size_t nevict = 0;
+		for( size_t q=0; q<cand.size() && nallocated_ > maxalloc; ++q, ++nevict )
+			release( cand[q] );
+
+		return nevict;
+	}
+
+	//! make the table hold a single mesh as cube (0,0,0)
+	Meshvar<T> *assign_single( Meshvar<T> *m )
+	{
+		resize( 1 );
+		insert( 0, 0, 0 );
+		publish( &rows_[0][0], m, true );
+		return m;
+	}
+
+	//! the mesh of cube (0,0,0), used if the table holds a single mesh
+	inline Meshvar<T> *single( void ) const
+	{
+		return rows_[0][0].data;
+	}
+
+	//! number of registered cubes
+	size_t size( void ) const
+	{
+		return nregistered_;
+	}
+
+	//! number of cubes that currently hold data
+	size_t count_allocated( void ) const
+	{
+		return nallocated_;
+	}
+
+	//! delete the data of all cubes, but keep them registered
+	void free_all( void )
+	{
+		for( size_t q=0; q<rows_.size(); ++q )
+			if( rows_[q] != NULL )
+				for( size_t k=0; k<n_; ++k )
+					release( &rows_[q][k] );
+	}
+};
+
+
 /*!
  * @brief encapsulates all things random number generator related
  */
@@ -88,23 +307,29 @@ public:
 		ncubes_;	//!< number of random number cubes to cover the full mesh
 	long baseseed_;	//!< base seed from which cube seeds are computed 
 	
+	//! algorithm used to fill random number cubes, set from [random]/algorithm
+	static rng_algorithm algorithm_;
+	static rng_gaussian_method gaussian_method_;
+	
+	//! memory budget in bytes for regenerable cubes, set from [random]/cache_mb (0: keep all cubes)
+	static size_t cache_bytes_;
     
 protected:
-	//! vector of 3D meshes (the random number cubes) with random numbers
-	std::vector< Meshvar<T>* > rnums_;
-    
-    //! map of 3D indices to cube index
-    std::map<size_t,size_t> cubemap_;
-    
-    typedef std::map<size_t,size_t>::iterator cubemap_iterator;
+	//! table of 3D meshes (the random number cubes) with random numbers
+	cube_table<T> cubes_;
+	
+	typedef typename cube_table<T>::slot cube_slot;
 	
 protected:
     
-    //! register a cube with the hash map
-    void register_cube( int i, int j, int k);
+    //! register a cube with the cube table, returns true if it was not registered before
+    bool register_cube( int i, int j, int k);
+	
+	//! fills a subcube with random numbers, unpinned cubes may be evicted and regenerated later
+	double fill_cube( int i, int j, int k, bool pin=true );
 	
-	//! fills a subcube with random numbers
-	double fill_cube( int i, int j, int k);
+	//! decide whether a fill of ncubes_fill cubes should be parallelized over the cubes
+	bool parallel_over_cubes( size_t ncubes_fill ) const;
 	
 	//! subtract a constant from an entire cube
 	void subtract_from_cube( int i, int j, int k, double val );
@@ -123,26 +348,26 @@ protected:
 		j = (j+ncubes_)%ncubes_;
 		k = (k+ncubes_)%ncubes_;
 		
-		size_t icube = (i*ncubes_+j)*ncubes_+k;
-        cubemap_iterator it = cubemap_.find( icube );
+        cube_slot *cs = cubes_.find( i, j, k );
         
-        if( it == cubemap_.end() )
+        if( cs == NULL )
         {
             LOGERR("attempting to copy data from non-existing RND cube %d,%d,%d",i,j,k);
             throw std::runtime_error("attempting to copy data from non-existing RND cube");
         }
-        
-        size_t cubeidx = it->second;
 		
 		for( int ii=0; ii<(int)cubesize_; ++ii )
 			for( int jj=0; jj<(int)cubesize_; ++jj )
 				for( int kk=0; kk<(int)cubesize_; ++kk )
-					dat(offi+ii,offj+jj,offk+kk) = (*rnums_[cubeidx])(ii,jj,kk);
+					dat(offi+ii,offj+jj,offk+kk) = (*cs->data)(ii,jj,kk);
 	}
 	
 	//! free the memory associated with a subcube
 	void free_cube( int i, int j, int k );
 	
+	//! generate a missing cube on first access, used if a memory budget is set
+	void fill_cube_lazy( int ic, int jc, int kc, cube_slot *cs, bool pin );
+	
 	//! initialize member variables and allocate memory
 	void initialize( void );
 	
@@ -158,15 +383,9 @@ protected:
 	{
 		double sum = 0.0;
 		
-        for( int i=0; i<(int)ncubes_; ++i )
-			for( int j=0; j<(int)ncubes_; ++j )
-				for( int k=0; k<(int)ncubes_; ++k )
-				{
-					int ii(i),jj(j),kk(k);
-                    register_cube(ii,jj,kk);
-                }
-        
-		#pragma omp parallel for reduction(+:sum)
+		bool bpar = parallel_over_cubes( (size_t)ncubes_*ncubes_*ncubes_ );
+		
+		#pragma omp parallel for reduction(+:sum) if(bpar)
 		for( int i=0; i<(int)ncubes_; ++i )
 			for( int j=0; j<(int)ncubes_; ++j )
 				for( int k=0; k<(int)ncubes_; ++k )
@@ -177,6 +396,7 @@ protected:
 					jj = (jj+ncubes_)%ncubes_;
 					kk = (kk+ncubes_)%ncubes_;
 					
+					register_cube(ii, jj, kk);
 					sum+=fill_cube(ii, jj, kk);
 					copy_cube(ii,jj,kk,dat);
 					free_cube(ii, jj, kk);
@@ -211,13 +431,11 @@ public:
 	//! destructor
 	~random_numbers()
 	{
-		for( unsigned i=0; i<rnums_.size(); ++i )
-			if( rnums_[i] != NULL )
-				delete rnums_[i];
-		rnums_.clear();
+		cubes_.clear();
 	}
 	
 	//! access a random number, this allocates a cube and fills it with consistent random numbers
+	/*! if a memory budget is set, fillrand=false announces a write access */
 	inline T& operator()( int i, int j, int k, bool fillrand=true )
 	{
 		int ic, jc, kc, is, js, ks;
@@ -230,42 +448,43 @@ public:
 		jc = (int)((double)j/cubesize_ + ncubes_) % ncubes_;
 		kc = (int)((double)k/cubesize_ + ncubes_) % ncubes_;
 		
-		size_t icube = ((size_t)ic*ncubes_+(size_t)jc)*ncubes_+(size_t)kc;
-		
-        cubemap_iterator it = cubemap_.find( icube );
+        cube_slot *cs = cubes_.find( ic, jc, kc );
         
-        if( it == cubemap_.end() )
+        if( cs == NULL )
         {
             LOGERR("Attempting to copy data from non-existing RND cube %d,%d,%d @ %d,%d,%d",ic,jc,kc,i,j,k);
             throw std::runtime_error("attempting to copy data from non-existing RND cube");
             
         }
         
-        size_t cubeidx = it->second;
-        
-		if( rnums_[ cubeidx ] == NULL )
+		//... with a memory budget, cubes are generated on first access and cubes that
+		//... are accessed for writing (fillrand=false) are pinned in memory
+		if( cache_bytes_ > 0 && (cs->data == NULL || (!fillrand && !cs->pinned)) )
+			fill_cube_lazy( ic, jc, kc, cs, !fillrand );
+		
+		if( cs->data == NULL )
 		{
             LOGERR("Attempting to access data from non-allocated RND cube %d,%d,%d",ic,jc,kc);
             throw std::runtime_error("attempting to access data from non-allocated RND cube");
 		}
 		
+		cubes_.touch( cs );
+		
 		//... determine cell in cube
 		is = (i - ic * cubesize_ + cubesize_) % cubesize_;
 		js = (j - jc * cubesize_ + cubesize_) % cubesize_;
 		ks = (k - kc * cubesize_ + cubesize_) % cubesize_;
 		
-        return (*rnums_[ cubeidx ])(is,js,ks);
+        return (*cs->data)(is,js,ks);
 	}
 	
+	//! evict least recently used cubes until the memory budget is met, no-op inside parallel regions
+	void trim_cache( void );
+	
 	//! free all cubes
 	void free_all_mem( void )
 	{
-		for( unsigned i=0; i<rnums_.size(); ++i )
-			if( rnums_[i] != NULL )
-			{
-				delete rnums_[i];	
-				rnums_[i] = NULL;
-			}
+		cubes_.free_all();
 	}
 	
 	
@@ -290,7 +509,11 @@ protected:
 	std::vector<std::string>		rngfnames_;
 	
 	bool							disk_cached_;
+	bool							disk_compressed_;	//!< compress the disk cache losslessly
+	bool							disk_async_;		//!< write the disk cache in the background
 	bool							restart_;
+	bool							noise_single_;		//!< keep the white noise cubes in single precision
+	wnoise_cache_writer<T>			*writer_;			//!< background writer of the last stored level
 	std::vector< std::vector<T>* >	mem_cache_;
 	
 	unsigned						ran_cube_size_;
@@ -310,8 +533,16 @@ protected:
 	//! the main driver routine for multi-scale white noise generation
 	void compute_random_numbers( void );
 	
+	//! generate all levels with white noise cubes of type R
+	template< typename R >
+	void compute_random_numbers_with( void );
+	
 	//! store the white noise fields in memory or on disk
-	void store_rnd( int ilevel, rng* prng );
+	template< typename R >
+	void store_rnd( int ilevel, R* prng );
+	
+	//! wait until the background writer has finished, rethrows its errors
+	void wait_for_writer( void );
 	
 
 public:
@@ -336,18 +567,17 @@ public:
 			
 			LOGUSER("Loading white noise from file \'%s\'...",fname);
 			
-			std::ifstream ifs( fname, std::ios::binary );
-			if( !ifs.good() )
+			wait_for_writer();
+			
+			wnoise_cache_file<T> ifs;
+			if( !ifs.open( fname ) )
 			{	
 				LOGERR("White noise file \'%s\'was not found.",fname);
 				throw std::runtime_error("A white noise file was not found. This is an internal inconsistency and bad.");
 				
 			}
 			
-			int nx,ny,nz;
-			ifs.read( reinterpret_cast<char*> (&nx), sizeof(int) );
-			ifs.read( reinterpret_cast<char*> (&ny), sizeof(int) );
-			ifs.read( reinterpret_cast<char*> (&nz), sizeof(int) );
+			int nx( ifs.size(0) ), ny( ifs.size(1) ), nz( ifs.size(2) );
 			
 			if( nx!=(int)A.size(0) || ny!=(int)A.size(1) || nz!=(int)A.size(2) )
 			{	
@@ -362,7 +592,7 @@ public:
 
 			      for( int i=0; i<nx; ++i )
 				{
-				  ifs.read( reinterpret_cast<char*> ( &slice[0] ), ny*nz*sizeof(T) );
+				  ifs.read_plane( &slice[0] );
 			      
 				  if( i<ox ) continue;
 				  if( i>=3*ox ) break;
@@ -383,10 +613,10 @@ public:
 			    }
 			}else{
 			
+			  std::vector<T> slice( ny*nz, 0.0 );
 			  for( int i=0; i<nx; ++i )
 			    {
-			      std::vector<T> slice( ny*nz, 0.0 );
-			      ifs.read( reinterpret_cast<char*> ( &slice[0] ), ny*nz*sizeof(T) );
+			      ifs.read_plane( &slice[0] );
 			      
                               #pragma omp parallel for
 			      for( int j=0; j<ny; ++j )
@@ -425,7 +655,48 @@ public:
 			
 		}
 
-		
+
+	}
+
+	//! load the planes x0...x0+A.size(0)-1 of the disk cached random numbers of a level
+	template< typename array >
+	void load_slab( array& A, int ilevel, int x0 )
+	{
+		char fname[128];
+		sprintf(fname,"wnoise_%04d.bin",ilevel);
+
+		LOGUSER("Loading planes %d-%d of white noise from file \'%s\'...",x0,x0+(int)A.size(0)-1,fname);
+
+		wnoise_cache_file<T> ifs;
+		if( !ifs.open( fname ) )
+		{
+			LOGERR("White noise file \'%s\'was not found.",fname);
+			throw std::runtime_error("A white noise file was not found. This is an internal inconsistency and bad.");
+		}
+
+		int nx( A.size(0) ), ny( ifs.size(1) ), nz( ifs.size(2) );
+
+		if( x0+nx > ifs.size(0) || ny!=(int)A.size(1) || nz!=(int)A.size(2) )
+		{
+			LOGERR("White noise file is not aligned with slab. File: [%d,%d,%d]. Mem: [%d+%d,%d,%d].",
+				   ifs.size(0),ny,nz,x0,A.size(0),A.size(1),A.size(2));
+			throw std::runtime_error("White noise file is not aligned with slab. This is an internal inconsistency and bad.");
+		}
+
+		ifs.skip_planes( x0 );
+
+		std::vector<T> slice( (size_t)ny*nz, 0.0 );
+		for( int i=0; i<nx; ++i )
+		{
+			ifs.read_plane( &slice[0] );
+
+			#pragma omp parallel for
+			for( int j=0; j<ny; ++j )
+				for( int k=0; k<nz; ++k )
+					A(i,j,k) = slice[(size_t)j*nz+k];
+		}
+
+		ifs.close();
 	}
 };
 
@@ -203,6 +203,35 @@ public:
         
     }
     
+    void query_row( double x, double y, const double *z, size_t n, int ilevel, unsigned char *inside )
+    {
+        if( !do_extra_padding_ )
+        {
+            std::fill( inside, inside+n, 1 );
+            return;
+        }
+        
+        bool check = true;
+        double xp[2] = { x, y }, dx;
+        for( int i=0; i<2; ++i )
+        {
+            dx = xp[i] - x0ref_[i];
+            if( dx < -0.5 ) dx += 1.0;
+            else if (dx > 0.5 ) dx -= 1.0;
+            
+            check &= ((dx >= padding_fine_) & (dx <= lxref_[i]-padding_fine_));
+        }
+        
+        for( size_t k=0; k<n; ++k )
+        {
+            dx = z[k] - x0ref_[2];
+            if( dx < -0.5 ) dx += 1.0;
+            else if (dx > 0.5 ) dx -= 1.0;
+            
+            inside[k] = check & ((dx >= padding_fine_) & (dx <= lxref_[2]-padding_fine_));
+        }
+    }
+    
     bool is_grid_dim_forced( size_t* ndims )
     {
         for( int i=0; i<3; ++i )
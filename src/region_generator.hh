@@ -31,6 +31,18 @@ public:
     //! query whether a point intersects the region
     virtual bool query_point( double *x, int level ) = 0;
     
+    //! query a row of n points (x,y,z[i]), inside[i] is set to 1 if the point intersects the region and to 0 otherwise
+    /*! the default queries the points one by one, plug-ins override it to handle whole rows at once */
+    virtual void query_row( double x, double y, const double *z, size_t n, int level, unsigned char *inside )
+    {
+        double xq[3] = { x, y, 0.0 };
+        for( size_t i=0; i<n; ++i )
+        {
+            xq[2] = z[i];
+            inside[i] = query_point( xq, level );
+        }
+    }
+    
     //! query whether the region generator explicitly forces the grid dimensions
     virtual bool is_grid_dim_forced( size_t *ndims ) = 0;
     
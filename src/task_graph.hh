@@ -0,0 +1,142 @@
+/*
+
+ task_graph.hh - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#ifndef __TASK_GRAPH_HH
+#define __TASK_GRAPH_HH
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "log.hh"
+#include "profile.hh"
+
+/*!
+ * @brief a small dependency graph of driver stages
+ *
+ * Stages are added in an order that respects their dependencies. Compute
+ * stages run one after the other on the calling thread and use all OpenMP
+ * threads themselves; I/O stages (plugin writes) run in order on one extra
+ * thread, so that they overlap with the compute stages they do not depend on.
+ * Without overlap all stages run in the order they were added, exactly like
+ * the plain sequential driver. The first exception thrown by a stage stops
+ * the graph and is rethrown by run().
+ */
+class task_graph
+{
+public:
+	enum kind_t { compute, io };
+
+protected:
+	struct node
+	{
+		std::string name;
+		kind_t kind;
+		std::function<void()> fn;
+		std::vector<int> deps;
+		bool done;
+	};
+
+	std::vector< node > nodes_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::exception_ptr error_;
+
+	//! wait until all dependencies of stage i are done, false if the graph was aborted
+	bool wait_for( int i )
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		for( size_t j=0; j<nodes_[i].deps.size(); ++j )
+			while( !nodes_[ nodes_[i].deps[j] ].done && !error_ )
+				cv_.wait( lock );
+		return !error_;
+	}
+
+	void execute( int i )
+	{
+		try{
+			profile::timer ptimer( nodes_[i].name );
+			nodes_[i].fn();
+		}catch(...){
+			std::lock_guard<std::mutex> lock( mutex_ );
+			if( !error_ )
+				error_ = std::current_exception();
+		}
+
+		std::lock_guard<std::mutex> lock( mutex_ );
+		nodes_[i].done = true;
+		cv_.notify_all();
+	}
+
+	//! run all stages of one kind in order
+	void run_kind( kind_t kind )
+	{
+		for( int i=0; i<(int)nodes_.size(); ++i )
+			if( nodes_[i].kind == kind )
+			{
+				if( !wait_for( i ) )
+					return;
+				execute( i );
+			}
+	}
+
+public:
+
+	//! add a stage that may run once the stages deps have finished, returns its id
+	int add( const std::string& name, kind_t kind, const std::function<void()>& fn, const std::vector<int>& deps = std::vector<int>() )
+	{
+		int id = (int)nodes_.size();
+		for( size_t j=0; j<deps.size(); ++j )
+			if( deps[j] < 0 || deps[j] >= id )
+			{
+				LOGERR("Stage \'%s\' depends on a stage that was not added before it.", name.c_str());
+				throw std::runtime_error("task_graph::add : invalid dependency");
+			}
+
+		node n = { name, kind, fn, deps, false };
+		nodes_.push_back( n );
+		return id;
+	}
+
+	//! run all stages, with overlap the I/O stages are run on a separate thread
+	void run( bool overlap )
+	{
+		if( !overlap )
+		{
+			for( int i=0; i<(int)nodes_.size() && !error_; ++i )
+			{
+				LOGUSER("Running stage \'%s\'", nodes_[i].name.c_str());
+				execute( i );
+			}
+		}
+		else
+		{
+			std::thread io_thread( &task_graph::run_kind, this, io );
+			run_kind( compute );
+			io_thread.join();
+		}
+
+		nodes_.clear();
+
+		if( error_ )
+		{
+			std::exception_ptr e = error_;
+			error_ = std::exception_ptr();
+			std::rethrow_exception( e );
+		}
+	}
+};
+
+#endif //__TASK_GRAPH_HH
@@ -58,6 +58,94 @@ transfer_function_plugin *select_transfer_function_plugin( config_file& cf )
 	transfer_function_plugin *the_transfer_function_plugin 
 	= the_transfer_function_plugin_creator->create( cf );
 	
+	if( cf.getValueSafe<bool>( "cosmology", "transfer_cache", true ) )
+		the_transfer_function_plugin = new transfer_function_cached( cf, the_transfer_function_plugin );
+	
 	return the_transfer_function_plugin;
 }
 
+
+transfer_function_cached::transfer_function_cached( config_file& cf, transfer_function_plugin *ptf )
+: transfer_function_plugin( cf ), ptf_( ptf )
+{
+	cosmo_ = ptf_->cosmo_;
+	tf_distinct_ = ptf_->tf_distinct_;
+	tf_withvel_ = ptf_->tf_withvel_;
+	tf_withtotal0_ = ptf_->tf_withtotal0_;
+	tf_velunits_ = ptf_->tf_velunits_;
+	
+	kmin_ = ptf_->get_kmin();
+	kmax_ = ptf_->get_kmax();
+	
+	for( int i=0; i<ntypes; ++i )
+		built_[i] = false;
+}
+
+void transfer_function_cached::build( tf_type type )
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	if( built_[type] )
+		return;
+	
+	table& t = tab_[type];
+	t.f.clear();
+	
+	double L = log( kmax_/kmin_ );
+	if( !(kmin_ > 0.0 && L > 0.0 && L < 1e3) )
+	{
+		built_[type].store( true, std::memory_order_release );
+		return;
+	}
+	
+	const unsigned nmin = 16, nmax = 4096;	// nodes per e-fold
+	double err = 0.0;
+	std::vector<double> k, fc;
+	
+	for( unsigned nper = nmin; nper <= nmax; nper *= 2 )
+	{
+		size_t n = (size_t)ceil( L*nper ) + 1;
+		t.lnkmin = log( kmin_ );
+		t.idlnk = (n-1) / L;
+		
+		//... the nodes, and the points half-way between them to check the interpolation
+		k.resize( 2*n-1 );
+		for( size_t i=0; i<2*n-1; ++i )
+			k[i] = exp( t.lnkmin + 0.5*i/t.idlnk );
+		k[0] = kmin_;
+		k[2*n-2] = kmax_;
+		
+		fc.resize( 2*n-1 );
+		ptf_->compute_batch( &k[0], &fc[0], 2*n-1, type );
+		
+		t.f.resize( n );
+		for( size_t i=0; i<n; ++i )
+			t.f[i] = fc[2*i];
+		
+		err = 0.0;
+		for( size_t i=0; i<n-1; ++i )
+		{
+			double fscale = 0.0;
+			for( size_t j=(i>0? i-1 : 0); j<=std::min( i+2, n-1 ); ++j )
+				fscale = std::max( fscale, fabs(t.f[j]) );
+			
+			double d = fabs( t.eval( log(k[2*i+1]) ) - fc[2*i+1] );
+			if( d > 0.0 )
+				err = std::max( err, fscale > 0.0? d/fscale : 1.0 );
+		}
+		
+		if( err <= TF_TABLE_ERR )
+			break;
+	}
+	
+	if( err > TF_TABLE_ERR )
+	{
+		LOGWARN("Transfer function type %d could not be tabulated to accuracy %g (got %g), evaluating directly.",(int)type,TF_TABLE_ERR,err);
+		t.f.clear();
+	}
+	else
+		LOGINFO("Tabulated transfer function type %d on [%g,%g] with %llu nodes, max. rel. error %g.",
+			(int)type,kmin_,kmax_,(unsigned long long)t.f.size(),err);
+	
+	built_[type].store( true, std::memory_order_release );
+}
+
@@ -18,6 +18,13 @@
 #include <cmath>
 #include <stdexcept>
 #include <complex>
+#include <map>
+#include <deque>
+#include <cstring>
+#include <stdint.h>
+#include <memory>
+#include <atomic>
+#include <mutex>
 
 #include <gsl/gsl_errno.h>
 #include <gsl/gsl_spline.h>
@@ -32,6 +39,7 @@ enum tf_type{
 };
 
 #define GSL_INTEGRATION_ERR 1e-5
+#define TF_TABLE_ERR 1e-6
 
 //! Abstract base class for transfer functions
 /*!
@@ -46,11 +54,20 @@ public:
 	bool tf_withvel_;		//!< bool if also have velocity transfer functions
 	bool tf_withtotal0_;	//!< have the z=0 spectrum for normalisation purposes
 	bool tf_velunits_;		//!< velocities are in velocity units (km/s)
+	uint64_t id_;			//!< unique per instance, identifies the plug-in in caches since addresses are reused
+	
+protected:
+	static uint64_t next_id( void )
+	{
+		static std::atomic<uint64_t> n( 0 );
+		return ++n;
+	}
+	
 public:
 	
 	//! constructor
 	transfer_function_plugin( config_file& cf ) 
-	: pcf_( &cf ), tf_distinct_(false), tf_withvel_(false), tf_withtotal0_(false), tf_velunits_(false)
+	: pcf_( &cf ), tf_distinct_(false), tf_withvel_(false), tf_withtotal0_(false), tf_velunits_(false), id_( next_id() )
 	{
 		real_t zstart;
 		zstart				= pcf_->getValue<real_t>( "setup", "zstart" );
@@ -72,6 +89,13 @@ public:
 	
 	//! compute value of transfer function at waven umber
 	virtual double compute( double k, tf_type type) = 0;
+	
+	//! compute the transfer function at the n wave numbers k, store them in T
+	virtual void compute_batch( const double *k, double *T, size_t n, tf_type type )
+	{
+		for( size_t i=0; i<n; ++i )
+			T[i] = compute( k[i], type );
+	}
 
 	//! return maximum wave number allowed
 	virtual double get_kmax( void ) = 0;
@@ -130,9 +154,108 @@ struct transfer_function_plugin_creator_concrete : public transfer_function_plug
 
 typedef transfer_function_plugin transfer_function;
 
+//! select the plug-in [cosmology] transfer, wrapped in a transfer_function_cached unless [cosmology] transfer_cache = no
 transfer_function_plugin *select_transfer_function_plugin( config_file& cf );
 
 
+/*!
+ * @class transfer_function_cached
+ * @brief decorator that tabulates the transfer functions of another plug-in
+ *
+ * Each type is tabulated when it is first requested, on a grid uniform in log k
+ * between get_kmin() and get_kmax() of the plug-in, and interpolated with the
+ * cubic through the four nearest nodes. The number of nodes is doubled until
+ * the interpolation error half-way between all nodes, compared to the direct
+ * evaluation and relative to the nearby values, is below TF_TABLE_ERR; if that
+ * is not reached, the type is evaluated directly. Outside of the table the
+ * plug-in is called as well. Lookups in the tables are thread-safe.
+ */
+class transfer_function_cached : public transfer_function_plugin
+{
+protected:
+	struct table
+	{
+		double lnkmin, idlnk;
+		std::vector<double> f;
+		
+		inline double eval( double lnk ) const
+		{
+			double x = (lnk - lnkmin) * idlnk;
+			long i = std::min( std::max( (long)x, 1L ), (long)f.size()-3 );
+			double t = x - i;
+			const double *p = &f[i-1];
+			
+			return ( -t*(t-1.0)*(t-2.0)*p[0] + 3.0*(t+1.0)*(t-1.0)*(t-2.0)*p[1]
+					-3.0*(t+1.0)*t*(t-2.0)*p[2] + (t+1.0)*t*(t-1.0)*p[3] ) * (1.0/6.0);
+		}
+	};
+	
+	enum{ ntypes = total0+1 };
+	
+	transfer_function_plugin *ptf_;
+	double kmin_, kmax_;
+	table tab_[ntypes];
+	std::atomic<bool> built_[ntypes];
+	std::mutex mutex_;
+	
+	//! tabulate type, or leave its table empty if the accuracy is not reached
+	void build( tf_type type );
+	
+	inline const table& get_table( tf_type type )
+	{
+		if( !built_[type].load( std::memory_order_acquire ) )
+			build( type );
+		return tab_[type];
+	}
+	
+public:
+	//! take over the plug-in ptf, which is deleted with the decorator
+	transfer_function_cached( config_file& cf, transfer_function_plugin *ptf );
+	
+	~transfer_function_cached()
+	{	delete ptf_;	}
+	
+	double compute( double k, tf_type type )
+	{
+		const table& t = get_table( type );
+		if( t.f.empty() || !(k >= kmin_ && k <= kmax_) )
+			return ptf_->compute( k, type );
+		return t.eval( log(k) );
+	}
+	
+	void compute_batch( const double *k, double *T, size_t n, tf_type type )
+	{
+		const table& t = get_table( type );
+		if( t.f.empty() )
+		{
+			ptf_->compute_batch( k, T, n, type );
+			return;
+		}
+		
+		bool boutside = false;
+		#pragma omp parallel for reduction(||:boutside) if( n > 16384 )
+		for( long i=0; i<(long)n; ++i )
+		{
+			bool bin = k[i] >= kmin_ && k[i] <= kmax_;
+			T[i] = bin? t.eval( log(k[i]) ) : 0.0;
+			boutside = boutside || !bin;
+		}
+		
+		//... the plug-in itself is not necessarily thread-safe
+		if( boutside )
+			for( size_t i=0; i<n; ++i )
+				if( !(k[i] >= kmin_ && k[i] <= kmax_) )
+					T[i] = ptf_->compute( k[i], type );
+	}
+	
+	double get_kmax( void )
+	{	return kmax_;	}
+	
+	double get_kmin( void )
+	{	return kmin_;	}
+};
+
+
 /**********************************************************************/
 /**********************************************************************/
 /**********************************************************************/
@@ -217,6 +340,177 @@ public:
 	{
 		return sqrtpnorm_*pow(k,0.5*nspec_)*ptf_->compute(k,type_);
 	}
+	
+protected:
+	/*!
+	 * @brief table of sqrt(P(k)) with piecewise uniform spacing inside every octave
+	 *
+	 * The nodes are k = 2^(e0+i) * (1+j/nsub), j=0..nsub-1, so that octave and bin
+	 * follow directly from the exponent and mantissa bits of k and the lookup needs
+	 * no logarithm. Values are interpolated linearly between the nodes.
+	 */
+	struct table
+	{
+		double klo, khi;
+		int e0;
+		unsigned nsub;
+		std::vector<double> f;
+		
+		inline double eval( double k ) const
+		{
+			uint64_t b;
+			memcpy( &b, &k, sizeof(double) );
+			int ioct = (int)((b >> 52) & 0x7ff) - 1023 - e0;
+			b = (b & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;
+			double m;
+			memcpy( &m, &b, sizeof(double) );
+			
+			double x = (m - 1.0) * nsub;
+			unsigned j = (unsigned)x;
+			size_t idx = (size_t)ioct * nsub + j;
+			return f[idx] + (x - j) * (f[idx+1] - f[idx]);
+		}
+		
+		inline double node( size_t idx ) const
+		{
+			return ldexp( 1.0 + (double)(idx % nsub) / nsub, e0 + (int)(idx / nsub) );
+		}
+	};
+	
+	//! identifies a table by type, plug-in instance and normalisation
+	struct table_key
+	{
+		int type;
+		uint64_t id;
+		double pnorm, nspec;
+		
+		bool operator<( const table_key& o ) const
+		{
+			if( type != o.type ) return type < o.type;
+			if( id != o.id ) return id < o.id;
+			if( pnorm != o.pnorm ) return pnorm < o.pnorm;
+			return nspec < o.nspec;
+		}
+	};
+	
+	std::shared_ptr<const table> ptab_;
+	
+	//! tables already built, shared by all instances; a published table is never changed,
+	//! a larger one replaces it in the cache while earlier users keep their reference
+	static std::map< table_key, std::shared_ptr<const table> >& table_cache( void )
+	{
+		static std::map< table_key, std::shared_ptr<const table> > cache;
+		return cache;
+	}
+	
+	//! fill the table and return the largest relative error found at the bin centres
+	double fill_table( table& t, tf_type type ) const
+	{
+		int e1 = ilogb( t.khi );
+		size_t nbins = (size_t)(e1 - t.e0 + 1) * t.nsub;
+		t.f.assign( nbins + 1, 0.0 );
+		
+		//... the error of linear interpolation is largest half-way between the nodes
+		std::vector<double> k( 2*nbins+1 ), T( 2*nbins+1 );
+		for( size_t i=0; i<=nbins; ++i )
+			k[2*i] = t.node(i);
+		for( size_t i=0; i<nbins; ++i )
+			k[2*i+1] = 0.5*(k[2*i]+k[2*i+2]);
+		ptf_->compute_batch( &k[0], &T[0], k.size(), type );
+		
+		double fmax = 0.0;
+		for( size_t i=0; i<=nbins; ++i )
+		{
+			t.f[i] = sqrtpnorm_*pow(k[2*i],0.5*nspec_)*T[2*i];
+			fmax = std::max( fmax, fabs(t.f[i]) );
+		}
+		
+		//... near zero crossings the error is measured relative to a small fraction of the maximum
+		double errmax = 0.0;
+		for( size_t i=0; i<nbins; ++i )
+		{
+			double k0 = k[2*i], k1 = k[2*i+2], kc = k[2*i+1];
+			if( k1 < t.klo || k0 > t.khi )
+				continue;
+			double fc = sqrtpnorm_*pow(kc,0.5*nspec_)*T[2*i+1];
+			double err = fabs( t.eval(kc) - fc ) / (fabs(fc) + TF_TABLE_ERR * fmax);
+			errmax = std::max( errmax, err );
+		}
+		return errmax;
+	}
+	
+public:
+	/*!
+	 * @brief tabulate the transfer function on [kmin,kmax]
+	 *
+	 * The number of nodes per octave is doubled until the interpolation error is
+	 * below TF_TABLE_ERR. The table is built only once per type and range and is
+	 * used by compute_tab, outside of [kmin,kmax] the function is evaluated directly.
+	 */
+	void tabulate( double kmin, double kmax )
+	{
+		kmin = std::max( kmin, (double)ptf_->get_kmin() );
+		kmax = std::min( kmax, (double)ptf_->get_kmax() );
+		ptab_.reset();
+		
+		if( !(kmin > 0.0 && kmax > kmin) )
+			return;
+		
+		table_key key = { (int)type_, ptf_->id_, pnorm_, (double)nspec_ };
+		std::map< table_key, std::shared_ptr<const table> >::iterator it = table_cache().find( key );
+		if( it != table_cache().end() )
+		{
+			if( it->second->klo <= kmin && it->second->khi >= kmax )
+			{
+				ptab_ = it->second;
+				return;
+			}
+			
+			//... the replacement covers the range of the old table as well
+			kmin = std::min( kmin, it->second->klo );
+			kmax = std::max( kmax, it->second->khi );
+		}
+		
+		std::shared_ptr<table> t( new table );
+		t->klo = kmin;
+		t->khi = kmax;
+		t->e0 = ilogb( kmin );
+		
+		const unsigned nsubmax = 1<<14;
+		double err = 0.0;
+		for( t->nsub = 256; t->nsub <= nsubmax; t->nsub *= 2 )
+			if( (err = fill_table( *t, type_ )) <= TF_TABLE_ERR )
+				break;
+		
+		if( t->nsub > nsubmax )
+		{
+			LOGWARN("Transfer function table did not reach accuracy %g (got %g), evaluating directly.",TF_TABLE_ERR,err);
+			return;
+		}
+		
+		LOGINFO("Tabulated transfer function type %d on [%g,%g] with %u nodes, max. rel. error %g.",
+			(int)type_,kmin,kmax,(unsigned)t->f.size(),err);
+		
+		//... tables of other plug-in instances can no longer be requested
+		for( it = table_cache().begin(); it != table_cache().end(); )
+		{
+			if( it->first.id != key.id )
+				table_cache().erase( it++ );
+			else
+				++it;
+		}
+		
+		ptab_ = t;
+		table_cache()[ key ] = ptab_;
+	}
+	
+	//! evaluate using the table if one has been built for this k
+	inline real_t compute_tab( real_t k ) const
+	{
+		if( ptab_ && k >= ptab_->klo && k < ptab_->khi )
+			return (real_t)ptab_->eval( k );
+		return compute( k );
+	}
 };
 
 
@@ -239,7 +533,7 @@ public:
 	
 protected:
 	
-	real_t krgood( real_t mu, real_t q, real_t dlnr, real_t kr )
+	static real_t krgood( real_t mu, real_t q, real_t dlnr, real_t kr )
 	{
 		double krnew = kr;
 		complex cdgamma, zm, zp;
@@ -269,103 +563,51 @@ protected:
 		return krnew;
 	}
 	
-	void transform( real_t pnorm, unsigned N, real_t q, std::vector<double>& rr, std::vector<double>& TT )
+	/*!
+	 * @brief the sampling and mode coefficients of the FFTlog transform for N points, bias q and order mu
+	 *
+	 * The coefficients contain the complex Gamma functions, the phase and the FFT normalisation,
+	 * they do not depend on the transfer function and are computed only once.
+	 */
+	struct fftlog_coeffs
 	{
-		const double mu = 0.5;
-		double qmin = 1.0e-7, qmax = 1.0e+7;
-		
-		q = 0.0;
-		
-		//N = 16384;
-		N = 1<<12;
-		
-#ifdef NZERO_Q
-		q=0.4;
-		//q=-0.1;
-#endif
+		unsigned N;
+		double q, mu;
+		double k0, k0r0, dlnk, dlnr;
+		std::vector<complex> u;
+	};
+	
+	static const fftlog_coeffs& get_fftlog_coeffs( unsigned N, double q, double mu )
+	{
+		//... a deque keeps references to its elements valid
+		static std::deque<fftlog_coeffs> cache;
+		for( size_t i=0; i<cache.size(); ++i )
+			if( cache[i].N == N && cache[i].q == q && cache[i].mu == mu )
+				return cache[i];
 		
+		double qmin = 1.0e-7, qmax = 1.0e+7;
 		double kmin = qmin, kmax=qmax;
 		double rmin = qmin, rmax = qmax;
-		double k0 = exp(0.5*(log(kmax)+log(kmin)));
 		double r0 = exp(0.5*(log(rmax)+log(rmin)));
 		double L = log(rmax)-log(rmin);
-		double k0r0 = k0*r0;
-		double dlnk = L/N, dlnr = L/N;
-		
-		double sqrtpnorm = sqrt(pnorm);
 		
-		double dir = 1.0;
-		
-		double fftnorm = 1.0/N;
-		
-		fftw_complex *in, *out;
-		
-		in = new fftw_complex[N];
-		out = new fftw_complex[N];
+		fftlog_coeffs c;
+		c.N = N;
+		c.q = q;
+		c.mu = mu;
+		c.k0 = exp(0.5*(log(kmax)+log(kmin)));
+		c.dlnk = L/N;
+		c.dlnr = L/N;
 		
 		//... perform anti-ringing correction from Hamilton (2000)
-		k0r0 = krgood( mu, q, dlnr, k0r0 );
-		
-		std::string ofname;
-		switch( type_ )
-		{
-			case cdm:		
-				ofname = "input_powerspec_cdm.txt"; break;
-			case baryon:	
-				ofname = "input_powerspec_baryon.txt"; break;
-			case total:		
-				ofname = "input_powerspec_total.txt"; break;
-			case vcdm:		
-				ofname = "input_powerspec_vcdm.txt"; break;
-			case vbaryon:	
-				ofname = "input_powerspec_vbaryon.txt"; break;
-			default:
-				throw std::runtime_error("Unknown transfer function type in TransferFunction_real::transform");
-		}
-			
-		
-		std::ofstream ofsk(ofname.c_str());
-		double sum_in = 0.0;
-		
-		ofsk << "# The power spectrum definition is smaller than CAMB by a factor 8 pi^3."
-		    << std::endl;
-
-		for( unsigned i=0; i<N; ++i )
-		{
-			double k = k0*exp(((int)i - (int)N/2+1) * dlnk);
-			double T = ptf_->compute( k, type_ );
-			double del = sqrtpnorm*T*pow(k,0.5*nspec_);
-			
-			RE(in[i]) = del*pow(k,1.5-q);
-			IM(in[i]) = 0.0;
-			
-			sum_in += RE(in[i]);	
-			
-			ofsk << std::setw(16) << k <<std::setw(16) << del*del << std::setw(16) << T << std::endl;
-		}
-		ofsk.close();
-		
-#ifdef FFTW3
-	#ifdef SINGLE_PRECISION
-		fftwf_plan p,ip;
-		p = fftwf_plan_dft_1d(N, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
-		ip = fftwf_plan_dft_1d(N, out, in, FFTW_BACKWARD, FFTW_ESTIMATE);
-		fftwf_execute(p);
-	#else
-		fftw_plan p,ip;
-		p = fftw_plan_dft_1d(N, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
-		ip = fftw_plan_dft_1d(N, out, in, FFTW_BACKWARD, FFTW_ESTIMATE);
-		fftw_execute(p);
-	#endif
-#else
-		fftw_plan p,ip;
-		p = fftw_create_plan(N, FFTW_FORWARD, FFTW_ESTIMATE);
-		ip = fftw_create_plan(N, FFTW_BACKWARD, FFTW_ESTIMATE);
-		fftw_one(p, in, out);
-#endif
+		const double k0r0 = krgood( mu, q, c.dlnr, c.k0*r0 );
+		const double dir = 1.0, fftnorm = 1.0/N;
+		c.k0r0 = k0r0;
+		c.u.resize( N );
 		
 		//... compute the Hankel transform by convolution with the Bessel function
-		for( unsigned i=0; i<N; ++i )
+		#pragma omp parallel for
+		for( int i=0; i<(int)N; ++i )
 		{
 			int ii=i;
 			if( ii > (int)N/2 )
@@ -378,20 +620,12 @@ protected:
 			gsl_sf_lngamma_complex_e(zp.real(), zp.imag(), &g_a, &g_p);
 			
 			double arg = 2.0*(log(2.0/k0r0)*y+g_p.val);
-			//complex cu = complex(out[i].re,out[i].im)*std::polar(1.0,arg);
-			//out[i].re = cu.real()*fftnorm;
-			//out[i].im = cu.imag()*fftnorm;
-			
-			complex cu = complex( RE(out[i]), IM(out[i]) ) * std::polar(1.0,arg);
-			RE(out[i]) = cu.real()*fftnorm;
-			IM(out[i]) = cu.imag()*fftnorm;
-			
-			
-#else		
+			c.u[i] = std::polar(fftnorm,arg);
+#else
 			complex x(dir*q, (double)ii*2.0*M_PI/L);
 			gsl_sf_result g_a, g_p;
 			
-			complex g1, g2, garg, U, phase;						
+			complex g1, g2, garg, U, phase;
 			complex twotox = pow(complex(2.0,0.0),x);
 			
 			/////////////////////////////////////////////////////////
@@ -400,12 +634,11 @@ protected:
 			garg = 0.5*(mu+1.0+x);
 			gsl_sf_lngamma_complex_e (garg.real(), garg.imag(), &g_a, &g_p);
 			g1 = std::polar(exp(g_a.val),g_p.val);
-
 			
 			garg = 0.5*(mu+1.0-x);
 			gsl_sf_lngamma_complex_e (garg.real(), garg.imag(), &g_a, &g_p);
 			g2 = std::polar(exp(g_a.val),g_p.val);
-
+			
 			/////////////////////////////////////////////////////////
 			//.. compute U
 			
@@ -415,76 +648,146 @@ protected:
 				g1 = 1.0; g2 = 1.0;
 			}
 			
-			
 			U = twotox * g1 / g2;
 			phase = pow(complex(k0r0,0.0),complex(0.0,2.0*M_PI*(double)ii/L));
 			
-			complex cu = complex(RE(out[i]),IM(out[i]))*U*phase*fftnorm;
-			
-			RE(out[i]) = cu.real();
-			IM(out[i]) = cu.imag();
-
-			/*if( (RE(out[i]) != RE(out[i]))||(IM(out[i]) != IM(out[i])) )
-			{	std::cerr << "NaN @ i=" << i << ", U= " << U << ", phase = " << phase << ", g1 = " << g1 << ", g2 = " << g2 << std::endl;
-				std::cerr << "mu+1+q = " << mu+1.0+q << std::endl;
-				//break;
-			}*/
-			
+			c.u[i] = U*phase*fftnorm;
 #endif
-
 		}
 		
+		cache.push_back( c );
+		return cache.back();
+	}
+	
+	//! FFTlog transform of one transfer function type, with the input samples
+	struct transformed
+	{
+		uint64_t id;
+		double pnorm, nspec;
+		std::vector<double> k, Tk, rr, TT, TTim;
+		bool bfiles;
+	};
+	
+	//! transforms already computed, by type
+	static std::map<int,transformed>& transform_cache( void )
+	{
+		static std::map<int,transformed> cache;
+		return cache;
+	}
+	
+	//! transform the given types together, they share the coefficients and one multi-FFT
+	/*! types after the first one that the plug-in cannot evaluate are skipped */
+	static void transform_batch( real_t pnorm, unsigned N, real_t q, std::vector<tf_type> types )
+	{
+		const double mu = 0.5;
+		const fftlog_coeffs& c = get_fftlog_coeffs( N, q, mu );
+		const double sqrtpnorm = sqrt(pnorm);
+		
+		std::vector<double> kk( N );
+		for( unsigned i=0; i<N; ++i )
+			kk[i] = c.k0*exp(((int)i - (int)N/2+1) * c.dlnk);
+		
+		std::vector<transformed> res;
+		for( size_t it=0; it<types.size(); )
+		{
+			transformed t;
+			t.id = ptf_->id_;
+			t.pnorm = pnorm;
+			t.nspec = nspec_;
+			t.bfiles = false;
+			t.k = kk;
+			t.Tk.assign( N, 0.0 );
+			try{
+				ptf_->compute_batch( &kk[0], &t.Tk[0], N, types[it] );
+			}catch(...){
+				if( it == 0 )
+					throw;
+				types.erase( types.begin()+it );
+				continue;
+			}
+			res.push_back( t );
+			++it;
+		}
+		
+		const int ntypes = (int)types.size();
+		fftw_complex *in = new fftw_complex[(size_t)N*ntypes];
+		
+		for( int it=0; it<ntypes; ++it )
+		{
+			const transformed& t = res[it];
+			fftw_complex *p = in + (size_t)it*N;
+			#pragma omp parallel for
+			for( int i=0; i<(int)N; ++i )
+			{
+				double del = sqrtpnorm*t.Tk[i]*pow(kk[i],0.5*nspec_);
+				RE(p[i]) = del*pow(kk[i],1.5-q);
+				IM(p[i]) = 0.0;
+			}
+		}
+		
+		//... the types are transformed in place, one after the other in memory
 #ifdef FFTW3
 	#ifdef SINGLE_PRECISION
-		fftwf_execute(ip);
+		int n[1] = { (int)N };
+		fftwf_plan p = fftwf_plan_many_dft(1, n, ntypes, in, NULL, 1, N, in, NULL, 1, N, FFTW_FORWARD, FFTW_ESTIMATE);
+		fftwf_plan ip = fftwf_plan_many_dft(1, n, ntypes, in, NULL, 1, N, in, NULL, 1, N, FFTW_BACKWARD, FFTW_ESTIMATE);
+		fftwf_execute(p);
 	#else
-		fftw_execute(ip);
+		int n[1] = { (int)N };
+		fftw_plan p = fftw_plan_many_dft(1, n, ntypes, in, NULL, 1, N, in, NULL, 1, N, FFTW_FORWARD, FFTW_ESTIMATE);
+		fftw_plan ip = fftw_plan_many_dft(1, n, ntypes, in, NULL, 1, N, in, NULL, 1, N, FFTW_BACKWARD, FFTW_ESTIMATE);
+		fftw_execute(p);
 	#endif
 #else
-		fftw_one(ip, out, in);
+		fftw_plan p = fftw_create_plan(N, FFTW_FORWARD, FFTW_ESTIMATE|FFTW_IN_PLACE);
+		fftw_plan ip = fftw_create_plan(N, FFTW_BACKWARD, FFTW_ESTIMATE|FFTW_IN_PLACE);
+		fftw(p, ntypes, in, 1, N, NULL, 1, N);
 #endif
 		
-		rr.assign(N,0.0);
-		TT.assign(N,0.0);
-		
-		r0 = k0r0/k0;
-		
-		for( unsigned i=0; i<N; ++i )
+		#pragma omp parallel for
+		for( long j=0; j<(long)N*ntypes; ++j )
 		{
-			int ii = i;
-			ii -= N/2-1;
-			double r = r0*exp(-ii*dlnr);
-			
-			rr[N-i-1] = r;
-			TT[N-i-1] = 4.0*M_PI* sqrt(M_PI/2.0) *  RE(in[i]) * pow(r,-(1.5+q));
+			complex cu = complex( RE(in[j]), IM(in[j]) ) * c.u[j%N];
+			RE(in[j]) = cu.real();
+			IM(in[j]) = cu.imag();
 		}
 		
+#ifdef FFTW3
+	#ifdef SINGLE_PRECISION
+		fftwf_execute(ip);
+	#else
+		fftw_execute(ip);
+	#endif
+#else
+		fftw(ip, ntypes, in, 1, N, NULL, 1, N);
+#endif
 		
+		double r0 = c.k0r0/c.k0;
 		
+		for( int it=0; it<ntypes; ++it )
 		{
-			std::string fname;
-			if(type_==total) fname = "transfer_real_total.txt";
-			if(type_==cdm) fname = "transfer_real_cdm.txt";
-			if(type_==baryon) fname = "transfer_real_baryon.txt";
-			if(type_==vcdm) fname = "transfer_real_vcdm.txt";
-			if(type_==vbaryon) fname = "transfer_real_vbaryon.txt";
+			transformed& t = res[it];
+			const fftw_complex *pin = in + (size_t)it*N;
+			t.rr.assign(N,0.0);
+			t.TT.assign(N,0.0);
+			t.TTim.assign(N,0.0);
 			
-			std::ofstream ofs(fname.c_str());
-							  
-			for( unsigned i=0; i<N; ++i )
+			#pragma omp parallel for
+			for( int i=0; i<(int)N; ++i )
 			{
 				int ii = i;
 				ii -= N/2-1;
+				double r = r0*exp(-ii*c.dlnr);
 				
-				double r = r0*exp(-ii*dlnr);//r0*exp(ii*dlnr);
-
-				double T = 4.0*M_PI* sqrt(M_PI/2.0) *  RE(in[i]) * pow(r,-(1.5+q));
-				ofs << r << "\t\t" << T << "\t\t" << IM(in[i]) << std::endl;				
+				t.rr[N-i-1] = r;
+				t.TT[N-i-1] = 4.0*M_PI* sqrt(M_PI/2.0) *  RE(pin[i]) * pow(r,-(1.5+q));
+				t.TTim[N-i-1] = IM(pin[i]);
 			}
+			
+			transform_cache()[ (int)types[it] ] = t;
 		}
 		
 		delete[] in;
-		delete[] out;
 		
 #if defined(FFTW3) && defined(SINGLE_PRECISION)
 		fftwf_destroy_plan(p);
@@ -494,6 +797,96 @@ protected:
 		fftw_destroy_plan(ip);
 #endif
 	}
+	
+	//! write the input power spectrum and the real space transfer function of a type
+	static void write_transform( tf_type type, const transformed& t )
+	{
+		std::string ofname, fname;
+		switch( type )
+		{
+			case cdm:
+				ofname = "input_powerspec_cdm.txt"; fname = "transfer_real_cdm.txt"; break;
+			case baryon:
+				ofname = "input_powerspec_baryon.txt"; fname = "transfer_real_baryon.txt"; break;
+			case total:
+				ofname = "input_powerspec_total.txt"; fname = "transfer_real_total.txt"; break;
+			case vcdm:
+				ofname = "input_powerspec_vcdm.txt"; fname = "transfer_real_vcdm.txt"; break;
+			case vbaryon:
+				ofname = "input_powerspec_vbaryon.txt"; fname = "transfer_real_vbaryon.txt"; break;
+			default:
+				throw std::runtime_error("Unknown transfer function type in TransferFunction_real::transform");
+		}
+		
+		std::ofstream ofsk(ofname.c_str());
+		
+		ofsk << "# The power spectrum definition is smaller than CAMB by a factor 8 pi^3."
+		    << std::endl;
+		
+		double sqrtpnorm = sqrt(t.pnorm);
+		for( size_t i=0; i<t.k.size(); ++i )
+		{
+			double del = sqrtpnorm*t.Tk[i]*pow(t.k[i],0.5*t.nspec);
+			ofsk << std::setw(16) << t.k[i] <<std::setw(16) << del*del << std::setw(16) << t.Tk[i] << std::endl;
+		}
+		ofsk.close();
+		
+		std::ofstream ofs(fname.c_str());
+		size_t N = t.rr.size();
+		for( size_t i=0; i<N; ++i )
+			ofs << t.rr[N-i-1] << "\t\t" << t.TT[N-i-1] << "\t\t" << t.TTim[N-i-1] << std::endl;
+	}
+	
+	/*!
+	 * @brief FFTlog transform of the type_ transfer function
+	 *
+	 * On the first request, all types that the real-space kernels of this transfer function
+	 * can need are transformed together and kept for later instances.
+	 */
+	void transform( real_t pnorm, unsigned N, real_t q, std::vector<double>& rr, std::vector<double>& TT )
+	{
+		q = 0.0;
+		
+		//N = 16384;
+		N = 1<<12;
+		
+#ifdef NZERO_Q
+		q=0.4;
+		//q=-0.1;
+#endif
+		
+		if( type_ != cdm && type_ != baryon && type_ != total && type_ != vcdm && type_ != vbaryon )
+			throw std::runtime_error("Unknown transfer function type in TransferFunction_real::transform");
+		
+		std::map<int,transformed>::iterator it = transform_cache().find( (int)type_ );
+		if( it == transform_cache().end() || it->second.id != ptf_->id_ || it->second.pnorm != pnorm
+		   || it->second.nspec != nspec_ || it->second.rr.size() != N )
+		{
+			std::vector<tf_type> types( 1, type_ );
+			tf_type others[] = { total, cdm, baryon, vcdm, vbaryon };
+			for( int i=0; i<5; ++i )
+			{
+				bool bneeded = others[i] == total || others[i] == cdm
+					|| (others[i] == baryon && ptf_->tf_is_distinct())
+					|| (others[i] == vcdm && ptf_->tf_has_velocities())
+					|| (others[i] == vbaryon && ptf_->tf_is_distinct() && ptf_->tf_has_velocities());
+				if( others[i] != type_ && bneeded )
+					types.push_back( others[i] );
+			}
+			
+			transform_batch( pnorm, N, q, types );
+			it = transform_cache().find( (int)type_ );
+		}
+		
+		if( !it->second.bfiles )
+		{
+			write_transform( type_, it->second );
+			it->second.bfiles = true;
+		}
+		
+		rr = it->second.rr;
+		TT = it->second.TT;
+	}
 	std::vector<real_t> m_xtable,m_ytable,m_dytable;
 	double m_xmin, m_xmax, m_dx, m_rdx;
 	static tf_type type_;
@@ -0,0 +1,612 @@
+/*
+
+ wnoise_cache.hh - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010  Oliver Hahn
+
+ */
+
+#ifndef __WNOISE_CACHE_HH
+#define __WNOISE_CACHE_HH
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <deque>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "log.hh"
+
+/*!
+ * @brief lossless codec for planes of white noise values
+ *
+ * The values of a plane are split into byte planes (byte shuffle), and every byte
+ * plane is stored either verbatim or Huffman coded, whichever is smaller. For
+ * Gaussian white noise only the bytes holding sign and exponent are compressible,
+ * the mantissa bytes are essentially random and are stored verbatim.
+ */
+namespace wnoise_codec
+{
+	const unsigned maxcodelen = 16;
+
+	//! compute length limited Huffman code lengths for a byte histogram
+	inline void huffman_lengths( const size_t *freq_in, unsigned char *len )
+	{
+		std::vector<size_t> freq( freq_in, freq_in+256 );
+
+		while( true )
+		{
+			//... simple O(n^2) Huffman tree construction on at most 256 symbols
+			std::vector<size_t> w;
+			std::vector<int> parent, node_of;
+			node_of.assign( 256, -1 );
+
+			for( int s=0; s<256; ++s )
+				if( freq[s] > 0 )
+				{
+					node_of[s] = (int)w.size();
+					w.push_back( freq[s] );
+				}
+
+			memset( len, 0, 256 );
+			size_t nleaf = w.size();
+			if( nleaf == 0 )
+				return;
+			if( nleaf == 1 )
+			{
+				for( int s=0; s<256; ++s )
+					if( node_of[s] >= 0 ) len[s] = 1;
+				return;
+			}
+
+			parent.assign( 2*nleaf-1, -1 );
+			std::vector<bool> used( 2*nleaf-1, false );
+
+			for( size_t inode=nleaf; inode<2*nleaf-1; ++inode )
+			{
+				int a=-1, b=-1;
+				for( size_t q=0; q<inode; ++q )
+				{
+					if( used[q] ) continue;
+					if( a<0 || w[q] < w[a] ){ b = a; a = (int)q; }
+					else if( b<0 || w[q] < w[b] ) b = (int)q;
+				}
+				used[a] = used[b] = true;
+				parent[a] = parent[b] = (int)inode;
+				w.push_back( w[a] + w[b] );
+			}
+
+			unsigned lmax = 0;
+			for( int s=0; s<256; ++s )
+				if( node_of[s] >= 0 )
+				{
+					unsigned l = 0;
+					for( int q=node_of[s]; parent[q] >= 0; q=parent[q] ) ++l;
+					len[s] = (unsigned char)l;
+					lmax = std::max( lmax, l );
+				}
+
+			if( lmax <= maxcodelen )
+				return;
+
+			//... flatten the histogram until the code fits the decoding table
+			for( int s=0; s<256; ++s )
+				if( freq[s] > 0 ) freq[s] = (freq[s]+1)/2;
+		}
+	}
+
+	//! canonical codes from code lengths
+	inline void canonical_codes( const unsigned char *len, uint32_t *code )
+	{
+		uint32_t c = 0;
+		for( unsigned l=1; l<=maxcodelen; ++l )
+		{
+			for( int s=0; s<256; ++s )
+				if( len[s] == l )
+					code[s] = c++;
+			c <<= 1;
+		}
+	}
+
+	//! Huffman encode n bytes, returns false if the result would not be smaller
+	inline bool huffman_encode( const unsigned char *in, size_t n, std::vector<unsigned char>& out )
+	{
+		size_t freq[256] = {0};
+		for( size_t q=0; q<n; ++q ) ++freq[in[q]];
+
+		unsigned char len[256];
+		uint32_t code[256];
+		huffman_lengths( freq, len );
+		canonical_codes( len, code );
+
+		size_t nbits = 0;
+		for( int s=0; s<256; ++s ) nbits += freq[s] * len[s];
+		if( 256 + (nbits+7)/8 >= n )
+			return false;
+
+		out.assign( len, len+256 );
+		out.reserve( 256 + (nbits+7)/8 + 8 );
+
+		uint64_t acc = 0;
+		unsigned nacc = 0;
+		for( size_t q=0; q<n; ++q )
+		{
+			acc = (acc << len[in[q]]) | code[in[q]];
+			nacc += len[in[q]];
+			while( nacc >= 8 )
+			{
+				nacc -= 8;
+				out.push_back( (unsigned char)(acc >> nacc) );
+			}
+		}
+		if( nacc > 0 )
+			out.push_back( (unsigned char)(acc << (8-nacc)) );
+
+		return true;
+	}
+
+	//! decode n bytes from a Huffman coded buffer
+	inline void huffman_decode( const unsigned char *in, size_t nin, unsigned char *out, size_t n )
+	{
+		const unsigned char *len = in;
+		uint32_t code[256];
+		canonical_codes( len, code );
+
+		//... direct lookup table on the next maxcodelen bits
+		std::vector<uint16_t> table( 1u<<maxcodelen, 0 );
+		for( int s=0; s<256; ++s )
+			if( len[s] > 0 )
+			{
+				uint32_t first = code[s] << (maxcodelen-len[s]), count = 1u << (maxcodelen-len[s]);
+				for( uint32_t q=0; q<count; ++q )
+					table[first+q] = (uint16_t)((s << 8) | len[s]);
+			}
+
+		const unsigned char *p = in+256, *pend = in+nin;
+		uint64_t acc = 0;
+		unsigned nacc = 0;
+
+		for( size_t q=0; q<n; ++q )
+		{
+			while( nacc < maxcodelen )
+			{
+				acc = (acc << 8) | (p < pend ? *p++ : 0);
+				nacc += 8;
+			}
+			uint16_t e = table[(acc >> (nacc-maxcodelen)) & ((1u<<maxcodelen)-1)];
+			out[q] = (unsigned char)(e >> 8);
+			nacc -= (e & 0xff);
+		}
+	}
+
+	//! compress n values of size vsize bytes
+	inline void encode( const void *data, size_t n, size_t vsize, std::vector<unsigned char>& out )
+	{
+		const unsigned char *in = reinterpret_cast<const unsigned char*>( data );
+		std::vector<unsigned char> plane( n ), coded;
+
+		out.clear();
+		for( size_t b=0; b<vsize; ++b )
+		{
+			for( size_t q=0; q<n; ++q )
+				plane[q] = in[q*vsize+b];
+
+			bool bhuff = huffman_encode( &plane[0], n, coded );
+			const std::vector<unsigned char>& payload = bhuff ? coded : plane;
+			uint64_t sz = payload.size();
+
+			out.push_back( bhuff ? 1 : 0 );
+			out.insert( out.end(), reinterpret_cast<unsigned char*>(&sz), reinterpret_cast<unsigned char*>(&sz)+sizeof(uint64_t) );
+			out.insert( out.end(), payload.begin(), payload.end() );
+		}
+	}
+
+	//! decompress n values of size vsize bytes
+	inline void decode( const unsigned char *in, size_t nin, void *data, size_t n, size_t vsize )
+	{
+		unsigned char *outp = reinterpret_cast<unsigned char*>( data );
+		std::vector<unsigned char> plane( n );
+		const unsigned char *p = in, *pend = in+nin;
+
+		for( size_t b=0; b<vsize; ++b )
+		{
+			uint64_t sz;
+			if( p + 1 + sizeof(uint64_t) > pend )
+				throw std::runtime_error("corrupt compressed white noise plane");
+			unsigned char mode = *p++;
+			memcpy( &sz, p, sizeof(uint64_t) ); p += sizeof(uint64_t);
+			if( p + sz > pend || (mode == 0 && sz != n) || mode > 1 )
+				throw std::runtime_error("corrupt compressed white noise plane");
+
+			if( mode == 1 )
+				huffman_decode( p, sz, &plane[0], n );
+			else
+				memcpy( &plane[0], p, n );
+			p += sz;
+
+			for( size_t q=0; q<n; ++q )
+				outp[q*vsize+b] = plane[q];
+		}
+	}
+}
+
+
+/*!
+ * @brief plane-wise white noise cache file
+ *
+ * The raw format is three ints nx,ny,nz followed by the data, the compressed format
+ * starts with a magic number and stores every plane of constant i as one compressed
+ * record, prefixed by its size. Readers detect the format, so restarts work with both.
+ */
+template< typename T >
+class wnoise_cache_file
+{
+protected:
+	static const uint32_t magic_ = 0x434e574d;	//!< "MWNC"
+
+	FILE *fp_;
+	bool compressed_;
+	int nx_, ny_, nz_, iplane_;
+
+	//... read-ahead of the next compressed plane
+	std::thread *prefetch_;
+	std::vector<T> next_;
+	bool next_ok_;
+
+	void read_compressed_plane( T *data, bool& ok )
+	{
+		uint64_t sz;
+		std::vector<unsigned char> buf;
+		ok = fread( &sz, sizeof(uint64_t), 1, fp_ ) == 1;
+		if( ok )
+		{
+			buf.resize( sz );
+			ok = fread( &buf[0], 1, sz, fp_ ) == sz;
+		}
+		if( ok )
+		{
+			try{ wnoise_codec::decode( &buf[0], sz, data, (size_t)ny_*nz_, sizeof(T) ); }
+			catch(...){ ok = false; }
+		}
+	}
+
+	void start_prefetch( void )
+	{
+		if( !compressed_ || iplane_ >= nx_ )
+			return;
+		next_.resize( (size_t)ny_*nz_ );
+		prefetch_ = new std::thread( &wnoise_cache_file<T>::read_compressed_plane, this, &next_[0], std::ref(next_ok_) );
+	}
+
+	//! write n items of size sz, a short write (e.g. a full disk) is an error
+	void write_checked( const void *data, size_t sz, size_t n )
+	{
+		if( n > 0 && fwrite( data, sz, n, fp_ ) != n )
+		{
+			LOGERR("Could not write plane %d to white noise file.", iplane_);
+			throw std::runtime_error("Could not write to white noise file");
+		}
+	}
+
+	void wait_prefetch( void )
+	{
+		if( prefetch_ != NULL )
+		{
+			prefetch_->join();
+			delete prefetch_;
+			prefetch_ = NULL;
+		}
+	}
+
+public:
+	wnoise_cache_file( void )
+	: fp_( NULL ), compressed_( false ), nx_( 0 ), ny_( 0 ), nz_( 0 ), iplane_( 0 ), prefetch_( NULL ), next_ok_( false )
+	{ }
+
+	~wnoise_cache_file()
+	{
+		close();
+	}
+
+	//! create a cache file for writing
+	void create( const char *fname, int nx, int ny, int nz, bool compressed )
+	{
+		close();
+		fp_ = fopen( fname, "wb" );
+		if( fp_ == NULL )
+		{
+			LOGERR("Could not open white noise file \'%s\' for writing.", fname);
+			throw std::runtime_error("Could not open white noise file for writing");
+		}
+		compressed_ = compressed;
+		nx_ = nx; ny_ = ny; nz_ = nz; iplane_ = 0;
+
+		if( compressed_ )
+		{
+			uint32_t hdr[2] = { magic_, (uint32_t)sizeof(T) };
+			write_checked( hdr, sizeof(uint32_t), 2 );
+		}
+		int dims[3] = { nx, ny, nz };
+		write_checked( dims, sizeof(int), 3 );
+	}
+
+	//! open an existing cache file for reading, either format
+	bool open( const char *fname )
+	{
+		close();
+		fp_ = fopen( fname, "rb" );
+		if( fp_ == NULL )
+			return false;
+
+		uint32_t hdr[2];
+		if( fread( hdr, sizeof(uint32_t), 2, fp_ ) != 2 )
+			return false;
+
+		compressed_ = (hdr[0] == magic_);
+		if( compressed_ )
+		{
+			if( hdr[1] != sizeof(T) )
+			{
+				LOGERR("White noise file \'%s\' was written with a different floating point precision.", fname);
+				throw std::runtime_error("White noise file precision mismatch");
+			}
+		}
+		else
+			fseek( fp_, 0, SEEK_SET );
+
+		int dims[3];
+		if( fread( dims, sizeof(int), 3, fp_ ) != 3 )
+			return false;
+		nx_ = dims[0]; ny_ = dims[1]; nz_ = dims[2]; iplane_ = 0;
+
+		start_prefetch();
+		return true;
+	}
+
+	int size( int dim ) const
+	{
+		return (dim==0) ? nx_ : ((dim==1) ? ny_ : nz_);
+	}
+
+	//! write the next plane of ny*nz values
+	void write_plane( const T *data )
+	{
+		if( compressed_ )
+		{
+			std::vector<unsigned char> buf;
+			wnoise_codec::encode( data, (size_t)ny_*nz_, sizeof(T), buf );
+			uint64_t sz = buf.size();
+			write_checked( &sz, sizeof(uint64_t), 1 );
+			write_checked( &buf[0], 1, sz );
+		}
+		else
+			write_checked( data, sizeof(T), (size_t)ny_*nz_ );
+		++iplane_;
+	}
+
+	//! read the next plane of ny*nz values, the following plane is decoded in the background
+	void read_plane( T *data )
+	{
+		bool ok;
+		if( compressed_ )
+		{
+			ok = prefetch_ != NULL;
+			wait_prefetch();
+			ok = ok && next_ok_;
+			if( ok )
+				std::copy( next_.begin(), next_.end(), data );
+			if( iplane_+1 >= nx_ )
+				std::vector<T>().swap( next_ );
+		}
+		else
+			ok = fread( data, sizeof(T), (size_t)ny_*nz_, fp_ ) == (size_t)ny_*nz_;
+
+		if( !ok )
+		{
+			LOGERR("Could not read plane %d from white noise file.", iplane_);
+			throw std::runtime_error("Could not read from white noise file");
+		}
+
+		++iplane_;
+		start_prefetch();
+	}
+
+	//! skip the next n planes without decoding them
+	void skip_planes( int n )
+	{
+		if( n <= 0 )
+			return;
+
+		bool ok = iplane_+n <= nx_;
+		if( ok && compressed_ )
+		{
+			//... the prefetch has already consumed the next plane
+			wait_prefetch();
+			for( int i=1; ok && i<n; ++i )
+			{
+				uint64_t sz;
+				ok = fread( &sz, sizeof(uint64_t), 1, fp_ ) == 1 && fseek( fp_, (long)sz, SEEK_CUR ) == 0;
+			}
+		}
+		else if( ok )
+		{
+			for( int i=0; ok && i<n; ++i )
+				ok = fseek( fp_, (long)(sizeof(T)*ny_*nz_), SEEK_CUR ) == 0;
+		}
+
+		if( !ok )
+		{
+			LOGERR("Could not skip to plane %d of white noise file.", iplane_+n);
+			throw std::runtime_error("Could not read from white noise file");
+		}
+
+		iplane_ += n;
+		start_prefetch();
+	}
+
+	//! close a written file, throws if the buffered data could not be written
+	void finish( void )
+	{
+		wait_prefetch();
+		FILE *fp = fp_;
+		fp_ = NULL;
+		if( fp != NULL && fclose( fp ) != 0 )
+		{
+			LOGERR("Could not write white noise file.");
+			throw std::runtime_error("Could not write to white noise file");
+		}
+	}
+
+	void close( void )
+	{
+		wait_prefetch();
+		if( fp_ != NULL )
+			fclose( fp_ );
+		fp_ = NULL;
+	}
+};
+
+
+/*!
+ * @brief writes a cache file from a background thread
+ *
+ * Planes are handed over through a bounded queue, so at most max_planes planes
+ * are held in memory on top of the generator. Errors of the writer thread are
+ * rethrown by finish(), after an error further planes are dropped.
+ */
+template< typename T >
+class wnoise_cache_writer
+{
+protected:
+	wnoise_cache_file<T> file_;
+	size_t plane_size_, max_planes_, nbuffers_;
+	std::deque< std::vector<T>* > queue_;
+	std::vector< std::vector<T>* > free_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::exception_ptr error_;
+	bool stop_;
+	std::thread thread_;
+
+	void work( void )
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		while( true )
+		{
+			while( queue_.empty() && !stop_ )
+				cv_.wait( lock );
+			if( queue_.empty() )
+				break;
+
+			std::vector<T> *plane = queue_.front();
+			queue_.pop_front();
+			bool skip = (bool)error_;
+			lock.unlock();
+
+			std::exception_ptr e;
+			try{
+				if( !skip )
+					file_.write_plane( &(*plane)[0] );
+			}catch(...){
+				e = std::current_exception();
+			}
+
+			lock.lock();
+			if( e && !error_ )
+				error_ = e;
+			free_.push_back( plane );
+			cv_.notify_all();
+		}
+		lock.unlock();
+
+		try{
+			file_.finish();
+		}catch(...){
+			lock.lock();
+			if( !error_ )
+				error_ = std::current_exception();
+		}
+	}
+
+	void join( void )
+	{
+		{
+			std::lock_guard<std::mutex> lock( mutex_ );
+			stop_ = true;
+			cv_.notify_all();
+		}
+		if( thread_.joinable() )
+			thread_.join();
+	}
+
+public:
+	//! create the file on the calling thread and start the writer
+	wnoise_cache_writer( const char *fname, int nx, int ny, int nz, bool compressed, size_t max_planes )
+	: plane_size_( (size_t)ny*nz ), max_planes_( std::max( max_planes, (size_t)1 ) ), nbuffers_( 0 ), stop_( false )
+	{
+		file_.create( fname, nx, ny, nz, compressed );
+		thread_ = std::thread( &wnoise_cache_writer<T>::work, this );
+	}
+
+	~wnoise_cache_writer()
+	{
+		join();
+		for( size_t i=0; i<free_.size(); ++i )
+			delete free_[i];
+		for( size_t i=0; i<queue_.size(); ++i )
+			delete queue_[i];
+	}
+
+	//! a plane buffer to fill, waits while max_planes planes are in flight
+	std::vector<T>* acquire( void )
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		while( free_.empty() && nbuffers_ >= max_planes_ && !error_ )
+			cv_.wait( lock );
+		if( error_ )
+		{
+			lock.unlock();
+			finish();
+		}
+
+		if( free_.empty() )
+		{
+			++nbuffers_;
+			return new std::vector<T>( plane_size_ );
+		}
+		std::vector<T> *plane = free_.back();
+		free_.pop_back();
+		return plane;
+	}
+
+	//! queue the next plane for writing
+	void push( std::vector<T>* plane )
+	{
+		std::lock_guard<std::mutex> lock( mutex_ );
+		queue_.push_back( plane );
+		cv_.notify_all();
+	}
+
+	//! wait until all planes are written, rethrows an error of the writer thread
+	void finish( void )
+	{
+		join();
+		if( error_ )
+		{
+			std::exception_ptr e = error_;
+			error_ = std::exception_ptr();
+			std::rethrow_exception( e );
+		}
+	}
+};
+
+#endif //__WNOISE_CACHE_HH
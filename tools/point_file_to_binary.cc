@@ -0,0 +1,57 @@
+/*
+
+ point_file_to_binary.cc - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010-13  Oliver Hahn
+
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "point_file_reader.hh"
+
+//! converts an ASCII region point file into a binary point file, which MUSIC reads without parsing
+int main( int argc, char **argv )
+{
+  if( argc < 3 || (argc > 3 && strcmp(argv[3],"-f") != 0) )
+    {
+      printf("Usage: %s <point file> <binary point file> [-f]\n\n",argv[0]);
+      printf("  -f : store single precision values\n\n");
+      return 0;
+    }
+
+  try
+    {
+      std::vector<double> pp;
+      int ncols = point_reader::read_values_from_file( argv[1], pp );
+
+      if( ncols == 0 )
+	{
+	  printf("point file \'%s\' does not contain any points\n",argv[1]);
+	  return 1;
+	}
+
+      if( argc > 3 )
+	{
+	  std::vector<float> ppf( pp.begin(), pp.end() );
+	  point_reader::write_binary_point_file( argv[2], ncols, ppf );
+	}
+      else
+	point_reader::write_binary_point_file( argv[2], ncols, pp );
+
+      printf("wrote %llu points with %d columns to \'%s\'\n",(unsigned long long)(pp.size()/ncols),ncols,argv[2]);
+    }
+  catch( std::exception& e )
+    {
+      printf("%s\n",e.what());
+      return 1;
+    }
+
+  return 0;
+}